@@ -84,4 +84,8 @@
 
 #define SO_BPF_EXTENSIONS	48
 
+#define SO_INCOMING_CPU		49
+
+#define SO_ZEROCOPY		60
+
 #endif /* _ASM_SOCKET_H */
@@ -12,6 +12,7 @@
 #include <linux/netdevice.h>
 #include <linux/filter.h>
 #include <linux/if_vlan.h>
+#include <linux/seccomp.h>
 
 /*
  * Conventions :
@@ -110,6 +111,7 @@ do {								\
 #define SEEN_DATAREF 1 /* might call external helpers */
 #define SEEN_XREG    2 /* ebx is used */
 #define SEEN_MEM     4 /* use mem[] for temporary storage */
+#define SEEN_CALL    8 /* calls a C function, see seccomp_bpf_load() */
 
 static inline void bpf_flush_icache(void *start, void *end)
 {
@@ -240,6 +242,7 @@ void bpf_jit_compile(struct sk_filter *fp)
 		case BPF_S_LD_W_ABS:
 		case BPF_S_LD_H_ABS:
 		case BPF_S_LD_B_ABS:
+		case BPF_S_ANC_SECCOMP_LD_W:
 			/* first instruction sets A register (or is RET 'constant') */
 			break;
 		default:
@@ -600,6 +603,20 @@ common_load:			seen |= SEEN_DATAREF;
 				EMIT1_off32(0xbe, K);	/* mov imm32,%esi */
 				EMIT1_off32(0xe8, t_offset); /* call sk_load_byte_msh */
 				break;
+#ifdef CONFIG_SECCOMP_FILTER
+			case BPF_S_ANC_SECCOMP_LD_W:
+				/*
+				 * Seccomp filters never touch skb data, so only
+				 * %eax is live across the call: %ebx and mem[]
+				 * are callee-saved.
+				 */
+				seen |= SEEN_CALL;
+				func = (u8 *)seccomp_bpf_load;
+				t_offset = func - (image + addrs[i]);
+				EMIT1_off32(0xbf, K); /* mov imm32,%edi */
+				EMIT1_off32(0xe8, t_offset); /* call */
+				break;
+#endif
 			case BPF_S_LD_W_IND:
 				func = sk_load_word;
 common_load_ind:		seen |= SEEN_DATAREF | SEEN_XREG;
@@ -55,6 +55,7 @@ static void blkg_free(struct blkcg_gq *blkg)
 		kfree(blkg->pd[i]);
 
 	blk_exit_rl(&blkg->rl);
+	kfree(blkg->mq_share);
 	kfree(blkg);
 }
 
@@ -464,7 +465,7 @@ static int blkcg_reset_stats(struct cgroup *cgroup, struct cftype *cftype,
 	return 0;
 }
 
-static const char *blkg_dev_name(struct blkcg_gq *blkg)
+const char *blkg_dev_name(struct blkcg_gq *blkg)
 {
 	/* some drivers (floppy) instantiate a queue w/o disk registered */
 	if (blkg->q->backing_dev_info.dev)
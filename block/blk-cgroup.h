@@ -121,6 +121,9 @@ struct blkcg_gq {
 	struct blkg_policy_data		*pd[BLKCG_MAX_POLS];
 
 	struct rcu_head			rcu_head;
+
+	/* tags held on each hw queue of a blk-mq @q, see blk-mq-cgroup.c */
+	RH_KABI_EXTEND(struct blkg_mq_share *mq_share)
 };
 
 typedef void (blkcg_pol_init_pd_fn)(struct blkcg_gq *blkg);
@@ -166,6 +169,7 @@ void blkcg_print_blkgs(struct seq_file *sf, struct blkcg *blkcg,
 				     struct blkg_policy_data *, int),
 		       const struct blkcg_policy *pol, int data,
 		       bool show_total);
+const char *blkg_dev_name(struct blkcg_gq *blkg);
 u64 __blkg_prfill_u64(struct seq_file *sf, struct blkg_policy_data *pd, u64 v);
 u64 __blkg_prfill_rwstat(struct seq_file *sf, struct blkg_policy_data *pd,
 			 const struct blkg_rwstat *rwstat);
@@ -32,6 +32,8 @@
 #include <linux/delay.h>
 #include <linux/ratelimit.h>
 #include <linux/pm_runtime.h>
+#include <linux/virtinfo.h>
+#include <linux/ve_stats.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -1634,6 +1636,13 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
+	/*
+	 * Charge iops limits of the submitter when a new request is made
+	 * for its bio rather than in the elevator: blk-mq queues have no
+	 * elevator, and plugged requests reach it only at unplug.
+	 */
+	virtinfo_notifier_call_irq(VITYPE_IO, VIRTINFO_IO_OP_ACCOUNT, q);
+
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
 		req->cpu = raw_smp_processor_id();
 
@@ -1954,9 +1963,13 @@ void submit_bio(int rw, struct bio *bio)
 
 		if (rw & WRITE) {
 			count_vm_events(PGPGOUT, count);
+			ve_stat_add(get_exec_env(), VE_STAT_BLK_WRITE,
+				    bio->bi_size);
 		} else {
 			task_io_account_read(bio->bi_size);
 			count_vm_events(PGPGIN, count);
+			ve_stat_add(get_exec_env(), VE_STAT_BLK_READ,
+				    bio->bi_size);
 		}
 
 		if (unlikely(block_dump)) {
@@ -2415,6 +2428,9 @@ bool blk_update_request(struct request *req, int error, unsigned int nr_bytes)
 	if (!req->bio)
 		return false;
 
+	if (nr_bytes >= blk_rq_bytes(req))
+		blk_throtl_rq_done(req);
+
 	trace_block_rq_complete(req->q, req, nr_bytes);
 
 	/*
@@ -2870,6 +2886,76 @@ int blk_lld_busy(struct request_queue *q)
 }
 EXPORT_SYMBOL_GPL(blk_lld_busy);
 
+/**
+ * blk_poll - reap completions of a queue without waiting for interrupts
+ * @q: the queue
+ *
+ * Description:
+ *    Submitters of synchronous IO to fast devices can spin on this instead
+ *    of sleeping until their IO completes, which saves the interrupt and
+ *    wakeup latency. Callers should still be prepared for the interrupt
+ *    to complete the IO first and should stop spinning when they need to
+ *    reschedule.
+ *
+ * Return:
+ *    nonzero if any completions were found
+ */
+int blk_poll(struct request_queue *q)
+{
+	if (!blk_queue_poll(q))
+		return 0;
+
+	return q->poll_fn(q);
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
+/**
+ * blk_poll_sleep - sleep through the first half of expected IO time
+ * @q: the queue
+ * @start: when the IO was submitted
+ *
+ * Polling all the time the device takes wastes a CPU. Sleep until half
+ * of the mean completion time of polled IO on @q has passed since @start.
+ */
+void blk_poll_sleep(struct request_queue *q, ktime_t start)
+{
+	u64 half = ACCESS_ONCE(q->poll_nsec) / 2;
+	s64 elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	ktime_t kt;
+
+	if (elapsed < 0 || half <= elapsed)
+		return;
+
+	kt = ns_to_ktime(half - elapsed);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&kt, HRTIMER_MODE_REL);
+}
+EXPORT_SYMBOL_GPL(blk_poll_sleep);
+
+/**
+ * blk_poll_account - account completion time of polled IO
+ * @q: the queue
+ * @start: when the IO was submitted
+ *
+ * Keeps a running average for blk_poll_sleep(). Races between pollers
+ * only make the average less precise.
+ */
+void blk_poll_account(struct request_queue *q, ktime_t start)
+{
+	s64 nsec = ktime_to_ns(ktime_sub(ktime_get(), start));
+	u64 mean = ACCESS_ONCE(q->poll_nsec);
+
+	if (nsec <= 0)
+		return;
+
+	if (mean)
+		mean = mean - (mean >> 3) + ((u64)nsec >> 3);
+	else
+		mean = nsec;
+	ACCESS_ONCE(q->poll_nsec) = mean;
+}
+EXPORT_SYMBOL_GPL(blk_poll_account);
+
 /**
  * blk_rq_unprep_clone - Helper function to free all bios in a cloned request
  * @rq: the clone request to be cleaned up
@@ -0,0 +1,172 @@
+/*
+ * Weighted sharing of blk-mq tags between blkio cgroups.
+ *
+ * Multiqueue devices bypass the elevator, so cfq weights of blkio cgroups
+ * (also set from UB io priorities) have no effect on them. Instead of
+ * queueing requests per group, limit how many tags of a hardware context
+ * each group may hold. While a single group issues IO on a hardware
+ * context it may use all of its tags. Once several groups are active
+ * there, each one is allowed a share of the tag depth proportional to its
+ * weight, and a group over its share sleeps for a tag the same way as
+ * when the map is exhausted. Tags are what a saturated fast device is
+ * short of, so groups get throughput according to their weights without
+ * any dispatch scheduling in the submission path.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-cgroup.h"
+#include "blk-mq.h"
+
+/*
+ * Groups over their share are still allowed that many tags, so that
+ * a tiny weight can't stall a group behind a deep queue.
+ */
+#define BLK_MQ_CG_MIN_TAGS	4U
+
+struct blkg_mq_share {
+	atomic_t	nr_active;	/* tags held on this hw queue */
+	unsigned int	weight;		/* contribution to hctx->cg_weight */
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Per hw queue state is allocated on first use: the root blkg can be
+ * created before the queue knows how many hw queues it has.
+ */
+static struct blkg_mq_share *blkg_mq_share(struct blkcg_gq *blkg,
+					   struct request_queue *q)
+{
+	struct blkg_mq_share *share = ACCESS_ONCE(blkg->mq_share);
+
+	if (likely(share))
+		return share;
+
+	share = kzalloc_node(q->nr_hw_queues * sizeof(*share),
+			     GFP_NOWAIT | __GFP_NOWARN, q->node);
+	if (share && cmpxchg(&blkg->mq_share, NULL, share)) {
+		kfree(share);
+		share = blkg->mq_share;
+	}
+	return share;
+}
+
+/**
+ * blk_mq_cg_get - find and pin the blkg a bio is to be accounted to
+ * @q: multiqueue request_queue
+ * @bio: bio a request is to be allocated for
+ *
+ * Returns %NULL if the group can't be found or set up, the request is
+ * then not accounted to any group.
+ */
+struct blkcg_gq *blk_mq_cg_get(struct request_queue *q, struct bio *bio)
+{
+	struct blkcg *blkcg;
+	struct blkcg_gq *blkg;
+
+	rcu_read_lock();
+	blkcg = bio_blkcg(bio);
+	blkg = blkg_lookup(blkcg, q);
+	if (unlikely(!blkg)) {
+		spin_lock_irq(q->queue_lock);
+		blkg = blkg_lookup_create(blkcg, q);
+		if (IS_ERR(blkg))
+			blkg = NULL;
+		else
+			blkg_get(blkg);
+		spin_unlock_irq(q->queue_lock);
+	} else if (!atomic_inc_not_zero(&blkg->refcnt))
+		blkg = NULL;	/* being destroyed */
+	rcu_read_unlock();
+
+	if (blkg && unlikely(!blkg_mq_share(blkg, q))) {
+		blkg_put(blkg);
+		blkg = NULL;
+	}
+	return blkg;
+}
+
+void blk_mq_cg_put(struct blkcg_gq *blkg)
+{
+	if (blkg)
+		blkg_put(blkg);
+}
+
+/**
+ * blk_mq_cg_may_queue - may @blkg take one more tag of @hctx
+ * @hctx: hardware context the tag is allocated from
+ * @blkg: group of the request, may be %NULL
+ * @depth: depth of the tag map
+ */
+bool blk_mq_cg_may_queue(struct blk_mq_hw_ctx *hctx, struct blkcg_gq *blkg,
+			 unsigned int depth)
+{
+	struct blkg_mq_share *share;
+	unsigned int active, total, limit;
+
+	if (!hctx || !blkg)
+		return true;
+
+	share = &blkg->mq_share[hctx->queue_num];
+	active = atomic_read(&share->nr_active);
+	if (!active)
+		return true;
+
+	/* nobody else is active on this hw queue */
+	total = ACCESS_ONCE(hctx->cg_weight);
+	if (total <= share->weight)
+		return true;
+
+	limit = max(depth * share->weight / total, BLK_MQ_CG_MIN_TAGS);
+	return active < limit;
+}
+
+/*
+ * Account a tag of @hctx taken for @rq to @blkg. The request now owns
+ * the reference on @blkg and keeps it in rq->rl, which blk-mq does not
+ * use otherwise.
+ */
+void blk_mq_cg_rq_start(struct blk_mq_hw_ctx *hctx, struct request *rq,
+			struct blkcg_gq *blkg)
+{
+	struct blkg_mq_share *share = &blkg->mq_share[hctx->queue_num];
+	unsigned long flags;
+
+	rq->rl = &blkg->rl;
+
+	if (atomic_inc_not_zero(&share->nr_active))
+		return;
+
+	spin_lock_irqsave(&hctx->cg_lock, flags);
+	if (atomic_inc_return(&share->nr_active) == 1) {
+		share->weight = max(blkg->blkcg->cfq_weight, 1U);
+		hctx->cg_weight += share->weight;
+	}
+	spin_unlock_irqrestore(&hctx->cg_lock, flags);
+}
+
+void blk_mq_cg_rq_done(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct blkcg_gq *blkg;
+	struct blkg_mq_share *share;
+	unsigned long flags;
+
+	if (!rq->rl)
+		return;
+
+	blkg = container_of(rq->rl, struct blkcg_gq, rl);
+	share = &blkg->mq_share[hctx->queue_num];
+	rq->rl = NULL;
+
+	if (!atomic_add_unless(&share->nr_active, -1, 1)) {
+		spin_lock_irqsave(&hctx->cg_lock, flags);
+		if (atomic_dec_and_test(&share->nr_active))
+			hctx->cg_weight -= share->weight;
+		spin_unlock_irqrestore(&hctx->cg_lock, flags);
+	}
+
+	blkg_put(blkg);
+}
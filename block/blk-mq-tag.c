@@ -173,13 +173,15 @@ restart:
  * until the map is exhausted.
  */
 static int __bt_get(struct blk_mq_hw_ctx *hctx, struct blk_mq_bitmap_tags *bt,
-		    unsigned int *tag_cache)
+		    unsigned int *tag_cache, struct blkcg_gq *blkg)
 {
 	unsigned int last_tag, org_last_tag;
 	int index, i, tag;
 
 	if (!hctx_may_queue(hctx, bt))
 		return -1;
+	if (!blk_mq_cg_may_queue(hctx, blkg, bt->depth))
+		return -1;
 
 	last_tag = org_last_tag = *tag_cache;
 	index = TAG_TO_INDEX(bt, last_tag);
@@ -239,7 +241,7 @@ static int bt_get(struct blk_mq_alloc_data *data,
 	DEFINE_WAIT(wait);
 	int tag;
 
-	tag = __bt_get(hctx, bt, last_tag);
+	tag = __bt_get(hctx, bt, last_tag, data->blkg);
 	if (tag != -1)
 		return tag;
 
@@ -250,7 +252,7 @@ static int bt_get(struct blk_mq_alloc_data *data,
 	do {
 		prepare_to_wait(&bs->wait, &wait, TASK_UNINTERRUPTIBLE);
 
-		tag = __bt_get(hctx, bt, last_tag);
+		tag = __bt_get(hctx, bt, last_tag, data->blkg);
 		if (tag != -1)
 			break;
 
@@ -21,6 +21,7 @@
 #include <linux/sched/sysctl.h>
 #include <linux/delay.h>
 #include <linux/crash_dump.h>
+#include <linux/virtinfo.h>
 
 #include <trace/events/block.h>
 
@@ -214,6 +215,8 @@ __blk_mq_alloc_request(struct blk_mq_alloc_data *data, int rw)
 
 		rq->tag = tag;
 		blk_mq_rq_ctx_init(data->q, data->ctx, rq, rw);
+		if (data->blkg)
+			blk_mq_cg_rq_start(data->hctx, rq, data->blkg);
 		return rq;
 	}
 
@@ -261,6 +264,7 @@ static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
 
 	if (rq->cmd_flags & REQ_MQ_INFLIGHT)
 		atomic_dec(&hctx->nr_active);
+	blk_mq_cg_rq_done(hctx, rq);
 	rq->cmd_flags = 0;
 
 	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
@@ -388,6 +392,8 @@ void blk_mq_start_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
 
+	set_io_start_time_ns(rq);
+
 	trace_block_rq_issue(q, rq);
 
 	rq->resid_len = blk_rq_bytes(rq);
@@ -1103,12 +1109,15 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 	struct request *rq;
 	int rw = bio_data_dir(bio);
 	struct blk_mq_alloc_data alloc_data;
+	struct blkcg_gq *blkg;
 
 	if (unlikely(blk_mq_queue_enter(q))) {
 		bio_endio(bio, -EIO);
 		return NULL;
 	}
 
+	blkg = blk_mq_cg_get(q, bio);
+
 	ctx = blk_mq_get_ctx(q);
 	hctx = q->mq_ops->map_queue(q, ctx->cpu);
 
@@ -1118,6 +1127,7 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 	trace_block_getrq(q, bio, rw);
 	blk_mq_set_alloc_data(&alloc_data, q, GFP_ATOMIC, false, ctx,
 			hctx);
+	alloc_data.blkg = blkg;
 	rq = __blk_mq_alloc_request(&alloc_data, rw);
 	if (unlikely(!rq)) {
 		__blk_mq_run_hw_queue(hctx);
@@ -1128,11 +1138,17 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 		hctx = q->mq_ops->map_queue(q, ctx->cpu);
 		blk_mq_set_alloc_data(&alloc_data, q,
 				__GFP_WAIT|GFP_ATOMIC, false, ctx, hctx);
+		alloc_data.blkg = blkg;
 		rq = __blk_mq_alloc_request(&alloc_data, rw);
 		ctx = alloc_data.ctx;
 		hctx = alloc_data.hctx;
+		if (unlikely(!rq))
+			blk_mq_cg_put(blkg);
 	}
 
+	/* see blk_queue_bio() */
+	virtinfo_notifier_call_irq(VITYPE_IO, VIRTINFO_IO_OP_ACCOUNT, q);
+
 	hctx->queued++;
 	data->hctx = hctx;
 	data->ctx = ctx;
@@ -1562,6 +1578,8 @@ static int blk_mq_init_hw_queues(struct request_queue *q,
 		INIT_DELAYED_WORK(&hctx->delay_work, blk_mq_delay_work_fn);
 		spin_lock_init(&hctx->lock);
 		INIT_LIST_HEAD(&hctx->dispatch);
+		spin_lock_init(&hctx->cg_lock);
+		hctx->cg_weight = 0;
 		hctx->queue = q;
 		hctx->queue_num = i;
 		hctx->flags = set->flags;
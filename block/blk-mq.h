@@ -105,6 +105,9 @@ struct blk_mq_alloc_data {
 	/* input & output parameter */
 	struct blk_mq_ctx *ctx;
 	struct blk_mq_hw_ctx *hctx;
+
+	/* blkio cgroup to account the request to, may be NULL */
+	struct blkcg_gq *blkg;
 };
 
 static inline void blk_mq_set_alloc_data(struct blk_mq_alloc_data *data,
@@ -117,6 +120,41 @@ static inline void blk_mq_set_alloc_data(struct blk_mq_alloc_data *data,
 	data->reserved = reserved;
 	data->ctx = ctx;
 	data->hctx = hctx;
+	data->blkg = NULL;
 }
 
+/*
+ * Weighted tag sharing between blkio cgroups, see blk-mq-cgroup.c
+ */
+struct blkcg_gq;
+#ifdef CONFIG_BLK_MQ_CGROUP
+extern struct blkcg_gq *blk_mq_cg_get(struct request_queue *q,
+				      struct bio *bio);
+extern void blk_mq_cg_put(struct blkcg_gq *blkg);
+extern bool blk_mq_cg_may_queue(struct blk_mq_hw_ctx *hctx,
+				struct blkcg_gq *blkg, unsigned int depth);
+extern void blk_mq_cg_rq_start(struct blk_mq_hw_ctx *hctx,
+			       struct request *rq, struct blkcg_gq *blkg);
+extern void blk_mq_cg_rq_done(struct blk_mq_hw_ctx *hctx,
+			      struct request *rq);
+#else
+static inline struct blkcg_gq *blk_mq_cg_get(struct request_queue *q,
+					     struct bio *bio)
+{
+	return NULL;
+}
+static inline void blk_mq_cg_put(struct blkcg_gq *blkg) { }
+static inline bool blk_mq_cg_may_queue(struct blk_mq_hw_ctx *hctx,
+				       struct blkcg_gq *blkg,
+				       unsigned int depth)
+{
+	return true;
+}
+static inline void blk_mq_cg_rq_start(struct blk_mq_hw_ctx *hctx,
+				      struct request *rq,
+				      struct blkcg_gq *blkg) { }
+static inline void blk_mq_cg_rq_done(struct blk_mq_hw_ctx *hctx,
+				     struct request *rq) { }
+#endif
+
 #endif
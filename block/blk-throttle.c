@@ -21,6 +21,28 @@ static int throtl_quantum = 32;
 /* Throttling is performed over 100ms slice and after that slice is renewed */
 static unsigned long throtl_slice = HZ/10;	/* 100 ms */
 
+/* Completion latency is averaged and checked against targets over this */
+static unsigned long throtl_lat_window = HZ/4;	/* 250 ms */
+
+/* Groups held back for a latency target get at least this many iops */
+#define THROTL_LAT_MIN_IOPS	16
+#define THROTL_LAT_MAX_SCALE	8
+
+/*
+ * Groups under their limits dispatch without queue_lock from a budget
+ * cached per cpu: a part of what is still allowed in the current slice
+ * window, charged to the group in advance. See tg_budget_refill().
+ */
+#define THROTL_BUDGET_SHARE	8		/* of what is left */
+#define THROTL_BUDGET_MAX_BYTES	(1024 * 1024)
+#define THROTL_BUDGET_MAX_IOS	32
+
+/*
+ * Histograms of queue and service time of requests: bucket i counts
+ * times in [2^i, 2^(i+1)) usecs, the first and last ones are open.
+ */
+#define THROTL_LAT_HIST_NR	20
+
 static struct blkcg_policy blkcg_policy_throtl;
 
 /* A workqueue to queue throttle related work */
@@ -89,6 +111,16 @@ struct tg_stats_cpu {
 	struct blkg_rwstat		service_bytes;
 	/* total IOs serviced, post merge */
 	struct blkg_rwstat		serviced;
+
+	/* queue and service time histograms, see blk_throtl_rq_done() */
+	unsigned long			queue_hist[THROTL_LAT_HIST_NR];
+	unsigned long			service_hist[THROTL_LAT_HIST_NR];
+
+	/* dispatch budget charged to the group in advance */
+	u64				budget_bytes[2];
+	unsigned int			budget_ios[2];
+	unsigned long			budget_expire[2];
+	unsigned int			budget_gen[2];
 };
 
 struct throtl_grp {
@@ -127,12 +159,26 @@ struct throtl_grp {
 	/* are there any throtl rules between this group and td? */
 	bool has_rules[2];
 
+	/* bumped when rules change to invalidate cached budgets */
+	unsigned int budget_gen;
+
 	/* bytes per second rate limits */
 	uint64_t bps[2];
 
 	/* IOPS limits */
 	unsigned int iops[2];
 
+	/* target average completion latency in usecs, -1 if none */
+	unsigned int latency_target;
+
+	/* completions in the current latency window, under td->lat_lock */
+	unsigned long lat_window_start;
+	u64 lat_sum;			/* nsecs */
+	unsigned int lat_nr;
+
+	/* completion rate when the group was not held back, ios per sec */
+	unsigned int lat_base_iops;
+
 	/* Number of bytes disptached in current slice */
 	uint64_t bytes_disp[2];
 	/* Number of bio's dispatched in current slice */
@@ -166,6 +212,18 @@ struct throtl_data
 
 	/* Work for dispatching throttled bios */
 	struct work_struct dispatch_work;
+
+	/*
+	 * Latency targets. When a group misses its target, all groups with
+	 * no target or a looser one are capped to their completion rate
+	 * shifted right by the scale. The scale grows with each missed
+	 * window and drops by one for each window without misses.
+	 */
+	spinlock_t lat_lock;
+	unsigned int nr_lat_targets;	/* under queue_lock */
+	unsigned int lat_missed;	/* tightest missed target */
+	unsigned int lat_scale;		/* as of lat_miss_time */
+	unsigned long lat_miss_time;
 };
 
 /* list and work item to allocate percpu group stats */
@@ -434,6 +492,8 @@ static void throtl_pd_init(struct blkcg_gq *blkg)
 	tg->bps[WRITE] = -1;
 	tg->iops[READ] = -1;
 	tg->iops[WRITE] = -1;
+	tg->latency_target = -1;
+	tg->lat_window_start = jiffies;
 
 	/*
 	 * Ugh... We need to perform per-cpu allocation for tg->stats_cpu
@@ -459,6 +519,9 @@ static void tg_update_has_rules(struct throtl_grp *tg)
 	for (rw = READ; rw <= WRITE; rw++)
 		tg->has_rules[rw] = (parent_tg && parent_tg->has_rules[rw]) ||
 				    (tg->bps[rw] != -1 || tg->iops[rw] != -1);
+
+	/* budgets cached per cpu were taken under the old rules */
+	tg->budget_gen++;
 }
 
 static void throtl_pd_online(struct blkcg_gq *blkg)
@@ -475,6 +538,9 @@ static void throtl_pd_exit(struct blkcg_gq *blkg)
 	struct throtl_grp *tg = blkg_to_tg(blkg);
 	unsigned long flags;
 
+	if (tg->latency_target != -1)
+		tg->td->nr_lat_targets--;
+
 	spin_lock_irqsave(&tg_stats_alloc_lock, flags);
 	list_del_init(&tg->stats_alloc_node);
 	spin_unlock_irqrestore(&tg_stats_alloc_lock, flags);
@@ -497,6 +563,8 @@ static void throtl_pd_reset_stats(struct blkcg_gq *blkg)
 
 		blkg_rwstat_reset(&sc->service_bytes);
 		blkg_rwstat_reset(&sc->serviced);
+		memset(sc->queue_hist, 0, sizeof(sc->queue_hist));
+		memset(sc->service_hist, 0, sizeof(sc->service_hist));
 	}
 }
 
@@ -776,7 +844,7 @@ static inline void throtl_trim_slice(struct throtl_grp *tg, bool rw)
 	do_div(tmp, HZ);
 	bytes_trim = tmp;
 
-	io_trim = (tg->iops[rw] * throtl_slice * nr_slices)/HZ;
+	io_trim = (tg_iops(tg, rw) * throtl_slice * nr_slices)/HZ;
 
 	if (!bytes_trim && !io_trim)
 		return;
@@ -799,10 +867,54 @@ static inline void throtl_trim_slice(struct throtl_grp *tg, bool rw)
 		   tg->slice_start[rw], tg->slice_end[rw], jiffies);
 }
 
+static unsigned int td_lat_scale(struct throtl_data *td)
+{
+	unsigned int scale = ACCESS_ONCE(td->lat_scale);
+	unsigned long windows;
+
+	if (!scale)
+		return 0;
+
+	windows = (jiffies - ACCESS_ONCE(td->lat_miss_time)) /
+		  throtl_lat_window;
+	return windows < scale ? scale - windows : 0;
+}
+
+/*
+ * Is @tg held back in favour of a group with a tighter latency target?
+ * The root group is never held back: all other groups are below it.
+ */
+static bool tg_lat_throttled(struct throtl_grp *tg)
+{
+	struct throtl_data *td = tg->td;
+
+	if (!td->nr_lat_targets || !tg_to_blkg(tg)->parent)
+		return false;
+
+	return td_lat_scale(td) &&
+	       tg->latency_target > ACCESS_ONCE(td->lat_missed);
+}
+
+/* The configured iops limit, lowered while the group is held back */
+static unsigned int tg_iops(struct throtl_grp *tg, bool rw)
+{
+	unsigned int iops = tg->iops[rw];
+	unsigned int scale, lat_iops;
+
+	if (!tg_lat_throttled(tg))
+		return iops;
+
+	scale = td_lat_scale(tg->td);
+	lat_iops = max_t(unsigned int, tg->lat_base_iops >> scale,
+			 THROTL_LAT_MIN_IOPS);
+	return min(iops, lat_iops);
+}
+
 static bool tg_with_in_iops_limit(struct throtl_grp *tg, struct bio *bio,
 				  unsigned long *wait)
 {
 	bool rw = bio_data_dir(bio);
+	unsigned int iops = tg_iops(tg, rw);
 	unsigned int io_allowed;
 	unsigned long jiffy_elapsed, jiffy_wait, jiffy_elapsed_rnd;
 	u64 tmp;
@@ -822,7 +934,7 @@ static bool tg_with_in_iops_limit(struct throtl_grp *tg, struct bio *bio,
 	 * have been trimmed.
 	 */
 
-	tmp = (u64)tg->iops[rw] * jiffy_elapsed_rnd;
+	tmp = (u64)iops * jiffy_elapsed_rnd;
 	do_div(tmp, HZ);
 
 	if (tmp > UINT_MAX)
@@ -837,7 +949,7 @@ static bool tg_with_in_iops_limit(struct throtl_grp *tg, struct bio *bio,
 	}
 
 	/* Calc approx time to dispatch */
-	jiffy_wait = ((tg->io_disp[rw] + 1) * HZ)/tg->iops[rw] + 1;
+	jiffy_wait = ((tg->io_disp[rw] + 1) * HZ)/iops + 1;
 
 	if (jiffy_wait > jiffy_elapsed)
 		jiffy_wait = jiffy_wait - jiffy_elapsed;
@@ -911,7 +1023,7 @@ static bool tg_may_dispatch(struct throtl_grp *tg, struct bio *bio,
 	       bio != throtl_peek_queued(&tg->service_queue.queued[rw]));
 
 	/* If tg->bps = -1, then BW is unlimited */
-	if (tg->bps[rw] == -1 && tg->iops[rw] == -1) {
+	if (tg->bps[rw] == -1 && tg_iops(tg, rw) == -1) {
 		if (wait)
 			*wait = 0;
 		return 1;
@@ -973,6 +1085,102 @@ static void throtl_update_dispatch_stats(struct blkcg_gq *blkg, u64 bytes,
 	local_irq_restore(flags);
 }
 
+/*
+ * Charge a part of what @tg may still dispatch in the current slice
+ * window to it and cache it on this cpu, so that next bios can go
+ * through tg_budget_consume() without queue_lock. Used only when no
+ * ancestor has limits, as lockless bios are not charged up the
+ * hierarchy. The budget expires with the window it was taken from. What
+ * is left unused by then is lost, which errs on the side of the limits.
+ */
+static void tg_budget_refill(struct throtl_grp *tg, bool rw)
+{
+	struct throtl_grp *parent_tg = sq_to_tg(tg->service_queue.parent_sq);
+	struct tg_stats_cpu *sc;
+	unsigned long jiffy_elapsed_rnd;
+	u64 bytes = -1, tmp;
+	unsigned int ios = -1;
+
+	if (!tg->stats_cpu || tg_lat_throttled(tg))
+		return;
+	if (parent_tg && parent_tg->has_rules[rw])
+		return;
+
+	jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+	if (!jiffy_elapsed_rnd)
+		jiffy_elapsed_rnd = throtl_slice;
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, throtl_slice);
+
+	if (tg->bps[rw] != -1) {
+		tmp = tg->bps[rw] * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		if (tmp <= tg->bytes_disp[rw])
+			return;
+		bytes = min_t(u64, div_u64(tmp - tg->bytes_disp[rw],
+					   THROTL_BUDGET_SHARE),
+			      THROTL_BUDGET_MAX_BYTES);
+	}
+
+	if (tg->iops[rw] != -1) {
+		tmp = (u64)tg->iops[rw] * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		if (tmp <= tg->io_disp[rw])
+			return;
+		ios = min_t(u64, div_u64(tmp - tg->io_disp[rw],
+					 THROTL_BUDGET_SHARE),
+			    THROTL_BUDGET_MAX_IOS);
+	}
+
+	if (!bytes || !ios)
+		return;
+
+	if (tg->bps[rw] != -1)
+		tg->bytes_disp[rw] += bytes;
+	if (tg->iops[rw] != -1)
+		tg->io_disp[rw] += ios;
+
+	/* queue_lock is held with irqs off, nobody else uses this cpu's sc */
+	sc = this_cpu_ptr(tg->stats_cpu);
+	sc->budget_bytes[rw] = bytes;
+	sc->budget_ios[rw] = ios;
+	sc->budget_expire[rw] = tg->slice_start[rw] + jiffy_elapsed_rnd;
+	sc->budget_gen[rw] = tg->budget_gen;
+}
+
+/*
+ * Dispatch @bio from the budget cached on this cpu, if there is enough
+ * of it. Called under rcu only, @bio was charged to @tg at refill time.
+ */
+static bool tg_budget_consume(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	struct tg_stats_cpu *sc;
+	unsigned long flags;
+	bool ret = false;
+
+	if (!tg->stats_cpu || tg_lat_throttled(tg))
+		return false;
+
+	/* throtl is FIFO - if bios are already queued, should queue */
+	if (ACCESS_ONCE(tg->service_queue.nr_queued[rw]))
+		return false;
+
+	local_irq_save(flags);
+	sc = this_cpu_ptr(tg->stats_cpu);
+	if (sc->budget_gen[rw] == ACCESS_ONCE(tg->budget_gen) &&
+	    time_before(jiffies, sc->budget_expire[rw]) &&
+	    sc->budget_ios[rw] && sc->budget_bytes[rw] >= bio->bi_size) {
+		sc->budget_ios[rw]--;
+		sc->budget_bytes[rw] -= bio->bi_size;
+		blkg_rwstat_add(&sc->serviced, bio->bi_rw, 1);
+		blkg_rwstat_add(&sc->service_bytes, bio->bi_rw, bio->bi_size);
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
 static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
 {
 	bool rw = bio_data_dir(bio);
@@ -1304,6 +1512,79 @@ static int tg_print_cpu_rwstat(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static void tg_print_hist(struct seq_file *sf, struct throtl_grp *tg, int off)
+{
+	int i, cpu;
+
+	for (i = 0; i < THROTL_LAT_HIST_NR; i++) {
+		unsigned long sum = 0;
+
+		for_each_possible_cpu(cpu) {
+			void *sc = per_cpu_ptr(tg->stats_cpu, cpu);
+
+			sum += ((unsigned long *)(sc + off))[i];
+		}
+		seq_printf(sf, " %lu", sum);
+	}
+	seq_putc(sf, '\n');
+}
+
+static u64 tg_prfill_lat_hist(struct seq_file *sf,
+			      struct blkg_policy_data *pd, int off)
+{
+	struct throtl_grp *tg = pd_to_tg(pd);
+	const char *dname = blkg_dev_name(pd->blkg);
+
+	if (!dname || !tg->stats_cpu)
+		return 0;
+
+	seq_printf(sf, "%s", dname);
+	tg_print_hist(sf, tg, off);
+	return 0;
+}
+
+static int tg_print_lat_hist(struct cgroup *cgrp, struct cftype *cft,
+			     struct seq_file *sf)
+{
+	struct blkcg *blkcg = cgroup_to_blkcg(cgrp);
+
+	blkcg_print_blkgs(sf, blkcg, tg_prfill_lat_hist, &blkcg_policy_throtl,
+			  cft->private, false);
+	return 0;
+}
+
+#ifdef CONFIG_BC_IO_PRIORITY
+static u64 tg_prfill_ub_iolat(struct seq_file *sf,
+			      struct blkg_policy_data *pd, int off)
+{
+	struct throtl_grp *tg = pd_to_tg(pd);
+	struct request_queue *q = pd->blkg->q;
+	const char *dev_name;
+
+	if (!tg->stats_cpu)
+		return 0;
+
+	if (q->kobj.parent)
+		dev_name = kobject_name(q->kobj.parent);
+	else
+		dev_name = "none";
+
+	seq_printf(sf, "%s queue", dev_name);
+	tg_print_hist(sf, tg, offsetof(struct tg_stats_cpu, queue_hist));
+	seq_printf(sf, "%s service", dev_name);
+	tg_print_hist(sf, tg, offsetof(struct tg_stats_cpu, service_hist));
+	return 0;
+}
+
+void blkcg_show_ub_iolat(struct cgroup *cgrp, struct seq_file *sf)
+{
+	struct blkcg *blkcg = cgroup_to_blkcg(cgrp);
+
+	blkcg_print_blkgs(sf, blkcg, tg_prfill_ub_iolat, &blkcg_policy_throtl,
+			  0, false);
+}
+#endif
+
 static u64 tg_prfill_conf_u64(struct seq_file *sf, struct blkg_policy_data *pd,
 			      int off)
 {
@@ -1351,6 +1632,7 @@ static int tg_set_conf(struct cgroup *cgrp, struct cftype *cft, const char *buf,
 	struct throtl_service_queue *sq;
 	struct blkcg_gq *blkg;
 	struct cgroup *pos_cgrp;
+	bool had_target;
 	int ret;
 
 	ret = blkg_conf_prep(blkcg, &blkcg_policy_throtl, buf, &ctx);
@@ -1359,6 +1641,7 @@ static int tg_set_conf(struct cgroup *cgrp, struct cftype *cft, const char *buf,
 
 	tg = blkg_to_tg(ctx.blkg);
 	sq = &tg->service_queue;
+	had_target = tg->latency_target != -1;
 
 	if (!ctx.v)
 		ctx.v = -1;
@@ -1368,10 +1651,12 @@ static int tg_set_conf(struct cgroup *cgrp, struct cftype *cft, const char *buf,
 	else
 		*(unsigned int *)((void *)tg + cft->private) = ctx.v;
 
+	tg->td->nr_lat_targets += (tg->latency_target != -1) - had_target;
+
 	throtl_log(&tg->service_queue,
-		   "limit change rbps=%llu wbps=%llu riops=%u wiops=%u",
+		   "limit change rbps=%llu wbps=%llu riops=%u wiops=%u lat=%u",
 		   tg->bps[READ], tg->bps[WRITE],
-		   tg->iops[READ], tg->iops[WRITE]);
+		   tg->iops[READ], tg->iops[WRITE], tg->latency_target);
 
 	/*
 	 * Update has_rules[] flags for the updated tg's subtree.  A tg is
@@ -1445,6 +1730,13 @@ static struct cftype throtl_files[] = {
 		.write_string = tg_set_conf_uint,
 		.max_write_len = 256,
 	},
+	{
+		.name = "throttle.latency_target_device",
+		.private = offsetof(struct throtl_grp, latency_target),
+		.read_seq_string = tg_print_conf_uint,
+		.write_string = tg_set_conf_uint,
+		.max_write_len = 256,
+	},
 	{
 		.name = "throttle.io_service_bytes",
 		.private = offsetof(struct tg_stats_cpu, service_bytes),
@@ -1455,6 +1747,16 @@ static struct cftype throtl_files[] = {
 		.private = offsetof(struct tg_stats_cpu, serviced),
 		.read_seq_string = tg_print_cpu_rwstat,
 	},
+	{
+		.name = "throttle.io_queue_time_hist",
+		.private = offsetof(struct tg_stats_cpu, queue_hist),
+		.read_seq_string = tg_print_lat_hist,
+	},
+	{
+		.name = "throttle.io_service_time_hist",
+		.private = offsetof(struct tg_stats_cpu, service_hist),
+		.read_seq_string = tg_print_lat_hist,
+	},
 	{ }	/* terminate */
 };
 
@@ -1489,6 +1791,10 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 	if (bio->bi_rw & REQ_THROTTLED)
 		goto out;
 
+	/* completion latency is accounted to the group of the bio */
+	if (td->nr_lat_targets)
+		bio_associate_current(bio);
+
 	/*
 	 * A throtl_grp pointer retrieved under rcu can be used to access
 	 * basic fields like stats and io rates. If a group has no rules,
@@ -1498,11 +1804,13 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 	blkcg = bio_blkcg(bio);
 	tg = throtl_lookup_tg(td, blkcg);
 	if (tg) {
-		if (!tg->has_rules[rw]) {
+		if (!tg->has_rules[rw] && !tg_lat_throttled(tg)) {
 			throtl_update_dispatch_stats(tg_to_blkg(tg),
 						     bio->bi_size, bio->bi_rw);
 			goto out_unlock_rcu;
 		}
+		if (tg_budget_consume(tg, bio))
+			goto out_unlock_rcu;
 	}
 
 	/*
@@ -1541,6 +1849,10 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 		 */
 		throtl_trim_slice(tg, rw);
 
+		/* let next bios of the group skip queue_lock */
+		if (!qn)
+			tg_budget_refill(tg, rw);
+
 		/*
 		 * @bio passed through this layer without being throttled.
 		 * Climb up the ladder.  If we''re already at the top, it
@@ -1591,6 +1903,136 @@ out:
 	return throttled;
 }
 
+/* Called under td->lat_lock when @tg's latency window is over */
+static void tg_lat_window_end(struct throtl_grp *tg)
+{
+	struct throtl_data *td = tg->td;
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - tg->lat_window_start;
+	unsigned int scale;
+	u64 avg;
+
+	if (tg->latency_target != -1 && tg->lat_nr) {
+		avg = div_u64(div_u64(tg->lat_sum, tg->lat_nr),
+			      NSEC_PER_USEC);
+		if (avg > tg->latency_target) {
+			scale = td_lat_scale(td);
+			if (!scale || tg->latency_target < td->lat_missed)
+				td->lat_missed = tg->latency_target;
+			td->lat_scale = min_t(unsigned int, scale + 1,
+					      THROTL_LAT_MAX_SCALE);
+			td->lat_miss_time = now;
+			throtl_log(&tg->service_queue,
+				   "latency %llu missed target %u scale=%u",
+				   avg, tg->latency_target, td->lat_scale);
+		}
+	}
+
+	/* a long idle period says nothing about the rate */
+	if (!tg_lat_throttled(tg) && elapsed < 2 * throtl_lat_window)
+		tg->lat_base_iops = tg->lat_nr * HZ / elapsed;
+
+	tg->lat_window_start = now;
+	tg->lat_sum = 0;
+	tg->lat_nr = 0;
+}
+
+static int throtl_lat_bucket(u64 nsec)
+{
+	u64 usec = div_u64(nsec, NSEC_PER_USEC);
+
+	if (!usec)
+		return 0;
+	return min_t(int, ilog2(usec), THROTL_LAT_HIST_NR - 1);
+}
+
+/*
+ * Queue time is from allocation of @rq to its dispatch to the driver,
+ * service time from there to @now.
+ */
+static void tg_update_lat_hist(struct throtl_grp *tg, struct request *rq,
+			       u64 now)
+{
+	u64 start = rq_start_time_ns(rq);
+	u64 io_start = rq_io_start_time_ns(rq);
+	struct tg_stats_cpu *sc;
+	unsigned long flags;
+
+	if (!tg->stats_cpu || !start)
+		return;
+
+	/* sched_clock() may differ a bit between cpus */
+	if (io_start < start)
+		io_start = start;
+	if (now < io_start)
+		now = io_start;
+
+	local_irq_save(flags);
+	sc = this_cpu_ptr(tg->stats_cpu);
+	sc->queue_hist[throtl_lat_bucket(io_start - start)]++;
+	sc->service_hist[throtl_lat_bucket(now - io_start)]++;
+	local_irq_restore(flags);
+}
+
+/*
+ * Group to account completion of @rq to: that of its first bio if the bio
+ * was associated, otherwise the one the request was allocated for.
+ */
+static struct throtl_grp *throtl_rq_tg(struct throtl_data *td,
+				       struct request *rq)
+{
+	struct bio *bio = rq->bio;
+	struct blkcg_gq *blkg = NULL;
+
+	if (bio->bi_css)
+		return throtl_lookup_tg(td, bio_blkcg(bio));
+
+	/* blk-mq has a blkg in rq->rl only with CONFIG_BLK_MQ_CGROUP */
+	if (rq->rl && rq->q->mq_ops)
+		blkg = container_of(rq->rl, struct blkcg_gq, rl);
+	else if (rq->rl)
+		blkg = rq->rl->blkg;
+
+	return blkg ? blkg_to_tg(blkg) : NULL;
+}
+
+/*
+ * Account queue and service time of @rq for the group histograms and,
+ * while some group on the queue has a latency target, completion latency
+ * to the group of its first bio.
+ */
+void blk_throtl_rq_done(struct request *rq)
+{
+	struct throtl_data *td = rq->q->td;
+	struct throtl_grp *tg;
+	struct bio *bio = rq->bio;
+	unsigned long flags;
+	u64 now;
+	s64 lat;
+
+	if (!td || rq->cmd_type != REQ_TYPE_FS)
+		return;
+
+	now = sched_clock();
+	lat = now - rq_start_time_ns(rq);
+
+	rcu_read_lock();
+	tg = throtl_rq_tg(td, rq);
+	if (tg)
+		tg_update_lat_hist(tg, rq, now);
+
+	if (tg && td->nr_lat_targets && bio->bi_css) {
+		spin_lock_irqsave(&td->lat_lock, flags);
+		tg->lat_sum += max_t(s64, lat, 0);
+		tg->lat_nr++;
+		if (time_after_eq(jiffies,
+				  tg->lat_window_start + throtl_lat_window))
+			tg_lat_window_end(tg);
+		spin_unlock_irqrestore(&td->lat_lock, flags);
+	}
+	rcu_read_unlock();
+}
+
 /*
  * Dispatch all bios from all children tg's queued on @parent_sq.  On
  * return, @parent_sq is guaranteed to not have any active children tg's
@@ -1667,6 +2109,7 @@ int blk_throtl_init(struct request_queue *q)
 		return -ENOMEM;
 
 	INIT_WORK(&td->dispatch_work, blk_throtl_dispatch_work_fn);
+	spin_lock_init(&td->lat_lock);
 	throtl_service_queue_init(&td->service_queue, NULL);
 
 	q->td = td;
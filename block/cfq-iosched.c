@@ -4010,7 +4010,6 @@ static void cfq_insert_request(struct request_queue *q, struct request *rq)
 	    &(RQ_CFQG(rq))->pd.blkg->blkcg->css)
 		ub_writeback_io(1, blk_rq_sectors(rq));
 #endif
-	virtinfo_notifier_call_irq(VITYPE_IO, VIRTINFO_IO_OP_ACCOUNT, q);
 	cfq_rq_enqueued(cfqd, cfqq, rq);
 }
 
@@ -930,6 +930,27 @@ static void nvme_make_request(struct request_queue *q, struct bio *bio)
 	put_nvmeq(nvmeq);
 }
 
+/*
+ * Reap completions on this cpu's queue for a polling submitter. cqe_seen
+ * stays set, so that the interrupt for what we took is not spurious.
+ */
+static int nvme_poll(struct request_queue *q)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_queue *nvmeq = get_nvmeq(ns->dev);
+	int found;
+
+	if (!nvmeq)
+		return 0;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	found = nvme_process_cq(nvmeq);
+	spin_unlock_irq(&nvmeq->q_lock);
+	put_nvmeq(nvmeq);
+
+	return found;
+}
+
 static irqreturn_t nvme_irq(int irq, void *data)
 {
 	irqreturn_t result;
@@ -2002,6 +2023,7 @@ static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, unsigned nsid,
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
 	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, ns->queue);
 	blk_queue_make_request(ns->queue, nvme_make_request);
+	blk_queue_poll_fn(ns->queue, nvme_poll);
 	ns->dev = dev;
 	ns->queue->queuedata = ns;
 
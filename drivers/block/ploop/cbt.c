@@ -0,0 +1,316 @@
+/* Changed block tracking: persistent bitmap of written clusters.
+ *
+ * Unlike tracker.c, which records changes of the top delta for the time
+ * of a migration, this keeps a bitmap of virtual clusters written since
+ * user last cleared them, and survives device restarts in a file given
+ * by user. The file header is marked "clean" only after the bitmap was
+ * saved on orderly stop, so after a crash we never report less than
+ * what was changed: the whole device is reported dirty instead.
+ */
+
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
+#include <asm/uaccess.h>
+
+#include <linux/ploop/ploop.h>
+
+struct ploop_cbt
+{
+	struct file	*file;
+	unsigned long	*map;
+	u64		nr_clusters;
+	int		lost;	/* something was not recorded, all is dirty */
+};
+
+static u64 cbt_nr_clusters(struct ploop_device * plo, u64 size)
+{
+	return (size + (1 << plo->cluster_log) - 1) >> plo->cluster_log;
+}
+
+static size_t cbt_map_bytes(u64 nr_clusters)
+{
+	return BITS_TO_LONGS(nr_clusters) * sizeof(unsigned long);
+}
+
+/* Called under plo->lock for every write and discard */
+void ploop_cbt_mark(struct ploop_device * plo, sector_t sec, unsigned int len)
+{
+	struct ploop_cbt * cbt = plo->cbt;
+	u64 start = sec >> plo->cluster_log;
+	u64 end = ((sec + len - 1) >> plo->cluster_log) + 1;
+
+	if (end > cbt->nr_clusters) {
+		cbt->lost = 1;
+		end = cbt->nr_clusters;
+	}
+	if (start < end)
+		bitmap_set(cbt->map, start, end - start);
+}
+
+static int cbt_write_header(struct ploop_device * plo, struct ploop_cbt * cbt,
+			    u32 flags)
+{
+	struct ploop_cbt_header hdr;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PLOOP_CBT_MAGIC;
+	hdr.version = PLOOP_CBT_VERSION;
+	hdr.flags = flags;
+	hdr.cluster_log = plo->cluster_log;
+	hdr.nr_clusters = cbt->nr_clusters;
+
+	err = kernel_write(cbt->file, (char *)&hdr, sizeof(hdr), 0);
+	if (err != sizeof(hdr))
+		return err < 0 ? err : -EIO;
+
+	return vfs_fsync(cbt->file, 0);
+}
+
+/* Returns 0 if saved bitmap matches the device and was loaded */
+static int cbt_load(struct ploop_device * plo, struct ploop_cbt * cbt)
+{
+	struct ploop_cbt_header hdr;
+	size_t size = cbt_map_bytes(cbt->nr_clusters);
+	int err;
+
+	err = kernel_read(cbt->file, 0, (char *)&hdr, sizeof(hdr));
+	if (err != sizeof(hdr))
+		return -ENODATA;
+
+	if (hdr.magic != PLOOP_CBT_MAGIC ||
+	    hdr.version != PLOOP_CBT_VERSION ||
+	    !(hdr.flags & PLOOP_CBT_F_CLEAN) ||
+	    hdr.cluster_log != plo->cluster_log ||
+	    hdr.nr_clusters != cbt->nr_clusters)
+		return -ESTALE;
+
+	err = kernel_read(cbt->file, PLOOP_CBT_DATA_OFFSET,
+			  (char *)cbt->map, size);
+	if (err != size)
+		return -ENODATA;
+
+	return 0;
+}
+
+static int cbt_save(struct ploop_device * plo, struct ploop_cbt * cbt)
+{
+	size_t size = cbt_map_bytes(cbt->nr_clusters);
+	int err;
+
+	if (cbt->lost)
+		return -ESTALE;
+
+	err = kernel_write(cbt->file, (char *)cbt->map, size,
+			   PLOOP_CBT_DATA_OFFSET);
+	if (err != size)
+		return err < 0 ? err : -EIO;
+
+	err = vfs_fsync(cbt->file, 0);
+	if (err)
+		return err;
+
+	return cbt_write_header(plo, cbt, PLOOP_CBT_F_CLEAN);
+}
+
+static void cbt_free(struct ploop_cbt * cbt)
+{
+	if (cbt->file)
+		fput(cbt->file);
+	vfree(cbt->map);
+	kfree(cbt);
+}
+
+int ploop_cbt_start(struct ploop_device * plo, unsigned long arg)
+{
+	struct ploop_cbt_ctl ctl;
+	struct ploop_cbt * cbt;
+	struct file * file;
+	int err;
+
+	if (copy_from_user(&ctl, (void*)arg, sizeof(ctl)))
+		return -EFAULT;
+
+	if (plo->cbt)
+		return -EBUSY;
+	if (list_empty(&plo->map.delta_list) || !plo->bd_size)
+		return -ENOENT;
+
+	file = fget(ctl.fd);
+	if (!file)
+		return -EBADF;
+
+	err = -EINVAL;
+	if (!S_ISREG(file_inode(file)->i_mode) ||
+	    (file->f_mode & (FMODE_READ|FMODE_WRITE)) !=
+	    (FMODE_READ|FMODE_WRITE))
+		goto out_fput;
+
+	err = -ENOMEM;
+	cbt = kzalloc(sizeof(*cbt), GFP_KERNEL);
+	if (!cbt)
+		goto out_fput;
+
+	cbt->file = file;
+	cbt->nr_clusters = cbt_nr_clusters(plo, plo->bd_size);
+	cbt->map = vzalloc(cbt_map_bytes(cbt->nr_clusters));
+	if (!cbt->map)
+		goto out_free;
+
+	ctl.flags = 0;
+	if (cbt_load(plo, cbt)) {
+		bitmap_fill(cbt->map, cbt->nr_clusters);
+		ctl.flags |= PLOOP_CBT_F_RESET;
+	}
+
+	/* From now on saved bitmap is stale until we save it again */
+	err = cbt_write_header(plo, cbt, 0);
+	if (err)
+		goto out_free;
+
+	if (copy_to_user((void*)arg, &ctl, sizeof(ctl))) {
+		err = -EFAULT;
+		goto out_free;
+	}
+
+	spin_lock_irq(&plo->lock);
+	plo->cbt = cbt;
+	spin_unlock_irq(&plo->lock);
+	return 0;
+
+out_free:
+	cbt_free(cbt);
+	return err;
+out_fput:
+	fput(file);
+	return err;
+}
+
+int ploop_cbt_stop(struct ploop_device * plo)
+{
+	struct ploop_cbt * cbt = plo->cbt;
+	int err;
+
+	if (!cbt)
+		return 0;
+
+	spin_lock_irq(&plo->lock);
+	plo->cbt = NULL;
+	spin_unlock_irq(&plo->lock);
+
+	err = cbt_save(plo, cbt);
+	if (err)
+		printk(KERN_WARNING "ploop%d: changed block bitmap "
+		       "is not saved (%d)\n", plo->index, err);
+
+	cbt_free(cbt);
+	return err;
+}
+
+/* Device was resized, resize bitmap too. New clusters are not dirty:
+ * they could not be read before. Called under ploop_quiesce().
+ */
+int ploop_cbt_grow(struct ploop_device * plo, u64 new_size)
+{
+	struct ploop_cbt * cbt = plo->cbt;
+	unsigned long * map, * old;
+	u64 nr;
+
+	if (!cbt)
+		return 0;
+
+	nr = cbt_nr_clusters(plo, new_size);
+	if (nr <= cbt->nr_clusters)
+		return 0;
+
+	map = vzalloc(cbt_map_bytes(nr));
+
+	spin_lock_irq(&plo->lock);
+	if (!map) {
+		cbt->lost = 1;
+		spin_unlock_irq(&plo->lock);
+		return -ENOMEM;
+	}
+	memcpy(map, cbt->map, cbt_map_bytes(cbt->nr_clusters));
+	old = cbt->map;
+	cbt->map = map;
+	cbt->nr_clusters = nr;
+	spin_unlock_irq(&plo->lock);
+
+	vfree(old);
+	return 0;
+}
+
+int ploop_cbt_get(struct ploop_device * plo, unsigned long arg)
+{
+	struct ploop_cbt_get_ctl ctl;
+	struct ploop_cbt * cbt = plo->cbt;
+	unsigned long * buf;
+	u64 n, done;
+	int err = 0;
+
+	if (copy_from_user(&ctl, (void*)arg, sizeof(ctl)))
+		return -EFAULT;
+
+	if (!cbt)
+		return -ENOENT;
+
+	if (ctl.start % PLOOP_CBT_ALIGN || ctl.__mbz)
+		return -EINVAL;
+
+	n = 0;
+	if (ctl.start < cbt->nr_clusters)
+		n = min(ctl.nr, cbt->nr_clusters - ctl.start);
+
+	/* Clearing goes by words, don't touch bits user did not ask for */
+	if (ctl.start + n < cbt->nr_clusters) {
+		n &= ~(u64)(PLOOP_CBT_ALIGN - 1);
+		if (!n && ctl.nr)
+			return -EINVAL;
+	}
+
+	buf = (unsigned long *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	for (done = 0; done < n; ) {
+		u64 chunk = min_t(u64, n - done, PAGE_SIZE * 8);
+		unsigned long * src;
+		int i, words = BITS_TO_LONGS(chunk);
+
+		spin_lock_irq(&plo->lock);
+		src = cbt->map + (ctl.start + done) / BITS_PER_LONG;
+		for (i = 0; i < words; i++) {
+			buf[i] = cbt->lost ? ~0UL : src[i];
+			if (ctl.flags & PLOOP_CBT_GET_CLEAR)
+				src[i] = 0;
+		}
+		spin_unlock_irq(&plo->lock);
+
+		if (copy_to_user((void *)(unsigned long)ctl.buf + done / 8,
+				 buf, (chunk + 7) / 8)) {
+			/* Give back what we cleared but did not report */
+			if (ctl.flags & PLOOP_CBT_GET_CLEAR) {
+				spin_lock_irq(&plo->lock);
+				for (i = 0; i < words; i++)
+					src[i] |= buf[i];
+				spin_unlock_irq(&plo->lock);
+			}
+			err = -EFAULT;
+			break;
+		}
+		done += chunk;
+	}
+
+	free_page((unsigned long)buf);
+
+	ctl.nr = done;
+	if (copy_to_user((void*)arg, &ctl, sizeof(ctl)))
+		err = -EFAULT;
+
+	return err;
+}
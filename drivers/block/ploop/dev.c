@@ -11,6 +11,7 @@
 #include <linux/seq_file.h>
 #include <linux/random.h>
 #include <linux/ve.h>
+#include <linux/ve_lat.h>
 #include <asm/uaccess.h>
 
 #include <trace/events/block.h>
@@ -126,6 +127,106 @@ static void mitigation_timeout(unsigned long data)
 	spin_unlock_irq(&plo->lock);
 }
 
+/*
+ * Maintenance throttling.
+ *
+ * Merge and relocation requests go cluster by cluster. Before taking
+ * the next cluster the request asks ploop_maint_delay() whether it may
+ * go now. If it may not, the request is parked on maint_queue and
+ * maint_timer puts it back to ready_queue later. Parked requests stay
+ * active, so nothing about their state changes meanwhile.
+ */
+#define PLOOP_MAINT_YIELD_DELAY	(HZ/20)
+
+/* Called under plo->lock. Returns 0 and charges budget if maintenance
+ * request may start next cluster, otherwise returns jiffies to wait.
+ */
+static long ploop_maint_delay(struct ploop_device * plo)
+{
+	u64 cost = 0;
+	u64 now;
+
+	/* Somebody waits for quiesce, don't stall him */
+	if (test_bit(PLOOP_S_ATTENTION, &plo->state))
+		return 0;
+
+	if (plo->tune.maint_yield_qlen &&
+	    plo->entry_qlen + plo->bio_qlen > plo->tune.maint_yield_qlen) {
+		plo->st.maint_yields++;
+		return PLOOP_MAINT_YIELD_DELAY;
+	}
+
+	if (plo->tune.maint_bw)
+		cost = div_u64((u64)NSEC_PER_SEC << (plo->cluster_log + 9),
+			       (u32)plo->tune.maint_bw * 1024);
+	if (plo->tune.maint_iops)
+		cost = max_t(u64, cost, NSEC_PER_SEC / plo->tune.maint_iops);
+	if (!cost)
+		return 0;
+
+	now = ktime_to_ns(ktime_get());
+	if (plo->maint_next > now)
+		return div_u64(plo->maint_next - now, NSEC_PER_SEC / HZ) + 1;
+
+	plo->maint_next = now + cost;
+	return 0;
+}
+
+/* Called under plo->lock by maintenance preq about to start next cluster.
+ * Returns non-zero if preq was parked.
+ */
+static int ploop_maint_park(struct ploop_device * plo,
+			    struct ploop_request * preq)
+{
+	long delay;
+
+	if (list_empty(&plo->maint_queue)) {
+		delay = ploop_maint_delay(plo);
+		if (!delay)
+			return 0;
+		mod_timer(&plo->maint_timer, jiffies + delay);
+	}
+
+	preq->eng_state = PLOOP_E_ENTRY;
+	list_add_tail(&preq->list, &plo->maint_queue);
+	plo->st.maint_throttled++;
+	return 1;
+}
+
+static void maint_timeout(unsigned long data)
+{
+	struct ploop_device * plo = (void*)data;
+	int woken = 0;
+
+	spin_lock_irq(&plo->lock);
+	while (!list_empty(&plo->maint_queue)) {
+		long delay = ploop_maint_delay(plo);
+
+		if (delay) {
+			mod_timer(&plo->maint_timer, jiffies + delay);
+			break;
+		}
+		list_move_tail(plo->maint_queue.next, &plo->ready_queue);
+		woken = 1;
+	}
+	if (woken && test_bit(PLOOP_S_WAIT_PROCESS, &plo->state))
+		wake_up_interruptible(&plo->waitq);
+	spin_unlock_irq(&plo->lock);
+}
+
+static int ploop_maint_nr_reqs(struct ploop_device * plo)
+{
+	int num_reqs = plo->tune.maint_reqs;
+
+	if (!num_reqs)
+		num_reqs = plo->tune.fsync_max;
+	if (num_reqs > plo->tune.max_requests/2)
+		num_reqs = plo->tune.max_requests/2;
+	if (num_reqs < 1)
+		num_reqs = 1;
+	return num_reqs;
+}
+
 static void freeze_timeout(unsigned long data)
 {
 	struct ploop_device * plo = (void*)data;
@@ -270,6 +371,23 @@ static void preq_set_sync_bit(struct ploop_request * preq)
 	}
 }
 
+static inline unsigned int ploop_tree_shard(cluster_t clu)
+{
+	return (clu >> PLOOP_TREE_RANGE_LOG) % PLOOP_TREE_SHARDS;
+}
+
+static inline struct rb_root *
+entry_root(struct ploop_device * plo, unsigned long rw, cluster_t clu)
+{
+	return &plo->entry_tree[rw & WRITE][ploop_tree_shard(clu)];
+}
+
+static inline struct rb_root *
+lockout_root(struct ploop_device * plo, cluster_t clu)
+{
+	return &plo->lockout_tree[ploop_tree_shard(clu)];
+}
+
 static void overlap_forward(struct ploop_device * plo,
 			    struct ploop_request * preq,
 			    struct ploop_request * preq1,
@@ -285,7 +403,8 @@ static void overlap_forward(struct ploop_device * plo,
 		if (test_bit(PLOOP_REQ_SYNC, &preq1->state))
 			preq_set_sync_bit(preq);
 		merge_rw_flags_to_req(preq1->req_rw, preq);
-		rb_erase(&preq1->lockout_link, &plo->entry_tree[preq1->req_rw & WRITE]);
+		rb_erase(&preq1->lockout_link,
+			 entry_root(plo, preq1->req_rw, preq1->req_cluster));
 		preq_unlink(preq1, drop_list);
 		plo->st.coal_mforw++;
 	}
@@ -294,7 +413,7 @@ static void overlap_forward(struct ploop_device * plo,
 		preq1 = rb_entry(n, struct ploop_request, lockout_link);
 		if (preq->req_sector + preq->req_size <= preq1->req_sector)
 			break;
-		rb_erase(n, &plo->entry_tree[preq->req_rw & WRITE]);
+		rb_erase(n, entry_root(plo, preq->req_rw, preq->req_cluster));
 		__clear_bit(PLOOP_REQ_SORTED, &preq1->state);
 		plo->st.coal_oforw++;
 	}
@@ -316,7 +435,8 @@ static void overlap_backward(struct ploop_device * plo,
 		if (test_bit(PLOOP_REQ_SYNC, &preq1->state))
 			preq_set_sync_bit(preq);
 		merge_rw_flags_to_req(preq1->req_rw, preq);
-		rb_erase(&preq1->lockout_link, &plo->entry_tree[preq->req_rw & WRITE]);
+		rb_erase(&preq1->lockout_link,
+			 entry_root(plo, preq->req_rw, preq->req_cluster));
 		preq_unlink(preq1, drop_list);
 		plo->st.coal_mback++;
 	}
@@ -325,7 +445,7 @@ static void overlap_backward(struct ploop_device * plo,
 		preq1 = rb_entry(n, struct ploop_request, lockout_link);
 		if (preq1->req_sector + preq1->req_size <= preq->req_sector)
 			break;
-		rb_erase(n, &plo->entry_tree[preq->req_rw & WRITE]);
+		rb_erase(n, entry_root(plo, preq->req_rw, preq->req_cluster));
 		__clear_bit(PLOOP_REQ_SORTED, &preq1->state);
 		plo->st.coal_oback++;
 	}
@@ -419,7 +539,8 @@ insert_entry_tree(struct ploop_device * plo, struct ploop_request * preq0,
 	struct ploop_request * clash;
 	struct rb_node * n;
 
-	clash = tree_insert(&plo->entry_tree[preq0->req_rw & WRITE], preq0);
+	clash = tree_insert(entry_root(plo, preq0->req_rw, preq0->req_cluster),
+			    preq0);
 	if (!clash)
 		return 0;
 
@@ -475,6 +596,63 @@ insert_entry_tree(struct ploop_device * plo, struct ploop_request * preq0,
 	return 0;
 }
 
+static inline u64 ploop_lat_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void ploop_lat_account(struct ploop_device * plo, int stage, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int b = us ? min_t(int, fls64(us), PLOOP_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(plo->lat->hist[stage][b]);
+}
+
+/* Account the wait which is over now: preq was picked up by
+ * ploop_thread() or is completed right in completion context.
+ * What preq was waiting for is told by the state it was left in.
+ */
+static void ploop_lat_wakeup(struct ploop_request * preq, u64 now)
+{
+	int stage;
+
+	if (test_and_clear_bit(PLOOP_REQ_LAT_LOCKOUT, &preq->state))
+		stage = PLOOP_LAT_LOCKOUT;
+	else switch (preq->eng_state) {
+	case PLOOP_E_ENTRY:
+		stage = PLOOP_LAT_QUEUE;
+		break;
+	case PLOOP_E_INDEX_READ:
+	case PLOOP_E_TRANS_INDEX_READ:
+	case PLOOP_E_INDEX_DELAY:
+	case PLOOP_E_INDEX_WB:
+	case PLOOP_E_ZERO_INDEX:
+	case PLOOP_E_DELTA_ZERO_INDEX:
+		stage = PLOOP_LAT_INDEX;
+		break;
+	default:
+		stage = PLOOP_LAT_DATA;
+	}
+
+	ploop_lat_account(preq->plo, stage, now - preq->lat_stamp);
+	preq->lat_stamp = now;
+}
+
+static void ploop_lat_complete(struct ploop_request * preq)
+{
+	u64 lat;
+
+	if (!preq->lat_start)
+		return;
+
+	lat = ploop_lat_now() - preq->lat_start;
+	ploop_lat_account(preq->plo, PLOOP_LAT_TOTAL, lat);
+	/* requests come from ploop_thread, the submitter's VE is unknown */
+	ve_lat_record(NULL, VE_LAT_PLOOP_IO, lat, preq->plo->index);
+	preq->lat_start = 0;
+}
+
 static void
 ploop_bio_queue(struct ploop_device * plo, struct bio * bio,
 		struct list_head *drop_list)
@@ -549,6 +727,8 @@ ploop_bio_queue(struct ploop_device * plo, struct bio * bio,
 		plo->bio_sync = NULL;
 	}
 
+	preq->lat_start = preq->lat_stamp = ploop_lat_now();
+
 	__TRACE("A %p %u\n", preq, preq->req_cluster);
 
 	if (unlikely(bio->bi_rw & REQ_DISCARD))
@@ -704,16 +884,14 @@ preallocate_bio(struct bio * orig_bio, struct ploop_device * plo)
 {
 	struct bio * nbio = NULL;
 
+	/* Lockless: one more trip to plo->lock per bio is what we save */
 	if (plo->cached_bio) {
-		spin_lock_irq(&plo->lock);
-		nbio = plo->cached_bio;
-		if (nbio) {
-			if (orig_bio->bi_vcnt <= nbio->bi_max_vecs)
-				plo->cached_bio = NULL;
-			else
-				nbio = NULL;
+		nbio = xchg(&plo->cached_bio, NULL);
+		if (nbio && orig_bio->bi_vcnt > nbio->bi_max_vecs) {
+			if (cmpxchg(&plo->cached_bio, NULL, nbio))
+				bio_put(nbio);
+			nbio = NULL;
 		}
-		spin_unlock_irq(&plo->lock);
 	}
 
 	if (nbio == NULL)
@@ -861,6 +1039,9 @@ static void ploop_make_request(struct request_queue *q, struct bio *bio)
 	ploop_acc_ff_in_locked(plo, rw);
 	plo->bio_total++;
 
+	if (unlikely(plo->cbt) && (rw & REQ_WRITE) && bio->bi_size)
+		ploop_cbt_mark(plo, bio->bi_sector, bio->bi_size >> 9);
+
 	/* Device is aborted, everything is in error. This should not happen. */
 	if (unlikely(!test_bit(PLOOP_S_RUNNING, &plo->state) ||
 		     ((bio->bi_rw & REQ_WRITE) &&
@@ -904,11 +1085,13 @@ static void ploop_make_request(struct request_queue *q, struct bio *bio)
 	/* Try to merge before checking for fastpath. Maybe, this
 	 * is not wise.
 	 */
-	if (!RB_EMPTY_ROOT(&plo->entry_tree[bio->bi_rw & WRITE]) &&
-	    bio->bi_size) {
+	if (bio->bi_size &&
+	    !RB_EMPTY_ROOT(entry_root(plo, bio->bi_rw,
+				      bio->bi_sector >> plo->cluster_log))) {
 		struct ploop_request * preq;
-		struct rb_node * n = plo->entry_tree[bio->bi_rw & WRITE].rb_node;
 		u32 bio_cluster = bio->bi_sector >> plo->cluster_log;
+		struct rb_node * n = entry_root(plo, bio->bi_rw,
+						bio_cluster)->rb_node;
 
 		while (n) {
 			preq = rb_entry(n, struct ploop_request, lockout_link);
@@ -1001,14 +1184,11 @@ queued:
 		}
 	}
 out:
-	if (nbio) {
-		if (!plo->cached_bio)
-			plo->cached_bio = nbio;
-		else
-			bio_put(nbio);
-	}
 	spin_unlock_irq(&plo->lock);
 
+	if (nbio && cmpxchg(&plo->cached_bio, NULL, nbio))
+		bio_put(nbio);
+
 	blk_check_plugged(ploop_unplug, plo, sizeof(struct blk_plug_cb));
 
 	if (!list_empty(&drop_list))
@@ -1113,7 +1293,7 @@ static int ploop_congested(void *data, int bits)
 static int check_lockout(struct ploop_request *preq)
 {
 	struct ploop_device * plo = preq->plo;
-	struct rb_node * n = plo->lockout_tree.rb_node;
+	struct rb_node * n = lockout_root(plo, preq->req_cluster)->rb_node;
 	struct ploop_request * p;
 
 	if (n == NULL)
@@ -1131,6 +1311,7 @@ static int check_lockout(struct ploop_request *preq)
 			n = n->rb_right;
 		else {
 			list_add_tail(&preq->list, &p->delay_list);
+			set_bit(PLOOP_REQ_LAT_LOCKOUT, &preq->state);
 			plo->st.bio_lockouts++;
 			trace_preq_lockout(preq, p);
 			return 1;
@@ -1142,7 +1323,8 @@ static int check_lockout(struct ploop_request *preq)
 int ploop_add_lockout(struct ploop_request *preq, int try)
 {
 	struct ploop_device * plo = preq->plo;
-	struct rb_node ** p = &plo->lockout_tree.rb_node;
+	struct rb_root * root = lockout_root(plo, preq->req_cluster);
+	struct rb_node ** p = &root->rb_node;
 	struct rb_node *parent = NULL;
 	struct ploop_request * pr;
 
@@ -1168,7 +1350,7 @@ int ploop_add_lockout(struct ploop_request *preq, int try)
 	trace_add_lockout(preq);
 
 	rb_link_node(&preq->lockout_link, parent, p);
-	rb_insert_color(&preq->lockout_link, &plo->lockout_tree);
+	rb_insert_color(&preq->lockout_link, root);
 	__set_bit(PLOOP_REQ_LOCKOUT, &preq->state);
 	return 0;
 }
@@ -1183,7 +1365,7 @@ void del_lockout(struct ploop_request *preq)
 
 	trace_del_lockout(preq);
 
-	rb_erase(&preq->lockout_link, &plo->lockout_tree);
+	rb_erase(&preq->lockout_link, lockout_root(plo, preq->req_cluster));
 }
 
 static void ploop_discard_wakeup(struct ploop_request *preq, int err)
@@ -1209,6 +1391,7 @@ static void ploop_complete_request(struct ploop_request * preq)
 	struct io_context *ioc;
 
 	trace_complete_request(preq);
+	ploop_lat_complete(preq);
 
 	__TRACE("Z %p %u\n", preq, preq->req_cluster);
 
@@ -1247,10 +1430,12 @@ static void ploop_complete_request(struct ploop_request * preq)
 
 				if (!list_empty(&preq->delay_list))
 					list_splice_init(&preq->delay_list, plo->ready_queue.prev);
-				plo->active_reqs--;
 
-				preq->eng_state = PLOOP_E_ENTRY;
-				ploop_entry_add(plo, preq);
+				if (!ploop_maint_park(plo, preq)) {
+					plo->active_reqs--;
+					preq->eng_state = PLOOP_E_ENTRY;
+					ploop_entry_add(plo, preq);
+				}
 				spin_unlock_irq(&plo->lock);
 				return;
 			}
@@ -1366,11 +1551,107 @@ void ploop_fail_immediate(struct ploop_request * preq, int err)
 		ploop_fail_immediate(preq, err);	\
 	} while (0);
 
+/* Only these bits may be set in preq->state of a request which is
+ * completed without help of ploop_thread().
+ */
+#define PLOOP_REQ_DIRECT_MASK	((1UL << PLOOP_REQ_SYNC) | (1UL << PLOOP_REQ_RSYNC))
+
+/* Plain read or write of an already mapped block needs nothing from
+ * the state machine on completion: no index update, no lockout, no
+ * tracking. Finish it right in the completion context, on the CPU which
+ * got the completion, instead of waking up ploop_thread() for every
+ * completed bio. Everything else still goes through ready_queue.
+ *
+ * Returns 1 if preq was completed here.
+ */
+static int ploop_complete_request_direct(struct ploop_request * preq)
+{
+	struct ploop_device * plo = preq->plo;
+	struct io_context * ioc = preq->ioc;
+	unsigned long flags;
+	int nr_completed = 0;
+
+	if (!plo->tune.direct_complete ||
+	    preq->eng_state != PLOOP_E_COMPLETE ||
+	    preq->error ||
+	    (preq->state & ~PLOOP_REQ_DIRECT_MASK) ||
+	    preq->aux_bio || preq->trans_map || preq->prealloc_size ||
+	    test_bit(PLOOP_S_ABORT, &plo->state))
+		return 0;
+
+	/* The last active reference must be dropped by
+	 * put_io_context_active() in process context. Leave such
+	 * requests to ploop_thread(). */
+	if (ioc && !atomic_add_unless(&ioc->active_ref, -1, 1))
+		return 0;
+
+	trace_complete_request(preq);
+	if (preq->lat_start) {
+		ploop_lat_wakeup(preq, ploop_lat_now());
+		ploop_lat_complete(preq);
+	}
+
+	while (preq->bl.head) {
+		struct bio * bio = preq->bl.head;
+		preq->bl.head = bio->bi_next;
+		bio->bi_next = NULL;
+		BIO_ENDIO(plo->queue, bio, 0);
+		nr_completed++;
+	}
+	preq->bl.tail = NULL;
+
+	spin_lock_irqsave(&plo->lock, flags);
+
+	if (preq->map) {
+		map_release(preq->map);
+		preq->map = NULL;
+	}
+	preq->ioc = NULL;
+
+	plo->active_reqs--;
+	plo->bio_total -= nr_completed;
+	plo->st.bio_direct++;
+
+	ploop_uncongest(plo);
+	list_add(&preq->list, &plo->free_list);
+	if (waitqueue_active(&plo->req_waitq))
+		wake_up(&plo->req_waitq);
+	else if (test_bit(PLOOP_S_WAIT_PROCESS, &plo->state) &&
+		 waitqueue_active(&plo->waitq) &&
+		 (plo->bio_head ||
+		  !bio_list_empty(&plo->bio_discard_list) ||
+		  (plo->active_reqs == 0 &&
+		   (test_bit(PLOOP_S_EXITING, &plo->state) ||
+		    !list_empty(&plo->entry_queue)))))
+		wake_up_interruptible(&plo->waitq);
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2,6,24)
+	if (plo->tune.congestion_detection &&
+	    plo->entry_qlen + plo->active_reqs - plo->fastpath_reqs
+	    <= plo->tune.max_requests/2) {
+		if (test_and_clear_bit(PLOOP_S_WRITE_CONG, &plo->state))
+			clear_bdi_congested(&plo->queue->backing_dev_info, WRITE);
+		if (test_and_clear_bit(PLOOP_S_READ_CONG, &plo->state))
+			clear_bdi_congested(&plo->queue->backing_dev_info, READ);
+	}
+#endif
+	spin_unlock_irqrestore(&plo->lock, flags);
+
+	if (ioc) {
+		atomic_dec(&ioc->nr_tasks);
+		put_io_context(ioc);
+	}
+	return 1;
+}
+
 void ploop_complete_io_state(struct ploop_request * preq)
 {
 	struct ploop_device * plo = preq->plo;
 	unsigned long flags;
 
+	if (ploop_complete_request_direct(preq))
+		return;
+
 	spin_lock_irqsave(&plo->lock, flags);
 	__TRACE("C %p %u\n", preq, preq->req_cluster);
 	if (preq->error)
@@ -1385,16 +1666,26 @@ void ploop_complete_io_state(struct ploop_request * preq)
 EXPORT_SYMBOL(ploop_complete_io_state);
 
 
+#define FILL_BIO_BATCH	16
+
 static int fill_bio(struct ploop_device *plo, struct bio * bio, cluster_t blk)
 {
 	int pages = block_vecs(plo);
-
-	for (; bio->bi_vcnt < pages; bio->bi_vcnt++) {
-		bio->bi_io_vec[bio->bi_vcnt].bv_page = alloc_page(GFP_NOFS);
-		if (bio->bi_io_vec[bio->bi_vcnt].bv_page == NULL)
+	struct page *batch[FILL_BIO_BATCH];
+
+	while (bio->bi_vcnt < pages) {
+		int i, nr;
+
+		nr = alloc_pages_bulk(GFP_NOFS,
+				      min(pages - bio->bi_vcnt, FILL_BIO_BATCH),
+				      batch);
+		for (i = 0; i < nr; i++, bio->bi_vcnt++) {
+			bio->bi_io_vec[bio->bi_vcnt].bv_page = batch[i];
+			bio->bi_io_vec[bio->bi_vcnt].bv_offset = 0;
+			bio->bi_io_vec[bio->bi_vcnt].bv_len = PAGE_SIZE;
+		}
+		if (!nr)
 			return -ENOMEM;
-		bio->bi_io_vec[bio->bi_vcnt].bv_offset = 0;
-		bio->bi_io_vec[bio->bi_vcnt].bv_len = PAGE_SIZE;
 	}
 	bio->bi_sector = blk << plo->cluster_log;
 	bio->bi_size = (1 << (plo->cluster_log + 9));
@@ -1445,6 +1736,70 @@ static void bio_bcopy(struct bio *dst, struct bio *src, struct ploop_device *plo
 	}
 }
 
+/* Non-zero if src carries the same data as dst has at its position */
+static int bio_bsame(struct bio *dst, struct bio *src, struct ploop_device *plo)
+{
+	int i;
+	unsigned int doff, soff, bv_off;
+
+	doff = (src->bi_sector & ((1<<plo->cluster_log) - 1)) << 9;
+	soff = 0;
+	bv_off = 0;
+	i = 0;
+
+	while (soff < src->bi_size) {
+		struct bio_vec * bv = src->bi_io_vec + i;
+		unsigned int len;
+		int didx;
+		int poff;
+		void * ksrc;
+		int diff;
+
+		if (bv_off >= bv->bv_len) {
+			i++;
+			bv++;
+			bv_off = 0;
+		}
+
+		didx = doff / PAGE_SIZE;
+		poff = doff & (PAGE_SIZE-1);
+		len = bv->bv_len - bv_off;
+		if (len > PAGE_SIZE - poff)
+			len = PAGE_SIZE - poff;
+
+		ksrc = kmap_atomic(bv->bv_page);
+		diff = memcmp(page_address(dst->bi_io_vec[didx].bv_page) + poff,
+			      ksrc + bv->bv_offset + bv_off, len);
+		kunmap_atomic(ksrc);
+		if (diff)
+			return 0;
+
+		bv_off += len;
+		doff += len;
+		soff += len;
+	}
+	return 1;
+}
+
+/* Write repeats what previous delta has, read into aux_bio */
+static int ploop_write_is_dup(struct ploop_request * preq)
+{
+	struct bio * b;
+
+	bio_list_for_each(b, &preq->bl)
+		if (!bio_bsame(preq->aux_bio, b, preq->plo))
+			return 0;
+	return 1;
+}
+
+/* Dropping a flush would lose ordering of earlier writes */
+static inline int ploop_may_dedup(struct ploop_request * preq)
+{
+	return preq->plo->tune.dedup &&
+		!(preq->req_rw & (REQ_FLUSH | REQ_DISCARD)) &&
+		!test_bit(PLOOP_REQ_FORCE_FLUSH, &preq->state);
+}
+
 int check_zeros(struct bio_list * bl)
 {
 	struct bio * bio;
@@ -1930,6 +2285,111 @@ err:
 
 /* Main preq state machine */
 
+/* Queue internal request reading in index page which maps clu.
+ * Called under plo->lock. If wait is not set and there are no free
+ * requests, returns 1 and does nothing.
+ */
+int ploop_map_prefetch(struct ploop_device * plo, cluster_t clu, int wait)
+{
+	struct ploop_request * preq;
+
+	if (list_empty(&plo->free_list)) {
+		if (!wait)
+			return 1;
+	} else if (!wait && test_bit(PLOOP_S_CONGESTED, &plo->state))
+		return 1;
+
+	preq = ploop_alloc_request(plo);
+
+	preq->bl.head = preq->bl.tail = NULL;
+	preq->req_cluster = clu;
+	preq->req_sector = (sector_t)clu << plo->cluster_log;
+	preq->req_size = 0;
+	preq->req_rw = READ;
+	preq->eng_state = PLOOP_E_ENTRY;
+	preq->state = (1 << PLOOP_REQ_PREFETCH);
+	preq->error = 0;
+	preq->tstamp = jiffies;
+	preq->iblock = 0;
+	preq->prealloc_size = 0;
+	preq->ioc = NULL;
+
+	list_add_tail(&preq->list, &plo->ready_queue);
+	plo->active_reqs++;
+	plo->st.map_prefetches++;
+
+	if (test_bit(PLOOP_S_WAIT_PROCESS, &plo->state) &&
+	    waitqueue_active(&plo->waitq))
+		wake_up_interruptible(&plo->waitq);
+	return 0;
+}
+
+/* aux_bio holds the whole cluster of trans delta (or preq is to clone it):
+ * write it to top delta, allocating new block there if needed.
+ */
+static void ploop_trans_delta_write(struct ploop_request * preq)
+{
+	struct ploop_device * plo = preq->plo;
+	struct ploop_delta * top_delta = ploop_top_delta(plo);
+	struct bio_list sbl;
+	u32 iblk;
+
+	sbl.head = sbl.tail = preq->aux_bio;
+
+	__set_bit(PLOOP_REQ_TRANS, &preq->state);
+	if (map_get_index(preq, preq->req_cluster, &iblk) != top_delta->level) {
+		/*
+		 * we can be here only if merge is in progress and
+		 * merge can't happen concurrently with ballooning
+		 */
+		top_delta->ops->allocate(top_delta, preq, &sbl, 1<<plo->cluster_log);
+		plo->st.bio_trans_alloc++;
+	} else {
+		preq->eng_state = PLOOP_E_COMPLETE;
+		preq->iblock = iblk;
+		top_delta->io.ops->submit(&top_delta->io, preq, preq->req_rw,
+					  &sbl, iblk, 1<<plo->cluster_log);
+	}
+}
+
+/* Index page is read in, or it is known to be absent: done. Errors are
+ * not reported, real requests will find them out and fail properly.
+ */
+static void ploop_entry_prefetch_req(struct ploop_request *preq)
+{
+	struct ploop_device * plo = preq->plo;
+
+	if (ploop_find_map(&plo->map, preq) == 1)
+		return;
+
+	preq->eng_state = PLOOP_E_COMPLETE;
+	ploop_complete_request(preq);
+}
+
+/* Read previous delta to see whether whole block write changes it */
+static void ploop_dedup_read(struct ploop_request * preq,
+			     struct ploop_delta * delta, iblock_t iblk)
+{
+	struct ploop_device * plo = preq->plo;
+	struct bio_list sbl;
+
+	if (!preq->aux_bio)
+		preq->aux_bio = bio_alloc(GFP_NOFS, block_vecs(plo));
+
+	if (!preq->aux_bio ||
+	    fill_bio(plo, preq->aux_bio, preq->req_cluster)) {
+		PLOOP_REQ_FAIL_IMMEDIATE(preq, -ENOMEM);
+		return;
+	}
+
+	__TRACE("DD %p %u\n", preq, preq->req_cluster);
+	preq->iblock = iblk;
+	preq->eng_state = PLOOP_E_DEDUP_READ;
+	sbl.head = sbl.tail = preq->aux_bio;
+	delta->io.ops->submit(&delta->io, preq, READ_SYNC,
+			      &sbl, iblk, 1<<plo->cluster_log);
+}
+
 static void
 ploop_entry_request(struct ploop_request * preq)
 {
@@ -1940,6 +2400,11 @@ ploop_entry_request(struct ploop_request * preq)
 	int err;
 	iblock_t iblk;
 
+	if (unlikely(test_bit(PLOOP_REQ_PREFETCH, &preq->state))) {
+		ploop_entry_prefetch_req(preq);
+		return;
+	}
+
 	/* Control request. */
 	if (unlikely(preq->bl.head == NULL &&
 		     !test_bit(PLOOP_REQ_MERGE, &preq->state) &&
@@ -2082,6 +2547,16 @@ restart:
 
 		delta = map_top_delta(plo->trans_map);
 
+		if (test_bit(PLOOP_REQ_MERGE, &preq->state) &&
+		    plo->merge_clone) {
+			/* Backing fs will share the cluster, skip reading it */
+			__TRACE("tDC %p %u\n", preq, preq->req_cluster);
+			preq->src_iblock = iblk;
+			__set_bit(PLOOP_REQ_CLONE, &preq->state);
+			ploop_trans_delta_write(preq);
+			return;
+		}
+
 		__TRACE("tDR %p %u\n", preq, preq->req_cluster);
 		preq->iblock = iblk;
 		preq->eng_state = PLOOP_E_TRANS_DELTA_READ;
@@ -2168,6 +2643,11 @@ delta_io:
 				ploop_add_lockout(preq, 0);
 				spin_unlock_irq(&plo->lock);
 
+				if (ploop_may_dedup(preq)) {
+					ploop_dedup_read(preq, delta, iblk);
+					return;
+				}
+
 				if (likely(ploop_reuse_free_block(preq)))
 					top_delta->ops->allocate(top_delta,
 								 preq, &preq->bl,
@@ -2246,12 +2726,18 @@ static void ploop_req_state_process(struct ploop_request * preq)
 	struct ploop_delta * top_delta;
 	struct io_context * saved_ioc = NULL;
 	int release_ioc = 0;
+	u64 lat_now = 0;
 #ifdef CONFIG_BEANCOUNTERS
 	struct user_beancounter * uninitialized_var(saved_ub);
 #endif
 
 	trace_req_state_process(preq);
 
+	if (preq->lat_start) {
+		lat_now = ploop_lat_now();
+		ploop_lat_wakeup(preq, lat_now);
+	}
+
 	if (preq->ioc) {
 		saved_ioc = current->io_context;
 		current->io_context = preq->ioc;
@@ -2316,12 +2802,16 @@ restart:
 				list_splice_init(&preq->delay_list,
 						 plo->ready_queue.prev);
 			}
-			spin_unlock_irq(&plo->lock);
 			preq->req_cluster = ~0U;
 			preq->src_iblock  = ~0U; /* redundant */
 			preq->dst_cluster = ~0U; /* redundant */
 			preq->dst_iblock  = ~0U; /* redundant */
 			preq->eng_state = PLOOP_E_ENTRY;
+			if (ploop_maint_park(plo, preq)) {
+				spin_unlock_irq(&plo->lock);
+				break;
+			}
+			spin_unlock_irq(&plo->lock);
 			goto restart;
 		}
 		/* drop down to PLOOP_E_COMPLETE case ... */
@@ -2375,6 +2865,13 @@ restart:
 			break;
 		}
 
+		/* Data is already in previous delta, nothing to write */
+		if (ploop_may_dedup(preq) && ploop_write_is_dup(preq)) {
+			plo->st.bio_dedup++;
+			ploop_complete_request(preq);
+			break;
+		}
+
 		bio_list_for_each(b, &preq->bl) {
 			bio_bcopy(preq->aux_bio, b, plo);
 		}
@@ -2392,6 +2889,29 @@ restart:
 		}
 		break;
 	}
+	case PLOOP_E_DEDUP_READ:
+	{
+		if (preq->error ||
+		    test_bit(PLOOP_S_ABORT, &plo->state)) {
+			PLOOP_REQ_FAIL_IMMEDIATE(preq, preq->error ? : -EIO);
+			break;
+		}
+
+		if (ploop_write_is_dup(preq)) {
+			plo->st.bio_dedup++;
+			ploop_complete_request(preq);
+			break;
+		}
+
+		/* Go on as whole block COW: data is in preq->bl, not aux_bio */
+		preq->iblock = 0;
+		if (likely(ploop_reuse_free_block(preq))) {
+			top_delta = ploop_top_delta(plo);
+			top_delta->ops->allocate(top_delta, preq, &preq->bl,
+						 preq->req_size);
+		}
+		break;
+	}
 	case PLOOP_E_ZERO_INDEX:
 	{
 		preq->eng_state = PLOOP_E_DATA_WBI;
@@ -2495,13 +3015,17 @@ restart:
 		del_lockout(preq);
 		preq->eng_state = PLOOP_E_ENTRY;
 		preq->req_cluster++;
+		spin_lock_irq(&plo->lock);
+		if (ploop_maint_park(plo, preq)) {
+			spin_unlock_irq(&plo->lock);
+			break;
+		}
+		spin_unlock_irq(&plo->lock);
 		goto restart;
 	}
 	case PLOOP_E_TRANS_DELTA_READ:
 	{
 		struct bio * b;
-		struct bio_list sbl;
-		u32 iblk;
 
 		/* preq was scheduled for read from delta. bio is a bio
 		 * covering full block of data. Now we should copy data
@@ -2517,23 +3041,7 @@ restart:
 			bio_bcopy(preq->aux_bio, b, plo);
 		}
 
-		top_delta = ploop_top_delta(plo);
-		sbl.head = sbl.tail = preq->aux_bio;
-
-		__set_bit(PLOOP_REQ_TRANS, &preq->state);
-		if (map_get_index(preq, preq->req_cluster, &iblk) != top_delta->level) {
-			/*
-			 * we can be here only if merge is in progress and
-			 * merge can't happen concurrently with ballooning
-			 */
-			top_delta->ops->allocate(top_delta, preq, &sbl, 1<<plo->cluster_log);
-			plo->st.bio_trans_alloc++;
-		} else {
-			preq->eng_state = PLOOP_E_COMPLETE;
-			preq->iblock = iblk;
-			top_delta->io.ops->submit(&top_delta->io, preq, preq->req_rw,
-						  &sbl, iblk, 1<<plo->cluster_log);
-		}
+		ploop_trans_delta_write(preq);
 		break;
 	}
 	case PLOOP_E_INDEX_READ:
@@ -2564,6 +3072,11 @@ restart:
 		BUG();
 	}
 
+	/* preq may be already gone, use only what we saved */
+	if (lat_now)
+		ploop_lat_account(plo, PLOOP_LAT_PROCESS,
+				  ploop_lat_now() - lat_now);
+
 	if (release_ioc) {
 		struct io_context * ioc = current->io_context;
 		current->io_context = saved_ioc;
@@ -2578,12 +3091,19 @@ static void ploop_wait(struct ploop_device * plo, int once, struct blk_plug *plu
 {
 	DEFINE_WAIT(_wait);
 	for (;;) {
+		long timeout;
+
 		prepare_to_wait(&plo->waitq, &_wait, TASK_INTERRUPTIBLE);
 
 		/* This is obvious. */
 		if (!list_empty(&plo->ready_queue))
 			break;
 
+		/* Group commit window of some index page is over */
+		timeout = ploop_index_batch_timeout(&plo->map);
+		if (!timeout)
+			break;
+
 		/* This is not. If we have something in entry queue... */
 		if (!list_empty(&plo->entry_queue)) {
 			/* And entry queue is not suspended due to barrier
@@ -2615,7 +3135,7 @@ static void ploop_wait(struct ploop_device * plo, int once, struct blk_plug *plu
 		once = 0;
 		spin_unlock_irq(&plo->lock);
 		blk_finish_plug(plug);
-		schedule();
+		schedule_timeout(timeout);
 		blk_start_plug(plug);
 		spin_lock_irq(&plo->lock);
 		clear_bit(PLOOP_S_WAIT_PROCESS, &plo->state);
@@ -2674,6 +3194,21 @@ static void ploop_handle_enospc_req(struct ploop_request *preq)
 	preq->iblock = 0;
 }
 
+/* Let io engines submit what they batched while the thread was busy */
+static void ploop_unplug_deltas(struct ploop_device * plo)
+{
+	struct ploop_delta * delta;
+
+	list_for_each_entry(delta, &plo->map.delta_list, list)
+		if (delta->io.ops->unplug)
+			delta->io.ops->unplug(&delta->io);
+
+	if (plo->trans_map)
+		list_for_each_entry(delta, &plo->trans_map->delta_list, list)
+			if (delta->io.ops->unplug)
+				delta->io.ops->unplug(&delta->io);
+}
+
 /* Main process. Processing queues in proper order, handling pre-barrier
  * flushes and queue suspend while processing a barrier
  */
@@ -2719,6 +3254,20 @@ static int ploop_thread(void * data)
 
 		/* Now ready_queue is empty */
 
+		/* Batched index updates must not outlive their window,
+		 * neither can they delay a barrier or thread exit. */
+		if (!list_empty(&plo->map.wb_batch)) {
+			int force = test_bit(PLOOP_S_ATTENTION, &plo->state) ||
+				    kthread_should_stop();
+
+			if (force || !ploop_index_batch_timeout(&plo->map)) {
+				spin_unlock_irq(&plo->lock);
+				ploop_index_batch_flush(&plo->map, force);
+				spin_lock_irq(&plo->lock);
+				continue;
+			}
+		}
+
 		if (plo->active_reqs == 0)
 			clear_bit(PLOOP_S_ATTENTION, &plo->state);
 
@@ -2757,7 +3306,9 @@ static int ploop_thread(void * data)
 			}
 
 			if (test_bit(PLOOP_REQ_SORTED, &preq->state)) {
-				rb_erase(&preq->lockout_link, &plo->entry_tree[preq->req_rw & WRITE]);
+				rb_erase(&preq->lockout_link,
+					 entry_root(plo, preq->req_rw,
+						    preq->req_cluster));
 				__clear_bit(PLOOP_REQ_SORTED, &preq->state);
 			}
 			preq->eng_state = PLOOP_E_ENTRY;
@@ -2778,6 +3329,10 @@ static int ploop_thread(void * data)
 			break;
 
 wait_more:
+		spin_unlock_irq(&plo->lock);
+		ploop_unplug_deltas(plo);
+		spin_lock_irq(&plo->lock);
+
 		ploop_wait(plo, once, &plug);
 		once = 0;
 	}
@@ -2849,6 +3404,13 @@ init_delta(struct ploop_device * plo, struct ploop_ctl * ctl, int level)
 			goto out_err;
 		if (level && !(ops->capability & PLOOP_FMT_CAP_DELTA))
 			goto out_err;
+	} else if (ctl->pctl_cluster_log < PAGE_SHIFT - 9 ||
+		   ctl->pctl_cluster_log > PAGE_SHIFT - 9 + ilog2(BIO_MAX_PAGES)) {
+		/* COW, merge and relocation move a cluster with one bio,
+		 * refuse cluster size which we would fail to allocate later.
+		 */
+		err = -EINVAL;
+		goto out_err;
 	}
 
 	if (level < 0)
@@ -3089,6 +3651,14 @@ static struct super_block *find_and_freeze_bdev(struct gendisk *disk,
 		if (!bdev)
 			break;
 
+		/* Write out the bulk while the fs still takes writes, so
+		 * that freeze_bdev() blocks writers for the leftover only */
+		sb = get_super(bdev);
+		if (sb) {
+			sync_filesystem(sb);
+			drop_super(sb);
+		}
+
 		sb = freeze_bdev(bdev);
 		if (sb)
 			break;
@@ -3151,6 +3721,12 @@ static int ploop_snapshot(struct ploop_device * plo, unsigned long arg,
 	if (err)
 		goto out_close2;
 
+	/* Write back the bulk while requests still run, it is only
+	 * an optimization: complete_snapshot() detaches the cache anyway */
+	if (top_delta->io.ops->cache_ctl)
+		top_delta->io.ops->cache_ctl(&top_delta->io,
+					     PLOOP_CACHE_WRITEBACK, 0);
+
 	/* _XXX_ only one mounted fs per ploop-device is supported */
 	sb = NULL;
 	if (ctl.pctl_flags & PLOOP_FLAG_FS_SYNC) {
@@ -3315,11 +3891,7 @@ static void ploop_merge_process(struct ploop_device * plo)
 
 	init_completion(&plo->maintenance_comp);
 
-	num_reqs = plo->tune.fsync_max;
-	if (num_reqs > plo->tune.max_requests/2)
-		num_reqs = plo->tune.max_requests/2;
-	if (num_reqs < 1)
-		num_reqs = 1;
+	num_reqs = ploop_maint_nr_reqs(plo);
 
 	for (; num_reqs; num_reqs--) {
 		struct ploop_request * preq;
@@ -3448,6 +4020,9 @@ static int ploop_merge(struct ploop_device * plo)
 		delta->level = 0;
 		plo->trans_map = map;
 		plo->maintenance_type = PLOOP_MNTN_MERGE;
+		plo->merge_clone = plo->tune.merge_clone &&
+				   next->io.ops->may_clone &&
+				   next->io.ops->may_clone(&next->io, &delta->io);
 		mutex_unlock(&plo->sysfs_mutex);
 	} else {
 		/* Yes. All transient obstacles must be resolved
@@ -3547,6 +4122,51 @@ static int ploop_truncate(struct ploop_device * plo, unsigned long arg)
 	return err;
 }
 
+static int ploop_cache_start(struct ploop_device * plo, unsigned long arg)
+{
+	struct ploop_delta * delta;
+	int err;
+
+	if (!test_bit(PLOOP_S_RUNNING, &plo->state))
+		return -EINVAL;
+	if (plo->maintenance_type != PLOOP_MNTN_OFF)
+		return -EBUSY;
+
+	delta = ploop_top_delta(plo);
+	if (delta->io.ops->cache_ctl == NULL)
+		return -EOPNOTSUPP;
+
+	ploop_quiesce(plo);
+	err = delta->io.ops->cache_ctl(&delta->io, PLOOP_CACHE_ATTACH, arg);
+	ploop_relax(plo);
+
+	return err;
+}
+
+static int ploop_cache_stop(struct ploop_device * plo)
+{
+	struct ploop_delta * delta;
+	int err;
+
+	if (!test_bit(PLOOP_S_RUNNING, &plo->state))
+		return -EINVAL;
+
+	delta = ploop_top_delta(plo);
+	if (delta->io.ops->cache_ctl == NULL)
+		return -ENOENT;
+
+	/* Write back the bulk while requests still run */
+	err = delta->io.ops->cache_ctl(&delta->io, PLOOP_CACHE_WRITEBACK, 0);
+	if (err)
+		return err;
+
+	ploop_quiesce(plo);
+	err = delta->io.ops->cache_ctl(&delta->io, PLOOP_CACHE_DETACH, 0);
+	ploop_relax(plo);
+
+	return err;
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 static int ploop_issue_flush_fn(request_queue_t *q, struct gendisk *disk,
 				sector_t *error_sector)
@@ -3762,6 +4382,7 @@ static int ploop_stop(struct ploop_device * plo, struct block_device *bdev)
 	/* This will wait for queue drain */
 	kthread_stop(plo->thread);
 	plo->thread = NULL;
+	del_timer_sync(&plo->maint_timer);
 
 	/* queue drained, no more ENOSPC */
 	spin_lock_irq(&plo->lock);
@@ -3865,6 +4486,7 @@ static int ploop_clear(struct ploop_device * plo, struct block_device * bdev)
 	clear_bit(PLOOP_S_DISCARD_LOADED, &plo->state);
 	clear_bit(PLOOP_S_DISCARD, &plo->state);
 
+	ploop_cbt_stop(plo);
 	destroy_deltas(plo, &plo->map);
 
 	if (plo->trans_map) {
@@ -3997,6 +4619,12 @@ static int ploop_grow(struct ploop_device *plo, struct block_device *bdev,
 	if (!delta->ops->prepare_grow)
 		return -EINVAL;
 
+	/* Flush the image while requests still run, complete_grow()
+	 * then has only the tail to sync with the queue quiesced */
+	err = delta->io.ops->sync(&delta->io);
+	if (err)
+		return err;
+
 	ploop_quiesce(plo);
 	err = delta->ops->prepare_grow(delta, &new_size, &reloc);
 	if (err)
@@ -4024,6 +4652,12 @@ already:
 			return -EIO;
 		}
 
+		err = delta->io.ops->sync(&delta->io);
+		if (err) {
+			plo->maintenance_type = PLOOP_MNTN_OFF;
+			return err;
+		}
+
 		ploop_quiesce(plo);
 		new_size = plo->grow_new_size;
 		plo->maintenance_type = PLOOP_MNTN_OFF;
@@ -4036,6 +4670,8 @@ already:
 			goto grow_failed;
 	}
 
+	ploop_cbt_grow(plo, new_size);
+
 	mutex_lock(&plo->sysfs_mutex);
 	plo->bd_size = new_size;
 	plo->map.max_index = (plo->bd_size + (1 << plo->cluster_log) - 1 )
@@ -4224,11 +4860,7 @@ static void ploop_relocblks_process(struct ploop_device *plo)
 	int num_reqs;
 	struct ploop_request *preq;
 
-	num_reqs = plo->tune.fsync_max;
-	if (num_reqs > plo->tune.max_requests/2)
-		num_reqs = plo->tune.max_requests/2;
-	if (num_reqs < 1)
-		num_reqs = 1;
+	num_reqs = ploop_maint_nr_reqs(plo);
 
 	spin_lock_irq(&plo->lock);
 
@@ -4432,7 +5064,16 @@ truncate:
 		err = copy_to_user((void*)arg, &ctl, sizeof(ctl));
 	}
 
-	ploop_discard_restart(plo, err);
+	/*
+	 * With tune.reloc_batch set, stay in FBLOADED while free blocks
+	 * remain: the next call relocates the next batch. Userspace sees
+	 * that via mntn_type of PLOOP_IOC_BALLOON.
+	 */
+	if (!err &&
+	    ploop_fb_relocation_resume(plo->fbd, delta->io.alloc_head))
+		plo->maintenance_type = PLOOP_MNTN_FBLOADED;
+	else
+		ploop_discard_restart(plo, err);
 
 	ploop_relax(plo);
 	return err;
@@ -4519,6 +5160,23 @@ static int ploop_ioctl(struct block_device *bdev, fmode_t fmode, unsigned int cm
 		err = ploop_tracker_read(plo, arg);
 		break;
 
+	case PLOOP_IOC_CBT_START:
+		err = ploop_cbt_start(plo, arg);
+		break;
+	case PLOOP_IOC_CBT_STOP:
+		err = ploop_cbt_stop(plo);
+		break;
+	case PLOOP_IOC_CBT_GET:
+		err = ploop_cbt_get(plo, arg);
+		break;
+
+	case PLOOP_IOC_CACHE_START:
+		err = ploop_cache_start(plo, arg);
+		break;
+	case PLOOP_IOC_CACHE_STOP:
+		err = ploop_cache_stop(plo);
+		break;
+
 	case PLOOP_IOC_MERGE:
 		err = ploop_merge(plo);
 		break;
@@ -4565,6 +5223,11 @@ static int ploop_ioctl(struct block_device *bdev, fmode_t fmode, unsigned int cm
 	case PLOOP_IOC_MAX_DELTA_SIZE:
 		err = ploop_set_max_delta_size(plo, arg);
 		break;
+	case PLOOP_IOC_WARM_MAP:
+		err = -EINVAL;
+		if (test_bit(PLOOP_S_RUNNING, &plo->state))
+			err = ploop_map_warm(&plo->map);
+		break;
 	default:
 		err = -EINVAL;
 	}
@@ -4606,6 +5269,7 @@ static struct sysfs_ops ploop_sysfs_ops = { };
 static void ploop_obj_release(struct kobject *kobj)
 {
 	struct ploop_device *plo = container_of(kobj, struct ploop_device, kobj);
+	free_percpu(plo->lat);
 	kfree(plo);
 	atomic_dec(&plo_count);
 }
@@ -4619,11 +5283,16 @@ static struct ploop_device *__ploop_dev_alloc(int index)
 {
 	struct ploop_device *plo;
 	struct gendisk *dk;
+	int i;
 
 	plo = kzalloc(sizeof(*plo), GFP_KERNEL);
 	if(!plo)
 		goto out;
 
+	plo->lat = alloc_percpu(struct ploop_lat_hist);
+	if (!plo->lat)
+		goto out_mem;
+
 	plo->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!plo->queue)
 		goto out_mem;
@@ -4646,9 +5315,15 @@ static struct ploop_device *__ploop_dev_alloc(int index)
 	init_timer(&plo->freeze_timer);
 	plo->freeze_timer.function = freeze_timeout;
 	plo->freeze_timer.data = (unsigned long)plo;
+	init_timer(&plo->maint_timer);
+	plo->maint_timer.function = maint_timeout;
+	plo->maint_timer.data = (unsigned long)plo;
+	INIT_LIST_HEAD(&plo->maint_queue);
 	INIT_LIST_HEAD(&plo->entry_queue);
-	plo->entry_tree[0] = plo->entry_tree[1] = RB_ROOT;
-	plo->lockout_tree = RB_ROOT;
+	for (i = 0; i < PLOOP_TREE_SHARDS; i++) {
+		plo->entry_tree[0][i] = plo->entry_tree[1][i] = RB_ROOT;
+		plo->lockout_tree[i] = RB_ROOT;
+	}
 	INIT_LIST_HEAD(&plo->ready_queue);
 	INIT_LIST_HEAD(&plo->free_list);
 	init_waitqueue_head(&plo->waitq);
@@ -4674,6 +5349,7 @@ static struct ploop_device *__ploop_dev_alloc(int index)
 out_queue:
 	blk_cleanup_queue(plo->queue);
 out_mem:
+	free_percpu(plo->lat);
 	kfree(plo);
 out:
 	return NULL;
@@ -4682,6 +5358,7 @@ out:
 static void ploop_dev_del(struct ploop_device *plo)
 {
 	ploop_tracker_destroy(plo, 1);
+	ploop_cbt_stop(plo);
 	ploop_sysfs_uninit(plo);
 	del_gendisk(plo->disk);
 	blk_cleanup_queue(plo->queue);
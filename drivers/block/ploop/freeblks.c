@@ -73,6 +73,8 @@ struct ploop_freeblks_desc {
 	int fbd_n_relocated;  /* # blocks actually relocated */
 	int fbd_n_relocating; /* # blocks whose relocation was at
 				   least started */
+	int fbd_reloc_limit;  /* stop relocation after this many blocks,
+				 0 - no limit (tune.reloc_batch) */
 
 	/* lost_range: [fbd_first_lost_iblk ..
 	 *		fbd_first_lost_iblk + fbd_lost_range_len - 1] */
@@ -464,6 +466,14 @@ int ploop_fb_get_reloc_block(struct ploop_freeblks_desc *fbd,
 	if (r_extent == NULL)
 		return -1;
 
+	/* this pass did enough, the rest is left for the next one */
+	if (fbd->fbd_reloc_limit &&
+	    fbd->fbd_n_relocating >= fbd->fbd_reloc_limit) {
+		fbd->fbd_lrb.ext = NULL;
+		fbd->fbd_lrb.off = 0;
+		return -1;
+	}
+
 	BUG_ON (fbd->fbd_lrb.off >= r_extent->len);
 
 	from_clu  = r_extent->clu  + fbd->fbd_lrb.off;
@@ -716,6 +726,19 @@ static void fbd_complete_bio(struct ploop_freeblks_desc *fbd, int err)
 	spin_unlock_irq(&plo->lock);
 }
 
+static void fbd_free_reloc_list(struct ploop_freeblks_desc *fbd)
+{
+	while (!list_empty(&fbd->fbd_reloc_list)) {
+		struct ploop_relocblks_extent *rblk_extent;
+
+		rblk_extent = list_first_entry(&fbd->fbd_reloc_list,
+					       struct ploop_relocblks_extent,
+					       list);
+		list_del(&rblk_extent->list);
+		kfree(rblk_extent);
+	}
+}
+
 void ploop_fb_reinit(struct ploop_freeblks_desc *fbd, int err)
 {
 	fbd_complete_bio(fbd, err);
@@ -730,15 +753,7 @@ void ploop_fb_reinit(struct ploop_freeblks_desc *fbd, int err)
 		kfree(fblk_extent);
 	}
 
-	while (!list_empty(&fbd->fbd_reloc_list)) {
-		struct ploop_relocblks_extent *rblk_extent;
-
-		rblk_extent = list_first_entry(&fbd->fbd_reloc_list,
-					       struct ploop_relocblks_extent,
-					       list);
-		list_del(&rblk_extent->list);
-		kfree(rblk_extent);
-	}
+	fbd_free_reloc_list(fbd);
 
 	fbd->fbd_n_free = 0;
 	fbd->fbd_ffb.ext = NULL;
@@ -748,6 +763,7 @@ void ploop_fb_reinit(struct ploop_freeblks_desc *fbd, int err)
 	fbd->fbd_lfb.off = 0;
 	fbd->fbd_lrb.off = 0;
 	fbd->fbd_n_relocated = fbd->fbd_n_relocating = 0;
+	fbd->fbd_reloc_limit = 0;
 	fbd->fbd_lost_range_len = 0;
 	fbd->fbd_lost_range_addon = 0;
 
@@ -814,15 +830,7 @@ void ploop_fb_fini(struct ploop_freeblks_desc *fbd, int err)
 		kfree(fblk_extent);
 	}
 
-	while (!list_empty(&fbd->fbd_reloc_list)) {
-		struct ploop_relocblks_extent *rblk_extent;
-
-		rblk_extent = list_first_entry(&fbd->fbd_reloc_list,
-					       struct ploop_relocblks_extent,
-					       list);
-		list_del(&rblk_extent->list);
-		kfree(rblk_extent);
-	}
+	fbd_free_reloc_list(fbd);
 
 	while (!list_empty(&fbd->free_zero_list)) {
 		struct ploop_request * preq;
@@ -871,15 +879,36 @@ int ploop_fb_add_free_extent(struct ploop_freeblks_desc *fbd,
 		}
 	}
 
-	fblk_extent = kzalloc(sizeof(*fblk_extent), GFP_KERNEL);
-	if (fblk_extent == NULL)
-		return -ENOMEM;
+	/*
+	 * Discards mostly arrive in ascending order: glue adjacent extents
+	 * together instead of growing the list by one entry per request.
+	 */
+	if (&ex->list != &fbd->fbd_free_list &&
+	    ex->iblk + ex->len == iblk && ex->clu + ex->len == clu) {
+		ex->len += len;
+		fblk_extent = ex;
+	} else {
+		fblk_extent = kzalloc(sizeof(*fblk_extent), GFP_KERNEL);
+		if (fblk_extent == NULL)
+			return -ENOMEM;
 
-	fblk_extent->clu  = clu;
-	fblk_extent->iblk = iblk;
-	fblk_extent->len  = len;
+		fblk_extent->clu  = clu;
+		fblk_extent->iblk = iblk;
+		fblk_extent->len  = len;
 
-	list_add(&fblk_extent->list, &ex->list);
+		list_add(&fblk_extent->list, &ex->list);
+	}
+
+	if (fblk_extent->list.next != &fbd->fbd_free_list) {
+		ex = list_entry(fblk_extent->list.next,
+				struct ploop_freeblks_extent, list);
+		if (fblk_extent->iblk + fblk_extent->len == ex->iblk &&
+		    fblk_extent->clu + fblk_extent->len == ex->clu) {
+			fblk_extent->len += ex->len;
+			list_del(&ex->list);
+			kfree(ex);
+		}
+	}
 
 	fbd->fbd_n_free	 += len;
 
@@ -952,6 +981,8 @@ void ploop_fb_relocation_start(struct ploop_freeblks_desc *fbd,
 	struct ploop_freeblks_extent *fextent;
 
 	BUG_ON(fbd->fbd_lost_range_len != 0);
+	fbd->fbd_reloc_limit = fbd->plo->tune.reloc_batch;
+
 	if (list_empty(&fbd->fbd_reloc_list)) {
 		fbd->fbd_first_lost_iblk -= n_scanned;
 		fbd->fbd_lost_range_len	 += n_scanned;
@@ -1064,6 +1095,67 @@ void ploop_fb_relocation_start(struct ploop_freeblks_desc *fbd,
 				       fextent->len) - 1;
 }
 
+/*
+ * Called when relocation stopped at fbd_reloc_limit and the tail it
+ * drained is truncated (alloc_head is the new end of image). Keep free
+ * extents neither reused by writes nor taken for relocation, so that a
+ * further PLOOP_IOC_RELOCBLKS can go on without another discard pass.
+ * Returns # free blocks kept, 0 means there is nothing to resume.
+ */
+int ploop_fb_relocation_resume(struct ploop_freeblks_desc *fbd,
+			       iblock_t alloc_head)
+{
+	struct ploop_freeblks_extent *fextent, *n;
+	int reused = 1;
+	int n_free = 0;
+
+	BUG_ON(!RB_EMPTY_ROOT(&fbd->reloc_tree));
+
+	if (!fbd->fbd_reloc_limit ||
+	    fbd->fbd_n_relocating < fbd->fbd_reloc_limit ||
+	    fbd->fbd_ffb.ext == NULL)
+		return 0;
+
+	/* everything before ffb is reused, everything past a_h is gone */
+	list_for_each_entry_safe(fextent, n, &fbd->fbd_free_list, list) {
+		if (fextent == fbd->fbd_ffb.ext) {
+			fextent->clu  += fbd->fbd_ffb.off;
+			fextent->iblk += fbd->fbd_ffb.off;
+			fextent->len  -= fbd->fbd_ffb.off;
+			reused = 0;
+		}
+
+		if (!reused && fextent->iblk + fextent->len > alloc_head)
+			fextent->len = fextent->iblk < alloc_head ?
+				       alloc_head - fextent->iblk : 0;
+
+		if (reused || !fextent->len) {
+			list_del(&fextent->list);
+			kfree(fextent);
+			continue;
+		}
+
+		n_free += fextent->len;
+	}
+
+	fbd_free_reloc_list(fbd);
+
+	fbd->fbd_n_free = n_free;
+	fbd->fbd_ffb.ext = n_free ? list_first_entry(&fbd->fbd_free_list,
+					struct ploop_freeblks_extent, list) :
+				    NULL;
+	fbd->fbd_lfb.ext = NULL;
+	fbd->fbd_lrb.ext = NULL;
+	fbd->fbd_ffb.off = 0;
+	fbd->fbd_lfb.off = 0;
+	fbd->fbd_lrb.off = 0;
+	fbd->fbd_n_relocated = fbd->fbd_n_relocating = 0;
+	fbd->fbd_lost_range_addon = 0;
+	ploop_fb_lost_range_init(fbd, alloc_head);
+
+	return n_free;
+}
+
 int ploop_discard_add_bio(struct ploop_freeblks_desc *fbd, struct bio *bio)
 {
 	struct ploop_device *plo;
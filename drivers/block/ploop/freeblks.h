@@ -11,6 +11,7 @@ int ploop_fb_add_free_extent(struct ploop_freeblks_desc *fbd, cluster_t clu, ibl
 int ploop_fb_add_reloc_extent(struct ploop_freeblks_desc *fbd, cluster_t clu, iblock_t iblk, u32 len, u32 free);
 void ploop_fb_lost_range_init(struct ploop_freeblks_desc *fbd, iblock_t first_lost_iblk);
 void ploop_fb_relocation_start(struct ploop_freeblks_desc *fbd, __u32 n_scanned);
+int ploop_fb_relocation_resume(struct ploop_freeblks_desc *fbd, iblock_t alloc_head);
 int ploop_discard_add_bio(struct ploop_freeblks_desc *fbd, struct bio *bio);
 int ploop_discard_is_inprogress(struct ploop_freeblks_desc *fbd);
 
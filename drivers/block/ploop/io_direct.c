@@ -16,6 +16,7 @@
 #include <linux/ploop/compat.h>
 #include "ploop_events.h"
 #include "io_direct_map.h"
+#include "io_direct_cache.h"
 
 #define CREATE_TRACE_POINTS
 #include "io_direct_events.h"
@@ -23,6 +24,18 @@
 /* from fs/ext4/ext4.h */
 #define EXT4_EXTENTS_FL			0x00080000
 
+/* from fs/xfs/xfs_fs.h */
+struct dio_fsxattr {
+	__u32		fsx_xflags;
+	__u32		fsx_extsize;
+	__u32		fsx_nextents;
+	__u32		fsx_projid;
+	unsigned char	fsx_pad[12];
+};
+#define XFS_XFLAG_EXTSIZE		0x00000800
+#define XFS_IOC_FSGETXATTR		_IOR('X', 31, struct dio_fsxattr)
+#define XFS_IOC_FSSETXATTR		_IOW('X', 32, struct dio_fsxattr)
+
 #define MIN(a, b) (a < b ? a : b)
 
 #define PLOOP_MAX_PREALLOC(plo) (128 * 1024 * 1024) /* 128MB */
@@ -30,6 +43,7 @@
 #define PLOOP_MAX_EXTENT_MAP (64 * 1024 * 1024)    /* 64MB */
 int max_extent_map_pages __read_mostly;
 int min_extent_map_entries __read_mostly;
+static int extent_map_prefetch __read_mostly = 1;
 
 /* total sum of m->size for all ploop_mapping structs */
 atomic_long_t ploop_io_images_size = ATOMIC_LONG_INIT(0);
@@ -60,6 +74,159 @@ DEFINE_BIO_CB(dio_endio_async)
 }
 END_BIO_CB(dio_endio_async)
 
+/* Bios of different requests submitted by ploop thread in one go are
+ * glued together when they are adjacent on backing device. Plugging
+ * does the same for request based queues, but bio based backing devices
+ * (md, dm, another ploop) would see every cluster as a separate bio.
+ */
+#define DIO_BATCH_MAX_BIOS	16
+
+struct dio_batch
+{
+	struct bio	*bio;		/* merged bio, NULL if nr == 1 */
+	unsigned long	rw;
+	sector_t	sector;
+	unsigned int	size;
+	int		nr;
+	struct bio	*parts[DIO_BATCH_MAX_BIOS];
+};
+
+DEFINE_BIO_CB(dio_endio_batch)
+{
+	struct dio_batch * b = bio->bi_private;
+	int i;
+
+	if (!err && !bio_flagged(bio, BIO_UPTODATE))
+		err = -EIO;
+
+	for (i = 0; i < b->nr; i++)
+		bio_endio(b->parts[i], err);
+
+	bio_put(bio);
+	kfree(b);
+}
+END_BIO_CB(dio_endio_batch)
+
+static void dio_batch_flush(struct ploop_io * io)
+{
+	struct dio_batch * b = io->dio_batch;
+
+	if (!b)
+		return;
+
+	io->dio_batch = NULL;
+
+	if (b->nr == 1) {
+		submit_bio(b->rw, b->parts[0]);
+		kfree(b);
+		return;
+	}
+
+	io->plo->st.dio_batched += b->nr - 1;
+	b->bio->bi_private = b;
+	b->bio->bi_end_io = dio_endio_batch;
+	submit_bio(b->rw, b->bio);
+}
+
+/* Append pages of src to dst, leave dst untouched on failure */
+static int dio_bio_append(struct bio * dst, struct bio * src)
+{
+	unsigned short vcnt = dst->bi_vcnt;
+	unsigned int size = dst->bi_size;
+	unsigned int last_len = vcnt ? dst->bi_io_vec[vcnt - 1].bv_len : 0;
+	struct bio_vec * bv;
+	int i;
+
+	bio_for_each_segment(bv, src, i) {
+		if (bio_add_page(dst, bv->bv_page, bv->bv_len,
+				 bv->bv_offset) != bv->bv_len)
+			goto undo;
+	}
+	return 1;
+
+undo:
+	dst->bi_vcnt = vcnt;
+	dst->bi_size = size;
+	if (vcnt)
+		dst->bi_io_vec[vcnt - 1].bv_len = last_len;
+	clear_bit(BIO_SEG_VALID, &dst->bi_flags);
+	return 0;
+}
+
+static int dio_batch_merge(struct dio_batch * b, struct bio * bio,
+			   unsigned long rw)
+{
+	struct request_queue * q = bdev_get_queue(bio->bi_bdev);
+	struct bio * first = b->parts[0];
+	struct bio * m = b->bio;
+	unsigned int nr_vecs;
+
+	if (b->rw != rw || b->nr >= DIO_BATCH_MAX_BIOS ||
+	    bio->bi_bdev != first->bi_bdev ||
+	    bio->bi_sector != b->sector + (b->size >> 9))
+		return 0;
+
+	nr_vecs = (m ? m->bi_vcnt : first->bi_vcnt) + bio->bi_vcnt;
+	if (nr_vecs > min_t(unsigned int, queue_max_segments(q),
+			    BIO_MAX_PAGES) ||
+	    (b->size + bio->bi_size) >> 9 > queue_max_sectors(q))
+		return 0;
+
+	if (!m) {
+		m = bio_alloc(GFP_NOFS, min_t(unsigned int,
+					      queue_max_segments(q),
+					      BIO_MAX_PAGES));
+		if (!m)
+			return 0;
+		m->bi_bdev = first->bi_bdev;
+		m->bi_sector = first->bi_sector;
+		if (!dio_bio_append(m, first)) {
+			bio_put(m);
+			return 0;
+		}
+		b->bio = m;
+	}
+
+	if (!dio_bio_append(m, bio))
+		return 0;
+
+	b->parts[b->nr++] = bio;
+	b->size += bio->bi_size;
+	return 1;
+}
+
+/* Submit bio, or keep it until ploop thread runs out of requests */
+static void dio_submit_bio(struct ploop_io * io, struct bio * bio,
+			   unsigned long rw)
+{
+	struct dio_batch * b = io->dio_batch;
+
+	if (current != io->plo->thread || (rw & (REQ_FLUSH | REQ_FUA)) ||
+	    bdev_get_queue(bio->bi_bdev)->merge_bvec_fn) {
+		submit_bio(rw, bio);
+		return;
+	}
+
+	if (b && dio_batch_merge(b, bio, rw))
+		return;
+
+	dio_batch_flush(io);
+
+	b = kmalloc(sizeof(*b), GFP_NOFS);
+	if (!b) {
+		submit_bio(rw, bio);
+		return;
+	}
+
+	b->bio = NULL;
+	b->rw = rw;
+	b->sector = bio->bi_sector;
+	b->size = bio->bi_size;
+	b->nr = 1;
+	b->parts[0] = bio;
+	io->dio_batch = b;
+}
+
 struct bio_list_walk
 {
 	struct bio * cur;
@@ -71,10 +238,10 @@ static int cached_submit(struct ploop_io *io, iblock_t iblk,
 	      struct ploop_request * preq,
 	      struct bio_list * sbl, unsigned int size);
 
-static void
-dio_submit(struct ploop_io *io, struct ploop_request * preq,
-	   unsigned long rw,
-	   struct bio_list *sbl, iblock_t iblk, unsigned int size)
+void
+dio_submit_nocache(struct ploop_io *io, struct ploop_request * preq,
+		   unsigned long rw,
+		   struct bio_list *sbl, iblock_t iblk, unsigned int size)
 {
 	struct bio_list bl;
 	struct bio * bio = NULL;
@@ -251,10 +418,13 @@ flush_bio:
 			rw2 |= (REQ_FUA | ((bio_num) ? REQ_FLUSH : 0));
 
 		ploop_acc_ff_out(preq->plo, rw2 | b->bi_rw);
-		submit_bio(rw2, b);
+		dio_submit_bio(io, b, rw2);
 		bio_num++;
 	}
 
+	if (current == io->plo->thread && !ploop_more_work(preq->plo))
+		dio_batch_flush(io);
+
 	ploop_complete_io_request(preq);
 	return;
 
@@ -359,6 +529,18 @@ static inline void bzero_page(struct page *page)
 	kunmap_atomic(kaddr);
 }
 
+/*
+ * Growing the image by fallocate() is only safe where the space comes
+ * back as unwritten extents: the extent map treats them as holes to be
+ * written, not as stale data.
+ */
+static inline int dio_unwritten_prealloc(struct ploop_io *io)
+{
+	struct super_block *sb = io->files.inode->i_sb;
+
+	return sb->s_magic == XFS_SUPER_MAGIC ||
+	       (io->files.flags & EXT4_EXTENTS_FL);
+}
 
 static int
 cached_submit(struct ploop_io *io, iblock_t iblk, struct ploop_request * preq,
@@ -379,7 +561,7 @@ cached_submit(struct ploop_io *io, iblock_t iblk, struct ploop_request * preq,
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2,6,24)
 	if (end_pos > i_size_read(io->files.inode) &&
 	    io->files.file->f_op->fallocate &&
-	    io->files.flags & EXT4_EXTENTS_FL) {
+	    dio_unwritten_prealloc(io)) {
 		if (unlikely(io->prealloced_size < clu_siz)) {
 			loff_t prealloc = end_pos;
 			if (prealloc > PLOOP_MAX_PREALLOC(plo))
@@ -641,6 +823,17 @@ out:
 	PLOOP_FAIL_REQUEST(preq, err);
 }
 
+static void
+dio_submit(struct ploop_io *io, struct ploop_request * preq,
+	   unsigned long rw,
+	   struct bio_list *sbl, iblock_t iblk, unsigned int size)
+{
+	if (io->cache && ploop_cache_submit(io, preq, rw, sbl, iblk, size))
+		return;
+
+	dio_submit_nocache(io, preq, rw, sbl, iblk, size);
+}
+
 static struct extent_map * dio_fallocate(struct ploop_io *io, u32 iblk, int nr)
 {
 	struct extent_map * em;
@@ -862,6 +1055,8 @@ static int dio_release_prealloced(struct ploop_io * io)
 
 static void dio_destroy(struct ploop_io * io)
 {
+	ploop_cache_detach(io);
+
 	if (io->files.file) {
 		struct file * file;
 		struct ploop_delta * delta = container_of(io, struct ploop_delta, io);
@@ -906,6 +1101,8 @@ static int dio_stop(struct ploop_io * io)
 {
 	struct file * file = io->files.file;
 
+	ploop_cache_detach(io);
+
 	if (file) {
 		dio_fsync(file);
 	}
@@ -955,6 +1152,9 @@ static int dio_open(struct ploop_io * io)
 		wake_up_process(io->fsync_thread);
 	}
 
+	if (extent_map_prefetch)
+		ploop_dio_prefetch(io);
+
 out:
 	mutex_unlock(&io->files.inode->i_mutex);
 	return err;
@@ -1488,6 +1688,14 @@ dio_fastmap(struct ploop_io * io, struct bio * orig_bio,
 	struct extent_map * em;
 	int i;
 
+	/* Flushes must reach the cache, cached clusters are served by it */
+	if (io->cache && (orig_bio->bi_size == 0 ||
+			  (orig_bio->bi_rw & REQ_FLUSH) ||
+			  ploop_cache_mapped(io, isec))) {
+		io->plo->st.fast_neg_cache++;
+		return 1;
+	}
+
 	if (orig_bio->bi_size == 0) {
 		bio->bi_vcnt   = 0;
 		bio->bi_sector = 0;
@@ -1613,6 +1821,9 @@ static int dio_complete_snapshot(struct ploop_io * io, struct ploop_snapdata *sd
 	struct file * file = io->files.file;
 	int ret;
 
+	/* The image becomes read-only delta, it must be complete */
+	ploop_cache_detach(io);
+
 	ret = dio_release_prealloced(io);
 	if (ret)
 		return ret;
@@ -1704,6 +1915,12 @@ static int dio_truncate(struct ploop_io * io, struct file * file,
 	if (file->f_mapping != io->files.mapping)
 		return -EINVAL;
 
+	if (io->cache) {
+		err = ploop_cache_trim(io, alloc_head);
+		if (err)
+			return err;
+	}
+
 	newattrs.ia_size = (u64)alloc_head << (io->plo->cluster_log + 9);
 	newattrs.ia_valid = ATTR_SIZE;
 
@@ -1739,8 +1956,8 @@ static int dio_start_merge(struct ploop_io * io, struct ploop_snapdata *sd)
 }
 
 static void dio_unplug(struct ploop_io * io)
-{	
-	/* Need more thinking how to implement unplug */
+{
+	dio_batch_flush(io);
 }
 
 static int dio_congested(struct ploop_io * io, int bits)
@@ -1761,7 +1978,7 @@ static void dio_queue_settings(struct ploop_io * io, struct request_queue * q)
 	blk_queue_stack_limits(q, bdev_get_queue(io->files.bdev));
 }
 
-static void dio_issue_flush(struct ploop_io * io, struct ploop_request *preq)
+void dio_issue_flush_nocache(struct ploop_io * io, struct ploop_request *preq)
 {
 	struct bio *bio;
 
@@ -1783,6 +2000,14 @@ static void dio_issue_flush(struct ploop_io * io, struct ploop_request *preq)
 	ploop_complete_io_request(preq);
 }
 
+static void dio_issue_flush(struct ploop_io * io, struct ploop_request *preq)
+{
+	if (io->cache && ploop_cache_issue_flush(io, preq))
+		return;
+
+	dio_issue_flush_nocache(io, preq);
+}
+
 static int dio_dump(struct ploop_io * io)
 {
 	extern void dump_extent_map(struct extent_map_tree *tree);
@@ -1794,6 +2019,44 @@ static int dio_dump(struct ploop_io * io)
 	return -1;
 }
 
+/*
+ * Image growth on XFS goes through the same fallocate() path as on ext4,
+ * but without an extent size hint the allocator is free to hand out
+ * space in small pieces when several images grow at once. Ask for
+ * cluster-sized extents on images which have nothing allocated yet;
+ * for existing images XFS refuses the change, the hint then has to be
+ * inherited from the image directory (xfs_io -c "extsize ..." <dir>).
+ */
+static void dio_xfs_set_extsize(struct ploop_io * io)
+{
+	struct file *file = io->files.file;
+	struct dio_fsxattr fa;
+	unsigned int extsize;
+	mm_segment_t fs;
+	int err;
+
+	if (!(file->f_mode & FMODE_WRITE) || !io->plo)
+		return;
+
+	extsize = 1U << (io->plo->cluster_log + 9);
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	memset(&fa, 0, sizeof(fa));
+	err = file->f_op->unlocked_ioctl(file, XFS_IOC_FSGETXATTR, (long)&fa);
+	if (!err && !(fa.fsx_xflags & XFS_XFLAG_EXTSIZE)) {
+		fa.fsx_xflags |= XFS_XFLAG_EXTSIZE;
+		fa.fsx_extsize = extsize;
+		err = file->f_op->unlocked_ioctl(file, XFS_IOC_FSSETXATTR,
+						 (long)&fa);
+	}
+	set_fs(fs);
+
+	if (err)
+		ploop_io_report_fn(file, KERN_INFO
+				   "File on XFS w/o extent size hint");
+}
+
 static int dio_autodetect(struct ploop_io * io)
 {
 	struct file  * file  = io->files.file;
@@ -1804,11 +2067,13 @@ static int dio_autodetect(struct ploop_io * io)
 	mm_segment_t fs;
 	unsigned int flags;
 	
-	if (inode->i_sb->s_magic != EXT4_SUPER_MAGIC)
+	if (inode->i_sb->s_magic != EXT4_SUPER_MAGIC &&
+	    inode->i_sb->s_magic != XFS_SUPER_MAGIC)
 		return -1; /* not mine */
 
 	if (inode->i_sb->s_bdev == NULL) {
-		printk("File on FS EXT(%s) without backing device\n", s_id);
+		printk("File on FS %s(%s) without backing device\n",
+		       inode->i_sb->s_type->name, s_id);
 		return -1;
 	}
 
@@ -1817,10 +2082,18 @@ static int dio_autodetect(struct ploop_io * io)
 					"File on FS w/o fallocate");
 
 	if (!file->f_op->unlocked_ioctl) {
-		printk("Cannot run on EXT4(%s): no unlocked_ioctl\n", s_id);
+		printk("Cannot run on %s(%s): no unlocked_ioctl\n",
+		       inode->i_sb->s_type->name, s_id);
 		return -1;
 	}
 
+	/* XFS is extent based, unwritten extents are always there */
+	if (inode->i_sb->s_magic == XFS_SUPER_MAGIC) {
+		io->files.flags = 0;
+		dio_xfs_set_extsize(io);
+		return 0;
+	}
+
 	fs = get_fs();
 	set_fs(KERNEL_DS);
 	flags = 0;
@@ -1874,6 +2147,7 @@ static struct ploop_io_ops ploop_io_ops_direct =
 
 	.queue_settings	=	dio_queue_settings,
 	.issue_flush	=	dio_issue_flush,
+	.cache_ctl	=	ploop_cache_ctl,
 
 	.dump		=	dio_dump,
 
@@ -1887,6 +2161,8 @@ module_param(max_extent_map_pages, int, 0644);
 MODULE_PARM_DESC(max_extent_map_pages, "Maximal amount of pages taken by all extent map caches");
 module_param(min_extent_map_entries, int, 0644);
 MODULE_PARM_DESC(min_extent_map_entries, "Minimal amount of entries in a single extent map cache");
+module_param(extent_map_prefetch, int, 0644);
+MODULE_PARM_DESC(extent_map_prefetch, "Map the whole image into extent map cache on open");
 
 static int __init pio_direct_mod_init(void)
 {
@@ -0,0 +1,1248 @@
+/* Write-back cache of io_direct image on a fast block device.
+ *
+ * The cache device is split into cluster sized slots. A write covering
+ * a whole cluster of the image gets a slot, later writes and reads of
+ * that cluster are served from the slot, everything else goes to the
+ * image as before. Dirty slots are copied back to the image by
+ * writeback thread in large batches sorted by position in the image.
+ *
+ * Index of dirty slots is kept on the device (see ploop_if.h), so that
+ * data acknowledged by a flush survives crash. A slot is recorded dirty
+ * only after its first write completed and the device was flushed, and
+ * is given for reuse only after it was erased from the index on media.
+ * Flush requests are served by flusher thread: it writes the index and
+ * flushes both the cache device and the image before the request goes
+ * on.
+ *
+ * Only clusters already allocated in the image and not unwritten in
+ * the backing fs are cached, so writeback never allocates. Writes which
+ * change index of the image (allocation, relocation) go to the image
+ * after the cluster was written back and dropped from the cache.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/kthread.h>
+#include <linux/radix-tree.h>
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <asm/uaccess.h>
+
+#include <linux/ploop/ploop.h>
+#include <linux/ploop/compat.h>
+#include "io_direct_map.h"
+#include "io_direct_cache.h"
+
+#define PCACHE_WB_BATCH		64	/* slots written back per pass */
+#define PCACHE_WB_DELAY		HZ	/* write back at least that often */
+#define PCACHE_PER_PAGE		(PAGE_SIZE / sizeof(struct ploop_cache_entry))
+#define PCACHE_MODE		(FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+enum {
+	PCACHE_FREE,
+	PCACHE_CLEAN,
+	PCACHE_DIRTY,
+	PCACHE_DEAD,		/* dropped, may still be dirty on media */
+};
+
+struct pcache_slot
+{
+	iblock_t	iblk;
+	u32		gen;		/* bumped by every write */
+	u16		inflight;	/* I/O using the slot */
+	u8		state;
+	u8		fresh:1,	/* first write is in flight */
+			ondisk:1,	/* index on media has it dirty */
+			ref:1;		/* used since eviction looked at it */
+};
+
+struct pcache_wb
+{
+	iblock_t	iblk;
+	u32		slot;
+	u32		gen;
+};
+
+struct ploop_cache
+{
+	struct ploop_io		*io;
+	struct block_device	*bdev;
+	unsigned int		nr_slots;
+	sector_t		data_start;
+
+	spinlock_t		lock;
+	struct radix_tree_root	map;		/* iblk -> slot */
+	struct pcache_slot	*slots;
+	u32			*free;		/* stack of free slots */
+	unsigned int		nr_free;
+	unsigned int		nr_dirty;
+	unsigned int		nr_dead;
+	unsigned int		evict_hand;
+	unsigned int		wb_hand;
+	struct list_head	queue;		/* requests waiting for flush */
+	struct list_head	done;		/* writes waiting for index */
+
+	struct mutex		index_mutex;
+	struct ploop_cache_entry *index;	/* copy of index on media */
+	unsigned int		index_pages;
+	unsigned long		*index_dirty;	/* pages to write */
+	unsigned long		*index_wr;	/* pages written, not flushed */
+
+	struct mutex		wb_mutex;	/* protects wb_pages */
+	struct page		**wb_pages;
+	unsigned int		wb_nr_pages;
+	struct pcache_wb	*wb;		/* owned by writer thread */
+
+	struct task_struct	*flusher;
+	struct task_struct	*writer;
+	wait_queue_head_t	flush_waitq;
+	wait_queue_head_t	wb_waitq;
+	wait_queue_head_t	drain_waitq;
+	int			wb_kick;
+	int			drain;
+};
+
+/* Request delayed until the cache is flushed */
+struct pcache_req
+{
+	struct list_head	list;
+	struct ploop_request	*preq;
+	unsigned long		rw;
+	struct bio_list		sbl;
+	iblock_t		iblk;
+	unsigned int		size;
+	int			flush_only;
+};
+
+/* I/O of one request to a slot */
+struct pcache_io
+{
+	struct list_head	list;
+	struct ploop_cache	*cache;
+	struct ploop_request	*preq;
+	struct pcache_slot	*slot;
+	atomic_t		count;
+	int			error;
+	unsigned int		fresh:1,
+				persist:1;	/* complete after index write */
+};
+
+static inline unsigned int pcache_nr(struct ploop_cache *c,
+				     struct pcache_slot *s)
+{
+	return s - c->slots;
+}
+
+static inline sector_t pcache_sector(struct ploop_cache *c,
+				     struct pcache_slot *s)
+{
+	return c->data_start +
+		((sector_t)pcache_nr(c, s) << c->io->plo->cluster_log);
+}
+
+/* Called under c->lock */
+static inline void pcache_index_mark(struct ploop_cache *c,
+				     struct pcache_slot *s)
+{
+	set_bit(pcache_nr(c, s) / PCACHE_PER_PAGE, c->index_dirty);
+}
+
+/* Scans of all slots should not keep irqs disabled for long */
+static inline void pcache_relax_lock(struct ploop_cache *c, unsigned int i)
+{
+	if ((i & 1023) == 1023) {
+		spin_unlock_irq(&c->lock);
+		cond_resched();
+		spin_lock_irq(&c->lock);
+	}
+}
+
+/* Called under c->lock */
+static void pcache_drop(struct ploop_cache *c, struct pcache_slot *s)
+{
+	radix_tree_delete(&c->map, s->iblk);
+	if (s->state == PCACHE_DIRTY)
+		c->nr_dirty--;
+	s->state = PCACHE_DEAD;
+	c->nr_dead++;
+	pcache_index_mark(c, s);
+}
+
+/* Fail request which was not submitted anywhere yet */
+static void pcache_fail(struct ploop_request *preq, int err)
+{
+	PLOOP_REQ_SET_ERROR(preq, err);
+	ploop_prepare_io_request(preq);
+	ploop_complete_io_request(preq);
+}
+
+static int pcache_sync_io(struct ploop_cache *c, int rw, struct page **pages,
+			  unsigned int nr, sector_t sec)
+{
+	while (nr) {
+		struct bio *bio;
+		int err;
+
+		bio = bio_alloc(GFP_NOIO, min_t(unsigned int, nr,
+						BIO_MAX_PAGES));
+		if (!bio)
+			return -ENOMEM;
+
+		bio->bi_bdev = c->bdev;
+		bio->bi_sector = sec;
+		while (nr && bio_add_page(bio, *pages, PAGE_SIZE, 0) ==
+		       PAGE_SIZE) {
+			pages++;
+			nr--;
+		}
+		if (!bio->bi_size) {
+			bio_put(bio);
+			return -EIO;
+		}
+		sec += bio->bi_size >> 9;
+
+		err = submit_bio_wait(rw, bio);
+		bio_put(bio);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static inline int pcache_index_io(struct ploop_cache *c, int rw,
+				  unsigned int i)
+{
+	struct page *page = vmalloc_to_page(c->index + i * PCACHE_PER_PAGE);
+
+	return pcache_sync_io(c, rw, &page, 1,
+			      (PLOOP_CACHE_INDEX_OFFSET >> 9) +
+			      i * (PAGE_SIZE >> 9));
+}
+
+/*
+ * Bring index on media in line with slots. Data of slots which first
+ * write completed must be on media before they are recorded dirty,
+ * hence the flush in front of index write.
+ */
+static int pcache_write_index(struct ploop_cache *c)
+{
+	unsigned int i, j, n;
+	int err;
+
+	mutex_lock(&c->index_mutex);
+
+	err = blkdev_issue_flush(c->bdev, GFP_NOIO, NULL);
+	if (err || bitmap_empty(c->index_dirty, c->index_pages))
+		goto out;
+
+	for (i = 0; i < c->index_pages; i++) {
+		struct ploop_cache_entry *e = c->index + i * PCACHE_PER_PAGE;
+		struct pcache_slot *s = c->slots + i * PCACHE_PER_PAGE;
+
+		if (!test_and_clear_bit(i, c->index_dirty))
+			continue;
+
+		n = min_t(unsigned int, PCACHE_PER_PAGE,
+			  c->nr_slots - i * PCACHE_PER_PAGE);
+
+		spin_lock_irq(&c->lock);
+		for (j = 0; j < n; j++) {
+			int dirty = s[j].state == PCACHE_DIRTY && !s[j].fresh;
+
+			e[j].iblk = dirty ? s[j].iblk : 0;
+			e[j].flags = dirty ? PLOOP_CACHE_E_DIRTY : 0;
+		}
+		spin_unlock_irq(&c->lock);
+
+		err = pcache_index_io(c, WRITE_SYNC, i);
+		if (err) {
+			set_bit(i, c->index_dirty);
+			break;
+		}
+		set_bit(i, c->index_wr);
+	}
+
+	if (!err)
+		err = blkdev_issue_flush(c->bdev, GFP_NOIO, NULL);
+	if (err) {
+		/* Not known what reached media, write these again */
+		bitmap_or(c->index_dirty, c->index_dirty, c->index_wr,
+			  c->index_pages);
+		bitmap_zero(c->index_wr, c->index_pages);
+		goto out;
+	}
+
+	spin_lock_irq(&c->lock);
+	for_each_set_bit(i, c->index_wr, c->index_pages) {
+		struct ploop_cache_entry *e = c->index + i * PCACHE_PER_PAGE;
+		struct pcache_slot *s = c->slots + i * PCACHE_PER_PAGE;
+
+		n = min_t(unsigned int, PCACHE_PER_PAGE,
+			  c->nr_slots - i * PCACHE_PER_PAGE);
+		for (j = 0; j < n; j++)
+			s[j].ondisk = !!(e[j].flags & PLOOP_CACHE_E_DIRTY);
+	}
+	spin_unlock_irq(&c->lock);
+	bitmap_zero(c->index_wr, c->index_pages);
+out:
+	mutex_unlock(&c->index_mutex);
+	return err;
+}
+
+static void pcache_io_done(struct pcache_io *pio)
+{
+	struct ploop_cache *c = pio->cache;
+	struct pcache_slot *s = pio->slot;
+	unsigned long flags;
+	int kick;
+
+	spin_lock_irqsave(&c->lock, flags);
+	s->inflight--;
+	if (pio->fresh) {
+		s->fresh = 0;
+		if (pio->error && s->state != PCACHE_DEAD)
+			pcache_drop(c, s);
+		else
+			pcache_index_mark(c, s);
+	}
+	kick = s->state == PCACHE_DEAD && !s->inflight;
+	if (pio->persist && !pio->error) {
+		list_add_tail(&pio->list, &c->done);
+		spin_unlock_irqrestore(&c->lock, flags);
+		wake_up(&c->flush_waitq);
+		return;
+	}
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	if (kick)
+		wake_up(&c->wb_waitq);
+
+	ploop_complete_io_request(pio->preq);
+	kfree(pio);
+}
+
+DEFINE_BIO_CB(pcache_endio)
+{
+	struct pcache_io *pio = bio->bi_private;
+
+	if (!err && !bio_flagged(bio, BIO_UPTODATE))
+		err = -EIO;
+	if (err) {
+		PLOOP_REQ_SET_ERROR(pio->preq, err);
+		pio->error = err;
+	}
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&pio->count))
+		pcache_io_done(pio);
+}
+END_BIO_CB(pcache_endio)
+
+/* Map request bios onto the slot and submit them */
+static void pcache_submit_io(struct pcache_io *pio, unsigned long rw,
+			     struct bio_list *sbl, unsigned int size)
+{
+	struct ploop_cache *c = pio->cache;
+	struct ploop_request *preq = pio->preq;
+	unsigned int mask = (1 << c->io->plo->cluster_log) - 1;
+	sector_t sec = pcache_sector(c, pio->slot) +
+		       (sbl->head->bi_sector & mask);
+	struct bio_list bl;
+	struct bio *b, *bio = NULL;
+	struct bio_vec *bv;
+	int i;
+
+	bio_list_init(&bl);
+	for (b = sbl->head; b && size; b = b->bi_next) {
+		bio_for_each_segment(bv, b, i) {
+			unsigned int len = min_t(unsigned int, bv->bv_len,
+						 size << 9);
+
+			if (!bio || bio_add_page(bio, bv->bv_page, len,
+						 bv->bv_offset) != len) {
+				bio = bio_alloc(GFP_NOFS, 32);
+				if (!bio)
+					goto enomem;
+				bio_list_add(&bl, bio);
+				bio->bi_bdev = c->bdev;
+				bio->bi_sector = sec;
+				bio->bi_private = pio;
+				bio->bi_end_io = pcache_endio;
+				if (bio_add_page(bio, bv->bv_page, len,
+						 bv->bv_offset) != len)
+					goto enomem;
+			}
+			sec += len >> 9;
+			size -= len >> 9;
+			if (!size)
+				break;
+		}
+	}
+
+submit:
+	ploop_prepare_io_request(preq);
+	atomic_inc(&preq->io_count);
+	atomic_set(&pio->count, 1);
+	while ((bio = bio_list_pop(&bl)) != NULL) {
+		atomic_inc(&pio->count);
+		submit_bio(rw, bio);
+	}
+	if (atomic_dec_and_test(&pio->count))
+		pcache_io_done(pio);
+	ploop_complete_io_request(preq);
+	return;
+
+enomem:
+	while ((bio = bio_list_pop(&bl)) != NULL)
+		bio_put(bio);
+	pio->error = -ENOMEM;
+	PLOOP_REQ_SET_ERROR(preq, -ENOMEM);
+	goto submit;
+}
+
+/* Copy slot to its cluster in image, called with wb_mutex held */
+static int pcache_copy_back(struct ploop_cache *c, struct pcache_slot *s,
+			    iblock_t iblk)
+{
+	struct ploop_io *io = c->io;
+	int err;
+
+	err = pcache_sync_io(c, READ_SYNC, c->wb_pages, c->wb_nr_pages,
+			     pcache_sector(c, s));
+	if (!err)
+		err = io->ops->sync_writevec(io, c->wb_pages, c->wb_nr_pages,
+				(sector_t)iblk << io->plo->cluster_log);
+	return err;
+}
+
+/*
+ * Drop slot of iblk before the cluster is written behind the cache.
+ * Dirty data is written back first: the write which supersedes it may
+ * be partial or fail. The slot must be gone on media before that write
+ * is issued, or a crash would bring stale data back.
+ */
+static int pcache_invalidate(struct ploop_cache *c, iblock_t iblk)
+{
+	struct pcache_slot *s;
+	u32 gen;
+	int err, dirty;
+
+again:
+	spin_lock_irq(&c->lock);
+	s = radix_tree_lookup(&c->map, iblk);
+	if (!s) {
+		spin_unlock_irq(&c->lock);
+		return 0;
+	}
+	dirty = s->state == PCACHE_DIRTY;
+	gen = s->gen;
+	s->inflight++;
+	spin_unlock_irq(&c->lock);
+
+	err = 0;
+	if (dirty) {
+		mutex_lock(&c->wb_mutex);
+		err = pcache_copy_back(c, s, iblk);
+		mutex_unlock(&c->wb_mutex);
+		if (!err)
+			err = blkdev_issue_flush(c->io->files.bdev, GFP_NOIO,
+						 NULL);
+	}
+
+	spin_lock_irq(&c->lock);
+	s->inflight--;
+	if (!err && radix_tree_lookup(&c->map, iblk) == s) {
+		if (s->gen != gen) {
+			spin_unlock_irq(&c->lock);
+			goto again;
+		}
+		pcache_drop(c, s);
+	}
+	spin_unlock_irq(&c->lock);
+
+	if (err)
+		return err;
+
+	return pcache_write_index(c);
+}
+
+/* Cache only clusters plain dio_sync_writevec() can write back */
+static int pcache_cluster_ok(struct ploop_cache *c, iblock_t iblk)
+{
+	struct ploop_io *io = c->io;
+	sector_t sec = (sector_t)iblk << io->plo->cluster_log;
+	sector_t end = sec + (1 << io->plo->cluster_log);
+
+	while (sec < end) {
+		struct extent_map *em;
+		int uninit;
+
+		em = extent_lookup_create(io, sec, end - sec);
+		if (IS_ERR(em))
+			return 0;
+		uninit = em->block_start == BLOCK_UNINIT;
+		sec = em->end;
+		extent_put(em);
+		if (uninit)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Serve request from the cache if possible. Returns 0 if it must go
+ * to the image; a copy of the cluster the request would make stale
+ * is dropped by then.
+ */
+static int pcache_route(struct ploop_cache *c, struct ploop_request *preq,
+			unsigned long rw, struct bio_list *sbl,
+			iblock_t iblk, unsigned int size)
+{
+	struct ploop_device *plo = c->io->plo;
+	int write = !!(rw & REQ_WRITE);
+	int whole = size == (1 << plo->cluster_log);
+	int fua = (rw & REQ_FUA) ||
+		  test_bit(PLOOP_REQ_FORCE_FUA, &preq->state);
+	struct pcache_slot *s;
+	struct pcache_io *pio;
+	int preloaded = 0, err;
+
+	if (iblk == PLOOP_ZERO_INDEX)
+		iblk = 0;
+
+	if ((rw & REQ_DISCARD) ||
+	    (write && preq->eng_state != PLOOP_E_COMPLETE))
+		goto bypass;
+
+	pio = kzalloc(sizeof(*pio), GFP_NOFS);
+	if (!pio)
+		goto bypass;
+
+	if (write && whole && pcache_cluster_ok(c, iblk) &&
+	    !radix_tree_preload(GFP_NOFS))
+		preloaded = 1;
+
+	spin_lock_irq(&c->lock);
+	s = radix_tree_lookup(&c->map, iblk);
+	if (!s && preloaded && c->nr_free) {
+		s = &c->slots[c->free[--c->nr_free]];
+		s->iblk = iblk;
+		s->state = PCACHE_DIRTY;
+		s->fresh = 1;
+		c->nr_dirty++;
+		radix_tree_insert(&c->map, iblk, s);
+		pio->fresh = 1;
+	} else if (!s && preloaded) {
+		c->wb_kick = 1;
+	}
+	if (!s) {
+		spin_unlock_irq(&c->lock);
+		if (preloaded) {
+			radix_tree_preload_end();
+			wake_up(&c->wb_waitq);
+		}
+		kfree(pio);
+		goto miss;
+	}
+
+	s->inflight++;
+	s->ref = 1;
+	if (write) {
+		s->gen++;
+		if (s->state == PCACHE_CLEAN) {
+			s->state = PCACHE_DIRTY;
+			c->nr_dirty++;
+			pcache_index_mark(c, s);
+		}
+		/* FUA is cheap only if media already has the slot dirty */
+		if (fua && !(s->ondisk && !s->fresh))
+			pio->persist = 1;
+	}
+	spin_unlock_irq(&c->lock);
+	if (preloaded)
+		radix_tree_preload_end();
+
+	pio->cache = c;
+	pio->preq = preq;
+	pio->slot = s;
+
+	rw &= ~(REQ_FLUSH | REQ_FUA);
+	if (write && fua) {
+		clear_bit(PLOOP_REQ_FORCE_FUA, &preq->state);
+		if (!pio->persist)
+			rw |= REQ_FUA;
+	}
+
+	plo->st.cache_hit++;
+	pcache_submit_io(pio, rw, sbl, size);
+	return 1;
+
+bypass:
+	if (write) {
+		err = pcache_invalidate(c, iblk);
+		if (err) {
+			pcache_fail(preq, err);
+			return 1;
+		}
+	}
+miss:
+	plo->st.cache_miss++;
+	return 0;
+}
+
+static int pcache_defer(struct ploop_cache *c, struct ploop_request *preq,
+			unsigned long rw, struct bio_list *sbl,
+			iblock_t iblk, unsigned int size, int flush_only)
+{
+	struct pcache_req *r;
+
+	r = kzalloc(sizeof(*r), GFP_NOFS);
+	if (!r)
+		return 0;
+
+	r->preq = preq;
+	r->rw = rw;
+	if (sbl)
+		r->sbl = *sbl;
+	r->iblk = iblk;
+	r->size = size;
+	r->flush_only = flush_only;
+
+	spin_lock_irq(&c->lock);
+	list_add_tail(&r->list, &c->queue);
+	spin_unlock_irq(&c->lock);
+
+	wake_up(&c->flush_waitq);
+	return 1;
+}
+
+/*
+ * Flusher: complete writes which wait for the index and let requests
+ * with preflush go on once both devices are flushed. All queued
+ * requests share a single index write and image flush.
+ */
+static void pcache_run_queue(struct ploop_cache *c)
+{
+	LIST_HEAD(reqs);
+	LIST_HEAD(done);
+	struct pcache_req *r, *rtmp;
+	struct pcache_io *pio, *ptmp;
+	int err, image = 0;
+
+	spin_lock_irq(&c->lock);
+	list_splice_init(&c->queue, &reqs);
+	list_splice_init(&c->done, &done);
+	spin_unlock_irq(&c->lock);
+
+	if (list_empty(&reqs) && list_empty(&done))
+		return;
+
+	err = pcache_write_index(c);
+
+	list_for_each_entry_safe(pio, ptmp, &done, list) {
+		if (err) {
+			PLOOP_REQ_SET_ERROR(pio->preq, err);
+		}
+		ploop_complete_io_request(pio->preq);
+		kfree(pio);
+	}
+
+	list_for_each_entry(r, &reqs, list)
+		if (!r->flush_only)
+			image = 1;
+	if (!err && image)
+		err = blkdev_issue_flush(c->io->files.bdev, GFP_NOIO, NULL);
+
+	list_for_each_entry_safe(r, rtmp, &reqs, list) {
+		list_del(&r->list);
+		if (err) {
+			pcache_fail(r->preq, err);
+		} else if (r->flush_only) {
+			/* Image is flushed by the request itself */
+			dio_issue_flush_nocache(c->io, r->preq);
+		} else {
+			clear_bit(PLOOP_REQ_FORCE_FLUSH, &r->preq->state);
+			r->rw &= ~REQ_FLUSH;
+			if (!pcache_route(c, r->preq, r->rw, &r->sbl,
+					  r->iblk, r->size))
+				dio_submit_nocache(c->io, r->preq, r->rw,
+						   &r->sbl, r->iblk, r->size);
+		}
+		kfree(r);
+	}
+}
+
+static int pcache_flusher(void *data)
+{
+	struct ploop_cache *c = data;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(c->flush_waitq,
+					 kthread_should_stop() ||
+					 !list_empty(&c->queue) ||
+					 !list_empty(&c->done));
+		pcache_run_queue(c);
+	}
+	return 0;
+}
+
+static int pcache_wb_cmp(const void *a, const void *b)
+{
+	const struct pcache_wb *x = a, *y = b;
+
+	return x->iblk < y->iblk ? -1 : x->iblk > y->iblk;
+}
+
+/*
+ * Copy up to PCACHE_WB_BATCH dirty slots to the image in order of
+ * their position there. Returns number of slots cleaned or error.
+ */
+static int pcache_writeback(struct ploop_cache *c)
+{
+	struct ploop_io *io = c->io;
+	unsigned int i, n = 0;
+	int err = 0;
+
+	spin_lock_irq(&c->lock);
+	for (i = 0; i < c->nr_slots && n < PCACHE_WB_BATCH; i++) {
+		struct pcache_slot *s = &c->slots[c->wb_hand];
+
+		if (s->state == PCACHE_DIRTY && !s->fresh) {
+			c->wb[n].iblk = s->iblk;
+			c->wb[n].slot = c->wb_hand;
+			c->wb[n].gen = s->gen;
+			s->inflight++;
+			n++;
+		}
+		if (++c->wb_hand == c->nr_slots)
+			c->wb_hand = 0;
+		pcache_relax_lock(c, i);
+	}
+	spin_unlock_irq(&c->lock);
+
+	if (!n)
+		return 0;
+
+	sort(c->wb, n, sizeof(*c->wb), pcache_wb_cmp, NULL);
+
+	for (i = 0; i < n && !err; i++) {
+		mutex_lock(&c->wb_mutex);
+		err = pcache_copy_back(c, &c->slots[c->wb[i].slot],
+				       c->wb[i].iblk);
+		mutex_unlock(&c->wb_mutex);
+	}
+	if (!err)
+		err = blkdev_issue_flush(io->files.bdev, GFP_NOIO, NULL);
+
+	spin_lock_irq(&c->lock);
+	for (i = 0; i < n; i++) {
+		struct pcache_slot *s = &c->slots[c->wb[i].slot];
+
+		s->inflight--;
+		if (!err && s->state == PCACHE_DIRTY &&
+		    s->gen == c->wb[i].gen) {
+			s->state = PCACHE_CLEAN;
+			c->nr_dirty--;
+			pcache_index_mark(c, s);
+		}
+	}
+	spin_unlock_irq(&c->lock);
+
+	if (err)
+		return err;
+
+	io->plo->st.cache_wb += n;
+	return n;
+}
+
+/* Drop clean slots when free ones run low, second chance by ref bit */
+static void pcache_evict(struct ploop_cache *c)
+{
+	unsigned int i;
+
+	spin_lock_irq(&c->lock);
+	if (c->nr_free >= c->nr_slots / 16)
+		goto out;
+
+	for (i = 0; c->nr_free + c->nr_dead < c->nr_slots / 8 &&
+		    i < 2 * c->nr_slots; i++) {
+		struct pcache_slot *s = &c->slots[c->evict_hand];
+
+		if (++c->evict_hand == c->nr_slots)
+			c->evict_hand = 0;
+		pcache_relax_lock(c, i);
+
+		if (s->state != PCACHE_CLEAN || s->inflight)
+			continue;
+		if (s->ref) {
+			s->ref = 0;
+			continue;
+		}
+		pcache_drop(c, s);
+	}
+out:
+	spin_unlock_irq(&c->lock);
+}
+
+/* Give back dropped slots which are idle and erased on media */
+static void pcache_reap(struct ploop_cache *c)
+{
+	unsigned int i;
+
+	if (!c->nr_dead || pcache_write_index(c))
+		return;
+
+	spin_lock_irq(&c->lock);
+	for (i = 0; i < c->nr_slots && c->nr_dead; i++) {
+		struct pcache_slot *s = &c->slots[i];
+
+		pcache_relax_lock(c, i);
+		if (s->state != PCACHE_DEAD || s->inflight || s->ondisk)
+			continue;
+		s->state = PCACHE_FREE;
+		s->ref = 0;
+		c->nr_dead--;
+		c->free[c->nr_free++] = i;
+	}
+	spin_unlock_irq(&c->lock);
+}
+
+static int pcache_writer(void *data)
+{
+	struct ploop_cache *c = data;
+
+	while (!kthread_should_stop()) {
+		int n;
+
+		c->wb_kick = 0;
+		n = pcache_writeback(c);
+		if (n < 0)
+			ploop_msg_once(c->io->plo,
+				       "cache writeback failed: %d", n);
+		pcache_evict(c);
+		pcache_reap(c);
+		wake_up(&c->drain_waitq);
+
+		if (n > 0 && (c->drain || c->nr_dirty > c->nr_slots / 2)) {
+			cond_resched();
+			continue;
+		}
+		wait_event_interruptible_timeout(c->wb_waitq,
+						 kthread_should_stop() ||
+						 c->drain || c->wb_kick,
+						 PCACHE_WB_DELAY);
+	}
+	return 0;
+}
+
+/* Let writer run without pauses until few dirty slots are left */
+static int pcache_drain(struct ploop_cache *c)
+{
+	int err;
+
+	c->drain = 1;
+	wake_up(&c->wb_waitq);
+	err = wait_event_interruptible(c->drain_waitq,
+				       c->nr_dirty <= PCACHE_WB_BATCH);
+	c->drain = 0;
+	return err;
+}
+
+int ploop_cache_submit(struct ploop_io *io, struct ploop_request *preq,
+		       unsigned long rw, struct bio_list *sbl,
+		       iblock_t iblk, unsigned int size)
+{
+	struct ploop_cache *c = io->cache;
+	int err;
+
+	if ((rw & REQ_FLUSH) ||
+	    test_bit(PLOOP_REQ_FORCE_FLUSH, &preq->state)) {
+		if (pcache_defer(c, preq, rw, sbl, iblk, size, 0))
+			return 1;
+
+		/* No memory to defer, flush the cache here */
+		err = pcache_write_index(c);
+		if (!err)
+			err = blkdev_issue_flush(io->files.bdev, GFP_NOIO,
+						 NULL);
+		if (err) {
+			pcache_fail(preq, err);
+			return 1;
+		}
+		clear_bit(PLOOP_REQ_FORCE_FLUSH, &preq->state);
+		rw &= ~REQ_FLUSH;
+		if (!pcache_route(c, preq, rw, sbl, iblk, size))
+			dio_submit_nocache(io, preq, rw, sbl, iblk, size);
+		return 1;
+	}
+
+	return pcache_route(c, preq, rw, sbl, iblk, size);
+}
+
+/* Returns 1 if flush request was taken care of */
+int ploop_cache_issue_flush(struct ploop_io *io, struct ploop_request *preq)
+{
+	struct ploop_cache *c = io->cache;
+	int err;
+
+	if (pcache_defer(c, preq, 0, NULL, 0, 0, 1))
+		return 1;
+
+	err = pcache_write_index(c);
+	if (err) {
+		pcache_fail(preq, err);
+		return 1;
+	}
+	return 0;
+}
+
+/* Called from fast path, the cache may be detached meanwhile */
+int ploop_cache_mapped(struct ploop_io *io, sector_t isec)
+{
+	struct ploop_cache *c;
+	unsigned long flags;
+	int ret = 0;
+
+	rcu_read_lock();
+	c = rcu_dereference(io->cache);
+	if (c) {
+		spin_lock_irqsave(&c->lock, flags);
+		ret = radix_tree_lookup(&c->map,
+				isec >> io->plo->cluster_log) != NULL;
+		spin_unlock_irqrestore(&c->lock, flags);
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+/* Image is truncated to alloc_head, called under ploop_quiesce() */
+int ploop_cache_trim(struct ploop_io *io, iblock_t alloc_head)
+{
+	struct ploop_cache *c = io->cache;
+	unsigned int i;
+
+	spin_lock_irq(&c->lock);
+	for (i = 0; i < c->nr_slots; i++) {
+		struct pcache_slot *s = &c->slots[i];
+
+		if ((s->state == PCACHE_CLEAN || s->state == PCACHE_DIRTY) &&
+		    s->iblk >= alloc_head)
+			pcache_drop(c, s);
+		pcache_relax_lock(c, i);
+	}
+	spin_unlock_irq(&c->lock);
+
+	return pcache_write_index(c);
+}
+
+static int pcache_geometry(struct ploop_cache *c, unsigned int cluster_log)
+{
+	sector_t size = i_size_read(c->bdev->bd_inode) >> 9;
+	sector_t cs = 1 << cluster_log;
+	sector_t index = PLOOP_CACHE_INDEX_OFFSET >> 9;
+	u64 n;
+
+	if (size <= index + cs)
+		return -ENOSPC;
+
+	n = div64_u64((u64)(size - index - cs) << 9,
+		      (cs << 9) + sizeof(struct ploop_cache_entry));
+	n = min_t(u64, n, UINT_MAX / sizeof(struct pcache_slot));
+
+	for (; n; n--) {
+		unsigned int pages = DIV_ROUND_UP(n, PCACHE_PER_PAGE);
+		sector_t start = index + pages * (PAGE_SIZE >> 9);
+
+		start = (start + cs - 1) & ~(cs - 1);
+		if (start + n * cs <= size) {
+			c->nr_slots = n;
+			c->index_pages = pages;
+			c->data_start = start;
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+/* Install slots recorded dirty on media by previous run */
+static int pcache_load_index(struct ploop_cache *c)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < c->index_pages; i++) {
+		err = pcache_index_io(c, READ_SYNC, i);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < c->nr_slots; i++) {
+		struct ploop_cache_entry *e = &c->index[i];
+		struct pcache_slot *s = &c->slots[i];
+
+		if (!(e->flags & PLOOP_CACHE_E_DIRTY) ||
+		    e->iblk >= c->io->alloc_head ||
+		    radix_tree_lookup(&c->map, e->iblk))
+			continue;
+
+		err = radix_tree_insert(&c->map, e->iblk, s);
+		if (err)
+			return err;
+		s->iblk = e->iblk;
+		s->state = PCACHE_DIRTY;
+		s->ondisk = 1;
+		c->nr_dirty++;
+	}
+	return 0;
+}
+
+static int pcache_load(struct ploop_cache *c, int reset)
+{
+	struct ploop_io *io = c->io;
+	struct inode *inode = io->files.inode;
+	struct ploop_cache_header *hdr;
+	struct page *page;
+	int err;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	err = pcache_sync_io(c, READ_SYNC, &page, 1, 0);
+	if (err)
+		goto out;
+
+	hdr = page_address(page);
+	if (!reset && hdr->magic == PLOOP_CACHE_MAGIC) {
+		err = -ESTALE;
+		if (hdr->version != PLOOP_CACHE_VERSION ||
+		    hdr->cluster_log != io->plo->cluster_log ||
+		    hdr->nr_slots != c->nr_slots ||
+		    hdr->data_start != c->data_start ||
+		    hdr->image_dev != new_encode_dev(inode->i_sb->s_dev) ||
+		    hdr->image_ino != inode->i_ino)
+			goto out;
+
+		err = pcache_load_index(c);
+		if (err)
+			goto out;
+	}
+
+	/* Index first: a new header must never cover a foreign index */
+	bitmap_fill(c->index_dirty, c->index_pages);
+	err = pcache_write_index(c);
+	if (err)
+		goto out;
+
+	memset(hdr, 0, PAGE_SIZE);
+	hdr->magic = PLOOP_CACHE_MAGIC;
+	hdr->version = PLOOP_CACHE_VERSION;
+	hdr->cluster_log = io->plo->cluster_log;
+	hdr->nr_slots = c->nr_slots;
+	hdr->data_start = c->data_start;
+	hdr->image_dev = new_encode_dev(inode->i_sb->s_dev);
+	hdr->image_ino = inode->i_ino;
+
+	err = pcache_sync_io(c, WRITE_FLUSH_FUA, &page, 1, 0);
+out:
+	__free_page(page);
+	return err;
+}
+
+static void pcache_free(struct ploop_cache *c)
+{
+	unsigned int i;
+
+	if (c->writer)
+		kthread_stop(c->writer);
+	if (c->flusher)
+		kthread_stop(c->flusher);
+
+	if (c->slots) {
+		for (i = 0; i < c->nr_slots; i++)
+			if (c->slots[i].state == PCACHE_CLEAN ||
+			    c->slots[i].state == PCACHE_DIRTY)
+				radix_tree_delete(&c->map, c->slots[i].iblk);
+	}
+
+	if (c->wb_pages) {
+		for (i = 0; i < c->wb_nr_pages; i++)
+			if (c->wb_pages[i])
+				__free_page(c->wb_pages[i]);
+		kfree(c->wb_pages);
+	}
+	kfree(c->wb);
+	kfree(c->index_wr);
+	kfree(c->index_dirty);
+	vfree(c->index);
+	vfree(c->free);
+	vfree(c->slots);
+	blkdev_put(c->bdev, PCACHE_MODE);
+	kfree(c);
+}
+
+static int pcache_attach(struct ploop_io *io, unsigned long arg)
+{
+	struct ploop_cache_ctl ctl;
+	struct ploop_cache *c;
+	struct block_device *bdev;
+	struct file *file;
+	unsigned int i;
+	dev_t dev;
+	int err;
+
+	if (copy_from_user(&ctl, (void*)arg, sizeof(ctl)))
+		return -EFAULT;
+
+	if (io->cache)
+		return -EBUSY;
+	if (!(io->files.file->f_mode & FMODE_WRITE))
+		return -EROFS;
+	/* Writeback relies on extents being stable */
+	if (io->files.em_tree->_get_extent ||
+	    io->plo->cluster_log + 9 < PAGE_SHIFT)
+		return -EOPNOTSUPP;
+
+	file = fget(ctl.fd);
+	if (!file)
+		return -EBADF;
+	dev = file_inode(file)->i_rdev;
+	err = S_ISBLK(file_inode(file)->i_mode) ? 0 : -ENOTBLK;
+	fput(file);
+	if (err)
+		return err;
+
+	bdev = blkdev_get_by_dev(dev, PCACHE_MODE, io);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+	if (bdev_logical_block_size(bdev) > PAGE_SIZE) {
+		blkdev_put(bdev, PCACHE_MODE);
+		return -EINVAL;
+	}
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c) {
+		blkdev_put(bdev, PCACHE_MODE);
+		return -ENOMEM;
+	}
+
+	c->io = io;
+	c->bdev = bdev;
+	spin_lock_init(&c->lock);
+	INIT_RADIX_TREE(&c->map, GFP_ATOMIC);
+	INIT_LIST_HEAD(&c->queue);
+	INIT_LIST_HEAD(&c->done);
+	mutex_init(&c->index_mutex);
+	mutex_init(&c->wb_mutex);
+	init_waitqueue_head(&c->flush_waitq);
+	init_waitqueue_head(&c->wb_waitq);
+	init_waitqueue_head(&c->drain_waitq);
+
+	err = pcache_geometry(c, io->plo->cluster_log);
+	if (err)
+		goto out_free;
+
+	err = -ENOMEM;
+	c->slots = vzalloc(sizeof(*c->slots) * c->nr_slots);
+	c->free = vmalloc(sizeof(*c->free) * c->nr_slots);
+	c->index = vzalloc((size_t)c->index_pages * PAGE_SIZE);
+	c->index_dirty = kzalloc(BITS_TO_LONGS(c->index_pages) *
+				 sizeof(long), GFP_KERNEL);
+	c->index_wr = kzalloc(BITS_TO_LONGS(c->index_pages) *
+			      sizeof(long), GFP_KERNEL);
+	c->wb = kmalloc(sizeof(*c->wb) * PCACHE_WB_BATCH, GFP_KERNEL);
+	c->wb_nr_pages = 1 << (io->plo->cluster_log + 9 - PAGE_SHIFT);
+	c->wb_pages = kzalloc(sizeof(struct page *) * c->wb_nr_pages,
+			      GFP_KERNEL);
+	if (!c->slots || !c->free || !c->index || !c->index_dirty ||
+	    !c->index_wr || !c->wb || !c->wb_pages)
+		goto out_free;
+	for (i = 0; i < c->wb_nr_pages; i++) {
+		c->wb_pages[i] = alloc_page(GFP_KERNEL);
+		if (!c->wb_pages[i])
+			goto out_free;
+	}
+
+	err = pcache_load(c, ctl.flags & PLOOP_CACHE_F_RESET);
+	if (err)
+		goto out_free;
+
+	for (i = c->nr_slots; i-- > 0; )
+		if (c->slots[i].state == PCACHE_FREE)
+			c->free[c->nr_free++] = i;
+
+	c->flusher = kthread_run(pcache_flusher, c, "ploop_cache%d",
+				 io->plo->index);
+	if (IS_ERR(c->flusher)) {
+		err = PTR_ERR(c->flusher);
+		c->flusher = NULL;
+		goto out_free;
+	}
+	c->writer = kthread_run(pcache_writer, c, "ploop_cachewb%d",
+				io->plo->index);
+	if (IS_ERR(c->writer)) {
+		err = PTR_ERR(c->writer);
+		c->writer = NULL;
+		goto out_free;
+	}
+
+	rcu_assign_pointer(io->cache, c);
+	return 0;
+
+out_free:
+	pcache_free(c);
+	return err;
+}
+
+/* Called under ploop_quiesce() or when the device is stopped */
+void ploop_cache_detach(struct ploop_io *io)
+{
+	struct ploop_cache *c = io->cache;
+	int err = 0;
+
+	if (!c)
+		return;
+
+	kthread_stop(c->writer);
+	c->writer = NULL;
+	kthread_stop(c->flusher);
+	c->flusher = NULL;
+	pcache_run_queue(c);
+
+	while (c->nr_dirty) {
+		err = pcache_writeback(c);
+		if (err <= 0)
+			break;
+	}
+	if (err >= 0)
+		err = pcache_write_index(c);
+	if (err || c->nr_dirty)
+		printk(KERN_WARNING "ploop%d: %u clusters were not written "
+		       "back from cache (%d)\n", io->plo->index,
+		       c->nr_dirty, err);
+
+	rcu_assign_pointer(io->cache, NULL);
+	synchronize_rcu();
+	pcache_free(c);
+}
+
+int ploop_cache_ctl(struct ploop_io *io, int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case PLOOP_CACHE_ATTACH:
+		return pcache_attach(io, arg);
+	case PLOOP_CACHE_WRITEBACK:
+		return io->cache ? pcache_drain(io->cache) : -ENOENT;
+	case PLOOP_CACHE_DETACH:
+		if (!io->cache)
+			return -ENOENT;
+		ploop_cache_detach(io);
+		return 0;
+	}
+	return -EINVAL;
+}
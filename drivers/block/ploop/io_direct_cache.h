@@ -0,0 +1,19 @@
+#ifndef __IO_DIRECT_CACHE_H__
+#define __IO_DIRECT_CACHE_H__
+
+int ploop_cache_ctl(struct ploop_io *io, int cmd, unsigned long arg);
+void ploop_cache_detach(struct ploop_io *io);
+int ploop_cache_trim(struct ploop_io *io, iblock_t alloc_head);
+int ploop_cache_submit(struct ploop_io *io, struct ploop_request *preq,
+		       unsigned long rw, struct bio_list *sbl,
+		       iblock_t iblk, unsigned int size);
+int ploop_cache_issue_flush(struct ploop_io *io, struct ploop_request *preq);
+int ploop_cache_mapped(struct ploop_io *io, sector_t isec);
+
+/* io_direct.c, I/O to the image itself */
+void dio_submit_nocache(struct ploop_io *io, struct ploop_request *preq,
+			unsigned long rw, struct bio_list *sbl,
+			iblock_t iblk, unsigned int size);
+void dio_issue_flush_nocache(struct ploop_io *io, struct ploop_request *preq);
+
+#endif
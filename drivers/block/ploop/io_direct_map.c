@@ -802,12 +802,99 @@ struct extent_map *extent_lookup_create(struct ploop_io *io,
 					sector_t start, sector_t len)
 {
 	struct extent_map_tree *tree = io->files.em_tree;
+	struct extent_map *em;
+
+	/* Fast path, also moves the extent to the tail of LRU */
+	em = extent_lookup(tree, start);
+	if (em) {
+		if (start + len <= em->end) {
+			io->plo->st.em_hit++;
+			return em;
+		}
+		extent_put(em);
+	}
+	io->plo->st.em_miss++;
 
 	return map_extent_get_block(io, tree->mapping,
 				    start, len, 0, mapping_gfp_mask(tree->mapping),
 				    NULL);
 }
 
+/*
+ * Fill extent tree of a freshly opened image by walking fiemap of
+ * the whole file, so that cold requests do not go to host fs one
+ * cluster at a time. Stops when the cache is full: LRU would only
+ * evict what we have just read in.
+ */
+void ploop_dio_prefetch(struct ploop_io *io)
+{
+	struct extent_map_tree *tree = io->files.em_tree;
+	struct inode *inode = tree->mapping->host;
+	loff_t off = 0, size = i_size_read(inode);
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	mm_segment_t old_fs;
+	int i, ret, last = 0;
+
+	if (tree->_get_extent || !inode->i_op->fiemap || tree->map_size)
+		return;
+
+	fe = (struct fiemap_extent *)__get_free_page(GFP_NOFS);
+	if (!fe)
+		return;
+
+	while (off < size && !last) {
+		fieinfo.fi_extents_start = fe;
+		fieinfo.fi_extents_max = PAGE_SIZE / sizeof(*fe);
+		fieinfo.fi_flags = 0;
+		fieinfo.fi_extents_mapped = 0;
+
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		ret = inode->i_op->fiemap(inode, &fieinfo, off, size - off);
+		set_fs(old_fs);
+
+		if (ret || !fieinfo.fi_extents_mapped)
+			break;
+
+		for (i = 0; i < fieinfo.fi_extents_mapped && !last; i++) {
+			struct extent_map *em;
+
+			last = !!(fe[i].fe_flags & FIEMAP_EXTENT_LAST);
+			off = fe[i].fe_logical + fe[i].fe_length;
+
+			/* Leave odd extents to __map_extent_bmap() */
+			if ((fe[i].fe_flags & (FIEMAP_EXTENT_UNWRITTEN |
+					       FIEMAP_EXTENT_DELALLOC |
+					       FIEMAP_EXTENT_UNKNOWN)) ||
+			    !(fe[i].fe_physical >> 9))
+				continue;
+
+			if (purge_lru_mapping(tree)) {
+				last = 1;
+				break;
+			}
+
+			em = alloc_extent_map(GFP_NOFS);
+			if (!em) {
+				last = 1;
+				break;
+			}
+
+			em->start = fe[i].fe_logical >> 9;
+			em->end = off >> 9;
+			em->block_start = fe[i].fe_physical >> 9;
+
+			/* The tree holds its own reference on success */
+			add_extent_mapping(tree, em);
+			extent_put(em);
+		}
+		cond_resched();
+	}
+
+	free_page((unsigned long)fe);
+}
+
 static int drop_extent_map(struct extent_map_tree *tree)
 {
 	struct extent_map *em;
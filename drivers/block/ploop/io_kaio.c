@@ -16,6 +16,7 @@
 #define KAIO_PREALLOC (128 * 1024 * 1024) /* 128 MB */
 
 #define KAIO_MAX_PAGES_PER_REQ 32	  /* 128 KB */
+#define KAIO_MAX_PREQS_PER_REQ 8	  /* preqs batched into one aio */
 
 /* This will be used as flag "ploop_kaio_open() succeeded" */
 static struct extent_map_tree
@@ -29,6 +30,7 @@ int ploop_kaio_upgrade(struct address_space * mapping);
 
 static int __kaio_truncate(struct ploop_io * io, struct file * file, u64 pos);
 static int kaio_truncate(struct ploop_io * io, struct file * file, __u32 a_h);
+static int kaio_clone_cluster(struct ploop_io * io, struct ploop_request * preq);
 
 static void __kaio_queue_fsync_req(struct ploop_request * preq, int prio)
 {
@@ -56,6 +58,14 @@ static void kaio_queue_trunc_req(struct ploop_request * preq)
 	__kaio_queue_fsync_req(preq, 1);
 }
 
+/* Cloning may sleep for long, it is done by fsync thread */
+static void kaio_queue_clone_req(struct ploop_request * preq)
+{
+	spin_lock_irq(&preq->plo->lock);
+	kaio_queue_fsync_req(preq);
+	spin_unlock_irq(&preq->plo->lock);
+}
+
 static void kaio_complete_io_state(struct ploop_request * preq)
 {
 	struct ploop_device * plo   = preq->plo;
@@ -66,6 +76,7 @@ static void kaio_complete_io_state(struct ploop_request * preq)
 	    preq->eng_state == PLOOP_E_INDEX_READ ||
 	    preq->eng_state == PLOOP_E_TRANS_INDEX_READ ||
 	    preq->eng_state == PLOOP_E_DELTA_READ ||
+	    preq->eng_state == PLOOP_E_DEDUP_READ ||
 	    preq->eng_state == PLOOP_E_TRANS_DELTA_READ) {
 		ploop_complete_io_state(preq);
 		return;
@@ -102,7 +113,12 @@ static void kaio_complete_io_request(struct ploop_request * preq)
 }
 
 struct kaio_req {
-	struct ploop_request *preq;
+	int		      nr_preqs;
+	int		      nr_segs;
+	size_t		      count;
+	loff_t		      pos;
+	unsigned long	      rw;
+	struct ploop_request *preq[KAIO_MAX_PREQS_PER_REQ];
 	struct bio_vec	      bvecs[0];
 };
 
@@ -129,10 +145,11 @@ static void kaio_rw_aio_complete(u64 data, long res)
 static void kaio_rw_kreq_complete(u64 data, long res)
 {
 	struct kaio_req *kreq = (struct kaio_req *)data;
-	struct ploop_request *preq = kreq->preq;
+	int i;
 
+	for (i = 0; i < kreq->nr_preqs; i++)
+		kaio_rw_aio_complete((u64)kreq->preq[i], res);
 	kfree(kreq);
-	kaio_rw_aio_complete((u64)preq, res);
 }
 
 static struct kaio_req *kaio_kreq_alloc(struct ploop_request *preq, int *nr_p)
@@ -143,14 +160,14 @@ static struct kaio_req *kaio_kreq_alloc(struct ploop_request *preq, int *nr_p)
 	kreq = kmalloc(offsetof(struct kaio_req, bvecs[nr]), GFP_NOFS);
 	if (kreq) {
 		*nr_p = nr;
-		kreq->preq = preq;
+		kreq->nr_preqs = 1;
+		kreq->preq[0] = preq;
 	}
 
 	return kreq;
 }
 
-static int kaio_kernel_submit(struct file *file, struct kaio_req *kreq,
-		size_t nr_segs, size_t count, loff_t pos, unsigned long rw)
+static int kaio_kernel_submit(struct file *file, struct kaio_req *kreq)
 {
 	struct kiocb *iocb;
 	unsigned short op;
@@ -161,24 +178,90 @@ static int kaio_kernel_submit(struct file *file, struct kaio_req *kreq,
 	if (!iocb)
 		return -ENOMEM;
 
-	if (rw & REQ_WRITE)
+	if (kreq->rw & REQ_WRITE)
 		op = IOCB_CMD_WRITE_ITER;
 	else
 		op = IOCB_CMD_READ_ITER;
 
-	iov_iter_init_bvec(&iter, kreq->bvecs, nr_segs, count, 0);
-	aio_kernel_init_iter(iocb, file, op, &iter, pos);
+	iov_iter_init_bvec(&iter, kreq->bvecs, kreq->nr_segs, kreq->count, 0);
+	aio_kernel_init_iter(iocb, file, op, &iter, kreq->pos);
 	aio_kernel_init_callback(iocb, kaio_rw_kreq_complete, (u64)kreq);
 
 	err = aio_kernel_submit(iocb);
 	if (err)
 		printk("kaio_kernel_submit: aio_kernel_submit failed with "
 		       "err=%d (rw=%s; state=%ld/0x%lx; pos=%lld; len=%ld)\n",
-		       err, (rw & REQ_WRITE) ? "WRITE" : "READ",
-		       kreq->preq->eng_state, kreq->preq->state, pos, count);
+		       err, (kreq->rw & REQ_WRITE) ? "WRITE" : "READ",
+		       kreq->preq[0]->eng_state, kreq->preq[0]->state,
+		       kreq->pos, kreq->count);
 	return err;
 }
 
+/*
+ * Submission batching.
+ *
+ * kreqs built by ploop thread during one pass are not submitted one by
+ * one. A kreq continuing the pending one in the file (same direction,
+ * adjacent position, bvecs fit) is merged into it, so contiguous requests
+ * go down to the filesystem as single aio. The pending kreq is submitted
+ * when the next one does not fit, when ploop thread has no more work
+ * queued, or when it goes to sleep (kaio_unplug()). So batches grow only
+ * while there is a queue to batch from and under light load every kreq
+ * goes down immediately.
+ */
+static int kaio_kreq_merge(struct kaio_req *dst, struct kaio_req *src)
+{
+	if ((dst->rw & REQ_WRITE) != (src->rw & REQ_WRITE) ||
+	    dst->pos + dst->count != src->pos ||
+	    dst->nr_segs + src->nr_segs > KAIO_MAX_PAGES_PER_REQ ||
+	    dst->nr_preqs + src->nr_preqs > KAIO_MAX_PREQS_PER_REQ)
+		return 0;
+
+	memcpy(dst->bvecs + dst->nr_segs, src->bvecs,
+	       src->nr_segs * sizeof(struct bio_vec));
+	memcpy(dst->preq + dst->nr_preqs, src->preq,
+	       src->nr_preqs * sizeof(struct ploop_request *));
+	dst->nr_segs += src->nr_segs;
+	dst->nr_preqs += src->nr_preqs;
+	dst->count += src->count;
+	kfree(src);
+	return 1;
+}
+
+static void kaio_batch_flush(struct ploop_io *io)
+{
+	struct kaio_req *kreq = io->kreq_batch;
+	int err, i;
+
+	if (!kreq)
+		return;
+
+	io->kreq_batch = NULL;
+	if (kreq->nr_preqs > 1)
+		io->plo->st.kaio_batched += kreq->nr_preqs;
+
+	err = kaio_kernel_submit(io->files.file, kreq);
+	if (err) {
+		for (i = 0; i < kreq->nr_preqs; i++)
+			kaio_rw_aio_complete((u64)kreq->preq[i], err);
+		kfree(kreq);
+	}
+}
+
+static int kaio_kreq_queue(struct ploop_io *io, struct kaio_req *kreq)
+{
+	/* Only ploop thread batches, fsync thread resubmits directly */
+	if (current != io->plo->thread)
+		return kaio_kernel_submit(io->files.file, kreq);
+
+	if (io->kreq_batch && kaio_kreq_merge(io->kreq_batch, kreq))
+		return 0;
+
+	kaio_batch_flush(io);
+	io->kreq_batch = kreq;
+	return 0;
+}
+
 /*
  * Pack as many bios from the list pointed by '*bio_pp' to kreq as possible,
  * but no more than 'size' bytes. Returns 'copy' equal to # bytes copied.
@@ -250,10 +333,11 @@ static size_t kaio_kreq_pack(struct kaio_req *kreq, int *nr_segs,
  * The same as WRITE, but here the file plays the role of source and the
  * content of bios in sbl plays the role of destination.
  */
-static void kaio_sbl_submit(struct file *file, struct ploop_request *preq,
+static void kaio_sbl_submit(struct ploop_io *io, struct ploop_request *preq,
 			    unsigned long rw, struct bio_list *sbl,
 			    iblock_t iblk, size_t size)
 {
+	struct file *file = io->files.file;
 	struct bio *bio = sbl->head;
 	int idx = 0;
 
@@ -285,9 +369,13 @@ static void kaio_sbl_submit(struct file *file, struct ploop_request *preq,
 		}
 
 		copy = kaio_kreq_pack(kreq, &nr_segs, &bio, &idx, size);
+		kreq->nr_segs = nr_segs;
+		kreq->count = copy;
+		kreq->pos = off;
+		kreq->rw = rw;
 
 		atomic_inc(&preq->io_count);
-		err = kaio_kernel_submit(file, kreq, nr_segs, copy, off, rw);
+		err = kaio_kreq_queue(io, kreq);
 		if (err) {
 			PLOOP_REQ_SET_ERROR(preq, err);
 			ploop_complete_io_request(preq);
@@ -299,6 +387,9 @@ static void kaio_sbl_submit(struct file *file, struct ploop_request *preq,
 		size -= copy;
 	}
 
+	if (current == io->plo->thread && !ploop_more_work(preq->plo))
+		kaio_batch_flush(io);
+
 	kaio_complete_io_request(preq);
 }
 
@@ -315,10 +406,15 @@ kaio_submit(struct ploop_io *io, struct ploop_request * preq,
 		return;
 	}
 
+	if (test_bit(PLOOP_REQ_CLONE, &preq->state)) {
+		kaio_queue_clone_req(preq);
+		return;
+	}
+
 	if (iblk == PLOOP_ZERO_INDEX)
 		iblk = 0;
 
-	kaio_sbl_submit(io->files.file, preq, rw, sbl, iblk, size);
+	kaio_sbl_submit(io, preq, rw, sbl, iblk, size);
 }
 
 /* returns non-zero if and only if preq was resubmitted */
@@ -406,6 +502,11 @@ static int kaio_fsync_thread(void * data)
 					    preq->prealloc_size >> (plo->cluster_log + 9));
 			if (err)
 				PLOOP_REQ_SET_ERROR(preq, -EIO);
+		} else if (test_and_clear_bit(PLOOP_REQ_CLONE, &preq->state)) {
+			if (kaio_clone_cluster(io, preq)) {
+				spin_lock_irq(&plo->lock);
+				continue;
+			}
 		} else {
 			struct file *file = io->files.file;
 			err = vfs_fsync(file, 1);
@@ -489,7 +590,12 @@ kaio_submit_alloc(struct ploop_io *io, struct ploop_request * preq,
 	preq->iblock = iblk;
 	preq->eng_state = PLOOP_E_DATA_WBI;
 
-	kaio_sbl_submit(io->files.file, preq, REQ_WRITE, sbl, iblk, size);
+	if (test_bit(PLOOP_REQ_CLONE, &preq->state)) {
+		kaio_queue_clone_req(preq);
+		return;
+	}
+
+	kaio_sbl_submit(io, preq, REQ_WRITE, sbl, iblk, size);
 }
 
 static int kaio_release_prealloced(struct ploop_io * io)
@@ -737,6 +843,66 @@ kaio_sync_write(struct ploop_io * io, struct page * page, unsigned int len,
 	return ret;
 }
 
+/* Make cluster preq->iblock of this image share data blocks with
+ * cluster preq->src_iblock of trans delta. If backing fs refuses,
+ * merge falls back to copying: the cluster is read in and written as
+ * usual. Returns non-zero if and only if preq was resubmitted.
+ */
+static int kaio_clone_cluster(struct ploop_io * io, struct ploop_request * preq)
+{
+	struct ploop_device * plo = preq->plo;
+	struct ploop_delta * src = map_top_delta(plo->trans_map);
+	int log = plo->cluster_log + 9;
+	struct bio * b = preq->aux_bio;
+	struct bio_list tbl;
+	sector_t sec;
+	int err, i;
+
+	err = vfs_clone_file_range(src->io.files.file,
+				   (loff_t)preq->src_iblock << log,
+				   io->files.file,
+				   (loff_t)preq->iblock << log, 1 << log);
+	if (!err) {
+		plo->st.bio_trans_clone++;
+		return 0;
+	}
+
+	if (err != -EOPNOTSUPP && err != -EXDEV && err != -EINVAL) {
+		PLOOP_REQ_SET_ERROR(preq, err);
+		return 0;
+	}
+
+	printk(KERN_INFO "ploop%d: cannot clone clusters (%d), "
+	       "merge falls back to copy\n", plo->index, err);
+	plo->merge_clone = 0;
+
+	sec = (sector_t)preq->src_iblock << plo->cluster_log;
+	for (i = 0; i < b->bi_vcnt; i++) {
+		struct bio_vec * bv = b->bi_io_vec + i;
+
+		err = kaio_sync_read(&src->io, bv->bv_page, bv->bv_len,
+				     bv->bv_offset, sec);
+		if (err) {
+			PLOOP_REQ_SET_ERROR(preq, err);
+			return 0;
+		}
+		sec += bv->bv_len >> 9;
+	}
+
+	tbl.head = tbl.tail = b;
+	kaio_submit(io, preq, preq->req_rw, &tbl, preq->iblock, 1 << log);
+	return 1;
+}
+
+static int kaio_may_clone(struct ploop_io * io, struct ploop_io * src)
+{
+	struct file * file = io->files.file;
+
+	return src->ops == io->ops &&
+	       file_inode(src->files.file)->i_sb == file_inode(file)->i_sb &&
+	       file->f_op->clone_file_range != NULL;
+}
+
 static int kaio_alloc_sync(struct ploop_io * io, loff_t pos, loff_t len)
 {
 	return __kaio_truncate(io, io->files.file, pos + len);
@@ -940,7 +1106,7 @@ static int kaio_truncate(struct ploop_io * io, struct file * file,
 
 static void kaio_unplug(struct ploop_io * io)
 {
-	/* Need more thinking how to implement unplug */
+	kaio_batch_flush(io);
 }
 
 static void kaio_queue_settings(struct ploop_io * io, struct request_queue * q)
@@ -1004,6 +1170,7 @@ static struct ploop_io_ops ploop_io_ops_kaio =
 	.alloc		=	kaio_alloc_sync,
 	.submit		=	kaio_submit,
 	.submit_alloc	=	kaio_submit_alloc,
+	.may_clone	=	kaio_may_clone,
 	.read_page	=	kaio_read_page,
 	.write_page	=	kaio_write_page,
 	.sync_read	=	kaio_sync_read,
@@ -42,8 +42,13 @@ typedef u32 map_index_t;
 
 static struct kmem_cache * ploop_map_cache;
 
-static LIST_HEAD(map_lru);
-static DEFINE_SPINLOCK(map_lru_lock);
+/* Every map has its own LRU of map_node-s protected by plo->lock,
+ * so that lookups and LRU updates never touch shared state. Maps which
+ * have cached pages are linked to map_list, it is used only to reclaim
+ * pages of other devices when the global max_map_pages is exceeded.
+ */
+static LIST_HEAD(map_list);
+static DEFINE_SPINLOCK(map_list_lock);
 static atomic_t map_pages_nr = ATOMIC_INIT(0);
 
 /*
@@ -76,6 +81,10 @@ struct map_node
 	struct list_head	lru;
 	u8			*levels;
 
+	/* Link in map->wb_batch and time when the node was batched */
+	struct list_head	wb_link;
+	unsigned long		wb_tstamp;
+
 	/* List of preq's blocking on this mapping.
 	 *
 	 * We queue here several kinds of requests:
@@ -120,27 +129,29 @@ void map_init(struct ploop_device * plo, struct ploop_map * map)
 	map->plo = plo;
 	map->rb_root = RB_ROOT;
 	map->lru_buffer_ptr = 0;
-	init_waitqueue_head(&map->destroy_waitq);
+	INIT_LIST_HEAD(&map->lru);
+	INIT_LIST_HEAD(&map->list);
+	INIT_LIST_HEAD(&map->wb_batch);
+	map->ra_last = 0;
+	map->ra_page = 0;
 }
 
-/* Deliver batch of LRU updates from buffer to global LRU.
+/* Deliver batch of LRU updates from buffer to LRU of the map.
  * Everything, which has zero refcnt, is added to LRU or moved to tail
  * of LRU. Everything, which has non-zero refcnt, is removed from LRU.
+ * Called under plo->lock.
  */
 static void flush_lru_buffer(struct ploop_map * map)
 {
 	int i;
-	unsigned long flags;
 
-	spin_lock_irqsave(&map_lru_lock, flags);
 	for (i = 0; i < map->lru_buffer_ptr; i++) {
 		struct map_node * m = map->lru_buffer[i];
 		if (atomic_dec_and_test(&m->refcnt))
-			list_move_tail(&m->lru, &map_lru);
+			list_move_tail(&m->lru, &map->lru);
 		else
 			list_del_init(&m->lru);
 	}
-	spin_unlock_irqrestore(&map_lru_lock, flags);
 
 	map->lru_buffer_ptr = 0;
 }
@@ -190,6 +201,48 @@ static struct map_node * map_lookup(struct ploop_map * map, cluster_t block)
 	return NULL;
 }
 
+/* The first cluster mapped by index page pageno */
+static inline cluster_t map_page_start(cluster_t pageno)
+{
+	return pageno ? pageno * INDEX_PER_PAGE - PLOOP_MAP_OFFSET : 0;
+}
+
+/* Sequential access detector. When accesses step from cluster to
+ * cluster, keep tune.map_readahead index pages ahead of the current
+ * one in cache, so that a cold sequential scan does not stall on every
+ * index page. Called under plo->lock.
+ */
+static void map_readahead(struct ploop_map * map, cluster_t block)
+{
+	struct ploop_device * plo = map->plo;
+	cluster_t pageno, last, p;
+
+	if (!plo->tune.map_readahead || block == map->ra_last)
+		return;
+
+	if (block != map->ra_last + 1) {
+		map->ra_last = block;
+		map->ra_page = 0;
+		return;
+	}
+	map->ra_last = block;
+
+	pageno = (block + PLOOP_MAP_OFFSET) / INDEX_PER_PAGE;
+	last = pageno + plo->tune.map_readahead;
+	if (last < map->ra_page)
+		return;
+
+	for (p = max(pageno + 1, map->ra_page); p <= last; p++) {
+		cluster_t clu = map_page_start(p);
+
+		if (clu >= map->max_index)
+			break;
+		if (!map_lookup(map, clu) && ploop_map_prefetch(plo, clu, 0))
+			break;
+	}
+	map->ra_page = p;
+}
+
 /* Lookup mapping atomically. */
 
 int ploop_fastmap(struct ploop_map * map, cluster_t block, iblock_t *result)
@@ -206,6 +259,8 @@ int ploop_fastmap(struct ploop_map * map, cluster_t block, iblock_t *result)
 		return 0;
 	}
 
+	map_readahead(map, block);
+
 	m = map_lookup(map, block);
 	if (m == NULL)
 		return -1;
@@ -240,6 +295,7 @@ static void map_node_destroy(struct map_node *m)
 {
 	rb_erase(&m->rb_link, &m->parent->rb_root);
 	list_del_init(&m->lru);
+	BUG_ON(!list_empty(&m->wb_link));
 	BUG_ON(atomic_read(&m->refcnt));
 	BUG_ON(!list_empty(&m->io_queue));
 	if (m->page)
@@ -251,59 +307,78 @@ static void map_node_destroy(struct map_node *m)
 	kmem_cache_free(ploop_map_cache, m);
 }
 
-static void map_lru_scan(void)
+/* Evict up to nr unused nodes from the head of map LRU while map holds
+ * more than target pages. Called under plo->lock.
+ */
+static void map_lru_shrink(struct ploop_map * map, unsigned int target, int nr)
+{
+	while (map->pages > target && nr-- > 0 && !list_empty(&map->lru)) {
+		struct map_node * m;
+
+		m = list_first_entry(&map->lru, struct map_node, lru);
+
+		/* Grabbed by ploop_fastmap(), but lru buffer is not
+		 * flushed yet. It will be re-added on flush. */
+		if (atomic_read(&m->refcnt)) {
+			list_del_init(&m->lru);
+			continue;
+		}
+		map_node_destroy(m);
+	}
+}
+
+/* This map is within its limits, when it is small and active. */
+static inline int map_is_protected(struct ploop_map * map)
+{
+	return map->pages <= map->plo->tune.min_map_pages &&
+	       time_after(map->last_activity +
+			  map->plo->tune.max_map_inactivity, jiffies) &&
+	       !test_bit(PLOOP_MAP_DEAD, &map->flags);
+}
+
+/* Global limit is exceeded: reclaim pages of all the devices round-robin.
+ * plo->lock nests outside of map_list_lock, so it is only trylocked here.
+ */
+static void map_lru_scan_global(void)
 {
 	int max_loops = atomic_read(&map_pages_nr);
 
+	spin_lock_irq(&map_list_lock);
 	while (atomic_read(&map_pages_nr) > max_map_pages &&
-	       --max_loops >= 0) {
+	       --max_loops >= 0 && !list_empty(&map_list)) {
 		struct ploop_map * map;
-		struct map_node * candidate = NULL;
 
-		spin_lock_irq(&map_lru_lock);
-		if (!list_empty(&map_lru)) {
-			candidate = list_first_entry(&map_lru, struct map_node, lru);
-			atomic_inc(&candidate->refcnt);
-		}
-		spin_unlock_irq(&map_lru_lock);
+		map = list_first_entry(&map_list, struct ploop_map, list);
+		list_move_tail(&map->list, &map_list);
 
-		if (!candidate)
-			break;
+		if (!spin_trylock(&map->plo->lock))
+			continue;
 
-		map = candidate->parent;
+		if (!map_is_protected(map))
+			map_lru_shrink(map, 0, PLOOP_LRU_BUFFER);
+		if (!map->pages)
+			list_del_init(&map->list);
 
-		spin_lock_irq(&map->plo->lock);
-		spin_lock(&map_lru_lock);
+		spin_unlock(&map->plo->lock);
+	}
+	spin_unlock_irq(&map_list_lock);
+}
 
-		if (waitqueue_active(&map->destroy_waitq)) {
-			atomic_dec(&candidate->refcnt);
-			wake_up(&map->destroy_waitq);
-			spin_unlock(&map_lru_lock);
-			spin_unlock_irq(&map->plo->lock);
-			return;
-		}
+/* The device which grows its map cache pays for it: it trims itself down
+ * to its own budget first and only then goes after other devices.
+ */
+static void map_lru_scan(struct ploop_map * map)
+{
+	unsigned int budget = map->plo->tune.max_map_pages;
 
-		list_del_init(&candidate->lru);
-
-		if (atomic_dec_and_test(&candidate->refcnt)) {
-			/* This instance is within its limits, just
-			 * readd node back to tail of lru.
-			 */
-			if (map->pages <= map->plo->tune.min_map_pages &&
-			    time_after(map->last_activity +
-				       map->plo->tune.max_map_inactivity, jiffies) &&
-			    !test_bit(PLOOP_MAP_DEAD, &map->flags)) {
-				list_add_tail(&candidate->lru, &map_lru);
-			} else {
-				map_node_destroy(candidate);
-			}
-		}
-		spin_unlock(&map_lru_lock);
+	if (budget && map->pages > budget) {
+		spin_lock_irq(&map->plo->lock);
+		map_lru_shrink(map, budget, map->pages - budget);
 		spin_unlock_irq(&map->plo->lock);
-
-		if (!(max_loops & 16))
-			cond_resched();
 	}
+
+	if (atomic_read(&map_pages_nr) > max_map_pages)
+		map_lru_scan_global();
 }
 
 static struct map_node *
@@ -334,6 +409,7 @@ map_create(struct ploop_map * map, cluster_t block)
 
 	INIT_LIST_HEAD(&m->io_queue);
 	INIT_LIST_HEAD(&m->lru);
+	INIT_LIST_HEAD(&m->wb_link);
 	m->levels = NULL;
 	m->state = 0;
 	atomic_set(&m->refcnt, 1);
@@ -371,10 +447,14 @@ map_create(struct ploop_map * map, cluster_t block)
 
 	map->pages++;
 	atomic_inc(&map_pages_nr);
+	if (list_empty(&map->list)) {
+		spin_lock(&map_list_lock);
+		list_add_tail(&map->list, &map_list);
+		spin_unlock(&map_list_lock);
+	}
 	spin_unlock_irq(&plo->lock);
 
-	if (atomic_read(&map_pages_nr) > max_map_pages)
-		map_lru_scan();
+	map_lru_scan(map);
 
 	return m;
 }
@@ -891,6 +971,18 @@ static void copy_index_for_wb(struct page * page, struct map_node * m, int level
 
 /* Data write is commited. Now we need to update index. */
 
+static inline int map_index_batch_possible(struct ploop_request * preq)
+{
+	struct ploop_device * plo = preq->plo;
+
+	return plo->tune.index_batch_delay &&
+	       preq->map->parent == &plo->map &&
+	       !test_bit(PLOOP_REQ_RELOC_A, &preq->state) &&
+	       !test_bit(PLOOP_REQ_RELOC_S, &preq->state) &&
+	       !test_bit(PLOOP_REQ_ZERO, &preq->state) &&
+	       !test_bit(PLOOP_S_ATTENTION, &plo->state);
+}
+
 void ploop_index_update(struct ploop_request * preq)
 {
 	struct ploop_device * plo = preq->plo;
@@ -936,6 +1028,22 @@ void ploop_index_update(struct ploop_request * preq)
 		return;
 	}
 
+	/* Group commit: do not write the page right now, hold it for
+	 * index_batch_delay. Updates to this page arriving meanwhile
+	 * are queued as PLOOP_E_INDEX_DELAY above and all of them go to
+	 * disk with single write, see ploop_index_batch_flush().
+	 */
+	if (map_index_batch_possible(preq)) {
+		preq->eng_state = PLOOP_E_INDEX_DELAY;
+		list_add_tail(&preq->list, &m->io_queue);
+		spin_lock_irq(&plo->lock);
+		m->wb_tstamp = jiffies;
+		list_add_tail(&m->wb_link, &m->parent->wb_batch);
+		spin_unlock_irq(&plo->lock);
+		__TRACE("b %p %u %p\n", preq, preq->req_cluster, m);
+		return;
+	}
+
 	page = alloc_page(GFP_NOFS);
 	if (page == NULL) {
 		clear_bit(PLOOP_MAP_WRITEBACK, &m->state);
@@ -1207,6 +1315,51 @@ static void map_wb_complete(struct map_node * m, int err)
 	put_page(page);
 }
 
+/* Returns how long the oldest batched map page may still wait,
+ * 0 if its window is expired. Called under plo->lock.
+ */
+long ploop_index_batch_timeout(struct ploop_map * map)
+{
+	struct map_node * m;
+	unsigned long expire;
+
+	if (list_empty(&map->wb_batch))
+		return MAX_SCHEDULE_TIMEOUT;
+
+	m = list_first_entry(&map->wb_batch, struct map_node, wb_link);
+	expire = m->wb_tstamp + map->plo->tune.index_batch_delay;
+	if (!time_before(jiffies, expire))
+		return 0;
+	return expire - jiffies;
+}
+
+/* Start writeback of batched map pages whose window is expired,
+ * or of all of them if force is set. Every page is written once,
+ * carrying all the index updates accumulated in its io_queue.
+ */
+void ploop_index_batch_flush(struct ploop_map * map, int force)
+{
+	struct ploop_device * plo = map->plo;
+	struct map_node * m;
+
+	spin_lock_irq(&plo->lock);
+	while (!list_empty(&map->wb_batch)) {
+		m = list_first_entry(&map->wb_batch, struct map_node, wb_link);
+		if (!force &&
+		    time_before(jiffies, m->wb_tstamp + plo->tune.index_batch_delay))
+			break;
+
+		list_del_init(&m->wb_link);
+		plo->st.map_batch_writes++;
+		spin_unlock_irq(&plo->lock);
+
+		map_wb_complete(m, 0);
+
+		spin_lock_irq(&plo->lock);
+	}
+	spin_unlock_irq(&plo->lock);
+}
+
 void
 ploop_index_wb_complete(struct ploop_request * preq)
 {
@@ -1229,20 +1382,6 @@ void ploop_map_start(struct ploop_map * map, u64 bd_size)
 }
 
 
-static void map_wait(struct ploop_map * map)
-{
-	DEFINE_WAIT(_wait);
-	prepare_to_wait(&map->destroy_waitq, &_wait, TASK_UNINTERRUPTIBLE);
-
-	spin_unlock(&map_lru_lock);
-	spin_unlock_irq(&map->plo->lock);
-	io_schedule();
-	spin_lock_irq(&map->plo->lock);
-	spin_lock(&map_lru_lock);
-
-	finish_wait(&map->destroy_waitq, &_wait);
-}
-
 void ploop_map_destroy(struct ploop_map * map)
 {
 	int i;
@@ -1256,25 +1395,46 @@ void ploop_map_destroy(struct ploop_map * map)
 
 	map->lru_buffer_ptr = 0;
 
-	spin_lock(&map_lru_lock);
-	while ((node = map->rb_root.rb_node) != NULL) {
-		struct map_node * m = rb_entry(node, struct map_node, rb_link);
-		/* refcnt can be not zero if and only if this node is grabbed
-		 * by map_lru_scan() and in flight between releasing
-		 * map_lru_lock and taking plo->lock. We can skip this entry
-		 * if will be destroyed by map_lru_scan(), because we
-		 * set PLOOP_MAP_DEAD.
-		 */
-		if (atomic_read(&m->refcnt) == 0)
-			map_node_destroy(m);
-		else
-			map_wait(map);
-	}
-	spin_unlock(&map_lru_lock);
+	while ((node = map->rb_root.rb_node) != NULL)
+		map_node_destroy(rb_entry(node, struct map_node, rb_link));
+
+	spin_lock(&map_list_lock);
+	list_del_init(&map->list);
+	spin_unlock(&map_list_lock);
 	spin_unlock_irq(&map->plo->lock);
 	BUG_ON(map->pages);
 }
 
+/* Queue reads of all the index pages which are not cached yet, stopping
+ * when map cache budget is exhausted. Reads are done by ploop thread,
+ * caller is blocked only while there are no free requests.
+ */
+int ploop_map_warm(struct ploop_map * map)
+{
+	struct ploop_device * plo = map->plo;
+	unsigned int budget = plo->tune.max_map_pages ? : max_map_pages;
+	cluster_t pageno, clu;
+
+	if (test_bit(PLOOP_MAP_IDENTICAL, &map->flags))
+		return 0;
+
+	for (pageno = 0; (clu = map_page_start(pageno)) < map->max_index;
+	     pageno++) {
+		if (map->pages >= budget)
+			break;
+		if (fatal_signal_pending(current))
+			return -EINTR;
+
+		spin_lock_irq(&plo->lock);
+		if (!map_lookup(map, clu))
+			ploop_map_prefetch(plo, clu, 1);
+		spin_unlock_irq(&plo->lock);
+
+		cond_resched();
+	}
+	return 0;
+}
+
 void ploop_map_remove_delta(struct ploop_map * map, int level)
 {
 	/* For now. */
@@ -213,6 +213,62 @@ static const struct attribute_group stats_group = {
 	.attrs = stats_attributes,
 };
 
+/* Latency histograms live in pstat too, one line of buckets per stage */
+static struct attribute lat_attr_arr[PLOOP_LAT_MAX] = {
+	[PLOOP_LAT_QUEUE]	= { .name = "lat_queue",   .mode = S_IRUGO|S_IWUSR, },
+	[PLOOP_LAT_LOCKOUT]	= { .name = "lat_lockout", .mode = S_IRUGO|S_IWUSR, },
+	[PLOOP_LAT_INDEX]	= { .name = "lat_index",   .mode = S_IRUGO|S_IWUSR, },
+	[PLOOP_LAT_DATA]	= { .name = "lat_data",    .mode = S_IRUGO|S_IWUSR, },
+	[PLOOP_LAT_PROCESS]	= { .name = "lat_process", .mode = S_IRUGO|S_IWUSR, },
+	[PLOOP_LAT_TOTAL]	= { .name = "lat_total",   .mode = S_IRUGO|S_IWUSR, },
+};
+
+static struct attribute *lat_attributes[] = {
+	&lat_attr_arr[PLOOP_LAT_QUEUE],
+	&lat_attr_arr[PLOOP_LAT_LOCKOUT],
+	&lat_attr_arr[PLOOP_LAT_INDEX],
+	&lat_attr_arr[PLOOP_LAT_DATA],
+	&lat_attr_arr[PLOOP_LAT_PROCESS],
+	&lat_attr_arr[PLOOP_LAT_TOTAL],
+	NULL
+};
+
+static const struct attribute_group lat_group = {
+	.attrs = lat_attributes,
+};
+
+static int is_lat_attr(struct attribute *attr)
+{
+	return attr >= lat_attr_arr && attr < lat_attr_arr + PLOOP_LAT_MAX;
+}
+
+static ssize_t lat_show(struct ploop_device * plo, int stage, char *page)
+{
+	ssize_t len = 0;
+	int b, cpu;
+
+	for (b = 0; b < PLOOP_LAT_BUCKETS; b++) {
+		u32 sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu_ptr(plo->lat, cpu)->hist[stage][b];
+
+		len += sprintf(page + len, b ? " %u" : "%u", sum);
+	}
+	len += sprintf(page + len, "\n");
+	return len;
+}
+
+/* Any write resets the histogram */
+static void lat_reset(struct ploop_device * plo, int stage)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(plo->lat, cpu)->hist[stage], 0,
+		       sizeof(per_cpu_ptr(plo->lat, cpu)->hist[stage]));
+}
+
 
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24)
@@ -228,6 +284,9 @@ static ssize_t pstat_show(struct kobject *kobj, struct attribute *attr,
 	struct ploop_device * plo = disk->private_data;
 	int n;
 
+	if (is_lat_attr(attr))
+		return lat_show(plo, attr - lat_attr_arr, page);
+
 	n = attr - (struct attribute *)&_attr_arr;
 
 	return sprintf(page, "%u\n", ((u32*)&plo->st)[n]);
@@ -242,6 +301,11 @@ static ssize_t pstat_store(struct kobject * kobj, struct attribute * attr,
 	unsigned long var;
 	int n;
 
+	if (is_lat_attr(attr)) {
+		lat_reset(plo, attr - lat_attr_arr);
+		return count;
+	}
+
 	var = simple_strtoul(p, &p, 10);
 
 	n = attr - (struct attribute *)&_attr_arr;
@@ -437,12 +501,23 @@ _TUNE_BOOL(pass_fuas);
 _TUNE_BOOL(congestion_detection);
 _TUNE_BOOL(check_zeros);
 _TUNE_U32(min_map_pages);
+_TUNE_U32(max_map_pages);
 _TUNE_JIFFIES(max_map_inactivity);
 _TUNE_BOOL(disable_root_threshold);
 _TUNE_BOOL(disable_user_threshold);
 _TUNE_U32(congestion_high_watermark);
 _TUNE_U32(congestion_low_watermark);
 _TUNE_U32(max_active_requests);
+_TUNE_BOOL(direct_complete);
+_TUNE_JIFFIES(index_batch_delay);
+_TUNE_U32(map_readahead);
+_TUNE_BOOL(merge_clone);
+_TUNE_BOOL(dedup);
+_TUNE_U32(maint_reqs);
+_TUNE_U32(maint_bw);
+_TUNE_U32(maint_iops);
+_TUNE_U32(maint_yield_qlen);
+_TUNE_U32(reloc_batch);
 
 
 struct pattr_sysfs_entry {
@@ -491,6 +566,7 @@ static struct attribute *tune_attributes[] = {
 	_A2(fsync_max),
 	_A2(fsync_delay),
 	_A2(min_map_pages),
+	_A2(max_map_pages),
 	_A2(max_map_inactivity),
 	_A2(pass_flushes),
 	_A2(pass_fuas),
@@ -501,6 +577,16 @@ static struct attribute *tune_attributes[] = {
 	_A2(congestion_high_watermark),
 	_A2(congestion_low_watermark),
 	_A2(max_active_requests),
+	_A2(direct_complete),
+	_A2(index_batch_delay),
+	_A2(map_readahead),
+	_A2(merge_clone),
+	_A2(dedup),
+	_A2(maint_reqs),
+	_A2(maint_bw),
+	_A2(maint_iops),
+	_A2(maint_yield_qlen),
+	_A2(reloc_batch),
 	NULL
 };
 
@@ -627,6 +713,8 @@ void ploop_sysfs_init(struct ploop_device * plo)
 	if (plo->pstat_dir) {
 		if (sysfs_create_group(plo->pstat_dir, &stats_group))
 			printk("ploop: were not able to create pstat dir\n");
+		if (sysfs_create_group(plo->pstat_dir, &lat_group))
+			printk("ploop: were not able to create latency stats\n");
 	}
 	plo->pstate_dir = kobject_add_attr(plo->disk, "pstate", &pattr_ktype);
 	if (plo->pstate_dir) {
@@ -652,6 +740,7 @@ void ploop_sysfs_init(struct ploop_device * plo)
 void ploop_sysfs_uninit(struct ploop_device * plo)
 {
 	if (plo->pstat_dir) {
+		sysfs_remove_group(plo->pstat_dir, &lat_group);
 		sysfs_remove_group(plo->pstat_dir, &stats_group);
 		kobject_del(plo->pstat_dir);
 		kobject_put(plo->pstat_dir);
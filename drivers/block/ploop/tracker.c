@@ -100,6 +100,9 @@ int ploop_tracker_init(struct ploop_device * plo, unsigned long arg)
 		return -EBUSY;
 	if (list_empty(&plo->map.delta_list))
 		return -ENOENT;
+	/* Image behind write-back cache is not what we would copy */
+	if (ploop_top_delta(plo)->io.cache)
+		return -EBUSY;
 
 	ploop_quiesce(plo);
 
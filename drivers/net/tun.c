@@ -746,7 +746,7 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Orphan the skb - required as we might hang on to it
 	 * for indefinite time. */
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		goto drop;
 	skb_orphan(skb);
 
@@ -1064,14 +1064,15 @@ static unsigned long iov_pages(const struct iovec *iv, int offset,
 /* Get packet from user space buffer */
 static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 			    void *msg_control, const struct iovec *iv,
-			    size_t total_len, size_t count, int noblock)
+			    size_t from, size_t total_len, size_t count,
+			    int noblock, struct sk_buff_head *batch)
 {
 	struct tun_pi pi = { 0, cpu_to_be16(ETH_P_IP) };
 	struct sk_buff *skb;
 	size_t len = total_len, align = NET_SKB_PAD, linear;
 	struct virtio_net_hdr gso = { 0 };
 	int good_linear;
-	int offset = 0;
+	int offset = from;
 	int copylen;
 	bool zerocopy = false;
 	int err;
@@ -1082,7 +1083,7 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 			return -EINVAL;
 		len -= sizeof(pi);
 
-		if (memcpy_fromiovecend((void *)&pi, iv, 0, sizeof(pi)))
+		if (memcpy_fromiovecend((void *)&pi, iv, offset, sizeof(pi)))
 			return -EFAULT;
 		offset += sizeof(pi);
 	}
@@ -1236,7 +1237,10 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 	skb_probe_transport_header(skb, 0);
 
 	rxhash = skb_get_hash(skb);
-	netif_rx_ni(skb);
+	if (batch)
+		__skb_queue_tail(batch, skb);
+	else
+		netif_rx_ni(skb);
 
 	tun->dev->stats.rx_packets++;
 	tun->dev->stats.rx_bytes += len;
@@ -1245,6 +1249,55 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 	return total_len;
 }
 
+/*
+ * IFF_BATCH write: every packet is preceded by a struct tun_batch_hdr.
+ * The packets are built one by one, and handed to the stack together
+ * once the buffer is parsed, so that the receive softirq runs once
+ * per write instead of once per packet.
+ */
+static ssize_t tun_get_batch(struct tun_struct *tun, struct tun_file *tfile,
+			     const struct iovec *iv, size_t total_len,
+			     size_t count, int noblock)
+{
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	size_t off = 0, done = 0;
+	ssize_t ret = -EINVAL;
+
+	__skb_queue_head_init(&batch);
+
+	while (off + sizeof(struct tun_batch_hdr) <= total_len) {
+		struct tun_batch_hdr hdr;
+
+		if (memcpy_fromiovecend((void *)&hdr, iv, off, sizeof(hdr))) {
+			ret = -EFAULT;
+			break;
+		}
+		off += sizeof(hdr);
+		if (hdr.len > total_len - off) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = tun_get_user(tun, tfile, NULL, iv, off, hdr.len, count,
+				   noblock, &batch);
+		if (ret < 0)
+			break;
+		off += hdr.len;
+		done = off;
+	}
+
+	if (!skb_queue_empty(&batch)) {
+		local_bh_disable();
+		while ((skb = __skb_dequeue(&batch)) != NULL)
+			netif_rx(skb);
+		local_bh_enable();
+	}
+
+	/* a bad packet ends the batch, report it only if it was the first */
+	return done ? done : ret;
+}
+
 static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 			      unsigned long count, loff_t pos)
 {
@@ -1258,8 +1311,13 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 
 	tun_debug(KERN_INFO, tun, "tun_chr_write %ld\n", count);
 
-	result = tun_get_user(tun, tfile, NULL, iv, iov_length(iv, count),
-			      count, file->f_flags & O_NONBLOCK);
+	if (tun->flags & TUN_BATCH)
+		result = tun_get_batch(tun, tfile, iv, iov_length(iv, count),
+				       count, file->f_flags & O_NONBLOCK);
+	else
+		result = tun_get_user(tun, tfile, NULL, iv, 0,
+				      iov_length(iv, count), count,
+				      file->f_flags & O_NONBLOCK, NULL);
 
 	tun_put(tun);
 	return result;
@@ -1269,7 +1327,7 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 static ssize_t tun_put_user(struct tun_struct *tun,
 			    struct tun_file *tfile,
 			    struct sk_buff *skb,
-			    const struct iovec *iv, int len)
+			    const struct iovec *iv, int from, int len)
 {
 	struct tun_pi pi = { 0, skb->protocol };
 	ssize_t total = 0;
@@ -1283,7 +1341,7 @@ static ssize_t tun_put_user(struct tun_struct *tun,
 			pi.flags |= TUN_PKT_STRIP;
 		}
 
-		if (memcpy_toiovecend(iv, (void *) &pi, 0, sizeof(pi)))
+		if (memcpy_toiovecend(iv, (void *) &pi, from, sizeof(pi)))
 			return -EFAULT;
 		total += sizeof(pi);
 	}
@@ -1330,7 +1388,7 @@ static ssize_t tun_put_user(struct tun_struct *tun,
 			gso.flags = VIRTIO_NET_HDR_F_DATA_VALID;
 		} /* else everything is zero */
 
-		if (unlikely(memcpy_toiovecend(iv, (void *)&gso, total,
+		if (unlikely(memcpy_toiovecend(iv, (void *)&gso, from + total,
 					       sizeof(gso))))
 			return -EFAULT;
 		total += tun->vnet_hdr_sz;
@@ -1338,7 +1396,7 @@ static ssize_t tun_put_user(struct tun_struct *tun,
 
 	len = min_t(int, skb->len, len);
 
-	skb_copy_datagram_const_iovec(skb, 0, iv, total, len);
+	skb_copy_datagram_const_iovec(skb, 0, iv, from + total, len);
 	total += skb->len;
 
 	tun->dev->stats.tx_packets++;
@@ -1347,9 +1405,79 @@ static ssize_t tun_put_user(struct tun_struct *tun,
 	return total;
 }
 
+static int tun_frame_len(struct tun_struct *tun, struct sk_buff *skb)
+{
+	int len = skb->len;
+
+	if (!(tun->flags & TUN_NO_PI))
+		len += sizeof(struct tun_pi);
+	if (tun->flags & TUN_VNET_HDR)
+		len += tun->vnet_hdr_sz;
+	return len;
+}
+
+/* Dequeue the next packet only if it fits whole in @room bytes */
+static struct sk_buff *tun_dequeue_fit(struct tun_struct *tun,
+				       struct sk_buff_head *queue, int room)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->lock, flags);
+	skb = skb_peek(queue);
+	if (skb && sizeof(struct tun_batch_hdr) +
+		   tun_frame_len(tun, skb) <= room)
+		__skb_unlink(skb, queue);
+	else
+		skb = NULL;
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	return skb;
+}
+
+/*
+ * IFF_BATCH read: after the packet the reader waited for, keep copying
+ * queued packets as long as they fit whole in the buffer, each behind
+ * a struct tun_batch_hdr.  Only the first one may be truncated.
+ */
+static ssize_t tun_put_batch(struct tun_struct *tun, struct tun_file *tfile,
+			     struct sk_buff *skb, const struct iovec *iv,
+			     int len)
+{
+	struct sk_buff_head *queue = &tfile->socket.sk->sk_receive_queue;
+	ssize_t total = 0, ret;
+
+	do {
+		struct tun_batch_hdr hdr;
+		int hlen = sizeof(hdr);
+
+		ret = -EINVAL;
+		if (len - total >= hlen)
+			ret = tun_put_user(tun, tfile, skb, iv, total + hlen,
+					   len - total - hlen);
+		if (unlikely(ret < 0)) {
+			kfree_skb(skb);
+			break;
+		}
+		consume_skb(skb);
+
+		/* only what was copied, a truncated first packet has
+		 * TUN_PKT_STRIP set in its tun_pi
+		 */
+		hdr.len = min_t(ssize_t, ret, len - total - hlen);
+		if (memcpy_toiovecend(iv, (void *)&hdr, total, hlen)) {
+			ret = -EFAULT;
+			break;
+		}
+		total += hlen + hdr.len;
+	} while ((skb = tun_dequeue_fit(tun, queue, len - total)) != NULL);
+
+	return total ? total : ret;
+}
+
 static ssize_t tun_do_read(struct tun_struct *tun, struct tun_file *tfile,
 			   struct kiocb *iocb, const struct iovec *iv,
-			   ssize_t len, int noblock)
+			   ssize_t len, int noblock, bool batch)
 {
 	DECLARE_WAITQUEUE(wait, current);
 	struct sk_buff *skb;
@@ -1382,7 +1510,12 @@ static ssize_t tun_do_read(struct tun_struct *tun, struct tun_file *tfile,
 			continue;
 		}
 
-		ret = tun_put_user(tun, tfile, skb, iv, len);
+		if (batch) {
+			ret = tun_put_batch(tun, tfile, skb, iv, len);
+			break;
+		}
+
+		ret = tun_put_user(tun, tfile, skb, iv, 0, len);
 		if (unlikely(ret < 0))
 			kfree_skb(skb);
 		else
@@ -1414,7 +1547,7 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 	}
 
 	ret = tun_do_read(tun, tfile, iocb, iv, len,
-			  file->f_flags & O_NONBLOCK);
+			  file->f_flags & O_NONBLOCK, tun->flags & TUN_BATCH);
 	ret = min_t(ssize_t, ret, len);
 out:
 	tun_put(tun);
@@ -1486,8 +1619,9 @@ static int tun_sendmsg(struct kiocb *iocb, struct socket *sock,
 
 	if (!tun)
 		return -EBADFD;
-	ret = tun_get_user(tun, tfile, m->msg_control, m->msg_iov, total_len,
-			   m->msg_iovlen, m->msg_flags & MSG_DONTWAIT);
+	ret = tun_get_user(tun, tfile, m->msg_control, m->msg_iov, 0,
+			   total_len, m->msg_iovlen,
+			   m->msg_flags & MSG_DONTWAIT, NULL);
 	tun_put(tun);
 	return ret;
 }
@@ -1509,7 +1643,7 @@ static int tun_recvmsg(struct kiocb *iocb, struct socket *sock,
 		goto out;
 	}
 	ret = tun_do_read(tun, tfile, iocb, m->msg_iov, total_len,
-			  flags & MSG_DONTWAIT);
+			  flags & MSG_DONTWAIT, false);
 	if (ret > total_len) {
 		m->msg_flags |= MSG_TRUNC;
 		ret = flags & MSG_TRUNC ? ret : total_len;
@@ -1560,6 +1694,9 @@ static int tun_flags(struct tun_struct *tun)
 	if (tun->flags & TUN_VNET_HDR)
 		flags |= IFF_VNET_HDR;
 
+	if (tun->flags & TUN_BATCH)
+		flags |= IFF_BATCH;
+
 	if (tun->flags & TUN_TAP_MQ)
 		flags |= IFF_MULTI_QUEUE;
 
@@ -1744,6 +1881,11 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	else
 		tun->flags &= ~TUN_VNET_HDR;
 
+	if (ifr->ifr_flags & IFF_BATCH)
+		tun->flags |= TUN_BATCH;
+	else
+		tun->flags &= ~TUN_BATCH;
+
 	if (ifr->ifr_flags & IFF_MULTI_QUEUE)
 		tun->flags |= TUN_TAP_MQ;
 	else
@@ -1917,7 +2059,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		 * This is needed because we never checked for invalid flags on
 		 * TUNSETIFF. */
 		return put_user(IFF_TUN | IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE |
-				IFF_VNET_HDR | IFF_MULTI_QUEUE,
+				IFF_VNET_HDR | IFF_MULTI_QUEUE | IFF_BATCH,
 				(unsigned int __user*)argp);
 	} else if (cmd == TUNSETQUEUE)
 		return tun_set_queue(file, &ifr);
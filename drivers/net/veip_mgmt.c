@@ -142,15 +142,16 @@ void veip_cleanup(void)
 {
 	int i;
 	struct veip_struct *veip;
+	struct ip_entry_table *tbl;
 
 	spin_lock(&veip_lock);
-	for (i = 0; i < VEIP_HASH_SZ; i++)
-		while (!hlist_empty(ip_entry_hash_table + i)) {
+	tbl = ip_entry_table_get();
+	for (i = 0; i < tbl->size; i++)
+		while (!hlist_empty(tbl->buckets + i)) {
 			struct ip_entry_struct *entry;
 
-			entry = hlist_entry(ip_entry_hash_table[i].first,
-					struct ip_entry_struct, ip_hash);
-			hlist_del(&entry->ip_hash);
+			entry = ip_entry_of(tbl->buckets[i].first, tbl->idx);
+			hlist_del(&entry->ip_hash[tbl->idx]);
 			list_del(&entry->ve_list);
 			kfree(entry);
 		}
@@ -27,6 +27,10 @@
 #include <linux/tcp.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <net/addrconf.h>
 
 #include <asm/uaccess.h>
@@ -43,25 +47,117 @@
 #include <linux/if_arp.h>	/* For ARPHRD_ETHER */
 #include <linux/ethtool.h>
 #include <linux/venet.h>
+#include <linux/vznetstat.h>
 #include <linux/ve_proto.h>
 #include <linux/vzctl.h>
 #include <uapi/linux/vzctl_venet.h>
 #include <linux/ve.h>
 #include <linux/venet-netlink.h>
 
-struct hlist_head ip_entry_hash_table[VEIP_HASH_SZ];
+struct ip_entry_table __rcu *ip_entry_table;
 DEFINE_SPINLOCK(veip_lock);
 LIST_HEAD(veip_lh);
 static struct rtnl_link_ops venet_link_ops;
 
-#define ip_entry_hash_function(ip)  (ntohl(ip) & (VEIP_HASH_SZ - 1))
+/* Both are protected by veip_lock */
+static unsigned int ip_entry_count;
+static u32 ip_entry_hashrnd __read_mostly;
 
+static void ip_entry_resize(struct work_struct *work);
+static DECLARE_WORK(ip_entry_resize_work, ip_entry_resize);
+
+/* All the key is hashed, as IPv6 ones often differ in upper words only */
+static inline unsigned int ip_entry_hash_function(struct ip_entry_table *tbl,
+		struct ve_addr_struct *addr)
+{
+	return jhash2(addr->key, ARRAY_SIZE(addr->key), ip_entry_hashrnd) &
+		(tbl->size - 1);
+}
+
+static struct ip_entry_table *ip_entry_table_alloc(unsigned int size,
+		unsigned int idx)
+{
+	struct ip_entry_table *tbl;
+	size_t bytes;
+
+	bytes = sizeof(*tbl) + size * sizeof(struct hlist_head);
+	if (bytes <= PAGE_SIZE)
+		tbl = kzalloc(bytes, GFP_KERNEL);
+	else
+		tbl = vzalloc(bytes);
+	if (tbl == NULL)
+		return NULL;
+
+	tbl->size = size;
+	tbl->idx = idx;
+	return tbl;
+}
+
+static void ip_entry_table_free(struct ip_entry_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+/* Keep the table at most half full */
+static unsigned int ip_entry_table_size(unsigned int count)
+{
+	unsigned int size = VEIP_HASH_SZ;
+
+	while (size < 2 * count)
+		size <<= 1;
+	return size;
+}
+
+static void ip_entry_resize(struct work_struct *work)
+{
+	struct ip_entry_table *old, *new;
+	struct ip_entry_struct *entry;
+	unsigned int size, i;
+
+	spin_lock(&veip_lock);
+	old = ip_entry_table_get();
+	size = ip_entry_table_size(ip_entry_count);
+	spin_unlock(&veip_lock);
+
+	if (size == old->size)
+		return;
+
+	/* Lookups are just slower if we fail */
+	new = ip_entry_table_alloc(size, old->idx ^ 1);
+	if (new == NULL)
+		return;
+
+	spin_lock(&veip_lock);
+	for (i = 0; i < old->size; i++)
+		ip_entry_for_each(entry, old, i)
+			hlist_add_head(&entry->ip_hash[new->idx],
+					new->buckets + ip_entry_hash_function(
+						new, &entry->addr));
+	rcu_assign_pointer(ip_entry_table, new);
+	spin_unlock(&veip_lock);
+
+	/*
+	 * The next resize reuses ip_hash[old->idx], and it can't start
+	 * before we return.
+	 */
+	synchronize_rcu();
+	ip_entry_table_free(old);
+}
+
+/* veip_lock is taken by the caller! */
 void ip_entry_hash(struct ip_entry_struct *entry, struct veip_struct *veip)
 {
-	hlist_add_head_rcu(&entry->ip_hash,
-			ip_entry_hash_table +
-			ip_entry_hash_function(entry->addr.key[3]));
+	struct ip_entry_table *tbl = ip_entry_table_get();
+
+	hlist_add_head_rcu(&entry->ip_hash[tbl->idx], tbl->buckets +
+			ip_entry_hash_function(tbl, &entry->addr));
 	list_add(&entry->ve_list, &veip->ip_lh);
+
+	if (++ip_entry_count > tbl->size / 2)
+		schedule_work(&ip_entry_resize_work);
 }
 
 static void ip_entry_free(struct rcu_head *rcu)
@@ -72,11 +168,17 @@ static void ip_entry_free(struct rcu_head *rcu)
 	kfree(e);
 }
 
+/* veip_lock is taken by the caller! */
 void ip_entry_unhash(struct ip_entry_struct *entry)
 {
+	struct ip_entry_table *tbl = ip_entry_table_get();
+
 	list_del(&entry->ve_list);
-	hlist_del_rcu(&entry->ip_hash);
+	hlist_del_rcu(&entry->ip_hash[tbl->idx]);
 	call_rcu(&entry->rcu, ip_entry_free);
+
+	if (--ip_entry_count < tbl->size / 8 && tbl->size > VEIP_HASH_SZ)
+		schedule_work(&ip_entry_resize_work);
 }
 
 static void veip_free(struct rcu_head *rcu)
@@ -101,12 +203,13 @@ int veip_put(struct veip_struct *veip)
 	return 1;
 }
 
+/* Under rcu_read_lock() or veip_lock */
 struct ip_entry_struct *venet_entry_lookup(struct ve_addr_struct *addr)
 {
+	struct ip_entry_table *tbl = ip_entry_table_get();
 	struct ip_entry_struct *entry;
 
-	hlist_for_each_entry_rcu(entry, ip_entry_hash_table +
-			ip_entry_hash_function(addr->key[3]), ip_hash)
+	ip_entry_for_each(entry, tbl, ip_entry_hash_function(tbl, addr))
 		if (memcmp(&entry->addr, addr, sizeof(*addr)) == 0)
 			return entry;
 	return NULL;
@@ -488,6 +591,10 @@ static int venet_xmit(struct sk_buff *skb, struct net_device *dev)
 	if (unlikely(ve->disable_net))
 		goto outf;
 
+	/* Egress of a VE is limited here, not by a qdisc on the host */
+	if (!ve_is_super(ve) && !venet_rate_allow(ve->stat, skb->len))
+		goto outf;
+
 	if (skb->protocol == __constant_htons(ETH_P_IP)) {
 		struct iphdr *iph;
 		iph = ip_hdr(skb);
@@ -633,7 +740,15 @@ fail:
 	return -ENOMEM;
 }
 
-static netdev_features_t common_features;
+/*
+ * Packets are only handed over to the stack of another namespace, so
+ * checksumming can be left to the final device, and GSO packets need not
+ * be split just to be passed through, as veth does.
+ */
+#define VENET_OFFLOAD_FEATURES	(NETIF_F_SG | NETIF_F_HW_CSUM | \
+				 NETIF_F_ALL_TSO)
+
+static netdev_features_t common_features = VENET_OFFLOAD_FEATURES;
 static const struct net_device_ops venet_netdev_ops;
 
 static int venet_set_features(struct net_device *dev,
@@ -650,6 +765,21 @@ static int venet_set_features(struct net_device *dev,
 	}
 	return 0;
 }
+
+/*
+ * Queue per cpu, so that a qdisc set up on venet does not serialize
+ * senders on different cpus.  Nothing is queued by default anyway.
+ */
+static u16 venet_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	return smp_processor_id() % dev->real_num_tx_queues;
+}
+
+static unsigned int venet_get_num_tx_queues(void)
+{
+	return num_possible_cpus();
+}
+
 #define DRV_NAME	"vz-venet"
 #define DRV_VERSION	"1.0"
 
@@ -723,6 +853,7 @@ static const struct ethtool_ops venet_ethtool_ops = {
 
 static const struct net_device_ops venet_netdev_ops = {
 	.ndo_start_xmit = venet_xmit,
+	.ndo_select_queue = venet_select_queue,
 	.ndo_get_stats = get_stats,
 	.ndo_open = venet_open,
 	.ndo_stop = venet_close,
@@ -732,17 +863,13 @@ static const struct net_device_ops venet_netdev_ops = {
 
 static void venet_setup(struct net_device *dev)
 {
-	/*
-	 * No other features, as they are:
-	 *  - checksumming is required, and nobody else will done our job
-	 */
 	dev->features |= NETIF_F_VENET | NETIF_F_VIRTUAL | NETIF_F_LLTX |
 	       NETIF_F_HIGHDMA | NETIF_F_VLAN_CHALLENGED;
 
 	dev->netdev_ops = &venet_netdev_ops;
 	dev->destructor = venet_destructor;
 
-	dev->hw_features = NETIF_F_SG | NETIF_F_IP_CSUM | NETIF_F_TSO;
+	dev->hw_features = VENET_OFFLOAD_FEATURES;
 
 	dev->features |= common_features;
 
@@ -775,24 +902,32 @@ unlock:
 	spin_unlock(&veip_lock);
 }
 
+/* The table may be resized meanwhile, so stick to the one we started with */
+struct veip_seq_iter {
+	struct ip_entry_table	*tbl;
+	unsigned int		bucket;
+};
+
 static void *veip_seq_start(struct seq_file *m, loff_t *pos)
 {
-	loff_t l;
+	struct veip_seq_iter *iter = m->private;
 	struct ip_entry_struct *s;
+	loff_t l;
 	int i;
 
 	l = *pos;
 	rcu_read_lock();
+	iter->tbl = rcu_dereference(ip_entry_table);
 	if (l == 0) {
-		m->private = (void *)0;
+		iter->bucket = 0;
 		return SEQ_START_TOKEN;
 	}
 
-	for (i = 0; i < VEIP_HASH_SZ; i++) {
-		hlist_for_each_entry_rcu(s, ip_entry_hash_table + i, ip_hash) {
+	for (i = 0; i < iter->tbl->size; i++) {
+		ip_entry_for_each(s, iter->tbl, i) {
 			if (--l == 0) {
-				m->private = (void *)(long)(i + 1);
-				return &s->ip_hash;
+				iter->bucket = i + 1;
+				return s;
 			}
 		}
 	}
@@ -801,24 +936,29 @@ static void *veip_seq_start(struct seq_file *m, loff_t *pos)
 
 static void *veip_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	struct hlist_node *p;
+	struct veip_seq_iter *iter = m->private;
+	struct ip_entry_table *tbl = iter->tbl;
+	struct ip_entry_struct *s;
 	int i;
 
 	if (v == SEQ_START_TOKEN)
 		goto find;
 
-	p = rcu_dereference(((struct hlist_node *)v)->next);
-	if (p != NULL)
+	s = v;
+	s = ip_entry_of(rcu_dereference(hlist_next_rcu(&s->ip_hash[tbl->idx])),
+			tbl->idx);
+	if (s != NULL)
 		goto found;
 
 find:
-	for (i = (int)(long)m->private; i < VEIP_HASH_SZ; i++) {
-		p = rcu_dereference(ip_entry_hash_table[i].first);
-		if (p != NULL) {
-			m->private = (void *)(long)(i + 1);
+	for (i = iter->bucket; i < tbl->size; i++) {
+		s = ip_entry_of(rcu_dereference(
+				hlist_first_rcu(tbl->buckets + i)), tbl->idx);
+		if (s != NULL) {
+			iter->bucket = i + 1;
 found:
 			(*pos)++;
-			return p;
+			return s;
 		}
 	}
 
@@ -832,7 +972,6 @@ static void veip_seq_stop(struct seq_file *m, void *v)
 
 static int veip_seq_show(struct seq_file *m, void *v)
 {
-	struct hlist_node *p;
 	struct ip_entry_struct *entry;
 	struct veip_struct *veip;
 	char s[40];
@@ -842,8 +981,7 @@ static int veip_seq_show(struct seq_file *m, void *v)
 		return 0;
 	}
 
-	p = (struct hlist_node *)v;
-	entry = hlist_entry(p, struct ip_entry_struct, ip_hash);
+	entry = v;
 	veaddr_print(s, sizeof(s), &entry->addr);
 	veip = ACCESS_ONCE(entry->tgt_veip);
 	seq_printf(m, "%39s %10u\n", s, veip == NULL ? 0 : veip->veid);
@@ -859,14 +997,15 @@ static struct seq_operations veip_seq_op = {
 
 static int veip_open(struct inode *inode, struct file *file)
 {
-        return seq_open(file, &veip_seq_op);
+	return seq_open_private(file, &veip_seq_op,
+			sizeof(struct veip_seq_iter));
 }
 
 static struct file_operations proc_veip_operations = {
 	.open		= veip_open,
 	.read		= seq_read,
 	.llseek		= seq_lseek,
-	.release	= seq_release,
+	.release	= seq_release_private,
 };
 #endif
 
@@ -1004,6 +1143,7 @@ static int ve_ip_access_seq_read(struct cgroup *cgrp, struct cftype *cft,
 				 struct seq_file *m)
 {
 	struct ve_struct *ve = cgroup_ve(cgrp);
+	struct ip_entry_table *tbl;
 	struct ip_entry_struct *s;
 	char buf[40];
 	int family = strncmp(cft->name, "ip6", 3) ? AF_INET : AF_INET6;
@@ -1013,9 +1153,9 @@ static int ve_ip_access_seq_read(struct cgroup *cgrp, struct cftype *cft,
 		return -ENOENT;
 
 	rcu_read_lock();
-	for (i = 0; i < VEIP_HASH_SZ; i++) {
-		hlist_for_each_entry_rcu(s, ip_entry_hash_table + i,
-					 ip_hash) {
+	tbl = rcu_dereference(ip_entry_table);
+	for (i = 0; i < tbl->size; i++) {
+		ip_entry_for_each(s, tbl, i) {
 			if (s->addr.family == family &&
 			    s->active_env && s->active_env->veid == ve->veid) {
 				veaddr_print(buf, sizeof(buf), &s->addr);
@@ -1071,7 +1211,8 @@ static int venet_dev_start(struct ve_struct *ve)
 	struct net_device *dev_venet;
 	int err;
 
-	dev_venet = alloc_netdev(0, "venet%d", venet_setup);
+	dev_venet = alloc_netdev_mq(0, "venet%d", venet_setup,
+			venet_get_num_tx_queues());
 	if (!dev_venet)
 		return -ENOMEM;
 	dev_net_set(dev_venet, ve->ve_netns);
@@ -1155,6 +1296,7 @@ static void venet_stop_notifier(void *data)
 static struct ve_hook venet_stop_hook = {
 	.fini		= venet_stop_notifier,
 	.priority	= HOOK_PRIO_FINISHING,
+	.flags		= VE_HOOK_ASYNC,
 	.owner		= THIS_MODULE,
 };
 
@@ -1208,6 +1350,7 @@ static struct rtnl_link_ops venet_link_ops = {
 	.kind		= "venet",
 	.priv_size	= sizeof(struct veip_struct),
 	.setup		= venet_setup,
+	.get_num_tx_queues = venet_get_num_tx_queues,
 	.changelink	= venet_changelink,
 	.policy		= venet_policy,
 	.maxtype	= VENET_INFO_MAX,
@@ -1215,14 +1358,18 @@ static struct rtnl_link_ops venet_link_ops = {
 
 __init int venet_init(void)
 {
+	struct ip_entry_table *tbl;
 	struct proc_dir_entry *de;
-	int i, err;
+	int err;
 
 	if (get_ve0()->_venet_dev != NULL)
 		return -EEXIST;
 
-	for (i = 0; i < VEIP_HASH_SZ; i++)
-		INIT_HLIST_HEAD(ip_entry_hash_table + i);
+	ip_entry_hashrnd = get_random_int();
+	tbl = ip_entry_table_alloc(VEIP_HASH_SZ, 0);
+	if (tbl == NULL)
+		return -ENOMEM;
+	rcu_assign_pointer(ip_entry_table, tbl);
 
 	err = register_pernet_device(&venet_net_ops);
 	if (err)
@@ -1248,6 +1395,7 @@ err_cgroup:
 err_proc:
 	unregister_pernet_device(&venet_net_ops);
 err_netdev:
+	ip_entry_table_free(tbl);
 	return err;
 }
 
@@ -1262,6 +1410,8 @@ __exit void venet_exit(void)
 
 	/* Ensure there are no outstanding rcu callbacks */
 	rcu_barrier();
+	cancel_work_sync(&ip_entry_resize_work);
+	ip_entry_table_free(rcu_dereference_protected(ip_entry_table, 1));
 
 	BUG_ON(!list_empty(&veip_lh));
 	rtnl_link_unregister(&venet_link_ops);
@@ -1286,4 +1436,4 @@ EXPORT_SYMBOL(veip_findcreate);
 EXPORT_SYMBOL(veip_put);
 EXPORT_SYMBOL(venet_ext_lookup);
 EXPORT_SYMBOL(veip_lh);
-EXPORT_SYMBOL(ip_entry_hash_table);
+EXPORT_SYMBOL(ip_entry_table);
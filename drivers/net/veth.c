@@ -13,11 +13,14 @@
 #include <linux/ethtool.h>
 #include <linux/etherdevice.h>
 #include <linux/u64_stats_sync.h>
+#include <linux/moduleparam.h>
 
 #include <net/rtnetlink.h>
 #include <net/dst.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include <linux/veth.h>
+#include <linux/vznetstat.h>
 #include <linux/module.h>
 #include "../../net/bridge/br_private.h"
 
@@ -27,15 +30,26 @@
 #define MIN_MTU 68		/* Min L3 MTU */
 #define MAX_MTU 65535		/* Max L3 MTU (arbitrary) */
 
+static unsigned int veth_queues;
+module_param_named(queues, veth_queues, uint, 0644);
+MODULE_PARM_DESC(queues, "Default number of queues, 0 - one per online CPU");
+
 struct pcpu_vstats {
 	u64			packets;
 	u64			bytes;
 	struct u64_stats_sync	syncp;
 };
 
+/* Receive queue, filled by xmit of the peer and drained by NAPI */
+struct veth_rq {
+	struct napi_struct	napi;
+	struct sk_buff_head	queue;
+};
+
 struct veth_priv {
 	struct net_device __rcu	*peer;
 	atomic64_t		dropped;
+	struct veth_rq		*rq;
 };
 
 /*
@@ -131,6 +145,106 @@ static int vzethdev_filter(struct sk_buff *skb, struct net_device *dev, struct n
 	return 1;
 }
 
+/* Deliver to receive queue of the peer chosen by tx queue of the skb */
+static int veth_forward_skb(struct net_device *rcv, struct sk_buff *skb)
+{
+	struct veth_priv *priv = netdev_priv(rcv);
+	struct veth_rq *rq;
+	u16 qid;
+
+	if (unlikely(!netif_running(rcv)))
+		goto drop;
+
+	qid = skb_get_queue_mapping(skb) % rcv->real_num_rx_queues;
+	rq = &priv->rq[qid];
+
+	/* Peer does not keep up, drop before paying for the rest */
+	if (unlikely(skb_queue_len(&rq->queue) >= netdev_max_backlog))
+		goto drop;
+
+	if (__dev_forward_skb(rcv, skb))
+		return NET_RX_DROP;
+
+	skb_record_rx_queue(skb, qid);
+	skb_mark_napi_id(skb, &rq->napi);
+	skb_queue_tail(&rq->queue, skb);
+	napi_schedule(&rq->napi);
+	return NET_RX_SUCCESS;
+
+drop:
+	atomic_long_inc(&rcv->rx_dropped);
+	kfree_skb(skb);
+	return NET_RX_DROP;
+}
+
+/* Called by the owner of NAPI_STATE_SCHED: softirq or busy polling */
+static int veth_rq_process(struct veth_rq *rq, int budget)
+{
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	int done = 0;
+
+	__skb_queue_head_init(&batch);
+
+	spin_lock_irq(&rq->queue.lock);
+	while (skb_queue_len(&batch) < budget &&
+	       (skb = __skb_dequeue(&rq->queue)) != NULL)
+		__skb_queue_tail(&batch, skb);
+	spin_unlock_irq(&rq->queue.lock);
+
+	while ((skb = __skb_dequeue(&batch)) != NULL) {
+		napi_gro_receive(&rq->napi, skb);
+		done++;
+	}
+
+	return done;
+}
+
+static int veth_poll(struct napi_struct *napi, int budget)
+{
+	struct veth_rq *rq = container_of(napi, struct veth_rq, napi);
+	int done;
+
+	done = veth_rq_process(rq, budget);
+	if (done < budget) {
+		napi_complete(napi);
+		/* Pairs with test_and_set_bit() in napi_schedule() */
+		smp_mb();
+		if (!skb_queue_empty(&rq->queue))
+			napi_schedule(napi);
+	}
+	return done;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Spinning reader pulls packets itself. Taking NAPI_STATE_SCHED keeps
+ * softirq away from the queue meanwhile, just like a scheduled NAPI.
+ */
+static int veth_busy_poll(struct napi_struct *napi)
+{
+	struct veth_rq *rq = container_of(napi, struct veth_rq, napi);
+	int done;
+
+	if (test_bit(NAPI_STATE_DISABLE, &napi->state))
+		return LL_FLUSH_FAILED;
+	if (test_and_set_bit(NAPI_STATE_SCHED, &napi->state))
+		return LL_FLUSH_BUSY;
+
+	done = veth_rq_process(rq, 4);
+	napi_gro_flush(napi, false);
+
+	smp_mb__before_clear_bit();
+	clear_bit(NAPI_STATE_SCHED, &napi->state);
+	/* Pairs with test_and_set_bit() in napi_schedule() */
+	smp_mb__after_clear_bit();
+	if (!skb_queue_empty(&rq->queue))
+		napi_schedule(napi);
+
+	return done;
+}
+#endif
+
 static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct veth_priv *priv = netdev_priv(dev);
@@ -156,7 +270,13 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto drop;
 	}
 
-	if (likely(dev_forward_skb(rcv, skb) == NET_RX_SUCCESS)) {
+	if (!ve_is_super(dev_net(dev)->owner_ve) &&
+	    !venet_rate_allow(dev_net(dev)->owner_ve->stat, length)) {
+		kfree_skb(skb);
+		goto drop;
+	}
+
+	if (likely(veth_forward_skb(rcv, skb) == NET_RX_SUCCESS)) {
 		struct pcpu_vstats *stats = this_cpu_ptr(dev->vstats);
 
 		u64_stats_update_begin(&stats->syncp);
@@ -225,10 +345,14 @@ static int veth_open(struct net_device *dev)
 {
 	struct veth_priv *priv = netdev_priv(dev);
 	struct net_device *peer = rtnl_dereference(priv->peer);
+	int i;
 
 	if (!peer)
 		return -ENOTCONN;
 
+	for (i = 0; i < dev->real_num_rx_queues; i++)
+		napi_enable(&priv->rq[i].napi);
+
 	if (peer->flags & IFF_UP) {
 		netif_carrier_on(dev);
 		netif_carrier_on(peer);
@@ -240,11 +364,18 @@ static int veth_close(struct net_device *dev)
 {
 	struct veth_priv *priv = netdev_priv(dev);
 	struct net_device *peer = rtnl_dereference(priv->peer);
+	int i;
 
 	netif_carrier_off(dev);
 	if (peer)
 		netif_carrier_off(peer);
 
+	/* Peer does not queue to us since we are not running any more */
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		napi_disable(&priv->rq[i].napi);
+		skb_queue_purge(&priv->rq[i].queue);
+	}
+
 	return 0;
 }
 
@@ -263,16 +394,49 @@ static int veth_change_mtu(struct net_device *dev, int new_mtu)
 
 static int veth_dev_init(struct net_device *dev)
 {
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
 	dev->vstats = alloc_percpu(struct pcpu_vstats);
 	if (!dev->vstats)
 		return -ENOMEM;
 
+	priv->rq = kcalloc(dev->num_rx_queues, sizeof(*priv->rq), GFP_KERNEL);
+	if (!priv->rq) {
+		free_percpu(dev->vstats);
+		dev->vstats = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < dev->num_rx_queues; i++) {
+		skb_queue_head_init(&priv->rq[i].queue);
+		netif_napi_add(dev, &priv->rq[i].napi, veth_poll,
+			       NAPI_POLL_WEIGHT);
+		napi_hash_add(&priv->rq[i].napi);
+	}
+
 	return 0;
 }
 
+static void veth_dev_uninit(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
+	/* Busy pollers are gone with synchronize_net() after ndo_uninit */
+	for (i = 0; i < dev->num_rx_queues; i++) {
+		napi_hash_del(&priv->rq[i].napi);
+		netif_napi_del(&priv->rq[i].napi);
+		skb_queue_purge(&priv->rq[i].queue);
+	}
+}
+
 static void veth_dev_free(struct net_device *dev)
 {
+	struct veth_priv *priv = netdev_priv(dev);
+
 	free_percpu(dev->vstats);
+	kfree(priv->rq);
 	free_netdev(dev);
 }
 
@@ -316,6 +480,7 @@ static int vzethdev_net_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd
 
 static const struct net_device_ops veth_netdev_ops = {
 	.ndo_init            = veth_dev_init,
+	.ndo_uninit          = veth_dev_uninit,
 	.ndo_open            = veth_open,
 	.ndo_stop            = veth_close,
 	.ndo_start_xmit      = veth_xmit,
@@ -323,6 +488,9 @@ static const struct net_device_ops veth_netdev_ops = {
 	.ndo_get_stats64     = veth_get_stats64,
 	.ndo_set_mac_address = veth_mac_addr,
 	.ndo_do_ioctl        = vzethdev_net_ioctl,
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll       = veth_busy_poll,
+#endif
 };
 
 #define VETH_FEATURES (NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_ALL_TSO |    \
@@ -370,6 +538,11 @@ static int veth_validate(struct nlattr *tb[], struct nlattr *data[])
 	return 0;
 }
 
+static unsigned int veth_get_num_queues(void)
+{
+	return veth_queues ? : num_online_cpus();
+}
+
 static struct rtnl_link_ops veth_link_ops;
 
 static int veth_newlink(struct net *src_net, struct net_device *dev,
@@ -525,6 +698,8 @@ static struct rtnl_link_ops veth_link_ops = {
 	.dellink	= veth_dellink,
 	.policy		= veth_policy,
 	.maxtype	= VETH_INFO_MAX,
+	.get_num_tx_queues = veth_get_num_queues,
+	.get_num_rx_queues = veth_get_num_queues,
 };
 
 /*
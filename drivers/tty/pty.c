@@ -841,6 +841,7 @@ static struct ve_hook ve_unix98_pty_hook = {
 	.init		= ve_unix98_pty_init,
 	.fini		= ve_unix98_pty_fini,
 	.priority	= HOOK_PRIO_DEFAULT,
+	.flags		= VE_HOOK_ASYNC,
 	.owner		= THIS_MODULE,
 };
 
@@ -1262,6 +1263,7 @@ static void ve_vtty_fini(void *data)
 static struct ve_hook vtty_hook = {
 	.fini           = ve_vtty_fini,
 	.priority       = HOOK_PRIO_DEFAULT,
+	.flags          = VE_HOOK_ASYNC,
 	.owner          = THIS_MODULE,
 };
 
@@ -129,6 +129,9 @@ struct kioctx {
 static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
+/* Runs buffered reads which would block on the page cache */
+static struct workqueue_struct *aio_read_wq;
+
 static struct vfsmount *aio_mnt;
 
 static const struct file_operations aio_ring_fops;
@@ -209,6 +212,10 @@ static int __init aio_setup(void)
 	kiocb_cachep = KMEM_CACHE(kiocb, SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
+	aio_read_wq = alloc_workqueue("aio_read", WQ_UNBOUND, 0);
+	if (!aio_read_wq)
+		panic("Failed to create aio read workqueue.");
+
 	pr_debug("sizeof(struct page) = %zu\n", sizeof(struct page));
 
 	return 0;
@@ -1396,6 +1403,83 @@ static ssize_t aio_write_iter(struct kiocb *iocb)
 	return ret;
 }
 
+static void aio_finish_iocb(struct kiocb *req, ssize_t ret)
+{
+	if (ret != -EIOCBQUEUED) {
+		/*
+		 * There's no easy way to restart the syscall since other AIO's
+		 * may be already running. Just fail this IO with EINTR.
+		 */
+		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+			     ret == -ERESTARTNOHAND ||
+			     ret == -ERESTART_RESTARTBLOCK))
+			ret = -EINTR;
+		aio_complete(req, ret, 0);
+	}
+}
+
+struct aio_read_work {
+	struct work_struct	work;
+	struct kiocb		*req;
+	aio_rw_op		*rw_op;
+	struct mm_struct	*mm;
+};
+
+static void aio_read_workfn(struct work_struct *work)
+{
+	struct aio_read_work *w = container_of(work, struct aio_read_work,
+					       work);
+	struct kiocb *req = w->req;
+	ssize_t ret;
+
+	use_mm(w->mm);
+	ret = aio_rw_vect_retry(req, READ, w->rw_op);
+	unuse_mm(w->mm);
+	mmput(w->mm);
+	kfree(w);
+
+	aio_finish_iocb(req, ret);
+}
+
+/*
+ * Buffered reads are synchronous in ->aio_read(), which would make
+ * io_submit() wait for the disk.  First copy whatever the page cache
+ * has with KIOCB_NOWAIT; if that stops at a page which needs reading,
+ * hand the rest to a worker, which borrows our mm to copy to the user
+ * buffers and does the readahead and the wait.
+ */
+static ssize_t aio_read_nowait(struct kiocb *req, aio_rw_op *rw_op)
+{
+	struct file *file = req->ki_filp;
+	struct aio_read_work *w;
+	ssize_t ret;
+
+	if (is_kernel_kiocb(req) || !current->mm ||
+	    (file->f_flags & O_DIRECT) ||
+	    !S_ISREG(file_inode(file)->i_mode))
+		return aio_rw_vect_retry(req, READ, rw_op);
+
+	req->ki_flags |= KIOCB_NOWAIT;
+	ret = aio_rw_vect_retry(req, READ, rw_op);
+	req->ki_flags &= ~KIOCB_NOWAIT;
+	if (ret != -EAGAIN)
+		return ret;
+
+	/* The iovec and ki_pos are advanced past what was copied */
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return aio_rw_vect_retry(req, READ, rw_op);
+
+	INIT_WORK(&w->work, aio_read_workfn);
+	w->req = req;
+	w->rw_op = rw_op;
+	w->mm = current->mm;
+	atomic_inc(&w->mm->mm_users);
+	queue_work(aio_read_wq, &w->work);
+
+	return -EIOCBQUEUED;
+}
+
 /*
  * aio_setup_iocb:
  *	Performs the initial checks and aio retry method
@@ -1444,7 +1528,10 @@ rw_common:
 		req->ki_nbytes = ret;
 		req->ki_left = ret;
 
-		ret = aio_rw_vect_retry(req, rw, rw_op);
+		if (rw == READ)
+			ret = aio_read_nowait(req, rw_op);
+		else
+			ret = aio_rw_vect_retry(req, rw, rw_op);
 		break;
 
 	case IOCB_CMD_READ_ITER:
@@ -1474,18 +1561,7 @@ rw_common:
 		return -EINVAL;
 	}
 
-	if (ret != -EIOCBQUEUED) {
-		/*
-		 * There's no easy way to restart the syscall since other AIO's
-		 * may be already running. Just fail this IO with EINTR.
-		 */
-		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
-			     ret == -ERESTARTNOHAND ||
-			     ret == -ERESTART_RESTARTBLOCK))
-			ret = -EINTR;
-		aio_complete(req, ret, 0);
-	}
-
+	aio_finish_iocb(req, ret);
 	return 0;
 }
 
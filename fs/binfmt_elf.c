@@ -33,6 +33,7 @@
 #include <linux/elf.h>
 #include <linux/utsname.h>
 #include <linux/coredump.h>
+#include <linux/hash.h>
 #include <linux/ve.h>
 #include <asm/uaccess.h>
 #include <asm/param.h>
@@ -84,6 +85,96 @@ static struct linux_binfmt elf_format = {
 
 #define BAD_ADDR(x) ((unsigned long)(x) >= TASK_SIZE)
 
+/*
+ * Small cache of parsed ELF and program headers, keyed by inode.
+ *
+ * Script-heavy workloads exec the same shell and the same ld.so many
+ * times per second and used to re-read both headers every time.  An
+ * entry is only trusted while the inode's size, mtime and ctime have
+ * not changed; any write to the file bumps those.  While an exec is
+ * running the file is also protected by deny_write_access().
+ */
+#define ELF_CACHE_BITS		5
+#define ELF_CACHE_PHNUM		16
+
+struct elf_cache_entry {
+	spinlock_t		lock;
+	struct super_block	*sb;
+	unsigned long		ino;
+	__u32			generation;
+	loff_t			size;
+	struct timespec		mtime;
+	struct timespec		ctime;
+	struct elfhdr		ex;
+	struct elf_phdr		phdr[ELF_CACHE_PHNUM];
+};
+
+static struct elf_cache_entry elf_cache[1 << ELF_CACHE_BITS];
+
+static struct elf_cache_entry *elf_cache_slot(struct inode *inode)
+{
+	unsigned long key = inode->i_ino ^ (unsigned long)inode->i_sb;
+
+	return &elf_cache[hash_long(key, ELF_CACHE_BITS)];
+}
+
+static bool elf_cache_match(struct elf_cache_entry *ce, struct inode *inode)
+{
+	return ce->sb == inode->i_sb && ce->ino == inode->i_ino &&
+	       ce->generation == inode->i_generation &&
+	       ce->size == i_size_read(inode) &&
+	       timespec_equal(&ce->mtime, &inode->i_mtime) &&
+	       timespec_equal(&ce->ctime, &inode->i_ctime);
+}
+
+/*
+ * Look @file up in the cache.  With @phdr == NULL only the ELF header
+ * is copied out to @ex.  Otherwise @ex must match the cached header
+ * and the program headers are copied to @phdr.
+ */
+static bool elf_cache_get(struct file *file, struct elfhdr *ex,
+			  struct elf_phdr *phdr)
+{
+	struct inode *inode = file_inode(file);
+	struct elf_cache_entry *ce = elf_cache_slot(inode);
+	bool hit = false;
+
+	spin_lock(&ce->lock);
+	if (!elf_cache_match(ce, inode))
+		goto out;
+	if (!phdr) {
+		*ex = ce->ex;
+		hit = true;
+	} else if (!memcmp(ex, &ce->ex, sizeof(*ex))) {
+		memcpy(phdr, ce->phdr, ex->e_phnum * sizeof(*phdr));
+		hit = true;
+	}
+out:
+	spin_unlock(&ce->lock);
+	return hit;
+}
+
+static void elf_cache_put(struct file *file, const struct elfhdr *ex,
+			  const struct elf_phdr *phdr)
+{
+	struct inode *inode = file_inode(file);
+	struct elf_cache_entry *ce = elf_cache_slot(inode);
+
+	if (ex->e_phnum > ELF_CACHE_PHNUM)
+		return;
+
+	spin_lock(&ce->lock);
+	ce->sb = inode->i_sb;
+	ce->ino = inode->i_ino;
+	ce->generation = inode->i_generation;
+	ce->size = i_size_read(inode);
+	ce->mtime = inode->i_mtime;
+	ce->ctime = inode->i_ctime;
+	ce->ex = *ex;
+	memcpy(ce->phdr, phdr, ex->e_phnum * sizeof(*phdr));
+	spin_unlock(&ce->lock);
+}
+
 static int set_brk(unsigned long start, unsigned long end)
 {
 	start = ELF_PAGEALIGN(start);
@@ -427,13 +518,16 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 	if (!elf_phdata)
 		goto out;
 
-	retval = kernel_read(interpreter, interp_elf_ex->e_phoff,
-			     (char *)elf_phdata, size);
-	error = -EIO;
-	if (retval != size) {
-		if (retval < 0)
-			error = retval;	
-		goto out_close;
+	if (!elf_cache_get(interpreter, interp_elf_ex, elf_phdata)) {
+		retval = kernel_read(interpreter, interp_elf_ex->e_phoff,
+				     (char *)elf_phdata, size);
+		error = -EIO;
+		if (retval != size) {
+			if (retval < 0)
+				error = retval;
+			goto out_close;
+		}
+		elf_cache_put(interpreter, interp_elf_ex, elf_phdata);
 	}
 
 	total_size = total_mapping_size(elf_phdata, interp_elf_ex->e_phnum);
@@ -622,12 +716,15 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	if (!elf_phdata)
 		goto out;
 
-	retval = kernel_read(bprm->file, loc->elf_ex.e_phoff,
-			     (char *)elf_phdata, size);
-	if (retval != size) {
-		if (retval >= 0)
-			retval = -EIO;
-		goto out_free_ph;
+	if (!elf_cache_get(bprm->file, &loc->elf_ex, elf_phdata)) {
+		retval = kernel_read(bprm->file, loc->elf_ex.e_phoff,
+				     (char *)elf_phdata, size);
+		if (retval != size) {
+			if (retval >= 0)
+				retval = -EIO;
+			goto out_free_ph;
+		}
+		elf_cache_put(bprm->file, &loc->elf_ex, elf_phdata);
 	}
 
 	elf_ppnt = elf_phdata;
@@ -681,6 +778,11 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			 */
 			would_dump(bprm, interpreter);
 
+			/* Get the exec headers */
+			if (elf_cache_get(interpreter, &loc->interp_elf_ex,
+					  NULL))
+				break;
+
 			retval = kernel_read(interpreter, 0, bprm->buf,
 					     BINPRM_BUF_SIZE);
 			if (retval != BINPRM_BUF_SIZE) {
@@ -689,7 +791,6 @@ static int load_elf_binary(struct linux_binprm *bprm)
 				goto out_free_dentry;
 			}
 
-			/* Get the exec headers */
 			loc->interp_elf_ex = *((struct elfhdr *)bprm->buf);
 			break;
 		}
@@ -2236,6 +2337,10 @@ out:
 
 static int __init init_elf_binfmt(void)
 {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(elf_cache); i++)
+		spin_lock_init(&elf_cache[i].lock);
 	register_binfmt(&elf_format);
 	return 0;
 }
@@ -772,6 +772,7 @@ static void ve_binfmt_fini(void *data)
 static struct ve_hook ve_binfmt_hook = {
 	.fini		= ve_binfmt_fini,
 	.priority	= HOOK_PRIO_DEFAULT,
+	.flags		= VE_HOOK_ASYNC,
 	.owner		= THIS_MODULE,
 };
 
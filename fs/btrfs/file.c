@@ -2767,6 +2767,7 @@ const struct file_operations btrfs_file_operations = {
 	.release	= btrfs_release_file,
 	.fsync		= btrfs_sync_file,
 	.fallocate	= btrfs_fallocate,
+	.clone_file_range = btrfs_clone_file_range,
 	.unlocked_ioctl	= btrfs_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= btrfs_ioctl,
@@ -3556,12 +3556,11 @@ out:
 	return ret;
 }
 
-static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
-				       u64 off, u64 olen, u64 destoff)
+static noinline int btrfs_clone_files(struct file *file, struct file *file_src,
+				      u64 off, u64 olen, u64 destoff)
 {
 	struct inode *inode = file_inode(file);
 	struct btrfs_root *root = BTRFS_I(inode)->root;
-	struct fd src_file;
 	struct inode *src;
 	int ret;
 	u64 len = olen;
@@ -3586,42 +3585,28 @@ static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
 	if (btrfs_root_readonly(root))
 		return -EROFS;
 
-	ret = mnt_want_write_file(file);
-	if (ret)
-		return ret;
-
-	src_file = fdget(srcfd);
-	if (!src_file.file) {
-		ret = -EBADF;
-		goto out_drop_write;
-	}
-
-	ret = -EXDEV;
-	if (src_file.file->f_path.mnt != file->f_path.mnt)
-		goto out_fput;
+	if (file_src->f_path.mnt != file->f_path.mnt)
+		return -EXDEV;
 
-	src = file_inode(src_file.file);
+	src = file_inode(file_src);
 
-	ret = -EINVAL;
 	if (src == inode)
 		same_inode = 1;
 
 	/* the src must be open for reading */
-	if (!(src_file.file->f_mode & FMODE_READ))
-		goto out_fput;
+	if (!(file_src->f_mode & FMODE_READ))
+		return -EINVAL;
 
 	/* don't make the dst file partly checksummed */
 	if ((BTRFS_I(src)->flags & BTRFS_INODE_NODATASUM) !=
 	    (BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM))
-		goto out_fput;
+		return -EINVAL;
 
-	ret = -EISDIR;
 	if (S_ISDIR(src->i_mode) || S_ISDIR(inode->i_mode))
-		goto out_fput;
+		return -EISDIR;
 
-	ret = -EXDEV;
 	if (src->i_sb != inode->i_sb)
-		goto out_fput;
+		return -EXDEV;
 
 	if (!same_inode) {
 		if (inode < src) {
@@ -3709,13 +3694,43 @@ out_unlock:
 	} else {
 		mutex_unlock(&src->i_mutex);
 	}
-out_fput:
+	return ret;
+}
+
+static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
+				       u64 off, u64 olen, u64 destoff)
+{
+	struct fd src_file;
+	int ret;
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		return ret;
+
+	src_file = fdget(srcfd);
+	if (!src_file.file) {
+		ret = -EBADF;
+		goto out_drop_write;
+	}
+
+	ret = btrfs_clone_files(file, src_file.file, off, olen, destoff);
+
 	fdput(src_file);
 out_drop_write:
 	mnt_drop_write_file(file);
 	return ret;
 }
 
+int btrfs_clone_file_range(struct file *src_file, loff_t off,
+			   struct file *dst_file, loff_t destoff, u64 len)
+{
+	/* zero length means "up to EOF" for the ioctl, not for this call */
+	if (!len)
+		return -EINVAL;
+
+	return btrfs_clone_files(dst_file, src_file, off, len, destoff);
+}
+
 static long btrfs_ioctl_clone_range(struct file *file, void __user *argp)
 {
 	struct btrfs_ioctl_clone_range_args args;
@@ -124,6 +124,32 @@ struct dentry_stat_t dentry_stat = {
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
 
+/*
+ * Max number of negative dentries per superblock, 0 for no limit. Over
+ * it, negative dentries are not kept in cache once their last reference
+ * is dropped, so lookups of names that don't exist can't fill the hash
+ * with them. The count includes referenced ones and is approximate.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
+static inline void d_negative_inc(struct dentry *dentry)
+{
+	percpu_counter_inc(&dentry->d_sb->s_nr_negative);
+}
+
+static inline void d_negative_dec(struct dentry *dentry)
+{
+	percpu_counter_dec(&dentry->d_sb->s_nr_negative);
+}
+
+static inline bool d_negative_over_limit(struct dentry *dentry)
+{
+	unsigned long limit = sysctl_negative_dentry_limit;
+
+	return limit && percpu_counter_read_positive(
+				&dentry->d_sb->s_nr_negative) > limit;
+}
+
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
 /*
@@ -259,6 +285,8 @@ static void d_free(struct dentry *dentry)
 {
 	BUG_ON((int)dentry->d_lockref.count > 0);
 	this_cpu_dec(nr_dentry);
+	if (!dentry->d_inode)
+		d_negative_dec(dentry);
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
 
@@ -295,6 +323,7 @@ static void dentry_iput(struct dentry * dentry)
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
 		dentry->d_inode = NULL;
+		d_negative_inc(dentry);
 		hlist_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&inode->i_lock);
@@ -320,6 +349,7 @@ static void dentry_unlink_inode(struct dentry * dentry)
 	struct inode *inode = dentry->d_inode;
 	__d_clear_type(dentry);
 	dentry->d_inode = NULL;
+	d_negative_inc(dentry);
 	hlist_del_init(&dentry->d_alias);
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -607,6 +637,9 @@ repeat:
 			goto kill_it;
 	}
 
+	if (unlikely(!dentry->d_inode && d_negative_over_limit(dentry)))
+		goto kill_it;
+
 	dentry->d_flags |= DCACHE_REFERENCED;
 	dentry_lru_add(dentry);
 
@@ -1111,6 +1144,7 @@ static void shrink_dcache_for_umount_subtree(struct dentry *dentry)
 			inode = dentry->d_inode;
 			if (inode) {
 				dentry->d_inode = NULL;
+				d_negative_inc(dentry);
 				hlist_del_init(&dentry->d_alias);
 				if (dentry->d_op && dentry->d_op->d_iput)
 					dentry->d_op->d_iput(dentry, inode);
@@ -1587,6 +1621,7 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *name)
 	d_set_d_op(dentry, dentry->d_sb->s_d_op);
 
 	this_cpu_inc(nr_dentry);
+	d_negative_inc(dentry);
 
 	return dentry;
 }
@@ -1700,8 +1735,11 @@ static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 
 	spin_lock(&dentry->d_lock);
 	__d_set_type(dentry, add_flags);
-	if (inode)
+	if (inode) {
 		hlist_add_head(&dentry->d_alias, &inode->i_dentry);
+		if (!dentry->d_inode)
+			d_negative_dec(dentry);
+	}
 	dentry->d_inode = inode;
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1909,6 +1947,7 @@ struct dentry *d_obtain_alias(struct inode *inode)
 
 	spin_lock(&tmp->d_lock);
 	tmp->d_inode = inode;
+	d_negative_dec(tmp);
 	tmp->d_flags |= add_flags;
 	hlist_add_head(&tmp->d_alias, &inode->i_dentry);
 	hlist_bl_lock(&tmp->d_sb->s_anon);
@@ -133,6 +133,10 @@ struct dio {
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
 
+	/* completion polling of sync IO, see dio_poll() */
+	struct request_queue *poll_q;
+	ktime_t poll_start;		/* last bio was submitted */
+
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
 	ssize_t result;                 /* IO result */
@@ -385,6 +389,15 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	if (dio->is_async && dio->rw == READ)
 		bio_set_pages_dirty(bio);
 
+	if (!dio->is_async) {
+		struct request_queue *q = bdev_get_queue(bio->bi_bdev);
+
+		if (blk_queue_poll(q)) {
+			dio->poll_q = q;
+			dio->poll_start = ktime_get();
+		}
+	}
+
 	if (sdio->submit_io)
 		sdio->submit_io(dio->rw, bio, dio->inode,
 			       sdio->logical_offset_in_bio);
@@ -405,6 +418,31 @@ static inline void dio_cleanup(struct dio *dio, struct dio_submit *sdio)
 		page_cache_release(dio_get_page(dio, sdio));
 }
 
+/*
+ * Reap completions on a queue with polling enabled instead of sleeping for
+ * the interrupt. To not burn a CPU for all the time the device takes, first
+ * sleep for half of the queue's mean completion time.
+ */
+static void dio_poll(struct dio *dio)
+{
+	struct request_queue *q = dio->poll_q;
+
+	if (ACCESS_ONCE(dio->refcount) <= 1 || ACCESS_ONCE(dio->bio_list))
+		return;
+
+	blk_poll_sleep(q, dio->poll_start);
+
+	while (ACCESS_ONCE(dio->refcount) > 1 && !ACCESS_ONCE(dio->bio_list)) {
+		if (blk_poll(q))
+			continue;
+		if (!blk_queue_poll(q) || need_resched())
+			return;
+		cpu_relax();
+	}
+
+	blk_poll_account(q, dio->poll_start);
+}
+
 /*
  * Wait for the next BIO to complete.  Remove it and return it.  NULL is
  * returned once all BIOs have been completed.  This must only be called once
@@ -416,6 +454,9 @@ static struct bio *dio_await_one(struct dio *dio)
 	unsigned long flags;
 	struct bio *bio = NULL;
 
+	if (dio->poll_q)
+		dio_poll(dio);
+
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
 	/*
@@ -56,6 +56,7 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/oom.h>
 #include <linux/compat.h>
+#include <linux/ve_lat.h>
 
 #include <bc/vmpages.h>
 
@@ -1521,6 +1522,7 @@ static int do_execve_common(struct filename *filename,
 	bool clear_in_exec;
 	int retval;
 	const struct cred *cred = current_cred();
+	u64 lat_start = ve_lat_start();
 
 	if (IS_ERR(filename))
 		return PTR_ERR(filename);
@@ -1612,6 +1614,7 @@ static int do_execve_common(struct filename *filename,
 	putname(filename);
 	if (displaced)
 		put_files_struct(displaced);
+	ve_lat_end(get_exec_env(), VE_LAT_EXEC, lat_start);
 	return retval;
 
 out:
@@ -31,6 +31,7 @@
 #include <linux/percpu_counter.h>
 #include <linux/ratelimit.h>
 #include <linux/pfcache.h>
+#include <linux/hashtable.h>
 #include <crypto/hash.h>
 #include <linux/falloc.h>
 #ifdef __KERNEL__
@@ -1295,6 +1296,8 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_large_prealloc_kb;
+	unsigned int s_mb_discard_batch;
 	unsigned int s_bd_full_ratelimit;
 	unsigned int s_max_dir_size_kb;
 	/* where last allocation was done - for stream allocation */
@@ -1317,6 +1320,11 @@ struct ext4_sb_info {
 	atomic_t s_mb_discarded;
 	atomic_t s_lock_busy;
 
+	/* freed extents waiting for background discard */
+	spinlock_t s_discard_lock;
+	struct list_head s_discard_list;
+	struct delayed_work s_discard_work;
+
 	struct inode *s_balloon_ino;
 
 	/* locality groups */
@@ -1360,10 +1368,8 @@ struct ext4_sb_info {
 
 	/* Reclaim extents from extent status tree */
 	struct shrinker s_es_shrinker;
-	struct list_head s_es_lru;
-	unsigned long s_es_last_sorted;
+	struct list_lru s_es_lru;	/* inodes, per node and memcg */
 	struct percpu_counter s_extent_cache_cnt;
-	spinlock_t s_es_lru_lock ____cacheline_aligned_in_smp;
 
 	/* Ratelimit ext4 messages. */
 	struct ratelimit_state s_err_ratelimit_state;
@@ -1377,6 +1383,26 @@ struct ext4_sb_info {
 	spinlock_t  s_pfcache_lock;
 	struct path s_pfcache_root;
 	struct percpu_counter s_pfcache_peers;
+	/* files in s_pfcache_root by checksum, see pfcache_lookup_peer() */
+	spinlock_t s_pfcache_peers_lock;
+	DECLARE_HASHTABLE(s_pfcache_peers_hash, 10);
+	struct list_head s_pfcache_peers_lru;
+	unsigned int s_pfcache_peers_nr;
+	unsigned long s_pfcache_gen;	/* root changes */
+	/* sha1 driver for data checksums, NULL means sha_transform() */
+	struct crypto_shash *s_pfcache_sha1;
+
+	/* inodes with complete data checksum by inode number */
+	spinlock_t s_csum_index_lock;
+	struct radix_tree_root s_csum_index;
+	bool s_csum_index_lost;
+
+	/* closed files waiting for background data checksumming */
+	spinlock_t s_csum_scrub_lock;
+	struct list_head s_csum_scrub_list;
+	unsigned int s_csum_scrub_nr;
+	unsigned int s_csum_scrub_kb;	/* per second, 0 disables */
+	struct delayed_work s_csum_scrub_work;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -2836,7 +2862,9 @@ extern int ext4_bio_write_page(struct ext4_io_submit *io,
 extern int ext4_multi_mount_protect(struct super_block *, ext4_fsblk_t);
 
 /* pfcache.c */
+extern void ext4_load_pfcache_sha1(struct super_block *sb);
 extern int ext4_open_pfcache(struct inode *inode);
+extern void ext4_flush_pfcache_peers(struct super_block *sb);
 extern int ext4_close_pfcache(struct inode *inode);
 extern int ext4_relink_pfcache(struct super_block *sb, char *new_root, bool new_sb);
 extern long ext4_dump_pfcache(struct super_block *sb,
@@ -2847,7 +2875,11 @@ extern void ext4_check_pos_data_csum(struct inode *inode, loff_t pos);
 extern void ext4_update_data_csum(struct inode *inode, loff_t pos,
 				  unsigned len, struct page* page);
 extern void ext4_commit_data_csum(struct inode *inode);
+extern void ext4_queue_data_csum(struct inode *inode);
+extern void ext4_init_csum_scrub(struct super_block *sb);
+extern void ext4_stop_csum_scrub(struct super_block *sb);
 extern void ext4_clear_data_csum(struct inode *inode);
+extern void ext4_unindex_data_csum(struct inode *inode);
 extern void ext4_truncate_data_csum(struct inode *inode, loff_t end);
 extern void ext4_load_dir_csum(struct inode *inode);
 extern void ext4_save_dir_csum(struct inode *inode);
@@ -10,7 +10,7 @@
  * Ext4 extents status tree core functions.
  */
 #include <linux/rbtree.h>
-#include <linux/list_sort.h>
+#include <linux/list_lru.h>
 #include "ext4.h"
 #include "extents_status.h"
 
@@ -148,6 +148,7 @@ static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 static int __es_try_to_reclaim_extents(struct ext4_inode_info *ei,
 				       int nr_to_scan);
 static int __ext4_es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
+			    struct shrink_control *sc,
 			    struct ext4_inode_info *locked_ei);
 
 int __init ext4_init_es(void)
@@ -676,7 +677,7 @@ int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
 retry:
 	err = __es_insert_extent(inode, &newes);
 	if (err == -ENOMEM && __ext4_es_shrink(EXT4_SB(inode->i_sb), 1,
-					       EXT4_I(inode)))
+					       NULL, EXT4_I(inode)))
 		goto retry;
 	if (err == -ENOMEM && !ext4_es_is_delayed(&newes))
 		err = 0;
@@ -829,7 +830,7 @@ retry:
 				es->es_len = orig_es.es_len;
 				if ((err == -ENOMEM) &&
 				    __ext4_es_shrink(EXT4_SB(inode->i_sb), 1,
-						     EXT4_I(inode)))
+						     NULL, EXT4_I(inode)))
 					goto retry;
 				goto out;
 			}
@@ -908,40 +909,75 @@ int ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 	return err;
 }
 
-static int ext4_inode_touch_time_cmp(void *priv, struct list_head *a,
-				     struct list_head *b)
+/*
+ * Extent trees of inodes used within this time are reclaimed only if
+ * nothing else could be freed.
+ */
+#define EXT4_ES_MIN_AGE		(10 * HZ)
+
+/* Shrink passes, each one is less careful than the previous */
+enum {
+	ES_SHRINK_OLD,		/* neither recently used nor precached */
+	ES_SHRINK_UNPRECACHED,	/* not precached */
+	ES_SHRINK_ANY,
+	ES_SHRINK_PASSES,
+};
+
+struct ext4_es_shrink_arg {
+	struct ext4_inode_info *locked_ei;
+	int nr_to_scan;		/* extents */
+	int nr_shrunk;
+	int pass;
+};
+
+static enum lru_status ext4_es_lru_isolate(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *cb_arg)
 {
-	struct ext4_inode_info *eia, *eib;
-	eia = list_entry(a, struct ext4_inode_info, i_es_lru);
-	eib = list_entry(b, struct ext4_inode_info, i_es_lru);
+	struct ext4_es_shrink_arg *arg = cb_arg;
+	struct ext4_inode_info *ei;
+	enum lru_status ret = LRU_ROTATE;
+	int nr;
+
+	ei = list_entry(item, struct ext4_inode_info, i_es_lru);
+
+	if (arg->nr_to_scan <= 0)
+		return LRU_SKIP;
+	if (arg->pass < ES_SHRINK_ANY &&
+	    ext4_test_inode_state(&ei->vfs_inode, EXT4_STATE_EXT_PRECACHED))
+		return LRU_ROTATE;
+	if (arg->pass < ES_SHRINK_UNPRECACHED &&
+	    time_before(jiffies, ei->i_touch_when + EXT4_ES_MIN_AGE))
+		return LRU_ROTATE;
+	if (ei == arg->locked_ei || !write_trylock(&ei->i_es_lock))
+		return LRU_SKIP;
+
+	nr = __es_try_to_reclaim_extents(ei, arg->nr_to_scan);
+	arg->nr_shrunk += nr;
+	arg->nr_to_scan -= nr;
+	if (ei->i_es_lru_nr == 0) {
+		list_lru_isolate(lru, item);
+		ret = LRU_REMOVED;
+	}
+	write_unlock(&ei->i_es_lock);
 
-	if (ext4_test_inode_state(&eia->vfs_inode, EXT4_STATE_EXT_PRECACHED) &&
-	    !ext4_test_inode_state(&eib->vfs_inode, EXT4_STATE_EXT_PRECACHED))
-		return 1;
-	if (!ext4_test_inode_state(&eia->vfs_inode, EXT4_STATE_EXT_PRECACHED) &&
-	    ext4_test_inode_state(&eib->vfs_inode, EXT4_STATE_EXT_PRECACHED))
-		return -1;
-	if (eia->i_touch_when == eib->i_touch_when)
-		return 0;
-	if (time_after(eia->i_touch_when, eib->i_touch_when))
-		return 1;
-	else
-		return -1;
+	return ret;
 }
 
+/*
+ * Reclaim up to @nr_to_scan extents from inodes on the lru of @sc node
+ * and memcg, or from all of them if @sc is NULL.
+ */
 static int __ext4_es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
+			    struct shrink_control *sc,
 			    struct ext4_inode_info *locked_ei)
 {
-	struct ext4_inode_info *ei;
-	struct list_head *cur, *tmp;
-	LIST_HEAD(skipped);
-	int ret, nr_shrunk = 0;
-	int retried = 0, skip_precached = 1, nr_skipped = 0;
-
-	spin_lock(&sbi->s_es_lru_lock);
+	struct ext4_es_shrink_arg arg = {
+		.locked_ei	= locked_ei,
+		.nr_to_scan	= nr_to_scan,
+	};
+	unsigned long nr_to_walk;
 
-retry:
-	list_for_each_safe(cur, tmp, &sbi->s_es_lru) {
+	for (arg.pass = 0; arg.pass < ES_SHRINK_PASSES; arg.pass++) {
 		/*
 		 * If we have already reclaimed all extents from extent
 		 * status tree, just stop the loop immediately.
@@ -949,66 +985,23 @@ retry:
 		if (percpu_counter_read_positive(&sbi->s_extent_cache_cnt) == 0)
 			break;
 
-		ei = list_entry(cur, struct ext4_inode_info, i_es_lru);
-
-		/*
-		 * Skip the inode that is newer than the last_sorted
-		 * time.  Normally we try hard to avoid shrinking
-		 * precached inodes, but we will as a last resort.
-		 */
-		if ((sbi->s_es_last_sorted < ei->i_touch_when) ||
-		    (skip_precached && ext4_test_inode_state(&ei->vfs_inode,
-						EXT4_STATE_EXT_PRECACHED))) {
-			nr_skipped++;
-			list_move_tail(cur, &skipped);
-			continue;
-		}
-
-		if (ei->i_es_lru_nr == 0 || ei == locked_ei ||
-		    !write_trylock(&ei->i_es_lock))
-			continue;
-
-		ret = __es_try_to_reclaim_extents(ei, nr_to_scan);
-		if (ei->i_es_lru_nr == 0)
-			list_del_init(&ei->i_es_lru);
-		write_unlock(&ei->i_es_lock);
-
-		nr_shrunk += ret;
-		nr_to_scan -= ret;
-		if (nr_to_scan == 0)
+		if (sc) {
+			nr_to_walk = sc->nr_to_scan;
+			list_lru_walk_one(&sbi->s_es_lru, sc->nid, sc->memcg,
+					  ext4_es_lru_isolate, &arg,
+					  &nr_to_walk);
+		} else
+			list_lru_walk(&sbi->s_es_lru, ext4_es_lru_isolate,
+				      &arg, ULONG_MAX);
+		if (arg.nr_shrunk)
 			break;
 	}
 
-	/* Move the newer inodes into the tail of the LRU list. */
-	list_splice_tail(&skipped, &sbi->s_es_lru);
-	INIT_LIST_HEAD(&skipped);
-
-	/*
-	 * If we skipped any inodes, and we weren't able to make any
-	 * forward progress, sort the list and try again.
-	 */
-	if ((nr_shrunk == 0) && nr_skipped && !retried) {
-		retried++;
-		list_sort(NULL, &sbi->s_es_lru, ext4_inode_touch_time_cmp);
-		sbi->s_es_last_sorted = jiffies;
-		ei = list_first_entry(&sbi->s_es_lru, struct ext4_inode_info,
-				      i_es_lru);
-		/*
-		 * If there are no non-precached inodes left on the
-		 * list, start releasing precached extents.
-		 */
-		if (ext4_test_inode_state(&ei->vfs_inode,
-					  EXT4_STATE_EXT_PRECACHED))
-			skip_precached = 0;
-		goto retry;
-	}
+	if (locked_ei && arg.nr_shrunk == 0)
+		arg.nr_shrunk = __es_try_to_reclaim_extents(locked_ei,
+							    nr_to_scan);
 
-	spin_unlock(&sbi->s_es_lru_lock);
-
-	if (locked_ei && nr_shrunk == 0)
-		nr_shrunk = __es_try_to_reclaim_extents(locked_ei, nr_to_scan);
-
-	return nr_shrunk;
+	return arg.nr_shrunk;
 }
 
 static unsigned long ext4_es_count(struct shrinker *shrink,
@@ -1018,11 +1011,12 @@ static unsigned long ext4_es_count(struct shrinker *shrink,
 	struct ext4_sb_info *sbi;
 
 	sbi = container_of(shrink, struct ext4_sb_info, s_es_shrinker);
-	nr = percpu_counter_read_positive(&sbi->s_extent_cache_cnt);
+	nr = list_lru_shrink_count(&sbi->s_es_lru, sc);
 	trace_ext4_es_shrink_enter(sbi->s_sb, sc->nr_to_scan, nr);
 	return nr;
 }
 
+/* Objects of the shrinker are inodes, reclaim all extents they have */
 static unsigned long ext4_es_scan(struct shrinker *shrink,
 				  struct shrink_control *sc)
 {
@@ -1037,53 +1031,52 @@ static unsigned long ext4_es_scan(struct shrinker *shrink,
 	if (!nr_to_scan)
 		return ret;
 
-	nr_shrunk = __ext4_es_shrink(sbi, nr_to_scan, NULL);
+	nr_shrunk = __ext4_es_shrink(sbi, INT_MAX, sc, NULL);
 
 	trace_ext4_es_shrink_exit(sbi->s_sb, nr_shrunk, ret);
 	return nr_shrunk;
 }
 
-void ext4_es_register_shrinker(struct ext4_sb_info *sbi)
+int ext4_es_register_shrinker(struct ext4_sb_info *sbi)
 {
-	INIT_LIST_HEAD(&sbi->s_es_lru);
-	spin_lock_init(&sbi->s_es_lru_lock);
-	sbi->s_es_last_sorted = 0;
+	int err;
+
+	err = list_lru_init_memcg(&sbi->s_es_lru);
+	if (err)
+		return err;
 	sbi->s_es_shrinker.scan_objects = ext4_es_scan;
 	sbi->s_es_shrinker.count_objects = ext4_es_count;
 	sbi->s_es_shrinker.seeks = DEFAULT_SEEKS;
-	register_shrinker(&sbi->s_es_shrinker);
+	sbi->s_es_shrinker.flags = SHRINKER_NUMA_AWARE | SHRINKER_MEMCG_AWARE;
+	err = register_shrinker(&sbi->s_es_shrinker);
+	if (err)
+		list_lru_destroy(&sbi->s_es_lru);
+	return err;
 }
 
 void ext4_es_unregister_shrinker(struct ext4_sb_info *sbi)
 {
 	unregister_shrinker(&sbi->s_es_shrinker);
+	list_lru_destroy(&sbi->s_es_lru);
 }
 
 void ext4_es_lru_add(struct inode *inode)
 {
 	struct ext4_inode_info *ei = EXT4_I(inode);
-	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
 	ei->i_touch_when = jiffies;
 
 	if (!list_empty(&ei->i_es_lru))
 		return;
 
-	spin_lock(&sbi->s_es_lru_lock);
-	if (list_empty(&ei->i_es_lru))
-		list_add_tail(&ei->i_es_lru, &sbi->s_es_lru);
-	spin_unlock(&sbi->s_es_lru_lock);
+	list_lru_add(&EXT4_SB(inode->i_sb)->s_es_lru, &ei->i_es_lru);
 }
 
 void ext4_es_lru_del(struct inode *inode)
 {
 	struct ext4_inode_info *ei = EXT4_I(inode);
-	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
-	spin_lock(&sbi->s_es_lru_lock);
-	if (!list_empty(&ei->i_es_lru))
-		list_del_init(&ei->i_es_lru);
-	spin_unlock(&sbi->s_es_lru_lock);
+	list_lru_del(&EXT4_SB(inode->i_sb)->s_es_lru, &ei->i_es_lru);
 }
 
 static int __es_try_to_reclaim_extents(struct ext4_inode_info *ei,
@@ -47,6 +47,7 @@ static int ext4_release_file(struct inode *inode, struct file *filp)
 	    (atomic_read(&inode->i_writecount) == 1)) {
 		if (ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM))
 			ext4_commit_data_csum(inode);
+		ext4_queue_data_csum(inode);
 		if (!EXT4_I(inode)->i_reserved_data_blocks) {
 			down_write(&EXT4_I(inode)->i_data_sem);
 			ext4_discard_preallocations(inode);
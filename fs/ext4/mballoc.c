@@ -26,6 +26,7 @@
 #include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/list_sort.h>
 #include <trace/events/ext4.h>
 
 #ifdef CONFIG_EXT4_DEBUG
@@ -368,6 +369,8 @@ static void ext4_mb_generate_from_freelist(struct super_block *sb, void *bitmap,
 						ext4_group_t group);
 static void ext4_free_data_callback(struct super_block *sb,
 				struct ext4_journal_cb_entry *jce, int rc);
+static int ext4_mb_discard_pending(struct super_block *sb, unsigned budget);
+static void ext4_mb_discard_work(struct work_struct *work);
 
 static inline void *mb_correct_addr_and_bit(int *bit, void *addr)
 {
@@ -2597,6 +2600,11 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_large_prealloc_kb = MB_DEFAULT_LARGE_PREALLOC_KB;
+	sbi->s_mb_discard_batch = MB_DEFAULT_DISCARD_BATCH;
+	spin_lock_init(&sbi->s_discard_lock);
+	INIT_LIST_HEAD(&sbi->s_discard_list);
+	INIT_DELAYED_WORK(&sbi->s_discard_work, ext4_mb_discard_work);
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2690,6 +2698,10 @@ int ext4_mb_release(struct super_block *sb)
 	if (sbi->s_proc)
 		remove_proc_entry("mb_groups", sbi->s_proc);
 
+	/* journal is gone, nobody can queue more */
+	cancel_delayed_work_sync(&sbi->s_discard_work);
+	ext4_mb_discard_pending(sb, 0);
+
 	if (sbi->s_group_info) {
 		for (i = 0; i < ngroups; i++) {
 			grinfo = ext4_get_group_info(sb, i);
@@ -2754,34 +2766,25 @@ static inline int ext4_issue_discard(struct super_block *sb,
 	return sb_issue_discard(sb, discard_block, count, GFP_NOFS, 0);
 }
 
+static void ext4_discard_failed(struct super_block *sb, ext4_group_t group,
+				ext4_grpblk_t cluster, int count, int err)
+{
+	if (err && err != -EOPNOTSUPP)
+		ext4_msg(sb, KERN_WARNING, "discard request in"
+			 " group:%d block:%d count:%d failed"
+			 " with %d", group, cluster, count, err);
+}
+
 /*
- * This function is called by the jbd2 layer once the commit has finished,
- * so we know we can free the blocks that were released with that commit.
+ * Give blocks of a committed extent back to the buddy allocator.
  */
-static void ext4_free_data_callback(struct super_block *sb,
-				    struct ext4_journal_cb_entry *jce,
-				    int rc)
+static void ext4_free_data_release(struct super_block *sb,
+				   struct ext4_free_data *entry)
 {
-	struct ext4_free_data *entry = (struct ext4_free_data *)jce;
 	struct ext4_buddy e4b;
 	struct ext4_group_info *db;
 	int err, count = 0, count2 = 0;
 
-	mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
-		 entry->efd_count, entry->efd_group, entry);
-
-	if (test_opt(sb, DISCARD)) {
-		err = ext4_issue_discard(sb, entry->efd_group,
-					 entry->efd_start_cluster,
-					 entry->efd_count);
-		if (err && err != -EOPNOTSUPP)
-			ext4_msg(sb, KERN_WARNING, "discard request in"
-				 " group:%d block:%d count:%d failed"
-				 " with %d", entry->efd_group,
-				 entry->efd_start_cluster,
-				 entry->efd_count, err);
-	}
-
 	err = ext4_mb_load_buddy(sb, entry->efd_group, &e4b);
 	/* we expect to find existing buddy because it's pinned */
 	BUG_ON(err != 0);
@@ -2819,6 +2822,134 @@ static void ext4_free_data_callback(struct super_block *sb,
 	mb_debug(1, "freed %u blocks in %u structures\n", count, count2);
 }
 
+static int ext4_free_data_cmp(void *priv, struct list_head *a,
+			      struct list_head *b)
+{
+	struct ext4_free_data *fa, *fb;
+
+	fa = list_entry(a, struct ext4_free_data, efd_jce.jce_list);
+	fb = list_entry(b, struct ext4_free_data, efd_jce.jce_list);
+
+	if (fa->efd_group != fb->efd_group)
+		return fa->efd_group < fb->efd_group ? -1 : 1;
+	return fa->efd_start_cluster < fb->efd_start_cluster ? -1 : 1;
+}
+
+/*
+ * Discard and release up to @budget clusters (all if 0) queued by
+ * ext4_free_data_callback(). Adjacent extents freed by different
+ * transactions are discarded by one request. Returns number of
+ * clusters given back to the allocator.
+ */
+static int ext4_mb_discard_pending(struct super_block *sb, unsigned budget)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_free_data *entry, *tmp, *run = NULL;
+	int count = 0, freed = 0, err;
+	LIST_HEAD(list);
+
+	spin_lock(&sbi->s_discard_lock);
+	while (!list_empty(&sbi->s_discard_list) &&
+	       (!budget || freed < budget)) {
+		entry = list_first_entry(&sbi->s_discard_list,
+					 struct ext4_free_data,
+					 efd_jce.jce_list);
+		list_move_tail(&entry->efd_jce.jce_list, &list);
+		freed += entry->efd_count;
+	}
+	spin_unlock(&sbi->s_discard_lock);
+
+	if (list_empty(&list))
+		return 0;
+
+	list_sort(NULL, &list, ext4_free_data_cmp);
+
+	list_for_each_entry(entry, &list, efd_jce.jce_list) {
+		if (run && run->efd_group == entry->efd_group &&
+		    run->efd_start_cluster + count == entry->efd_start_cluster) {
+			count += entry->efd_count;
+			continue;
+		}
+		if (run) {
+			err = ext4_issue_discard(sb, run->efd_group,
+						 run->efd_start_cluster, count);
+			ext4_discard_failed(sb, run->efd_group,
+					    run->efd_start_cluster, count, err);
+		}
+		run = entry;
+		count = entry->efd_count;
+	}
+	err = ext4_issue_discard(sb, run->efd_group,
+				 run->efd_start_cluster, count);
+	ext4_discard_failed(sb, run->efd_group,
+			    run->efd_start_cluster, count, err);
+
+	list_for_each_entry_safe(entry, tmp, &list, efd_jce.jce_list) {
+		list_del(&entry->efd_jce.jce_list);
+		ext4_free_data_release(sb, entry);
+	}
+
+	return freed;
+}
+
+static void ext4_mb_discard_work(struct work_struct *work)
+{
+	struct ext4_sb_info *sbi = container_of(to_delayed_work(work),
+						struct ext4_sb_info,
+						s_discard_work);
+	int more;
+
+	ext4_mb_discard_pending(sbi->s_sb, sbi->s_mb_discard_batch);
+
+	spin_lock(&sbi->s_discard_lock);
+	more = !list_empty(&sbi->s_discard_list);
+	spin_unlock(&sbi->s_discard_lock);
+
+	if (more)
+		queue_delayed_work(system_long_wq, &sbi->s_discard_work,
+				   MB_DISCARD_INTERVAL);
+}
+
+/*
+ * This function is called by the jbd2 layer once the commit has finished,
+ * so we know we can free the blocks that were released with that commit.
+ *
+ * With online discard blocks must not be reused until they are discarded.
+ * Unless mb_discard_batch is 0 this is left to ext4_mb_discard_work(), so
+ * that deleting a large tree does not stall commit on discards.
+ */
+static void ext4_free_data_callback(struct super_block *sb,
+				    struct ext4_journal_cb_entry *jce,
+				    int rc)
+{
+	struct ext4_free_data *entry = (struct ext4_free_data *)jce;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int err;
+
+	mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
+		 entry->efd_count, entry->efd_group, entry);
+
+	if (test_opt(sb, DISCARD) && sbi->s_mb_discard_batch) {
+		spin_lock(&sbi->s_discard_lock);
+		list_add_tail(&jce->jce_list, &sbi->s_discard_list);
+		spin_unlock(&sbi->s_discard_lock);
+		queue_delayed_work(system_long_wq, &sbi->s_discard_work,
+				   MB_DISCARD_INTERVAL);
+		return;
+	}
+
+	if (test_opt(sb, DISCARD)) {
+		err = ext4_issue_discard(sb, entry->efd_group,
+					 entry->efd_start_cluster,
+					 entry->efd_count);
+		ext4_discard_failed(sb, entry->efd_group,
+				    entry->efd_start_cluster,
+				    entry->efd_count, err);
+	}
+
+	ext4_free_data_release(sb, entry);
+}
+
 int __init ext4_init_mballoc(void)
 {
 	ext4_pspace_cachep = KMEM_CACHE(ext4_prealloc_space,
@@ -2996,6 +3127,27 @@ static void ext4_mb_normalize_group_request(struct ext4_allocation_context *ac)
  * Normalization means making request better in terms of
  * size and alignment
  */
+/*
+ * Big growing files, e.g. ploop images appended by many containers at
+ * once, get preallocation windows of 1/8 of their size.  Thus each of
+ * them keeps growing in large contiguous chunks instead of interleaving
+ * with the others in 8M ones.  Returns window size in bytes, or 0.
+ */
+static loff_t ext4_mb_large_window(struct super_block *sb, loff_t size)
+{
+	loff_t window, max;
+
+	max = (loff_t)EXT4_SB(sb)->s_mb_large_prealloc_kb << 10;
+	max = min_t(loff_t, max,
+		    (loff_t)EXT4_BLOCKS_PER_GROUP(sb) << sb->s_blocksize_bits);
+	if (size <= 16 * 1024 * 1024 || max <= 8 * 1024 * 1024)
+		return 0;
+
+	window = 1LL << ilog2(size >> 3);
+	return clamp_t(loff_t, window, 8 * 1024 * 1024,
+		       1LL << ilog2(max));
+}
+
 static noinline_for_stack void
 ext4_mb_normalize_request(struct ext4_allocation_context *ac,
 				struct ext4_allocation_request *ar)
@@ -3003,7 +3155,7 @@ ext4_mb_normalize_request(struct ext4_allocation_context *ac,
 	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
 	int bsbits, max;
 	ext4_lblk_t end;
-	loff_t size, start_off;
+	loff_t size, start_off, window;
 	loff_t orig_size __maybe_unused;
 	ext4_lblk_t start;
 	struct ext4_inode_info *ei = EXT4_I(ac->ac_inode);
@@ -3069,6 +3221,11 @@ ext4_mb_normalize_request(struct ext4_allocation_context *ac,
 		start_off = ((loff_t)ac->ac_o_ex.fe_logical >>
 							(22 - bsbits)) << 22;
 		size = 4 * 1024 * 1024;
+	} else if ((window = ext4_mb_large_window(ac->ac_sb, size)) &&
+		   EXT4_C2B(sbi, ac->ac_o_ex.fe_len) <= window >> bsbits) {
+		start_off = ((loff_t)ac->ac_o_ex.fe_logical << bsbits) &
+			    ~(window - 1);
+		size = window;
 	} else if (NRL_CHECK_SIZE(ac->ac_o_ex.fe_len,
 					(8<<20)>>bsbits, max, 8 * 1024)) {
 		start_off = ((loff_t)ac->ac_o_ex.fe_logical >>
@@ -4513,6 +4670,8 @@ repeat:
 		}
 	} else {
 		freed  = ext4_mb_discard_preallocations(sb, ac->ac_o_ex.fe_len);
+		if (!freed)
+			freed = ext4_mb_discard_pending(sb, 0);
 		if (freed)
 			goto repeat;
 		*errp = -ENOSPC;
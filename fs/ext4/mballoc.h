@@ -89,6 +89,20 @@ extern ushort ext4_mballoc_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * inode preallocation of files larger than 16M grows with file size
+ * up to this many kilobytes, see ext4_mb_large_window()
+ */
+#define MB_DEFAULT_LARGE_PREALLOC_KB	65536
+
+/*
+ * with online discard, freed clusters are discarded in background
+ * by at most this many clusters every MB_DISCARD_INTERVAL,
+ * 0 means discard synchronously at commit time
+ */
+#define MB_DEFAULT_DISCARD_BATCH	16384
+#define MB_DISCARD_INTERVAL		(HZ / 10)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -12,13 +12,18 @@
 #include <linux/fs.h>
 #include <linux/jbd2.h>
 #include <linux/cryptohash.h>
+#include <crypto/sha.h>
 #include <linux/namei.h>
 #include <linux/exportfs.h>
 #include <linux/init_task.h>	/* for init_cred */
+#include <asm/unaligned.h>
+#include <bc/beancounter.h>
 #include "ext4.h"
 #include "xattr.h"
 #include "../internal.h"
 
+#include <trace/events/ext4.h>
+
 #define PFCACHE_MAX_PATH	(EXT4_DATA_CSUM_SIZE * 2 + 2)
 static void pfcache_path(struct inode *inode, char *path)
 {
@@ -33,6 +38,122 @@ static void pfcache_path(struct inode *inode, char *path)
 	*p = 0;
 }
 
+/*
+ * Files found in the pfcache root are remembered by checksum, so next
+ * opens of the same content skip the path walk.  Entries pin dentries,
+ * thus their number is limited, the oldest one goes first.  All of them
+ * are dropped when the root changes, s_pfcache_gen tells which root an
+ * entry was looked up in.
+ */
+#define PFCACHE_PEERS_MAX	4096
+
+struct pfcache_peer {
+	struct hlist_node	hash;
+	struct list_head	lru;
+	struct path		path;
+	u8			csum[EXT4_DATA_CSUM_SIZE];
+};
+
+static u32 pfcache_peer_key(const u8 *csum)
+{
+	return get_unaligned((u32 *)csum);
+}
+
+static void pfcache_free_peers(struct list_head *list)
+{
+	struct pfcache_peer *peer, *next;
+
+	list_for_each_entry_safe(peer, next, list, lru) {
+		path_put(&peer->path);
+		kfree(peer);
+	}
+}
+
+static void __pfcache_del_peer(struct ext4_sb_info *sbi,
+			       struct pfcache_peer *peer, struct list_head *list)
+{
+	hash_del(&peer->hash);
+	list_move(&peer->lru, list);
+	sbi->s_pfcache_peers_nr--;
+}
+
+static int pfcache_lookup_peer(struct inode *inode, struct path *path)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	const u8 *csum = EXT4_I(inode)->i_data_csum;
+	struct pfcache_peer *peer;
+	LIST_HEAD(stale);
+	int ret = -ENOENT;
+
+	spin_lock(&sbi->s_pfcache_peers_lock);
+	hash_for_each_possible(sbi->s_pfcache_peers_hash, peer, hash,
+			       pfcache_peer_key(csum)) {
+		if (memcmp(peer->csum, csum, EXT4_DATA_CSUM_SIZE))
+			continue;
+		/* removed or replaced in the cache */
+		if (d_unhashed(peer->path.dentry) ||
+		    !peer->path.dentry->d_inode) {
+			__pfcache_del_peer(sbi, peer, &stale);
+			break;
+		}
+		list_move_tail(&peer->lru, &sbi->s_pfcache_peers_lru);
+		*path = peer->path;
+		path_get(path);
+		ret = 0;
+		break;
+	}
+	spin_unlock(&sbi->s_pfcache_peers_lock);
+
+	pfcache_free_peers(&stale);
+	return ret;
+}
+
+static void pfcache_add_peer(struct inode *inode, struct path *path,
+			     unsigned long gen)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct pfcache_peer *peer;
+	LIST_HEAD(stale);
+
+	peer = kmalloc(sizeof(*peer), GFP_NOFS);
+	if (!peer)
+		return;
+	memcpy(peer->csum, EXT4_I(inode)->i_data_csum, EXT4_DATA_CSUM_SIZE);
+	peer->path = *path;
+	path_get(&peer->path);
+
+	spin_lock(&sbi->s_pfcache_peers_lock);
+	if (gen != sbi->s_pfcache_gen) {
+		list_add(&peer->lru, &stale);
+		goto out;
+	}
+	hash_add(sbi->s_pfcache_peers_hash, &peer->hash,
+		 pfcache_peer_key(peer->csum));
+	list_add_tail(&peer->lru, &sbi->s_pfcache_peers_lru);
+	if (++sbi->s_pfcache_peers_nr > PFCACHE_PEERS_MAX)
+		__pfcache_del_peer(sbi, list_first_entry(
+				&sbi->s_pfcache_peers_lru,
+				struct pfcache_peer, lru), &stale);
+out:
+	spin_unlock(&sbi->s_pfcache_peers_lock);
+
+	pfcache_free_peers(&stale);
+}
+
+void ext4_flush_pfcache_peers(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	LIST_HEAD(stale);
+
+	spin_lock(&sbi->s_pfcache_peers_lock);
+	list_splice_init(&sbi->s_pfcache_peers_lru, &stale);
+	hash_init(sbi->s_pfcache_peers_hash);
+	sbi->s_pfcache_peers_nr = 0;
+	spin_unlock(&sbi->s_pfcache_peers_lock);
+
+	pfcache_free_peers(&stale);
+}
+
 /* require inode->i_mutex held or unreachable inode */
 int ext4_open_pfcache(struct inode *inode)
 {
@@ -40,6 +161,7 @@ int ext4_open_pfcache(struct inode *inode)
 	const struct cred *cur_cred;
 	char name[PFCACHE_MAX_PATH];
 	struct path root, path;
+	unsigned long gen;
 	int ret;
 
 	if (!(ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM) &&
@@ -49,9 +171,13 @@ int ext4_open_pfcache(struct inode *inode)
 	if (!EXT4_SB(sb)->s_pfcache_root.mnt)
 		return -ENODEV;
 
+	if (!pfcache_lookup_peer(inode, &path))
+		goto open;
+
 	spin_lock(&EXT4_SB(sb)->s_pfcache_lock);
 	root = EXT4_SB(sb)->s_pfcache_root;
 	path_get(&root);
+	gen = EXT4_SB(sb)->s_pfcache_gen;
 	spin_unlock(&EXT4_SB(sb)->s_pfcache_lock);
 
 	if (!root.mnt)
@@ -71,12 +197,18 @@ int ext4_open_pfcache(struct inode *inode)
 	lockdep_on();
 	revert_creds(cur_cred);
 	path_put(&root);
-	if (ret)
+	if (ret) {
+		ub_percpu_inc(get_exec_ub(), pfcache_miss);
 		return ret;
-
+	}
+	pfcache_add_peer(inode, &path, gen);
+open:
 	ret = open_mapping_peer(inode->i_mapping, &path, &init_cred);
-	if (!ret)
+	if (!ret) {
 		percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_pfcache_peers);
+		ub_percpu_inc(get_exec_ub(), pfcache_hit);
+	} else
+		ub_percpu_inc(get_exec_ub(), pfcache_miss);
 	path_put(&path);
 	return ret;
 }
@@ -91,15 +223,153 @@ int ext4_close_pfcache(struct inode *inode)
 	return 0;
 }
 
+/*
+ * Inodes with complete data checksum are indexed by inode number, so
+ * relink and dump do not have to walk every cached inode of the sb and
+ * may drop all locks between batches.  Entries could be stale, i.e.
+ * point to an inode which lost its checksum, users must check the state.
+ * If insertion fails the whole index is marked lost and users fall back
+ * to the sb inode list.
+ */
+#define PFCACHE_INDEX_BATCH	16
+
+static void ext4_index_data_csum(struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	int err;
+
+	if (radix_tree_preload(GFP_NOFS)) {
+		sbi->s_csum_index_lost = true;
+		return;
+	}
+	spin_lock(&sbi->s_csum_index_lock);
+	err = radix_tree_insert(&sbi->s_csum_index, inode->i_ino, inode);
+	if (err == -EEXIST) {
+		radix_tree_delete(&sbi->s_csum_index, inode->i_ino);
+		err = radix_tree_insert(&sbi->s_csum_index,
+					inode->i_ino, inode);
+	}
+	if (err)
+		sbi->s_csum_index_lost = true;
+	spin_unlock(&sbi->s_csum_index_lock);
+	radix_tree_preload_end();
+}
+
+void ext4_unindex_data_csum(struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	void *entry;
+
+	if (!S_ISREG(inode->i_mode))
+		return;
+
+	rcu_read_lock();
+	entry = radix_tree_lookup(&sbi->s_csum_index, inode->i_ino);
+	rcu_read_unlock();
+	if (entry != inode)
+		return;
+
+	spin_lock(&sbi->s_csum_index_lock);
+	if (radix_tree_lookup(&sbi->s_csum_index, inode->i_ino) == inode)
+		radix_tree_delete(&sbi->s_csum_index, inode->i_ino);
+	spin_unlock(&sbi->s_csum_index_lock);
+}
+
+/*
+ * Grab next batch of indexed inodes starting from inode number *pos.
+ * Returns batch size, some entries could be NULL if inode is going away.
+ */
+static int ext4_next_indexed_csum(struct super_block *sb,
+				  unsigned long *pos, struct inode **batch)
+{
+	struct inode *inode;
+	int i, nr;
+
+	rcu_read_lock();
+	nr = radix_tree_gang_lookup(&EXT4_SB(sb)->s_csum_index,
+				    (void **)batch, *pos, PFCACHE_INDEX_BATCH);
+	for (i = 0; i < nr; i++) {
+		inode = batch[i];
+		*pos = inode->i_ino + 1;
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & (I_FREEING|I_CLEAR|I_WILL_FREE|I_NEW))
+			batch[i] = NULL;
+		else
+			__iget(inode);
+		spin_unlock(&inode->i_lock);
+	}
+	rcu_read_unlock();
+
+	return nr;
+}
+
+/* under inode->i_mutex */
+static void pfcache_relink_inode(struct inode *inode, struct path *root,
+				 bool reload_csum, long *nr_opened,
+				 long *nr_closed)
+{
+	struct path path = { .mnt = NULL, .dentry = NULL };
+	struct file *file;
+
+	if (!ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM)) {
+		if (!reload_csum)
+			return;
+		if (S_ISDIR(inode->i_mode)) {
+			ext4_load_dir_csum(inode);
+			return;
+		}
+		if (ext4_load_data_csum(inode))
+			return;
+	} else if (!(EXT4_I(inode)->i_data_csum_end < 0) ||
+			S_ISDIR(inode->i_mode))
+		return;
+
+	if (root->mnt) {
+		char name[PFCACHE_MAX_PATH];
+		const struct cred *cur_cred;
+		int err;
+
+		pfcache_path(inode, name);
+		cur_cred = override_creds(&init_cred);
+		err = vfs_path_lookup(root->dentry, root->mnt,
+				name, 0, &path);
+		revert_creds(cur_cred);
+		if (err) {
+			path.mnt = NULL;
+			path.dentry = NULL;
+		}
+	}
+
+	file = inode->i_mapping->i_peer_file;
+	if ((!path.mnt && !file) || (path.mnt && file &&
+	     file->f_mapping == path.dentry->d_inode->i_mapping))
+		goto out;
+
+	if (file) {
+		close_mapping_peer(inode->i_mapping);
+		(*nr_closed)++;
+	}
+
+	if (path.mnt) {
+		if (!open_mapping_peer(inode->i_mapping,
+					&path, &init_cred))
+			(*nr_opened)++;
+	}
+out:
+	path_put(&path);
+}
+
 /* under sb->s_umount write lock */
 int ext4_relink_pfcache(struct super_block *sb, char *new_root, bool new_sb)
 {
 	int old_root = !!EXT4_SB(sb)->s_pfcache_root.mnt;
 	struct inode *inode, *old_inode = NULL;
-	struct file *file;
+	struct inode *batch[PFCACHE_INDEX_BATCH];
 	long nr_opened = 0, nr_closed = 0, nr_total;
 	bool reload_csum = false;
 	struct path root, path;
+	unsigned long pos = 0;
+	int i, nr;
 
 	if (new_root) {
 		int err;
@@ -129,9 +399,33 @@ int ext4_relink_pfcache(struct super_block *sb, char *new_root, bool new_sb)
 	spin_lock(&EXT4_SB(sb)->s_pfcache_lock);
 	path = EXT4_SB(sb)->s_pfcache_root;
 	EXT4_SB(sb)->s_pfcache_root = root;
+	spin_lock(&EXT4_SB(sb)->s_pfcache_peers_lock);
+	EXT4_SB(sb)->s_pfcache_gen++;
+	spin_unlock(&EXT4_SB(sb)->s_pfcache_peers_lock);
 	spin_unlock(&EXT4_SB(sb)->s_pfcache_lock);
 	path_put(&path);
+	ext4_flush_pfcache_peers(sb);
+
+	/* Checksums are not loaded yet, only the sb inode list knows them */
+	if (reload_csum || EXT4_SB(sb)->s_csum_index_lost)
+		goto walk_sb_inodes;
 
+	while ((nr = ext4_next_indexed_csum(sb, &pos, batch))) {
+		for (i = 0; i < nr; i++) {
+			inode = batch[i];
+			if (!inode)
+				continue;
+			mutex_lock(&inode->i_mutex);
+			pfcache_relink_inode(inode, &root, false,
+					     &nr_opened, &nr_closed);
+			mutex_unlock(&inode->i_mutex);
+			iput(inode);
+		}
+		cond_resched();
+	}
+	goto done;
+
+walk_sb_inodes:
 	spin_lock(&inode_sb_list_lock);
 
 	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
@@ -149,64 +443,16 @@ int ext4_relink_pfcache(struct super_block *sb, char *new_root, bool new_sb)
 		iput(old_inode);
 		old_inode = inode;
 
-		path.mnt = NULL;
-		path.dentry = NULL;
-
 		mutex_lock(&inode->i_mutex);
-
-		if (!ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM)) {
-			if (!reload_csum)
-				goto next;
-			if (S_ISDIR(inode->i_mode)) {
-				ext4_load_dir_csum(inode);
-				goto next;
-			}
-			if (ext4_load_data_csum(inode))
-				goto next;
-		} else if (!(EXT4_I(inode)->i_data_csum_end < 0) ||
-				S_ISDIR(inode->i_mode))
-			goto next;
-
-		if (new_root) {
-			char name[PFCACHE_MAX_PATH];
-			const struct cred *cur_cred;
-			int err;
-
-			pfcache_path(inode, name);
-			cur_cred = override_creds(&init_cred);
-			err = vfs_path_lookup(root.dentry, root.mnt,
-					name, 0, &path);
-			revert_creds(cur_cred);
-			if (err) {
-				path.mnt = NULL;
-				path.dentry = NULL;
-			}
-		}
-
-		file = inode->i_mapping->i_peer_file;
-		if ((!path.mnt && !file) || (path.mnt && file &&
-		     file->f_mapping == path.dentry->d_inode->i_mapping))
-			goto next;
-
-		if (file) {
-			close_mapping_peer(inode->i_mapping);
-			nr_closed++;
-		}
-
-		if (path.mnt) {
-			if (!open_mapping_peer(inode->i_mapping,
-						&path, &init_cred))
-				nr_opened++;
-		}
-next:
+		pfcache_relink_inode(inode, &root, reload_csum,
+				     &nr_opened, &nr_closed);
 		mutex_unlock(&inode->i_mutex);
-		path_put(&path);
 		cond_resched();
 		spin_lock(&inode_sb_list_lock);
 	}
 	spin_unlock(&inode_sb_list_lock);
 	iput(old_inode);
-
+done:
 	percpu_counter_add(&EXT4_SB(sb)->s_pfcache_peers,
 			   nr_opened - nr_closed);
 	nr_total = percpu_counter_sum(&EXT4_SB(sb)->s_pfcache_peers);
@@ -226,14 +472,156 @@ next:
 
 #define MAX_LOCK_BATCH	256
 
+/*
+ * Apply request filters to the inode and construct its payload.
+ * Returns payload size, zero if the inode is filtered out.
+ */
+static long pfcache_dump_inode(struct inode *inode,
+			       struct pfcache_dump_request *req, void *buffer)
+{
+	u64 state, *x;
+	void *p;
+
+	if (!S_ISREG(inode->i_mode) ||
+	    inode == EXT4_SB(inode->i_sb)->s_balloon_ino)
+		return 0;
+
+	/* evaluate the inode state */
+	state = 0;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM) &&
+	    EXT4_I(inode)->i_data_csum_end < 0)
+		state |= PFCACHE_FILTER_WITH_CSUM;
+	else
+		state |= PFCACHE_FILTER_WITHOUT_CSUM;
+
+	if (inode->i_mapping->i_peer_file)
+		state |= PFCACHE_FILTER_WITH_PEER;
+	else
+		state |= PFCACHE_FILTER_WITHOUT_PEER;
+
+	/* check state-filter */
+	if (req->filter & state)
+		return 0;
+
+	/* check csum-filter */
+	if ((req->filter & PFCACHE_FILTER_COMPARE_CSUM) &&
+	    memcmp(EXT4_I(inode)->i_data_csum,
+		    req->csum_filter, EXT4_DATA_CSUM_SIZE))
+		return 0;
+
+	/* -- add new filters above this line -- */
+
+	/* check offset-filter at the last */
+	if (req->offset > 0) {
+		req->offset--;
+		return 0;
+	}
+
+	/* construct the payload */
+	p = buffer;
+
+	if (req->payload & PFCACHE_PAYLOAD_CSUM) {
+		BUILD_BUG_ON(PFCACHE_CSUM_SIZE != EXT4_DATA_CSUM_SIZE);
+		if (state & PFCACHE_FILTER_WITH_CSUM)
+			memcpy(p, EXT4_I(inode)->i_data_csum,
+					EXT4_DATA_CSUM_SIZE);
+		else
+			memset(p, 0, EXT4_DATA_CSUM_SIZE);
+		p += ALIGN(PFCACHE_CSUM_SIZE, sizeof(u64));
+	}
+
+	if (req->payload & PFCACHE_PAYLOAD_FHANDLE) {
+		unsigned *x = p;
+
+		*x++ = 8;
+		*x++ = FILEID_INO32_GEN;
+		*x++ = inode->i_ino;
+		*x++ = inode->i_generation;
+		p += 16;
+	}
+
+	if (req->payload & PFCACHE_PAYLOAD_STATE) {
+		x = p;
+		*x = state;
+		p += sizeof(u64);
+	}
+
+	if (req->payload & PFCACHE_PAYLOAD_FSIZE) {
+		x = p;
+		*x = i_size_read(inode);
+		p += sizeof(u64);
+	}
+
+	if (req->payload & PFCACHE_PAYLOAD_PAGES) {
+		x = p;
+		*x = inode->i_mapping->nrpages;
+		p += sizeof(u64);
+	}
+
+	/* -- add new payloads above this line -- */
+
+	BUG_ON(!IS_ALIGNED(p - buffer, sizeof(u64)));
+	BUG_ON(p - buffer > PFCACHE_PAYLOAD_MAX_SIZE);
+
+	return p - buffer;
+}
+
+/*
+ * Dump only inodes with checksum in inode number order.  Sets req->cursor
+ * to the inode number to continue from, or zero if all are dumped.
+ */
+static long ext4_dump_indexed_pfcache(struct super_block *sb,
+				      struct pfcache_dump_request *req,
+				      u8 __user *user_buffer, void *buffer)
+{
+	struct inode *inode, *batch[PFCACHE_INDEX_BATCH];
+	unsigned long pos = req->cursor;
+	bool stop = false;
+	long ret = 0, size;
+	int i, nr;
+
+	req->cursor = 0;
+	while (!stop && (nr = ext4_next_indexed_csum(sb, &pos, batch))) {
+		for (i = 0; i < nr; i++) {
+			inode = batch[i];
+			if (!inode)
+				continue;
+			size = stop ? 0 : pfcache_dump_inode(inode, req, buffer);
+			if (size > req->buffer_size) {
+				req->cursor = inode->i_ino;
+				stop = true;
+			} else if (size) {
+				if (copy_to_user(user_buffer, buffer, size)) {
+					ret = -EFAULT;
+					stop = true;
+				} else {
+					ret++;
+					user_buffer += size;
+					req->buffer_size -= size;
+				}
+			}
+			iput(inode);
+		}
+		if (!stop && signal_pending(current)) {
+			if (!ret)
+				ret = -EINTR;
+			req->cursor = pos;
+			stop = true;
+		}
+		cond_resched();
+	}
+
+	return ret;
+}
+
 long ext4_dump_pfcache(struct super_block *sb,
 		      struct pfcache_dump_request __user *user_req)
 {
 	struct inode *inode, *old_inode = NULL;
 	struct pfcache_dump_request req;
 	u8 __user *user_buffer;
-	u64 state, *x;
-	void *buffer, *p;
+	void *buffer;
 	long ret, size;
 	int lock_batch = 0;
 
@@ -249,6 +637,14 @@ long ext4_dump_pfcache(struct super_block *sb,
 	    (req.payload & ~PFCACHE_PAYLOAD_MASK))
 		return -EINVAL;
 
+	if (!PFCACHE_DUMP_HAS(&req, cursor))
+		req.cursor = 0;
+
+	/* cursor works only for walk over inodes with checksum */
+	if (req.cursor && (!(req.filter & PFCACHE_FILTER_WITHOUT_CSUM) ||
+			   EXT4_SB(sb)->s_csum_index_lost))
+		return -EINVAL;
+
 	buffer = kzalloc(PFCACHE_PAYLOAD_MAX_SIZE, GFP_KERNEL);
 	if (!buffer)
 		return -ENOMEM;
@@ -257,93 +653,24 @@ long ext4_dump_pfcache(struct super_block *sb,
 	/* skip all new fields in the user request header */
 	user_buffer = (void*)user_req + req.header_size;
 
+	if ((req.filter & PFCACHE_FILTER_WITHOUT_CSUM) &&
+	    !EXT4_SB(sb)->s_csum_index_lost) {
+		ret = ext4_dump_indexed_pfcache(sb, &req, user_buffer, buffer);
+		if (PFCACHE_DUMP_HAS(&req, cursor) &&
+		    put_user(req.cursor, &user_req->cursor))
+			ret = -EFAULT;
+		goto out_free;
+	}
+
 	spin_lock(&inode_sb_list_lock);
 	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
 		if (inode->i_state & (I_FREEING|I_CLEAR|I_WILL_FREE|I_NEW))
 			continue;
-		if (!S_ISREG(inode->i_mode) ||
-		    inode == EXT4_SB(sb)->s_balloon_ino)
-			goto next;
-
-		/* evaluate the inode state */
-		state = 0;
-
-		if (ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM) &&
-		    EXT4_I(inode)->i_data_csum_end < 0)
-			state |= PFCACHE_FILTER_WITH_CSUM;
-		else
-			state |= PFCACHE_FILTER_WITHOUT_CSUM;
-
-		if (inode->i_mapping->i_peer_file)
-			state |= PFCACHE_FILTER_WITH_PEER;
-		else
-			state |= PFCACHE_FILTER_WITHOUT_PEER;
-
-		/* check state-filter */
-		if (req.filter & state)
-			goto next;
 
-		/* check csum-filter */
-		if ((req.filter & PFCACHE_FILTER_COMPARE_CSUM) &&
-		    memcmp(EXT4_I(inode)->i_data_csum,
-			    req.csum_filter, EXT4_DATA_CSUM_SIZE))
+		size = pfcache_dump_inode(inode, &req, buffer);
+		if (!size)
 			goto next;
 
-		/* -- add new filters above this line -- */
-
-		/* check offset-filter at the last */
-		if (req.offset > 0) {
-			req.offset--;
-			goto next;
-		}
-
-		/* construct the payload */
-		p = buffer;
-
-		if (req.payload & PFCACHE_PAYLOAD_CSUM) {
-			BUILD_BUG_ON(PFCACHE_CSUM_SIZE != EXT4_DATA_CSUM_SIZE);
-			if (state & PFCACHE_FILTER_WITH_CSUM)
-				memcpy(p, EXT4_I(inode)->i_data_csum,
-						EXT4_DATA_CSUM_SIZE);
-			else
-				memset(p, 0, EXT4_DATA_CSUM_SIZE);
-			p += ALIGN(PFCACHE_CSUM_SIZE, sizeof(u64));
-		}
-
-		if (req.payload & PFCACHE_PAYLOAD_FHANDLE) {
-			unsigned *x = p;
-
-			*x++ = 8;
-			*x++ = FILEID_INO32_GEN;
-			*x++ = inode->i_ino;
-			*x++ = inode->i_generation;
-			p += 16;
-		}
-
-		if (req.payload & PFCACHE_PAYLOAD_STATE) {
-			x = p;
-			*x = state;
-			p += sizeof(u64);
-		}
-
-		if (req.payload & PFCACHE_PAYLOAD_FSIZE) {
-			x = p;
-			*x = i_size_read(inode);
-			p += sizeof(u64);
-		}
-
-		if (req.payload & PFCACHE_PAYLOAD_PAGES) {
-			x = p;
-			*x = inode->i_mapping->nrpages;
-			p += sizeof(u64);
-		}
-
-		/* -- add new payloads above this line -- */
-
-		size = p - buffer;
-		BUG_ON(!IS_ALIGNED(size, sizeof(u64)));
-		BUG_ON(size > PFCACHE_PAYLOAD_MAX_SIZE);
-
 		if (size > req.buffer_size)
 			goto out;
 
@@ -389,7 +716,7 @@ out:
 	spin_unlock(&inode_sb_list_lock);
 out_nolock:
 	iput(old_inode);
-
+out_free:
 	kfree(buffer);
 
 	return ret;
@@ -408,9 +735,10 @@ void ext4_clear_data_csum(struct inode *inode)
 	ext4_clear_inode_state(inode, EXT4_STATE_PFCACHE_CSUM);
 	if (!S_ISREG(inode->i_mode))
 		return;
-	if (EXT4_I(inode)->i_data_csum_end < 0)
+	if (EXT4_I(inode)->i_data_csum_end < 0) {
 		percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_csum_complete);
-	else
+		ext4_unindex_data_csum(inode);
+	} else
 		percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_csum_partial);
 }
 
@@ -439,6 +767,7 @@ int ext4_load_data_csum(struct inode *inode)
 	EXT4_I(inode)->i_data_csum_end = -1;
 	ext4_set_inode_state(inode, EXT4_STATE_PFCACHE_CSUM);
 	percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_csum_complete);
+	ext4_index_data_csum(inode);
 	return 0;
 }
 
@@ -450,8 +779,11 @@ static int ext4_save_data_csum(struct inode *inode, u8 *csum)
 
 	if (ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM) &&
 	    EXT4_I(inode)->i_data_csum_end < 0 &&
-	    memcmp(EXT4_I(inode)->i_data_csum, csum, EXT4_DATA_CSUM_SIZE))
+	    memcmp(EXT4_I(inode)->i_data_csum, csum, EXT4_DATA_CSUM_SIZE)) {
+		trace_ext4_pfcache_invalidate(inode);
+		ub_percpu_inc(get_exec_ub(), pfcache_invalidate);
 		ext4_close_pfcache(inode);
+	}
 
 	spin_lock(&inode->i_lock);
 	if (ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM))
@@ -461,6 +793,7 @@ static int ext4_save_data_csum(struct inode *inode, u8 *csum)
 	ext4_set_inode_state(inode, EXT4_STATE_PFCACHE_CSUM);
 	percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_csum_complete);
 	spin_unlock(&inode->i_lock);
+	ext4_index_data_csum(inode);
 
 	ext4_open_pfcache(inode);
 
@@ -503,6 +836,8 @@ void ext4_truncate_data_csum(struct inode *inode, loff_t pos)
 
 	if (EXT4_I(inode)->i_data_csum_end < 0) {
 		WARN_ON(journal_current_handle());
+		trace_ext4_pfcache_invalidate(inode);
+		ub_percpu_inc(get_exec_ub(), pfcache_invalidate);
 		ext4_xattr_set(inode, EXT4_XATTR_INDEX_TRUSTED,
 				EXT4_DATA_CSUM_NAME, NULL, 0, 0);
 		ext4_close_pfcache(inode);
@@ -521,10 +856,63 @@ void ext4_check_pos_data_csum(struct inode *inode, loff_t pos)
 		ext4_truncate_data_csum(inode, pos);
 }
 
-static void sha_batch_transform(__u32 *digest, const char *data, unsigned rounds)
+/*
+ * Use the crypto API sha1, which picks the fastest implementation for
+ * the cpu, e.g. ssse3, avx or avx2 ones on x86.  Checksums keep only
+ * the raw state between writes, so move it in and out of the driver
+ * with import and export.
+ */
+void ext4_load_pfcache_sha1(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct crypto_shash *tfm;
+
+	if (sbi->s_pfcache_sha1)
+		return;
+
+	tfm = crypto_alloc_shash("sha1", 0, 0);
+	if (IS_ERR(tfm)) {
+		ext4_msg(sb, KERN_WARNING, "Cannot load sha1 driver, "
+			 "data checksums use generic sha_transform");
+		return;
+	}
+
+	if (crypto_shash_descsize(tfm) > sizeof(struct sha1_state) ||
+	    crypto_shash_statesize(tfm) != sizeof(struct sha1_state)) {
+		crypto_free_shash(tfm);
+		return;
+	}
+
+	ACCESS_ONCE(sbi->s_pfcache_sha1) = tfm;
+}
+
+static void sha_batch_transform(struct super_block *sb, __u32 *digest,
+				const char *data, unsigned rounds)
 {
+	struct crypto_shash *tfm = ACCESS_ONCE(EXT4_SB(sb)->s_pfcache_sha1);
 	__u32 temp[SHA_WORKSPACE_WORDS];
 
+	if (tfm) {
+		struct {
+			struct shash_desc shash;
+			char ctx[sizeof(struct sha1_state)];
+		} desc;
+		struct sha1_state state = { .count = 0 };
+
+		memcpy(state.state, digest, SHA1_DIGEST_SIZE);
+		desc.shash.tfm = tfm;
+		desc.shash.flags = 0;
+
+		/* whole blocks only, the driver never buffers anything */
+		if (!crypto_shash_import(&desc.shash, &state) &&
+		    !crypto_shash_update(&desc.shash, data,
+					 rounds * SHA_MESSAGE_BYTES) &&
+		    !crypto_shash_export(&desc.shash, &state)) {
+			memcpy(digest, state.state, SHA1_DIGEST_SIZE);
+			return;
+		}
+	}
+
 	while (rounds--) {
 		sha_transform(digest, data, temp);
 		data += SHA_MESSAGE_BYTES;
@@ -549,7 +937,7 @@ void ext4_update_data_csum(struct inode *inode, loff_t pos,
 
 	kaddr = kmap_atomic(page);
 	data = kaddr + (pos & (PAGE_CACHE_SIZE - 1));
-	sha_batch_transform(digest, data, len / SHA_MESSAGE_BYTES);
+	sha_batch_transform(inode->i_sb, digest, data, len / SHA_MESSAGE_BYTES);
 	kunmap_atomic(kaddr);
 }
 
@@ -599,11 +987,11 @@ static int ext4_finish_data_csum(struct inode *inode, u8 *csum)
 	if (tail >= SHA_MESSAGE_BYTES - sizeof(bits)) {
 		memcpy(data + SHA_MESSAGE_BYTES * 2 - sizeof(bits),
 				&bits, sizeof(bits));
-		sha_batch_transform(digest, data, 2);
+		sha_batch_transform(inode->i_sb, digest, data, 2);
 	} else {
 		memcpy(data + SHA_MESSAGE_BYTES - sizeof(bits),
 				&bits, sizeof(bits));
-		sha_batch_transform(digest, data, 1);
+		sha_batch_transform(inode->i_sb, digest, data, 1);
 	}
 
 	for (tail = 0; tail < SHA_DIGEST_WORDS ; tail++)
@@ -628,6 +1016,174 @@ void ext4_commit_data_csum(struct inode *inode)
 	mutex_unlock(&inode->i_mutex);
 }
 
+/*
+ * Files which lost their checksum on write, e.g. written not sequentially,
+ * are checksummed again in background once the last writer closes them.
+ * Progress is kept in the inode as a partial checksum, so the scrubber
+ * reads at most s_csum_scrub_kb per second and continues later.  Only
+ * the inode number is queued, files evicted meanwhile are forgotten.
+ */
+#define EXT4_CSUM_SCRUB_MAX	4096
+
+struct ext4_csum_scrub {
+	struct list_head	list;
+	unsigned long		ino;
+	__u32			generation;
+};
+
+static bool ext4_data_csum_complete(struct inode *inode)
+{
+	return ext4_test_inode_state(inode, EXT4_STATE_PFCACHE_CSUM) &&
+	       EXT4_I(inode)->i_data_csum_end < 0;
+}
+
+void ext4_queue_data_csum(struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_csum_scrub *scrub;
+
+	if (!S_ISREG(inode->i_mode) || !test_opt2(inode->i_sb, PFCACHE_CSUM) ||
+	    !sbi->s_csum_scrub_kb || !i_size_read(inode) ||
+	    ext4_data_csum_complete(inode) ||
+	    ACCESS_ONCE(sbi->s_csum_scrub_nr) >= EXT4_CSUM_SCRUB_MAX)
+		return;
+
+	scrub = kmalloc(sizeof(*scrub), GFP_NOFS);
+	if (!scrub)
+		return;
+	scrub->ino = inode->i_ino;
+	scrub->generation = inode->i_generation;
+
+	spin_lock(&sbi->s_csum_scrub_lock);
+	list_add_tail(&scrub->list, &sbi->s_csum_scrub_list);
+	sbi->s_csum_scrub_nr++;
+	spin_unlock(&sbi->s_csum_scrub_lock);
+
+	queue_delayed_work(system_long_wq, &sbi->s_csum_scrub_work, HZ);
+}
+
+/*
+ * Feed up to @budget bytes of the file to its partial checksum.  Returns
+ * the number of bytes read, sets @done when the file needs no more work.
+ */
+static long ext4_scrub_data_csum(struct inode *inode, long budget, bool *done)
+{
+	loff_t pos, size;
+	long bytes = 0;
+
+	*done = true;
+	mutex_lock(&inode->i_mutex);
+	/* Somebody writes it again, last close will queue it once more */
+	if (atomic_read(&inode->i_writecount) > 0 ||
+	    ext4_data_csum_complete(inode))
+		goto out;
+
+	ext4_start_data_csum(inode);
+	while (bytes < budget) {
+		struct page *page;
+		unsigned len;
+
+		pos = EXT4_I(inode)->i_data_csum_end;
+		size = i_size_read(inode);
+		if (size - pos < SHA_MESSAGE_BYTES) {
+			mutex_unlock(&inode->i_mutex);
+			ext4_commit_data_csum(inode);
+			return bytes;
+		}
+
+		page = read_cache_page_gfp(inode->i_mapping,
+					   pos >> PAGE_CACHE_SHIFT, GFP_NOFS);
+		if (IS_ERR(page))
+			goto out;
+
+		len = min_t(loff_t, PAGE_CACHE_SIZE - (pos & ~PAGE_CACHE_MASK),
+			    size - pos);
+		ext4_update_data_csum(inode, pos, len, page);
+		page_cache_release(page);
+		bytes += len;
+		cond_resched();
+	}
+	*done = false;
+out:
+	mutex_unlock(&inode->i_mutex);
+	return bytes;
+}
+
+static void ext4_csum_scrub_work(struct work_struct *work)
+{
+	struct ext4_sb_info *sbi = container_of(to_delayed_work(work),
+					struct ext4_sb_info, s_csum_scrub_work);
+	struct super_block *sb = sbi->s_sb;
+	struct ext4_csum_scrub *scrub;
+	struct inode *inode;
+	long budget;
+	bool done;
+
+	/* Do not pin inodes under umount, ext4_stop_csum_scrub() cleans up */
+	if (!grab_super_passive(sb))
+		goto again;
+
+	budget = (long)ACCESS_ONCE(sbi->s_csum_scrub_kb) << 10;
+	while (budget > 0 && !(sb->s_flags & MS_RDONLY)) {
+		spin_lock(&sbi->s_csum_scrub_lock);
+		scrub = list_first_entry_or_null(&sbi->s_csum_scrub_list,
+						 struct ext4_csum_scrub, list);
+		if (scrub) {
+			list_del(&scrub->list);
+			sbi->s_csum_scrub_nr--;
+		}
+		spin_unlock(&sbi->s_csum_scrub_lock);
+		if (!scrub)
+			break;
+
+		done = true;
+		inode = ilookup(sb, scrub->ino);
+		if (inode) {
+			if (inode->i_generation == scrub->generation &&
+			    test_opt2(sb, PFCACHE_CSUM))
+				budget -= ext4_scrub_data_csum(inode, budget,
+							       &done);
+			iput(inode);
+		}
+
+		if (done) {
+			kfree(scrub);
+			continue;
+		}
+		spin_lock(&sbi->s_csum_scrub_lock);
+		list_add(&scrub->list, &sbi->s_csum_scrub_list);
+		sbi->s_csum_scrub_nr++;
+		spin_unlock(&sbi->s_csum_scrub_lock);
+	}
+	drop_super(sb);
+again:
+	if (!list_empty(&sbi->s_csum_scrub_list) &&
+	    !(sb->s_flags & MS_RDONLY))
+		queue_delayed_work(system_long_wq, &sbi->s_csum_scrub_work, HZ);
+}
+
+void ext4_init_csum_scrub(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	spin_lock_init(&sbi->s_csum_scrub_lock);
+	INIT_LIST_HEAD(&sbi->s_csum_scrub_list);
+	INIT_DELAYED_WORK(&sbi->s_csum_scrub_work, ext4_csum_scrub_work);
+	sbi->s_csum_scrub_kb = 1024;
+}
+
+void ext4_stop_csum_scrub(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_csum_scrub *scrub, *tmp;
+
+	cancel_delayed_work_sync(&sbi->s_csum_scrub_work);
+	list_for_each_entry_safe(scrub, tmp, &sbi->s_csum_scrub_list, list)
+		kfree(scrub);
+	INIT_LIST_HEAD(&sbi->s_csum_scrub_list);
+	sbi->s_csum_scrub_nr = 0;
+}
+
 static int ext4_xattr_trusted_csum_get(struct dentry *dentry, const char *name,
 				       void *buffer, size_t size, int handler_flags)
 {
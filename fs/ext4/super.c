@@ -780,6 +780,7 @@ static void ext4_put_super(struct super_block *sb)
 	int i, err;
 
 	ext4_unregister_li_request(sb);
+	ext4_stop_csum_scrub(sb);
 	dquot_disable(sb, -1, DQUOT_USAGE_ENABLED | DQUOT_LIMITS_ENABLED);
 
 	flush_workqueue(sbi->unrsv_conversion_wq);
@@ -862,6 +863,8 @@ static void ext4_put_super(struct super_block *sb)
 	wait_for_completion(&sbi->s_kobj_unregister);
 	if (sbi->s_chksum_driver)
 		crypto_free_shash(sbi->s_chksum_driver);
+	if (sbi->s_pfcache_sha1)
+		crypto_free_shash(sbi->s_pfcache_sha1);
 	kfree(sbi->s_blockgroup_lock);
 	kfree(sbi);
 }
@@ -989,6 +992,7 @@ void ext4_clear_inode(struct inode *inode)
 		ext4_close_pfcache(inode);
 		ext4_clear_data_csum(inode);
 	}
+	ext4_unindex_data_csum(inode);
 }
 
 static struct inode *ext4_nfs_get_inode(struct super_block *sb,
@@ -2750,6 +2754,8 @@ EXT4_RW_ATTR_SBI_UI(mb_min_to_scan, s_mb_min_to_scan);
 EXT4_RW_ATTR_SBI_UI(mb_order2_req, s_mb_order2_reqs);
 EXT4_RW_ATTR_SBI_UI(mb_stream_req, s_mb_stream_request);
 EXT4_RW_ATTR_SBI_UI(mb_group_prealloc, s_mb_group_prealloc);
+EXT4_RW_ATTR_SBI_UI(mb_large_prealloc_kb, s_mb_large_prealloc_kb);
+EXT4_RW_ATTR_SBI_UI(mb_discard_batch, s_mb_discard_batch);
 EXT4_DEPRECATED_ATTR(max_writeback_mb_bump, 128);
 EXT4_RW_ATTR_SBI_UI(extent_max_zeroout_kb, s_extent_max_zeroout_kb);
 EXT4_ATTR(trigger_fs_error, 0200, NULL, trigger_test_error);
@@ -2763,6 +2769,7 @@ EXT4_RO_ATTR_ES_UI(errors_count, s_error_count);
 EXT4_RO_ATTR_ES_UI(first_error_time, s_first_error_time);
 EXT4_RO_ATTR_ES_UI(last_error_time, s_last_error_time);
 EXT4_RW_ATTR_SBI_UI(bd_full_ratelimit, s_bd_full_ratelimit);
+EXT4_RW_ATTR_SBI_UI(pfcache_scrub_kb, s_csum_scrub_kb);
 
 static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(delayed_allocation_blocks),
@@ -2777,6 +2784,8 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(mb_order2_req),
 	ATTR_LIST(mb_stream_req),
 	ATTR_LIST(mb_group_prealloc),
+	ATTR_LIST(mb_large_prealloc_kb),
+	ATTR_LIST(mb_discard_batch),
 	ATTR_LIST(max_writeback_mb_bump),
 	ATTR_LIST(extent_max_zeroout_kb),
 	ATTR_LIST(trigger_fs_error),
@@ -2793,6 +2802,7 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(csum_partial),
 	ATTR_LIST(csum_complete),
 	ATTR_LIST(pfcache_peers),
+	ATTR_LIST(pfcache_scrub_kb),
 	NULL,
 };
 
@@ -3588,6 +3598,7 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	unsigned int journal_ioprio = DEFAULT_JOURNAL_IOPRIO;
 	unsigned long balloon_ino = 0;
 	ext4_group_t first_not_zeroed;
+	struct blk_plug plug;
 
 	sbi = kzalloc(sizeof(*sbi), GFP_KERNEL);
 	if (!sbi)
@@ -3752,6 +3763,9 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 			   &journal_ioprio, &balloon_ino, 0))
 		goto failed_mount;
 
+	if (test_opt2(sb, PFCACHE_CSUM))
+		ext4_load_pfcache_sha1(sb);
+
 	if (test_opt(sb, DATA_FLAGS) == EXT4_MOUNT_JOURNAL_DATA) {
 		printk_once(KERN_WARNING "EXT4-fs: Warning: mounting "
 			    "with data=journal disables delayed "
@@ -4060,6 +4074,17 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 
 	bgl_lock_init(sbi->s_blockgroup_lock);
 
+	/*
+	 * Submit reads of all descriptor blocks at once, otherwise big
+	 * filesystems wait for thousands of synchronous reads in a row.
+	 */
+	blk_start_plug(&plug);
+	for (i = 0; i < db_count; i++) {
+		block = descriptor_loc(sb, logical_sb_block, i);
+		sb_breadahead(sb, block);
+	}
+	blk_finish_plug(&plug);
+
 	for (i = 0; i < db_count; i++) {
 		block = descriptor_loc(sb, logical_sb_block, i);
 		sbi->s_group_desc[i] = sb_bread(sb, block);
@@ -4079,13 +4104,22 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	get_random_bytes(&sbi->s_next_generation, sizeof(u32));
 	spin_lock_init(&sbi->s_next_gen_lock);
 	spin_lock_init(&sbi->s_pfcache_lock);
+	spin_lock_init(&sbi->s_pfcache_peers_lock);
+	hash_init(sbi->s_pfcache_peers_hash);
+	INIT_LIST_HEAD(&sbi->s_pfcache_peers_lru);
+	spin_lock_init(&sbi->s_csum_index_lock);
+	INIT_RADIX_TREE(&sbi->s_csum_index, GFP_ATOMIC);
+	ext4_init_csum_scrub(sb);
 
 	init_timer(&sbi->s_err_report);
 	sbi->s_err_report.function = print_daily_error_info;
 	sbi->s_err_report.data = (unsigned long) sb;
 
 	/* Register extent status tree shrinker */
-	ext4_es_register_shrinker(sbi);
+	if (ext4_es_register_shrinker(sbi)) {
+		ext4_msg(sb, KERN_ERR, "insufficient memory");
+		goto failed_mount2;
+	}
 
 	err = percpu_counter_init(&sbi->s_extent_cache_cnt, 0);
 	if (!err) {
@@ -4451,6 +4485,8 @@ failed_mount2:
 failed_mount:
 	if (sbi->s_chksum_driver)
 		crypto_free_shash(sbi->s_chksum_driver);
+	if (sbi->s_pfcache_sha1)
+		crypto_free_shash(sbi->s_pfcache_sha1);
 	if (sbi->s_proc) {
 		remove_proc_entry("options", sbi->s_proc);
 		remove_proc_entry(sb->s_id, ext4_proc_root);
@@ -5055,6 +5091,9 @@ static int ext4_remount(struct super_block *sb, int *flags, char *data)
 		goto restore_opts;
 	}
 
+	if (test_opt2(sb, PFCACHE_CSUM))
+		ext4_load_pfcache_sha1(sb);
+
 	if (test_opt(sb, DATA_FLAGS) == EXT4_MOUNT_JOURNAL_DATA) {
 		if (test_opt2(sb, EXPLICIT_DELALLOC)) {
 			ext4_msg(sb, KERN_ERR, "can't mount with "
@@ -5863,6 +5902,7 @@ static void __exit ext4_exit_fs(void)
 
 MODULE_AUTHOR("Remy Card, Stephen Tweedie, Andrew Morton, Andreas Dilger, Theodore Ts'o and others");
 MODULE_DESCRIPTION("Fourth Extended Filesystem");
+MODULE_SOFTDEP("pre: crc32c");
 MODULE_LICENSE("GPL");
 module_init(ext4_init_fs)
 module_exit(ext4_exit_fs)
@@ -26,6 +26,7 @@
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/tracepoint.h>
+#include <linux/hash.h>
 #include "internal.h"
 #include <bc/io_acct.h>
 
@@ -265,6 +266,49 @@ static bool inode_dirtied_after(struct inode *inode, unsigned long t)
  * Move expired (dirtied before work->older_than_this) dirty inodes from
  * @delaying_queue to @dispatch_queue.
  */
+#define WB_UB_SLOTS_SHIFT	4
+#define WB_UB_SLOTS		(1 << WB_UB_SLOTS_SHIFT)
+
+/*
+ * Interleave the inodes of different beancounters, so that a container
+ * which dirtied lots of inodes doesn't hold back writeback of everybody
+ * else's until all of its own are written. Inodes are spread over a few
+ * slots by their dirtied_ub, keeping dirtied_when order inside a slot,
+ * and then taken one by one from each slot in turn, eldest first.
+ * Beancounters hashed to the same slot share its turns.
+ */
+static void interleave_ub_inodes(struct list_head *list)
+{
+	struct list_head slots[WB_UB_SLOTS];
+	struct inode *inode;
+	int i, nr_used = 0;
+
+	for (i = 0; i < WB_UB_SLOTS; i++)
+		INIT_LIST_HEAD(&slots[i]);
+
+	while (!list_empty(list)) {
+		inode = wb_inode(list->prev);
+		i = hash_ptr(ACCESS_ONCE(inode->i_mapping->dirtied_ub),
+			     WB_UB_SLOTS_SHIFT);
+		if (list_empty(&slots[i]))
+			nr_used++;
+		list_move(&inode->i_wb_list, &slots[i]);
+	}
+
+	for (i = 0; nr_used > 1; i = (i + 1) % WB_UB_SLOTS) {
+		if (list_empty(&slots[i]))
+			continue;
+		inode = wb_inode(slots[i].prev);
+		list_move(&inode->i_wb_list, list);
+		if (list_empty(&slots[i]))
+			nr_used--;
+	}
+
+	/* Only one slot left, it goes after everything taken in turns */
+	for (i = 0; i < WB_UB_SLOTS; i++)
+		list_splice(&slots[i], list);
+}
+
 static int move_expired_inodes(struct list_head *delaying_queue,
 			       struct list_head *dispatch_queue,
 			       int flags,
@@ -304,6 +348,10 @@ static int move_expired_inodes(struct list_head *delaying_queue,
 		sb = inode->i_sb;
 	}
 
+	/* Sorting by sb below keeps this order within every sb */
+	if (moved > 1)
+		interleave_ub_inodes(&tmp);
+
 	/* just one sb in list, splice to dispatch_queue and we're done */
 	if (!do_sb_sort) {
 		list_splice(&tmp, dispatch_queue);
@@ -26,15 +26,35 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_dev *fuse_get_dev(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+static struct fuse_conn *fuse_get_conn(struct file *file)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+
+	return fud ? fud->fc : NULL;
+}
+
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+
+	fud = kzalloc(sizeof(struct fuse_dev), GFP_KERNEL);
+	if (fud)
+		fud->fc = fc;
+
+	return fud;
+}
+EXPORT_SYMBOL_GPL(fuse_dev_alloc);
+
 static void fuse_request_init(struct fuse_req *req, struct page **pages,
 			      struct fuse_page_desc *page_descs,
 			      unsigned npages)
@@ -79,6 +99,43 @@ static struct fuse_req *__fuse_request_alloc(unsigned npages, gfp_t flags)
 	return req;
 }
 
+/*
+ * Double the page array of the request, up to fc->max_pages.  Lets
+ * writeback build large requests without allocating max sized
+ * arrays for every one of them.
+ */
+int fuse_req_realloc_pages(struct fuse_conn *fc, struct fuse_req *req,
+			   gfp_t flags)
+{
+	unsigned npages = min(max(req->max_pages * 2, 2U), fc->max_pages);
+	struct page **pages;
+	struct fuse_page_desc *page_descs;
+
+	if (npages <= req->max_pages)
+		return -E2BIG;
+
+	pages = kzalloc(sizeof(struct page *) * npages, flags);
+	page_descs = kzalloc(sizeof(struct fuse_page_desc) * npages, flags);
+	if (!pages || !page_descs) {
+		kfree(pages);
+		kfree(page_descs);
+		return -ENOMEM;
+	}
+
+	memcpy(pages, req->pages, sizeof(struct page *) * req->num_pages);
+	memcpy(page_descs, req->page_descs,
+	       sizeof(struct fuse_page_desc) * req->num_pages);
+	if (req->pages != req->inline_pages) {
+		kfree(req->pages);
+		kfree(req->page_descs);
+	}
+	req->pages = pages;
+	req->page_descs = page_descs;
+	req->max_pages = npages;
+
+	return 0;
+}
+
 struct fuse_req *fuse_request_alloc(unsigned npages)
 {
 	return __fuse_request_alloc(npages, GFP_KERNEL);
@@ -309,18 +366,41 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 	return fc->reqctr;
 }
 
+/*
+ * Queue of the current cpu if some cloned device serves it.  Called
+ * under fc->lock, so we stay on the cpu.
+ */
+static struct fuse_dev_queue *fuse_cpu_queue(struct fuse_conn *fc)
+{
+	struct fuse_dev_queue *fq;
+
+	if (!fc->queues)
+		return NULL;
+
+	fq = &fc->queues[smp_processor_id()];
+	return fq->nr_devs ? fq : NULL;
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_dev_queue *fq = fuse_cpu_queue(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	if (fq) {
+		list_add_tail(&req->list, &fq->pending);
+		wake_up(&fq->waitq);
+		kill_fasync(&fq->fasync, SIGIO, POLL_IN);
+	} else {
+		list_add_tail(&req->list, &fc->pending);
+		wake_up(&fc->waitq);
+		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	}
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -414,9 +494,18 @@ __acquires(fc->lock)
 
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	struct fuse_dev_queue *fq = req->fq;
+
+	/* The interrupt goes to the daemon threads serving the request */
+	if (fq) {
+		list_add_tail(&req->intr_entry, &fq->interrupts);
+		wake_up(&fq->waitq);
+		kill_fasync(&fq->fasync, SIGIO, POLL_IN);
+	} else {
+		list_add_tail(&req->intr_entry, &fc->interrupts);
+		wake_up(&fc->waitq);
+		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	}
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -646,6 +735,9 @@ static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
 	}
 }
 
+/* Pages of the userspace buffer pinned at once by fuse_copy_fill() */
+#define FUSE_COPY_BATCH 16
+
 struct fuse_copy_state {
 	struct fuse_conn *fc;
 	int write;
@@ -658,6 +750,9 @@ struct fuse_copy_state {
 	unsigned long seglen;
 	unsigned long addr;
 	struct page *pg;
+	struct page *batch[FUSE_COPY_BATCH];
+	unsigned batch_nr;
+	unsigned batch_idx;
 	void *mapaddr;
 	void *buf;
 	unsigned len;
@@ -676,7 +771,7 @@ static void fuse_copy_init(struct fuse_copy_state *cs, struct fuse_conn *fc,
 }
 
 /* Unmap and put previous page of userspace buffer */
-static void fuse_copy_finish(struct fuse_copy_state *cs)
+static void fuse_copy_put_page(struct fuse_copy_state *cs)
 {
 	if (cs->currbuf) {
 		struct pipe_buffer *buf = cs->currbuf;
@@ -700,6 +795,46 @@ static void fuse_copy_finish(struct fuse_copy_state *cs)
 	}
 }
 
+/* Also drop the pinned pages of userspace buffer we did not get to */
+static void fuse_copy_finish(struct fuse_copy_state *cs)
+{
+	fuse_copy_put_page(cs);
+	while (cs->batch_idx < cs->batch_nr)
+		put_page(cs->batch[cs->batch_idx++]);
+
+	/*
+	 * Step back over the unused part of the last page, so that the
+	 * next message of a batch is copied right after this one
+	 */
+	if (!cs->pipebufs && cs->len) {
+		cs->addr -= cs->len;
+		cs->seglen += cs->len;
+		cs->len = 0;
+	}
+}
+
+/*
+ * Pin the next pages of the current iovec segment, as many as it
+ * spans but no more than FUSE_COPY_BATCH, so that large requests do
+ * not walk the page tables of the daemon for every page
+ */
+static int fuse_copy_pin(struct fuse_copy_state *cs)
+{
+	unsigned long offset = cs->addr % PAGE_SIZE;
+	int nr = DIV_ROUND_UP(offset + cs->seglen, PAGE_SIZE);
+	int err;
+
+	nr = clamp(nr, 1, FUSE_COPY_BATCH);
+	err = get_user_pages_fast(cs->addr, nr, cs->write, cs->batch);
+	if (err < 0)
+		return err;
+	BUG_ON(!err);
+	cs->batch_nr = err;
+	cs->batch_idx = 0;
+
+	return 0;
+}
+
 /*
  * Get another pagefull of userspace buffer, and map it to kernel
  * address space, and lock request
@@ -710,7 +845,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 	int err;
 
 	unlock_request(cs->fc, cs->req);
-	fuse_copy_finish(cs);
+	fuse_copy_put_page(cs);
 	if (cs->pipebufs) {
 		struct pipe_buffer *buf = cs->pipebufs;
 
@@ -755,10 +890,12 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 			cs->iov++;
 			cs->nr_segs--;
 		}
-		err = get_user_pages_fast(cs->addr, 1, cs->write, &cs->pg);
-		if (err < 0)
-			return err;
-		BUG_ON(err != 1);
+		if (cs->batch_idx == cs->batch_nr) {
+			err = fuse_copy_pin(cs);
+			if (err)
+				return err;
+		}
+		cs->pg = cs->batch[cs->batch_idx++];
 		offset = cs->addr % PAGE_SIZE;
 		cs->mapaddr = kmap(cs->pg);
 		cs->buf = cs->mapaddr + offset;
@@ -1043,21 +1180,34 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/* Forgets are not tied to a cpu, only the main device reads them */
+static int request_pending(struct fuse_dev *fud)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_dev_queue *fq = fud->fq;
+
+	if (fq)
+		return !list_empty(&fq->pending) ||
+			!list_empty(&fq->interrupts);
+
+	return !list_empty(&fud->fc->pending) ||
+		!list_empty(&fud->fc->interrupts) || forget_pending(fud->fc);
+}
+
+static wait_queue_head_t *dev_waitq(struct fuse_dev *fud)
+{
+	return fud->fq ? &fud->fq->waitq : &fud->fc->waitq;
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void request_wait(struct fuse_dev *fud)
+__releases(fud->fc->lock)
+__acquires(fud->fc->lock)
 {
+	struct fuse_conn *fc = fud->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(dev_waitq(fud), &wait);
+	while (fc->connected && !request_pending(fud)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -1067,7 +1217,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(dev_waitq(fud), &wait);
 }
 
 /*
@@ -1230,11 +1380,19 @@ __releases(fc->lock)
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * With @more set we are filling the rest of a batched read: only take
+ * a request which fits into what is left, and never wait for one.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
-				struct fuse_copy_state *cs, size_t nbytes)
+static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
+				struct fuse_copy_state *cs, size_t nbytes,
+				bool more)
 {
 	int err;
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_dev_queue *fq = fud->fq;
+	struct list_head *pending = fq ? &fq->pending : &fc->pending;
+	struct list_head *interrupts = fq ? &fq->interrupts : &fc->interrupts;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
@@ -1242,33 +1400,43 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
  restart:
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
+	if (more) {
+		if (!fc->connected || list_empty(pending))
+			goto err_unlock;
+		req = list_entry(pending->next, struct fuse_req, list);
+		if (req->in.h.len > nbytes)
+			goto err_unlock;
+		goto dequeue;
+	}
+
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fud))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fud);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fud))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(interrupts)) {
+		req = list_entry(interrupts->next, struct fuse_req,
 				 intr_entry);
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
-	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+	if (!fq && forget_pending(fc)) {
+		if (list_empty(pending) || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(pending->next, struct fuse_req, list);
+ dequeue:
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
@@ -1305,7 +1473,9 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		req->fq = fq;
+		list_move_tail(&req->list,
+			       fq ? &fq->processing : &fc->processing);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1322,13 +1492,21 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	size_t nbytes = iov_length(iov, nr_segs);
+	ssize_t res, done = 0;
+	if (!fud)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, fud->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	res = fuse_dev_do_read(fud, file, &cs, nbytes, false);
+	while (fud->batch && res > 0) {
+		done += res;
+		res = fuse_dev_do_read(fud, file, &cs, nbytes - done, true);
+	}
+
+	return done ? done : res;
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1356,18 +1534,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(in);
+	if (!fud)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, fud->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(fud, in, &cs, len, false);
 	if (ret < 0)
 		goto out;
 
@@ -1521,6 +1699,89 @@ err:
 	return err;
 }
 
+/*
+ * Many inode and entry invalidations in one message.  Records for
+ * inodes and entries we do not have cached are silently skipped.
+ */
+static int fuse_notify_inval_batch(struct fuse_conn *fc, unsigned int size,
+				   struct fuse_copy_state *cs)
+{
+	struct fuse_notify_inval_batch_out outarg;
+	struct fuse_notify_inval_rec rec;
+	struct qstr name;
+	unsigned i;
+	int err = -ENOMEM;
+	char *buf;
+
+	buf = kzalloc(FUSE_NAME_MAX + 1, GFP_KERNEL);
+	if (!buf)
+		goto err;
+
+	err = -EINVAL;
+	if (size < sizeof(outarg))
+		goto err;
+
+	err = fuse_copy_one(cs, &outarg, sizeof(outarg));
+	if (err)
+		goto err;
+	size -= sizeof(outarg);
+
+	down_read(&fc->killsb);
+	for (i = 0; i < outarg.count; i++) {
+		unsigned namesize;
+
+		err = -EINVAL;
+		if (size < sizeof(rec))
+			break;
+		err = fuse_copy_one(cs, &rec, sizeof(rec));
+		if (err)
+			break;
+		size -= sizeof(rec);
+
+		err = -ENAMETOOLONG;
+		if (rec.namelen > FUSE_NAME_MAX)
+			break;
+
+		/* The name with its padding */
+		namesize = FUSE_INVAL_REC_SIZE(&rec) - sizeof(rec);
+		err = -EINVAL;
+		if (size < namesize)
+			break;
+		err = fuse_copy_one(cs, buf, namesize);
+		if (err)
+			break;
+		size -= namesize;
+
+		err = -ENOENT;
+		if (!fc->sb)
+			break;
+
+		if (rec.namelen) {
+			buf[rec.namelen] = 0;
+			name.name = buf;
+			name.len = rec.namelen;
+			name.hash = full_name_hash(name.name, name.len);
+			err = fuse_reverse_inval_entry(fc->sb, rec.nodeid, 0,
+						       &name);
+		} else {
+			err = fuse_reverse_inval_inode(fc->sb, rec.nodeid,
+						       rec.off, rec.len);
+		}
+		if (err == -ENOENT || err == -ENOTDIR)
+			err = 0;
+		if (err)
+			break;
+	}
+	up_read(&fc->killsb);
+
+	if (!err && size)
+		err = -EINVAL;
+err:
+	kfree(buf);
+	fuse_copy_finish(cs);
+	return err;
+}
+
 static int fuse_notify_delete(struct fuse_conn *fc, unsigned int size,
 			      struct fuse_copy_state *cs)
 {
@@ -1686,7 +1947,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 		num = file_size - outarg->offset;
 
 	num_pages = (num + offset + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	num_pages = min(num_pages, FUSE_MAX_PAGES_PER_REQ);
+	num_pages = min_t(int, num_pages, fc->max_pages);
 
 	req = fuse_get_req(fc, num_pages);
 	if (IS_ERR(req))
@@ -1828,6 +2089,9 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 	case FUSE_NOTIFY_INVAL_FILES:
 		return fuse_notify_inval_files(fc, size, cs);
 
+	case FUSE_NOTIFY_INVAL_BATCH:
+		return fuse_notify_inval_batch(fc, size, cs);
+
 	default:
 		fuse_copy_finish(cs);
 		return -EINVAL;
@@ -1835,11 +2099,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct list_head *processing, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1878,10 +2142,16 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
-				 struct fuse_copy_state *cs, size_t nbytes)
+/*
+ * In a batched write @nbytes may hold more than one reply, then only
+ * the first one is handled and its length is returned.
+ */
+static ssize_t fuse_dev_do_write(struct fuse_dev *fud,
+				 struct fuse_copy_state *cs, size_t nbytes,
+				 bool batch)
 {
 	int err;
+	struct fuse_conn *fc = fud->fc;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
 
@@ -1893,8 +2163,10 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		goto err_finish;
 
 	err = -EINVAL;
-	if (oh.len != nbytes)
+	if (oh.len > nbytes || (!batch && oh.len != nbytes) ||
+	    oh.len < sizeof(oh))
 		goto err_finish;
+	nbytes = oh.len;
 
 	/*
 	 * Zero oh.unique indicates unsolicited notification message
@@ -1914,7 +2186,8 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fud->fq ? &fud->fq->processing : &fc->processing,
+			   oh.unique);
 	if (!req)
 		goto err_unlock;
 
@@ -1975,13 +2248,23 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(iocb->ki_filp);
+	size_t nbytes = iov_length(iov, nr_segs);
+	ssize_t res, done = 0;
+	if (!fud)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, fud->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	/* A failed reply ends the batch, the write comes out short */
+	do {
+		res = fuse_dev_do_write(fud, &cs, nbytes - done, fud->batch);
+		if (res <= 0)
+			break;
+		done += res;
+	} while (fud->batch && done < nbytes);
+
+	return done ? done : res;
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1992,12 +2275,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_dev *fud;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	fud = fuse_get_dev(out);
+	if (!fud)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -2044,14 +2327,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, fud->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(fud, &cs, len, false);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -2065,16 +2348,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_conn *fc;
+	if (!fud)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = fud->fc;
+	poll_wait(file, dev_waitq(fud), wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fud))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -2144,6 +2429,14 @@ __acquires(fc->lock)
 	flush_bg_queue(fc);
 	end_requests(fc, &fc->pending);
 	end_requests(fc, &fc->processing);
+	if (fc->queues) {
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			end_requests(fc, &fc->queues[cpu].pending);
+			end_requests(fc, &fc->queues[cpu].processing);
+		}
+	}
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -2192,18 +2485,61 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		fuse_wake_readers(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+void fuse_wake_readers(struct fuse_conn *fc)
+{
+	struct fuse_dev_queue *queues = ACCESS_ONCE(fc->queues);
+	int cpu;
+
+	wake_up_all(&fc->waitq);
+	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+
+	if (!queues)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		wake_up_all(&queues[cpu].waitq);
+		kill_fasync(&queues[cpu].fasync, SIGIO, POLL_IN);
+	}
+}
+
+/*
+ * The last clone of a queue is gone: requests not read yet go to
+ * the main device, those being processed cannot be answered anymore.
+ */
+static void fuse_dev_queue_release(struct fuse_conn *fc,
+				   struct fuse_dev_queue *fq)
+{
+	spin_lock(&fc->lock);
+	if (!--fq->nr_devs) {
+		if (!list_empty(&fq->pending)) {
+			list_splice_tail_init(&fq->pending, &fc->pending);
+			wake_up(&fc->waitq);
+			kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		}
+		end_requests(fc, &fq->processing);
+	}
+	spin_unlock(&fc->lock);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_conn *fc;
+
+	if (!fud)
+		return 0;
+
+	fc = fud->fc;
+	if (fud->fq) {
+		fuse_dev_queue_release(fc, fud->fq);
+	} else {
 		spin_lock(&fc->lock);
 		fc->connected = 0;
 		fc->blocked = 0;
@@ -2212,8 +2548,11 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
-		fuse_conn_put(fc);
+		/* Clones may still wait for requests */
+		fuse_wake_readers(fc);
 	}
+	fuse_conn_put(fc);
+	kfree(fud);
 
 	return 0;
 }
@@ -2221,12 +2560,128 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (!fud)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on,
+			     fud->fq ? &fud->fq->fasync : &fud->fc->fasync);
+}
+
+static struct fuse_dev_queue *fuse_alloc_queues(void)
+{
+	struct fuse_dev_queue *queues;
+	int cpu;
+
+	queues = kcalloc(nr_cpu_ids, sizeof(*queues), GFP_KERNEL);
+	if (!queues)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		struct fuse_dev_queue *fq = &queues[cpu];
+
+		init_waitqueue_head(&fq->waitq);
+		INIT_LIST_HEAD(&fq->pending);
+		INIT_LIST_HEAD(&fq->processing);
+		INIT_LIST_HEAD(&fq->interrupts);
+	}
+	return queues;
+}
+
+/*
+ * Bind a new device to the queue of the current cpu of the
+ * connection the old device belongs to
+ */
+static int fuse_dev_clone(struct file *file, struct file *old)
+{
+	struct fuse_conn *fc = fuse_get_conn(old);
+	struct fuse_dev_queue *queues = NULL;
+	struct fuse_dev *fud;
+	int err;
+
+	if (!fc)
+		return -EINVAL;
+
+	fud = fuse_dev_alloc(fc);
+	if (!fud)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	if (!ACCESS_ONCE(fc->queues)) {
+		queues = fuse_alloc_queues();
+		if (!queues)
+			goto out_free;
+	}
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	if (file->private_data)
+		goto out_unlock;
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		goto out_unlock;
+	}
+	if (!fc->queues) {
+		fc->queues = queues;
+		queues = NULL;
+	}
+	fud->fq = &fc->queues[smp_processor_id()];
+	fud->fq->nr_devs++;
+	spin_unlock(&fc->lock);
+
+	file->private_data = fud;
+	fuse_conn_get(fc);
+	mutex_unlock(&fuse_mutex);
+	kfree(queues);
+	return 0;
+
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(queues);
+ out_free:
+	kfree(fud);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_dev *fud;
+	struct file *old;
+	u32 oldfd, val;
+	int err;
+
+	if (cmd == FUSE_DEV_IOC_BATCH) {
+		fud = fuse_get_dev(file);
+		if (!fud)
+			return -EPERM;
+		if (get_user(val, (u32 __user *)arg))
+			return -EFAULT;
+		fud->batch = !!val;
+		return 0;
+	}
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (u32 __user *)arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	/* Only a device of the same kind can be cloned */
+	err = -EINVAL;
+	if (old->f_op == file->f_op)
+		err = fuse_dev_clone(file, old);
+
+	fput(old);
+	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2241,6 +2696,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -13,6 +13,7 @@
 #include <linux/sched.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/highmem.h>
 
 static bool fuse_use_readdirplus(struct inode *dir, struct file *filp)
 {
@@ -112,6 +113,24 @@ void fuse_invalidate_attr(struct inode *inode)
 	get_fuse_inode(inode)->i_time = 0;
 }
 
+void fuse_readdir_cache_reset(struct inode *dir)
+{
+	struct fuse_inode *fi = get_fuse_inode(dir);
+
+	spin_lock(&fi->rdc.lock);
+	fi->rdc.cached = false;
+	fi->rdc.size = 0;
+	fi->rdc.pos = 0;
+	fi->rdc.version++;
+	spin_unlock(&fi->rdc.lock);
+}
+
+void fuse_dir_changed(struct inode *dir)
+{
+	fuse_invalidate_attr(dir);
+	fuse_readdir_cache_reset(dir);
+}
+
 /*
  * Just mark the entry as stale, so that a next attempt to look it up
  * will result in a new lookup call to userspace
@@ -481,7 +500,7 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	kfree(forget);
 	d_instantiate(entry, inode);
 	fuse_change_entry_timeout(entry, &outentry);
-	fuse_invalidate_attr(dir);
+	fuse_dir_changed(dir);
 	err = finish_open(file, entry, generic_file_open, opened);
 	if (err) {
 		if (fc->writeback_cache) {
@@ -613,7 +632,7 @@ static int create_new_entry(struct fuse_conn *fc, struct fuse_req *req,
 		d_instantiate(entry, inode);
 
 	fuse_change_entry_timeout(entry, &outarg);
-	fuse_invalidate_attr(dir);
+	fuse_dir_changed(dir);
 	return 0;
 
  out_put_forget_req:
@@ -726,7 +745,7 @@ static int fuse_unlink(struct inode *dir, struct dentry *entry)
 			drop_nlink(inode);
 		spin_unlock(&fc->lock);
 		fuse_invalidate_attr(inode);
-		fuse_invalidate_attr(dir);
+		fuse_dir_changed(dir);
 		fuse_invalidate_entry_cache(entry);
 	} else if (err == -EINTR)
 		fuse_invalidate_entry(entry);
@@ -751,7 +770,7 @@ static int fuse_rmdir(struct inode *dir, struct dentry *entry)
 	fuse_put_request(fc, req);
 	if (!err) {
 		clear_nlink(entry->d_inode);
-		fuse_invalidate_attr(dir);
+		fuse_dir_changed(dir);
 		fuse_invalidate_entry_cache(entry);
 	} else if (err == -EINTR)
 		fuse_invalidate_entry(entry);
@@ -794,9 +813,9 @@ static int fuse_rename_common(struct inode *olddir, struct dentry *oldent,
 			fuse_invalidate_attr(newent->d_inode);
 		}
 
-		fuse_invalidate_attr(olddir);
+		fuse_dir_changed(olddir);
 		if (olddir != newdir)
-			fuse_invalidate_attr(newdir);
+			fuse_dir_changed(newdir);
 
 		/* newent will end up negative */
 		if (!(flags & RENAME_EXCHANGE) && newent->d_inode) {
@@ -1057,7 +1076,7 @@ int fuse_reverse_inval_entry(struct super_block *sb, u64 parent_nodeid,
 	if (!entry)
 		goto unlock;
 
-	fuse_invalidate_attr(parent);
+	fuse_dir_changed(parent);
 	fuse_invalidate_entry(entry);
 
 	if (child_nodeid != 0 && entry->d_inode) {
@@ -1239,6 +1258,229 @@ static int fuse_permission(struct inode *inode, int mask)
 	return err;
 }
 
+/*
+ * Append the entry read at offset @pos to the readdir cache, if the
+ * cache ends right there.  Entries never cross a page boundary, the
+ * rest of a page is zeroed, so that a reader stops at zero namelen.
+ */
+static void fuse_add_dirent_to_cache(struct file *file,
+				     struct fuse_dirent *dirent, loff_t pos)
+{
+	struct fuse_file *ff = file->private_data;
+	struct inode *dir = file_inode(file);
+	struct fuse_inode *fi = get_fuse_inode(dir);
+	size_t reclen = FUSE_DIRENT_SIZE(dirent);
+	pgoff_t index;
+	struct page *page;
+	loff_t size;
+	u64 version;
+	unsigned offset;
+	void *addr;
+
+	if (!(ff->open_flags & FOPEN_CACHE_DIR))
+		return;
+
+	spin_lock(&fi->rdc.lock);
+	if (fi->rdc.cached || fi->rdc.pos != pos) {
+		spin_unlock(&fi->rdc.lock);
+		return;
+	}
+	version = fi->rdc.version;
+	size = fi->rdc.size;
+	offset = size & ~PAGE_CACHE_MASK;
+	index = size >> PAGE_CACHE_SHIFT;
+	if (offset + reclen > PAGE_CACHE_SIZE) {
+		index++;
+		offset = 0;
+	}
+	spin_unlock(&fi->rdc.lock);
+
+	if (offset) {
+		page = find_lock_page(file->f_mapping, index);
+	} else {
+		page = find_or_create_page(file->f_mapping, index,
+					   mapping_gfp_mask(file->f_mapping));
+	}
+	if (!page) {
+		/* The head of the page was reclaimed, start over */
+		if (offset)
+			fuse_readdir_cache_reset(dir);
+		return;
+	}
+
+	spin_lock(&fi->rdc.lock);
+	/* Raced with another reader or with a reset */
+	if (fi->rdc.version != version || fi->rdc.size != size ||
+	    WARN_ON(fi->rdc.pos != pos))
+		goto unlock;
+
+	addr = kmap_atomic(page);
+	if (!offset)
+		clear_page(addr);
+	memcpy(addr + offset, dirent, reclen);
+	kunmap_atomic(addr);
+	fi->rdc.size = (index << PAGE_CACHE_SHIFT) + offset + reclen;
+	fi->rdc.pos = dirent->off;
+unlock:
+	spin_unlock(&fi->rdc.lock);
+	unlock_page(page);
+	page_cache_release(page);
+}
+
+/* READDIR at @pos returned nothing: the whole directory is cached */
+static void fuse_readdir_cache_end(struct file *file, loff_t pos)
+{
+	struct fuse_file *ff = file->private_data;
+	struct fuse_inode *fi = get_fuse_inode(file_inode(file));
+
+	if (!(ff->open_flags & FOPEN_CACHE_DIR))
+		return;
+
+	spin_lock(&fi->rdc.lock);
+	if (fi->rdc.pos == pos)
+		fi->rdc.cached = true;
+	spin_unlock(&fi->rdc.lock);
+}
+
+enum fuse_parse_result {
+	FOUND_ERR = -1,
+	FOUND_NONE = 0,
+	FOUND_SOME,
+	FOUND_ALL,
+};
+
+static enum fuse_parse_result fuse_parse_cache(struct fuse_file *ff,
+					       void *addr, unsigned size,
+					       struct file *file, void *dstbuf,
+					       filldir_t filldir)
+{
+	unsigned offset = ff->readdir.cache_off & ~PAGE_CACHE_MASK;
+	enum fuse_parse_result res = FOUND_NONE;
+
+	WARN_ON(offset >= size);
+
+	for (;;) {
+		struct fuse_dirent *dirent = addr + offset;
+		unsigned nbytes = size - offset;
+		size_t reclen;
+
+		if (nbytes < FUSE_NAME_OFFSET || !dirent->namelen)
+			break;
+
+		reclen = FUSE_DIRENT_SIZE(dirent);
+
+		if (WARN_ON(dirent->namelen > FUSE_NAME_MAX))
+			return FOUND_ERR;
+		if (WARN_ON(reclen > nbytes))
+			return FOUND_ERR;
+		if (WARN_ON(memchr(dirent->name, '/',
+				   dirent->namelen) != NULL))
+			return FOUND_ERR;
+
+		if (filldir(dstbuf, dirent->name, dirent->namelen,
+			    file->f_pos, dirent->ino, dirent->type))
+			return FOUND_ALL;
+
+		res = FOUND_SOME;
+		file->f_pos = dirent->off;
+		ff->readdir.pos = dirent->off;
+		ff->readdir.cache_off += reclen;
+		offset += reclen;
+	}
+
+	return res;
+}
+
+/*
+ * Serve readdir from the cache.  Returns 1 if the cache can't be used
+ * at the current position and READDIR must be sent to the daemon.
+ */
+static int fuse_readdir_cached(struct file *file, void *dstbuf,
+			       filldir_t filldir)
+{
+	struct fuse_file *ff = file->private_data;
+	struct inode *dir = file_inode(file);
+	struct fuse_inode *fi = get_fuse_inode(dir);
+	enum fuse_parse_result res;
+	pgoff_t index;
+	unsigned size;
+	struct page *page;
+	void *addr;
+
+	/* Seeked?  If so, reset the cache stream */
+	if (ff->readdir.pos != file->f_pos) {
+		ff->readdir.pos = 0;
+		ff->readdir.cache_off = 0;
+	}
+
+retry:
+	spin_lock(&fi->rdc.lock);
+	if (!fi->rdc.cached) {
+		spin_unlock(&fi->rdc.lock);
+		return 1;
+	}
+	/* The position is only valid for the cache it was taken in */
+	if (ff->readdir.version != fi->rdc.version) {
+		ff->readdir.version = fi->rdc.version;
+		ff->readdir.pos = 0;
+		ff->readdir.cache_off = 0;
+	}
+	if (ff->readdir.pos != file->f_pos) {
+		spin_unlock(&fi->rdc.lock);
+		return 1;
+	}
+	/* End of cache reached */
+	if (ff->readdir.cache_off == fi->rdc.size) {
+		spin_unlock(&fi->rdc.lock);
+		return 0;
+	}
+	index = ff->readdir.cache_off >> PAGE_CACHE_SHIFT;
+	if (index == (fi->rdc.size >> PAGE_CACHE_SHIFT))
+		size = fi->rdc.size & ~PAGE_CACHE_MASK;
+	else
+		size = PAGE_CACHE_SIZE;
+	spin_unlock(&fi->rdc.lock);
+
+	page = find_get_page(file->f_mapping, index);
+	if (!page) {
+		/* Part of the cache was reclaimed, don't trust the rest */
+		spin_lock(&fi->rdc.lock);
+		if (fi->rdc.version == ff->readdir.version) {
+			spin_unlock(&fi->rdc.lock);
+			fuse_readdir_cache_reset(dir);
+		} else {
+			spin_unlock(&fi->rdc.lock);
+		}
+		return 1;
+	}
+
+	spin_lock(&fi->rdc.lock);
+	if (fi->rdc.version != ff->readdir.version) {
+		spin_unlock(&fi->rdc.lock);
+		page_cache_release(page);
+		goto retry;
+	}
+	spin_unlock(&fi->rdc.lock);
+
+	addr = kmap(page);
+	res = fuse_parse_cache(ff, addr, size, file, dstbuf, filldir);
+	kunmap(page);
+	page_cache_release(page);
+
+	if (res == FOUND_ERR) {
+		fuse_readdir_cache_reset(dir);
+		return 1;
+	}
+
+	if (res == FOUND_ALL)
+		return 0;
+
+	/* We are at the end of the page, go to the next one */
+	if (size == PAGE_CACHE_SIZE)
+		ff->readdir.cache_off = (loff_t)(index + 1) << PAGE_CACHE_SHIFT;
+	goto retry;
+}
+
 static int parse_dirfile(char *buf, size_t nbytes, struct file *file,
 			 void *dstbuf, filldir_t filldir)
 {
@@ -1253,6 +1495,8 @@ static int parse_dirfile(char *buf, size_t nbytes, struct file *file,
 		if (memchr(dirent->name, '/', dirent->namelen) != NULL)
 			return -EIO;
 
+		fuse_add_dirent_to_cache(file, dirent, file->f_pos);
+
 		over = filldir(dstbuf, dirent->name, dirent->namelen,
 			       file->f_pos, dirent->ino, dirent->type);
 		if (over)
@@ -1401,6 +1645,7 @@ static int parse_dirplusfile(char *buf, size_t nbytes, struct file *file,
 			   we need to send a FORGET for each of those
 			   which we did not link.
 			*/
+			fuse_add_dirent_to_cache(file, dirent, file->f_pos);
 			over = filldir(dstbuf, dirent->name, dirent->namelen,
 				       file->f_pos, dirent->ino,
 				       dirent->type);
@@ -1425,12 +1670,19 @@ static int fuse_readdir(struct file *file, void *dstbuf, filldir_t filldir)
 	struct page *page;
 	struct inode *inode = file_inode(file);
 	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_file *ff = file->private_data;
 	struct fuse_req *req;
 	u64 attr_version = 0;
 
 	if (is_bad_inode(inode))
 		return -EIO;
 
+	if (ff->open_flags & FOPEN_CACHE_DIR) {
+		err = fuse_readdir_cached(file, dstbuf, filldir);
+		if (err <= 0)
+			return err;
+	}
+
 	req = fuse_get_req(fc, 1);
 	if (IS_ERR(req))
 		return PTR_ERR(req);
@@ -1458,7 +1710,9 @@ static int fuse_readdir(struct file *file, void *dstbuf, filldir_t filldir)
 	nbytes = req->out.args[0].size;
 	err = req->out.h.error;
 	fuse_put_request(fc, req);
-	if (!err) {
+	if (!err && !nbytes) {
+		fuse_readdir_cache_end(file, file->f_pos);
+	} else if (!err) {
 		if (plus) {
 			err = parse_dirplusfile(page_address(page), nbytes,
 						file, dstbuf, filldir,
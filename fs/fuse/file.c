@@ -243,8 +243,11 @@ void fuse_finish_open(struct inode *inode, struct file *file)
 
 	if (ff->open_flags & FOPEN_DIRECT_IO)
 		file->f_op = &fuse_direct_io_file_operations;
-	if (!(ff->open_flags & FOPEN_KEEP_CACHE))
+	if (!(ff->open_flags & FOPEN_KEEP_CACHE)) {
+		if (S_ISDIR(inode->i_mode))
+			fuse_readdir_cache_reset(inode);
 		invalidate_inode_pages2(inode->i_mapping);
+	}
 	if (ff->open_flags & FOPEN_NONSEEKABLE)
 		nonseekable_open(inode, file);
 	if (fc->atomic_o_trunc && (file->f_flags & O_TRUNC)) {
@@ -1100,11 +1103,11 @@ static int fuse_readpages_fill(void *_data, struct page *page)
 	fuse_wait_on_page_writeback_or_invalidate(inode, file, page->index);
 
 	if (req->num_pages &&
-	    (req->num_pages == FUSE_MAX_PAGES_PER_REQ ||
+	    (req->num_pages == fc->max_pages ||
 	     (req->num_pages + 1) * PAGE_CACHE_SIZE > fc->max_read ||
 	     req->pages[req->num_pages - 1]->index + 1 != page->index)) {
 		int nr_alloc = min_t(unsigned, data->nr_pages,
-				     FUSE_MAX_PAGES_PER_REQ);
+				     fc->max_pages);
 		fuse_send_readpages(req, data->file);
 		if (fc->async_read)
 			req = fuse_get_req_for_background(fc, nr_alloc);
@@ -1138,7 +1141,7 @@ static int fuse_readpages(struct file *file, struct address_space *mapping,
 	struct fuse_conn *fc = get_fuse_conn(inode);
 	struct fuse_fill_data data;
 	int err;
-	int nr_alloc = min_t(unsigned, nr_pages, FUSE_MAX_PAGES_PER_REQ);
+	int nr_alloc = min_t(unsigned, nr_pages, fc->max_pages);
 
 	err = -EIO;
 	if (is_bad_inode(inode))
@@ -1354,12 +1357,13 @@ static ssize_t fuse_fill_write_pages(struct fuse_req *req,
 	return count > 0 ? count : err;
 }
 
-static inline unsigned fuse_wr_pages(loff_t pos, size_t len)
+static inline unsigned fuse_wr_pages(loff_t pos, size_t len,
+				     unsigned max_pages)
 {
 	return min_t(unsigned,
 		     ((pos + len - 1) >> PAGE_CACHE_SHIFT) -
 		     (pos >> PAGE_CACHE_SHIFT) + 1,
-		     FUSE_MAX_PAGES_PER_REQ);
+		     max_pages);
 }
 
 static ssize_t fuse_perform_write(struct file *file,
@@ -1381,7 +1385,8 @@ static ssize_t fuse_perform_write(struct file *file,
 	do {
 		struct fuse_req *req;
 		ssize_t count;
-		unsigned nr_pages = fuse_wr_pages(pos, iov_iter_count(ii));
+		unsigned nr_pages = fuse_wr_pages(pos, iov_iter_count(ii),
+						  fc->max_pages);
 
 		req = fuse_get_req(fc, nr_pages);
 		if (IS_ERR(req)) {
@@ -1595,12 +1600,13 @@ static int fuse_get_user_pages(struct fuse_req *req, struct iov_iter *ii,
 	return 0;
 }
 
-static inline int fuse_iter_npages(const struct iov_iter *ii_p)
+static inline int fuse_iter_npages(const struct iov_iter *ii_p,
+				   int max_pages)
 {
 	struct iov_iter ii = *ii_p;
 	int npages = 0;
 
-	while (iov_iter_count(&ii) && npages < FUSE_MAX_PAGES_PER_REQ) {
+	while (iov_iter_count(&ii) && npages < max_pages) {
 		unsigned long user_addr = fuse_get_user_addr(&ii);
 		unsigned offset = user_addr & ~PAGE_MASK;
 		size_t frag_size = iov_iter_single_seg_count(&ii);
@@ -1609,7 +1615,7 @@ static inline int fuse_iter_npages(const struct iov_iter *ii_p)
 		iov_iter_advance(&ii, frag_size);
 	}
 
-	return min(npages, FUSE_MAX_PAGES_PER_REQ);
+	return min(npages, max_pages);
 }
 
 ssize_t fuse_direct_io(struct fuse_io_priv *io, const struct iovec *iov,
@@ -1632,9 +1638,10 @@ ssize_t fuse_direct_io(struct fuse_io_priv *io, const struct iovec *iov,
 	iov_iter_init(&ii, iov, nr_segs, count, 0);
 
 	if (io->async)
-		req = fuse_get_req_for_background(fc, fuse_iter_npages(&ii));
+		req = fuse_get_req_for_background(fc,
+				fuse_iter_npages(&ii, fc->max_pages));
 	else
-		req = fuse_get_req(fc, fuse_iter_npages(&ii));
+		req = fuse_get_req(fc, fuse_iter_npages(&ii, fc->max_pages));
 	if (IS_ERR(req))
 		return PTR_ERR(req);
 
@@ -1679,9 +1686,10 @@ ssize_t fuse_direct_io(struct fuse_io_priv *io, const struct iovec *iov,
 			fuse_put_request(fc, req);
 			if (io->async)
 				req = fuse_get_req_for_background(fc,
-					fuse_iter_npages(&ii));
+					fuse_iter_npages(&ii, fc->max_pages));
 			else
-				req = fuse_get_req(fc, fuse_iter_npages(&ii));
+				req = fuse_get_req(fc,
+					fuse_iter_npages(&ii, fc->max_pages));
 			if (IS_ERR(req))
 				break;
 		}
@@ -2097,10 +2105,15 @@ static int fuse_writepages_fill(struct page *page,
 		fuse_wait_on_page_writeback(inode, page->index);
 	}
 
+	/*
+	 * Requests start small and grow up to fc->max_pages while the
+	 * dirty pages are contiguous
+	 */
 	if (req->num_pages &&
-	    (req->num_pages == FUSE_MAX_PAGES_PER_REQ ||
-	     (req->num_pages + 1) * PAGE_CACHE_SIZE > fc->max_write ||
-	     req->pages[req->num_pages - 1]->index + 1 != page->index)) {
+	    ((req->num_pages + 1) * PAGE_CACHE_SIZE > fc->max_write ||
+	     req->pages[req->num_pages - 1]->index + 1 != page->index ||
+	     (req->num_pages == req->max_pages &&
+	      fuse_req_realloc_pages(fc, req, GFP_NOFS)))) {
 		int err;
 
 		if (wbc->sync_mode == WB_SYNC_NONE && fc->blocked) {
@@ -2115,8 +2128,8 @@ static int fuse_writepages_fill(struct page *page,
 			return err;
 		}
 
-		data->req = req =
-			fuse_request_alloc_nofs(FUSE_MAX_PAGES_PER_REQ);
+		data->req = req = fuse_request_alloc_nofs(min_t(unsigned,
+				fc->max_pages, FUSE_DEFAULT_MAX_PAGES_PER_REQ));
 		if (!req) {
 			unlock_page(page);
 			return -ENOMEM;
@@ -2197,7 +2210,8 @@ static int fuse_writepages(struct address_space *mapping,
 	}
 
 	data.inode = inode;
-	data.req = fuse_request_alloc_nofs(FUSE_MAX_PAGES_PER_REQ);
+	data.req = fuse_request_alloc_nofs(min_t(unsigned, fc->max_pages,
+					   FUSE_DEFAULT_MAX_PAGES_PER_REQ));
 	err = -ENOMEM;
 	if (!data.req)
 		goto out_put;
@@ -2709,7 +2723,7 @@ static int fuse_copy_ioctl_iovec_old(struct iovec *dst, void *src,
 static int fuse_verify_ioctl_iov(struct iovec *iov, size_t count)
 {
 	size_t n;
-	u32 max = FUSE_MAX_PAGES_PER_REQ << PAGE_SHIFT;
+	u32 max = FUSE_DEFAULT_MAX_PAGES_PER_REQ << PAGE_SHIFT;
 
 	for (n = 0; n < count; n++, iov++) {
 		if (iov->iov_len > (size_t) max)
@@ -2832,7 +2846,8 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 	BUILD_BUG_ON(sizeof(struct fuse_ioctl_iovec) * FUSE_IOCTL_MAX_IOV > PAGE_SIZE);
 
 	err = -ENOMEM;
-	pages = kcalloc(FUSE_MAX_PAGES_PER_REQ, sizeof(pages[0]), GFP_KERNEL);
+	pages = kcalloc(FUSE_DEFAULT_MAX_PAGES_PER_REQ, sizeof(pages[0]),
+			GFP_KERNEL);
 	iov_page = (struct iovec *) __get_free_page(GFP_KERNEL);
 	if (!pages || !iov_page)
 		goto out;
@@ -2871,7 +2886,7 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 
 	/* make sure there are enough buffer pages and init request with them */
 	err = -ENOMEM;
-	if (max_pages > FUSE_MAX_PAGES_PER_REQ)
+	if (max_pages > FUSE_DEFAULT_MAX_PAGES_PER_REQ)
 		goto out;
 	while (num_pages < max_pages) {
 		pages[num_pages] = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
@@ -3171,8 +3186,8 @@ static ssize_t fuse_direct_IO_bvec(int rw, struct kiocb *iocb,
 	loff_t pos = iocb->ki_pos;
 	int i;
 
-	if (nmax > FUSE_MAX_PAGES_PER_REQ << PAGE_SHIFT)
-		nmax = FUSE_MAX_PAGES_PER_REQ << PAGE_SHIFT;
+	if (nmax > fc->max_pages << PAGE_SHIFT)
+		nmax = fc->max_pages << PAGE_SHIFT;
 
 	virtinfo_notifier_call(VITYPE_IO, VIRTINFO_IO_PREPARE, NULL);
 
@@ -3249,7 +3264,7 @@ static void fuse_do_truncate(struct file *file)
 
 static inline loff_t fuse_round_up(loff_t off)
 {
-	return round_up(off, FUSE_MAX_PAGES_PER_REQ << PAGE_SHIFT);
+	return round_up(off, FUSE_DEFAULT_MAX_PAGES_PER_REQ << PAGE_SHIFT);
 }
 
 static ssize_t
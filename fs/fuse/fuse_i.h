@@ -23,8 +23,11 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 
-/** Max number of pages that can be used in a single read request */
-#define FUSE_MAX_PAGES_PER_REQ 32
+/** Default max number of pages that can be used in a single request */
+#define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
+
+/** Upper limit of max_pages the filesystem may ask for in INIT (4M) */
+#define FUSE_MAX_MAX_PAGES 1024
 
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
@@ -124,6 +127,24 @@ struct fuse_inode {
 
 	/** Mostly to detect very first open */
 	atomic_t num_openers;
+
+	/** Readdir cache of a directory, kept in its page cache */
+	struct {
+		/** Protects the fields below */
+		spinlock_t lock;
+
+		/** All entries up to the end of directory are cached */
+		bool cached;
+
+		/** Bytes of fuse_dirent records in the page cache */
+		loff_t size;
+
+		/** Daemon's offset cookie after the last cached entry */
+		loff_t pos;
+
+		/** Bumped on every reset of the cache */
+		u64 version;
+	} rdc;
 };
 
 /** FUSE inode state bits */
@@ -180,6 +201,18 @@ struct fuse_file {
 	bool flock:1;
 
 	unsigned long ff_state;
+
+	/** Position of a directory reader in the readdir cache */
+	struct {
+		/** Offset cookie the cache position corresponds to */
+		loff_t pos;
+
+		/** Offset in the cache of the next entry */
+		loff_t cache_off;
+
+		/** Version of the cache the position is valid for */
+		u64 version;
+	} readdir;
 };
 
 /** FUSE file states (ff_state) */
@@ -290,6 +323,9 @@ struct fuse_req {
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
+	/** Device queue the request was read from, NULL for the main one */
+	struct fuse_dev_queue *fq;
+
 	/** refcount */
 	atomic_t count;
 
@@ -406,6 +442,48 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A per-cpu queue of a connection, served by cloned devices.
+ *
+ * Requests submitted on a cpu go to its queue if some cloned device
+ * is bound to it, and to the main pending list of the connection
+ * otherwise.  The reply must come through a device of the same queue.
+ * Protected by fc->lock.
+ */
+struct fuse_dev_queue {
+	/** Readers of the cloned devices are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** Requests routed to this queue */
+	struct list_head pending;
+
+	/** Requests read from this queue and waiting for a reply */
+	struct list_head processing;
+
+	/** Pending interrupts of the requests being processed */
+	struct list_head interrupts;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+
+	/** Number of cloned devices bound to this queue */
+	unsigned nr_devs;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * An open fuse device, private_data of the file
+ */
+struct fuse_dev {
+	/** The connection, the device holds a reference to it */
+	struct fuse_conn *fc;
+
+	/** The queue of a cloned device, NULL for the main device */
+	struct fuse_dev_queue *fq;
+
+	/** Many requests per read() and replies per write() */
+	bool batch;
+};
+
 /**
  * A Fuse connection.
  *
@@ -438,6 +516,9 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
+	/** Maximum number of pages that can be used in a single request */
+	unsigned max_pages;
+
 	/** Readers of the connection are waiting on this */
 	wait_queue_head_t waitq;
 
@@ -450,6 +531,9 @@ struct fuse_conn {
 	/** The list of requests under I/O */
 	struct list_head io;
 
+	/** Per-cpu device queues, allocated on the first clone */
+	struct fuse_dev_queue *queues;
+
 	/** The next unique kernel file handle */
 	u64 khctr;
 
@@ -844,6 +928,9 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/* Wake up all readers of the connection, called on disconnect */
+void fuse_wake_readers(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -851,6 +938,13 @@ void fuse_invalidate_attr(struct inode *inode);
 
 void fuse_invalidate_entry_cache(struct dentry *entry);
 
+/**
+ * Directory contents changed: drop its attributes and readdir cache
+ */
+void fuse_dir_changed(struct inode *dir);
+
+void fuse_readdir_cache_reset(struct inode *dir);
+
 /**
  * Acquire reference to fuse_conn
  */
@@ -948,6 +1042,9 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 long fuse_ioctl_common(struct file *file, unsigned int cmd,
 		       unsigned long arg, unsigned int flags);
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+int fuse_req_realloc_pages(struct fuse_conn *fc, struct fuse_req *req,
+			   gfp_t flags);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
 bool fuse_write_update_size(struct inode *inode, loff_t pos);
@@ -101,6 +101,11 @@ static struct inode *fuse_alloc_inode(struct super_block *sb)
 	INIT_LIST_HEAD(&fi->queued_writes);
 	INIT_LIST_HEAD(&fi->writepages);
 	init_waitqueue_head(&fi->page_waitq);
+	spin_lock_init(&fi->rdc.lock);
+	fi->rdc.cached = false;
+	fi->rdc.size = 0;
+	fi->rdc.pos = 0;
+	fi->rdc.version = 0;
 	fi->forget = fuse_alloc_forget();
 	if (!fi->forget) {
 		kmem_cache_free(fuse_inode_cachep, inode);
@@ -229,6 +234,17 @@ void fuse_change_attributes(struct inode *inode, struct fuse_attr *attr,
 		i_size_write(inode, attr->size);
 	spin_unlock(&fc->lock);
 
+	if (S_ISDIR(inode->i_mode)) {
+		struct timespec new_mtime = {
+			.tv_sec = attr->mtime,
+			.tv_nsec = attr->mtimensec,
+		};
+
+		/* Somebody changed the directory behind our back */
+		if (!timespec_equal(&old_mtime, &new_mtime))
+			fuse_readdir_cache_reset(inode);
+	}
+
 	if (!is_wb && S_ISREG(inode->i_mode)) {
 		bool inval = false;
 
@@ -346,6 +362,8 @@ int fuse_reverse_inval_inode(struct super_block *sb, u64 nodeid,
 		return -ENOENT;
 
 	fuse_invalidate_attr(inode);
+	if (S_ISDIR(inode->i_mode))
+		fuse_readdir_cache_reset(inode);
 	if (offset >= 0) {
 		pg_start = offset >> PAGE_CACHE_SHIFT;
 		if (len <= 0)
@@ -415,6 +433,16 @@ int fuse_invalidate_files(struct fuse_conn *fc, u64 nodeid)
 		spin_lock(&fc->lock);
 		fuse_kill_requests(fc, inode, &fc->processing);
 		fuse_kill_requests(fc, inode, &fc->pending);
+		if (fc->queues) {
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				struct fuse_dev_queue *fq = &fc->queues[cpu];
+
+				fuse_kill_requests(fc, inode, &fq->processing);
+				fuse_kill_requests(fc, inode, &fq->pending);
+			}
+		}
 		fuse_kill_requests(fc, inode, &fc->bg_queue);
 		fuse_kill_requests(fc, inode, &fc->io);
 		wake_up(&fi->page_waitq); /* readpage[s] can wait on fuse wb */
@@ -462,8 +490,7 @@ void fuse_conn_kill(struct fuse_conn *fc)
 	fc->initialized = 1;
 	spin_unlock(&fc->lock);
 	/* Flush all readers on this fs */
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
-	wake_up_all(&fc->waitq);
+	fuse_wake_readers(fc);
 	wake_up_all(&fc->blocked_waitq);
 	wake_up_all(&fc->reserved_req_waitq);
 }
@@ -715,6 +742,7 @@ void fuse_conn_init(struct fuse_conn *fc)
 	atomic_set(&fc->num_waiting, 0);
 	fc->max_background = FUSE_DEFAULT_MAX_BACKGROUND;
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
+	fc->max_pages = FUSE_DEFAULT_MAX_PAGES_PER_REQ;
 	fc->khctr = 0;
 	fc->polled_files = RB_ROOT;
 	fc->reqctr = 0;
@@ -730,6 +758,7 @@ void fuse_conn_put(struct fuse_conn *fc)
 	if (atomic_dec_and_test(&fc->count)) {
 		if (fc->destroy_req)
 			fuse_request_free(fc->destroy_req);
+		kfree(fc->queues);
 		mutex_destroy(&fc->inst_mutex);
 		fc->release(fc);
 	}
@@ -1009,6 +1038,10 @@ static void process_init_reply(struct fuse_conn *fc, struct fuse_req *req)
 			}
 			if (arg->flags & FUSE_ASYNC_DIO)
 				fc->async_dio = 1;
+			if (arg->flags & FUSE_MAX_PAGES)
+				fc->max_pages = clamp_t(unsigned,
+						arg->max_pages, 1,
+						FUSE_MAX_MAX_PAGES);
 		} else {
 			ra_pages = fc->max_read / PAGE_CACHE_SIZE;
 			fc->no_lock = 1;
@@ -1036,7 +1069,8 @@ static void fuse_send_init(struct fuse_conn *fc, struct fuse_req *req)
 		FUSE_EXPORT_SUPPORT | FUSE_BIG_WRITES | FUSE_DONT_MASK |
 		FUSE_SPLICE_WRITE | FUSE_SPLICE_MOVE | FUSE_SPLICE_READ |
 		FUSE_FLOCK_LOCKS | FUSE_IOCTL_DIR | FUSE_AUTO_INVAL_DATA |
-		FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_ASYNC_DIO;
+		FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_ASYNC_DIO |
+		FUSE_MAX_PAGES;
 	req->in.h.opcode = FUSE_INIT;
 	req->in.numargs = 1;
 	req->in.args[0].size = sizeof(*arg);
@@ -1108,6 +1142,7 @@ static int fuse_bdi_init(struct fuse_conn *fc, struct super_block *sb)
 static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 {
 	struct fuse_conn *fc;
+	struct fuse_dev *fud;
 	struct inode *root;
 	struct fuse_mount_data d;
 	struct file *file;
@@ -1199,6 +1234,10 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 			goto err_free_init_req;
 	}
 
+	fud = fuse_dev_alloc(fc);
+	if (!fud)
+		goto err_free_init_req;
+
 	mutex_lock(&fuse_mutex);
 	err = -EINVAL;
 	if (file->private_data)
@@ -1211,7 +1250,8 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 	list_add_tail(&fc->entry, &fuse_conn_list);
 	sb->s_root = root_dentry;
 	fc->connected = 1;
-	file->private_data = fuse_conn_get(fc);
+	fuse_conn_get(fc);
+	file->private_data = fud;
 	mutex_unlock(&fuse_mutex);
 	/*
 	 * atomic_dec_and_test() in fput() provides the necessary
@@ -1226,6 +1266,7 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 
  err_unlock:
 	mutex_unlock(&fuse_mutex);
+	kfree(fud);
  err_free_init_req:
 	fuse_request_free(init_req);
  err_put_root:
@@ -19,6 +19,7 @@
 #include <linux/ratelimit.h>
 #include <linux/list_lru.h>
 #include <linux/vzstat.h>
+#include <linux/pagecache_handover.h>
 #include <trace/events/writeback.h>
 #include "internal.h"
 
@@ -950,6 +951,8 @@ EXPORT_SYMBOL(lockdep_annotate_inode_mutex_key);
  */
 void unlock_new_inode(struct inode *inode)
 {
+	/* nobody can see the page cache of the inode while it is I_NEW */
+	pagecache_handover_adopt(inode);
 	lockdep_annotate_inode_mutex_key(inode);
 	spin_lock(&inode->i_lock);
 	WARN_ON(!(inode->i_state & I_NEW));
@@ -16,6 +16,7 @@ struct file_system_type;
 struct linux_binprm;
 struct path;
 struct mount;
+struct mnt_namespace;
 struct shrink_control;
 
 /*
@@ -55,6 +56,8 @@ extern int copy_mount_string(const void __user *, char **);
 
 extern struct vfsmount *lookup_mnt(struct path *);
 extern int finish_automount(struct vfsmount *, struct path *);
+extern int iterate_ns_mounts(struct mnt_namespace *,
+			     int (*)(struct vfsmount *, void *), void *);
 
 extern int sb_prepare_remount_readonly(struct super_block *);
 
@@ -337,29 +337,49 @@ static void jbd2_descr_block_csum_set(journal_t *j,
 	tail->t_checksum = cpu_to_be32(csum);
 }
 
-static void jbd2_block_tag_csum_set(journal_t *j, journal_block_tag_t *tag,
-				    struct buffer_head *bh, __u32 sequence)
+/*
+ * Set the checksums of all the tags of a full descriptor block in one
+ * go.  A tag checksum is crc32c(uuid+seq+block) and uuid+seq is the
+ * same for the whole transaction, so the caller computes it once and
+ * passes it in as @seq_csum.  @bhs are the log buffers the tags
+ * describe, in tag order.
+ */
+static void jbd2_block_tags_csum_set(journal_t *j,
+				     struct buffer_head *descriptor,
+				     struct buffer_head **bhs, int nr,
+				     __u32 seq_csum)
 {
-	journal_block_tag3_t *tag3 = (journal_block_tag3_t *)tag;
-	struct page *page = bh->b_page;
-	__u8 *addr;
-	__u32 csum32;
-	__be32 seq;
+	struct jbd2_chksum_desc desc;
+	int tag_bytes = journal_tag_bytes(j);
+	char *tagp;
+	int i;
 
 	if (!jbd2_journal_has_csum_v2or3(j))
 		return;
 
-	seq = cpu_to_be32(sequence);
-	addr = kmap_atomic(page);
-	csum32 = jbd2_chksum(j, j->j_csum_seed, (__u8 *)&seq, sizeof(seq));
-	csum32 = jbd2_chksum(j, csum32, addr + offset_in_page(bh->b_data),
-			     bh->b_size);
-	kunmap_atomic(addr);
+	jbd2_chksum_desc_init(j, &desc);
+	tagp = &descriptor->b_data[sizeof(journal_header_t)];
+	for (i = 0; i < nr; i++) {
+		journal_block_tag_t *tag = (journal_block_tag_t *)tagp;
+		journal_block_tag3_t *tag3 = (journal_block_tag3_t *)tagp;
+		struct buffer_head *bh = bhs[i];
+		__u8 *addr;
+		__u32 csum32;
+
+		addr = kmap_atomic(bh->b_page);
+		csum32 = jbd2_chksum_desc(&desc, seq_csum,
+					  addr + offset_in_page(bh->b_data),
+					  bh->b_size);
+		kunmap_atomic(addr);
+
+		if (JBD2_HAS_INCOMPAT_FEATURE(j, JBD2_FEATURE_INCOMPAT_CSUM_V3))
+			tag3->t_checksum = cpu_to_be32(csum32);
+		else
+			tag->t_checksum = cpu_to_be16(csum32);
 
-	if (JBD2_HAS_INCOMPAT_FEATURE(j, JBD2_FEATURE_INCOMPAT_CSUM_V3))
-		tag3->t_checksum = cpu_to_be32(csum32);
-	else
-		tag->t_checksum = cpu_to_be16(csum32);
+		/* The first tag is followed by the journal UUID */
+		tagp += tag_bytes + (i == 0 ? 16 : 0);
+	}
 }
 /*
  * jbd2_journal_commit_transaction
@@ -396,6 +416,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	tid_t first_tid;
 	int update_tail;
 	int csum_size = 0;
+	__u32 seq_csum = 0;
 	LIST_HEAD(io_bufs);
 	LIST_HEAD(log_bufs);
 
@@ -581,6 +602,13 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	J_ASSERT(commit_transaction->t_nr_buffers <=
 		 atomic_read(&commit_transaction->t_outstanding_credits));
 
+	if (jbd2_journal_has_csum_v2or3(journal)) {
+		__be32 seq = cpu_to_be32(commit_transaction->t_tid);
+
+		seq_csum = jbd2_chksum(journal, journal->j_csum_seed,
+				       (__u8 *)&seq, sizeof(seq));
+	}
+
 	err = 0;
 	bufs = 0;
 	descriptor = NULL;
@@ -695,8 +723,6 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		tag = (journal_block_tag_t *) tagp;
 		write_tag_block(journal, tag, jh2bh(jh)->b_blocknr);
 		tag->t_flags = cpu_to_be16(tag_flag);
-		jbd2_block_tag_csum_set(journal, tag, wbuf[bufs],
-					commit_transaction->t_tid);
 		tagp += tag_bytes;
 		space_left -= tag_bytes;
 		bufs++;
@@ -723,6 +749,9 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 
 			tag->t_flags |= cpu_to_be16(JBD2_FLAG_LAST_TAG);
 
+			/* wbuf[0] is the descriptor itself */
+			jbd2_block_tags_csum_set(journal, descriptor,
+						 wbuf + 1, bufs - 1, seq_csum);
 			jbd2_descr_block_csum_set(journal, descriptor);
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
@@ -2667,6 +2667,8 @@ static void __exit journal_exit(void)
 }
 
 MODULE_LICENSE("GPL");
+/* Make the accelerated crc32c drivers register before our first tfm */
+MODULE_SOFTDEP("pre: crc32c");
 module_init(journal_init);
 module_exit(journal_exit);
 
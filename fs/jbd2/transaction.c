@@ -37,6 +37,16 @@ static void __jbd2_journal_temp_unlink_buffer(struct journal_head *jh);
 static void __jbd2_journal_unfile_buffer(struct journal_head *jh);
 
 static struct kmem_cache *transaction_cache;
+
+/*
+ * Expire transactions of all journals with the same commit interval at
+ * the same moments.  Hundreds of small filesystems on one host then
+ * commit together and their cache flushes reach the device close enough
+ * to be merged by the block layer, instead of a steady stream of them.
+ */
+static bool jbd2_commit_align __read_mostly = true;
+module_param_named(commit_align, jbd2_commit_align, bool, 0644);
+MODULE_PARM_DESC(commit_align, "Align periodic commits of all journals");
 int __init jbd2_journal_init_transaction_cache(void)
 {
 	J_ASSERT(!transaction_cache);
@@ -88,6 +98,11 @@ jbd2_get_transaction(journal_t *journal, transaction_t *transaction)
 	transaction->t_start_time = ktime_get();
 	transaction->t_tid = journal->j_transaction_sequence++;
 	transaction->t_expires = jiffies + journal->j_commit_interval;
+	/* Next multiple of the interval, in average it is just as far */
+	if (jbd2_commit_align && journal->j_commit_interval > 1)
+		transaction->t_expires = roundup(jiffies +
+				journal->j_commit_interval / 2,
+				journal->j_commit_interval);
 	spin_lock_init(&transaction->t_handle_lock);
 	atomic_set(&transaction->t_updates, 0);
 	atomic_set(&transaction->t_outstanding_credits,
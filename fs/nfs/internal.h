@@ -73,6 +73,7 @@ struct nfs_client_initdata {
 	struct nfs_subversion *nfs_mod;
 	int proto;
 	u32 minorversion;
+	unsigned int nconnect;
 	struct net *net;
 };
 
@@ -112,6 +113,7 @@ struct nfs_parsed_mount_data {
 		char			*export_path;
 		int			port;
 		unsigned short		protocol;
+		unsigned int		nconnect;
 	} nfs_server;
 
 	struct security_mnt_opts lsm_opts;
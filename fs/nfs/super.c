@@ -106,6 +106,7 @@ enum {
 	Opt_mountport,
 	Opt_mountvers,
 	Opt_minorversion,
+	Opt_nconnect,
 
 	/* Mount options that take string arguments */
 	Opt_nfsvers,
@@ -171,6 +172,7 @@ static const match_table_t nfs_mount_option_tokens = {
 	{ Opt_mountport, "mountport=%s" },
 	{ Opt_mountvers, "mountvers=%s" },
 	{ Opt_minorversion, "minorversion=%s" },
+	{ Opt_nconnect, "nconnect=%s" },
 
 	{ Opt_nfsvers, "nfsvers=%s" },
 	{ Opt_nfsvers, "vers=%s" },
@@ -681,6 +683,8 @@ static void nfs_show_mount_options(struct seq_file *m, struct nfs_server *nfss,
 		if (nfss->port)
 			seq_printf(m, ",port=%u", nfss->port);
 
+	if (nfss->nfs_client->cl_nconnect > 1)
+		seq_printf(m, ",nconnect=%u", nfss->nfs_client->cl_nconnect);
 	seq_printf(m, ",timeo=%lu", 10U * nfss->client->cl_timeout->to_initval / HZ);
 	seq_printf(m, ",retrans=%u", nfss->client->cl_timeout->to_retries);
 	seq_printf(m, ",sec=%s", nfs_pseudoflavour_to_name(nfss->client->cl_auth->au_flavor));
@@ -929,6 +933,7 @@ static struct nfs_parsed_mount_data *nfs_alloc_parsed_mount_data(void)
 		data->mount_server.port	= NFS_UNSPEC_PORT;
 		data->nfs_server.port	= NFS_UNSPEC_PORT;
 		data->nfs_server.protocol = XPRT_TRANSPORT_TCP;
+		data->nfs_server.nconnect = 1;
 		data->selected_flavor	= RPC_AUTH_MAXFLAVOR;
 		data->minorversion	= 0;
 		data->need_mount	= true;
@@ -1335,6 +1340,12 @@ static int nfs_parse_mount_options(char *raw,
 				goto out_invalid_value;
 			mnt->nfs_server.port = option;
 			break;
+		case Opt_nconnect:
+			if (nfs_get_option_ul(args, &option) ||
+			    option < 1 || option > RPC_MAX_CONNECT)
+				goto out_invalid_value;
+			mnt->nfs_server.nconnect = option;
+			break;
 		case Opt_rsize:
 			if (nfs_get_option_ul(args, &option))
 				goto out_invalid_value;
@@ -2154,6 +2165,8 @@ static int nfs_validate_text_mount_data(void *options,
 		nfs_validate_transport_protocol(args);
 		if (args->nfs_server.protocol == XPRT_TRANSPORT_UDP)
 			goto out_invalid_transport_udp;
+		if (args->nfs_server.nconnect > 1)
+			goto out_v4_nconnect;
 		nfs4_validate_mount_flags(args);
 #else
 		goto out_v4_not_compiled;
@@ -2177,6 +2190,9 @@ out_v4_not_compiled:
 out_invalid_transport_udp:
 	dfprintk(MOUNT, "NFSv4: Unsupported transport protocol udp\n");
 	return -EINVAL;
+out_v4_nconnect:
+	dfprintk(MOUNT, "NFSv4: nconnect is not supported\n");
+	return -EINVAL;
 #endif /* !CONFIG_NFS_V4 */
 
 out_no_address:
@@ -2214,6 +2230,7 @@ nfs_compare_remount_data(struct nfs_server *nfss,
 	    data->acdirmax != nfss->acdirmax / HZ ||
 	    data->timeo != (10U * nfss->client->cl_timeout->to_initval / HZ) ||
 	    data->nfs_server.port != nfss->port ||
+	    data->nfs_server.nconnect != nfss->nfs_client->cl_nconnect ||
 	    data->nfs_server.addrlen != nfss->nfs_client->cl_addrlen ||
 	    !rpc_cmp_addr((struct sockaddr *)&data->nfs_server.address,
 			  (struct sockaddr *)&nfss->nfs_client->cl_addr))
@@ -2260,6 +2277,7 @@ nfs_remount(struct super_block *sb, int *flags, char *raw_data)
 	data->acdirmax = nfss->acdirmax / HZ;
 	data->timeo = 10U * nfss->client->cl_timeout->to_initval / HZ;
 	data->nfs_server.port = nfss->port;
+	data->nfs_server.nconnect = nfss->nfs_client->cl_nconnect;
 	data->nfs_server.addrlen = nfss->nfs_client->cl_addrlen;
 	data->version = nfsvers;
 	data->minorversion = nfss->nfs_client->cl_minorversion;
@@ -76,6 +76,8 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 	struct file *new_file;
 	loff_t old_pos = 0;
 	loff_t new_pos = 0;
+	loff_t end = len;
+	bool skip_hole = true;
 	int error = 0;
 
 	if (len == 0)
@@ -91,7 +93,14 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		goto out_fput;
 	}
 
-	/* FIXME: copy up sparse files efficiently */
+	/*
+	 * If both layers are on the same filesystem and it can share
+	 * extents, copy up is just a metadata operation.  Anything else
+	 * (-EXDEV, -EOPNOTSUPP, ...) means we have to copy the data.
+	 */
+	if (!vfs_clone_file_range(old_file, 0, new_file, 0, len))
+		goto out;
+
 	while (len) {
 		size_t this_len = OVL_COPY_UP_CHUNK_SIZE;
 		long bytes;
@@ -104,6 +113,26 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 			break;
 		}
 
+		/* Don't fill holes of sparse files, leave them in upper too */
+		if (skip_hole) {
+			loff_t data_pos = vfs_llseek(old_file, old_pos,
+						     SEEK_DATA);
+
+			if (data_pos == -ENXIO) {
+				/* Only a hole is left till the end */
+				break;
+			} else if (data_pos < 0) {
+				/* Lower fs does not know SEEK_DATA */
+				skip_hole = false;
+			} else if (data_pos > old_pos) {
+				if (data_pos >= end)
+					break;
+				len -= data_pos - old_pos;
+				old_pos = new_pos = data_pos;
+				continue;
+			}
+		}
+
 		bytes = do_splice_direct(old_file, &old_pos,
 					 new_file, &new_pos,
 					 this_len, SPLICE_F_MOVE);
@@ -116,6 +145,18 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		len -= bytes;
 	}
 
+	/* Trailing hole was skipped, extend upper file to the full size */
+	if (!error && new_pos < end) {
+		struct iattr attr = {
+			.ia_valid = ATTR_SIZE,
+			.ia_size = end,
+		};
+
+		mutex_lock(&new->dentry->d_inode->i_mutex);
+		error = notify_change(new->dentry, &attr, NULL);
+		mutex_unlock(&new->dentry->d_inode->i_mutex);
+	}
+out:
 	fput(new_file);
 out_fput:
 	fput(old_file);
@@ -177,7 +177,7 @@ static int ovl_create_upper(struct dentry *dentry, struct inode *inode,
 	if (err)
 		goto out_dput;
 
-	ovl_dentry_version_inc(dentry->d_parent);
+	ovl_dir_cache_add(dentry->d_parent, dentry, newdentry->d_inode);
 	ovl_dentry_update(dentry, newdentry);
 	ovl_copyattr(newdentry->d_inode, inode);
 	d_instantiate(dentry, inode);
@@ -357,7 +357,7 @@ static int ovl_create_over_whiteout(struct dentry *dentry, struct inode *inode,
 		if (err)
 			goto out_cleanup;
 	}
-	ovl_dentry_version_inc(dentry->d_parent);
+	ovl_dir_cache_add(dentry->d_parent, dentry, newdentry->d_inode);
 	ovl_dentry_update(dentry, newdentry);
 	ovl_copyattr(newdentry->d_inode, inode);
 	d_instantiate(dentry, inode);
@@ -553,7 +553,7 @@ static int ovl_remove_and_whiteout(struct dentry *dentry, bool is_dir)
 		if (is_dir)
 			ovl_cleanup(wdir, upper);
 	}
-	ovl_dentry_version_inc(dentry->d_parent);
+	ovl_dir_cache_del(dentry->d_parent, dentry);
 out_d_drop:
 	d_drop(dentry);
 	dput(whiteout);
@@ -586,7 +586,10 @@ static int ovl_remove_upper(struct dentry *dentry, bool is_dir)
 		else
 			err = vfs_unlink(dir, upper, NULL);
 		dput(upper);
-		ovl_dentry_version_inc(dentry->d_parent);
+		if (!err)
+			ovl_dir_cache_del(dentry->d_parent, dentry);
+		else
+			ovl_dentry_version_inc(dentry->d_parent);
 	}
 
 	/*
@@ -155,6 +155,10 @@ extern const struct file_operations ovl_dir_operations;
 int ovl_check_empty_dir(struct dentry *dentry, struct list_head *list);
 void ovl_cleanup_whiteouts(struct dentry *upper, struct list_head *list);
 void ovl_cache_free(struct list_head *list);
+void ovl_dir_cache_release(struct ovl_dir_cache *cache);
+void ovl_dir_cache_add(struct dentry *dir, struct dentry *dentry,
+		       struct inode *realinode);
+void ovl_dir_cache_del(struct dentry *dir, struct dentry *dentry);
 
 /* inode.c */
 int ovl_setattr(struct dentry *dentry, struct iattr *attr);
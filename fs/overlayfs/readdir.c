@@ -12,7 +12,7 @@
 #include <linux/namei.h>
 #include <linux/file.h>
 #include <linux/xattr.h>
-#include <linux/rbtree.h>
+#include <linux/hash.h>
 #include <linux/security.h>
 #include <linux/cred.h>
 #include "overlayfs.h"
@@ -22,16 +22,34 @@ struct ovl_cache_entry {
 	unsigned int type;
 	u64 ino;
 	struct list_head l_node;
-	struct rb_node node;
+	struct hlist_node h_node;
+	unsigned int hash;
 	bool is_whiteout;
 	bool is_cursor;
 	char name[];
 };
 
+/* Name lookup in a merged listing, grows with the number of entries */
+struct ovl_cache_hash {
+	struct hlist_head *heads;
+	unsigned int bits;
+	unsigned int count;
+};
+
+#define OVL_CACHE_HASH_MIN_BITS	4
+#define OVL_CACHE_HASH_MAX_BITS	16
+
+/*
+ * Merged listing of a directory.  It lives as long as the dentry, which
+ * holds one reference, so it is not rebuilt for every opener.  Creates
+ * and unlinks in the directory update it in place, anything else bumps
+ * the dentry version and the next opener builds a new one.
+ */
 struct ovl_dir_cache {
 	long refcount;
 	u64 version;
 	struct list_head entries;
+	struct ovl_cache_hash hash;
 };
 
 struct dir_context {
@@ -42,7 +60,7 @@ struct dir_context {
 struct ovl_readdir_data {
 	struct dir_context ctx;
 	bool is_merge;
-	struct rb_root root;
+	struct ovl_cache_hash *hash;
 	struct list_head *list;
 	struct list_head middle;
 	int count;
@@ -58,26 +76,67 @@ struct ovl_dir_file {
 	struct file *upperfile;
 };
 
-static struct ovl_cache_entry *ovl_cache_entry_from_node(struct rb_node *n)
+static int ovl_cache_hash_init(struct ovl_cache_hash *h)
+{
+	h->bits = OVL_CACHE_HASH_MIN_BITS;
+	h->count = 0;
+	h->heads = kcalloc(1 << h->bits, sizeof(struct hlist_head),
+			   GFP_KERNEL);
+
+	return h->heads ? 0 : -ENOMEM;
+}
+
+static void ovl_cache_hash_free(struct ovl_cache_hash *h)
+{
+	kfree(h->heads);
+	h->heads = NULL;
+}
+
+/* Failing to grow is not an error, chains just get longer */
+static void ovl_cache_hash_grow(struct ovl_cache_hash *h)
+{
+	unsigned int bits = h->bits + 1;
+	struct hlist_head *heads;
+	struct hlist_node *tmp;
+	struct ovl_cache_entry *p;
+	unsigned int i;
+
+	heads = kcalloc(1 << bits, sizeof(struct hlist_head),
+			GFP_KERNEL | __GFP_NOWARN);
+	if (!heads)
+		return;
+
+	for (i = 0; i < (1 << h->bits); i++) {
+		hlist_for_each_entry_safe(p, tmp, &h->heads[i], h_node) {
+			hlist_del(&p->h_node);
+			hlist_add_head(&p->h_node,
+				       &heads[hash_32(p->hash, bits)]);
+		}
+	}
+	kfree(h->heads);
+	h->heads = heads;
+	h->bits = bits;
+}
+
+static void ovl_cache_hash_add(struct ovl_cache_hash *h,
+			       struct ovl_cache_entry *p)
 {
-	return container_of(n, struct ovl_cache_entry, node);
+	if (h->count >= (1 << h->bits) && h->bits < OVL_CACHE_HASH_MAX_BITS)
+		ovl_cache_hash_grow(h);
+
+	hlist_add_head(&p->h_node, &h->heads[hash_32(p->hash, h->bits)]);
+	h->count++;
 }
 
-static struct ovl_cache_entry *ovl_cache_entry_find(struct rb_root *root,
-						    const char *name, int len)
+static struct ovl_cache_entry *ovl_cache_entry_find(struct ovl_cache_hash *h,
+						    const char *name, int len,
+						    unsigned int hash)
 {
-	struct rb_node *node = root->rb_node;
-	int cmp;
-
-	while (node) {
-		struct ovl_cache_entry *p = ovl_cache_entry_from_node(node);
-
-		cmp = strncmp(name, p->name, len);
-		if (cmp > 0)
-			node = p->node.rb_right;
-		else if (cmp < 0 || len < p->len)
-			node = p->node.rb_left;
-		else
+	struct ovl_cache_entry *p;
+
+	hlist_for_each_entry(p, &h->heads[hash_32(hash, h->bits)], h_node) {
+		if (p->hash == hash && p->len == len &&
+		    !memcmp(p->name, name, len))
 			return p;
 	}
 
@@ -85,7 +144,8 @@ static struct ovl_cache_entry *ovl_cache_entry_find(struct rb_root *root,
 }
 
 static struct ovl_cache_entry *ovl_cache_entry_new(const char *name, int len,
-						   u64 ino, unsigned int d_type)
+						   unsigned int hash, u64 ino,
+						   unsigned int d_type)
 {
 	struct ovl_cache_entry *p;
 	size_t size = offsetof(struct ovl_cache_entry, name[len + 1]);
@@ -95,6 +155,7 @@ static struct ovl_cache_entry *ovl_cache_entry_new(const char *name, int len,
 		memcpy(p->name, name, len);
 		p->name[len] = '\0';
 		p->len = len;
+		p->hash = hash;
 		p->type = d_type;
 		p->ino = ino;
 		p->is_whiteout = false;
@@ -104,36 +165,22 @@ static struct ovl_cache_entry *ovl_cache_entry_new(const char *name, int len,
 	return p;
 }
 
-static int ovl_cache_entry_add_rb(struct ovl_readdir_data *rdd,
-				  const char *name, int len, u64 ino,
-				  unsigned int d_type)
+static int ovl_fill_upper(struct ovl_readdir_data *rdd,
+			  const char *name, int len, u64 ino,
+			  unsigned int d_type)
 {
-	struct rb_node **newp = &rdd->root.rb_node;
-	struct rb_node *parent = NULL;
+	unsigned int hash = full_name_hash(name, len);
 	struct ovl_cache_entry *p;
 
-	while (*newp) {
-		int cmp;
-		struct ovl_cache_entry *tmp;
-
-		parent = *newp;
-		tmp = ovl_cache_entry_from_node(*newp);
-		cmp = strncmp(name, tmp->name, len);
-		if (cmp > 0)
-			newp = &tmp->node.rb_right;
-		else if (cmp < 0 || len < tmp->len)
-			newp = &tmp->node.rb_left;
-		else
-			return 0;
-	}
+	if (ovl_cache_entry_find(rdd->hash, name, len, hash))
+		return 0;
 
-	p = ovl_cache_entry_new(name, len, ino, d_type);
+	p = ovl_cache_entry_new(name, len, hash, ino, d_type);
 	if (p == NULL)
 		return -ENOMEM;
 
 	list_add_tail(&p->l_node, rdd->list);
-	rb_link_node(&p->node, parent, newp);
-	rb_insert_color(&p->node, &rdd->root);
+	ovl_cache_hash_add(rdd->hash, p);
 
 	return 0;
 }
@@ -142,17 +189,20 @@ static int ovl_fill_lower(struct ovl_readdir_data *rdd,
 			  const char *name, int namelen,
 			  loff_t offset, u64 ino, unsigned int d_type)
 {
+	unsigned int hash = full_name_hash(name, namelen);
 	struct ovl_cache_entry *p;
 
-	p = ovl_cache_entry_find(&rdd->root, name, namelen);
+	p = ovl_cache_entry_find(rdd->hash, name, namelen, hash);
 	if (p) {
 		list_move_tail(&p->l_node, &rdd->middle);
 	} else {
-		p = ovl_cache_entry_new(name, namelen, ino, d_type);
-		if (p == NULL)
+		p = ovl_cache_entry_new(name, namelen, hash, ino, d_type);
+		if (p == NULL) {
 			rdd->err = -ENOMEM;
-		else
+		} else {
 			list_add_tail(&p->l_node, &rdd->middle);
+			ovl_cache_hash_add(rdd->hash, p);
+		}
 	}
 
 	return rdd->err;
@@ -169,22 +219,92 @@ void ovl_cache_free(struct list_head *list)
 	INIT_LIST_HEAD(list);
 }
 
-static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
+static void ovl_dir_cache_unref(struct ovl_dir_cache *cache)
 {
-	struct ovl_dir_cache *cache = od->cache;
-
-	list_del_init(&od->cursor.l_node);
 	WARN_ON(cache->refcount <= 0);
 	cache->refcount--;
 	if (!cache->refcount) {
-		if (ovl_dir_cache(dentry) == cache)
-			ovl_set_dir_cache(dentry, NULL);
-
 		ovl_cache_free(&cache->entries);
+		ovl_cache_hash_free(&cache->hash);
 		kfree(cache);
 	}
 }
 
+static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
+{
+	list_del_init(&od->cursor.l_node);
+	ovl_dir_cache_unref(od->cache);
+}
+
+/* Drop the reference of the dentry, called when it goes away */
+void ovl_dir_cache_release(struct ovl_dir_cache *cache)
+{
+	ovl_dir_cache_unref(cache);
+}
+
+/* Return the cache of @dir only if it is still in sync with the layers */
+static struct ovl_dir_cache *ovl_dir_cache_current(struct dentry *dir)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache(dir);
+
+	if (cache && ovl_dentry_version_get(dir) != cache->version)
+		cache = NULL;
+
+	return cache;
+}
+
+/*
+ * @dentry was created in @dir.  A hidden entry for the same name (lower
+ * entry covered by a whiteout, or a name removed earlier) is shown again
+ * with the attributes of the new upper inode, otherwise a new entry is
+ * added at the end, so that offsets of open directories stay valid.
+ */
+void ovl_dir_cache_add(struct dentry *dir, struct dentry *dentry,
+		       struct inode *realinode)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache_current(dir);
+	const char *name = dentry->d_name.name;
+	int len = dentry->d_name.len;
+	unsigned int hash = full_name_hash(name, len);
+	struct ovl_cache_entry *p;
+
+	if (!cache)
+		return;
+
+	p = ovl_cache_entry_find(&cache->hash, name, len, hash);
+	if (!p) {
+		p = ovl_cache_entry_new(name, len, hash, 0, 0);
+		if (!p) {
+			ovl_dentry_version_inc(dir);
+			return;
+		}
+		list_add_tail(&p->l_node, &cache->entries);
+		ovl_cache_hash_add(&cache->hash, p);
+	}
+	p->ino = realinode->i_ino;
+	p->type = (realinode->i_mode >> 12) & 15;
+	p->is_whiteout = false;
+}
+
+/* @dentry was removed from @dir: hide its entry but keep offsets */
+void ovl_dir_cache_del(struct dentry *dir, struct dentry *dentry)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache_current(dir);
+	const char *name = dentry->d_name.name;
+	int len = dentry->d_name.len;
+	struct ovl_cache_entry *p;
+
+	if (!cache)
+		return;
+
+	p = ovl_cache_entry_find(&cache->hash, name, len,
+				 full_name_hash(name, len));
+	if (p)
+		p->is_whiteout = true;
+	else
+		ovl_dentry_version_inc(dir);
+}
+
 static int ovl_fill_merge(void *buf, const char *name, int namelen,
 			  loff_t offset, u64 ino, unsigned int d_type)
 {
@@ -194,7 +314,7 @@ static int ovl_fill_merge(void *buf, const char *name, int namelen,
 
 	rdd->count++;
 	if (!rdd->is_merge)
-		return ovl_cache_entry_add_rb(rdd, name, namelen, ino, d_type);
+		return ovl_fill_upper(rdd, name, namelen, ino, d_type);
 	else
 		return ovl_fill_lower(rdd, name, namelen, offset, ino, d_type);
 }
@@ -281,7 +401,8 @@ static int ovl_dir_mark_whiteouts(struct dentry *dir,
 	return 0;
 }
 
-static int ovl_dir_read_merged(struct dentry *dentry, struct list_head *list)
+static int ovl_dir_read_merged(struct dentry *dentry, struct list_head *list,
+			       struct ovl_cache_hash *hash)
 {
 	int err;
 	struct path lowerpath;
@@ -289,7 +410,7 @@ static int ovl_dir_read_merged(struct dentry *dentry, struct list_head *list)
 	struct ovl_readdir_data rdd = {
 		.ctx.actor = ovl_fill_merge,
 		.list = list,
-		.root = RB_ROOT,
+		.hash = hash,
 		.is_merge = false,
 	};
 
@@ -341,23 +462,34 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 	int res;
 	struct ovl_dir_cache *cache;
 
-	cache = ovl_dir_cache(dentry);
-	if (cache && ovl_dentry_version_get(dentry) == cache->version) {
+	cache = ovl_dir_cache_current(dentry);
+	if (cache) {
 		cache->refcount++;
 		return cache;
 	}
-	ovl_set_dir_cache(dentry, NULL);
+
+	cache = ovl_dir_cache(dentry);
+	if (cache) {
+		/* Stale, openers still using it keep it alive */
+		ovl_set_dir_cache(dentry, NULL);
+		ovl_dir_cache_unref(cache);
+	}
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
 		return ERR_PTR(-ENOMEM);
 
-	cache->refcount = 1;
+	/* One reference for the dentry, one for the opener */
+	cache->refcount = 2;
 	INIT_LIST_HEAD(&cache->entries);
 
-	res = ovl_dir_read_merged(dentry, &cache->entries);
+	res = ovl_cache_hash_init(&cache->hash);
+	if (!res)
+		res = ovl_dir_read_merged(dentry, &cache->entries,
+					  &cache->hash);
 	if (res) {
 		ovl_cache_free(&cache->entries);
+		ovl_cache_hash_free(&cache->hash);
 		kfree(cache);
 		return ERR_PTR(res);
 	}
@@ -554,8 +686,14 @@ int ovl_check_empty_dir(struct dentry *dentry, struct list_head *list)
 {
 	int err;
 	struct ovl_cache_entry *p;
+	struct ovl_cache_hash hash;
+
+	err = ovl_cache_hash_init(&hash);
+	if (err)
+		return err;
 
-	err = ovl_dir_read_merged(dentry, list);
+	err = ovl_dir_read_merged(dentry, list, &hash);
+	ovl_cache_hash_free(&hash);
 	if (err)
 		return err;
 
@@ -261,6 +261,8 @@ static void ovl_dentry_release(struct dentry *dentry)
 	struct ovl_entry *oe = dentry->d_fsdata;
 
 	if (oe) {
+		if (oe->cache)
+			ovl_dir_cache_release(oe->cache);
 		dput(oe->__upperdentry);
 		dput(oe->lowerdentry);
 		kfree_rcu(oe, rcu);
@@ -283,6 +285,14 @@ static inline struct dentry *ovl_lookup_real(struct dentry *dir,
 
 	mutex_lock(&dir->d_inode->i_mutex);
 	dentry = lookup_one_len(name->name, dir, name->len);
+	/*
+	 * The combined result, including whiteouts and opaque directories,
+	 * is cached in the overlay dentry, and the layers can only change
+	 * through us.  A negative dentry in the layer would just be a second
+	 * copy of it, so unhash it while we still hold the directory.
+	 */
+	if (!IS_ERR(dentry) && !dentry->d_inode)
+		d_drop(dentry);
 	mutex_unlock(&dir->d_inode->i_mutex);
 
 	if (IS_ERR(dentry)) {
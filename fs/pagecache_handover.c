@@ -0,0 +1,479 @@
+/*
+ *  fs/pagecache_handover.c
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ * Carry clean page cache of container filesystems over a kexec reboot.
+ *
+ * "pagecache_handover=size@offset" reserves a region of RAM very early
+ * at boot, and both the old and the new kernel must be given the same
+ * value.  Once vm.pagecache_handover is set, every block-backed
+ * filesystem being unmounted copies its clean page cache into the
+ * region before its inodes are evicted.  kexec seals the region right
+ * before jumping to the new kernel, which validates it at boot and
+ * puts the pages back into the page cache of a file when its inode is
+ * read in again with the same uuid, number, generation, size and mtime.
+ * Every page carries its own checksum, so whatever got overwritten on
+ * the way is simply not adopted.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/highmem.h>
+#include <linux/memblock.h>
+#include <linux/ioport.h>
+#include <linux/crc32.h>
+#include <linux/hashtable.h>
+#include <linux/slab.h>
+#include <linux/rwsem.h>
+#include <linux/sysctl.h>
+#include <linux/pagecache_handover.h>
+#include "internal.h"
+
+#define PCH_MAGIC	0x50434841534e4f56ULL	/* "VONSAHCP" */
+#define PCH_VERSION	1
+
+struct pch_header {
+	__u64	magic;
+	__u32	version;
+	__u32	crc;		/* of the header and the used entries */
+	__u64	size;		/* of the whole region */
+	__u32	nr_entries;
+	__u32	max_entries;
+};
+
+struct pch_entry {
+	__u8	uuid[16];
+	__u64	ino;
+	__u64	index;
+	__u64	isize;
+	__s64	mtime_sec;
+	__u32	mtime_nsec;
+	__u32	generation;
+	__u32	crc;		/* of the data page */
+	__u32	pad;
+};
+
+/* A run of entries of one inode, waiting for the inode to be read in */
+struct pch_inode {
+	struct hlist_node	hash;
+	struct pch_entry	*entry;	/* the first one, for the identity */
+	unsigned int		first;
+	unsigned int		nr;
+};
+
+int sysctl_pagecache_handover;
+struct static_key pagecache_handover_pending = STATIC_KEY_INIT_FALSE;
+
+static phys_addr_t pch_base;
+static unsigned long pch_size;
+static struct pch_header *pch_hdr;
+static struct pch_entry *pch_entries;
+static void *pch_data;
+
+static struct resource pch_res = {
+	.name	= "Page cache handover",
+	.flags	= IORESOURCE_BUSY | IORESOURCE_MEM,
+};
+
+/*
+ * Write side: saving, arming and dropping the adoption index.
+ * Read side: adoption, which copies out of the region.
+ */
+static DECLARE_RWSEM(pch_sem);
+
+#define PCH_HASH_BITS	10
+static DEFINE_HASHTABLE(pch_hash, PCH_HASH_BITS);
+static DEFINE_SPINLOCK(pch_hash_lock);
+static unsigned int pch_pending;
+
+static inline void *pch_page(unsigned int i)
+{
+	return pch_data + (unsigned long)i * PAGE_SIZE;
+}
+
+static u32 pch_header_crc(void)
+{
+	struct pch_header hdr = *pch_hdr;
+	u32 crc;
+
+	hdr.crc = 0;
+	crc = crc32_le(~0, (void *)&hdr, sizeof(hdr));
+	return crc32_le(crc, (void *)pch_entries,
+			hdr.nr_entries * sizeof(struct pch_entry));
+}
+
+static void pch_reset(void)
+{
+	pch_hdr->magic = 0;
+	pch_hdr->nr_entries = 0;
+}
+
+static int __init pch_setup(char *arg)
+{
+	unsigned long long size, base;
+	char *cur = arg;
+
+	size = memparse(arg, &cur);
+	if (cur == arg || *cur != '@' || !size)
+		return -EINVAL;
+	base = memparse(cur + 1, &cur);
+	if ((base | size) & ~PAGE_MASK)
+		return -EINVAL;
+
+	/*
+	 * Reserve right now: anything allocated from the region before
+	 * it is validated may destroy what the old kernel left in it.
+	 */
+	if (memblock_reserve(base, size))
+		return -ENOMEM;
+
+	pch_base = base;
+	pch_size = size;
+	return 0;
+}
+early_param("pagecache_handover", pch_setup);
+
+static bool __init pch_region_is_ram(void)
+{
+	unsigned long pfn = PFN_DOWN(pch_base);
+	unsigned long last = PFN_DOWN(pch_base + pch_size - 1);
+
+	for (; pfn <= last; pfn++)
+		if (!pfn_valid(pfn) || !PageReserved(pfn_to_page(pfn)))
+			return false;
+	return true;
+}
+
+static void __init pch_build_index(void)
+{
+	unsigned int i, nr_inodes = 0;
+	struct pch_inode *pi = NULL;
+
+	if (pch_hdr->magic != PCH_MAGIC ||
+	    pch_hdr->version != PCH_VERSION ||
+	    pch_hdr->size != pch_size ||
+	    pch_hdr->nr_entries > pch_hdr->max_entries ||
+	    pch_hdr->crc != pch_header_crc())
+		goto reset;
+
+	for (i = 0; i < pch_hdr->nr_entries; i++) {
+		struct pch_entry *e = &pch_entries[i];
+
+		if (pi && !memcmp(pi->entry->uuid, e->uuid, sizeof(e->uuid)) &&
+		    pi->entry->ino == e->ino &&
+		    pi->entry->generation == e->generation) {
+			pi->nr++;
+			continue;
+		}
+
+		pi = kmalloc(sizeof(*pi), GFP_KERNEL);
+		if (!pi)
+			break;
+		pi->entry = e;
+		pi->first = i;
+		pi->nr = 1;
+		hash_add(pch_hash, &pi->hash, e->ino);
+		nr_inodes++;
+	}
+
+	if (!nr_inodes)
+		goto reset;
+
+	pch_pending = nr_inodes;
+	static_key_slow_inc(&pagecache_handover_pending);
+	pr_info("pagecache handover: %u pages of %u files to adopt\n",
+		pch_hdr->nr_entries, nr_inodes);
+	return;
+
+reset:
+	pch_reset();
+}
+
+static int __init pch_init(void)
+{
+	unsigned int max;
+
+	if (!pch_size)
+		return 0;
+
+	if (pch_size < 2 * PAGE_SIZE || !pch_region_is_ram()) {
+		pr_err("pagecache handover: bad region %lx@%llx\n",
+		       pch_size, (unsigned long long)pch_base);
+		pch_size = 0;
+		return 0;
+	}
+
+	pch_res.start = pch_base;
+	pch_res.end = pch_base + pch_size - 1;
+	insert_resource(&iomem_resource, &pch_res);
+
+	/* Header page, then the entries, then one data page per entry */
+	max = (pch_size - PAGE_SIZE) / (PAGE_SIZE + sizeof(struct pch_entry));
+	while (PAGE_SIZE + PAGE_ALIGN(max * sizeof(struct pch_entry)) +
+	       (unsigned long)max * PAGE_SIZE > pch_size)
+		max--;
+
+	pch_hdr = phys_to_virt(pch_base);
+	pch_entries = (void *)pch_hdr + PAGE_SIZE;
+	pch_data = (void *)pch_entries +
+		   PAGE_ALIGN(max * sizeof(struct pch_entry));
+
+	/* What the old kernel had must have been laid out the same way */
+	if (pch_hdr->max_entries == max)
+		pch_build_index();
+	else
+		pch_reset();
+	pch_hdr->max_entries = max;
+	return 0;
+}
+subsys_initcall(pch_init);
+
+static void pch_drop_index(void)
+{
+	struct pch_inode *pi;
+	struct hlist_node *tmp;
+	bool pending;
+	int bkt;
+
+	spin_lock(&pch_hash_lock);
+	hash_for_each_safe(pch_hash, bkt, tmp, pi, hash) {
+		hash_del(&pi->hash);
+		kfree(pi);
+	}
+	pending = pch_pending;
+	pch_pending = 0;
+	spin_unlock(&pch_hash_lock);
+
+	if (pending)
+		static_key_slow_dec(&pagecache_handover_pending);
+}
+
+static bool pch_inode_matches(struct pch_entry *e, struct inode *inode)
+{
+	return e->ino == inode->i_ino &&
+	       e->generation == inode->i_generation &&
+	       e->isize == i_size_read(inode) &&
+	       e->mtime_sec == inode->i_mtime.tv_sec &&
+	       e->mtime_nsec == inode->i_mtime.tv_nsec &&
+	       !memcmp(e->uuid, inode->i_sb->s_uuid, sizeof(e->uuid));
+}
+
+static struct pch_inode *pch_lookup(struct inode *inode)
+{
+	struct pch_inode *pi;
+	bool last = false;
+
+	spin_lock(&pch_hash_lock);
+	hash_for_each_possible(pch_hash, pi, hash, inode->i_ino) {
+		if (pch_inode_matches(pi->entry, inode)) {
+			hash_del(&pi->hash);
+			last = !--pch_pending;
+			goto found;
+		}
+	}
+	pi = NULL;
+found:
+	spin_unlock(&pch_hash_lock);
+
+	/* The key can only go from here, nobody adds to the index */
+	if (last)
+		static_key_slow_dec(&pagecache_handover_pending);
+	return pi;
+}
+
+static void pch_adopt_page(struct address_space *mapping,
+			   struct pch_entry *e, void *src)
+{
+	/* Inodes are also read in under running journal handles */
+	gfp_t gfp = mapping_gfp_mask(mapping) & ~__GFP_FS;
+	struct page *page;
+	void *dst;
+	u32 crc;
+
+	page = __page_cache_alloc(gfp | __GFP_COLD | __GFP_NOWARN);
+	if (!page)
+		return;
+
+	dst = kmap_atomic(page);
+	memcpy(dst, src, PAGE_SIZE);
+	crc = crc32_le(~0, dst, PAGE_SIZE);
+	kunmap_atomic(dst);
+	if (crc != e->crc)
+		goto out;
+
+	if (add_to_page_cache_lru(page, mapping, e->index, gfp))
+		goto out;
+	SetPageUptodate(page);
+	unlock_page(page);
+out:
+	page_cache_release(page);
+}
+
+void __pagecache_handover_adopt(struct inode *inode)
+{
+	struct pch_inode *pi;
+	unsigned int i;
+
+	if (!S_ISREG(inode->i_mode) || !inode->i_sb->s_bdev)
+		return;
+
+	down_read(&pch_sem);
+	pi = pch_lookup(inode);
+	if (!pi)
+		goto out;
+	for (i = pi->first; i < pi->first + pi->nr; i++)
+		pch_adopt_page(inode->i_mapping, &pch_entries[i], pch_page(i));
+	kfree(pi);
+out:
+	up_read(&pch_sem);
+}
+
+/* Returns false once the region is full */
+static bool pch_save_inode(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	pgoff_t end = DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE);
+	struct pagevec pvec;
+	pgoff_t index = 0;
+	int i;
+
+	pagevec_init(&pvec, 0);
+	while (index < end &&
+	       pagevec_lookup(&pvec, mapping, index, PAGEVEC_SIZE)) {
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			struct page *page = pvec.pages[i];
+			unsigned int n = pch_hdr->nr_entries;
+			struct pch_entry *e = &pch_entries[n];
+			void *src;
+
+			index = page->index + 1;
+			if (page->index >= end || !PageUptodate(page) ||
+			    PageDirty(page) || PageWriteback(page))
+				continue;
+
+			if (n == pch_hdr->max_entries) {
+				pagevec_release(&pvec);
+				return false;
+			}
+
+			src = kmap_atomic(page);
+			memcpy(pch_page(n), src, PAGE_SIZE);
+			kunmap_atomic(src);
+
+			memcpy(e->uuid, inode->i_sb->s_uuid, sizeof(e->uuid));
+			e->ino = inode->i_ino;
+			e->index = page->index;
+			e->isize = i_size_read(inode);
+			e->mtime_sec = inode->i_mtime.tv_sec;
+			e->mtime_nsec = inode->i_mtime.tv_nsec;
+			e->generation = inode->i_generation;
+			e->crc = crc32_le(~0, pch_page(n), PAGE_SIZE);
+			e->pad = 0;
+			pch_hdr->nr_entries = n + 1;
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	return true;
+}
+
+static bool pch_uuid_set(struct super_block *sb)
+{
+	int i;
+
+	for (i = 0; i < sizeof(sb->s_uuid); i++)
+		if (sb->s_uuid[i])
+			return true;
+	return false;
+}
+
+/*
+ * Called on umount after sync_filesystem(), so that what is still
+ * cached is clean, and before the inodes are evicted.
+ */
+void pagecache_handover_save(struct super_block *sb)
+{
+	struct inode *inode, *toput_inode = NULL;
+	bool room = true;
+
+	if (!ACCESS_ONCE(sysctl_pagecache_handover) || !pch_size ||
+	    !sb->s_bdev || !pch_uuid_set(sb))
+		return;
+
+	down_write(&pch_sem);
+	if (!sysctl_pagecache_handover)
+		goto out;
+
+	spin_lock(&inode_sb_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		spin_lock(&inode->i_lock);
+		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+		    !S_ISREG(inode->i_mode) ||
+		    (inode->i_mapping->nrpages == 0)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&inode_sb_list_lock);
+		room = pch_save_inode(inode);
+		iput(toput_inode);
+		toput_inode = inode;
+		spin_lock(&inode_sb_list_lock);
+		if (!room)
+			break;
+	}
+	spin_unlock(&inode_sb_list_lock);
+	iput(toput_inode);
+
+	if (!room)
+		pr_info_once("pagecache handover: region is full\n");
+out:
+	up_write(&pch_sem);
+}
+
+/* The last thing before machine_kexec(), other cpus are already down */
+void pagecache_handover_seal(void)
+{
+	if (!pch_size || !sysctl_pagecache_handover)
+		return;
+
+	pch_hdr->magic = PCH_MAGIC;
+	pch_hdr->version = PCH_VERSION;
+	pch_hdr->size = pch_size;
+	pch_hdr->crc = pch_header_crc();
+	pr_emerg("pagecache handover: %u pages saved\n", pch_hdr->nr_entries);
+}
+
+/* kexec segments must not be loaded over the region */
+bool pagecache_handover_overlaps(unsigned long start, unsigned long end)
+{
+	return pch_size && start < pch_base + pch_size && end > pch_base;
+}
+
+/*
+ * Writing 1 drops whatever is left from the previous kernel and arms
+ * saving on umount, writing 0 disarms it.
+ */
+int pagecache_handover_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	if (!write)
+		return proc_dointvec_minmax(table, write, buffer, length, ppos);
+
+	down_write(&pch_sem);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && sysctl_pagecache_handover && pch_size) {
+		pch_drop_index();
+		pch_reset();
+	}
+	up_write(&pch_sem);
+	return ret;
+}
@@ -87,6 +87,7 @@
 #include <linux/slab.h>
 #include <linux/flex_array.h>
 #include <linux/posix-timers.h>
+#include <linux/splice.h>
 #ifdef CONFIG_HARDWALL
 #include <asm/hardwall.h>
 #endif
@@ -832,6 +833,92 @@ static ssize_t mem_read(struct file *file, char __user *buf,
 	return mem_rw(file, buf, count, ppos, 0);
 }
 
+static int mem_pipe_buf_steal(struct pipe_inode_info *pipe,
+			      struct pipe_buffer *buf)
+{
+	/* the page still belongs to the task */
+	return 1;
+}
+
+static const struct pipe_buf_operations mem_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = mem_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+/*
+ * Splicing from /proc/pid/mem links the pages of the task into the pipe
+ * instead of copying them, so that a dumper can stream task memory to a
+ * socket or an image file a pipe worth at a time. The pages are not a
+ * snapshot and may change until the pipe is drained. That is fine for
+ * tasks which are frozen, and for pre-copy iterations that use the
+ * soft-dirty bits in pagemap to find the pages to send again.
+ */
+static ssize_t mem_splice_read(struct file *file, loff_t *ppos,
+			       struct pipe_inode_info *pipe, size_t len,
+			       unsigned int flags)
+{
+	struct mm_struct *mm = file->private_data;
+	unsigned long addr = *ppos;
+	unsigned int offset = addr & ~PAGE_MASK;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.flags = flags,
+		.ops = &mem_pipe_buf_ops,
+		.spd_release = spd_release_page,
+	};
+	long i, nr;
+	ssize_t ret;
+
+	if (!mm || !len)
+		return 0;
+
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		return 0;
+
+	ret = -ENOMEM;
+	if (splice_grow_spd(pipe, &spd))
+		goto out_mmput;
+
+	nr = min_t(unsigned long, spd.nr_pages_max,
+		   DIV_ROUND_UP(offset + len, PAGE_SIZE));
+	down_read(&mm->mmap_sem);
+	nr = get_user_pages(NULL, mm, addr & PAGE_MASK, nr, 0, 1,
+			    spd.pages, NULL);
+	up_read(&mm->mmap_sem);
+	if (nr <= 0) {
+		ret = nr ? nr : -EIO;
+		goto out_shrink;
+	}
+
+	for (i = 0; i < nr; i++) {
+		unsigned int this_len = min_t(size_t, len, PAGE_SIZE - offset);
+
+		spd.partial[i].offset = offset;
+		spd.partial[i].len = this_len;
+		len -= this_len;
+		offset = 0;
+	}
+	spd.nr_pages = nr;
+
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret > 0)
+		*ppos += ret;
+out_shrink:
+	splice_shrink_spd(&spd);
+out_mmput:
+	mmput(mm);
+	return ret;
+}
+
 static ssize_t mem_write(struct file *file, const char __user *buf,
 			 size_t count, loff_t *ppos)
 {
@@ -866,6 +953,7 @@ static const struct file_operations proc_mem_operations = {
 	.llseek		= mem_lseek,
 	.read		= mem_read,
 	.write		= mem_write,
+	.splice_read	= mem_splice_read,
 	.open		= mem_open,
 	.release	= mem_release,
 };
@@ -277,7 +277,7 @@ static const struct file_operations proc_kpagecgroup_operations = {
  *
  * This function tries to get a user memory page by pfn as described above.
  */
-static struct page *kpageidle_get_page(unsigned long pfn)
+struct page *page_idle_get_page(unsigned long pfn)
 {
 	struct page *page;
 	struct zone *zone;
@@ -306,7 +306,7 @@ static struct page *kpageidle_get_page(unsigned long pfn)
  * mappings to a page. Since the latter also clears the page idle flag if the
  * page was referenced, it can be used to update the idle flag of a page.
  */
-static void kpageidle_clear_pte_refs(struct page *page)
+void page_idle_clear_pte_refs(struct page *page)
 {
 	unsigned long dummy;
 
@@ -343,7 +343,7 @@ static ssize_t kpageidle_read(struct file *file, char __user *buf,
 
 	for (; pfn < end_pfn; pfn++) {
 		bit = pfn % KPMBITS;
-		page = kpageidle_get_page(pfn);
+		page = page_idle_get_page(pfn);
 		if (page) {
 			if (page_is_idle(page)) {
 				/*
@@ -351,7 +351,7 @@ static ssize_t kpageidle_read(struct file *file, char __user *buf,
 				 * pte, in which case it is not idle. Clear
 				 * refs and recheck.
 				 */
-				kpageidle_clear_pte_refs(page);
+				page_idle_clear_pte_refs(page);
 				if (page_is_idle(page))
 					idle_bitmap |= 1ULL << bit;
 			}
@@ -404,9 +404,9 @@ static ssize_t kpageidle_write(struct file *file, const char __user *buf,
 			in++;
 		}
 		if (idle_bitmap >> bit & 1) {
-			page = kpageidle_get_page(pfn);
+			page = page_idle_get_page(pfn);
 			if (page) {
-				kpageidle_clear_pte_refs(page);
+				page_idle_clear_pte_refs(page);
 				set_page_idle(page);
 				put_page(page);
 			}
@@ -81,16 +81,20 @@
 #include <linux/uaccess.h>
 
 /*
- * There are three quota SMP locks. dq_list_lock protects all lists with quotas
+ * There are four quota SMP locks. dq_list_lock protects all lists with quotas
  * and quota formats.
- * dq_data_lock protects data from dq_dqb and also mem_dqinfo structures and
- * also guards consistency of dquot->dq_dqb with inode->i_blocks, i_bytes.
- * i_blocks and i_bytes updates itself are guarded by i_lock acquired directly
- * in inode_add_bytes() and inode_sub_bytes(). dq_state_lock protects
- * modifications of quota state (on quotaon and quotaoff) and readers who care
- * about latest values take it as well.
+ * dq_data_lock protects mem_dqinfo structures and serializes setting and
+ * clearing of the inode->i_dquot[] pointers.
+ * dquot->dq_dqb_lock protects data from dq_dqb of that dquot. Keeping it per
+ * dquot means that allocations charged to different users do not contend.
+ * Consistency of dquot->dq_dqb with inode->i_blocks, i_bytes and the reserved
+ * space is guarded by inode->i_lock, which is held across the whole update
+ * of the inode and all its dquots. dq_state_lock protects modifications of
+ * quota state (on quotaon and quotaoff) and readers who care about latest
+ * values take it as well.
  *
- * The spinlock ordering is hence: dq_data_lock > dq_list_lock > i_lock,
+ * The spinlock ordering is hence:
+ *   dq_data_lock > dq_list_lock > i_lock > dq_dqb_lock,
  *   dq_list_lock > dq_state_lock
  *
  * Note that some things (eg. sb pointer, type, id) doesn't change during
@@ -115,7 +119,7 @@
  * it is being allocated) on the first dqget() and when it is being released on
  * the last dqput(). The allocation and release oparations are serialized by
  * the dq_lock and by checking the use count in dquot_release().  Write
- * operations on dquots don't hold dq_lock as they copy data under dq_data_lock
+ * operations on dquots don't hold dq_lock as they copy data under dq_dqb_lock
  * spinlock to internal buffers before writing.
  *
  * Lock ordering (including related VFS locks) is the following:
@@ -800,6 +804,7 @@ static struct dquot *get_empty_dquot(struct super_block *sb, int type)
 		return NULL;
 
 	mutex_init(&dquot->dq_lock);
+	spin_lock_init(&dquot->dq_dqb_lock);
 	INIT_LIST_HEAD(&dquot->dq_free);
 	INIT_LIST_HEAD(&dquot->dq_inuse);
 	INIT_HLIST_NODE(&dquot->dq_hash);
@@ -1237,7 +1242,7 @@ static int ignore_hardlimit(struct dquot *dquot)
 		!(info->dqi_flags & V1_DQF_RSQUASH));
 }
 
-/* needs dq_data_lock */
+/* needs dq_dqb_lock */
 static int check_idq(struct dquot *dquot, qsize_t inodes,
 		     struct dquot_warn *warn)
 {
@@ -1274,7 +1279,7 @@ static int check_idq(struct dquot *dquot, qsize_t inodes,
 	return 0;
 }
 
-/* needs dq_data_lock */
+/* needs dq_dqb_lock */
 static int check_bdq(struct dquot *dquot, qsize_t space, int prealloc,
 		     struct dquot_warn *warn)
 {
@@ -1325,6 +1330,47 @@ static int check_bdq(struct dquot *dquot, qsize_t space, int prealloc,
 	return 0;
 }
 
+/* Check limits and charge a single dquot, needs dq_dqb_lock not held */
+static int dquot_add_inodes(struct dquot *dquot, qsize_t inodes,
+			    struct dquot_warn *warn)
+{
+	int ret;
+
+	spin_lock(&dquot->dq_dqb_lock);
+	ret = check_idq(dquot, inodes, warn);
+	if (!ret)
+		dquot_incr_inodes(dquot, inodes);
+	spin_unlock(&dquot->dq_dqb_lock);
+	return ret;
+}
+
+static int dquot_add_space(struct dquot *dquot, qsize_t space,
+			   qsize_t rsv_space, int flags,
+			   struct dquot_warn *warn)
+{
+	int ret;
+
+	spin_lock(&dquot->dq_dqb_lock);
+	ret = check_bdq(dquot, space + rsv_space,
+			!(flags & DQUOT_SPACE_WARN), warn);
+	if (!ret || (flags & DQUOT_SPACE_NOFAIL)) {
+		dquot_incr_space(dquot, space);
+		dquot_resv_space(dquot, rsv_space);
+	}
+	spin_unlock(&dquot->dq_dqb_lock);
+	return ret;
+}
+
+/* Back out a charge done by dquot_add_space() */
+static void dquot_sub_space(struct dquot *dquot, qsize_t space,
+			    qsize_t rsv_space)
+{
+	spin_lock(&dquot->dq_dqb_lock);
+	dquot->dq_dqb.dqb_curspace -= space;
+	dquot->dq_dqb.dqb_rsvspace -= rsv_space;
+	spin_unlock(&dquot->dq_dqb_lock);
+}
+
 static int info_idq_free(struct dquot *dquot, qsize_t inodes)
 {
 	qsize_t newinodes;
@@ -1357,6 +1403,47 @@ static int info_bdq_free(struct dquot *dquot, qsize_t space)
 	return QUOTA_NL_NOWARN;
 }
 
+/*
+ * Lockless variants of the inode space helpers below, for use by quota code
+ * that holds inode->i_lock across the inode and dquot updates.
+ */
+static qsize_t __inode_get_rsv_space(struct inode *inode)
+{
+	if (!inode->i_sb->dq_op->get_reserved_space)
+		return 0;
+	return *inode_reserved_space(inode);
+}
+
+static void __inode_incr_space(struct inode *inode, qsize_t number,
+			       int reserve)
+{
+	if (reserve)
+		*inode_reserved_space(inode) += number;
+	else
+		__inode_add_bytes(inode, number);
+}
+
+static void __inode_decr_space(struct inode *inode, qsize_t number,
+			       int reserve)
+{
+	if (reserve)
+		*inode_reserved_space(inode) -= number;
+	else
+		__inode_sub_bytes(inode, number);
+}
+
+static void __inode_claim_rsv_space(struct inode *inode, qsize_t number)
+{
+	*inode_reserved_space(inode) -= number;
+	__inode_add_bytes(inode, number);
+}
+
+static void __inode_reclaim_rsv_space(struct inode *inode, qsize_t number)
+{
+	*inode_reserved_space(inode) += number;
+	__inode_sub_bytes(inode, number);
+}
+
 static int dquot_active(const struct inode *inode)
 {
 	struct super_block *sb = inode->i_sb;
@@ -1415,6 +1502,7 @@ static void __dquot_initialize(struct inode *inode, int type)
 	spin_lock(&dq_data_lock);
 	if (IS_NOQUOTA(inode))
 		goto out_err;
+	spin_lock(&inode->i_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (type != -1 && cnt != type)
 			continue;
@@ -1431,11 +1519,17 @@ static void __dquot_initialize(struct inode *inode, int type)
 			 * Make quota reservation system happy if someone
 			 * did a write before quota was turned on
 			 */
-			rsv = inode_get_rsv_space(inode);
-			if (unlikely(rsv))
-				dquot_resv_space(inode->i_dquot[cnt], rsv);
+			rsv = __inode_get_rsv_space(inode);
+			if (unlikely(rsv)) {
+				struct dquot *dquot = inode->i_dquot[cnt];
+
+				spin_lock(&dquot->dq_dqb_lock);
+				dquot_resv_space(dquot, rsv);
+				spin_unlock(&dquot->dq_dqb_lock);
+			}
 		}
 	}
+	spin_unlock(&inode->i_lock);
 out_err:
 	spin_unlock(&dq_data_lock);
 	/* Drop unused references */
@@ -1510,7 +1604,7 @@ EXPORT_SYMBOL(inode_reserved_space);
 void inode_add_rsv_space(struct inode *inode, qsize_t number)
 {
 	spin_lock(&inode->i_lock);
-	*inode_reserved_space(inode) += number;
+	__inode_incr_space(inode, number, 1);
 	spin_unlock(&inode->i_lock);
 }
 EXPORT_SYMBOL(inode_add_rsv_space);
@@ -1518,8 +1612,7 @@ EXPORT_SYMBOL(inode_add_rsv_space);
 void inode_claim_rsv_space(struct inode *inode, qsize_t number)
 {
 	spin_lock(&inode->i_lock);
-	*inode_reserved_space(inode) -= number;
-	__inode_add_bytes(inode, number);
+	__inode_claim_rsv_space(inode, number);
 	spin_unlock(&inode->i_lock);
 }
 EXPORT_SYMBOL(inode_claim_rsv_space);
@@ -1527,8 +1620,7 @@ EXPORT_SYMBOL(inode_claim_rsv_space);
 void inode_reclaim_rsv_space(struct inode *inode, qsize_t number)
 {
 	spin_lock(&inode->i_lock);
-	*inode_reserved_space(inode) += number;
-	__inode_sub_bytes(inode, number);
+	__inode_reclaim_rsv_space(inode, number);
 	spin_unlock(&inode->i_lock);
 }
 EXPORT_SYMBOL(inode_reclaim_rsv_space);
@@ -1536,7 +1628,7 @@ EXPORT_SYMBOL(inode_reclaim_rsv_space);
 void inode_sub_rsv_space(struct inode *inode, qsize_t number)
 {
 	spin_lock(&inode->i_lock);
-	*inode_reserved_space(inode) -= number;
+	__inode_decr_space(inode, number, 1);
 	spin_unlock(&inode->i_lock);
 }
 EXPORT_SYMBOL(inode_sub_rsv_space);
@@ -1545,10 +1637,8 @@ qsize_t inode_get_rsv_space(struct inode *inode)
 {
 	qsize_t ret;
 
-	if (!inode->i_sb->dq_op->get_reserved_space)
-		return 0;
 	spin_lock(&inode->i_lock);
-	ret = *inode_reserved_space(inode);
+	ret = __inode_get_rsv_space(inode);
 	spin_unlock(&inode->i_lock);
 	return ret;
 }
@@ -1602,27 +1692,27 @@ int __dquot_alloc_space(struct inode *inode, qsize_t number, int flags)
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!dquots[cnt])
 			continue;
-		ret = check_bdq(dquots[cnt], number,
-				!(flags & DQUOT_SPACE_WARN), &warn[cnt]);
+		ret = dquot_add_space(dquots[cnt], reserve ? 0 : number,
+				      reserve ? number : 0, flags, &warn[cnt]);
 		if (ret && !(flags & DQUOT_SPACE_NOFAIL)) {
-			spin_unlock(&dq_data_lock);
+			/* Back out the charges we already did */
+			while (--cnt >= 0) {
+				if (!dquots[cnt])
+					continue;
+				dquot_sub_space(dquots[cnt],
+						reserve ? 0 : number,
+						reserve ? number : 0);
+			}
+			spin_unlock(&inode->i_lock);
 			goto out_flush_warn;
 		}
 	}
-	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
-		if (!dquots[cnt])
-			continue;
-		if (reserve)
-			dquot_resv_space(dquots[cnt], number);
-		else
-			dquot_incr_space(dquots[cnt], number);
-	}
-	inode_incr_space(inode, number, reserve);
-	spin_unlock(&dq_data_lock);
+	__inode_incr_space(inode, number, reserve);
+	spin_unlock(&inode->i_lock);
 
 	if (reserve)
 		goto out_flush_warn;
@@ -1650,23 +1740,22 @@ int dquot_alloc_inode(const struct inode *inode)
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!dquots[cnt])
 			continue;
-		ret = check_idq(dquots[cnt], 1, &warn[cnt]);
-		if (ret)
-			goto warn_put_all;
-	}
-
-	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
-		if (!dquots[cnt])
-			continue;
-		dquot_incr_inodes(dquots[cnt], 1);
+		ret = dquot_add_inodes(dquots[cnt], 1, &warn[cnt]);
+		if (ret) {
+			while (--cnt >= 0) {
+				if (!dquots[cnt])
+					continue;
+				spin_lock(&dquots[cnt]->dq_dqb_lock);
+				dquots[cnt]->dq_dqb.dqb_curinodes--;
+				spin_unlock(&dquots[cnt]->dq_dqb_lock);
+			}
+			break;
+		}
 	}
 
-warn_put_all:
-	spin_unlock(&dq_data_lock);
 	if (ret == 0)
 		mark_all_dquot_dirty(dquots);
 	srcu_read_unlock(&dquot_srcu, index);
@@ -1688,16 +1777,20 @@ int dquot_claim_space_nodirty(struct inode *inode, qsize_t number)
 	}
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
 	/* Claim reserved quotas to allocated quotas */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
-		if (inode->i_dquot[cnt])
-			dquot_claim_reserved_space(inode->i_dquot[cnt],
-							number);
+		struct dquot *dquot = inode->i_dquot[cnt];
+
+		if (!dquot)
+			continue;
+		spin_lock(&dquot->dq_dqb_lock);
+		dquot_claim_reserved_space(dquot, number);
+		spin_unlock(&dquot->dq_dqb_lock);
 	}
 	/* Update inode bytes */
-	inode_claim_rsv_space(inode, number);
-	spin_unlock(&dq_data_lock);
+	__inode_claim_rsv_space(inode, number);
+	spin_unlock(&inode->i_lock);
 	mark_all_dquot_dirty(inode->i_dquot);
 	srcu_read_unlock(&dquot_srcu, index);
 	return 0;
@@ -1717,16 +1810,20 @@ void dquot_reclaim_space_nodirty(struct inode *inode, qsize_t number)
 	}
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
 	/* Claim reserved quotas to allocated quotas */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
-		if (inode->i_dquot[cnt])
-			dquot_reclaim_reserved_space(inode->i_dquot[cnt],
-						     number);
+		struct dquot *dquot = inode->i_dquot[cnt];
+
+		if (!dquot)
+			continue;
+		spin_lock(&dquot->dq_dqb_lock);
+		dquot_reclaim_reserved_space(dquot, number);
+		spin_unlock(&dquot->dq_dqb_lock);
 	}
 	/* Update inode bytes */
-	inode_reclaim_rsv_space(inode, number);
-	spin_unlock(&dq_data_lock);
+	__inode_reclaim_rsv_space(inode, number);
+	spin_unlock(&inode->i_lock);
 	mark_all_dquot_dirty(inode->i_dquot);
 	srcu_read_unlock(&dquot_srcu, index);
 	return;
@@ -1749,13 +1846,14 @@ void __dquot_free_space(struct inode *inode, qsize_t number, int flags)
 	}
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		int wtype;
 
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 		if (!dquots[cnt])
 			continue;
+		spin_lock(&dquots[cnt]->dq_dqb_lock);
 		wtype = info_bdq_free(dquots[cnt], number);
 		if (wtype != QUOTA_NL_NOWARN)
 			prepare_warning(&warn[cnt], dquots[cnt], wtype);
@@ -1763,9 +1861,10 @@ void __dquot_free_space(struct inode *inode, qsize_t number, int flags)
 			dquot_free_reserved_space(dquots[cnt], number);
 		else
 			dquot_decr_space(dquots[cnt], number);
+		spin_unlock(&dquots[cnt]->dq_dqb_lock);
 	}
-	inode_decr_space(inode, number, reserve);
-	spin_unlock(&dq_data_lock);
+	__inode_decr_space(inode, number, reserve);
+	spin_unlock(&inode->i_lock);
 
 	if (reserve)
 		goto out_unlock;
@@ -1790,19 +1889,19 @@ void dquot_free_inode(const struct inode *inode)
 		return;
 
 	index = srcu_read_lock(&dquot_srcu);
-	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		int wtype;
 
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 		if (!dquots[cnt])
 			continue;
+		spin_lock(&dquots[cnt]->dq_dqb_lock);
 		wtype = info_idq_free(dquots[cnt], 1);
 		if (wtype != QUOTA_NL_NOWARN)
 			prepare_warning(&warn[cnt], dquots[cnt], wtype);
 		dquot_decr_inodes(dquots[cnt], 1);
+		spin_unlock(&dquots[cnt]->dq_dqb_lock);
 	}
-	spin_unlock(&dq_data_lock);
 	mark_all_dquot_dirty(dquots);
 	srcu_read_unlock(&dquot_srcu, index);
 	flush_warnings(warn);
@@ -1846,10 +1945,11 @@ int __dquot_transfer(struct inode *inode, struct dquot **transfer_to)
 		spin_unlock(&dq_data_lock);
 		return 0;
 	}
-	cur_space = inode_get_bytes(inode);
-	rsv_space = inode_get_rsv_space(inode);
+	spin_lock(&inode->i_lock);
+	cur_space = __inode_get_bytes(inode);
+	rsv_space = __inode_get_rsv_space(inode);
 	space = cur_space + rsv_space;
-	/* Build the transfer_from list and check the limits */
+	/* Build the transfer_from list, check the limits and charge */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		/*
 		 * Skip changes for same uid or gid or for turned off quota-type.
@@ -1861,43 +1961,48 @@ int __dquot_transfer(struct inode *inode, struct dquot **transfer_to)
 			continue;
 		is_valid[cnt] = 1;
 		transfer_from[cnt] = inode->i_dquot[cnt];
-		ret = check_idq(transfer_to[cnt], 1, &warn_to[cnt]);
+		ret = dquot_add_inodes(transfer_to[cnt], 1, &warn_to[cnt]);
 		if (ret)
 			goto over_quota;
-		ret = check_bdq(transfer_to[cnt], space, 0, &warn_to[cnt]);
-		if (ret)
+		ret = dquot_add_space(transfer_to[cnt], cur_space, rsv_space,
+				      DQUOT_SPACE_WARN, &warn_to[cnt]);
+		if (ret) {
+			spin_lock(&transfer_to[cnt]->dq_dqb_lock);
+			transfer_to[cnt]->dq_dqb.dqb_curinodes--;
+			spin_unlock(&transfer_to[cnt]->dq_dqb_lock);
 			goto over_quota;
+		}
 	}
 
 	/*
 	 * Finally perform the needed transfer from transfer_from to transfer_to
 	 */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		struct dquot *from = transfer_from[cnt];
+
 		if (!is_valid[cnt])
 			continue;
 		/* Due to IO error we might not have transfer_from[] structure */
-		if (transfer_from[cnt]) {
+		if (from) {
 			int wtype;
-			wtype = info_idq_free(transfer_from[cnt], 1);
+
+			spin_lock(&from->dq_dqb_lock);
+			wtype = info_idq_free(from, 1);
 			if (wtype != QUOTA_NL_NOWARN)
 				prepare_warning(&warn_from_inodes[cnt],
-						transfer_from[cnt], wtype);
-			wtype = info_bdq_free(transfer_from[cnt], space);
+						from, wtype);
+			wtype = info_bdq_free(from, space);
 			if (wtype != QUOTA_NL_NOWARN)
 				prepare_warning(&warn_from_space[cnt],
-						transfer_from[cnt], wtype);
-			dquot_decr_inodes(transfer_from[cnt], 1);
-			dquot_decr_space(transfer_from[cnt], cur_space);
-			dquot_free_reserved_space(transfer_from[cnt],
-						  rsv_space);
+						from, wtype);
+			dquot_decr_inodes(from, 1);
+			dquot_decr_space(from, cur_space);
+			dquot_free_reserved_space(from, rsv_space);
+			spin_unlock(&from->dq_dqb_lock);
 		}
-
-		dquot_incr_inodes(transfer_to[cnt], 1);
-		dquot_incr_space(transfer_to[cnt], cur_space);
-		dquot_resv_space(transfer_to[cnt], rsv_space);
-
 		inode->i_dquot[cnt] = transfer_to[cnt];
 	}
+	spin_unlock(&inode->i_lock);
 	spin_unlock(&dq_data_lock);
 
 	mark_all_dquot_dirty(transfer_from);
@@ -1911,6 +2016,17 @@ int __dquot_transfer(struct inode *inode, struct dquot **transfer_to)
 			transfer_to[cnt] = transfer_from[cnt];
 	return 0;
 over_quota:
+	/* Back out the charges we already did */
+	while (--cnt >= 0) {
+		if (!is_valid[cnt])
+			continue;
+		spin_lock(&transfer_to[cnt]->dq_dqb_lock);
+		transfer_to[cnt]->dq_dqb.dqb_curinodes--;
+		transfer_to[cnt]->dq_dqb.dqb_curspace -= cur_space;
+		transfer_to[cnt]->dq_dqb.dqb_rsvspace -= rsv_space;
+		spin_unlock(&transfer_to[cnt]->dq_dqb_lock);
+	}
+	spin_unlock(&inode->i_lock);
 	spin_unlock(&dq_data_lock);
 	flush_warnings(warn_to);
 	return ret;
@@ -2396,7 +2512,7 @@ static void do_get_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 			FS_USER_QUOTA : FS_GROUP_QUOTA;
 	di->d_id = from_kqid_munged(current_user_ns(), dquot->dq_id);
 
-	spin_lock(&dq_data_lock);
+	spin_lock(&dquot->dq_dqb_lock);
 	di->d_blk_hardlimit = stoqb(dm->dqb_bhardlimit);
 	di->d_blk_softlimit = stoqb(dm->dqb_bsoftlimit);
 	di->d_ino_hardlimit = dm->dqb_ihardlimit;
@@ -2405,7 +2521,7 @@ static void do_get_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 	di->d_icount = dm->dqb_curinodes;
 	di->d_btimer = dm->dqb_btime;
 	di->d_itimer = dm->dqb_itime;
-	spin_unlock(&dq_data_lock);
+	spin_unlock(&dquot->dq_dqb_lock);
 }
 
 int dquot_get_dqblk(struct super_block *sb, struct kqid qid,
@@ -2448,7 +2564,7 @@ static int do_set_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 	     (di->d_ino_hardlimit > dqi->dqi_maxilimit)))
 		return -ERANGE;
 
-	spin_lock(&dq_data_lock);
+	spin_lock(&dquot->dq_dqb_lock);
 	if (di->d_fieldmask & FS_DQ_BCOUNT) {
 		dm->dqb_curspace = di->d_bcount - dm->dqb_rsvspace;
 		check_blim = 1;
@@ -2514,7 +2630,7 @@ static int do_set_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 		clear_bit(DQ_FAKE_B, &dquot->dq_flags);
 	else
 		set_bit(DQ_FAKE_B, &dquot->dq_flags);
-	spin_unlock(&dq_data_lock);
+	spin_unlock(&dquot->dq_dqb_lock);
 	mark_dquot_dirty(dquot);
 
 	return 0;
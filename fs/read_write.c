@@ -8,6 +8,7 @@
 #include <linux/stat.h>
 #include <linux/fcntl.h>
 #include <linux/file.h>
+#include <linux/mount.h>
 #include <linux/uio.h>
 #include <linux/aio.h>
 #include <linux/fsnotify.h>
@@ -1178,6 +1179,58 @@ out:
 	return retval;
 }
 
+/**
+ * vfs_clone_file_range - share a range of blocks of one file with another
+ * @file_in:	source file
+ * @pos_in:	offset in source
+ * @file_out:	destination file
+ * @pos_out:	offset in destination
+ * @len:	number of bytes to share
+ *
+ * Makes the range of @file_out refer to the same data blocks as the range
+ * of @file_in, without copying. Both files must live on the same
+ * superblock, possibly seen through different mounts (as with the private
+ * layer mounts of overlayfs), and the filesystem must implement
+ * ->clone_file_range().
+ * Returns -EOPNOTSUPP when it does not, so callers can fall back to copy.
+ */
+int vfs_clone_file_range(struct file *file_in, loff_t pos_in,
+			 struct file *file_out, loff_t pos_out, u64 len)
+{
+	struct inode *inode_in = file_inode(file_in);
+	struct inode *inode_out = file_inode(file_out);
+	int ret;
+
+	if (inode_in->i_sb != inode_out->i_sb)
+		return -EXDEV;
+
+	if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+		return -EINVAL;
+
+	if (!(file_in->f_mode & FMODE_READ) ||
+	    !(file_out->f_mode & FMODE_WRITE) ||
+	    (file_out->f_flags & O_APPEND))
+		return -EBADF;
+
+	if (!file_out->f_op || !file_out->f_op->clone_file_range)
+		return -EOPNOTSUPP;
+
+	ret = mnt_want_write_file(file_out);
+	if (ret)
+		return ret;
+
+	ret = file_out->f_op->clone_file_range(file_in, pos_in,
+					       file_out, pos_out, len);
+	if (!ret) {
+		fsnotify_access(file_in);
+		fsnotify_modify(file_out);
+	}
+
+	mnt_drop_write_file(file_out);
+	return ret;
+}
+EXPORT_SYMBOL(vfs_clone_file_range);
+
 SYSCALL_DEFINE4(sendfile, int, out_fd, int, in_fd, off_t __user *, offset, size_t, count)
 {
 	loff_t pos;
@@ -28,6 +28,7 @@
 #include <linux/hrtimer.h>
 #include <linux/sched/rt.h>
 #include <linux/freezer.h>
+#include <linux/eventpoll.h>
 #include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
@@ -396,10 +397,23 @@ static inline void wait_key_set(poll_table *wait, unsigned long in,
 		wait->_key |= POLLOUT_SET;
 }
 
+/*
+ * Poll one file for select(2)/poll(2), through the readiness cache if the
+ * caller got one from poll_cache_begin().
+ */
+static inline unsigned int file_poll(struct eventpoll *pc, struct file *file,
+				     int fd, poll_table *wait)
+{
+	if (pc)
+		return poll_cache_poll(pc, file, fd, wait);
+	return file->f_op->poll(file, wait);
+}
+
 int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 {
 	ktime_t expire, *to = NULL;
 	struct poll_wqueues table;
+	struct eventpoll *pc;
 	poll_table *wait;
 	int retval, i, timed_out = 0;
 	unsigned long slack = 0;
@@ -432,6 +446,8 @@ int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 		inp = fds->in; outp = fds->out; exp = fds->ex;
 		rinp = fds->res_in; routp = fds->res_out; rexp = fds->res_ex;
 
+		pc = poll_cache_begin(n, wait);
+
 		for (i = 0; i < n; ++rinp, ++routp, ++rexp) {
 			unsigned long in, out, ex, all_bits, bit = 1, mask, j;
 			unsigned long res_in = 0, res_out = 0, res_ex = 0;
@@ -457,7 +473,8 @@ int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 					if (f_op && f_op->poll) {
 						wait_key_set(wait, in, out,
 							     bit, busy_flag);
-						mask = (*f_op->poll)(f.file, wait);
+						mask = file_poll(pc, f.file, i,
+								 wait);
 					}
 					fdput(f);
 					if ((mask & POLLIN_SET) && (in & bit)) {
@@ -497,6 +514,8 @@ int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 				*rexp = res_ex;
 			cond_resched();
 		}
+		if (pc)
+			poll_cache_end(pc);
 		wait->_qproc = NULL;
 		if (retval || timed_out || signal_pending(current))
 			break;
@@ -748,7 +767,7 @@ struct poll_list {
  * if pwait->_qproc is non-NULL.
  */
 static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait,
-				     bool *can_busy_poll,
+				     struct eventpoll *pc, bool *can_busy_poll,
 				     unsigned int busy_flag)
 {
 	unsigned int mask;
@@ -764,7 +783,7 @@ static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait,
 			if (f.file->f_op && f.file->f_op->poll) {
 				pwait->_key = pollfd->events|POLLERR|POLLHUP;
 				pwait->_key |= busy_flag;
-				mask = f.file->f_op->poll(f.file, pwait);
+				mask = file_poll(pc, f.file, fd, pwait);
 				if (mask & busy_flag)
 					*can_busy_poll = true;
 			}
@@ -782,6 +801,7 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 		   struct poll_wqueues *wait, struct timespec *end_time)
 {
 	poll_table* pt = &wait->pt;
+	struct eventpoll *pc;
 	ktime_t expire, *to = NULL;
 	int timed_out = 0, count = 0;
 	unsigned long slack = 0;
@@ -801,6 +821,7 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 		struct poll_list *walk;
 		bool can_busy_loop = false;
 
+		pc = poll_cache_begin(nfds, pt);
 		for (walk = list; walk != NULL; walk = walk->next) {
 			struct pollfd * pfd, * pfd_end;
 
@@ -814,7 +835,7 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 				 * this. They'll get immediately deregistered
 				 * when we break out and return.
 				 */
-				if (do_pollfd(pfd, pt, &can_busy_loop,
+				if (do_pollfd(pfd, pt, pc, &can_busy_loop,
 					      busy_flag)) {
 					count++;
 					pt->_qproc = NULL;
@@ -824,6 +845,8 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 				}
 			}
 		}
+		if (pc)
+			poll_cache_end(pc);
 		/*
 		 * All waiters have already been registered, so don't provide
 		 * a poll_table->_qproc to them on the next loop iteration.
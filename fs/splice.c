@@ -32,6 +32,7 @@
 #include <linux/gfp.h>
 #include <linux/socket.h>
 #include <linux/compat.h>
+#include <linux/poll.h>
 #include "internal.h"
 #include <linux/virtinfo.h>
 
@@ -1177,6 +1178,47 @@ static long do_splice_to(struct file *in, loff_t *ppos,
  *    that process.
  *
  */
+/*
+ * The internal pipe used when neither end of a splice is a pipe.  It is
+ * always left empty between calls.
+ */
+static struct pipe_inode_info *splice_private_pipe(void)
+{
+	struct pipe_inode_info *pipe = current->splice_pipe;
+
+	if (unlikely(!pipe)) {
+		pipe = alloc_pipe_info();
+		if (!pipe)
+			return NULL;
+
+		/*
+		 * We don't have an immediate reader, but we'll read the stuff
+		 * out of the pipe right after the splice_to_pipe(). So set
+		 * PIPE_READERS appropriately.
+		 */
+		pipe->readers = 1;
+
+		current->splice_pipe = pipe;
+	}
+
+	return pipe;
+}
+
+static void splice_release_private_pipe(struct pipe_inode_info *pipe)
+{
+	int i;
+
+	for (i = 0; i < pipe->buffers; i++) {
+		struct pipe_buffer *buf = pipe->bufs + i;
+
+		if (buf->ops) {
+			buf->ops->release(pipe, buf);
+			buf->ops = NULL;
+		}
+	}
+	pipe->nrbufs = pipe->curbuf = 0;
+}
+
 ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 			       splice_direct_actor *actor)
 {
@@ -1184,12 +1226,12 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 	long ret, bytes;
 	umode_t i_mode;
 	size_t len;
-	int i, flags;
+	int flags;
 
 	/*
 	 * We require the input being a regular file, as we don't want to
 	 * randomly drop data for eg socket -> socket splicing. Use the
-	 * piped splicing for that!
+	 * piped splicing or splice_sock_to_sock() for that!
 	 */
 	i_mode = file_inode(in)->i_mode;
 	if (unlikely(!S_ISREG(i_mode) && !S_ISBLK(i_mode)))
@@ -1199,21 +1241,9 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 	 * neither in nor out is a pipe, setup an internal pipe attached to
 	 * 'out' and transfer the wanted data from 'in' to 'out' through that
 	 */
-	pipe = current->splice_pipe;
-	if (unlikely(!pipe)) {
-		pipe = alloc_pipe_info();
-		if (!pipe)
-			return -ENOMEM;
-
-		/*
-		 * We don't have an immediate reader, but we'll read the stuff
-		 * out of the pipe right after the splice_to_pipe(). So set
-		 * PIPE_READERS appropriately.
-		 */
-		pipe->readers = 1;
-
-		current->splice_pipe = pipe;
-	}
+	pipe = splice_private_pipe();
+	if (!pipe)
+		return -ENOMEM;
 
 	/*
 	 * Do the splice.
@@ -1270,14 +1300,7 @@ out_release:
 	 * If we did an incomplete transfer we must release
 	 * the pipe buffers in question:
 	 */
-	for (i = 0; i < pipe->buffers; i++) {
-		struct pipe_buffer *buf = pipe->bufs + i;
-
-		if (buf->ops) {
-			buf->ops->release(pipe, buf);
-			buf->ops = NULL;
-		}
-	}
+	splice_release_private_pipe(pipe);
 
 	if (!bytes)
 		bytes = ret;
@@ -1332,6 +1355,88 @@ long do_splice_direct(struct file *in, loff_t *ppos, struct file *out,
 }
 EXPORT_SYMBOL(do_splice_direct);
 
+/*
+ * Wait until @out can take more data.  Only a fatal signal stops us, as
+ * the data already taken from the input socket has nowhere else to go.
+ */
+static int splice_wait_writable(struct file *out)
+{
+	struct poll_wqueues table;
+	int err = 0;
+
+	poll_initwait(&table);
+	for (;;) {
+		unsigned int mask = out->f_op->poll(out, &table.pt);
+
+		if (mask & (POLLOUT | POLLERR | POLLHUP))
+			break;
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		/* We are on the wait queues now, don't queue again */
+		table.pt._qproc = NULL;
+		poll_schedule(&table, TASK_KILLABLE);
+	}
+	poll_freewait(&table);
+
+	return err;
+}
+
+/*
+ * Socket to socket splice through the internal pipe, which is grown to
+ * take up to pipe_max_size per call.  Generic direct splicing refuses
+ * this because a short write would drop data; here the output is
+ * drained completely, waiting for it if needed (a non-blocking input
+ * still only takes what is queued), so data is only lost if the output
+ * fails for good or the task is killed.
+ */
+static long splice_sock_to_sock(struct file *in, struct file *out,
+				size_t len, unsigned int flags)
+{
+	struct pipe_inode_info *pipe;
+	unsigned long nr_pages;
+	loff_t pos = 0;
+	long ret, read, sent = 0;
+
+	if (!out->f_op || !out->f_op->poll)
+		return -EINVAL;
+
+	pipe = splice_private_pipe();
+	if (!pipe)
+		return -ENOMEM;
+
+	nr_pages = min_t(size_t, len, pipe_max_size) >> PAGE_SHIFT;
+	if (nr_pages > pipe->buffers)
+		pipe_set_size(pipe, roundup_pow_of_two(nr_pages));
+
+	ret = do_splice_to(in, &pos, pipe, len, flags);
+	if (ret <= 0)
+		return ret;
+	read = ret;
+
+	flags &= ~SPLICE_F_NONBLOCK;
+	while (pipe->nrbufs) {
+		pos = 0;
+		ret = do_splice_from(pipe, out, &pos, read - sent, flags);
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
+		if (ret != -EAGAIN && ret != -EINTR && ret != -ERESTARTSYS)
+			break;
+		ret = splice_wait_writable(out);
+		if (ret)
+			break;
+	}
+
+	if (pipe->nrbufs)
+		splice_release_private_pipe(pipe);
+	pipe->nrbufs = pipe->curbuf = 0;
+
+	return sent ? sent : ret;
+}
+
 static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 			       struct pipe_inode_info *opipe,
 			       size_t len, unsigned int flags);
@@ -1412,6 +1517,13 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 		return ret;
 	}
 
+	if (S_ISSOCK(file_inode(in)->i_mode) &&
+	    S_ISSOCK(file_inode(out)->i_mode)) {
+		if (off_in || off_out)
+			return -ESPIPE;
+		return splice_sock_to_sock(in, out, len, flags);
+	}
+
 	return -EINVAL;
 }
 
@@ -16,6 +16,8 @@
 #include <linux/quotaops.h>
 #include <linux/backing-dev.h>
 #include <linux/ve.h>
+#include <linux/nsproxy.h>
+#include <linux/mount.h>
 #include "internal.h"
 
 #include <bc/beancounter.h>
@@ -99,97 +101,119 @@ static void fdatawait_one_bdev(struct block_device *bdev, void *arg)
 	filemap_fdatawait(bdev->bd_inode->i_mapping);
 }
 
-#if 0
-
-struct sync_sb {
+struct sync_mnt {
 	struct list_head list;
-	struct super_block *sb;
+	struct vfsmount *mnt;
 };
 
-static void sync_release_filesystems(struct list_head *sync_list)
+/* Collect one mount per superblock, pinned so that the sb stays alive */
+static int sync_collect_mnt(struct vfsmount *mnt, void *arg)
+{
+	struct list_head *sync_list = arg;
+	struct sync_mnt *sm;
+
+	list_for_each_entry(sm, sync_list, list)
+		if (sm->mnt->mnt_sb == mnt->mnt_sb)
+			return 0;
+
+	sm = kmalloc(sizeof(*sm), GFP_KERNEL);
+	if (sm == NULL)
+		return -ENOMEM;
+	sm->mnt = mntget(mnt);
+	list_add_tail(&sm->list, sync_list);
+	return 0;
+}
+
+static void sync_release_mnts(struct list_head *sync_list)
 {
-	struct sync_sb *ss, *tmp;
+	struct sync_mnt *sm, *tmp;
 
-	list_for_each_entry_safe(ss, tmp, sync_list, list) {
-		list_del(&ss->list);
-		put_super(ss->sb);
-		kfree(ss);
+	list_for_each_entry_safe(sm, tmp, sync_list, list) {
+		list_del(&sm->list);
+		mntput(sm->mnt);
+		kfree(sm);
 	}
 }
 
-static int sync_filesystem_collected(struct list_head *sync_list, struct super_block *sb)
+/* Same as iterate_supers(), over the collected superblocks only */
+static void sync_iterate_mnts(struct list_head *sync_list,
+			      void (*f)(struct super_block *, void *),
+			      void *arg)
 {
-	struct sync_sb *ss;
+	struct sync_mnt *sm;
 
-	list_for_each_entry(ss, sync_list, list)
-		if (ss->sb == sb)
-			return 1;
-	return 0;
+	list_for_each_entry(sm, sync_list, list) {
+		struct super_block *sb = sm->mnt->mnt_sb;
+
+		down_read(&sb->s_umount);
+		if (sb->s_root && (sb->s_flags & MS_BORN))
+			f(sb, arg);
+		up_read(&sb->s_umount);
+	}
 }
 
-static int sync_collect_filesystems(struct ve_struct *ve, struct list_head *sync_list)
+static void writeback_inodes_one_sb(struct super_block *sb, void *arg)
 {
-	struct vfsmount *root = ve->root_path.mnt;
-	struct vfsmount *mnt;
-	struct sync_sb *ss;
-	int ret = 0;
+	if (!(sb->s_flags & MS_RDONLY))
+		writeback_inodes_sb(sb, WB_REASON_SYNC);
+}
+
+/* Block devices are shared by superblocks rarely, but do each one once */
+static void sync_iterate_bdevs(struct list_head *sync_list,
+			       void (*f)(struct block_device *, void *))
+{
+	struct sync_mnt *sm, *prev;
 
-	BUG_ON(!list_empty(sync_list));
+	list_for_each_entry(sm, sync_list, list) {
+		struct super_block *sb = sm->mnt->mnt_sb;
 
-	down_read(&namespace_sem);
-	for (mnt = root; mnt; mnt = next_mnt(mnt, root)) {
-		if (sync_filesystem_collected(sync_list, mnt->mnt_sb))
+		if (!sb->s_bdev)
+			continue;
+		list_for_each_entry(prev, sync_list, list)
+			if (prev == sm ||
+			    prev->mnt->mnt_sb->s_bdev == sb->s_bdev)
+				break;
+		if (prev != sm)
 			continue;
 
-		ss = kmalloc(sizeof(*ss), GFP_KERNEL);
-		if (ss == NULL) {
-			ret = -ENOMEM;
-			break;
-		}
-		ss->sb = mnt->mnt_sb;
-		/*
-		 * We hold mount point and thus can be sure, that superblock is
-		 * alive. And it means, that we can safely increase it's usage
-		 * counter.
-		 */
-		spin_lock(&sb_lock);
-		ss->sb->s_count++;
-		spin_unlock(&sb_lock);
-		list_add_tail(&ss->list, sync_list);
+		down_read(&sb->s_umount);
+		if (sb->s_root)
+			f(sb->s_bdev, NULL);
+		up_read(&sb->s_umount);
 	}
-	up_read(&namespace_sem);
-	return ret;
 }
 
-static void sync_filesystems_ve(struct ve_struct *ve, struct user_beancounter *ub, int wait)
+/*
+ * Container sync: the same sequence as sync(2), but over the superblocks
+ * mounted in the caller's mount namespace instead of all of them. First
+ * writeback is started on every sb so that it runs in parallel, and only
+ * then waited for.
+ */
+static void sync_filesystems_ve(struct ve_struct *ve)
 {
-	struct super_block *sb;
 	LIST_HEAD(sync_list);
-	struct sync_sb *ss;
+	int nowait = 0, wait = 1;
 
-	mutex_lock(&ve->sync_mutex);		/* Could be down_interruptible */
+	mutex_lock(&ve->sync_mutex);
 
 	/*
-	 * We don't need to care about allocating failure here. At least we
-	 * don't need to skip sync on such error.
-	 * Let's sync what we collected already instead.
+	 * Allocation failure is not a reason to skip sync, sync what
+	 * was collected.
 	 */
-	sync_collect_filesystems(ve, &sync_list);
-
-	list_for_each_entry(ss, &sync_list, list) {
-		sb = ss->sb;
-		down_read(&sb->s_umount);
-		if (!(sb->s_flags & MS_RDONLY) && sb->s_root && sb->s_bdi)
-			__sync_filesystem(sb, ub, wait);
-		up_read(&sb->s_umount);
-	}
+	iterate_ns_mounts(current->nsproxy->mnt_ns,
+			  sync_collect_mnt, &sync_list);
 
-	sync_release_filesystems(&sync_list);
+	sync_iterate_mnts(&sync_list, writeback_inodes_one_sb, NULL);
+	sync_iterate_mnts(&sync_list, sync_inodes_one_sb, NULL);
+	sync_iterate_mnts(&sync_list, sync_fs_one_sb, &nowait);
+	sync_iterate_mnts(&sync_list, sync_fs_one_sb, &wait);
+	sync_iterate_bdevs(&sync_list, fdatawrite_one_bdev);
+	sync_iterate_bdevs(&sync_list, fdatawait_one_bdev);
 
 	mutex_unlock(&ve->sync_mutex);
-}
 
-#endif
+	sync_release_mnts(&sync_list);
+}
 
 static int __ve_fsync_behavior(struct ve_struct *ve)
 {
@@ -246,6 +270,9 @@ SYSCALL_DEFINE0(sync)
 		fsb = __ve_fsync_behavior(ve);
 		if (fsb == FSYNC_NEVER)
 			goto skip;
+
+		sync_filesystems_ve(ve);
+		goto skip;
 	}
 
 	wakeup_flusher_threads(0, WB_REASON_SYNC);
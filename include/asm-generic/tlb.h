@@ -16,6 +16,7 @@
 #define _ASM_GENERIC__TLB_H
 
 #include <linux/swap.h>
+#include <linux/workqueue.h>
 #include <asm/pgalloc.h>
 #include <asm/tlbflush.h>
 
@@ -72,6 +73,8 @@ struct mmu_gather_batch {
 	struct mmu_gather_batch	*next;
 	unsigned int		nr;
 	unsigned int		max;
+	struct mmu_gather	*tlb;		/* for freeing by a worker */
+	struct work_struct	free_work;
 	struct page		*pages[0];
 };
 
@@ -108,6 +111,7 @@ struct mmu_gather {
 	struct mmu_gather_batch	local;
 	struct page		*__pages[MMU_GATHER_BUNDLE];
 	unsigned int		batch_count;
+	atomic_t		nr_async;	/* batches left to workers */
 };
 
 #define HAVE_GENERIC_MMU_GATHER
@@ -20,7 +20,9 @@
 #include <linux/percpu.h>
 #include <linux/percpu_counter.h>
 #include <linux/ratelimit.h>
+#include <linux/seqlock.h>
 #include <linux/cgroup.h>
+#include <linux/mmzone.h>
 #include <bc/decl.h>
 #include <asm/atomic.h>
 
@@ -62,6 +64,7 @@ struct ub_percpu_struct {
 #ifdef CONFIG_BC_IO_ACCOUNTING
 	unsigned long async_write_complete;
 	unsigned long async_write_canceled;
+	unsigned long writeback_done;
 	unsigned long long sync_write_bytes;
 	unsigned long long sync_read_bytes;
 #endif
@@ -77,6 +80,15 @@ struct ub_percpu_struct {
 	unsigned long	frsync;
 	unsigned long	frsync_done;
 
+	unsigned long	tcache_hit;
+	unsigned long	tcache_miss;
+	unsigned long	tcache_evict;
+
+	unsigned long	pfcache_hit;
+	unsigned long	pfcache_miss;
+	unsigned long	pfcache_peer_pages;
+	unsigned long	pfcache_invalidate;
+
 	/* percpu resource precharge */
 	int	precharge[UB_RESOURCES];
 };
@@ -90,6 +102,13 @@ enum {
 struct user_beancounter {
 	struct cgroup_subsys_state css;
 
+	/*
+	 * Beancounter of the enclosing container, NULL for top level ones.
+	 * Whatever is charged to a beancounter, its own precharges included,
+	 * is charged to all its ancestors too.
+	 */
+	struct user_beancounter	*parent;
+
 	struct cgroup_subsys_state *ub_bound_css[NR_UB_BOUND_CGROUPS];
 
 	unsigned long		ub_magic;
@@ -109,6 +128,27 @@ struct user_beancounter {
 
 	void			*iolimit;
 
+	/* write bandwidth estimation, see ub_write_bandwidth */
+	unsigned long		bw_time_stamp;
+	unsigned long		written_stamp;
+	unsigned long		write_bandwidth;	/* pages per second */
+
+	/*
+	 * Usage without precharges, folded from cpus at most every
+	 * ub_snapshot_interval ms, see ub_get_usage. Updated under ub_lock.
+	 */
+	seqcount_t		ub_snap_seq;
+	unsigned long		ub_snap_time;
+	unsigned long		ub_snap_held[UB_RESOURCES];
+
+	/*
+	 * Memcg LRU sizes summed over online nodes, refreshed by the same
+	 * rule, see ub_page_stat_cached. Updated under ub_lock.
+	 */
+	seqcount_t		ub_lru_seq;
+	unsigned long		ub_lru_time;
+	unsigned long		ub_lru_pages[NR_LRU_LISTS];
+
 	/* resources statistic and settings */
 	struct ubparm		ub_parms[UB_RESOURCES];
 	/* resources statistic for last interval */
@@ -119,6 +159,7 @@ struct user_beancounter {
 
 enum ub_flags {
 	UB_DIRTY_EXCEEDED,
+	UB_IO_LIMITED,		/* io or iops limit set, see vziolimit */
 };
 
 extern int ub_count;
@@ -294,6 +335,8 @@ extern void ub_sync_memcg(struct user_beancounter *ub);
 extern void ub_page_stat(struct user_beancounter *ub,
 			 const nodemask_t *nodemask,
 			 unsigned long *pages);
+extern void ub_page_stat_cached(struct user_beancounter *ub,
+				unsigned long *pages);
 extern unsigned long ub_total_pages(struct user_beancounter *ub, bool swap);
 
 extern const char *ub_rnames[];
@@ -338,6 +381,8 @@ extern void ub_init_late(void);
 extern void ub_init_early(void);
 
 #define UB_STAT_BATCH	64
+/* max difference between ub_stat_get and ub_stat_get_exact */
+#define UB_STAT_ERROR	(UB_STAT_BATCH * num_possible_cpus())
 
 static inline void __ub_stat_add(atomic_long_t *stat, int *pcpu, long val)
 {
@@ -388,6 +433,14 @@ static inline void __ub_stat_flush_pcpu(atomic_long_t *stat, int *pcpu)
 #define __ub_stat_get(ub, name)		atomic_long_read(&(ub)->name)
 #define ub_stat_get(ub, name)		max(0l, atomic_long_read(&(ub)->name))
 #define ub_stat_get_exact(ub, name)	max(0l, __ub_stat_get(ub, name) + __ub_percpu_sum(ub, name))
+/* exact only if the approximate value is within UB_STAT_ERROR of limit */
+#define ub_stat_get_bounded(ub, name, limit)	({			\
+		struct user_beancounter *__ubb = (ub);			\
+		long __val = ub_stat_get(__ubb, name);			\
+		if (__val + UB_STAT_ERROR >= (limit))			\
+			__val = ub_stat_get_exact(__ubb, name);		\
+		__val;							\
+	})
 #define ub_stat_flush_pcpu(ub, name)	__ub_stat_flush_pcpu(&(ub)->name, &(ub)->ub_percpu->name)
 
 int ubstat_alloc_store(struct user_beancounter *ub);
@@ -487,6 +540,9 @@ int precharge_beancounter(struct user_beancounter *ub,
 		int resource, unsigned long val);
 void ub_precharge_snapshot(struct user_beancounter *ub, int *precharge);
 
+extern int ub_snapshot_interval;
+void ub_get_usage(struct user_beancounter *ub, unsigned long *held);
+
 #define UB_IOPRIO_MIN 0
 #define UB_IOPRIO_MAX 8
 
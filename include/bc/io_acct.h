@@ -58,6 +58,10 @@ extern void ub_io_writeback_dec(struct address_space *mapping);
 
 extern int ub_dirty_limits(unsigned long *pbackground,
 			   long *pdirty, struct user_beancounter *ub);
+extern unsigned long ub_dirty_pages(struct user_beancounter *ub,
+				    unsigned long thresh);
+extern unsigned long ub_write_bandwidth(struct user_beancounter *ub,
+					unsigned long start_time);
 
 extern bool ub_should_skip_writeback(struct user_beancounter *ub,
 				     struct inode *inode);
@@ -105,6 +109,18 @@ static inline int ub_dirty_limits(unsigned long *pbackground,
 	return 0;
 }
 
+static inline unsigned long ub_dirty_pages(struct user_beancounter *ub,
+					   unsigned long thresh)
+{
+	return 0;
+}
+
+static inline unsigned long ub_write_bandwidth(struct user_beancounter *ub,
+					       unsigned long start_time)
+{
+	return ULONG_MAX;
+}
+
 static inline bool ub_should_skip_writeback(struct user_beancounter *ub,
 				     struct inode *inode)
 {
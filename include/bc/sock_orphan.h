@@ -39,6 +39,20 @@ static inline int ub_get_orphan_count(struct sock *sk)
 	return percpu_counter_sum_positive(__ub_get_orphan_count_ptr(sk));
 }
 
+/*
+ * Precise sum walks all CPUs under the counter lock, so do it only when
+ * the approximate value is already over the limit, like
+ * tcp_too_many_orphans() does.
+ */
+static inline int __ub_orphans_over(struct sock *sk, int shift, int limit)
+{
+	struct percpu_counter *ocp = __ub_get_orphan_count_ptr(sk);
+
+	if ((percpu_counter_read_positive(ocp) << shift) <= limit)
+		return 0;
+	return (percpu_counter_sum_positive(ocp) << shift) > limit;
+}
+
 static inline int ub_too_many_orphans(struct sock *sk, int count)
 {
 	struct net *net = sock_net(sk);
@@ -47,7 +61,7 @@ static inline int ub_too_many_orphans(struct sock *sk, int count)
 	if (__ub_too_many_orphans(sk, count))
 		return 1;
 #endif
-	return (ub_get_orphan_count(sk) > sysctl_tcp_max_orphans ||
+	return (__ub_orphans_over(sk, 0, sysctl_tcp_max_orphans) ||
 		(sk->sk_wmem_queued > SOCK_MIN_SNDBUF &&
 		atomic_long_read(&tcp_memory_allocated) > net->ipv4.sysctl_tcp_mem[2]));
 }
@@ -29,6 +29,10 @@ struct kiocb;
  */
 #define KIOCB_CANCELLED		((void *) (~0ULL))
 
+/* ki_flags */
+#define KIOCB_NOWAIT		(1 << 0) /* only use the page cache, -EAGAIN
+					  * instead of waiting for a read */
+
 typedef int (kiocb_cancel_fn)(struct kiocb *, struct io_event *);
 
 struct kiocb {
@@ -47,6 +51,7 @@ struct kiocb {
 
 	__u64			ki_user_data;	/* user's data for completion */
 	loff_t			ki_pos;
+	unsigned int		ki_flags;
 
 	void			*private;
 	/* State that we remember to be able to restart/retry  */
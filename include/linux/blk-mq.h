@@ -74,6 +74,10 @@ struct blk_mq_hw_ctx {
 	RH_KABI_EXTEND(struct blk_mq_ctxmap	ctx_map)
 
 	RH_KABI_EXTEND(atomic_t		nr_active)
+
+	/* sum of weights of blkio cgroups holding tags, see blk-mq-cgroup.c */
+	RH_KABI_EXTEND(spinlock_t		cg_lock)
+	RH_KABI_EXTEND(unsigned int		cg_weight)
 };
 
 #ifdef __GENKSYMS__
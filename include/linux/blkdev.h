@@ -263,6 +263,7 @@ typedef int (merge_bvec_fn) (struct request_queue *, struct bvec_merge_data *,
 typedef void (softirq_done_fn)(struct request *);
 typedef int (dma_drain_needed_fn)(struct request *);
 typedef int (lld_busy_fn) (struct request_queue *q);
+typedef int (poll_q_fn) (struct request_queue *q);
 typedef int (bsg_job_fn) (struct bsg_job *);
 
 enum blk_eh_timer_return {
@@ -515,6 +516,10 @@ struct request_queue {
 	RH_KABI_EXTEND(spinlock_t			requeue_lock)
 	RH_KABI_EXTEND(struct work_struct		requeue_work)
 	RH_KABI_EXTEND(int				mq_freeze_depth)
+
+	/* completion polling, see blk_poll() */
+	RH_KABI_EXTEND(poll_q_fn			*poll_fn)
+	RH_KABI_EXTEND(u64				poll_nsec)
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -541,6 +546,7 @@ struct request_queue {
 #define QUEUE_FLAG_UNPRIV_SGIO 21	/* SG_IO free for unprivileged users */
 #define QUEUE_FLAG_NO_SG_MERGE 22	/* don't attempt to merge SG segments*/
 #define QUEUE_FLAG_SG_GAPS     23	/* queue doesn't support SG gaps */
+#define QUEUE_FLAG_POLL        24	/* poll for sync IO completion */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -628,6 +634,8 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 #define blk_queue_stackable(q)	\
 	test_bit(QUEUE_FLAG_STACKABLE, &(q)->queue_flags)
 #define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
+#define blk_queue_poll(q)	\
+	((q)->poll_fn && test_bit(QUEUE_FLAG_POLL, &(q)->queue_flags))
 #define blk_queue_secdiscard(q)	(blk_queue_discard(q) && \
 	test_bit(QUEUE_FLAG_SECDISCARD, &(q)->queue_flags))
 
@@ -832,6 +840,9 @@ extern void blk_add_request_payload(struct request *rq, struct page *page,
 		unsigned int len);
 extern int blk_rq_check_limits(struct request_queue *q, struct request *rq);
 extern int blk_lld_busy(struct request_queue *q);
+extern int blk_poll(struct request_queue *q);
+extern void blk_poll_sleep(struct request_queue *q, ktime_t start);
+extern void blk_poll_account(struct request_queue *q, ktime_t start);
 extern int blk_rq_prep_clone(struct request *rq, struct request *rq_src,
 			     struct bio_set *bs, gfp_t gfp_mask,
 			     int (*bio_ctr)(struct bio *, struct bio *, void *),
@@ -1063,6 +1074,7 @@ extern int blk_queue_dma_drain(struct request_queue *q,
 			       dma_drain_needed_fn *dma_drain_needed,
 			       void *buf, unsigned int size);
 extern void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn);
+extern void blk_queue_poll_fn(struct request_queue *q, poll_q_fn *fn);
 extern void blk_queue_segment_boundary(struct request_queue *, unsigned long);
 extern void blk_queue_prep_rq(struct request_queue *, prep_rq_fn *pfn);
 extern void blk_queue_unprep_rq(struct request_queue *, unprep_rq_fn *ufn);
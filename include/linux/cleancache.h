@@ -28,6 +28,8 @@ struct cleancache_filekey {
 struct cleancache_ops {
 	int (*init_fs)(size_t);
 	int (*init_shared_fs)(char *uuid, size_t);
+	/* optional, called instead of init_fs if set */
+	int (*init_fs_uuid)(char *uuid, size_t);
 	int (*get_page)(int, struct cleancache_filekey,
 			pgoff_t, struct page *);
 	void (*put_page)(int, struct cleancache_filekey,
@@ -18,6 +18,9 @@
 
 /* Forward declarations to avoid compiler errors */
 struct file;
+struct eventpoll;
+struct task_struct;
+struct poll_table_struct;
 
 
 #ifdef CONFIG_EPOLL
@@ -61,11 +64,33 @@ static inline void eventpoll_release(struct file *file)
 	eventpoll_release_file(file);
 }
 
+/* Readiness cache for poll(2)/select(2), see fs/eventpoll.c */
+extern int sysctl_poll_cache_min_fds;
+struct eventpoll *poll_cache_begin(unsigned int nfds,
+				   struct poll_table_struct *pt);
+void poll_cache_end(struct eventpoll *ep);
+unsigned int poll_cache_poll(struct eventpoll *ep, struct file *file,
+			     int fd, struct poll_table_struct *pt);
+void poll_cache_exit(struct task_struct *tsk);
+
 #else
 
 static inline void eventpoll_init_file(struct file *file) {}
 static inline void eventpoll_release(struct file *file) {}
 
+static inline struct eventpoll *
+poll_cache_begin(unsigned int nfds, struct poll_table_struct *pt)
+{
+	return NULL;
+}
+static inline void poll_cache_end(struct eventpoll *ep) {}
+static inline unsigned int poll_cache_poll(struct eventpoll *ep,
+		struct file *file, int fd, struct poll_table_struct *pt)
+{
+	return 0;
+}
+static inline void poll_cache_exit(struct task_struct *tsk) {}
+
 #endif
 
 #endif /* #ifndef _LINUX_EVENTPOLL_H */
@@ -1368,26 +1368,45 @@ extern int jbd_blocks_per_page(struct inode *inode);
 /* JBD uses a CRC32 checksum */
 #define JBD_MAX_CHECKSUM_SIZE 4
 
-static inline u32 jbd2_chksum(journal_t *journal, u32 crc,
-			      const void *address, unsigned int length)
-{
-	struct {
-		struct shash_desc shash;
-		char ctx[JBD_MAX_CHECKSUM_SIZE];
-	} desc;
-	int err;
+struct jbd2_chksum_desc {
+	struct shash_desc shash;
+	char ctx[JBD_MAX_CHECKSUM_SIZE];
+};
 
+/*
+ * A descriptor set up once can be reused for any number of buffers,
+ * see jbd2_block_tags_csum_set().
+ */
+static inline void jbd2_chksum_desc_init(journal_t *journal,
+					 struct jbd2_chksum_desc *desc)
+{
 	BUG_ON(crypto_shash_descsize(journal->j_chksum_driver) >
 		JBD_MAX_CHECKSUM_SIZE);
 
-	desc.shash.tfm = journal->j_chksum_driver;
-	desc.shash.flags = 0;
-	*(u32 *)desc.ctx = crc;
+	desc->shash.tfm = journal->j_chksum_driver;
+	desc->shash.flags = 0;
+}
 
-	err = crypto_shash_update(&desc.shash, address, length);
+static inline u32 jbd2_chksum_desc(struct jbd2_chksum_desc *desc, u32 crc,
+				   const void *address, unsigned int length)
+{
+	int err;
+
+	*(u32 *)desc->ctx = crc;
+
+	err = crypto_shash_update(&desc->shash, address, length);
 	BUG_ON(err);
 
-	return *(u32 *)desc.ctx;
+	return *(u32 *)desc->ctx;
+}
+
+static inline u32 jbd2_chksum(journal_t *journal, u32 crc,
+			      const void *address, unsigned int length)
+{
+	struct jbd2_chksum_desc desc;
+
+	jbd2_chksum_desc_init(journal, &desc);
+	return jbd2_chksum_desc(&desc, crc, address, length);
 }
 
 /* Return most recent uncommitted transaction */
@@ -60,6 +60,7 @@ struct file;
 
 struct subprocess_info {
 	struct kthread_work work;
+	u64 queued;		/* when work was queued, in ns */
 	struct completion *complete;
 	char *path;
 	char **argv;
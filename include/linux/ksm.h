@@ -21,6 +21,7 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags);
 int __ksm_enter(struct mm_struct *mm);
 void __ksm_exit(struct mm_struct *mm);
+unsigned long ksm_mmap_flags(struct mm_struct *mm, unsigned long vm_flags);
 
 static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
@@ -91,6 +92,12 @@ static inline void ksm_exit(struct mm_struct *mm)
 {
 }
 
+static inline unsigned long ksm_mmap_flags(struct mm_struct *mm,
+					   unsigned long vm_flags)
+{
+	return vm_flags;
+}
+
 static inline int PageKsm(struct page *page)
 {
 	return 0;
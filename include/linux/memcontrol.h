@@ -68,6 +68,9 @@ extern int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 struct lruvec *mem_cgroup_zone_lruvec(struct zone *, struct mem_cgroup *);
 struct lruvec *mem_cgroup_page_lruvec(struct page *, struct zone *);
 
+unsigned short mem_cgroup_page_id(struct page *page);
+struct lruvec *mem_cgroup_id_lruvec(unsigned short id, struct zone *zone);
+
 /* For coalescing uncharge for reducing memcg' overhead*/
 extern void mem_cgroup_uncharge_start(void);
 extern void mem_cgroup_uncharge_end(void);
@@ -258,6 +261,17 @@ static inline struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
 	return &zone->lruvec;
 }
 
+static inline unsigned short mem_cgroup_page_id(struct page *page)
+{
+	return 0;
+}
+
+static inline struct lruvec *mem_cgroup_id_lruvec(unsigned short id,
+						  struct zone *zone)
+{
+	return &zone->lruvec;
+}
+
 static inline struct lruvec *mem_cgroup_page_lruvec(struct page *page,
 						    struct zone *zone)
 {
@@ -422,9 +436,13 @@ enum {
 };
 
 struct sock;
+struct cg_proto;
 #if defined(CONFIG_INET) && defined(CONFIG_MEMCG_KMEM)
 void sock_update_memcg(struct sock *sk);
 void sock_release_memcg(struct sock *sk);
+void memcg_charge_sock(struct cg_proto *prot, unsigned long nr_pages,
+		       int *parent_status);
+void memcg_uncharge_sock(struct cg_proto *prot, unsigned long nr_pages);
 #else
 static inline void sock_update_memcg(struct sock *sk)
 {
@@ -432,6 +450,15 @@ static inline void sock_update_memcg(struct sock *sk)
 static inline void sock_release_memcg(struct sock *sk)
 {
 }
+static inline void memcg_charge_sock(struct cg_proto *prot,
+				     unsigned long nr_pages,
+				     int *parent_status)
+{
+}
+static inline void memcg_uncharge_sock(struct cg_proto *prot,
+				       unsigned long nr_pages)
+{
+}
 #endif /* CONFIG_INET && CONFIG_MEMCG_KMEM */
 
 #ifdef CONFIG_MEMCG_KMEM
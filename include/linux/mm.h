@@ -2121,6 +2121,9 @@ static inline void clear_page_idle(struct page *page)
 {
 	ClearPageIdle(page);
 }
+
+extern struct page *page_idle_get_page(unsigned long pfn);
+extern void page_idle_clear_pte_refs(struct page *page);
 #else /* !CONFIG_IDLE_PAGE_TRACKING */
 static inline bool page_is_young(struct page *page)
 {
@@ -24,6 +24,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct futex_hash_bucket;
 struct gang;
 
 #define USE_SPLIT_PTE_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
@@ -408,6 +409,11 @@ struct mm_struct {
 	struct user_beancounter *mm_ub;
 #endif
 	struct core_state *core_state; /* coredumping support */
+#ifdef CONFIG_FUTEX
+	/* private futexes of a multithreaded process, see futex_mm_init() */
+	struct futex_hash_bucket *futex_hash;
+	unsigned int		futex_hash_mask;
+#endif
 #ifdef CONFIG_AIO
 	spinlock_t		ioctx_lock;
 	struct hlist_head	ioctx_list;
@@ -212,6 +212,8 @@ struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
 	unsigned long pages_scanned;
+	/* Evictions & activations on the inactive file list */
+	atomic_long_t inactive_age;
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
@@ -245,13 +247,27 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * Besides order-0 pages, the pcp lists cache small high-order blocks up to
+ * PAGE_ALLOC_COSTLY_ORDER, which are allocated often too (skb fragments,
+ * stacks, kmalloc of a few pages). Lists are indexed by
+ * order * MIGRATE_PCPTYPES + migratetype.
+ */
+#define PCP_MAX_ORDER		PAGE_ALLOC_COSTLY_ORDER
+#define NR_PCP_LISTS		(MIGRATE_PCPTYPES * (PCP_MAX_ORDER + 1))
+
+static inline int pcp_list_index(unsigned int order, int migratetype)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type, see above */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -401,9 +417,6 @@ struct zone {
 	spinlock_t		lru_lock;
 	struct lruvec		lruvec;
 
-	/* Evictions & activations on the inactive file list */
-	atomic_long_t		inactive_age;
-
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
@@ -663,6 +663,7 @@ static inline void rps_reset_sock_flow(struct rps_sock_flow_table *table,
 }
 
 extern struct rps_sock_flow_table __rcu *rps_sock_flow_table;
+extern int sysctl_rps_ve_steering;
 
 #ifdef CONFIG_RFS_ACCEL
 extern bool rps_may_expire_flow(struct net_device *dev, u16 rxq_index,
@@ -2525,6 +2526,8 @@ extern int		dev_get_phys_port_id(struct net_device *dev,
 extern int		dev_hard_start_xmit(struct sk_buff *skb,
 					    struct net_device *dev,
 					    struct netdev_queue *txq);
+extern int		__dev_forward_skb(struct net_device *dev,
+					  struct sk_buff *skb);
 extern int		dev_forward_skb(struct net_device *dev,
 					struct sk_buff *skb);
 
@@ -2949,6 +2952,9 @@ extern void netdev_stats_to_stats64(struct rtnl_link_stats64 *stats64,
 extern int		netdev_max_backlog;
 extern int		netdev_tstamp_prequeue;
 extern int		weight_p;
+#ifdef CONFIG_VE
+extern int		sysctl_ve_rx_softirq_max;
+#endif
 extern int		bpf_jit_enable;
 
 extern bool netdev_has_upper_dev(struct net_device *dev,
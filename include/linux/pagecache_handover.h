@@ -0,0 +1,48 @@
+/*
+ *  include/linux/pagecache_handover.h
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ *  Clean page cache carried over kexec in a reserved memory region.
+ */
+
+#ifndef _LINUX_PAGECACHE_HANDOVER_H
+#define _LINUX_PAGECACHE_HANDOVER_H
+
+#include <linux/types.h>
+#include <linux/jump_label.h>
+
+struct inode;
+struct super_block;
+struct ctl_table;
+
+#ifdef CONFIG_PAGECACHE_HANDOVER
+extern int sysctl_pagecache_handover;
+extern struct static_key pagecache_handover_pending;
+
+extern void pagecache_handover_save(struct super_block *sb);
+extern void __pagecache_handover_adopt(struct inode *inode);
+extern void pagecache_handover_seal(void);
+extern bool pagecache_handover_overlaps(unsigned long start,
+					unsigned long end);
+extern int pagecache_handover_sysctl_handler(struct ctl_table *table,
+		int write, void __user *buffer, size_t *length, loff_t *ppos);
+
+/* Called for every inode read in, so only a static key when idle */
+static inline void pagecache_handover_adopt(struct inode *inode)
+{
+	if (static_key_false(&pagecache_handover_pending))
+		__pagecache_handover_adopt(inode);
+}
+#else
+static inline void pagecache_handover_save(struct super_block *sb) { }
+static inline void pagecache_handover_adopt(struct inode *inode) { }
+static inline void pagecache_handover_seal(void) { }
+static inline bool pagecache_handover_overlaps(unsigned long start,
+					       unsigned long end)
+{
+	return false;
+}
+#endif
+
+#endif /* _LINUX_PAGECACHE_HANDOVER_H */
@@ -32,6 +32,11 @@ struct pfcache_dump_request {
 	__u64	payload;		/* payload flags */
 	__u32	offset;			/* skip inodes, after filtering */
 	__u8	csum_filter[PFCACHE_CSUM_SIZE];
+	/*
+	 * In: inode number to start from.  Out: where to continue, or zero
+	 * when all are dumped.  Needs PFCACHE_FILTER_WITHOUT_CSUM in filter.
+	 */
+	__u64	cursor;
 	/* -- add fields above this line -- */
 	__u8	buffer[0];
 };
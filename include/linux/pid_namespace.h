@@ -25,7 +25,8 @@ struct pid_namespace {
 	struct pidmap pidmap[PIDMAP_ENTRIES];
 	int last_pid;
 	int pid_max;
-	unsigned int nr_hashed;
+	unsigned int nr_hashed;		/* protected by pidmap_lock */
+	spinlock_t pidmap_lock;
 	struct task_struct *child_reaper;
 	struct kmem_cache *pid_cachep;
 	unsigned int level;
@@ -29,6 +29,7 @@ typedef u32	iblock_t;
 
 struct ploop_request;
 struct ploop_delta;
+struct kaio_req;
 
 enum {
 	PLOOP_S_RUNNING,	/* Device is active */
@@ -106,6 +107,10 @@ struct ploop_io
 	wait_queue_head_t	fsync_waitq;
 	struct timer_list	fsync_timer;
 
+	struct kaio_req		*kreq_batch;	/* kaio: pending batched aio */
+	struct dio_batch	*dio_batch;	/* direct: pending merged bios */
+	struct ploop_cache	*cache;		/* direct: write-back cache */
+
 	struct ploop_io_ops	*ops;
 };
 
@@ -144,6 +149,11 @@ struct ploop_io_ops
 				struct bio_list *sbl, unsigned int size);
 
 	int	(*disable_merge)(struct ploop_io * io, sector_t isector, unsigned int len);
+
+	/* Non-zero if clusters of src image can be shared with this one
+	 * by the backing fs (PLOOP_REQ_CLONE) instead of being copied.
+	 */
+	int	(*may_clone)(struct ploop_io * io, struct ploop_io * src);
 	int	(*fastmap)(struct ploop_io * io, struct bio *orig_bio,
 			   struct bio * bio, sector_t isec);
 
@@ -178,6 +188,9 @@ struct ploop_io_ops
 
 	void	(*issue_flush)(struct ploop_io*, struct ploop_request * preq);
 
+	/* Write-back cache of the image, PLOOP_CACHE_* below */
+	int	(*cache_ctl)(struct ploop_io *, int cmd, unsigned long arg);
+
 	int	(*dump)(struct ploop_io*);
 
 	loff_t  (*i_size_read)(struct ploop_io*);
@@ -186,6 +199,13 @@ struct ploop_io_ops
 	int     (*autodetect)(struct ploop_io * io);
 };
 
+/* cache_ctl commands */
+enum {
+	PLOOP_CACHE_ATTACH,	/* arg is user ploop_cache_ctl, quiesced */
+	PLOOP_CACHE_WRITEBACK,	/* write back most of dirty data */
+	PLOOP_CACHE_DETACH,	/* quiesced */
+};
+
 static inline loff_t generic_i_size_read(struct ploop_io *io)
 {
 	BUG_ON(!io->files.file);
@@ -222,7 +242,17 @@ struct ploop_map
 	struct map_node		*lru_buffer[PLOOP_LRU_BUFFER];
 	unsigned int		lru_buffer_ptr;
 
-	wait_queue_head_t	destroy_waitq;
+	/* map_node-s with zero refcnt, protected by plo->lock */
+	struct list_head	lru;
+	/* Link in global list of maps with cached pages */
+	struct list_head	list;
+
+	/* map_node-s held for group commit of index updates */
+	struct list_head	wb_batch;
+
+	/* Sequential access detector for index read-ahead */
+	cluster_t		ra_last;	/* last accessed cluster */
+	cluster_t		ra_page;	/* first index page not read ahead */
 };
 
 #define PLOOP_FMT_CAP_DELTA	1
@@ -298,15 +328,26 @@ struct ploop_tunable
 	int	fsync_max;
 	int	fsync_delay;
 	int	min_map_pages;
+	int	max_map_pages;	/* per-device budget, 0 - only global limit */
 	int	max_map_inactivity;
 	int	congestion_high_watermark;
 	int	congestion_low_watermark;
 	int	max_active_requests;
+	int	index_batch_delay;
+	int	map_readahead;	/* index pages to read ahead, 0 - off */
+	int	maint_reqs;	/* maintenance reqs in flight, 0 - auto */
+	int	maint_bw;	/* maintenance KB/s, 0 - unlimited */
+	int	maint_iops;	/* maintenance clusters/s, 0 - unlimited */
+	int	maint_yield_qlen; /* pause maintenance above this queue */
+	int	reloc_batch;	/* blocks per PLOOP_IOC_RELOCBLKS, 0 - all */
 	unsigned int pass_flushes : 1, pass_fuas : 1,
 		     congestion_detection : 1,
 		     check_zeros : 1,
 		     disable_root_threshold : 1,
-		     disable_user_threshold : 1;
+		     disable_user_threshold : 1,
+		     direct_complete : 1,
+		     merge_clone : 1,
+		     dedup : 1;		/* skip writes repeating lower delta */
 };
 
 #define DEFAULT_PLOOP_MAXRQ 256
@@ -326,6 +367,8 @@ struct ploop_tunable
 .pass_flushes = 1, \
 .pass_fuas = 1, \
 .check_zeros = 1, \
+.direct_complete = 1, \
+.merge_clone = 1, \
 .max_active_requests = DEFAULT_PLOOP_BATCH_ENTRY_QLEN / 2, }
 
 struct ploop_stats
@@ -335,7 +378,35 @@ struct ploop_stats
 #undef __DO
 };
 
+/* Stages of request life for latency histograms (pstat/lat_*) */
+enum
+{
+	PLOOP_LAT_QUEUE,	/* in entry or ready queue */
+	PLOOP_LAT_LOCKOUT,	/* delayed by request to the same cluster */
+	PLOOP_LAT_INDEX,	/* index page read or writeback */
+	PLOOP_LAT_DATA,		/* data I/O in backing file */
+	PLOOP_LAT_PROCESS,	/* ploop_thread handles request, incl. submit */
+	PLOOP_LAT_TOTAL,	/* arrival to completion */
+	PLOOP_LAT_MAX
+};
+
+/* Bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us, the last one is open */
+#define PLOOP_LAT_BUCKETS	24
+
+struct ploop_lat_hist
+{
+	u32	hist[PLOOP_LAT_MAX][PLOOP_LAT_BUCKETS];
+};
+
 struct ploop_freeblks_desc;
+struct ploop_cbt;
+
+/* Entry and lockout trees are split by ranges of clusters, so that each
+ * lookup under plo->lock walks a shallow tree. Neighbours inside one
+ * cluster, which merging looks for, always share a tree.
+ */
+#define PLOOP_TREE_SHARDS	16
+#define PLOOP_TREE_RANGE_LOG	4	/* clusters per range, log2 */
 
 struct ploop_device
 {
@@ -355,11 +426,11 @@ struct ploop_device
 	int			bio_qlen;
 	int			bio_total;
 
-	struct rb_root		entry_tree[2];
+	struct rb_root		entry_tree[2][PLOOP_TREE_SHARDS];
 
 	struct list_head	ready_queue;
 
-	struct rb_root		lockout_tree;
+	struct rb_root		lockout_tree[PLOOP_TREE_SHARDS];
 
 	int			cluster_log;
 	int			fmt_version;
@@ -416,6 +487,12 @@ struct ploop_device
 	u32			track_ptr;
 
 	u32			merge_ptr;
+	int			merge_clone;	/* merge shares data, no copy */
+
+	/* Throttled maintenance (merge, relocation) requests */
+	struct list_head	maint_queue;
+	struct timer_list	maint_timer;
+	u64			maint_next;	/* ns, when next one may go */
 
 	atomic_t		maintenance_cnt;
 	struct completion	maintenance_comp;
@@ -434,9 +511,11 @@ struct ploop_device
 	struct kobject		*ptune_dir;
 
 	struct ploop_stats	st;
+	struct ploop_lat_hist __percpu *lat;
 	char                    cookie[PLOOP_COOKIE_SIZE];
 
 	struct ploop_freeblks_desc *fbd;
+	struct ploop_cbt	*cbt;	/* changed block tracking, plo->lock */
 
 	unsigned long		locking_state; /* plo locked by userspace */
 };
@@ -459,6 +538,9 @@ enum
 	PLOOP_REQ_FORCE_FUA,	/*force fua of req write I/O by engine */
 	PLOOP_REQ_FORCE_FLUSH,	/*force flush by engine */
 	PLOOP_REQ_KAIO_FSYNC,	/*force image fsync by KAIO module */
+	PLOOP_REQ_PREFETCH,	/* Internal req reading in an index page */
+	PLOOP_REQ_CLONE,	/* merge: clone src_iblock of trans delta */
+	PLOOP_REQ_LAT_LOCKOUT,	/* was waiting for lockout, for latency stats */
 };
 
 enum
@@ -483,6 +565,9 @@ enum
 	PLOOP_E_ZERO_INDEX,	/* Zeroing index of free block; original request
 				   can use .submit on completion */
 	PLOOP_E_DELTA_ZERO_INDEX,/* the same but for PLOOP_E_DELTA_READ */
+	PLOOP_E_DEDUP_READ,	/* Whole block write reads previous delta
+				 * to compare data.
+				 */
 };
 
 #define BIO_BDEV_REUSED	14	/* io_context is stored in bi_bdev */
@@ -505,6 +590,8 @@ struct ploop_request
 	unsigned int		req_size;
 	unsigned int		req_rw;
 	unsigned long		tstamp;
+	u64			lat_start;	/* ns, arrival; 0 - not accounted */
+	u64			lat_stamp;	/* ns, last picked by ploop_thread */
 	struct io_context	*ioc;
 
 	struct bio_list		bl;
@@ -745,6 +832,13 @@ static inline void ploop_entry_qlen_dec(struct ploop_request * preq)
 	}
 }
 
+/* Would ploop thread get more requests before going to sleep? */
+static inline int ploop_more_work(struct ploop_device *plo)
+{
+	return !list_empty(&plo->ready_queue) ||
+	       !list_empty(&plo->entry_queue) || plo->bio_head;
+}
+
 static inline int ploop_map_log(struct ploop_device *plo)
 {
 	switch (plo->fmt_version) {
@@ -781,6 +875,10 @@ void ploop_map_destroy(struct ploop_map * map);
 void ploop_map_remove_delta(struct ploop_map * map, int level);
 void ploop_index_update(struct ploop_request * preq);
 void ploop_index_wb_complete(struct ploop_request * preq);
+long ploop_index_batch_timeout(struct ploop_map * map);
+void ploop_index_batch_flush(struct ploop_map * map, int force);
+int ploop_map_prefetch(struct ploop_device * plo, cluster_t clu, int wait);
+int ploop_map_warm(struct ploop_map * map);
 int __init ploop_map_init(void);
 void ploop_map_exit(void);
 
@@ -795,6 +893,12 @@ int ploop_tracker_read(struct ploop_device * plo, unsigned long arg);
 int ploop_tracker_setpos(struct ploop_device * plo, unsigned long arg);
 int ploop_tracker_init(struct ploop_device * plo, unsigned long arg);
 
+void ploop_cbt_mark(struct ploop_device * plo, sector_t sec, unsigned int len);
+int ploop_cbt_grow(struct ploop_device * plo, u64 new_size);
+int ploop_cbt_start(struct ploop_device * plo, unsigned long arg);
+int ploop_cbt_stop(struct ploop_device * plo);
+int ploop_cbt_get(struct ploop_device * plo, unsigned long arg);
+
 
 int ploop_add_lockout(struct ploop_request *preq, int try);
 void del_lockout(struct ploop_request *preq);
@@ -180,12 +180,96 @@ struct ploop_balloon_ctl
 	__u8	__mbz;
 } __attribute__ ((aligned (8)));
 
+/* Changed block tracking.
+ *
+ * Bitmap of virtual clusters written since it was last cleared, one bit
+ * per cluster, little-endian bit order (cluster N is bit N % 8 of byte
+ * N / 8). It is stored in a file supplied by user: ploop_cbt_header at
+ * offset 0, bitmap at PLOOP_CBT_DATA_OFFSET. The header is marked clean
+ * only when the bitmap was saved on orderly stop. If it is not clean
+ * (crash) or does not match the device, all clusters are reported dirty
+ * and PLOOP_CBT_F_RESET is returned.
+ */
+#define PLOOP_CBT_MAGIC		0x54424350	/* "PCBT" */
+#define PLOOP_CBT_VERSION	1
+#define PLOOP_CBT_DATA_OFFSET	4096
+#define PLOOP_CBT_ALIGN		64		/* clusters */
+
+struct ploop_cbt_header
+{
+	__u32	magic;
+	__u32	version;
+	__u32	flags;		/* PLOOP_CBT_F_CLEAN */
+	__u32	cluster_log;
+	__u64	nr_clusters;
+} __attribute__ ((aligned (8)));
+
+#define PLOOP_CBT_F_CLEAN	1	/* header: bitmap is up to date */
+#define PLOOP_CBT_F_RESET	2	/* start: saved state was lost */
+
+struct ploop_cbt_ctl
+{
+	__u32	fd;		/* bitmap file, open for read and write */
+	__u32	flags;		/* out: PLOOP_CBT_F_RESET */
+} __attribute__ ((aligned (8)));
+
+#define PLOOP_CBT_GET_CLEAR	1	/* clear bits returned */
+
+struct ploop_cbt_get_ctl
+{
+	__u64	start;		/* first cluster, multiple of PLOOP_CBT_ALIGN */
+	__u64	nr;		/* in: clusters wanted, out: returned */
+	__u64	buf;		/* user buffer, (nr + 7) / 8 bytes */
+	__u32	flags;		/* PLOOP_CBT_GET_CLEAR */
+	__u32	__mbz;
+} __attribute__ ((aligned (8)));
+
 struct ploop_getdevice_ctl
 {
 	__u32	minor;
 	__u32	__mbz1;
 } __attribute__ ((aligned (8)));
 
+/* Write-back cache of top delta on a fast block device.
+ *
+ * Device layout: ploop_cache_header at offset 0, array of
+ * ploop_cache_entry, one per slot, at PLOOP_CACHE_INDEX_OFFSET, then
+ * slots of one cluster each from data_start. An entry is dirty when its
+ * slot holds data of image cluster iblk which is newer than the image.
+ * Dirty slots are loaded back on next start with the same image, so
+ * the device must not be used without its image and vice versa.
+ */
+#define PLOOP_CACHE_MAGIC		0x48434350	/* "PCCH" */
+#define PLOOP_CACHE_VERSION		1
+#define PLOOP_CACHE_INDEX_OFFSET	4096
+
+struct ploop_cache_header
+{
+	__u32	magic;
+	__u32	version;
+	__u32	cluster_log;
+	__u32	nr_slots;
+	__u64	data_start;	/* in sectors */
+	__u64	image_dev;	/* image the cache belongs to */
+	__u64	image_ino;
+} __attribute__ ((aligned (8)));
+
+struct ploop_cache_entry
+{
+	__u32	iblk;
+	__u32	flags;		/* PLOOP_CACHE_E_DIRTY */
+};
+
+#define PLOOP_CACHE_E_DIRTY	1
+
+#define PLOOP_CACHE_F_RESET	1	/* start: drop what device holds */
+
+struct ploop_cache_ctl
+{
+	__u32	fd;		/* cache block device, open for write */
+	__u32	flags;		/* PLOOP_CACHE_F_RESET */
+} __attribute__ ((aligned (8)));
+
 /* maintenance types */
 enum {
 	PLOOP_MNTN_OFF = 0,  /* no maintenance is in progress */
@@ -302,6 +386,25 @@ struct ploop_track_extent
 /* Set maximum size for the top delta . */
 #define PLOOP_IOC_MAX_DELTA_SIZE _IOW(PLOOPCTLTYPE, 28, __u64)
 
+/* Read index pages of running device into map cache in background,
+ * as much as map cache budget allows. */
+#define PLOOP_IOC_WARM_MAP	_IO(PLOOPCTLTYPE, 29)
+
+/* Start changed block tracking, loading bitmap from file */
+#define PLOOP_IOC_CBT_START	_IOWR(PLOOPCTLTYPE, 30, struct ploop_cbt_ctl)
+
+/* Save bitmap to its file and stop changed block tracking */
+#define PLOOP_IOC_CBT_STOP	_IO(PLOOPCTLTYPE, 31)
+
+/* Read (and optionally clear) part of changed block bitmap */
+#define PLOOP_IOC_CBT_GET	_IOWR(PLOOPCTLTYPE, 32, struct ploop_cbt_get_ctl)
+
+/* Attach write-back cache to top delta of running device */
+#define PLOOP_IOC_CACHE_START	_IOW(PLOOPCTLTYPE, 33, struct ploop_cache_ctl)
+
+/* Write back and detach the cache */
+#define PLOOP_IOC_CACHE_STOP	_IO(PLOOPCTLTYPE, 34)
+
 /* Events exposed via /sys/block/ploopN/pstate/event */
 #define PLOOP_EVENT_ABORTED	1
 #define PLOOP_EVENT_STOPPED	2
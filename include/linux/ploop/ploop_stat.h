@@ -32,13 +32,18 @@ __DO(bio_lockouts)
 __DO(map_lockouts)
 __DO(merge_lockouts)
 __DO(map_reads)
+__DO(map_prefetches)
 __DO(map_merges)
 __DO(map_single_writes)
 __DO(map_multi_writes)
 __DO(map_multi_updates)
+__DO(map_batch_writes)
 __DO(bio_trans_whole)
 __DO(bio_trans_copy)
 __DO(bio_trans_alloc)
+__DO(bio_trans_clone)
+__DO(maint_throttled)
+__DO(maint_yields)
 __DO(bio_trans_index)
 __DO(bio_flush_in)
 __DO(bio_fua_in)
@@ -46,3 +51,13 @@ __DO(bio_flush_out)
 __DO(bio_fua_out)
 __DO(bio_flush_skip)
 
+__DO(bio_direct)
+__DO(kaio_batched)
+__DO(dio_batched)
+__DO(em_hit)
+__DO(em_miss)
+__DO(cache_hit)
+__DO(cache_miss)
+__DO(cache_wb)
+__DO(fast_neg_cache)
+__DO(bio_dedup)
@@ -272,7 +272,7 @@ static inline void dqstats_dec(unsigned int type)
 #define DQ_ACTIVE_B	5	/* dquot is active (dquot_release not called) */
 #define DQ_LASTSET_B	6	/* Following 6 bits (see QIF_) are reserved\
 				 * for the mask of entries set via SETQUOTA\
-				 * quotactl. They are set under dq_data_lock\
+				 * quotactl. They are set under dq_dqb_lock\
 				 * and the quota format handling dquot can\
 				 * clear them when it sees fit. */
 
@@ -282,6 +282,7 @@ struct dquot {
 	struct list_head dq_free;	/* Free list element */
 	struct list_head dq_dirty;	/* List of dirty dquots */
 	struct mutex dq_lock;		/* dquot IO lock */
+	spinlock_t dq_dqb_lock;		/* Lock protecting dq_dqb changes */
 	atomic_t dq_count;		/* Use count */
 	wait_queue_head_t dq_wait_unused;	/* Wait queue for dquot to become unused */
 	struct super_block *dq_sb;	/* superblock this applies to */
@@ -1510,6 +1510,11 @@ struct task_struct {
 	 */
 	struct pipe_inode_info *splice_pipe;
 
+#ifdef CONFIG_EPOLL
+	/* readiness cache for poll(2)/select(2) */
+	struct file *poll_cache;
+#endif
+
 	struct page_frag task_frag;
 
 #ifdef	CONFIG_TASK_DELAY_ACCT
@@ -2141,6 +2146,8 @@ static inline void sched_autogroup_exit(struct signal_struct *sig) { }
 struct cgroup;
 extern int sched_cgroup_set_rate(struct cgroup *cgrp, unsigned long rate);
 extern unsigned long sched_cgroup_get_rate(struct cgroup *cgrp);
+extern int sched_cgroup_set_burst(struct cgroup *cgrp, unsigned long rate);
+extern unsigned long sched_cgroup_get_burst(struct cgroup *cgrp);
 extern int sched_cgroup_set_nr_cpus(struct cgroup *cgrp, unsigned int nr_cpus);
 extern unsigned int sched_cgroup_get_nr_cpus(struct cgroup *cgrp);
 #endif
@@ -2903,6 +2910,7 @@ static inline void set_task_cpu(struct task_struct *p, unsigned int cpu)
 extern unsigned int task_nr_cpus(struct task_struct *p);
 extern unsigned int task_vcpu_id(struct task_struct *p);
 extern unsigned int sysctl_sched_vcpu_hotslice;
+extern unsigned int sysctl_sched_vcpu_affinity;
 extern unsigned int sysctl_sched_cpulimit_scale_cpufreq;
 extern unsigned int sched_cpulimit_scale_cpufreq(unsigned int freq);
 #else
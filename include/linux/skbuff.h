@@ -288,11 +288,17 @@ enum {
  * false on data copy or out of memory error caused by data copy attempt.
  * The ctx field is used to track device context.
  * The desc field is used to track userspace buffer index.
+ * The rest is used by MSG_ZEROCOPY sockets, where every skb sharing the
+ * pinned pages holds a reference, see sock_zerocopy_alloc().
  */
 struct ubuf_info {
 	void (*callback)(struct ubuf_info *, bool zerocopy_success);
 	void *ctx;
 	unsigned long desc;
+	atomic_t refcnt;
+	u32 id;
+	bool zerocopy;
+	bool aborted;
 };
 
 /* This data is invariant across clones and lives at
@@ -700,6 +706,8 @@ extern void kfree_skb(struct sk_buff *skb);
 extern void kfree_skb_list(struct sk_buff *segs);
 extern void skb_tx_error(struct sk_buff *skb);
 extern void consume_skb(struct sk_buff *skb);
+extern void napi_consume_skb(struct sk_buff *skb, int budget);
+extern void napi_skb_free_stolen_head(struct sk_buff *skb);
 extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct kmem_cache *skbuff_head_cache;
 
@@ -730,6 +738,16 @@ static inline struct sk_buff *alloc_skb_head(gfp_t priority)
 
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
 extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, bool zerocopy);
+extern void sock_zerocopy_callback(struct ubuf_info *uarg, bool success);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+				    const char __user *from, int length,
+				    struct ubuf_info *uarg);
+extern int skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig);
+
 extern struct sk_buff *skb_clone(struct sk_buff *skb,
 				 gfp_t priority);
 extern struct sk_buff *skb_copy(const struct sk_buff *skb,
@@ -881,6 +899,22 @@ static inline struct skb_shared_hwtstamps *skb_hwtstamps(struct sk_buff *skb)
 	return &skb_shinfo(skb)->hwtstamps;
 }
 
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+/* Returns the ubuf_info if frags of @skb are pages pinned by MSG_ZEROCOPY */
+static inline struct ubuf_info *skb_zcopy_sock(struct sk_buff *skb)
+{
+	struct ubuf_info *uarg;
+
+	if (likely(!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)))
+		return NULL;
+	uarg = skb_shinfo(skb)->destructor_arg;
+	return uarg->callback == sock_zerocopy_callback ? uarg : NULL;
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1944,8 +1978,29 @@ static inline void skb_orphan(struct sk_buff *skb)
  *	For each frag in the SKB which needs a destructor (i.e. has an
  *	owner) create a copy of that frag and release the original
  *	page by calling the destructor.
+ *
+ *	Pages pinned by MSG_ZEROCOPY are refcounted and the socket is told
+ *	only when the last skb using them is gone, so they can be shared
+ *	by clones and segments as is.
  */
 static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)))
+		return 0;
+	if (skb_zcopy_sock(skb))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
+/**
+ *	skb_orphan_frags_rx - orphan the frags of a buffer being received
+ *	@skb: buffer to orphan frags from
+ *	@gfp_mask: allocation mask for replacement pages
+ *
+ *	Like skb_orphan_frags, but copies MSG_ZEROCOPY pages too: a local
+ *	receiver may hold them for an unbounded time.
+ */
+static inline int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	if (likely(!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)))
 		return 0;
@@ -2464,6 +2519,14 @@ static inline void skb_frag_add_head(struct sk_buff *skb, struct sk_buff *frag)
 #define skb_walk_frags(skb, iter)	\
 	for (iter = skb_shinfo(skb)->frag_list; iter; iter = iter->next)
 
+extern int __skb_wait_for_more_packets(struct sock *sk, int *err,
+				       long *timeo_p,
+				       const struct sk_buff *skb);
+extern struct sk_buff *__skb_try_recv_from_queue(struct sock *sk,
+						 struct sk_buff_head *queue,
+						 unsigned int flags,
+						 int *peeked, int *off,
+						 struct sk_buff **last);
 extern struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 					   int *peeked, int *off, int *err);
 extern struct sk_buff *skb_recv_datagram(struct sock *sk, unsigned flags,
@@ -2489,6 +2552,10 @@ extern int	       skb_copy_datagram_const_iovec(const struct sk_buff *from,
 extern void	       skb_free_datagram(struct sock *sk, struct sk_buff *skb);
 extern void	       skb_free_datagram_locked(struct sock *sk,
 						struct sk_buff *skb);
+extern int	       __skb_kill_datagram(struct sock *sk,
+					   struct sk_buff_head *queue,
+					   struct sk_buff *skb,
+					   unsigned int flags);
 extern int	       skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
 					 unsigned int flags);
 extern __wsum	       skb_checksum(const struct sk_buff *skb, int offset,
@@ -38,6 +38,7 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt __rcu *	cl_xprt;	/* transport */
+	struct rpc_xprt_set __rcu *cl_xprt_set;	/* extra transports */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -65,6 +66,19 @@ struct rpc_clnt {
 	const struct rpc_program *cl_program;
 };
 
+/*
+ * Additional connections to the same server (nconnect), shared by a client
+ * and its clones. Tasks are spread round-robin over cl_xprt and these.
+ */
+struct rpc_xprt_set {
+	atomic_t		count;
+	atomic_t		next;
+	unsigned int		nr;
+	struct rpc_xprt *	xprts[0];
+};
+
+#define RPC_MAX_CONNECT		16
+
 /*
  * General RPC program info
  */
@@ -116,6 +130,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* transports to create */
 };
 
 /* Values for "flags" field */
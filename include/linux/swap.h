@@ -223,7 +223,7 @@ struct swap_info_struct {
 					 * hold swap_lock first.
 					 */
 	RH_KABI_EXTEND(struct plist_node list)		/* entry in swap_active_head */
-	RH_KABI_EXTEND(struct plist_node avail_list)	/* entry in swap_avail_head */
+	RH_KABI_EXTEND(struct plist_node *avail_lists)	/* per-node avail entries */
 };
 
 /* linux/mm/workingset.c */
@@ -312,6 +312,8 @@ extern int __isolate_lru_page(struct page *page, isolate_mode_t mode);
 extern unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem,
 						  unsigned long nr_pages,
 						  gfp_t gfp_mask, bool noswap);
+extern unsigned long try_to_free_mem_cgroup_kmem(struct mem_cgroup *memcg,
+						 gfp_t gfp_mask);
 extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						gfp_t gfp_mask, bool noswap,
 						struct zone *zone,
@@ -75,6 +75,12 @@ struct udp_sock {
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
 	void (*encap_destroy)(struct sock *sk);
+
+	/*
+	 * Datagrams moved off sk_receive_queue in bulk by the reader, so
+	 * that recvmsg() does not contend with softirq enqueue per packet.
+	 */
+	struct sk_buff_head	reader_queue;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
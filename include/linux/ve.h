@@ -21,6 +21,7 @@
 #include <linux/path.h>
 #include <linux/socket.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <linux/ve_proto.h>
 #include <net/inet_frag.h>
 #include <linux/cgroup.h>
@@ -32,6 +33,17 @@ struct veip_struct;
 struct ve_monitor;
 struct nsproxy;
 
+/* How long work waits in the queues of VE's kernel threads */
+struct ve_work_stat {
+	spinlock_t		lock;
+	u64			count;
+	u64			total_lat;	/* ns */
+	u64			max_lat;	/* ns */
+};
+
+/* usermode helpers of a VE are spawned by this many threads */
+#define VE_UMH_WORKERS		4
+
 struct ve_struct {
 	struct cgroup_subsys_state	css;
 
@@ -50,12 +62,24 @@ struct ve_struct {
 	atomic_t		suspend;
 	/* see vzcalluser.h for VE_FEATURE_XXX definitions */
 	__u64			features;
+	/* new private mappings are MADV_MERGEABLE, see ksm_mmap_flags() */
+	int			ksm;
+	/* timer slack given to tasks entering the VE, 0 leaves it as is */
+	unsigned long		timer_slack_ns;
+	/* coarser rounding of timer-wheel timers, see apply_slack() */
+	int			timer_coalesce;
 
 	struct task_struct	*ve_kthread_task;
 	struct kthread_worker	ve_kthread_worker;
+	struct ve_work_stat	ve_kthread_stat;
+
+	struct task_struct	*ve_umh_task[VE_UMH_WORKERS];
+	struct kthread_worker	ve_umh_worker[VE_UMH_WORKERS];
+	atomic_t		ve_umh_next;
+	struct ve_work_stat	ve_umh_stat;
 
-	struct task_struct	*ve_umh_task;
-	struct kthread_worker	ve_umh_worker;
+	/* unbound work done on behalf of the VE, see ve_queue_work() */
+	struct workqueue_struct	*wq;
 
 /* VE's root */
 	struct path		root_path;
@@ -89,6 +113,10 @@ struct ve_struct {
 	u32			jiffies_fixup;
 
 	struct kstat_lat_pcpu_struct	sched_lat_ve;
+	struct kstat_lat_hist_struct __percpu *sched_lat_hist;
+	struct kstat_stall_struct	stall;
+	struct kstat_softirq_pcpu_struct __percpu *rx_softirq;
+	struct ve_stats_pcpu __percpu *stats;	/* see ve_stats.h */
 
 #ifdef CONFIG_INET
 	struct venet_stat       *stat;
@@ -184,6 +212,11 @@ extern struct task_struct *kthread_create_on_node_ve(struct ve_struct *ve,
 	__k;								   \
 })
 
+extern struct kthread_worker *ve_umh_worker(struct ve_struct *ve);
+extern bool ve_queue_work(struct ve_struct *ve, struct work_struct *work);
+extern int ve_wq_set_cpumask(struct ve_struct *ve, const struct cpumask *mask);
+extern void ve_work_account(struct ve_work_stat *stat, u64 queued);
+
 struct subprocess_info;
 extern int call_usermodehelper_fns_ve(struct ve_struct *ve,
 	char *path, char **argv, char **envp, int wait,
@@ -198,6 +231,8 @@ call_usermodehelper_ve(struct ve_struct *ve, char *path, char **argv,
 				       NULL, NULL, NULL);
 }
 void do_update_load_avg_ve(void);
+extern bool ve_sched_cpu_allowed(struct ve_struct *ve, int cpu);
+extern u64 ve_account_softirq_time(struct ve_struct *ve, u64 ns);
 
 extern struct ve_struct *get_ve(struct ve_struct *ve);
 extern void put_ve(struct ve_struct *ve);
@@ -235,6 +270,12 @@ static inline int vz_security_protocol_check(struct net *net, int protocol) { re
 #define get_ve(ve)	(NULL)
 #define put_ve(ve)	do { } while (0)
 
+static inline bool ve_queue_work(struct ve_struct *ve,
+				 struct work_struct *work)
+{
+	return queue_work(system_unbound_wq, work);
+}
+
 static inline void ve_stop_ns(struct pid_namespace *ns) { }
 static inline void ve_exit_ns(struct pid_namespace *ns) { }
 
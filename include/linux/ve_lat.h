@@ -0,0 +1,50 @@
+/*
+ *  include/linux/ve_lat.h
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ */
+
+#ifndef __VE_LAT_H__
+#define __VE_LAT_H__
+
+#include <linux/jump_label.h>
+#include <linux/sched.h>
+#include <uapi/linux/vzstat.h>
+
+struct ve_struct;
+
+#ifdef CONFIG_VE
+extern struct static_key ve_lat_key;
+
+extern void __ve_lat_record(struct ve_struct *ve, int type, u64 lat,
+			    u16 arg);
+
+static inline void ve_lat_record(struct ve_struct *ve, int type, u64 lat,
+				 u16 arg)
+{
+	if (static_key_false(&ve_lat_key))
+		__ve_lat_record(ve, type, lat, arg);
+}
+
+/* Returns 0 when sampling is off, so that ve_lat_end() does nothing */
+static inline u64 ve_lat_start(void)
+{
+	if (static_key_false(&ve_lat_key))
+		return local_clock();
+	return 0;
+}
+
+static inline void ve_lat_end(struct ve_struct *ve, int type, u64 start)
+{
+	if (start)
+		__ve_lat_record(ve, type, local_clock() - start, 0);
+}
+#else
+static inline void ve_lat_record(struct ve_struct *ve, int type, u64 lat,
+				 u16 arg) { }
+static inline u64 ve_lat_start(void) { return 0; }
+static inline void ve_lat_end(struct ve_struct *ve, int type, u64 start) { }
+#endif
+
+#endif /* __VE_LAT_H__ */
@@ -79,6 +79,7 @@ struct ve_hook
 
 	/* Functions are called in ascending priority */
 	int priority;
+	unsigned int flags;
 
 	/* Private part */
 	struct list_head list;
@@ -99,6 +100,12 @@ enum {
 	HOOK_PRIO_FINISHING = INT_MAX,
 };
 
+/*
+ * The hook does not depend on other hooks of the same priority and may
+ * run concurrently with them.  It must not rely on the calling task.
+ */
+#define VE_HOOK_ASYNC		0x1
+
 void *ve_seq_start(struct seq_file *m, loff_t *pos);
 void *ve_seq_next(struct seq_file *m, void *v, loff_t *pos);
 void ve_seq_stop(struct seq_file *m, void *v);
@@ -0,0 +1,43 @@
+/*
+ *  include/linux/ve_stats.h
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ */
+
+#ifndef __VE_STATS_H__
+#define __VE_STATS_H__
+
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/ve.h>
+#include <uapi/linux/vzstat.h>
+
+struct ve_stats_pcpu {
+	u64	stat[VE_STAT_NR];
+	u64	lat_count[VE_LAT_NR];
+	u64	lat_ns[VE_LAT_NR];
+};
+
+#ifdef CONFIG_VE
+extern struct static_key ve_stats_key;
+
+static inline void ve_stat_add(struct ve_struct *ve, int type, u64 val)
+{
+	if (static_key_false(&ve_stats_key))
+		this_cpu_add(ve->stats->stat[type], val);
+}
+
+static inline void ve_stat_lat(struct ve_struct *ve, int type, u64 lat)
+{
+	if (static_key_false(&ve_stats_key)) {
+		this_cpu_inc(ve->stats->lat_count[type]);
+		this_cpu_add(ve->stats->lat_ns[type], lat);
+	}
+}
+#else
+static inline void ve_stat_add(struct ve_struct *ve, int type, u64 val) { }
+static inline void ve_stat_lat(struct ve_struct *ve, int type, u64 lat) { }
+#endif
+
+#endif /* __VE_STATS_H__ */
@@ -13,10 +13,12 @@
 
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/rculist.h>
 #include <uapi/linux/vzcalluser.h>
 #include <linux/veip.h>
 #include <linux/netdevice.h>
 
+/* Initial and minimal size of ip_entry_table, grows with the number of IPs */
 #define VEIP_HASH_SZ 512
 
 struct ve_struct;
@@ -31,13 +33,43 @@ struct ip_entry_struct
 	struct ve_addr_struct	addr;
 	struct ve_struct	*active_env;
 	struct veip_struct	*tgt_veip;
-	struct hlist_node 	ip_hash;
+	/* ip_entry_table::idx tells which one the current table uses */
+	struct hlist_node 	ip_hash[2];
 	union {
 		struct list_head 	ve_list;
 		struct rcu_head		rcu;
 	};
 };
 
+/*
+ * Resizing builds the new table over the other ip_hash node of the
+ * entries, so RCU readers of the old one are not disturbed.
+ */
+struct ip_entry_table
+{
+	unsigned int		size;	/* power of 2 */
+	unsigned int		idx;
+	struct hlist_head	buckets[0];
+};
+
+static inline struct ip_entry_struct *
+ip_entry_of(struct hlist_node *node, unsigned int idx)
+{
+	if (node == NULL)
+		return NULL;
+	return container_of(node - idx, struct ip_entry_struct, ip_hash[0]);
+}
+
+/* Under rcu_read_lock() or veip_lock */
+#define ip_entry_for_each(entry, tbl, bucket)				\
+	for (entry = ip_entry_of(rcu_dereference_raw(			\
+			hlist_first_rcu((tbl)->buckets + (bucket))),	\
+			(tbl)->idx);					\
+	     entry != NULL;						\
+	     entry = ip_entry_of(rcu_dereference_raw(			\
+			hlist_next_rcu(&entry->ip_hash[(tbl)->idx])),	\
+			(tbl)->idx))
+
 struct ext_entry_struct
 {
 	struct list_head	list;
@@ -92,9 +124,15 @@ extern struct list_head veip_lh;
 struct ext_entry_struct *venet_ext_lookup(struct ve_struct *ve,
 		struct ve_addr_struct *addr);
 
-extern struct hlist_head ip_entry_hash_table[];
+extern struct ip_entry_table __rcu *ip_entry_table;
 extern spinlock_t veip_lock;
 
+static inline struct ip_entry_table *ip_entry_table_get(void)
+{
+	return rcu_dereference_check(ip_entry_table,
+			lockdep_is_held(&veip_lock));
+}
+
 extern void (*venet_free_stat)(struct ve_struct *);
 
 #define NIPQUAD(addr) \
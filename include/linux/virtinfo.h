@@ -15,6 +15,11 @@
 #include <linux/page-flags.h>
 #include <linux/notifier.h>
 #include <linux/mmzone.h>
+#include <linux/jump_label.h>
+#ifdef CONFIG_BEANCOUNTERS
+#include <bc/beancounter.h>
+#include <bc/task.h>
+#endif
 
 struct vnotifier_block
 {
@@ -28,8 +33,8 @@ extern struct semaphore virtinfo_sem;
 void __virtinfo_notifier_register(int type, struct vnotifier_block *nb);
 void virtinfo_notifier_register(int type, struct vnotifier_block *nb);
 void virtinfo_notifier_unregister(int type, struct vnotifier_block *nb);
-int virtinfo_notifier_call(int type, unsigned long n, void *data);
-int virtinfo_notifier_call_irq(int type, unsigned long n, void *data);
+int __virtinfo_notifier_call(int type, unsigned long n, void *data);
+int __virtinfo_notifier_call_irq(int type, unsigned long n, void *data);
 
 struct page_info {
 	unsigned long nr_file_dirty;
@@ -84,4 +89,42 @@ enum virt_info_types {
 	VIRT_TYPES
 };
 
+/* enabled while at least one notifier of the type is registered */
+extern struct static_key virtinfo_keys[VIRT_TYPES];
+
+/*
+ * The calls sit in page cache and fault hot paths, so they cost
+ * nothing unless somebody listens.  VITYPE_IO notifiers only act on
+ * beancounters with io limits set, everybody else skips the chain.
+ */
+static inline bool virtinfo_wanted(int type)
+{
+	if (!static_key_false(&virtinfo_keys[type]))
+		return false;
+#ifdef CONFIG_BEANCOUNTERS
+	if (type == VITYPE_IO) {
+		struct user_beancounter *ub = get_exec_ub();
+
+		return ub && test_bit(UB_IO_LIMITED, &ub->ub_flags);
+	}
+#endif
+	return true;
+}
+
+static inline int virtinfo_notifier_call(int type, unsigned long n,
+					 void *data)
+{
+	if (!virtinfo_wanted(type))
+		return NOTIFY_DONE;
+	return __virtinfo_notifier_call(type, n, data);
+}
+
+static inline int virtinfo_notifier_call_irq(int type, unsigned long n,
+					     void *data)
+{
+	if (!virtinfo_wanted(type))
+		return NOTIFY_DONE;
+	return __virtinfo_notifier_call_irq(type, n, data);
+}
+
 #endif /* __LINUX_VIRTINFO_H */
@@ -16,6 +16,18 @@ enum {
 	VE_EVENT_START,
 	VE_EVENT_STOP,
 	VE_EVENT_REBOOT,
+	VE_EVENT_MAX,
 };
 
+/*
+ * Multicast groups of the vzevent netlink socket.  Every message is an
+ * "action@attrs" string.  VZ_EVGRP_ALL gets one message per event, as
+ * it always did.  VZ_EVGRP_BATCH gets the events of a short window
+ * coalesced into one message, the records separated by '\0'.
+ * VZ_EVGRP_TYPE(event) gets only the events of that type.
+ */
+#define VZ_EVGRP_ALL		1
+#define VZ_EVGRP_BATCH		2
+#define VZ_EVGRP_TYPE(event)	(3 + (event))
+
 #endif /* __LINUX_VZ_EVENT_H__ */
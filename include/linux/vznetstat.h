@@ -10,6 +10,10 @@
 
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #define TC_CLASS_MAX	16
 
@@ -29,6 +33,24 @@ struct acct_stat {
 	struct acct_counter cnt[TC_CLASS_MAX][ACCT_MAX];
 };
 
+/*
+ * Egress rate limit of a VE.  Tokens (bytes) are kept in a shared pool,
+ * which is refilled by whoever wins the cmpxchg on the stamp, and every
+ * CPU takes them from the pool by batches into its own cache.  So most
+ * packets only touch per-CPU data and nobody ever spins on a lock.
+ */
+struct venet_rate {
+	u64			rate;	/* bytes per second, 0 - no limit */
+	u64			burst;	/* bytes */
+	u64			batch;	/* bytes taken from the pool at once */
+	atomic64_t		tokens;
+	atomic64_t		stamp;	/* ns of the last refill */
+	s64 __percpu		*cache;
+};
+
+#define VENET_RATE_BATCH_MAX	(64 * 1024)
+#define VENET_RATE_BURST_MIN	(2 * 64 * 1024)
+
 struct venet_stat {
 	struct list_head list;
 	envid_t  veid;
@@ -38,6 +60,8 @@ struct venet_stat {
 
 	struct acct_stat __percpu *ipv4_stat;
 	struct acct_stat __percpu *ipv6_stat;
+	struct venet_rate rate;
+	struct rcu_head rcu;
 };
 
 static inline int venet_acct_skb_size(struct sk_buff *skb)
@@ -65,6 +89,52 @@ void venet_acct_classify_add_incoming_plain(struct venet_stat *stat,
 void venet_acct_classify_add_outgoing_plain(struct venet_stat *stat,
 		struct ve_addr_struct *dst_addr, int data_size);
 
+static inline bool __venet_rate_grab(struct venet_rate *r, s64 *cache,
+				     unsigned int len)
+{
+	s64 now = ktime_to_ns(ktime_get());
+	s64 last = atomic64_read(&r->stamp);
+	u64 want = max_t(u64, len, ACCESS_ONCE(r->batch));
+
+	if (now > last && atomic64_cmpxchg(&r->stamp, last, now) == last) {
+		u64 burst = ACCESS_ONCE(r->burst);
+		s64 tokens;
+
+		tokens = atomic64_add_return(div_u64(ACCESS_ONCE(r->rate) *
+				min_t(s64, now - last, NSEC_PER_SEC),
+				NSEC_PER_SEC), &r->tokens);
+		/* Best effort, overflow by a concurrent grab is harmless */
+		if (tokens > burst)
+			atomic64_cmpxchg(&r->tokens, tokens, burst);
+	}
+
+	if (atomic64_sub_return(want, &r->tokens) < 0) {
+		atomic64_add(want, &r->tokens);
+		return false;
+	}
+	*cache += want - len;
+	return true;
+}
+
+/*
+ * Returns false if the VE is over its egress rate and the packet of @len
+ * bytes should be dropped.  Called from ndo_start_xmit, BHs are disabled.
+ */
+static inline bool venet_rate_allow(struct venet_stat *stat, unsigned int len)
+{
+	s64 *cache;
+
+	if (!stat || likely(!ACCESS_ONCE(stat->rate.rate)))
+		return true;
+
+	cache = this_cpu_ptr(stat->rate.cache);
+	if (*cache >= len) {
+		*cache -= len;
+		return true;
+	}
+	return __venet_rate_grab(&stat->rate, cache, len);
+}
+
 #else /* !CONFIG_VE_NETDEV_ACCOUNTING */
 static inline void venet_acct_get_stat(struct venet_stat *stat) { }
 static inline void venet_acct_put_stat(struct venet_stat *stat) { }
@@ -80,6 +150,11 @@ static inline void venet_acct_classify_add_incoming_plain(struct venet_stat *sta
 		struct ve_addr_struct *src_addr, int data_size) {}
 static inline void venet_acct_classify_add_outgoing_plain(struct venet_stat *stat,
 		struct ve_addr_struct *dst_addr, int data_size) {}
+
+static inline bool venet_rate_allow(struct venet_stat *stat, unsigned int len)
+{
+	return true;
+}
 #endif /* CONFIG_VE_NETDEV_ACCOUNTING */
 
 #endif
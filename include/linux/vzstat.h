@@ -12,6 +12,7 @@
 #define __VZSTAT_H__
 
 #include <linux/mmzone.h>
+#include <uapi/linux/vzstat.h>
 
 struct swap_cache_info_struct {
 	unsigned long add_total;
@@ -41,6 +42,54 @@ struct kstat_lat_pcpu_struct {
 	u64 avg[3];
 };
 
+/*
+ * Log2 histogram of latencies: bucket 0 counts latencies below
+ * 2^KSTAT_LAT_HIST_SHIFT ns, bucket i those below 2^(i + SHIFT) ns,
+ * and the last one all the rest.
+ */
+#define KSTAT_LAT_HIST_SHIFT	10
+#define KSTAT_LAT_HIST_NR	24
+
+struct kstat_lat_hist_struct {
+	unsigned long bucket[KSTAT_LAT_HIST_NR];
+};
+
+enum {
+	KSTAT_STALL_CPU,	/* runnable, waiting for a cpu */
+	KSTAT_STALL_MEM,	/* in direct or memcg reclaim */
+	KSTAT_STALL_IO,		/* waiting for io */
+	KSTAT_STALL_NR,
+};
+
+struct kstat_stall_pcpu_struct {
+	u64 time[KSTAT_STALL_NR];
+};
+
+/*
+ * Time tasks spent stalled, summed over tasks, and its averages over
+ * 10s, 60s and 300s in FIXED_1 units of stalled tasks.
+ */
+struct kstat_stall_struct {
+	struct kstat_stall_pcpu_struct __percpu *cur;
+	spinlock_t lock;		/* protects the rest */
+	u64 last_update;
+	u64 last[KSTAT_STALL_NR];
+	unsigned long avg[KSTAT_STALL_NR][3];
+};
+
+/*
+ * NET_RX softirq time spent delivering packets to a container.  The
+ * softirq runs on behalf of whoever it interrupts, so the container is
+ * charged separately; see __netif_receive_skb().
+ */
+struct kstat_softirq_pcpu_struct {
+	u64 time;			/* total, ns */
+	u64 uncharged;			/* not yet in the cpu cgroup, ns */
+	u64 window_start;		/* of the current throttling window */
+	u64 window_time;		/* spent within the window, ns */
+	unsigned long throttled;	/* packets dropped over the limit */
+};
+
 struct kstat_perf_snap_struct {
 	u64 wall_tottime, cpu_tottime;
 	u64 wall_maxdur, cpu_maxdur;
@@ -80,6 +129,7 @@ struct kernel_stat_glob {
 	unsigned long alloc_fails[NR_CPUS][KSTAT_ALLOCSTAT_NR];
 	struct kstat_lat_pcpu_struct alloc_lat[KSTAT_ALLOCSTAT_NR];
 	struct kstat_lat_pcpu_struct sched_lat;
+	struct kstat_lat_hist_struct __percpu *sched_lat_hist;
 	struct kstat_lat_pcpu_struct page_in;
 	struct kstat_lat_struct swap_in;
 
@@ -115,6 +165,37 @@ extern void KSTAT_LAT_PCPU_ADD(struct kstat_lat_pcpu_struct *p, int cpu, u64 dur
 extern void KSTAT_LAT_UPDATE(struct kstat_lat_struct *p);
 extern void KSTAT_LAT_PCPU_UPDATE(struct kstat_lat_pcpu_struct *p);
 
+struct seq_file;
+
+/* cpu must not change under us, e.g. because rq lock is held */
+static inline void KSTAT_LAT_HIST_ADD(struct kstat_lat_hist_struct __percpu *p,
+		int cpu, u64 dur)
+{
+	int i = fls64(dur >> KSTAT_LAT_HIST_SHIFT);
+
+	if (i >= KSTAT_LAT_HIST_NR)
+		i = KSTAT_LAT_HIST_NR - 1;
+	per_cpu_ptr(p, cpu)->bucket[i]++;
+}
+
+extern void kstat_lat_hist_sum(struct kstat_lat_hist_struct __percpu *p,
+		struct kstat_lat_hist_struct *sum);
+extern void kstat_lat_hist_seq_show(struct seq_file *m,
+		struct kstat_lat_hist_struct __percpu *p);
+
+static inline void KSTAT_STALL_ADD(struct kstat_stall_struct *p, int type,
+		int cpu, u64 dur)
+{
+	per_cpu_ptr(p->cur, cpu)->time[type] += dur;
+}
+
+extern u64 kstat_stall_start(void);
+extern void kstat_stall_end(int type, u64 start);
+extern int kstat_stall_init(struct kstat_stall_struct *p);
+extern void kstat_stall_free(struct kstat_stall_struct *p);
+extern void kstat_stall_seq_show(struct seq_file *m,
+		struct kstat_stall_struct *p);
+
 #else
 #define KSTAT_PERF_ADD(ptr, real_time, cpu_time)
 #define KSTAT_PERF_ENTER(name)
@@ -124,6 +205,10 @@ extern void KSTAT_LAT_PCPU_UPDATE(struct kstat_lat_pcpu_struct *p);
 #define KSTAT_LAT_UPDATE(p)
 #define KSTAT_LAT_PCPU_UPDATE(p)
 #define KSTAT_LAT_PCPU_UPDATE(p)
+#define KSTAT_LAT_HIST_ADD(p, cpu, dur)
+#define KSTAT_STALL_ADD(p, type, cpu, dur)
+static inline u64 kstat_stall_start(void) { return 0; }
+static inline void kstat_stall_end(int type, u64 start) { }
 #endif
 
 #endif /* __VZSTAT_H__ */
@@ -30,7 +30,6 @@
 #ifdef CONFIG_NET_RX_BUSY_POLL
 
 struct napi_struct;
-extern unsigned int sysctl_net_busy_read __read_mostly;
 extern unsigned int sysctl_net_busy_poll __read_mostly;
 
 /* return values from ndo_ll_poll */
@@ -168,6 +168,43 @@ static inline spinlock_t *inet_ehash_lockp(
 	return &hashinfo->ehash_locks[hash & hashinfo->ehash_locks_mask];
 }
 
+/*
+ * Established and timewait sockets of a non-initial namespace are also
+ * linked on a per-namespace list, so that inet_diag dumps issued from a
+ * container walk only the container's own sockets instead of the whole
+ * ehash table.  The host namespace is not tracked: its dumps walk the
+ * table anyway, and its connection setup stays free of the extra lock.
+ *
+ * Both helpers are called under the ehash bucket lock with BH disabled.
+ */
+static inline void inet_ehash_netns_add(struct sock *sk)
+{
+#ifdef CONFIG_NET_NS
+	struct net *net = sock_net(sk);
+
+	if (net_eq(net, &init_net))
+		return;
+
+	spin_lock(&net->ipv4.ehash_sk_lock);
+	hlist_add_head(&sk->sk_netns_node, &net->ipv4.ehash_sk_list);
+	spin_unlock(&net->ipv4.ehash_sk_lock);
+#endif
+}
+
+static inline void inet_ehash_netns_del(struct sock *sk)
+{
+#ifdef CONFIG_NET_NS
+	struct net *net = sock_net(sk);
+
+	if (hlist_unhashed(&sk->sk_netns_node))
+		return;
+
+	spin_lock(&net->ipv4.ehash_sk_lock);
+	hlist_del_init(&sk->sk_netns_node);
+	spin_unlock(&net->ipv4.ehash_sk_lock);
+#endif
+}
+
 static inline int inet_ehash_locks_alloc(struct inet_hashinfo *hashinfo)
 {
 	unsigned int i, size = 256;
@@ -187,6 +187,7 @@ struct neigh_hash_table {
 struct neigh_table {
 	struct neigh_table	*next;
 	int			family;
+	int			index;		/* in netns_neigh */
 	int			entry_size;
 	int			key_len;
 	__u32			(*hash)(const void *pkey,
@@ -208,6 +209,7 @@ struct neigh_table {
 	struct timer_list 	proxy_timer;
 	struct sk_buff_head	proxy_queue;
 	atomic_t		entries;
+	unsigned int		gc_pos;		/* forced gc cursor */
 	rwlock_t		lock;
 	unsigned long		last_rand;
 	struct neigh_statistics	__percpu *stats;
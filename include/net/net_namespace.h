@@ -13,6 +13,7 @@
 #include <net/netns/mib.h>
 #include <net/netns/unix.h>
 #include <net/netns/packet.h>
+#include <net/netns/neigh.h>
 #include <net/netns/ipv4.h>
 #include <net/netns/ipv6.h>
 #include <net/netns/sctp.h>
@@ -56,7 +57,7 @@ struct net {
 
 	struct list_head	list;		/* list of network namespaces */
 	struct list_head	cleanup_list;	/* namespaces on death row */
-	struct list_head	exit_list;	/* Use only net_mutex */
+	struct list_head	exit_list;	/* Use only under net_sem */
 
 	struct user_namespace   *user_ns;	/* Owning user namespace */
 
@@ -93,6 +94,7 @@ struct net {
 	struct netns_core	core;
 	struct netns_mib	mib;
 	struct netns_packet	packet;
+	struct netns_neigh	neigh;
 	struct netns_unix	unx;
 	struct netns_ipv4	ipv4;
 #if IS_ENABLED(CONFIG_IPV6)
@@ -313,6 +315,11 @@ struct pernet_operations {
 	void (*exit_batch)(struct list_head *net_exit_list);
 	int *id;
 	size_t size;
+	/*
+	 * init and exit may run for several namespaces at once, i.e.
+	 * they don't need net_mutex to serialize against each other.
+	 */
+	bool async;
 };
 
 /*
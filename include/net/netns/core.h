@@ -9,6 +9,10 @@ struct netns_core {
 	struct ctl_table_header	*sysctl_hdr;
 
 	int	sysctl_somaxconn;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* default SO_BUSY_POLL of new sockets */
+	unsigned int	sysctl_busy_read;
+#endif
 
 	struct prot_inuse __percpu *inuse;
 };
@@ -41,8 +41,15 @@ struct netns_ipv4 {
 
 	struct sock		**icmp_sk;
 	struct inet_peer_base	*peers;
+	/* established and timewait inet sockets, for inet_diag */
+	struct hlist_head	ehash_sk_list;
+	spinlock_t		ehash_sk_lock;
+
 	struct tcpm_hash_bucket	*tcp_metrics_hash;
 	unsigned int		tcp_metrics_hash_log;
+	spinlock_t		tcp_metrics_lock;
+	unsigned int		tcp_metrics_count;	/* under the lock */
+	unsigned int		tcp_metrics_max;
 	struct netns_frags	frags;
 #ifdef CONFIG_NETFILTER
 	struct xt_table		*iptable_filter;
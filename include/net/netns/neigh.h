@@ -0,0 +1,21 @@
+/*
+ * Neighbour tables accounting in a network namespace
+ */
+#ifndef __NETNS_NEIGH_H__
+#define __NETNS_NEIGH_H__
+
+#include <linux/atomic.h>
+
+enum {
+	NEIGH_ARP_TABLE,
+	NEIGH_ND_TABLE,
+	NEIGH_DN_TABLE,
+	NEIGH_NR_TABLES,
+};
+
+struct netns_neigh {
+	/* entries of this namespace, indexed by neigh_table->index */
+	atomic_t		entries[NEIGH_NR_TABLES];
+};
+
+#endif /* __NETNS_NEIGH_H__ */
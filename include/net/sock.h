@@ -152,6 +152,7 @@ typedef __u64 __bitwise __addrpair;
  *	@skc_nulls_node: main hash linkage for TCP/UDP/UDP-Lite protocol
  *	@skc_tx_queue_mapping: tx queue number for this connection
  *	@skc_refcnt: reference count
+ *	@skc_netns_node: per-namespace list of established sockets
  *
  *	This is the minimal network layer representation of sockets, the header
  *	for struct sock and struct inet_timewait_sock.
@@ -212,6 +213,9 @@ struct sock_common {
 	};
 	int			skc_tx_queue_mapping;
 	atomic_t		skc_refcnt;
+#ifdef CONFIG_NET_NS
+	struct hlist_node	skc_netns_node;
+#endif
 	/* private: */
 	int                     skc_dontcopy_end[0];
 	/* public: */
@@ -235,9 +239,12 @@ struct cg_proto;
   *	@sk_write_queue: Packet sending queue
   *	@sk_omem_alloc: "o" is "option" or "other"
   *	@sk_wmem_queued: persistent queue size
+  *	@sk_zckey: id of the next %MSG_ZEROCOPY send
   *	@sk_forward_alloc: space allocated forward
   *	@sk_napi_id: id of the last napi context to receive data for sk
   *	@sk_ll_usec: usecs to busypoll when there is no data
+  *	@sk_incoming_cpu: record cpu processing incoming packets, for
+  *			  listeners the cpu SO_INCOMING_CPU prefers them on
   *	@sk_allocation: allocation mode
   *	@sk_pacing_rate: Pacing rate (if supported by transport/packet scheduler)
   *	@sk_sndbuf: size of send buffer in bytes
@@ -303,6 +310,7 @@ struct sock {
 #define sk_nulls_node		__sk_common.skc_nulls_node
 #define sk_refcnt		__sk_common.skc_refcnt
 #define sk_tx_queue_mapping	__sk_common.skc_tx_queue_mapping
+#define sk_netns_node		__sk_common.skc_netns_node
 
 #define sk_dontcopy_begin	__sk_common.skc_dontcopy_begin
 #define sk_dontcopy_end		__sk_common.skc_dontcopy_end
@@ -350,6 +358,7 @@ struct sock {
 	unsigned int		sk_ll_usec;
 #endif
 	atomic_t		sk_drops;
+	int			sk_incoming_cpu;
 	int			sk_rcvbuf;
 
 	struct sk_filter __rcu	*sk_filter;
@@ -383,6 +392,7 @@ struct sock {
 				sk_type      : 16;
 	kmemcheck_bitfield_end(flags);
 	int			sk_wmem_queued;
+	u32			sk_zckey;
 	gfp_t			sk_allocation;
 	u32			sk_pacing_rate; /* bytes per second */
 	netdev_features_t	sk_route_caps;
@@ -719,6 +729,7 @@ enum sock_flags {
 		     */
 	SOCK_FILTER_LOCKED, /* Filter cannot be changed anymore */
 	SOCK_SELECT_ERR_QUEUE, /* Wake select on error queue */
+	SOCK_ZEROCOPY, /* MSG_ZEROCOPY sends are allowed */
 };
 
 static inline void sock_copy_flags(struct sock *nsk, struct sock *osk)
@@ -846,6 +857,11 @@ static inline int sk_backlog_rcv(struct sock *sk, struct sk_buff *skb)
 	return sk->sk_backlog_rcv(sk, skb);
 }
 
+static inline void sk_incoming_cpu_update(struct sock *sk)
+{
+	sk->sk_incoming_cpu = raw_smp_processor_id();
+}
+
 static inline void sock_rps_record_flow(const struct sock *sk)
 {
 #ifdef CONFIG_RPS
@@ -1076,6 +1092,11 @@ struct cg_proto {
 	 * for everybody, instead of just for memcg users.
 	 */
 	struct mem_cgroup	*memcg;
+	/*
+	 * Pages charged to memory_allocated and to the memcg, but not yet
+	 * handed out to any socket, see memcg_charge_sock().
+	 */
+	unsigned int __percpu	*stock;
 };
 
 extern int proto_register(struct proto *prot, int alloc_slab);
@@ -1199,21 +1220,13 @@ static inline void memcg_memory_allocated_add(struct cg_proto *prot,
 					      unsigned long amt,
 					      int *parent_status)
 {
-	struct res_counter *fail;
-	int ret;
-
-	memcg_charge_kmem_nofail(prot->memcg, amt << PAGE_SHIFT);
-	ret = res_counter_charge_nofail(prot->memory_allocated,
-					amt << PAGE_SHIFT, &fail);
-	if (ret < 0)
-		*parent_status = OVER_LIMIT;
+	memcg_charge_sock(prot, amt, parent_status);
 }
 
 static inline void memcg_memory_allocated_sub(struct cg_proto *prot,
 					      unsigned long amt)
 {
-	res_counter_uncharge(prot->memory_allocated, amt << PAGE_SHIFT);
-	memcg_uncharge_kmem(prot->memcg, amt << PAGE_SHIFT);
+	memcg_uncharge_sock(prot, amt);
 }
 
 static inline u64 memcg_memory_allocated_read(struct cg_proto *prot)
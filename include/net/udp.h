@@ -234,6 +234,10 @@ extern int udp_push_pending_frames(struct sock *sk);
 extern void udp_flush_pending_frames(struct sock *sk);
 extern int udp_rcv(struct sk_buff *skb);
 extern int udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
+extern struct sk_buff *__skb_recv_udp(struct sock *sk, unsigned int flags,
+				      int *peeked, int *off, int *err);
+extern int udp_skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
+				 unsigned int flags);
 extern int udp_disconnect(struct sock *sk, int flags);
 extern unsigned int udp_poll(struct file *file, struct socket *sock,
 			     poll_table *wait);
@@ -26,6 +26,7 @@ static __inline__ int udplite_getfrag(void *from, char *to, int  offset,
 static inline int udplite_sk_init(struct sock *sk)
 {
 	udp_sk(sk)->pcflag = UDPLITE_BIT;
+	skb_queue_head_init(&udp_sk(sk)->reader_queue);
 	return 0;
 }
 
@@ -0,0 +1,130 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tcache
+
+#if !defined(_TRACE_TCACHE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_TCACHE_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/cleancache.h>
+
+#ifndef _TRACE_TCACHE_DEF
+#define _TRACE_TCACHE_DEF
+enum {
+	TCACHE_EVICT_SHRINK,	/* dropped by the shrinker */
+	TCACHE_EVICT_REUSE,	/* reused for a new page */
+	TCACHE_EVICT_COMPRESS,	/* moved to the compressed tier */
+	TCACHE_EVICT_ZBUD,	/* dropped from the compressed tier */
+	TCACHE_EVICT_SHARED,	/* shared page reference dropped */
+};
+#endif
+
+#define show_tcache_evict_reason(reason)				\
+	__print_symbolic(reason,					\
+		{ TCACHE_EVICT_SHRINK,		"shrink"   },		\
+		{ TCACHE_EVICT_REUSE,		"reuse"    },		\
+		{ TCACHE_EVICT_COMPRESS,	"compress" },		\
+		{ TCACHE_EVICT_ZBUD,		"zbud"     },		\
+		{ TCACHE_EVICT_SHARED,		"shared"   })
+
+DECLARE_EVENT_CLASS(tcache_page,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key,
+		 pgoff_t index, int ret),
+
+	TP_ARGS(pool_id, key, index, ret),
+
+	TP_STRUCT__entry(
+		__field(	int,		pool_id		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	index		)
+		__field(	int,		ret		)
+	),
+
+	TP_fast_assign(
+		__entry->pool_id	= pool_id;
+		__entry->ino		= key->u.ino;
+		__entry->index		= index;
+		__entry->ret		= ret;
+	),
+
+	TP_printk("pool=%d ino=%lu index=%lu ret=%d",
+		__entry->pool_id, (unsigned long)__entry->ino,
+		(unsigned long)__entry->index, __entry->ret)
+);
+
+DEFINE_EVENT(tcache_page, tcache_put_page,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key,
+		 pgoff_t index, int ret),
+
+	TP_ARGS(pool_id, key, index, ret)
+);
+
+DEFINE_EVENT(tcache_page, tcache_get_page,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key,
+		 pgoff_t index, int ret),
+
+	TP_ARGS(pool_id, key, index, ret)
+);
+
+DEFINE_EVENT(tcache_page, tcache_invalidate_page,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key,
+		 pgoff_t index, int ret),
+
+	TP_ARGS(pool_id, key, index, ret)
+);
+
+TRACE_EVENT(tcache_invalidate_inode,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key),
+
+	TP_ARGS(pool_id, key),
+
+	TP_STRUCT__entry(
+		__field(	int,		pool_id		)
+		__field(	ino_t,		ino		)
+	),
+
+	TP_fast_assign(
+		__entry->pool_id	= pool_id;
+		__entry->ino		= key->u.ino;
+	),
+
+	TP_printk("pool=%d ino=%lu",
+		__entry->pool_id, (unsigned long)__entry->ino)
+);
+
+TRACE_EVENT(tcache_evict,
+
+	TP_PROTO(int pool_id, const struct cleancache_filekey *key,
+		 pgoff_t index, int reason),
+
+	TP_ARGS(pool_id, key, index, reason),
+
+	TP_STRUCT__entry(
+		__field(	int,		pool_id		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	index		)
+		__field(	int,		reason		)
+	),
+
+	TP_fast_assign(
+		__entry->pool_id	= pool_id;
+		__entry->ino		= key->u.ino;
+		__entry->index		= index;
+		__entry->reason		= reason;
+	),
+
+	TP_printk("pool=%d ino=%lu index=%lu reason=%s",
+		__entry->pool_id, (unsigned long)__entry->ino,
+		(unsigned long)__entry->index,
+		show_tcache_evict_reason(__entry->reason))
+);
+
+#endif /* _TRACE_TCACHE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
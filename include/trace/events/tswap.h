@@ -0,0 +1,95 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tswap
+
+#if !defined(_TRACE_TSWAP_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_TSWAP_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+#ifndef _TRACE_TSWAP_DEF
+#define _TRACE_TSWAP_DEF
+enum {
+	TSWAP_EVICT_WRITEBACK,	/* moved to swap cache to be written */
+	TSWAP_EVICT_SWAPCACHE,	/* dropped, swap cache has the data */
+};
+#endif
+
+#define show_tswap_evict_reason(reason)					\
+	__print_symbolic(reason,					\
+		{ TSWAP_EVICT_WRITEBACK,	"writeback" },		\
+		{ TSWAP_EVICT_SWAPCACHE,	"swapcache" })
+
+DECLARE_EVENT_CLASS(tswap_page,
+
+	TP_PROTO(unsigned type, pgoff_t offset, int ret),
+
+	TP_ARGS(type, offset, ret),
+
+	TP_STRUCT__entry(
+		__field(	unsigned,	type		)
+		__field(	pgoff_t,	offset		)
+		__field(	int,		ret		)
+	),
+
+	TP_fast_assign(
+		__entry->type		= type;
+		__entry->offset		= offset;
+		__entry->ret		= ret;
+	),
+
+	TP_printk("type=%u offset=%lu ret=%d",
+		__entry->type, (unsigned long)__entry->offset, __entry->ret)
+);
+
+DEFINE_EVENT(tswap_page, tswap_store,
+
+	TP_PROTO(unsigned type, pgoff_t offset, int ret),
+
+	TP_ARGS(type, offset, ret)
+);
+
+DEFINE_EVENT(tswap_page, tswap_load,
+
+	TP_PROTO(unsigned type, pgoff_t offset, int ret),
+
+	TP_ARGS(type, offset, ret)
+);
+
+DEFINE_EVENT(tswap_page, tswap_invalidate_page,
+
+	TP_PROTO(unsigned type, pgoff_t offset, int ret),
+
+	TP_ARGS(type, offset, ret)
+);
+
+TRACE_EVENT(tswap_evict,
+
+	TP_PROTO(unsigned type, pgoff_t offset, unsigned long age, int reason),
+
+	TP_ARGS(type, offset, age, reason),
+
+	TP_STRUCT__entry(
+		__field(	unsigned,	type		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	age		)
+		__field(	int,		reason		)
+	),
+
+	TP_fast_assign(
+		__entry->type		= type;
+		__entry->offset		= offset;
+		__entry->age		= age;
+		__entry->reason		= reason;
+	),
+
+	TP_printk("type=%u offset=%lu age=%ums reason=%s",
+		__entry->type, (unsigned long)__entry->offset,
+		jiffies_to_msecs(__entry->age),
+		show_tswap_evict_reason(__entry->reason))
+);
+
+#endif /* _TRACE_TSWAP_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,37 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ve_lat
+
+#if !defined(_TRACE_VE_LAT_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_VE_LAT_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ve_latency,
+
+	TP_PROTO(unsigned int veid, int type, u64 lat, u16 arg),
+
+	TP_ARGS(veid, type, lat, arg),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	veid	)
+		__field(	int,		type	)
+		__field(	u64,		lat	)
+		__field(	u16,		arg	)
+	),
+
+	TP_fast_assign(
+		__entry->veid	= veid;
+		__entry->type	= type;
+		__entry->lat	= lat;
+		__entry->arg	= arg;
+	),
+
+	TP_printk("veid=%u type=%d lat=%llu arg=%u",
+		  __entry->veid, __entry->type,
+		  (unsigned long long)__entry->lat, __entry->arg)
+);
+
+#endif /* _TRACE_VE_LAT_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
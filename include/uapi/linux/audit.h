@@ -273,6 +273,8 @@
 
 #define AUDIT_FILTERKEY	210
 
+#define AUDIT_VEID	300	/* id of the container of the task */
+
 #define AUDIT_NEGATE			0x80000000
 
 /* These are the supported operators.
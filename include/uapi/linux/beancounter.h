@@ -1,6 +1,8 @@
 #ifndef _UAPI_LINUX_BEANCOUNTER_H
 #define _UAPI_LINUX_BEANCOUNTER_H
 
+#include <linux/types.h>
+
 /*
  * Resource list.
  */
@@ -38,7 +40,8 @@
  */
 #define UB_NUMXTENT		23
 #define UB_SWAPPAGES		24
-#define UB_RESOURCES		25
+#define UB_TCACHEPAGES		25	/* Pages kept in tcache, raw or compressed */
+#define UB_RESOURCES		26
 
 struct ubparm {
 	/*
@@ -55,4 +58,25 @@ struct ubparm {
 	int		max_precharge;	/* maximum percpu resource precharge */
 };
 
+/*
+ * /proc/bc/usage is a sequence of fixed size records, one per beancounter,
+ * so that all of them can be read with one read(2).
+ */
+#define UB_USAGE_NAME_LEN	64
+
+struct ub_usage_res {
+	__u64	held;
+	__u64	maxheld;
+	__u64	barrier;
+	__u64	limit;
+	__u64	failcnt;
+};
+
+struct ub_usage_record {
+	char			name[UB_USAGE_NAME_LEN];
+	__u32			size;		/* of the whole record */
+	__u32			nr_resources;	/* UB_RESOURCES */
+	struct ub_usage_res	res[UB_RESOURCES];
+};
+
 #endif /* _UAPI_LINUX_BEANCOUNTER_H */
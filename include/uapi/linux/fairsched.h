@@ -4,5 +4,8 @@
 #define FAIRSCHED_SET_RATE	0
 #define FAIRSCHED_DROP_RATE	1
 #define FAIRSCHED_GET_RATE	2
+/* Unused cpu time carried over to the next period, in rate units */
+#define FAIRSCHED_SET_BURST	3
+#define FAIRSCHED_GET_BURST	4
 
 #endif /* _UAPI_LINUX_FAIRSCHED_H */
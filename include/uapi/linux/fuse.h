@@ -101,6 +101,9 @@
  *  - add FATTR_CTIME
  *  - add ctime and ctimensec to fuse_setattr_in
  *  - add FUSE_RENAME2 request
+ *  - add FUSE_MAX_PAGES, add max_pages to init_out
+ *  - add FOPEN_CACHE_DIR
+ *  - add FUSE_NOTIFY_INVAL_BATCH
  */
 
 #ifndef _LINUX_FUSE_H
@@ -111,6 +114,7 @@
 #else
 #include <stdint.h>
 #endif
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -203,10 +207,12 @@ struct fuse_file_lock {
  * FOPEN_DIRECT_IO: bypass page cache for this open file
  * FOPEN_KEEP_CACHE: don't invalidate the data cache on open
  * FOPEN_NONSEEKABLE: the file is not seekable
+ * FOPEN_CACHE_DIR: allow caching this directory
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_CACHE_DIR		(1 << 3)
 
 /**
  * INIT request/reply flags
@@ -227,6 +233,7 @@ struct fuse_file_lock {
  * FUSE_DO_READDIRPLUS: do READDIRPLUS (READDIR+LOOKUP in one)
  * FUSE_READDIRPLUS_AUTO: adaptive readdirplus
  * FUSE_ASYNC_DIO: asynchronous direct I/O submission
+ * FUSE_MAX_PAGES: init_out.max_pages contains the max number of req pages
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -244,6 +251,7 @@ struct fuse_file_lock {
 #define FUSE_DO_READDIRPLUS	(1 << 13)
 #define FUSE_READDIRPLUS_AUTO	(1 << 14)
 #define FUSE_ASYNC_DIO		(1 << 15)
+#define FUSE_MAX_PAGES		(1 << 22)
 
 /**
  * CUSE INIT request/reply flags
@@ -365,6 +373,7 @@ enum fuse_notify_code {
 	FUSE_NOTIFY_RETRIEVE = 5,
 	FUSE_NOTIFY_DELETE = 6,
 	FUSE_NOTIFY_INVAL_FILES = 77,
+	FUSE_NOTIFY_INVAL_BATCH = 78,
 	FUSE_NOTIFY_CODE_MAX,
 };
 
@@ -578,6 +587,10 @@ struct fuse_init_out {
 	uint16_t	max_background;
 	uint16_t	congestion_threshold;
 	uint32_t	max_write;
+	uint32_t	time_gran;
+	uint16_t	max_pages;
+	uint16_t	padding;
+	uint32_t	unused[8];
 };
 
 #define CUSE_INIT_INFO_MAX 4096
@@ -713,6 +726,28 @@ struct fuse_notify_inval_entry_out {
 	uint32_t	padding;
 };
 
+/*
+ * FUSE_NOTIFY_INVAL_BATCH is followed by 'count' records.  A record
+ * with zero namelen invalidates inode 'nodeid' like INVAL_INODE does,
+ * otherwise it is followed by the name padded to 8 bytes and
+ * invalidates the entry in directory 'nodeid' like INVAL_ENTRY does.
+ */
+struct fuse_notify_inval_batch_out {
+	uint32_t	count;
+	uint32_t	padding;
+};
+
+struct fuse_notify_inval_rec {
+	uint64_t	nodeid;
+	int64_t		off;
+	int64_t		len;
+	uint32_t	namelen;
+	uint32_t	padding;
+};
+
+#define FUSE_INVAL_REC_SIZE(r) \
+	FUSE_DIRENT_ALIGN(sizeof(struct fuse_notify_inval_rec) + (r)->namelen)
+
 struct fuse_notify_delete_out {
 	uint64_t	parent;
 	uint64_t	child;
@@ -749,4 +784,23 @@ struct fuse_notify_inval_files_out {
 	__u64	ino;
 };
 
+/*
+ * Attach a freshly opened /dev/fuse to the connection of the device
+ * given by fd.  The clone gets a queue of the cpu the caller runs on:
+ * requests submitted on that cpu are read and must be answered
+ * through the devices cloned there, so a daemon thread pinned to the
+ * cpu can serve it without sharing the queue with other threads.
+ */
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, uint32_t)
+
+/*
+ * Non-zero argument switches the device to batched I/O: read() returns
+ * as many whole requests as fit into the buffer, blocking only for the
+ * first one, and write() takes a series of replies and notifications,
+ * each starting with its fuse_out_header.  A write stops at the first
+ * reply that fails and returns the length of those handled before it.
+ * splice keeps transferring one message at a time.
+ */
+#define FUSE_DEV_IOC_BATCH	_IOW(229, 77, uint32_t)
+
 #endif /* _LINUX_FUSE_H */
@@ -36,6 +36,7 @@
 #define TUN_PERSIST 	0x0100	
 #define TUN_VNET_HDR 	0x0200
 #define TUN_TAP_MQ      0x0400
+#define TUN_BATCH	0x0800
 
 /* Ioctl defines */
 #define TUNSETNOCSUM  _IOW('T', 200, int) 
@@ -62,6 +63,7 @@
 /* TUNSETIFF ifr flags */
 #define IFF_TUN		0x0001
 #define IFF_TAP		0x0002
+#define IFF_BATCH	0x0080
 #define IFF_NO_PI	0x1000
 /* This flag has no real effect */
 #define IFF_ONE_QUEUE	0x2000
@@ -88,6 +90,16 @@ struct tun_pi {
 	__be16 proto;
 };
 
+/*
+ * With IFF_BATCH a read() or write() carries several packets.  Each one
+ * is preceded by this header, and is laid out as a single packet would
+ * be otherwise: struct tun_pi unless IFF_NO_PI, the vnet header if
+ * IFF_VNET_HDR, then the frame.  @len covers all of that.
+ */
+struct tun_batch_hdr {
+	__u32	len;
+};
+
 /*
  * Filter spec (used for SETXXFILTER ioctls)
  * This stuff is applicable only to the TAP (Ethernet) devices.
@@ -23,6 +23,7 @@
 #define XENFS_SUPER_MAGIC	0xabba1974
 #define EXT4_SUPER_MAGIC	0xEF53
 #define BTRFS_SUPER_MAGIC	0x9123683E
+#define XFS_SUPER_MAGIC		0x58465342	/* 'XFSB' */
 #define NILFS_SUPER_MAGIC	0x3434
 #define F2FS_SUPER_MAGIC	0xF2F52010
 #define HPFS_SUPER_MAGIC	0xf995e849
@@ -58,11 +58,36 @@ struct vzctl_tc_get_stat_list {
 	int				length;
 };
 
+#define VZ_TC_CLASS_MAX			16
+
+/* Folded counters of one VE, an element of VZCTL_TC_GET_ALL_STAT buffer */
+struct vz_tc_ve_stat {
+	envid_t				veid;
+	__u32				__pad;
+	__u64				incoming[VZ_TC_CLASS_MAX];
+	__u64				outgoing[VZ_TC_CLASS_MAX];
+	__u32				incoming_pkt[VZ_TC_CLASS_MAX];
+	__u32				outgoing_pkt[VZ_TC_CLASS_MAX];
+};
+
+struct vzctl_tc_get_all_stat {
+	struct vz_tc_ve_stat		*stat;
+	int				length;	/* in records */
+};
+
 struct vzctl_tc_set_base {
 	envid_t				veid;
 	__u16				base;
 };
 
+/* Egress rate limit of a VE, rate 0 means no limit */
+struct vzctl_tc_rate {
+	envid_t				veid;
+	__u32				__pad;
+	__u64				rate;	/* bytes per second */
+	__u64				burst;	/* bytes */
+};
+
 #define VZTCCTLTYPE			'='
 #define VZCTL_TC_MAX_CLASS		_IO(VZTCCTLTYPE, 1)
 #define VZCTL_TC_CLASS_NUM		_IO(VZTCCTLTYPE, 2)
@@ -86,6 +111,12 @@ struct vzctl_tc_set_base {
 #define VZCTL_TC_CLEAR_STAT		_IO(VZTCCTLTYPE, 17)
 #define VZCTL_TC_CLEAR_ALL_STAT		_IO(VZTCCTLTYPE, 18)
 
+#define VZCTL_TC_GET_ALL_STAT		_IOR(VZTCCTLTYPE, 19, struct vzctl_tc_get_all_stat)
+#define VZCTL_TC_GET_ALL_STAT_V6	_IOR(VZTCCTLTYPE, 20, struct vzctl_tc_get_all_stat)
+
+#define VZCTL_TC_SET_RATE		_IOW(VZTCCTLTYPE, 21, struct vzctl_tc_rate)
+#define VZCTL_TC_GET_RATE		_IOWR(VZTCCTLTYPE, 22, struct vzctl_tc_rate)
+
 #ifdef __KERNEL__
 #ifdef CONFIG_COMPAT
 #include <linux/compat.h>
@@ -109,10 +140,17 @@ struct compat_vzctl_tc_get_stat_list {
 	int				length;
 };
 
+struct compat_vzctl_tc_get_all_stat {
+	compat_uptr_t			stat;
+	int				length;
+};
+
 #define COMPAT_VZCTL_TC_SET_CLASS_TABLE	_IOW(VZTCCTLTYPE, 3, struct compat_vzctl_tc_classes)
 #define COMPAT_VZCTL_TC_GET_CLASS_TABLE	_IOR(VZTCCTLTYPE, 4, struct compat_vzctl_tc_classes)
 #define COMPAT_VZCTL_TC_GET_STAT_LIST	_IOR(VZTCCTLTYPE, 6, struct compat_vzctl_tc_get_stat_list)
 #define COMPAT_VZCTL_TC_GET_STAT	_IOR(VZTCCTLTYPE, 7, struct compat_vzctl_tc_get_stat)
+#define COMPAT_VZCTL_TC_GET_ALL_STAT	_IOR(VZTCCTLTYPE, 19, struct compat_vzctl_tc_get_all_stat)
+#define COMPAT_VZCTL_TC_GET_ALL_STAT_V6	_IOR(VZTCCTLTYPE, 20, struct compat_vzctl_tc_get_all_stat)
 #endif /* CONFIG_COMPAT */
 #endif /* __KERNEL__ */
 
@@ -37,10 +37,31 @@ struct vzlist_veipctl {
 	void __user	*ip;
 };
 
+/*
+ * Per task summary, so that monitoring does not have to walk /proc of
+ * a VE pid by pid.  Times are in nanoseconds, rss is in pages.
+ */
+struct vzlist_vetask {
+	pid_t		pid;		/* in the host pid namespace */
+	pid_t		vpid;		/* in the VE pid namespace */
+	pid_t		tgid;		/* in the host pid namespace */
+	__u32		state;		/* task state or exit state bits */
+	__u64		utime;
+	__u64		stime;
+	__u64		rss;
+};
+
+struct vzlist_vetaskctl {
+	envid_t		veid;
+	unsigned int	num;
+	struct vzlist_vetask __user *task;
+};
+
 #define VZLISTTYPE		'x'
 #define VZCTL_GET_VEIDS		_IOR(VZLISTTYPE, 1, struct vzlist_veidctl)
 #define VZCTL_GET_VEPIDS	_IOR(VZLISTTYPE, 2, struct vzlist_vepidctl)
 #define VZCTL_GET_VEIPS		_IOR(VZLISTTYPE, 3, struct vzlist_veipctl)
 #define VZCTL_GET_VEIP6S	_IOR(VZLISTTYPE, 4, struct vzlist_veipctl)
+#define VZCTL_GET_VETASKS	_IOR(VZLISTTYPE, 5, struct vzlist_vetaskctl)
 
 #endif /* _UAPI_LINUX_VZLIST_H */
@@ -0,0 +1,149 @@
+#ifndef _UAPI_LINUX_VZSTAT_H
+#define _UAPI_LINUX_VZSTAT_H
+
+#include <linux/types.h>
+
+/*
+ * /proc/vz/kstat is one fixed size record with the counters of
+ * /proc/vz/latency and /proc/vz/mmperf, so that monitoring agents
+ * get them with one read(2) and no parsing.
+ */
+#define VZ_KSTAT_VERSION	1
+
+#define VZ_KSTAT_ALLOC_NR	5	/* atomic, low, high, lowmp, highmp */
+#define VZ_KSTAT_HIST_NR	24
+
+struct vz_kstat_lat {
+	__u64	maxlat;
+	__u64	totlat;
+	__u64	count;
+	__u64	avg[3];		/* 1, 5 and 15 minutes */
+};
+
+struct vz_kstat_perf {
+	__u64	count;
+	__u64	cpu_maxdur;
+	__u64	wall_maxdur;
+	__u64	cpu_tottime;
+	__u64	wall_tottime;
+};
+
+struct vz_kstat_record {
+	__u32			size;		/* of the whole record */
+	__u32			version;	/* VZ_KSTAT_VERSION */
+
+	struct vz_kstat_lat	sched_lat;
+	struct vz_kstat_lat	alloc_lat[VZ_KSTAT_ALLOC_NR];
+	struct vz_kstat_lat	swap_in;
+	struct vz_kstat_lat	page_in;
+	/* bucket i counts latencies below 2^(i + 10) ns, the last the rest */
+	__u64			sched_lat_hist[VZ_KSTAT_HIST_NR];
+
+	struct vz_kstat_perf	ttfp;
+	struct vz_kstat_perf	cache_reap;
+	struct vz_kstat_perf	refill_inact;
+	struct vz_kstat_perf	shrink_icache;
+	struct vz_kstat_perf	shrink_dcache;
+};
+
+/*
+ * /proc/vz/latency_ring: per-cpu rings of per-container latency
+ * samples.  read(2) returns struct ve_lat_info.  The ring of cpu N is
+ * mmap(2)ed read-only at offset N * region_size: one header page
+ * (struct ve_lat_ring_hdr) followed by nr_samples samples.
+ *
+ * The kernel writes sample (head & (nr_samples - 1)) with seq = 0,
+ * fills it in, then sets seq = head + 1 and bumps head.  A reader
+ * copies a sample and keeps it only if seq did not change meanwhile.
+ */
+#define VE_LAT_VERSION		1
+
+enum {
+	VE_LAT_FORK,		/* copy_process() */
+	VE_LAT_EXEC,		/* execve() */
+	VE_LAT_FAULT,		/* handle_mm_fault() */
+	VE_LAT_MEMCG_RECLAIM,	/* memcg charge reclaim */
+	VE_LAT_PLOOP_IO,	/* ploop request, arg is the ploop minor */
+	VE_LAT_NET_RX,		/* NET_RX delivery, arg is the ifindex */
+	VE_LAT_NR,
+};
+
+struct ve_lat_info {
+	__u32	version;	/* VE_LAT_VERSION */
+	__u32	nr_cpus;
+	__u32	region_size;	/* bytes mapped per cpu */
+	__u32	nr_samples;	/* per cpu, a power of two */
+};
+
+struct ve_lat_ring_hdr {
+	__u64	head;		/* samples ever written */
+	__u32	cpu;
+	__u32	data_offset;	/* of the first sample in the region */
+};
+
+struct ve_lat_sample {
+	__u64	seq;
+	__u64	time;		/* local_clock() at completion, ns */
+	__u64	lat;		/* ns */
+	__u32	veid;
+	__u16	type;		/* VE_LAT_* */
+	__u16	arg;
+};
+
+/*
+ * /proc/vz/stats_ring: periodic snapshots of per-container counters.
+ * read(2) returns struct ve_stats_info, mmap(2) at offset 0 maps the
+ * ring read-only: one header page (struct ve_stats_ring_hdr) followed
+ * by nr_entries entries.
+ *
+ * Every interval_ms the kernel sums the per-cpu counters of each
+ * running container and writes one entry per container, all of them
+ * bearing the same period; hdr->period is bumped when the snapshot is
+ * complete.  Entries are written the same way as latency samples:
+ * seq = 0, data, seq = head + 1, head++.  Counters are cumulative
+ * since the container start, a reader diffs two periods.  lat_count
+ * and lat_ns sum everything passed to the latency rings above, so they
+ * stay zero when those are disabled.  CPU time is taken from the
+ * container's cpu cgroup and is zero for the host (veid 0).
+ */
+#define VE_STATS_VERSION	1
+
+enum {
+	VE_STAT_CPU_USER,	/* ns, user and nice */
+	VE_STAT_CPU_SYSTEM,	/* ns */
+	VE_STAT_MEM_CHARGED,	/* pages charged to memory cgroups */
+	VE_STAT_BLK_READ,	/* bytes submitted by submit_bio() */
+	VE_STAT_BLK_WRITE,
+	VE_STAT_NET_RX_PKTS,	/* delivered to the container's devices */
+	VE_STAT_NET_RX_BYTES,
+	VE_STAT_NET_TX_PKTS,	/* queued to the container's devices */
+	VE_STAT_NET_TX_BYTES,
+	VE_STAT_NR,
+};
+
+struct ve_stats_info {
+	__u32	version;	/* VE_STATS_VERSION */
+	__u32	interval_ms;
+	__u32	region_size;	/* bytes to map */
+	__u32	nr_entries;	/* a power of two */
+};
+
+struct ve_stats_ring_hdr {
+	__u64	head;		/* entries ever written */
+	__u64	period;		/* snapshots completed */
+	__u32	data_offset;	/* of the first entry in the region */
+	__u32	entry_size;	/* sizeof(struct ve_stats_entry) */
+};
+
+struct ve_stats_entry {
+	__u64	seq;
+	__u64	time;		/* ktime_get() of the snapshot, ns */
+	__u64	period;
+	__u32	veid;
+	__u32	__pad;
+	__u64	stat[VE_STAT_NR];
+	__u64	lat_count[VE_LAT_NR];
+	__u64	lat_ns[VE_LAT_NR];
+};
+
+#endif /* _UAPI_LINUX_VZSTAT_H */
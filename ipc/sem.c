@@ -112,6 +112,7 @@ struct sem_queue {
 	struct sembuf		*sops;	 /* array of pending operations */
 	int			nsops;	 /* number of operations */
 	int			alter;	 /* does *sops alter the array? */
+	int			complex; /* queued on the global lists */
 };
 
 /* Each task has a list of undo requests. They are executed automatically
@@ -278,7 +279,30 @@ static void sem_wait_array(struct sem_array *sma)
 }
 
 /*
- * If the request contains only one semaphore operation, and there are
+ * A semop request is simple if all its operations target the same
+ * semaphore and either all of them wait-for-zero or none of them do.
+ * Such a request behaves like a single sop: if it can proceed at some
+ * semval, it can proceed at any larger one.  This lets e.g. the
+ * { -1, +1 } sequences used by databases use the per-semaphore lock.
+ */
+static bool sem_ops_simple(struct sembuf *sops, int nsops)
+{
+	int i, zero = 0;
+
+	if (!sops || nsops < 1)
+		return false;
+
+	for (i = 0; i < nsops; i++) {
+		if (sops[i].sem_num != sops[0].sem_num)
+			return false;
+		if (sops[i].sem_op == 0)
+			zero++;
+	}
+	return zero == 0 || zero == nsops;
+}
+
+/*
+ * If the request is simple (see sem_ops_simple()), and there are
  * no complex transactions pending, lock only the semaphore involved.
  * Otherwise, lock the entire semaphore array, since we either have
  * multiple semaphores in our own semops, or we need to look at
@@ -289,7 +313,7 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 {
 	struct sem *sem;
 
-	if (nsops != 1) {
+	if (!sem_ops_simple(sops, nsops)) {
 		/* Complex operation - acquire a full lock */
 		ipc_lock_object(&sma->sem_perm);
 
@@ -707,7 +731,7 @@ static void wake_up_sem_queue_do(struct list_head *pt)
 static void unlink_queue(struct sem_array *sma, struct sem_queue *q)
 {
 	list_del(&q->list);
-	if (q->nsops > 1)
+	if (q->complex)
 		sma->complex_count--;
 }
 
@@ -1850,7 +1874,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	/*
 	 * We eventually might perform the following check in a lockless
 	 * fashion, considering ipc_valid_object() locking constraints.
-	 * If nsops == 1 and there is no contention for sem_perm.lock, then
+	 * If sops are simple and sem_perm.lock is not contended, then
 	 * only a per-semaphore lock is held and it's OK to proceed with the
 	 * check below. More details on the fine grained locking scheme
 	 * entangled here and why it's RMID race safe on comments at sem_lock()
@@ -1890,8 +1914,9 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
+	queue.complex = !sem_ops_simple(sops, nsops);
 
-	if (nsops == 1) {
+	if (!queue.complex) {
 		struct sem *curr;
 		curr = &sma->sem_base[sops->sem_num];
 
@@ -261,6 +261,13 @@ extern struct list_head audit_filter_list[];
 
 extern struct audit_entry *audit_dupe_rule(struct audit_krule *old);
 
+#ifdef CONFIG_AUDITSYSCALL
+/* Union of the syscall masks of all rules of each list */
+extern u32 audit_list_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+extern void audit_compile_rules(void);
+extern bool audit_task_wanted(struct task_struct *tsk);
+#endif
+
 /* audit watch functions */
 #ifdef CONFIG_AUDIT_WATCH
 extern void audit_put_watch(struct audit_watch *watch);
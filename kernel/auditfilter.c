@@ -29,6 +29,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/security.h>
+#include <linux/ve.h>
 #include "audit.h"
 
 /*
@@ -67,6 +68,25 @@ static struct list_head audit_rules_list[AUDIT_NR_FILTERS] = {
 
 DEFINE_MUTEX(audit_filter_mutex);
 
+#ifdef CONFIG_AUDITSYSCALL
+u32 audit_list_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
+/*
+ * The containers syscall rules may apply to.  A rule is scoped to a
+ * container by a "veid=" field, anything else may match any task.
+ * NULL means all containers; that is also the state before the first
+ * rule is added.
+ */
+struct audit_ve_scope {
+	struct rcu_head rcu;
+	bool all;
+	int nr;
+	envid_t veids[];
+};
+
+static struct audit_ve_scope __rcu *audit_ve_scope;
+#endif
+
 static inline void audit_free_rule(struct audit_entry *e)
 {
 	int i;
@@ -344,6 +364,7 @@ static int audit_field_valid(struct audit_entry *entry, struct audit_field *f)
 	case AUDIT_EXIT:
 	case AUDIT_SUCCESS:
 	case AUDIT_INODE:
+	case AUDIT_VEID:
 		/* bit ops are only useful on syscall args */
 		if (f->op == Audit_bitmask || f->op == Audit_bittest)
 			return -EINVAL;
@@ -840,6 +861,109 @@ out:
 	return found;
 }
 
+#ifdef CONFIG_AUDITSYSCALL
+static bool audit_rule_veid(struct audit_krule *rule, envid_t *veid)
+{
+	int i;
+
+	for (i = 0; i < rule->field_count; i++) {
+		struct audit_field *f = &rule->fields[i];
+
+		if (f->type == AUDIT_VEID && f->op == Audit_equal) {
+			*veid = f->val;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void audit_scope_add(struct audit_ve_scope *scope,
+			    struct list_head *list)
+{
+	struct audit_krule *r;
+	envid_t veid;
+
+	list_for_each_entry(r, list, list)
+		if (audit_rule_veid(r, &veid))
+			scope->veids[scope->nr++] = veid;
+}
+
+/*
+ * Recompute what the syscall paths need to know about the rule lists
+ * without walking them: which syscalls any rule of a list is interested
+ * in, and which containers the syscall rules may apply to.
+ */
+void audit_compile_rules(void)
+{
+	struct audit_ve_scope *scope, *old;
+	struct audit_krule *r;
+	int i, w, nr = 0;
+	bool all = false;
+	envid_t veid;
+
+	lockdep_assert_held(&audit_filter_mutex);
+
+	for (i = 0; i < AUDIT_NR_FILTERS; i++) {
+		u32 mask[AUDIT_BITMASK_SIZE] = { 0 };
+
+		list_for_each_entry(r, &audit_rules_list[i], list) {
+			for (w = 0; w < AUDIT_BITMASK_SIZE; w++)
+				mask[w] |= r->mask[w];
+			if (i != AUDIT_FILTER_ENTRY && i != AUDIT_FILTER_EXIT)
+				continue;
+			if (audit_rule_veid(r, &veid))
+				nr++;
+			else
+				all = true;
+		}
+		for (w = 0; w < AUDIT_BITMASK_SIZE; w++)
+			ACCESS_ONCE(audit_list_mask[i][w]) = mask[w];
+	}
+
+	/* On failure leave everybody audited */
+	scope = kmalloc(sizeof(*scope) + nr * sizeof(envid_t), GFP_KERNEL);
+	if (scope) {
+		scope->all = all;
+		scope->nr = 0;
+		audit_scope_add(scope, &audit_rules_list[AUDIT_FILTER_ENTRY]);
+		audit_scope_add(scope, &audit_rules_list[AUDIT_FILTER_EXIT]);
+	}
+
+	old = rcu_dereference_protected(audit_ve_scope,
+			lockdep_is_held(&audit_filter_mutex));
+	rcu_assign_pointer(audit_ve_scope, scope);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+/*
+ * Whether a new task may be matched by any syscall rule.  Host tasks
+ * always are, so that e.g. LSM records keep their syscall context.
+ */
+bool audit_task_wanted(struct task_struct *tsk)
+{
+#ifdef CONFIG_VE
+	struct audit_ve_scope *scope;
+	struct ve_struct *ve = tsk->task_ve;
+	bool wanted;
+	int i;
+
+	if (ve_is_super(ve))
+		return true;
+
+	rcu_read_lock();
+	scope = rcu_dereference(audit_ve_scope);
+	wanted = !scope || scope->all;
+	for (i = 0; !wanted && i < scope->nr; i++)
+		wanted = scope->veids[i] == ve->veid;
+	rcu_read_unlock();
+	return wanted;
+#else
+	return true;
+#endif
+}
+#endif
+
 static u64 prio_low = ~0ULL/2;
 static u64 prio_high = ~0ULL/2 - 1;
 
@@ -911,6 +1035,8 @@ static inline int audit_add_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals++;
+
+	audit_compile_rules();
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
@@ -963,6 +1089,8 @@ static inline int audit_del_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals--;
+
+	audit_compile_rules();
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
@@ -69,6 +69,7 @@
 #include <linux/capability.h>
 #include <linux/fs_struct.h>
 #include <linux/compat.h>
+#include <linux/ve.h>
 
 #include "audit.h"
 
@@ -459,6 +460,12 @@ static int audit_filter_rules(struct task_struct *tsk,
 			pid = task_pid_nr(tsk);
 			result = audit_comparator(pid, f->op, f->val);
 			break;
+#ifdef CONFIG_VE
+		case AUDIT_VEID:
+			result = audit_comparator(tsk->task_ve->veid,
+						  f->op, f->val);
+			break;
+#endif
 		case AUDIT_PPID:
 			if (ctx) {
 				if (!ctx->ppid)
@@ -723,7 +730,7 @@ static enum audit_state audit_filter_task(struct task_struct *tsk, char **key)
 	return AUDIT_BUILD_CONTEXT;
 }
 
-static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
+static int audit_mask_test(const u32 *mask, unsigned long val)
 {
 	int word, bit;
 
@@ -736,7 +743,12 @@ static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
 
 	bit = AUDIT_BIT(val);
 
-	return rule->mask[word] & bit;
+	return ACCESS_ONCE(mask[word]) & bit;
+}
+
+static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
+{
+	return audit_mask_test(rule->mask, val);
 }
 
 /* At syscall entry and exit time, this filter is called if the
@@ -746,14 +758,19 @@ static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
  */
 static enum audit_state audit_filter_syscall(struct task_struct *tsk,
 					     struct audit_context *ctx,
-					     struct list_head *list)
+					     int listnr)
 {
+	struct list_head *list = &audit_filter_list[listnr];
 	struct audit_entry *e;
 	enum audit_state state;
 
 	if (audit_pid && tsk->tgid == audit_pid)
 		return AUDIT_DISABLED;
 
+	/* No rule of the list looks at this syscall */
+	if (!audit_mask_test(audit_list_mask[listnr], ctx->major))
+		return AUDIT_BUILD_CONTEXT;
+
 	rcu_read_lock();
 	if (!list_empty(list)) {
 		list_for_each_entry_rcu(e, list, list) {
@@ -846,7 +863,7 @@ static inline struct audit_context *audit_get_context(struct task_struct *tsk,
 		context->return_code  = return_code;
 
 	if (context->in_syscall && !context->dummy) {
-		audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_EXIT]);
+		audit_filter_syscall(tsk, context, AUDIT_FILTER_EXIT);
 		audit_filter_inodes(tsk, context);
 	}
 
@@ -918,6 +935,12 @@ int audit_alloc(struct task_struct *tsk)
 		return 0; /* Return if not auditing. */
 
 	state = audit_filter_task(tsk, &key);
+	/*
+	 * Tasks of containers no syscall rule applies to take the fast
+	 * syscall path.  A task rule asking for a record still wins.
+	 */
+	if (state == AUDIT_BUILD_CONTEXT && !audit_task_wanted(tsk))
+		state = AUDIT_DISABLED;
 	if (state == AUDIT_DISABLED) {
 		clear_tsk_thread_flag(tsk, TIF_SYSCALL_AUDIT);
 		return 0;
@@ -1453,7 +1476,7 @@ void __audit_syscall_entry(int major, unsigned long a1, unsigned long a2,
 	context->dummy = !audit_n_rules;
 	if (!context->dummy && state == AUDIT_BUILD_CONTEXT) {
 		context->prio = 0;
-		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_ENTRY]);
+		state = audit_filter_syscall(tsk, context, AUDIT_FILTER_ENTRY);
 	}
 	if (state == AUDIT_DISABLED)
 		return;
@@ -0,0 +1,428 @@
+/*
+ *  kernel/bc/bc_bench.c
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ *  Charge path microbenchmark: times charge/uncharge of every beancounter
+ *  resource and a memcg kmem charge from 1..N CPUs at once and reports
+ *  ns/op and cache misses/op.
+ *
+ *  Run it with "echo 1 > /sys/module/bc_bench/parameters/run" or boot with
+ *  bc_bench.run=1. Results go to the kernel log.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/memcontrol.h>
+#include <linux/perf_event.h>
+
+#include <bc/beancounter.h>
+
+enum {
+	BC_BENCH_CHARGE,	/* charge_beancounter(), always locked */
+	BC_BENCH_FAST,		/* charge_beancounter_fast(), percpu stock */
+	BC_BENCH_PRECHARGE,	/* precharge_beancounter() + fast charge */
+	BC_BENCH_MEMCG_KMEM,	/* memcg_charge_kmem() of one page */
+	BC_BENCH_NR_OPS,
+};
+
+static const char *bc_bench_op_names[BC_BENCH_NR_OPS] = {
+	[BC_BENCH_CHARGE]	= "charge",
+	[BC_BENCH_FAST]		= "fast",
+	[BC_BENCH_PRECHARGE]	= "precharge",
+	[BC_BENCH_MEMCG_KMEM]	= "memcg_kmem",
+};
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0644);
+MODULE_PARM_DESC(iterations, "Charge/uncharge pairs per CPU and test");
+
+static unsigned int max_cpus;
+module_param(max_cpus, uint, 0644);
+MODULE_PARM_DESC(max_cpus, "Highest CPU count to scale to (0 - all online)");
+
+struct bc_bench_thread {
+	struct task_struct	*task;
+	u64			ns;
+	u64			misses;
+	bool			have_misses;
+	int			err;
+};
+
+static struct user_beancounter *bench_ub;
+static struct mem_cgroup *bench_memcg;
+static int bench_op, bench_resource;
+
+static atomic_t bench_ready;
+static atomic_t bench_running;
+static bool bench_go;
+static DECLARE_WAIT_QUEUE_HEAD(bench_wq);
+static DECLARE_COMPLETION(bench_done);
+
+static DEFINE_MUTEX(bench_mutex);
+static bool bench_initialized, bench_requested;
+
+/* These are accounted by memcg, their held values are synced from it */
+static bool bc_bench_skip_resource(int resource)
+{
+	if (!strcmp(ub_rnames[resource], "dummy"))
+		return true;
+
+	switch (resource) {
+	case UB_KMEMSIZE:
+	case UB_DCACHESIZE:
+	case UB_PHYSPAGES:
+	case UB_SWAPPAGES:
+	case UB_OOMGUARPAGES:
+	case UB_NUMTCPSOCK:
+	case UB_TCPSNDBUF:
+	case UB_TCPRCVBUF:
+	case UB_OTHERSOCKBUF:
+	case UB_DGRAMRCVBUF:
+	case UB_NUMOTHERSOCK:
+		return true;
+	}
+	return false;
+}
+
+static const char *bc_bench_res_name(int op, int resource)
+{
+	return op == BC_BENCH_MEMCG_KMEM ? "-" : ub_rnames[resource];
+}
+
+static int bc_bench_one(int op, int resource)
+{
+	struct user_beancounter *ub = bench_ub;
+	int err;
+
+	switch (op) {
+	case BC_BENCH_CHARGE:
+		err = charge_beancounter(ub, resource, 1, UB_FORCE);
+		if (!err)
+			uncharge_beancounter(ub, resource, 1);
+		break;
+	case BC_BENCH_PRECHARGE:
+		err = precharge_beancounter(ub, resource, 1);
+		if (err)
+			break;
+		/* fall through */
+	case BC_BENCH_FAST:
+		err = charge_beancounter_fast(ub, resource, 1, UB_FORCE);
+		if (!err)
+			uncharge_beancounter_fast(ub, resource, 1);
+		break;
+	case BC_BENCH_MEMCG_KMEM:
+		err = memcg_charge_kmem(bench_memcg, GFP_KERNEL, PAGE_SIZE);
+		if (!err)
+			memcg_uncharge_kmem(bench_memcg, PAGE_SIZE);
+		break;
+	default:
+		BUG();
+	}
+	return err;
+}
+
+#ifdef CONFIG_PERF_EVENTS
+static struct perf_event *bc_bench_counter_create(void)
+{
+	struct perf_event_attr attr = {
+		.type		= PERF_TYPE_HARDWARE,
+		.config		= PERF_COUNT_HW_CACHE_MISSES,
+		.size		= sizeof(attr),
+		.pinned		= 1,
+	};
+	struct perf_event *event;
+
+	event = perf_event_create_kernel_counter(&attr, -1, current,
+						 NULL, NULL);
+	return IS_ERR(event) ? NULL : event;
+}
+
+static u64 bc_bench_counter_read(struct perf_event *event)
+{
+	u64 enabled, running;
+
+	return perf_event_read_value(event, &enabled, &running);
+}
+
+static void bc_bench_counter_release(struct perf_event *event)
+{
+	perf_event_release_kernel(event);
+}
+#else
+struct perf_event;
+
+static inline struct perf_event *bc_bench_counter_create(void)
+{
+	return NULL;
+}
+
+static inline u64 bc_bench_counter_read(struct perf_event *event)
+{
+	return 0;
+}
+
+static inline void bc_bench_counter_release(struct perf_event *event) { }
+#endif
+
+static int bc_bench_thread_fn(void *data)
+{
+	struct bc_bench_thread *th = data;
+	struct perf_event *event;
+	u64 start, misses = 0;
+	unsigned int i;
+
+	event = bc_bench_counter_create();
+
+	/* Start all CPUs at once, so that they contend for real */
+	atomic_inc(&bench_ready);
+	wake_up_all(&bench_wq);
+	wait_event(bench_wq, ACCESS_ONCE(bench_go));
+
+	if (event)
+		misses = bc_bench_counter_read(event);
+	start = local_clock();
+	for (i = 0; i < iterations; i++) {
+		th->err = bc_bench_one(bench_op, bench_resource);
+		if (th->err)
+			break;
+		if (!(i & 1023))
+			cond_resched();
+	}
+	th->ns = local_clock() - start;
+	if (event) {
+		th->misses = bc_bench_counter_read(event) - misses;
+		th->have_misses = true;
+		bc_bench_counter_release(event);
+	}
+
+	if (atomic_dec_and_test(&bench_running))
+		complete(&bench_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int bc_bench_run(struct bc_bench_thread *threads, int nr_cpus)
+{
+	struct bc_bench_thread *th;
+	u64 ns = 0, misses = 0;
+	bool have_misses = true;
+	const char *name;
+	int cpu, i, err = 0;
+
+	memset(threads, 0, nr_cpus * sizeof(*threads));
+	atomic_set(&bench_ready, 0);
+	atomic_set(&bench_running, nr_cpus);
+	bench_go = false;
+	reinit_completion(&bench_done);
+
+	get_online_cpus();
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == nr_cpus)
+			break;
+		th = &threads[i];
+		th->task = kthread_create_on_node(bc_bench_thread_fn, th,
+						  cpu_to_node(cpu),
+						  "bc_bench/%d", cpu);
+		if (IS_ERR(th->task)) {
+			err = PTR_ERR(th->task);
+			th->task = NULL;
+			break;
+		}
+		kthread_bind(th->task, cpu);
+		i++;
+	}
+	if (i < nr_cpus) {
+		if (!err)
+			err = -ENODEV;
+		/* Threads that were never woken exit on kthread_stop() */
+		for (i = 0; i < nr_cpus && threads[i].task; i++)
+			kthread_stop(threads[i].task);
+		goto out;
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		wake_up_process(threads[i].task);
+	wait_event(bench_wq, atomic_read(&bench_ready) == nr_cpus);
+	bench_go = true;
+	wake_up_all(&bench_wq);
+	wait_for_completion(&bench_done);
+
+	for (i = 0; i < nr_cpus; i++) {
+		th = &threads[i];
+		kthread_stop(th->task);
+		if (th->err && !err)
+			err = th->err;
+		ns += th->ns;
+		misses += th->misses;
+		have_misses &= th->have_misses;
+	}
+	if (err)
+		goto out;
+
+	name = bc_bench_res_name(bench_op, bench_resource);
+	ns = div64_u64(ns, (u64)nr_cpus * iterations);
+	if (have_misses)
+		pr_info("bc_bench: %-10s %-14s cpus %3d: %6llu ns/op, "
+			"%6llu misses/op\n", bc_bench_op_names[bench_op],
+			name, nr_cpus, ns,
+			div64_u64(misses, (u64)nr_cpus * iterations));
+	else
+		pr_info("bc_bench: %-10s %-14s cpus %3d: %6llu ns/op\n",
+			bc_bench_op_names[bench_op], name, nr_cpus, ns);
+out:
+	put_online_cpus();
+	return err;
+}
+
+static int bc_bench_scale(struct bc_bench_thread *threads, int cpus,
+			  int op, int resource)
+{
+	int nr, err;
+
+	bench_op = op;
+	bench_resource = resource;
+
+	for (nr = 1; ; nr = min(nr * 2, cpus)) {
+		err = bc_bench_run(threads, nr);
+		if (err) {
+			pr_err("bc_bench: %s %s on %d cpus failed: %d\n",
+			       bc_bench_op_names[op],
+			       bc_bench_res_name(op, resource),
+			       nr, err);
+			return err;
+		}
+		if (nr == cpus)
+			break;
+	}
+	return 0;
+}
+
+static void bc_bench_prepare_ub(struct user_beancounter *ub)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	for (i = 0; i < UB_RESOURCES; i++) {
+		if (bc_bench_skip_resource(i))
+			continue;
+		ub->ub_parms[i].barrier = UB_MAXVALUE;
+		ub->ub_parms[i].limit = UB_MAXVALUE;
+	}
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+}
+
+static int bc_bench(void)
+{
+	struct bc_bench_thread *threads;
+	struct cgroup_subsys_state *css;
+	int cpus, op, i, err = 0;
+
+	cpus = num_online_cpus();
+	if (max_cpus && max_cpus < cpus)
+		cpus = max_cpus;
+	if (!iterations)
+		return -EINVAL;
+
+	threads = kcalloc(cpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	bench_ub = get_beancounter_by_name("bc_bench", 1);
+	if (IS_ERR_OR_NULL(bench_ub)) {
+		err = bench_ub ? PTR_ERR(bench_ub) : -ENOMEM;
+		goto out_free;
+	}
+	bc_bench_prepare_ub(bench_ub);
+
+	css = ub_get_mem_css(bench_ub);
+	bench_memcg = mem_cgroup_from_cont(css->cgroup);
+
+	pr_info("bc_bench: %u iterations, up to %d cpus\n", iterations, cpus);
+
+	for (op = BC_BENCH_CHARGE; op < BC_BENCH_MEMCG_KMEM; op++) {
+		for (i = 0; i < UB_RESOURCES; i++) {
+			if (bc_bench_skip_resource(i))
+				continue;
+			/* Without precharge these are the locked path again */
+			if (op != BC_BENCH_CHARGE && !ub_resource_precharge[i])
+				continue;
+			err = bc_bench_scale(threads, cpus, op, i);
+			if (err)
+				goto out_put;
+		}
+	}
+	err = bc_bench_scale(threads, cpus, BC_BENCH_MEMCG_KMEM, 0);
+
+out_put:
+	for (i = 0; i < UB_RESOURCES; i++) {
+		if (bc_bench_skip_resource(i))
+			continue;
+		if (__get_beancounter_usage_percpu(bench_ub, i))
+			pr_warn("bc_bench: %s leaked %lu\n", ub_rnames[i],
+				__get_beancounter_usage_percpu(bench_ub, i));
+	}
+	bench_memcg = NULL;
+	css_put(css);
+	put_beancounter(bench_ub);
+	bench_ub = NULL;
+out_free:
+	kfree(threads);
+	return err;
+}
+
+static int bc_bench_set_run(const char *val, const struct kernel_param *kp)
+{
+	bool run;
+	int err;
+
+	err = strtobool(val, &run);
+	if (err || !run)
+		return err;
+
+	mutex_lock(&bench_mutex);
+	if (bench_initialized)
+		err = bc_bench();
+	else
+		bench_requested = true;
+	mutex_unlock(&bench_mutex);
+	return err;
+}
+
+static struct kernel_param_ops bc_bench_run_ops = {
+	.set = bc_bench_set_run,
+	.get = param_get_bool,
+};
+module_param_cb(run, &bc_bench_run_ops, &bench_requested, 0644);
+MODULE_PARM_DESC(run, "Write 1 to run the benchmark");
+
+static int __init bc_bench_init(void)
+{
+	mutex_lock(&bench_mutex);
+	bench_initialized = true;
+	if (bench_requested) {
+		bench_requested = false;
+		bc_bench();
+	}
+	mutex_unlock(&bench_mutex);
+	return 0;
+}
+late_initcall(bc_bench_init);
@@ -74,14 +74,21 @@ const char *ub_rnames[] = {
 	"dummy",
 	"numiptent",
 	"swappages",
+	"tcachepages",	/* 25 */
 };
 
 /* default maximum perpcu resources precharge */
 int ub_resource_precharge[UB_RESOURCES] = {
+	[UB_LOCKEDPAGES]= 256,
 	[UB_PRIVVMPAGES]= 256,
+	[UB_SHMPAGES]	= 256,
 	[UB_NUMPROC]	= 4,
+	[UB_NUMFLOCK]	= 4,
+	[UB_NUMPTY]	= 4,
 	[UB_NUMSIGINFO]	= 4,
 	[UB_NUMFILE]	= 8,
+	[UB_NUMXTENT]	= 16,
+	[UB_TCACHEPAGES]= 256,
 };
 
 /* natural limits for percpu precharge bounds */
@@ -246,6 +253,36 @@ void ub_page_stat(struct user_beancounter *ub, const nodemask_t *nodemask,
 	css_put(css);
 }
 
+/*
+ * Same as ub_page_stat() over all online nodes, but walking every node of
+ * every memcg in the hierarchy is costly, and /proc/meminfo is read often
+ * inside containers. So the sums are cached for ub_snapshot_interval ms
+ * and readers get them locklessly.
+ */
+void ub_page_stat_cached(struct user_beancounter *ub, unsigned long *pages)
+{
+	unsigned long stamp = ACCESS_ONCE(ub->ub_lru_time);
+	unsigned seq;
+
+	if (!stamp || !time_in_range(jiffies, stamp, stamp +
+			msecs_to_jiffies(ub_snapshot_interval))) {
+		ub_page_stat(ub, &node_online_map, pages);
+
+		spin_lock_irq(&ub->ub_lock);
+		write_seqcount_begin(&ub->ub_lru_seq);
+		memcpy(ub->ub_lru_pages, pages, sizeof(ub->ub_lru_pages));
+		ub->ub_lru_time = jiffies ?: 1;
+		write_seqcount_end(&ub->ub_lru_seq);
+		spin_unlock_irq(&ub->ub_lock);
+		return;
+	}
+
+	do {
+		seq = read_seqcount_begin(&ub->ub_lru_seq);
+		memcpy(pages, ub->ub_lru_pages, sizeof(ub->ub_lru_pages));
+	} while (read_seqcount_retry(&ub->ub_lru_seq, seq));
+}
+
 unsigned long ub_total_pages(struct user_beancounter *ub, bool swap)
 {
 	struct cgroup_subsys_state *css;
@@ -301,13 +338,61 @@ void ub_precharge_snapshot(struct user_beancounter *ub, int *precharge)
 	}
 }
 
+/* max age of usage snapshots in ms, 0 to fold on every read */
+int ub_snapshot_interval = 1000;
+
+static void ub_fold_usage(struct user_beancounter *ub)
+{
+	unsigned long held[UB_RESOURCES];
+	int resource, precharge[UB_RESOURCES];
+
+	ub_sync_memcg(ub);
+	ub_precharge_snapshot(ub, precharge);
+	for (resource = 0; resource < UB_RESOURCES; resource++)
+		held[resource] = max(0l, (long)ub->ub_parms[resource].held -
+					 precharge[resource]);
+
+	spin_lock_irq(&ub->ub_lock);
+	write_seqcount_begin(&ub->ub_snap_seq);
+	memcpy(ub->ub_snap_held, held, sizeof(held));
+	ub->ub_snap_time = jiffies ?: 1;
+	write_seqcount_end(&ub->ub_snap_seq);
+	spin_unlock_irq(&ub->ub_lock);
+}
+
+/*
+ * Get usage of all resources without precharges. Summing precharges over
+ * cpus is costly on big machines, so the sums are cached for
+ * ub_snapshot_interval ms and readers get the cached values locklessly.
+ * Fields other than held, synced from memcg, are as of the last fold.
+ */
+void ub_get_usage(struct user_beancounter *ub, unsigned long *held)
+{
+	unsigned long stamp = ACCESS_ONCE(ub->ub_snap_time);
+	unsigned seq;
+
+	if (!stamp || !time_in_range(jiffies, stamp, stamp +
+			msecs_to_jiffies(ub_snapshot_interval)))
+		ub_fold_usage(ub);
+
+	do {
+		seq = read_seqcount_begin(&ub->ub_snap_seq);
+		memcpy(held, ub->ub_snap_held, sizeof(ub->ub_snap_held));
+	} while (read_seqcount_retry(&ub->ub_snap_seq, seq));
+}
+
 static void uncharge_beancounter_precharge(struct user_beancounter *ub)
 {
 	int resource, precharge[UB_RESOURCES];
 
 	ub_precharge_snapshot(ub, precharge);
-	for ( resource = 0 ; resource < UB_RESOURCES ; resource++ )
+	for ( resource = 0 ; resource < UB_RESOURCES ; resource++ ) {
 		ub->ub_parms[resource].held -= precharge[resource];
+		/* ancestors were charged for our precharges too */
+		if (ub->parent && precharge[resource])
+			uncharge_beancounter_fast(ub->parent, resource,
+						  precharge[resource]);
+	}
 }
 
 static void init_beancounter_struct(struct user_beancounter *ub);
@@ -498,19 +583,20 @@ static inline int bc_verify_held(struct user_beancounter *ub)
 
 static struct cgroup_subsys_state *ub_cgroup_css_alloc(struct cgroup *cg)
 {
-	struct user_beancounter *ub;
+	struct user_beancounter *ub, *parent;
 
 	if (!cg->parent)
 		return &ub0.css;
 
-	/* forbid nested containers */
-	if (cgroup_ub(cg->parent) != &ub0)
-		return ERR_PTR(-EPERM);
-
 	ub = alloc_ub(cg->dentry->d_name.name);
 	if (!ub)
 		return ERR_PTR(-ENOMEM);
 
+	/* nested containers are charged to the enclosing ones, not to ub0 */
+	parent = cgroup_ub(cg->parent);
+	if (parent != &ub0)
+		ub->parent = get_beancounter(parent);
+
 	return &ub->css;
 }
 
@@ -553,6 +639,7 @@ static void ub_cgroup_css_free(struct cgroup *cg)
 		add_taint(TAINT_CRAP, LOCKDEP_STILL_OK);
 		return;
 	}
+	put_beancounter(ub->parent);
 	free_ub(ub);
 }
 
@@ -562,7 +649,7 @@ static void __ub_cgroup_attach(struct task_struct *tsk)
 
 	rcu_read_lock();
 	do {
-		ub = cgroup_ub(task_cgroup(current, ub_subsys_id));
+		ub = cgroup_ub(task_cgroup(tsk, ub_subsys_id));
 		if (tsk->task_bc.exec_ub == ub)
 			goto out;
 	} while (!get_beancounter_rcu(ub));
@@ -591,7 +678,7 @@ static void ub_cgroup_attach(struct cgroup *cg, struct cgroup_taskset *tset)
 		 * don't change ub for them
 		 */
 		if (p->flags & PF_KTHREAD)
-			return;
+			continue;
 
 		init_task_work(&p->task_bc.cgroup_attach_work,
 			       ub_cgroup_attach_work_fn);
@@ -718,7 +805,8 @@ static ssize_t ub_cgroup_resource_read(struct cgroup *cg, struct cftype *cft,
 
 	switch (attr) {
 	case UB_CGROUP_ATTR_HELD:
-		val = ubparm->held;
+		/* do not report what is precharged on cpus */
+		val = __get_beancounter_usage_percpu(ub, res);
 		break;
 	case UB_CGROUP_ATTR_MAXHELD:
 		val = ubparm->maxheld;
@@ -894,6 +982,7 @@ int __charge_beancounter_locked(struct user_beancounter *ub,
 int charge_beancounter(struct user_beancounter *ub,
 		int resource, unsigned long val, enum ub_severity strict)
 {
+	struct user_beancounter *p;
 	int retval;
 	unsigned long flags;
 
@@ -901,12 +990,22 @@ int charge_beancounter(struct user_beancounter *ub,
 	if (val > UB_MAXVALUE)
 		goto out;
 
-	if (ub) {
+	for (p = ub; p; p = p->parent) {
+		spin_lock_irqsave(&p->ub_lock, flags);
+		retval = __charge_beancounter_locked(p, resource, val, strict);
+		spin_unlock_irqrestore(&p->ub_lock, flags);
+		if (retval)
+			goto out_undo;
+	}
+out:
+	return retval;
+
+out_undo:
+	for (; ub != p; ub = ub->parent) {
 		spin_lock_irqsave(&ub->ub_lock, flags);
-		retval = __charge_beancounter_locked(ub, resource, val, strict);
+		__uncharge_beancounter_locked(ub, resource, val);
 		spin_unlock_irqrestore(&ub->ub_lock, flags);
 	}
-out:
 	return retval;
 }
 
@@ -935,7 +1034,7 @@ void uncharge_beancounter(struct user_beancounter *ub,
 {
 	unsigned long flags;
 
-	if (ub) {
+	for (; ub; ub = ub->parent) {
 		spin_lock_irqsave(&ub->ub_lock, flags);
 		__uncharge_beancounter_locked(ub, resource, val);
 		spin_unlock_irqrestore(&ub->ub_lock, flags);
@@ -961,13 +1060,56 @@ static int __precharge_beancounter_percpu(struct user_beancounter *ub,
 		ub_pcpu->precharge[resource];
 	retval = __charge_beancounter_locked(ub, resource,
 			charge, UB_SOFT | UB_TEST);
+	spin_unlock(&ub->ub_lock);
+
+	if (!retval && ub->parent) {
+		retval = charge_beancounter_fast(ub->parent, resource,
+						 charge, UB_SOFT | UB_TEST);
+		if (retval) {
+			spin_lock(&ub->ub_lock);
+			__uncharge_beancounter_locked(ub, resource, charge);
+			spin_unlock(&ub->ub_lock);
+		}
+	}
 	if (!retval)
 		ub_pcpu->precharge[resource] += charge;
-	spin_unlock(&ub->ub_lock);
 
 	return retval;
 }
 
+/*
+ * Charge the parent of ub for what was charged to ub, which is val plus
+ * *precharge to be added to the precharge of ub. If the parent cannot afford
+ * the precharge, it is given back and *precharge is zeroed. On failure, the
+ * whole charge is given back. Called with disabled interrupts.
+ */
+static int __charge_beancounter_parent(struct user_beancounter *ub,
+		int resource, unsigned long val, int *precharge,
+		enum ub_severity strict)
+{
+	int retval;
+
+	if (*precharge) {
+		retval = charge_beancounter_fast(ub->parent, resource,
+					val + *precharge, UB_SOFT | UB_TEST);
+		if (!retval)
+			return 0;
+
+		spin_lock(&ub->ub_lock);
+		__uncharge_beancounter_locked(ub, resource, *precharge);
+		spin_unlock(&ub->ub_lock);
+		*precharge = 0;
+	}
+
+	retval = charge_beancounter_fast(ub->parent, resource, val, strict);
+	if (retval) {
+		spin_lock(&ub->ub_lock);
+		__uncharge_beancounter_locked(ub, resource, val);
+		spin_unlock(&ub->ub_lock);
+	}
+	return retval;
+}
+
 /* called with disabled interrupts */
 int __charge_beancounter_percpu(struct user_beancounter *ub,
 		struct ub_percpu_struct *ub_pcpu,
@@ -980,15 +1122,20 @@ int __charge_beancounter_percpu(struct user_beancounter *ub,
 			ub_pcpu->precharge[resource]);
 	retval = __charge_beancounter_locked(ub, resource,
 			val + precharge, UB_SOFT | UB_TEST);
-	if (!retval)
-		ub_pcpu->precharge[resource] += precharge;
-	else {
+	if (retval) {
 		init_beancounter_precharge(ub, resource);
+		precharge = 0;
 		retval = __charge_beancounter_locked(ub, resource,
 				val, strict);
 	}
 	spin_unlock(&ub->ub_lock);
 
+	if (!retval && ub->parent)
+		retval = __charge_beancounter_parent(ub, resource,
+						     val, &precharge, strict);
+	if (!retval)
+		ub_pcpu->precharge[resource] += precharge;
+
 	return retval;
 }
 EXPORT_SYMBOL(__charge_beancounter_percpu);
@@ -1010,6 +1157,9 @@ void __uncharge_beancounter_percpu(struct user_beancounter *ub,
 	smp_wmb();
 	__uncharge_beancounter_locked(ub, resource, val + uncharge);
 	spin_unlock(&ub->ub_lock);
+
+	if (ub->parent)
+		uncharge_beancounter_fast(ub->parent, resource, val + uncharge);
 }
 EXPORT_SYMBOL(__uncharge_beancounter_percpu);
 
@@ -1061,6 +1211,8 @@ static void init_beancounter_struct(struct user_beancounter *ub)
 {
 	ub->ub_magic = UB_MAGIC;
 	spin_lock_init(&ub->ub_lock);
+	seqcount_init(&ub->ub_snap_seq);
+	seqcount_init(&ub->ub_lru_seq);
 }
 
 static void init_beancounter_nolimits(struct user_beancounter *ub)
@@ -1150,6 +1302,14 @@ static ctl_table ub_sysctl_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_resource_precharge,
 	},
+	{
+		.procname	= "snapshot_interval",
+		.data		= &ub_snapshot_interval,
+		.maxlen		= sizeof ub_snapshot_interval,
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.extra1		= &resource_precharge_min,
+	},
 #ifdef CONFIG_BC_IO_ACCOUNTING
 	{
 		.procname	= "dirty_ratio",
@@ -118,6 +118,8 @@ void ub_io_writeback_dec(struct address_space *mapping)
 
 	ub_stat_dec(ub, writeback_pages);
 
+	ub_percpu_inc(ub, writeback_done);
+
 	if (!radix_tree_tagged(&mapping->page_tree, PAGECACHE_TAG_WRITEBACK) &&
 	    (!radix_tree_tagged(&mapping->page_tree, PAGECACHE_TAG_DIRTY) ||
 	     !mapping_cap_account_dirty(mapping))) {
@@ -150,6 +152,72 @@ int ub_dirty_limits(unsigned long *pbackground,
 	return 1;
 }
 
+/* dirty and writeback pages of @ub, exact if close to @thresh */
+unsigned long ub_dirty_pages(struct user_beancounter *ub, unsigned long thresh)
+{
+	unsigned long dirty;
+
+	dirty = ub_stat_get(ub, dirty_pages) + ub_stat_get(ub, writeback_pages);
+	if (dirty + 2 * UB_STAT_ERROR >= thresh)
+		dirty = ub_stat_get_exact(ub, dirty_pages) +
+			ub_stat_get_exact(ub, writeback_pages);
+
+	return dirty;
+}
+
+#define UB_INIT_BW		(100 << (20 - PAGE_SHIFT))
+#define UB_BANDWIDTH_INTERVAL	max(HZ/5, 1)
+
+/*
+ * Write bandwidth of @ub in pages per second, estimated from completed
+ * writeback the same way as for bdi, see bdi_update_write_bandwidth().
+ * Updated at most once every 200ms by balance_dirty_pages() of tasks
+ * going over the beancounter dirty limits.
+ */
+unsigned long ub_write_bandwidth(struct user_beancounter *ub,
+				 unsigned long start_time)
+{
+	const unsigned long period = roundup_pow_of_two(3 * HZ);
+	unsigned long flags, now = jiffies;
+	unsigned long elapsed, written;
+	u64 bw;
+
+	if (time_is_after_eq_jiffies(ub->bw_time_stamp + UB_BANDWIDTH_INTERVAL))
+		return ub->write_bandwidth;
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	elapsed = now - ub->bw_time_stamp;
+	if (elapsed < UB_BANDWIDTH_INTERVAL)
+		goto out;
+
+	written = __ub_percpu_sum(ub, writeback_done);
+	if (!ub->bw_time_stamp) {
+		ub->write_bandwidth = UB_INIT_BW;
+		goto snapshot;
+	}
+
+	/* Skip quiet periods, as bdi does */
+	if (elapsed > HZ && time_before(ub->bw_time_stamp, start_time))
+		goto snapshot;
+
+	bw = (u64)(written - ub->written_stamp) * HZ;
+	if (unlikely(elapsed > period))
+		do_div(bw, elapsed);
+	else {
+		bw += (u64)ub->write_bandwidth * (period - elapsed);
+		bw >>= ilog2(period);
+	}
+	ub->write_bandwidth = bw;
+
+snapshot:
+	ub->written_stamp = written;
+	ub->bw_time_stamp = now;
+out:
+	bw = ub->write_bandwidth;
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	return bw;
+}
+
 bool ub_should_skip_writeback(struct user_beancounter *ub, struct inode *inode)
 {
 	struct user_beancounter *dirtied_ub;
@@ -182,7 +250,7 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 
 	ub = seq_beancounter(f);
 
-	dirty_pages = __ub_stat_get(ub, dirty_pages);
+	dirty_pages = ub_stat_get_exact(ub, dirty_pages);
 
 	read = write = cancel = 0;
 	sync = sync_done = fsync = fsync_done =
@@ -195,7 +263,6 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 		read += ub_percpu->sync_read_bytes;
 		write += ub_percpu->sync_write_bytes;
 
-		dirty_pages += ub_percpu->dirty_pages;
 		write += (u64)ub_percpu->async_write_complete << PAGE_SHIFT;
 		cancel += (u64)ub_percpu->async_write_canceled << PAGE_SHIFT;
 
@@ -212,9 +279,6 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 		fuse_bytes += ub_percpu->fuse_bytes;
 	}
 
-	if ((long)dirty_pages < 0)
-		dirty_pages = 0;
-
 	dirtied = write + cancel;
 	dirtied += (u64)dirty_pages << PAGE_SHIFT;
 
@@ -20,6 +20,7 @@ static unsigned int ioprio_weight[UB_IOPRIO_MAX] = {
 extern unsigned int blkcg_get_weight(struct cgroup *cgrp);
 extern int blkcg_set_weight(struct cgroup *cgrp, unsigned int weight);
 extern void blkcg_show_ub_iostat(struct cgroup *cgrp, struct seq_file *sf);
+extern void blkcg_show_ub_iolat(struct cgroup *cgrp, struct seq_file *sf);
 
 int ub_set_ioprio(int id, int ioprio)
 {
@@ -76,6 +77,27 @@ static struct bc_proc_entry bc_iostat_entry = {
 	.u.show = bc_iostat_single,
 };
 
+#ifdef CONFIG_BLK_DEV_THROTTLING
+/*
+ * Histograms of request queue and service time per device, bucket i
+ * counts requests which took [2^i, 2^(i+1)) usecs.
+ */
+static int bc_iolat_show(struct seq_file *f, void *v)
+{
+	struct cgroup_subsys_state *css;
+
+	css = ub_get_blkio_css(seq_beancounter(f));
+	blkcg_show_ub_iolat(css->cgroup, f);
+	css_put(css);
+	return 0;
+}
+
+static struct bc_proc_entry bc_iolat_entry = {
+	.name = "iolatency",
+	.u.show = bc_iolat_show,
+};
+#endif
+
 static void *bc_iostat_start(struct seq_file *f, loff_t *ppos)
 {
 	struct user_beancounter *ub;
@@ -168,6 +190,9 @@ static int __init bc_iostat_init(void)
 {
 	bc_register_proc_entry(&bc_ioprio_entry);
 	bc_register_proc_entry(&bc_iostat_entry);
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	bc_register_proc_entry(&bc_iolat_entry);
+#endif
 	bc_register_proc_root_entry(&bc_root_iostat_entry);
 	return 0;
 }
@@ -89,7 +89,8 @@ int ub_flock_charge(struct file_lock *fl, int hard)
 	if (ub == NULL)
 		return 0;
 
-	err = charge_beancounter(ub, UB_NUMFLOCK, 1, hard ? UB_HARD : UB_SOFT);
+	err = charge_beancounter_fast(ub, UB_NUMFLOCK, 1,
+				      hard ? UB_HARD : UB_SOFT);
 	if (!err)
 		fl->fl_charged = 1;
 	return err;
@@ -103,7 +104,7 @@ void ub_flock_uncharge(struct file_lock *fl)
 	if (ub == NULL || !fl->fl_charged)
 		return;
 
-	uncharge_beancounter(ub, UB_NUMFLOCK, 1);
+	uncharge_beancounter_fast(ub, UB_NUMFLOCK, 1);
 	fl->fl_charged = 0;
 }
 
@@ -147,7 +148,7 @@ int ub_pty_charge(struct tty_struct *tty)
 	retval = 0;
 	if (ub && tty->driver->subtype == PTY_TYPE_MASTER &&
 			!test_bit(TTY_CHARGED, &tty->flags)) {
-		retval = charge_beancounter(ub, UB_NUMPTY, 1, UB_HARD);
+		retval = charge_beancounter_fast(ub, UB_NUMPTY, 1, UB_HARD);
 		if (!retval) {
 			set_bit(TTY_CHARGED, &tty->flags);
 			tty->ub = get_beancounter(ub);
@@ -163,7 +164,7 @@ void ub_pty_uncharge(struct tty_struct *tty)
 	ub = tty->ub;
 	if (ub && tty->driver->subtype == PTY_TYPE_MASTER &&
 			test_bit(TTY_CHARGED, &tty->flags)) {
-		uncharge_beancounter(ub, UB_NUMPTY, 1);
+		uncharge_beancounter_fast(ub, UB_NUMPTY, 1);
 		clear_bit(TTY_CHARGED, &tty->flags);
 		put_beancounter(ub);
 	}
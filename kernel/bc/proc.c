@@ -43,15 +43,11 @@ static const char *res_fmt = "%10s%c %-12s %20lu %20lu %20lu %20lu %20lu\n";
 #endif
 
 static void ub_show_res(struct seq_file *f, struct user_beancounter *ub,
-		int r, int precharge, int show_uid)
+		int r, unsigned long held, int show_uid)
 {
 	struct ubparm *p;
-	unsigned long held;
 
 	p = &ub->ub_parms[r];
-	held = p->held;
-	held = (held > precharge) ? (held - precharge) : 0;
-
 	seq_printf(f, res_fmt,
 			show_uid && r == 0 ? ub->ub_name : "",
 			show_uid && r == 0 ? ':' : ' ',
@@ -66,17 +62,17 @@ static void ub_show_res(struct seq_file *f, struct user_beancounter *ub,
 static void __show_resources(struct seq_file *f, struct user_beancounter *ub,
 		int show_uid)
 {
-	int i, precharge[UB_RESOURCES];
+	unsigned long held[UB_RESOURCES];
+	int i;
 
-	ub_sync_memcg(ub);
-	ub_precharge_snapshot(ub, precharge);
+	ub_get_usage(ub, held);
 
 	for (i = 0; i < UB_RESOURCES_COMPAT; i++)
 		if (strcmp(ub_rnames[i], "dummy") != 0)
-			ub_show_res(f, ub, i, precharge[i], show_uid);
+			ub_show_res(f, ub, i, held[i], show_uid);
 
 	for (i = UB_RESOURCES_COMPAT; i < UB_RESOURCES; i++)
-		ub_show_res(f, ub, i, precharge[i], show_uid);
+		ub_show_res(f, ub, i, held[i], show_uid);
 }
 
 static int bc_resources_show(struct seq_file *f, void *v)
@@ -170,14 +166,14 @@ static struct bc_proc_entry bc_nodeinfo_entry = {
 
 static int ub_show(struct seq_file *f, void *v)
 {
-	int i, precharge[UB_RESOURCES];
+	unsigned long held[UB_RESOURCES];
 	struct user_beancounter *ub = v;
+	int i;
 
-	ub_sync_memcg(ub);
-	ub_precharge_snapshot(ub, precharge);
+	ub_get_usage(ub, held);
 
 	for (i = 0; i < UB_RESOURCES_COMPAT; i++)
-		ub_show_res(f, ub, i, precharge[i], 1);
+		ub_show_res(f, ub, i, held[i], 1);
 	return 0;
 }
 
@@ -200,16 +196,13 @@ static void ub_show_header(struct seq_file *f)
 			"held", "maxheld", "barrier", "limit", "failcnt");
 }
 
-static void *ub_start(struct seq_file *f, loff_t *ppos)
+static void *__ub_start(struct seq_file *f, loff_t *ppos)
 {
 	struct user_beancounter *ub, *ret = NULL;
 	struct user_beancounter *exec_ub; 
 	unsigned long pos;
 
 	pos = *ppos;
-	if (pos == 0)
-		ub_show_header(f);
-
 	exec_ub = get_exec_ub();
 
 	rcu_read_lock();
@@ -228,6 +221,13 @@ static void *ub_start(struct seq_file *f, loff_t *ppos)
 	return ret;
 }
 
+static void *ub_start(struct seq_file *f, loff_t *ppos)
+{
+	if (*ppos == 0)
+		ub_show_header(f);
+	return __ub_start(f, ppos);
+}
+
 static void *ub_next(struct seq_file *f, void *v, loff_t *ppos)
 {
 	struct user_beancounter *ub, *ret = NULL;
@@ -307,6 +307,63 @@ static struct bc_proc_entry bc_all_resources_entry = {
 	.u.fops = &resources_operations,
 };
 
+static int usage_show(struct seq_file *f, void *v)
+{
+	struct user_beancounter *ub = v;
+	struct ub_usage_record *rec = f->private;
+	unsigned long held[UB_RESOURCES];
+	int i;
+
+	ub_get_usage(ub, held);
+
+	memset(rec, 0, sizeof(*rec));
+	strlcpy(rec->name, ub->ub_name, sizeof(rec->name));
+	rec->size = sizeof(*rec);
+	rec->nr_resources = UB_RESOURCES;
+	for (i = 0; i < UB_RESOURCES; i++) {
+		struct ubparm *p = &ub->ub_parms[i];
+
+		rec->res[i].held = held[i];
+		rec->res[i].maxheld = p->maxheld;
+		rec->res[i].barrier = p->barrier;
+		rec->res[i].limit = p->limit;
+		rec->res[i].failcnt = p->failcnt;
+	}
+
+	seq_write(f, rec, sizeof(*rec));
+	return 0;
+}
+
+static struct seq_operations usage_seq_ops = {
+	.start = __ub_start,
+	.next  = ub_next,
+	.stop  = ub_stop,
+	.show  = usage_show,
+};
+
+static int usage_open(struct inode *inode, struct file *filp)
+{
+	if (!(capable(CAP_DAC_OVERRIDE) && capable(CAP_DAC_READ_SEARCH)))
+		return -EACCES;
+
+	if (!__seq_open_private(filp, &usage_seq_ops,
+				sizeof(struct ub_usage_record)))
+		return -ENOMEM;
+	return 0;
+}
+
+static struct file_operations usage_operations = {
+	.open		= usage_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release_private,
+};
+
+static struct bc_proc_entry bc_usage_entry = {
+	.name = "usage",
+	.u.fops = &usage_operations,
+};
+
 /*
  * Generic showing stuff
  */
@@ -742,6 +799,7 @@ static int __init ub_init_proc(void)
 	bc_register_proc_entry(&bc_resources_entry);
 	bc_register_proc_entry(&bc_precharge_entry);
 	bc_register_proc_root_entry(&bc_all_resources_entry);
+	bc_register_proc_root_entry(&bc_usage_entry);
 	bc_register_proc_entry(&bc_meminfo_entry);
 	bc_register_proc_entry(&bc_nodeinfo_entry);
 
@@ -16,6 +16,7 @@
 #include <linux/vmalloc.h>
 #include <linux/init.h>
 #include <linux/ve.h>
+#include <linux/debugfs.h>
 
 #include <asm/pgtable.h>
 #include <asm/page.h>
@@ -40,7 +41,7 @@ int ub_memory_charge(struct mm_struct *mm, unsigned long size,
 	BUG_ON(sv != UB_SOFT && sv != UB_HARD);
 
 	if (vm_flags & VM_LOCKED) {
-		if (charge_beancounter(ub, UB_LOCKEDPAGES, size, sv))
+		if (charge_beancounter_fast(ub, UB_LOCKEDPAGES, size, sv))
 			goto out_err;
 	}
 	if (VM_UB_PRIVATE(vm_flags, vm_file)) {
@@ -51,7 +52,7 @@ int ub_memory_charge(struct mm_struct *mm, unsigned long size,
 
 out_private:
 	if (vm_flags & VM_LOCKED)
-		uncharge_beancounter(ub, UB_LOCKEDPAGES, size);
+		uncharge_beancounter_fast(ub, UB_LOCKEDPAGES, size);
 out_err:
 	return -ENOMEM;
 }
@@ -68,7 +69,7 @@ void ub_memory_uncharge(struct mm_struct *mm, unsigned long size,
 	size >>= PAGE_SHIFT;
 
 	if (vm_flags & VM_LOCKED)
-		uncharge_beancounter(ub, UB_LOCKEDPAGES, size);
+		uncharge_beancounter_fast(ub, UB_LOCKEDPAGES, size);
 	if (VM_UB_PRIVATE(vm_flags, vm_file))
 		uncharge_beancounter_fast(ub, UB_PRIVVMPAGES, size);
 }
@@ -81,7 +82,7 @@ int ub_locked_charge(struct mm_struct *mm, unsigned long size)
 	if (ub == NULL)
 		return 0;
 
-	return charge_beancounter(ub, UB_LOCKEDPAGES,
+	return charge_beancounter_fast(ub, UB_LOCKEDPAGES,
 			size >> PAGE_SHIFT, UB_HARD);
 }
 
@@ -93,7 +94,7 @@ void ub_locked_uncharge(struct mm_struct *mm, unsigned long size)
 	if (ub == NULL)
 		return;
 
-	uncharge_beancounter(ub, UB_LOCKEDPAGES, size >> PAGE_SHIFT);
+	uncharge_beancounter_fast(ub, UB_LOCKEDPAGES, size >> PAGE_SHIFT);
 }
 
 int ub_lockedshm_charge(struct shmem_inode_info *shi, unsigned long size)
@@ -104,7 +105,7 @@ int ub_lockedshm_charge(struct shmem_inode_info *shi, unsigned long size)
 	if (ub == NULL)
 		return 0;
 
-	return charge_beancounter(ub, UB_LOCKEDPAGES,
+	return charge_beancounter_fast(ub, UB_LOCKEDPAGES,
 			size >> PAGE_SHIFT, UB_HARD);
 }
 
@@ -116,7 +117,7 @@ void ub_lockedshm_uncharge(struct shmem_inode_info *shi, unsigned long size)
 	if (ub == NULL)
 		return;
 
-	uncharge_beancounter(ub, UB_LOCKEDPAGES, size >> PAGE_SHIFT);
+	uncharge_beancounter_fast(ub, UB_LOCKEDPAGES, size >> PAGE_SHIFT);
 }
 
 static int bc_fill_sysinfo(struct user_beancounter *ub,
@@ -169,8 +170,8 @@ static int bc_fill_meminfo(struct user_beancounter *ub,
 	if (ret & NOTIFY_STOP_MASK)
 		goto out;
 
-	ub_sync_memcg(ub);
-	ub_page_stat(ub, &node_online_map, mi->pages);
+	/* bc_fill_sysinfo() has just synced ub_parms from memcg */
+	ub_page_stat_cached(ub, mi->pages);
 
 	mi->locked = ub->ub_parms[UB_LOCKEDPAGES].held;
 	mi->shmem = ub->ub_parms[UB_SHMPAGES].held;
@@ -262,9 +263,79 @@ static struct bc_proc_entry bc_vmaux_entry = {
 	.u.show = bc_vmaux_show,
 };
 
+/*
+ * Pages read from the pfcache peer instead of the own page cache of a
+ * file, each of them is a page this beancounter did not have to hold.
+ */
+static int bc_pfcache_show(struct seq_file *f, void *v)
+{
+	struct user_beancounter *ub = seq_beancounter(f);
+
+	seq_printf(f, bc_proc_lu_lfmt, "hit", ub_percpu_sum(ub, pfcache_hit));
+	seq_printf(f, bc_proc_lu_lfmt, "miss",
+		   ub_percpu_sum(ub, pfcache_miss));
+	seq_printf(f, bc_proc_lu_lfmt, "peer_pages",
+		   ub_percpu_sum(ub, pfcache_peer_pages));
+	seq_printf(f, bc_proc_lu_lfmt, "invalidate",
+		   ub_percpu_sum(ub, pfcache_invalidate));
+	return 0;
+}
+
+static struct bc_proc_entry bc_pfcache_entry = {
+	.name = "pfcache",
+	.u.show = bc_pfcache_show,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int bc_pfcache_summary_show(struct seq_file *m, void *v)
+{
+	struct user_beancounter *ub;
+
+	seq_printf(m, "%-12s %12s %12s %12s %12s %12s\n", "ub",
+		   "hit", "miss", "peer_pages", "saved_kb", "invalidate");
+
+	rcu_read_lock();
+	for_each_beancounter(ub) {
+		unsigned long pages = ub_percpu_sum(ub, pfcache_peer_pages);
+
+		seq_printf(m, "%-12s %12lu %12lu %12lu %12lu %12lu\n",
+			   ub->ub_name,
+			   ub_percpu_sum(ub, pfcache_hit),
+			   ub_percpu_sum(ub, pfcache_miss), pages,
+			   pages << (PAGE_SHIFT - 10),
+			   ub_percpu_sum(ub, pfcache_invalidate));
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static int bc_pfcache_summary_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bc_pfcache_summary_show, NULL);
+}
+
+static const struct file_operations bc_pfcache_summary_fops = {
+	.open		= bc_pfcache_summary_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init bc_pfcache_debugfs_init(void)
+{
+	if (debugfs_initialized())
+		debugfs_create_file("pfcache", S_IRUSR, NULL, NULL,
+				    &bc_pfcache_summary_fops);
+}
+#else
+static inline void bc_pfcache_debugfs_init(void) { }
+#endif
+
 static int __init bc_vmaux_init(void)
 {
 	bc_register_proc_entry(&bc_vmaux_entry);
+	bc_register_proc_entry(&bc_pfcache_entry);
+	bc_pfcache_debugfs_init();
 	return 0;
 }
 
@@ -351,8 +351,13 @@ static int css_set_count;
  * hash table for cgroup groups. This improves the performance to find
  * an existing css_set. This hash doesn't (currently) take into
  * account cgroups in empty hierarchies.
+ *
+ * Every container has a css_set of its own, and starting one creates a
+ * transient css_set per hierarchy it is attached to, so size the table
+ * for thousands of them.  Lookups are done under RCU; insertions and
+ * removals happen under css_set_lock.
  */
-#define CSS_SET_HASH_BITS	7
+#define CSS_SET_HASH_BITS	10
 static DEFINE_HASHTABLE(css_set_table, CSS_SET_HASH_BITS);
 
 static unsigned long css_set_hash(struct cgroup_subsys_state *css[])
@@ -391,7 +396,7 @@ static void __put_css_set(struct css_set *cg, int taskexit)
 	}
 
 	/* This css_set is dead. unlink it and release cgroup refcounts */
-	hash_del(&cg->hlist);
+	hash_del_rcu(&cg->hlist);
 	css_set_count--;
 
 	list_for_each_entry_safe(link, saved_link, &cg->cg_links,
@@ -523,6 +528,8 @@ static bool compare_css_sets(struct css_set *cg,
  *
  * template: location in which to build the desired set of subsystem
  * state objects for the new cgroup group
+ *
+ * Returns the matching css_set with a reference taken, or NULL.
  */
 static struct css_set *find_existing_css_set(
 	struct css_set *oldcg,
@@ -553,13 +560,27 @@ static struct css_set *find_existing_css_set(
 	}
 
 	key = css_set_hash(template);
-	hash_for_each_possible(css_set_table, cg, hlist, key) {
-		if (!compare_css_sets(cg, oldcg, cgrp, template))
+	rcu_read_lock();
+	hash_for_each_possible_rcu(css_set_table, cg, hlist, key) {
+		/* cheap check first, ->subsys never changes under us */
+		if (memcmp(template, cg->subsys, sizeof(cg->subsys)))
+			continue;
+		/*
+		 * Pin it before looking at ->cg_links, which a concurrent
+		 * final put_css_set() frees without waiting for RCU.
+		 */
+		if (!atomic_inc_not_zero(&cg->refcount))
+			continue;
+		if (!compare_css_sets(cg, oldcg, cgrp, template)) {
+			put_css_set(cg);
 			continue;
+		}
 
 		/* This css_set matches what we need */
+		rcu_read_unlock();
 		return cg;
 	}
+	rcu_read_unlock();
 
 	/* No existing cgroup group matched */
 	return NULL;
@@ -642,12 +663,7 @@ static struct css_set *find_css_set(
 
 	/* First see if we already have a cgroup group that matches
 	 * the desired set */
-	read_lock(&css_set_lock);
 	res = find_existing_css_set(oldcg, cgrp, template);
-	if (res)
-		get_css_set(res);
-	read_unlock(&css_set_lock);
-
 	if (res)
 		return res;
 
@@ -685,7 +701,7 @@ static struct css_set *find_css_set(
 
 	/* Add this cgroup group to the hash table */
 	key = css_set_hash(res->subsys);
-	hash_add(css_set_table, &res->hlist, key);
+	hash_add_rcu(css_set_table, &res->hlist, key);
 
 	write_unlock(&css_set_lock);
 
@@ -41,6 +41,7 @@
 #include <linux/cgroup.h>
 #include <linux/module.h>
 #include <linux/mman.h>
+#include <linux/ve.h>
 
 #include "internal.h"
 
@@ -1226,6 +1227,9 @@ static void perf_event__header_size(struct perf_event *event)
 	if (sample_type & PERF_SAMPLE_TRANSACTION)
 		size += sizeof(data->txn);
 
+	if (sample_type & PERF_SAMPLE_VEID)
+		size += sizeof(u64);
+
 	event->header_size = size;
 }
 
@@ -4575,6 +4579,22 @@ static void perf_output_read(struct perf_output_handle *handle,
 		perf_output_read_one(handle, event, enabled, running);
 }
 
+/*
+ * The sample is taken in the context of the interrupted task, so its
+ * VE is the one the sample belongs to.  This lets one system-wide
+ * event per cpu profile all containers at once, where the cgroup mode
+ * needs an event per cgroup per cpu and switches them on every
+ * context switch.
+ */
+static inline u64 perf_sample_veid(void)
+{
+#ifdef CONFIG_VE
+	return get_exec_env()->veid;
+#else
+	return 0;
+#endif
+}
+
 void perf_output_sample(struct perf_output_handle *handle,
 			struct perf_event_header *header,
 			struct perf_sample_data *data,
@@ -4697,6 +4717,12 @@ void perf_output_sample(struct perf_output_handle *handle,
 	if (sample_type & PERF_SAMPLE_TRANSACTION)
 		perf_output_put(handle, data->txn);
 
+	if (sample_type & PERF_SAMPLE_VEID) {
+		u64 veid = perf_sample_veid();
+
+		perf_output_put(handle, veid);
+	}
+
 	if (!event->attr.watermark) {
 		int wakeup_events = event->attr.wakeup_events;
 
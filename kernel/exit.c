@@ -55,6 +55,7 @@
 #include <linux/writeback.h>
 #include <linux/shm.h>
 
+#include <linux/eventpoll.h>
 #include <bc/misc.h>
 
 #include <asm/uaccess.h>
@@ -814,6 +815,7 @@ void do_exit(long code)
 	exit_sem(tsk);
 	exit_shm(tsk);
 	exit_files(tsk);
+	poll_cache_exit(tsk);
 	exit_fs(tsk);
 	exit_task_namespaces(tsk);
 	exit_task_work(tsk);
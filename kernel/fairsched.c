@@ -202,6 +202,8 @@ SYSCALL_DEFINE3(fairsched_rate, unsigned int, id, int, op, unsigned, rate)
 		return -EINVAL;
 	if (op == FAIRSCHED_SET_RATE && (rate < 1 || rate >= (1UL << 31)))
 		return -EINVAL;
+	if (op == FAIRSCHED_SET_BURST && rate >= (1UL << 31))
+		return -EINVAL;
 
 	cgrp = ve_cgroup_open(root_node.cpu, 0, fairsched_id(id));
 	if (IS_ERR(cgrp))
@@ -221,6 +223,14 @@ SYSCALL_DEFINE3(fairsched_rate, unsigned int, id, int, op, unsigned, rate)
 			if (!ret)
 				ret = -ENODATA;
 			break;
+		case FAIRSCHED_SET_BURST:
+			ret = sched_cgroup_set_burst(cgrp, rate);
+			if (!ret)
+				ret = sched_cgroup_get_burst(cgrp);
+			break;
+		case FAIRSCHED_GET_BURST:
+			ret = sched_cgroup_get_burst(cgrp);
+			break;
 		default:
 			ret = -EINVAL;
 			break;
@@ -305,6 +315,15 @@ SYSCALL_DEFINE3(fairsched_cpumask, unsigned int, id, unsigned int, len,
 		cpumask_and(new_mask, in_mask, cpu_active_mask);
 		retval = cgroup_set_cpumask(cgrp, new_mask);
 	}
+	if (retval == 0) {
+		struct ve_struct *ve = get_ve_by_id(fairsched_id(id));
+
+		/* let the container's background work follow it */
+		if (ve) {
+			ve_wq_set_cpumask(ve, new_mask);
+			put_ve(ve);
+		}
+	}
 
 	free_cpumask_var(new_mask);
 
@@ -73,6 +73,7 @@
 #include <linux/uprobes.h>
 #include <linux/aio.h>
 #include <linux/ve.h>
+#include <linux/ve_lat.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -340,6 +341,9 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	tsk->btrace_seq = 0;
 #endif
 	tsk->splice_pipe = NULL;
+#ifdef CONFIG_EPOLL
+	tsk->poll_cache = NULL;
+#endif
 	tsk->task_frag.page = NULL;
 
 	account_kernel_stack(ti, 1);
@@ -583,6 +587,9 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	mm->cached_hole_size = ~0UL;
 	mm_init_aio(mm);
 	mm_init_owner(mm, p);
+#ifdef CONFIG_FUTEX
+	mm->futex_hash = NULL;
+#endif
 	clear_tlb_flush_pending(mm);
 
 	if (current->mm) {
@@ -650,6 +657,7 @@ void __mmdrop(struct mm_struct *mm)
 	mm_free_pgd(mm);
 	destroy_context(mm);
 	mmu_notifier_mm_destroy(mm);
+	futex_mm_free(mm);
 	check_mm(mm);
 	free_mm(mm);
 }
@@ -940,6 +948,7 @@ static int copy_mm(unsigned long clone_flags, struct task_struct *tsk)
 		return 0;
 
 	if (clone_flags & CLONE_VM) {
+		futex_mm_init(oldmm);
 		atomic_inc(&oldmm->mm_users);
 		mm = oldmm;
 		goto good_mm;
@@ -1645,6 +1654,7 @@ long do_fork(unsigned long clone_flags,
 	struct task_struct *p;
 	int trace = 0;
 	long nr;
+	u64 lat_start;
 
 	/*
 	 * Do some preliminary argument and permissions checking before we
@@ -1673,8 +1683,10 @@ long do_fork(unsigned long clone_flags,
 			trace = 0;
 	}
 
+	lat_start = ve_lat_start();
 	p = copy_process(clone_flags, stack_start, stack_size,
 			 child_tidptr, NULL, trace);
+	ve_lat_end(get_exec_env(), VE_LAT_FORK, lat_start);
 	/*
 	 * Do this prior waking up the new thread - the thread pointer
 	 * might get invalid after that point, if the thread exits quickly.
@@ -296,9 +296,62 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct mm_struct *mm = key->private.mm;
+
+		if (mm->futex_hash)
+			return &mm->futex_hash[hash & mm->futex_hash_mask];
+	}
 	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	atomic_set(&hb->waiters, 0);
+	plist_head_init(&hb->chain);
+	spin_lock_init(&hb->lock);
+}
+
+/**
+ * futex_mm_init() - give a process its own hash for private futexes
+ * @mm:		the mm about to get its second user
+ *
+ * Private futexes of a multithreaded process are hashed in a table of
+ * its own, allocated on the node it runs on, instead of the global one
+ * where they would collide with those of every other process.  A key
+ * must hash to the same bucket for all its waiters and wakers, so the
+ * table can only be installed while there is nobody to wait yet: when
+ * a single threaded process creates its first thread.  Processes for
+ * which that fails keep using the global table.
+ */
+void futex_mm_init(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *hash;
+	unsigned int i, size;
+
+	if (mm->futex_hash || atomic_read(&mm->mm_users) != 1)
+		return;
+
+	size = roundup_pow_of_two(max(4 * num_online_cpus(), 16U));
+	hash = kmalloc_node(size * sizeof(*hash), GFP_KERNEL | __GFP_NOWARN,
+			    numa_node_id());
+	if (!hash)
+		return;
+
+	for (i = 0; i < size; i++)
+		futex_hash_bucket_init(&hash[i]);
+
+	mm->futex_hash_mask = size - 1;
+	mm->futex_hash = hash;
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
+	mm->futex_hash = NULL;
+}
+
 /*
  * Return 1 if two futex_keys are equal, 0 otherwise.
  */
@@ -3059,11 +3112,8 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	for (i = 0; i < futex_hashsize; i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
@@ -36,6 +36,7 @@
 #include <linux/syscore_ops.h>
 #include <linux/security.h>
 #include <linux/hugetlb.h>
+#include <linux/pagecache_handover.h>
 
 #include <asm/page.h>
 #include <asm/uaccess.h>
@@ -244,6 +245,17 @@ static int sanity_check_segment_list(struct kimage *image)
 			    (mend > crashk_res.end))
 				return result;
 		}
+	} else {
+		/* Don't load the new kernel over the page cache it inherits */
+		result = -EADDRNOTAVAIL;
+		for (i = 0; i < nr_segments; i++) {
+			unsigned long mstart, mend;
+
+			mstart = image->segment[i].mem;
+			mend = mstart + image->segment[i].memsz;
+			if (pagecache_handover_overlaps(mstart, mend))
+				return result;
+		}
 	}
 
 	return 0;
@@ -2802,6 +2814,7 @@ int kernel_kexec(void)
 		kernel_restart_prepare(NULL);
 		pr_emerg("Starting new kernel\n");
 		machine_shutdown();
+		pagecache_handover_seal();
 	}
 
 	machine_kexec(kexec_image);
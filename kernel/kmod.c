@@ -541,6 +541,12 @@ static void __call_usermodehelper(struct kthread_work *work)
 	int wait = sub_info->wait & ~UMH_KILLABLE;
 	pid_t pid;
 
+#ifdef CONFIG_VE
+	if (!ve_is_super(get_exec_env()))
+		ve_work_account(&get_exec_env()->ve_umh_stat,
+				sub_info->queued);
+#endif
+
 	/* CLONE_VFORK: wait until the usermode helper has execve'd
 	 * successfully We need the data structures to stay around
 	 * until that is done.  */
@@ -813,6 +819,7 @@ static int __call_usermodehelper_exec(struct kthread_worker *worker,
 
 	sub_info->complete = &done;
 	sub_info->wait = wait;
+	sub_info->queued = ktime_to_ns(ktime_get());
 
 	queue_kthread_work(worker, &sub_info->work);
 	if (wait == UMH_NO_WAIT)	/* task has freed sub_info */
@@ -881,7 +888,7 @@ int call_usermodehelper_fns_ve(struct ve_struct *ve,
 	if (!ve)
 		return -EFAULT;
 
-	khelper = ve_is_super(ve) ? &khelper_worker : &ve->ve_umh_worker;
+	khelper = ve_is_super(ve) ? &khelper_worker : ve_umh_worker(ve);
 
 	if (ve_is_super(ve) || (get_exec_env() == ve)) {
 		err = call_usermodehelper_by(khelper, path, argv, envp, wait, init,
@@ -73,6 +73,7 @@ struct pid_namespace init_pid_ns = {
 		[ 0 ... PIDMAP_ENTRIES-1] = { ATOMIC_INIT(BITS_PER_PAGE), NULL }
 	},
 	.last_pid = 0,
+	.pidmap_lock = __SPIN_LOCK_UNLOCKED(init_pid_ns.pidmap_lock),
 	.level = 0,
 	.child_reaper = &init_task,
 	.user_ns = &init_user_ns,
@@ -92,9 +93,44 @@ EXPORT_SYMBOL_GPL(init_pid_ns);
  * After we clean up the tasklist_lock and know there are no
  * irq handlers that take it we can leave the interrupts enabled.
  * For now it is easier to be safe than to prove it can't happen.
+ *
+ * The pidmap bitmaps themselves are lock-free.  Each pid namespace
+ * has its own pidmap_lock protecting nr_hashed and the installation
+ * of new map pages, so forks in different containers never contend.
+ * The shared pid_hash chains are protected by a small array of hashed
+ * locks nested inside the namespace lock.  When several namespace
+ * locks are held at once they are always taken child first.
  */
 
-static  __cacheline_aligned_in_smp DEFINE_SPINLOCK(pidmap_lock);
+#define PID_HASH_LOCKS		256
+
+static struct pid_hash_lock {
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp pid_hash_locks[PID_HASH_LOCKS];
+
+static inline spinlock_t *pid_hash_lockp(unsigned int hash)
+{
+	return &pid_hash_locks[hash & (PID_HASH_LOCKS - 1)].lock;
+}
+
+static void pid_hash_add(struct upid *upid)
+{
+	unsigned int hash = pid_hashfn(upid->nr, upid->ns);
+	spinlock_t *lock = pid_hash_lockp(hash);
+
+	spin_lock(lock);
+	hlist_add_head_rcu(&upid->pid_chain, &pid_hash[hash]);
+	spin_unlock(lock);
+}
+
+static void pid_hash_del(struct upid *upid)
+{
+	spinlock_t *lock = pid_hash_lockp(pid_hashfn(upid->nr, upid->ns));
+
+	spin_lock(lock);
+	hlist_del_rcu(&upid->pid_chain);
+	spin_unlock(lock);
+}
 
 static void free_pidmap(struct upid *upid)
 {
@@ -168,12 +204,12 @@ static int alloc_pidmap(struct pid_namespace *pid_ns)
 			 * Free the page if someone raced with us
 			 * installing it:
 			 */
-			spin_lock_irq(&pidmap_lock);
+			spin_lock_irq(&pid_ns->pidmap_lock);
 			if (!map->page) {
 				map->page = page;
 				page = NULL;
 			}
-			spin_unlock_irq(&pidmap_lock);
+			spin_unlock_irq(&pid_ns->pidmap_lock);
 			kfree(page);
 			if (unlikely(!map->page))
 				break;
@@ -257,12 +293,13 @@ void free_pid(struct pid *pid)
 	int i;
 	unsigned long flags;
 
-	spin_lock_irqsave(&pidmap_lock, flags);
+	local_irq_save(flags);
 	for (i = 0; i <= pid->level; i++) {
 		struct upid *upid = pid->numbers + i;
 		struct pid_namespace *ns = upid->ns;
 
-		hlist_del_rcu(&upid->pid_chain);
+		spin_lock(&ns->pidmap_lock);
+		pid_hash_del(upid);
 
 		switch(--ns->nr_hashed) {
 		case 2:
@@ -277,8 +314,9 @@ void free_pid(struct pid *pid)
 			schedule_work(&ns->proc_work);
 			break;
 		}
+		spin_unlock(&ns->pidmap_lock);
 	}
-	spin_unlock_irqrestore(&pidmap_lock, flags);
+	local_irq_restore(flags);
 
 	for (i = 0; i <= pid->level; i++)
 		free_pidmap(pid->numbers + i);
@@ -321,21 +359,30 @@ struct pid *alloc_pid(struct pid_namespace *ns)
 		INIT_HLIST_HEAD(&pid->tasks[type]);
 
 	upid = pid->numbers + ns->level;
-	spin_lock_irq(&pidmap_lock);
+	/*
+	 * Holding the lock of the innermost namespace keeps
+	 * disable_pid_allocation() from completing until every level
+	 * of the new pid is hashed.
+	 */
+	spin_lock_irq(&ns->pidmap_lock);
 	if (!(ns->nr_hashed & PIDNS_HASH_ADDING))
 		goto out_unlock;
 	for ( ; upid >= pid->numbers; --upid) {
-		hlist_add_head_rcu(&upid->pid_chain,
-				&pid_hash[pid_hashfn(upid->nr, upid->ns)]);
+		if (upid->ns != ns)
+			spin_lock_nested(&upid->ns->pidmap_lock,
+					 SINGLE_DEPTH_NESTING);
+		pid_hash_add(upid);
 		upid->ns->nr_hashed++;
+		if (upid->ns != ns)
+			spin_unlock(&upid->ns->pidmap_lock);
 	}
-	spin_unlock_irq(&pidmap_lock);
+	spin_unlock_irq(&ns->pidmap_lock);
 
 out:
 	return pid;
 
 out_unlock:
-	spin_unlock_irq(&pidmap_lock);
+	spin_unlock_irq(&ns->pidmap_lock);
 	put_pid_ns(ns);
 
 out_free:
@@ -349,9 +396,9 @@ out_free:
 
 void disable_pid_allocation(struct pid_namespace *ns)
 {
-	spin_lock_irq(&pidmap_lock);
+	spin_lock_irq(&ns->pidmap_lock);
 	ns->nr_hashed &= ~PIDNS_HASH_ADDING;
-	spin_unlock_irq(&pidmap_lock);
+	spin_unlock_irq(&ns->pidmap_lock);
 }
 
 struct pid *find_pid_ns(int nr, struct pid_namespace *ns)
@@ -466,10 +513,10 @@ int change_active_pid_ns(struct task_struct *task, struct pid_namespace *ns)
 		ns->child_reaper = task;
 	}
 
-	spin_lock_irq(&pidmap_lock);
-	hlist_add_head_rcu(&upid->pid_chain, &pid_hash[pid_hashfn(nr, ns)]);
+	spin_lock_irq(&ns->pidmap_lock);
+	pid_hash_add(upid);
 	ns->nr_hashed++;
-	spin_unlock_irq(&pidmap_lock);
+	spin_unlock_irq(&ns->pidmap_lock);
 
 	return 0;
 
@@ -633,6 +680,8 @@ void __init pidhash_init(void)
 
 	for (i = 0; i < pidhash_size; i++)
 		INIT_HLIST_HEAD(&pid_hash[i]);
+	for (i = 0; i < PID_HASH_LOCKS; i++)
+		spin_lock_init(&pid_hash_locks[i].lock);
 }
 
 void __init pidmap_init(void)
@@ -120,6 +120,7 @@ static struct pid_namespace *create_pid_namespace(struct user_namespace *user_ns
 	ns->parent = get_pid_ns(parent_pid_ns);
 	ns->user_ns = get_user_ns(user_ns);
 	ns->nr_hashed = PIDNS_HASH_ADDING;
+	spin_lock_init(&ns->pidmap_lock);
 	INIT_WORK(&ns->proc_work, proc_cleanup_work);
 	ns->pid_max = PID_MAX_NS_DEFAULT;
 
@@ -44,6 +44,7 @@
 #include <linux/rculist.h>
 #include <linux/poll.h>
 #include <linux/irq_work.h>
+#include <linux/kthread.h>
 #include <linux/utsname.h>
 #include <linux/vermagic.h>
 #include <linux/ve.h>
@@ -282,6 +283,9 @@ static struct log_state {
 	struct cont cont;
 
 	wait_queue_head_t wait;
+
+	/* VE logs only, the host log is under logbuf_lock */
+	raw_spinlock_t lock;
 } init_log_state = {
 	.buf = __log_buf,
 	.buf_len = __LOG_BUF_LEN,
@@ -313,6 +317,11 @@ static inline struct log_state *ve_log_state(void)
 	return log;
 }
 
+static inline raw_spinlock_t *log_lock(struct log_state *log)
+{
+	return log == &init_log_state ? &logbuf_lock : &log->lock;
+}
+
 void log_poll_wait(struct file *filp, poll_table *p)
 {
 	poll_wait(filp, &ve_log_state()->wait, p);
@@ -574,20 +583,20 @@ static ssize_t devkmsg_read(struct file *file, char __user *buf,
 	ret = mutex_lock_interruptible(&user->lock);
 	if (ret)
 		return ret;
-	raw_spin_lock_irq(&logbuf_lock);
+	raw_spin_lock_irq(log_lock(log));
 	while (user->seq == log->next_seq) {
 		if (file->f_flags & O_NONBLOCK) {
 			ret = -EAGAIN;
-			raw_spin_unlock_irq(&logbuf_lock);
+			raw_spin_unlock_irq(log_lock(log));
 			goto out;
 		}
 
-		raw_spin_unlock_irq(&logbuf_lock);
+		raw_spin_unlock_irq(log_lock(log));
 		ret = wait_event_interruptible(log->wait,
 				user->seq != log->next_seq);
 		if (ret)
 			goto out;
-		raw_spin_lock_irq(&logbuf_lock);
+		raw_spin_lock_irq(log_lock(log));
 	}
 
 	if (user->seq < log->first_seq) {
@@ -595,7 +604,7 @@ static ssize_t devkmsg_read(struct file *file, char __user *buf,
 		user->idx = log->first_idx;
 		user->seq = log->first_seq;
 		ret = -EPIPE;
-		raw_spin_unlock_irq(&logbuf_lock);
+		raw_spin_unlock_irq(log_lock(log));
 		goto out;
 	}
 
@@ -662,7 +671,7 @@ static ssize_t devkmsg_read(struct file *file, char __user *buf,
 
 	user->idx = log_next(log, user->idx);
 	user->seq++;
-	raw_spin_unlock_irq(&logbuf_lock);
+	raw_spin_unlock_irq(log_lock(log));
 
 	if (len > count) {
 		ret = -EINVAL;
@@ -690,7 +699,7 @@ static loff_t devkmsg_llseek(struct file *file, loff_t offset, int whence)
 	if (offset)
 		return -ESPIPE;
 
-	raw_spin_lock_irq(&logbuf_lock);
+	raw_spin_lock_irq(log_lock(log));
 	switch (whence) {
 	case SEEK_SET:
 		/* the first record */
@@ -714,7 +723,7 @@ static loff_t devkmsg_llseek(struct file *file, loff_t offset, int whence)
 	default:
 		ret = -EINVAL;
 	}
-	raw_spin_unlock_irq(&logbuf_lock);
+	raw_spin_unlock_irq(log_lock(log));
 	return ret;
 }
 
@@ -729,7 +738,7 @@ static unsigned int devkmsg_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wait, wait);
 
-	raw_spin_lock_irq(&logbuf_lock);
+	raw_spin_lock_irq(log_lock(log));
 	if (user->seq < log->next_seq) {
 		/* return error when data has vanished underneath us */
 		if (user->seq < log->first_seq)
@@ -737,7 +746,7 @@ static unsigned int devkmsg_poll(struct file *file, poll_table *wait)
 		else
 			ret = POLLIN|POLLRDNORM;
 	}
-	raw_spin_unlock_irq(&logbuf_lock);
+	raw_spin_unlock_irq(log_lock(log));
 
 	return ret;
 }
@@ -763,10 +772,10 @@ static int devkmsg_open(struct inode *inode, struct file *file)
 
 	mutex_init(&user->lock);
 
-	raw_spin_lock_irq(&logbuf_lock);
+	raw_spin_lock_irq(log_lock(log));
 	user->idx = log->first_idx;
 	user->seq = log->first_seq;
-	raw_spin_unlock_irq(&logbuf_lock);
+	raw_spin_unlock_irq(log_lock(log));
 
 	file->private_data = user;
 	return 0;
@@ -1079,7 +1088,7 @@ static int syslog_print(struct log_state *log, char __user *buf, int size)
 		size_t n;
 		size_t skip;
 
-		raw_spin_lock_irq(&logbuf_lock);
+		raw_spin_lock_irq(log_lock(log));
 		if (log->syslog_seq < log->first_seq) {
 			/* messages are gone, move to first one */
 			log->syslog_seq = log->first_seq;
@@ -1088,7 +1097,7 @@ static int syslog_print(struct log_state *log, char __user *buf, int size)
 			log->syslog_partial = 0;
 		}
 		if (log->syslog_seq == log->next_seq) {
-			raw_spin_unlock_irq(&logbuf_lock);
+			raw_spin_unlock_irq(log_lock(log));
 			break;
 		}
 
@@ -1109,7 +1118,7 @@ static int syslog_print(struct log_state *log, char __user *buf, int size)
 			log->syslog_partial += n;
 		} else
 			n = 0;
-		raw_spin_unlock_irq(&logbuf_lock);
+		raw_spin_unlock_irq(log_lock(log));
 
 		if (!n)
 			break;
@@ -1139,7 +1148,7 @@ static int syslog_print_all(struct log_state *log,
 	if (!text)
 		return -ENOMEM;
 
-	raw_spin_lock_irq(&logbuf_lock);
+	raw_spin_lock_irq(log_lock(log));
 	if (buf) {
 		u64 next_seq;
 		u64 seq;
@@ -1200,12 +1209,12 @@ static int syslog_print_all(struct log_state *log,
 			seq++;
 			prev = msg->flags;
 
-			raw_spin_unlock_irq(&logbuf_lock);
+			raw_spin_unlock_irq(log_lock(log));
 			if (copy_to_user(buf + len, text, textlen))
 				len = -EFAULT;
 			else
 				len += textlen;
-			raw_spin_lock_irq(&logbuf_lock);
+			raw_spin_lock_irq(log_lock(log));
 
 			if (seq < log->first_seq) {
 				/* messages are gone, move to next one */
@@ -1220,7 +1229,7 @@ static int syslog_print_all(struct log_state *log,
 		log->clear_seq = log->next_seq;
 		log->clear_idx = log->next_idx;
 	}
-	raw_spin_unlock_irq(&logbuf_lock);
+	raw_spin_unlock_irq(log_lock(log));
 
 	kfree(text);
 	return len;
@@ -1322,7 +1331,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		break;
 	/* Number of chars in the log buffer */
 	case SYSLOG_ACTION_SIZE_UNREAD:
-		raw_spin_lock_irq(&logbuf_lock);
+		raw_spin_lock_irq(log_lock(log));
 		if (log->syslog_seq < log->first_seq) {
 			/* messages are gone, move to first one */
 			log->syslog_seq = log->first_seq;
@@ -1353,7 +1362,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 			}
 			error -= log->syslog_partial;
 		}
-		raw_spin_unlock_irq(&logbuf_lock);
+		raw_spin_unlock_irq(log_lock(log));
 		break;
 	/* Size of the log buffer */
 	case SYSLOG_ACTION_SIZE_BUFFER:
@@ -1602,6 +1611,7 @@ int ve_log_init(struct ve_struct *ve)
 		return -ENOMEM;
 
 	init_waitqueue_head(&log->wait);
+	raw_spin_lock_init(&log->lock);
 	log->buf_len = VE_LOG_BUF_LEN;
 	/* buf will be initialized later by log_state_init() */
 
@@ -1618,89 +1628,29 @@ void ve_log_destroy(struct ve_struct *ve)
 	kfree(log);
 }
 EXPORT_SYMBOL(ve_log_destroy);
-#endif
 
 static int log_state_init(struct log_state *log)
 {
-#ifdef CONFIG_VE
 	if (log->buf)
 		return 0;
 
 	log->buf = kzalloc(log->buf_len, GFP_ATOMIC);
 	if (!log->buf)
 		return -ENOMEM;
-#endif
 	return 0;
 }
+#endif
 
-static int __vprintk_emit(struct log_state *log,
-			  int facility, int level,
-			  const char *dict, size_t dictlen,
-			  const char *fmt, va_list args)
+/*
+ * Strip the syslog prefix and trailing newline from a formatted line and
+ * commit it to @log, through the continuation buffer where possible.
+ * Called with the log's lock held, returns the number of bytes stored.
+ */
+static size_t log_emit_text(struct log_state *log, int facility, int *level,
+			    const char *dict, size_t dictlen,
+			    char *text, size_t text_len)
 {
-	static int recursion_bug;
-	static char textbuf[LOG_LINE_MAX];
-	char *text = textbuf;
-	size_t text_len;
 	enum log_flags lflags = 0;
-	unsigned long flags;
-	int this_cpu;
-	int printed_len = 0;
-	bool need_wake = false;
-	int err;
-
-	boot_delay_msec(level);
-	printk_delay();
-
-	/* This stops the holder of console_sem just where we want him */
-	local_irq_save(flags);
-	this_cpu = smp_processor_id();
-
-	/*
-	 * Ouch, printk recursed into itself!
-	 */
-	if (unlikely(logbuf_cpu == this_cpu)) {
-		/*
-		 * If a crash is occurring during printk() on this CPU,
-		 * then try to get the crash message out but make sure
-		 * we can't deadlock. Otherwise just return to avoid the
-		 * recursion and return - but flag the recursion so that
-		 * it can be printed at the next appropriate moment:
-		 */
-		if (!oops_in_progress && !lockdep_recursing(current)) {
-			recursion_bug = 1;
-			goto out_restore_irqs;
-		}
-		zap_locks();
-	}
-
-	lockdep_off();
-	raw_spin_lock(&logbuf_lock);
-	logbuf_cpu = this_cpu;
-
-	err = log_state_init(log);
-	if (err) {
-		raw_spin_unlock(&logbuf_lock);
-		printed_len = err;
-		goto out_lockdep;
-	}
-
-	if (recursion_bug) {
-		static const char recursion_msg[] =
-			"BUG: recent printk recursion!";
-
-		recursion_bug = 0;
-		printed_len += strlen(recursion_msg);
-		/* emit KERN_CRIT message */
-		log_store(log, 0, 2, LOG_PREFIX|LOG_NEWLINE, 0,
-			  NULL, 0, recursion_msg, printed_len);
-	}
-
-	/*
-	 * The printf needs to come first; we need the syslog
-	 * prefix which might be passed-in as a parameter.
-	 */
-	text_len = vscnprintf(text, sizeof(textbuf), fmt, args);
 
 	/* mark and strip a trailing newline */
 	if (text_len && text[text_len-1] == '\n') {
@@ -1716,8 +1666,8 @@ static int __vprintk_emit(struct log_state *log,
 			const char *end_of_header = printk_skip_level(text);
 			switch (kern_level) {
 			case '0' ... '7':
-				if (level == -1)
-					level = kern_level - '0';
+				if (*level == -1)
+					*level = kern_level - '0';
 			case 'd':	/* KERN_DEFAULT */
 				lflags |= LOG_PREFIX;
 			case 'c':	/* KERN_CONT */
@@ -1728,8 +1678,8 @@ static int __vprintk_emit(struct log_state *log,
 		}
 	}
 
-	if (level == -1)
-		level = default_message_loglevel;
+	if (*level == -1)
+		*level = default_message_loglevel;
 
 	if (dict)
 		lflags |= LOG_PREFIX|LOG_NEWLINE;
@@ -1744,8 +1694,8 @@ static int __vprintk_emit(struct log_state *log,
 			cont_flush(log, LOG_NEWLINE);
 
 		/* buffer line if possible, otherwise store it right away */
-		if (!cont_add(log, facility, level, text, text_len))
-			log_store(log, facility, level, lflags | LOG_CONT, 0,
+		if (!cont_add(log, facility, *level, text, text_len))
+			log_store(log, facility, *level, lflags | LOG_CONT, 0,
 				  dict, dictlen, text, text_len);
 	} else {
 		bool stored = false;
@@ -1758,16 +1708,159 @@ static int __vprintk_emit(struct log_state *log,
 		 */
 		if (log->cont.len && log->cont.owner == current) {
 			if (!(lflags & LOG_PREFIX))
-				stored = cont_add(log, facility, level,
+				stored = cont_add(log, facility, *level,
 						  text, text_len);
 			cont_flush(log, LOG_NEWLINE);
 		}
 
 		if (!stored)
-			log_store(log, facility, level, lflags, 0,
+			log_store(log, facility, *level, lflags, 0,
 				  dict, dictlen, text, text_len);
 	}
-	printed_len += text_len;
+	return text_len;
+}
+
+#ifdef CONFIG_VE
+/*
+ * Container logs never go to the console, so there is no reason to have
+ * them serialized against the host log and each other. Each VE log has its
+ * own lock and the line is formatted in a per-cpu staging buffer before it
+ * is taken, so the lock only covers copying the record into the ring.
+ */
+static DEFINE_PER_CPU(char [LOG_LINE_MAX], ve_log_textbuf);
+static DEFINE_PER_CPU(int, ve_log_busy);
+
+static int ve_vprintk_emit(struct log_state *log,
+			   int facility, int level,
+			   const char *dict, size_t dictlen,
+			   const char *fmt, va_list args)
+{
+	unsigned long flags;
+	bool need_wake = false;
+	size_t text_len;
+	char *text;
+	int ret;
+
+	local_irq_save(flags);
+	/* NMI or recursion from the locked section, drop the message */
+	if (unlikely(__this_cpu_read(ve_log_busy))) {
+		local_irq_restore(flags);
+		return 0;
+	}
+	__this_cpu_write(ve_log_busy, 1);
+
+	text = __get_cpu_var(ve_log_textbuf);
+	text_len = vscnprintf(text, LOG_LINE_MAX, fmt, args);
+
+	lockdep_off();
+	raw_spin_lock(&log->lock);
+	ret = log_state_init(log);
+	if (!ret) {
+		ret = log_emit_text(log, facility, &level,
+				    dict, dictlen, text, text_len);
+		if (log->seen_seq != log->next_seq && !oops_in_progress) {
+			log->seen_seq = log->next_seq;
+			need_wake = true;
+		}
+	}
+	raw_spin_unlock(&log->lock);
+	lockdep_on();
+
+	__this_cpu_write(ve_log_busy, 0);
+	local_irq_restore(flags);
+
+	if (need_wake)
+		wake_up_interruptible(&log->wait);
+
+	return ret;
+}
+#endif
+
+static void wake_up_console(void);
+
+/*
+ * Printing to the console is handed off to the "kconsole" thread, so that
+ * a printk storm does not make whoever happens to hold console_sem print
+ * everybody's messages with interrupts off. Anything critical, and the
+ * early boot, shutdown and oops paths, still print synchronously.
+ */
+static bool __read_mostly console_offload = true;
+module_param(console_offload, bool, S_IRUGO | S_IWUSR);
+
+static struct task_struct *console_task;
+
+static inline bool printk_offload_console(int level)
+{
+	return console_offload && console_task && !oops_in_progress &&
+	       level > 2 && system_state == SYSTEM_RUNNING;
+}
+
+static int __vprintk_emit(struct log_state *log,
+			  int facility, int level,
+			  const char *dict, size_t dictlen,
+			  const char *fmt, va_list args)
+{
+	static int recursion_bug;
+	static char textbuf[LOG_LINE_MAX];
+	size_t text_len;
+	unsigned long flags;
+	int this_cpu;
+	int printed_len = 0;
+	bool offload = false;
+
+#ifdef CONFIG_VE
+	if (log != &init_log_state)
+		return ve_vprintk_emit(log, facility, level,
+				       dict, dictlen, fmt, args);
+#endif
+
+	boot_delay_msec(level);
+	printk_delay();
+
+	/* This stops the holder of console_sem just where we want him */
+	local_irq_save(flags);
+	this_cpu = smp_processor_id();
+
+	/*
+	 * Ouch, printk recursed into itself!
+	 */
+	if (unlikely(logbuf_cpu == this_cpu)) {
+		/*
+		 * If a crash is occurring during printk() on this CPU,
+		 * then try to get the crash message out but make sure
+		 * we can't deadlock. Otherwise just return to avoid the
+		 * recursion and return - but flag the recursion so that
+		 * it can be printed at the next appropriate moment:
+		 */
+		if (!oops_in_progress && !lockdep_recursing(current)) {
+			recursion_bug = 1;
+			goto out_restore_irqs;
+		}
+		zap_locks();
+	}
+
+	lockdep_off();
+	raw_spin_lock(&logbuf_lock);
+	logbuf_cpu = this_cpu;
+
+	if (recursion_bug) {
+		static const char recursion_msg[] =
+			"BUG: recent printk recursion!";
+
+		recursion_bug = 0;
+		printed_len += strlen(recursion_msg);
+		/* emit KERN_CRIT message */
+		log_store(log, 0, 2, LOG_PREFIX|LOG_NEWLINE, 0,
+			  NULL, 0, recursion_msg, printed_len);
+	}
+
+	/*
+	 * The printf needs to come first; we need the syslog
+	 * prefix which might be passed-in as a parameter.
+	 */
+	text_len = vscnprintf(textbuf, sizeof(textbuf), fmt, args);
+	printed_len += log_emit_text(log, facility, &level,
+				     dict, dictlen, textbuf, text_len);
 
 	/*
 	 * Try to acquire and then immediately release the console semaphore.
@@ -1777,23 +1870,19 @@ static int __vprintk_emit(struct log_state *log,
 	 * The console_trylock_for_printk() function will release 'logbuf_lock'
 	 * regardless of whether it actually gets the console semaphore or not.
 	 */
-	if (log != &init_log_state) {
-		if (log->seen_seq != log->next_seq && !oops_in_progress) {
-			log->seen_seq = log->next_seq;
-			need_wake = true;
-		}
+	if (printk_offload_console(level)) {
 		logbuf_cpu = UINT_MAX;
 		raw_spin_unlock(&logbuf_lock);
+		offload = true;
 	} else if (console_trylock_for_printk(this_cpu))
 		console_unlock();
 
-out_lockdep:
 	lockdep_on();
 out_restore_irqs:
 	local_irq_restore(flags);
 
-	if (need_wake)
-		wake_up_interruptible(&log->wait);
+	if (offload)
+		wake_up_console();
 
 	return printed_len;
 }
@@ -2673,6 +2762,7 @@ late_initcall(printk_late_init);
 
 #define PRINTK_PENDING_WAKEUP	0x01
 #define PRINTK_PENDING_SCHED	0x02
+#define PRINTK_PENDING_CONSOLE	0x04
 
 static DEFINE_PER_CPU(int, printk_pending);
 static DEFINE_PER_CPU(char [PRINTK_BUF_SIZE], printk_sched_buf);
@@ -2688,6 +2778,9 @@ static void wake_up_klogd_work_func(struct irq_work *irq_work)
 
 	if (pending & PRINTK_PENDING_WAKEUP)
 		wake_up_interruptible(&init_log_state.wait);
+
+	if (pending & PRINTK_PENDING_CONSOLE)
+		wake_up_process(console_task);
 }
 
 static DEFINE_PER_CPU(struct irq_work, wake_up_klogd_work) = {
@@ -2705,6 +2798,56 @@ void wake_up_klogd(void)
 	preempt_enable();
 }
 
+/* printk() may be called under the runqueue lock, kick the thread later */
+static void wake_up_console(void)
+{
+	preempt_disable();
+	this_cpu_or(printk_pending, PRINTK_PENDING_CONSOLE);
+	irq_work_queue(&__get_cpu_var(wake_up_klogd_work));
+	preempt_enable();
+}
+
+static bool console_flush_pending(void)
+{
+	struct log_state *log = &init_log_state;
+	bool ret;
+
+	raw_spin_lock_irq(&logbuf_lock);
+	ret = log->console_seq != log->next_seq;
+	raw_spin_unlock_irq(&logbuf_lock);
+	return ret;
+}
+
+static int console_thread(void *unused)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		/* resume_console() flushes whatever piled up meanwhile */
+		if (console_suspended || !console_flush_pending())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		console_lock();
+		console_unlock();
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init console_thread_init(void)
+{
+	struct task_struct *task;
+
+	task = kthread_run(console_thread, NULL, "kconsole");
+	if (IS_ERR(task)) {
+		pr_err("printk: failed to start console thread\n");
+		return PTR_ERR(task);
+	}
+	console_task = task;
+	return 0;
+}
+late_initcall(console_thread_init);
+
 int printk_sched(const char *fmt, ...)
 {
 	unsigned long flags;
@@ -151,6 +151,7 @@ EXPORT_SYMBOL(kstat_glob);
 EXPORT_SYMBOL(kstat_glb_lock);
 
 static DEFINE_PER_CPU(struct kstat_lat_pcpu_snap_struct, glob_kstat_lat);
+static DEFINE_PER_CPU(struct kstat_lat_hist_struct, glob_kstat_lat_hist);
 static DEFINE_PER_CPU(struct kstat_lat_pcpu_snap_struct, glob_kstat_page_in);
 static DEFINE_PER_CPU(struct kstat_lat_pcpu_snap_struct, alloc_kstat_lat[KSTAT_ALLOCSTAT_NR]);
 
@@ -165,6 +166,7 @@ void __init kstat_init(void)
 	int i;
 
 	kstat_glob.sched_lat.cur = &glob_kstat_lat;
+	kstat_glob.sched_lat_hist = &glob_kstat_lat_hist;
 	kstat_glob.page_in.cur = &glob_kstat_page_in;
 	for ( i = 0 ; i < KSTAT_ALLOCSTAT_NR ; i++)
 		kstat_glob.alloc_lat[i].cur = &alloc_kstat_lat[i];
@@ -4971,14 +4973,17 @@ EXPORT_SYMBOL_GPL(yield_to);
 void __sched io_schedule(void)
 {
 	struct rq *rq = raw_rq();
+	u64 stall;
 
 	delayacct_blkio_start();
+	stall = kstat_stall_start();
 	atomic_inc(&rq->nr_iowait);
 	blk_flush_plug(current);
 	current->in_iowait = 1;
 	schedule();
 	current->in_iowait = 0;
 	atomic_dec(&rq->nr_iowait);
+	kstat_stall_end(KSTAT_STALL_IO, stall);
 	delayacct_blkio_end();
 }
 EXPORT_SYMBOL(io_schedule);
@@ -4987,14 +4992,17 @@ long __sched io_schedule_timeout(long timeout)
 {
 	struct rq *rq = raw_rq();
 	long ret;
+	u64 stall;
 
 	delayacct_blkio_start();
+	stall = kstat_stall_start();
 	atomic_inc(&rq->nr_iowait);
 	blk_flush_plug(current);
 	current->in_iowait = 1;
 	ret = schedule_timeout(timeout);
 	current->in_iowait = 0;
 	atomic_dec(&rq->nr_iowait);
+	kstat_stall_end(KSTAT_STALL_IO, stall);
 	delayacct_blkio_end();
 	return ret;
 }
@@ -7781,6 +7789,7 @@ static void free_sched_group(struct task_group *tg)
 	free_percpu(tg->taskstats);
 	kfree(tg->cpustat_last);
 	kfree(tg->vcpustat);
+	free_cpumask_var(tg->used_cpus);
 	kfree(tg);
 }
 
@@ -7813,6 +7822,9 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!tg->vcpustat)
 		goto err;
 
+	if (!zalloc_cpumask_var(&tg->used_cpus, GFP_KERNEL))
+		goto err;
+
 	tg->vcpustat_last_update = ktime_set(0, 0);
 	spin_lock_init(&tg->vcpustat_lock);
 
@@ -8362,9 +8374,22 @@ static u64 cpu_shares_read_u64(struct cgroup *cgrp, struct cftype *cft)
 {
 	struct task_group *tg = cgroup_tg(cgrp);
 
+	if (tg->idle)
+		return (u64) scale_load_down(tg->shares_saved);
 	return (u64) scale_load_down(tg->shares);
 }
 
+static int cpu_idle_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+			      u64 idle)
+{
+	return sched_group_set_idle(cgroup_tg(cgrp), idle);
+}
+
+static u64 cpu_idle_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_tg(cgrp)->idle;
+}
+
 int sched_cgroup_set_shares(struct cgroup *cgrp, unsigned long shares)
 {
 	return sched_group_set_shares(cgroup_tg(cgrp), shares);
@@ -8396,7 +8421,8 @@ const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
 static int __cfs_schedulable(struct task_group *tg, u64 period, u64 runtime);
 
 /* call with cfs_constraints_mutex held */
-static int __tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+static int __tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota,
+				  u64 burst)
 {
 	int i, ret = 0, runtime_enabled, runtime_was_enabled;
 	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
@@ -8420,6 +8446,10 @@ static int __tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	if (period > max_cfs_quota_period)
 		return -EINVAL;
 
+	/* A group may not save up more than one more quota */
+	if (quota != RUNTIME_INF && burst > quota)
+		return -EINVAL;
+
 	ret = __cfs_schedulable(tg, period, quota);
 	if (ret)
 		return ret;
@@ -8430,6 +8460,7 @@ static int __tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	raw_spin_lock_irq(&cfs_b->lock);
 	cfs_b->period = ns_to_ktime(period);
 	cfs_b->quota = quota;
+	cfs_b->burst = burst;
 
 	__refill_cfs_bandwidth_runtime(cfs_b);
 	/* restart the period timer (if active) to handle new period expiry */
@@ -8457,12 +8488,13 @@ static int __tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 
 static void tg_update_cpu_limit(struct task_group *tg);
 
-static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota,
+				u64 burst)
 {
 	int ret;
 
 	mutex_lock(&cfs_constraints_mutex);
-	ret = __tg_set_cfs_bandwidth(tg, period, quota);
+	ret = __tg_set_cfs_bandwidth(tg, period, quota, burst);
 	tg_update_cpu_limit(tg);
 	mutex_unlock(&cfs_constraints_mutex);
 
@@ -8479,7 +8511,8 @@ int tg_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
 	else
 		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota,
+				    tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_quota(struct task_group *tg)
@@ -8502,7 +8535,8 @@ int tg_set_cfs_period(struct task_group *tg, long cfs_period_us)
 	period = (u64)cfs_period_us * NSEC_PER_USEC;
 	quota = tg->cfs_bandwidth.quota;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota,
+				    tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_period(struct task_group *tg)
@@ -8515,6 +8549,29 @@ long tg_get_cfs_period(struct task_group *tg)
 	return cfs_period_us;
 }
 
+static int tg_set_cfs_burst(struct task_group *tg, u64 cfs_burst_us)
+{
+	u64 quota, period;
+
+	if (cfs_burst_us > max_cfs_quota_period / NSEC_PER_USEC)
+		return -EINVAL;
+
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	quota = tg->cfs_bandwidth.quota;
+
+	return tg_set_cfs_bandwidth(tg, period, quota,
+				    cfs_burst_us * NSEC_PER_USEC);
+}
+
+static u64 tg_get_cfs_burst(struct task_group *tg)
+{
+	u64 burst_us = tg->cfs_bandwidth.burst;
+
+	do_div(burst_us, NSEC_PER_USEC);
+
+	return burst_us;
+}
+
 static s64 cpu_cfs_quota_read_s64(struct cgroup *cgrp, struct cftype *cft)
 {
 	return tg_get_cfs_quota(cgroup_tg(cgrp));
@@ -8537,6 +8594,17 @@ static int cpu_cfs_period_write_u64(struct cgroup *cgrp, struct cftype *cftype,
 	return tg_set_cfs_period(cgroup_tg(cgrp), cfs_period_us);
 }
 
+static u64 cpu_cfs_burst_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_burst(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_burst_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+				u64 cfs_burst_us)
+{
+	return tg_set_cfs_burst(cgroup_tg(cgrp), cfs_burst_us);
+}
+
 struct cfs_schedulable_data {
 	struct task_group *tg;
 	u64 period, quota;
@@ -8663,7 +8731,8 @@ static int tg_set_cpu_limit(struct task_group *tg,
 	}
 
 	mutex_lock(&cfs_constraints_mutex);
-	ret = __tg_set_cfs_bandwidth(tg, period, quota);
+	ret = __tg_set_cfs_bandwidth(tg, period, quota,
+				     tg->cfs_bandwidth.burst);
 	if (!ret) {
 		tg->cpu_rate = cpu_rate;
 		tg->nr_cpus = nr_cpus;
@@ -8687,6 +8756,24 @@ unsigned long sched_cgroup_get_rate(struct cgroup *cgrp)
 	return cgroup_tg(cgrp)->cpu_rate;
 }
 
+/* Burst is given in cpu_rate units, i.e. as a share of one cpu's period */
+int sched_cgroup_set_burst(struct cgroup *cgrp, unsigned long rate)
+{
+	struct task_group *tg = cgroup_tg(cgrp);
+	u64 period = ktime_to_ns(tg->cfs_bandwidth.period);
+
+	return tg_set_cfs_burst(tg, div_u64(period * rate,
+				MAX_CPU_RATE * NSEC_PER_USEC));
+}
+
+unsigned long sched_cgroup_get_burst(struct cgroup *cgrp)
+{
+	struct task_group *tg = cgroup_tg(cgrp);
+	u64 period = ktime_to_ns(tg->cfs_bandwidth.period);
+
+	return div64_u64(tg->cfs_bandwidth.burst * MAX_CPU_RATE, period);
+}
+
 int sched_cgroup_set_nr_cpus(struct cgroup *cgrp, unsigned int nr_cpus)
 {
 	struct task_group *tg = cgroup_tg(cgrp);
@@ -8897,6 +8984,7 @@ static void cpu_cgroup_update_vcpustat(struct cgroup *cgrp)
 	u64 abs_delta_ns, max_usage;
 	struct kernel_cpustat stat_delta, stat_rem;
 	struct task_group *tg = cgroup_tg(cgrp);
+	const struct cpumask *used = tg_used_cpus(tg);
 	int first_pass = 1;
 
 	spin_lock(&tg->vcpustat_lock);
@@ -8912,7 +9000,7 @@ static void cpu_cgroup_update_vcpustat(struct cgroup *cgrp)
 		 * over pcpus j such that j % nr_vcpus == i */
 		for (i = 0; i < nr_vcpus; i++) {
 			for (j = i; j < nr_cpu_ids; j += nr_vcpus) {
-				if (!cpu_possible(j))
+				if (!cpumask_test_cpu(j, used))
 					continue;
 				kernel_cpustat_add(tg->vcpustat + i,
 						   cpuacct_cpustat(cgrp, j),
@@ -8930,7 +9018,7 @@ static void cpu_cgroup_update_vcpustat(struct cgroup *cgrp)
 		goto out_unlock;
 
 	/* temporarily copy per cpu usage delta to tg->cpustat_last */
-	for_each_possible_cpu(i)
+	for_each_cpu(i, used)
 		kernel_cpustat_sub(cpuacct_cpustat(cgrp, i),
 				   tg->cpustat_last + i,
 				   tg->cpustat_last + i);
@@ -8944,7 +9032,7 @@ again:
 
 		kernel_cpustat_zero(&stat_delta);
 		for (j = i; j < nr_cpu_ids; j += nr_vcpus) {
-			if (!cpu_possible(j))
+			if (!cpumask_test_cpu(j, used))
 				continue;
 			kernel_cpustat_add(&stat_delta,
 					   tg->cpustat_last + j, &stat_delta);
@@ -8972,7 +9060,7 @@ again:
 		goto again;
 	}
 out_update_last:
-	for_each_possible_cpu(i)
+	for_each_cpu(i, used)
 		tg->cpustat_last[i] = *cpuacct_cpustat(cgrp, i);
 	tg->vcpustat_last_update = now;
 out_unlock:
@@ -8998,7 +9086,8 @@ int cpu_cgroup_proc_stat(struct cgroup *cgrp, struct cftype *cft,
 	getboottime(&boottime);
 	jif = boottime.tv_sec + tg->start_time.tv_sec;
 
-	for_each_possible_cpu(i) {
+	/* a container only ever ran on a few cpus, skip the rest */
+	for_each_cpu(i, tg_used_cpus(tg)) {
 		cpu_cgroup_update_stat(cgrp, i);
 
 		/* root task group has autogrouping, so this doesn't hold */
@@ -9089,7 +9178,7 @@ int cpu_cgroup_proc_loadavg(struct cgroup *cgrp, struct cftype *cft,
 	avnrun[1] = tg->avenrun[1] + FIXED_1/200;
 	avnrun[2] = tg->avenrun[2] + FIXED_1/200;
 
-	for_each_possible_cpu(i) {
+	for_each_cpu(i, tg_used_cpus(tg)) {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 		nr_running += tg->cfs_rq[i]->nr_running;
 #endif
@@ -9181,6 +9270,11 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_shares_read_u64,
 		.write_u64 = cpu_shares_write_u64,
 	},
+	{
+		.name = "idle",
+		.read_u64 = cpu_idle_read_u64,
+		.write_u64 = cpu_idle_write_u64,
+	},
 #endif
 #ifdef CONFIG_CFS_BANDWIDTH
 	{
@@ -9193,6 +9287,11 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_cfs_period_read_u64,
 		.write_u64 = cpu_cfs_period_write_u64,
 	},
+	{
+		.name = "cfs_burst_us",
+		.read_u64 = cpu_cfs_burst_read_u64,
+		.write_u64 = cpu_cfs_burst_write_u64,
+	},
 	{
 		.name = "stat",
 		.read_map = cpu_stats_show,
@@ -4,6 +4,7 @@
 #include <linux/kernel_stat.h>
 #include <linux/static_key.h>
 #include <linux/context_tracking.h>
+#include <linux/ve.h>
 #include "sched.h"
 
 
@@ -126,6 +127,31 @@ static inline void task_group_account_field(struct task_struct *p, int index,
 	cpuacct_account_field(p, index, tmp);
 }
 
+#ifdef CONFIG_VE
+/*
+ * Charge @ns of softirq time spent on behalf of @ve to its cpu accounting
+ * group.  Returns the part below the cputime granularity, which the
+ * caller keeps for the next time.
+ */
+u64 ve_account_softirq_time(struct ve_struct *ve, u64 ns)
+{
+	struct task_struct *p;
+	cputime64_t ct = nsecs_to_cputime64(ns);
+
+	if (!ct)
+		return ns;
+
+	rcu_read_lock();
+	/* attached to all the cgroups of the container */
+	p = ACCESS_ONCE(ve->ve_kthread_task);
+	if (p)
+		cpuacct_account_field(p, CPUTIME_SOFTIRQ, (__force u64) ct);
+	rcu_read_unlock();
+
+	return ns - cputime_to_nsecs((__force cputime_t) ct);
+}
+#endif
+
 /*
  * Account user cpu time to a process.
  * @p: the process that the cpu time gets accounted to
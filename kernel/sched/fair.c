@@ -116,6 +116,12 @@ unsigned int sysctl_sched_cfs_bandwidth_slice = 5000UL;
 
 #ifdef CONFIG_CFS_CPULIMIT
 unsigned int sysctl_sched_vcpu_hotslice = 5000000UL;
+
+/*
+ * Wake up tasks of a group that is idle everywhere on the cpu where
+ * the group was last active, if it is idle, or near it.
+ */
+unsigned int sysctl_sched_vcpu_affinity = 1;
 #endif
 
 /*
@@ -520,6 +526,7 @@ static void inc_nr_active_cfs_rqs(struct cfs_rq *cfs_rq)
 	if (hrtimer_try_to_cancel(&cfs_rq->active_timer) != 1)
 		atomic_inc(&cfs_rq->tg->nr_cpus_active);
 	cfs_rq->active = 1;
+	cfs_rq->tg->last_active_cpu = cpu_of(rq_of(cfs_rq));
 }
 
 static void dec_nr_active_cfs_rqs(struct cfs_rq *cfs_rq, int postpone)
@@ -553,15 +560,21 @@ static enum hrtimer_restart sched_cfs_active_timer(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
-static inline int check_cpulimit_spread(struct cfs_rq *cfs_rq, int target_cpu)
+/* How many cpus the group may be active on, 0 means no limit */
+static inline int cpulimit_nr_cpus(struct task_group *tg)
 {
-	struct task_group *tg = cfs_rq->tg;
-	int nr_cpus_active = atomic_read(&tg->nr_cpus_active);
 	int nr_cpus_limit = DIV_ROUND_UP(tg->cpu_rate, MAX_CPU_RATE);
 
-	nr_cpus_limit = nr_cpus_limit && tg->nr_cpus ?
+	return nr_cpus_limit && tg->nr_cpus ?
 		min_t(int, nr_cpus_limit, tg->nr_cpus) :
 		max_t(int, nr_cpus_limit, tg->nr_cpus);
+}
+
+static inline int check_cpulimit_spread(struct cfs_rq *cfs_rq, int target_cpu)
+{
+	struct task_group *tg = cfs_rq->tg;
+	int nr_cpus_active = atomic_read(&tg->nr_cpus_active);
+	int nr_cpus_limit = cpulimit_nr_cpus(tg);
 
 	if (!nr_cpus_limit || nr_cpus_active < nr_cpus_limit)
 		return 1;
@@ -571,6 +584,24 @@ static inline int check_cpulimit_spread(struct cfs_rq *cfs_rq, int target_cpu)
 
 	return cfs_rq_active(tg->cfs_rq[target_cpu]) ? 0 : -1;
 }
+
+#ifdef CONFIG_VE
+/*
+ * Whether work done on behalf of @ve, e.g. packet steering, may be placed
+ * on @cpu without the container's tasks having to follow it off the cpus
+ * its cpulimit currently keeps them on.  Called under rcu_read_lock().
+ */
+bool ve_sched_cpu_allowed(struct ve_struct *ve, int cpu)
+{
+	/* attached to all the cgroups of the container */
+	struct task_struct *p = ACCESS_ONCE(ve->ve_kthread_task);
+
+	if (!p)
+		return true;
+
+	return check_cpulimit_spread(task_group(p)->cfs_rq[cpu], cpu) >= 0;
+}
+#endif
 #else /* !CONFIG_CFS_CPULIMIT */
 static inline int cfs_rq_active(struct cfs_rq *cfs_rq)
 {
@@ -594,6 +625,13 @@ static inline int check_cpulimit_spread(struct cfs_rq *cfs_rq, int target_cpu)
 {
 	return 1;
 }
+
+#ifdef CONFIG_VE
+bool ve_sched_cpu_allowed(struct ve_struct *ve, int cpu)
+{
+	return true;
+}
+#endif
 #endif /* CONFIG_CFS_CPULIMIT */
 
 static __always_inline
@@ -905,6 +943,12 @@ static inline void update_sched_lat(struct task_struct *t, u64 now)
 				cpu, now - ve_wstamp);
 		KSTAT_LAT_PCPU_ADD(&t->task_ve->sched_lat_ve,
 				cpu, now - ve_wstamp);
+		KSTAT_LAT_HIST_ADD(kstat_glob.sched_lat_hist,
+				cpu, now - ve_wstamp);
+		KSTAT_LAT_HIST_ADD(t->task_ve->sched_lat_hist,
+				cpu, now - ve_wstamp);
+		KSTAT_STALL_ADD(&t->task_ve->stall, KSTAT_STALL_CPU,
+				cpu, now - ve_wstamp);
 	}
 #endif
 }
@@ -1165,6 +1209,20 @@ pid_t task_numa_group_id(struct task_struct *p)
 	return p->numa_group ? p->numa_group->gid : 0;
 }
 
+/*
+ * Fairsched binds containers to nodes through their cpuset mems, so do
+ * not place a task on a node its memory may not live on.  Racy with
+ * cpuset updates, which is fine for a placement hint.
+ */
+static inline bool numa_node_allowed(struct task_struct *p, int nid)
+{
+#ifdef CONFIG_CPUSETS
+	return node_isset(nid, p->mems_allowed);
+#else
+	return true;
+#endif
+}
+
 static inline int task_faults_idx(int nid, int priv)
 {
 	return NR_NUMA_HINT_FAULT_TYPES * nid + priv;
@@ -1405,7 +1463,8 @@ static void task_numa_compare(struct task_numa_env *env,
 	 */
 	if (cur) {
 		/* Skip this swap candidate if cannot move to the source cpu */
-		if (!cpumask_test_cpu(env->src_cpu, tsk_cpus_allowed(cur)))
+		if (!cpumask_test_cpu(env->src_cpu, tsk_cpus_allowed(cur)) ||
+		    !numa_node_allowed(cur, env->src_nid))
 			goto unlock;
 
 		/*
@@ -1556,7 +1615,7 @@ static int task_numa_migrate(struct task_struct *p)
 	update_numa_stats(&env.dst_stats, env.dst_nid);
 
 	/* If the preferred nid has capacity, try to use it. */
-	if (env.dst_stats.has_capacity)
+	if (env.dst_stats.has_capacity && numa_node_allowed(p, env.dst_nid))
 		task_numa_find_cpu(&env, taskimp, groupimp);
 
 	/* No space available on the preferred nid. Look elsewhere. */
@@ -1564,6 +1623,8 @@ static int task_numa_migrate(struct task_struct *p)
 		for_each_online_node(nid) {
 			if (nid == env.src_nid || nid == p->numa_preferred_nid)
 				continue;
+			if (!numa_node_allowed(p, nid))
+				continue;
 
 			/* Only consider nodes where both task and groups benefit */
 			taskimp = task_weight(p, nid) - taskweight;
@@ -1820,6 +1881,9 @@ static void task_numa_placement(struct task_struct *p)
 			}
 		}
 
+		if (!numa_node_allowed(p, nid))
+			continue;
+
 		if (faults > max_faults) {
 			max_faults = faults;
 			max_nid = nid;
@@ -1843,6 +1907,8 @@ static void task_numa_placement(struct task_struct *p)
 			unsigned long weight, max_weight = 0;
 
 			for_each_online_node(nid) {
+				if (!numa_node_allowed(p, nid))
+					continue;
 				weight = task_weight(p, nid) + group_weight(p, nid);
 				if (weight > max_weight) {
 					max_weight = weight;
@@ -3367,8 +3433,10 @@ static inline u64 sched_cfs_bandwidth_slice(void)
 
 /*
  * Replenish runtime according to assigned quota and update expiration time.
- * We use sched_clock_cpu directly instead of rq->clock to avoid adding
- * additional synchronization around rq->lock.
+ * Runtime left unused in the global pool is kept, up to burst on top of
+ * quota, so a group idle for a while may run over its quota for a short
+ * spike.  We use sched_clock_cpu directly instead of rq->clock to avoid
+ * adding additional synchronization around rq->lock.
  *
  * requires cfs_b->lock
  */
@@ -3380,7 +3448,8 @@ void __refill_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b)
 		return;
 
 	now = sched_clock_cpu(smp_processor_id());
-	cfs_b->runtime = cfs_b->quota;
+	cfs_b->runtime = min(cfs_b->runtime + cfs_b->quota,
+			     cfs_b->quota + cfs_b->burst);
 	cfs_b->runtime_expires = now + ktime_to_ns(cfs_b->period);
 }
 
@@ -3398,39 +3467,108 @@ static inline u64 cfs_rq_clock_task(struct cfs_rq *cfs_rq)
 	return rq_clock_task(rq_of(cfs_rq)) - cfs_rq->throttled_clock_task_time;
 }
 
+/*
+ * Take up to @want of runtime from the global pool, @min_amount is enough
+ * if there is no limit.  Returns the amount taken.
+ *
+ * requires cfs_b->lock
+ */
+static u64 __take_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b,
+					u64 min_amount, u64 want)
+{
+	u64 amount = 0;
+
+	if (cfs_b->quota == RUNTIME_INF)
+		return min_amount;
+
+	/*
+	 * If the bandwidth pool has become inactive, then at least one
+	 * period must have elapsed since the last consumption.
+	 * Refresh the global state and ensure bandwidth timer becomes
+	 * active.
+	 */
+	if (!cfs_b->timer_active) {
+		__refill_cfs_bandwidth_runtime(cfs_b);
+		__start_cfs_bandwidth(cfs_b);
+	}
+
+	if (cfs_b->runtime > 0) {
+		amount = min(cfs_b->runtime, want);
+		cfs_b->runtime -= amount;
+		cfs_b->idle = 0;
+	}
+	return amount;
+}
+
+/*
+ * On NUMA hosts cfs_b->lock would be taken by every cpu of the group
+ * each slice.  Instead cpus take runtime from a pool of their node, which
+ * takes it from the global pool a few slices at once, but no more than
+ * the node's share of quota, so that nodes do not starve each other.
+ * Pooled runtime is only valid for the period it was issued in.
+ */
+#define CFS_POOL_BATCH	4	/* slices */
+
+static u64 assign_pool_runtime(struct cfs_bandwidth *cfs_b,
+			       struct cfs_rq *cfs_rq, u64 min_amount,
+			       u64 *expires)
+{
+	struct cfs_bandwidth_pool *pool;
+	u64 amount, batch;
+
+	pool = cfs_b->pools[cpu_to_node(cpu_of(rq_of(cfs_rq)))];
+
+	raw_spin_lock(&pool->lock);
+	if (pool->runtime_expires != ACCESS_ONCE(cfs_b->runtime_expires))
+		pool->runtime = 0;
+
+	if (pool->runtime < min_amount) {
+		batch = min_t(u64, CFS_POOL_BATCH * sched_cfs_bandwidth_slice(),
+			      div_u64(ACCESS_ONCE(cfs_b->quota),
+				      num_online_nodes()));
+		batch = max(batch, min_amount);
+
+		raw_spin_lock(&cfs_b->lock);
+		amount = __take_cfs_bandwidth_runtime(cfs_b, min_amount,
+						      batch - pool->runtime);
+		/* the period could be refreshed meanwhile */
+		if (pool->runtime_expires != cfs_b->runtime_expires) {
+			pool->runtime = 0;
+			pool->runtime_expires = cfs_b->runtime_expires;
+		}
+		raw_spin_unlock(&cfs_b->lock);
+
+		pool->runtime += amount;
+	}
+
+	amount = min(pool->runtime, min_amount);
+	pool->runtime -= amount;
+	*expires = pool->runtime_expires;
+	raw_spin_unlock(&pool->lock);
+
+	return amount;
+}
+
 /* returns 0 on failure to allocate runtime */
 static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 {
 	struct task_group *tg = cfs_rq->tg;
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(tg);
-	u64 amount = 0, min_amount, expires;
+	u64 amount, min_amount, expires;
 
 	/* note: this is a positive sum as runtime_remaining <= 0 */
 	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
 
-	raw_spin_lock(&cfs_b->lock);
-	if (cfs_b->quota == RUNTIME_INF)
-		amount = min_amount;
-	else {
-		/*
-		 * If the bandwidth pool has become inactive, then at least one
-		 * period must have elapsed since the last consumption.
-		 * Refresh the global state and ensure bandwidth timer becomes
-		 * active.
-		 */
-		if (!cfs_b->timer_active) {
-			__refill_cfs_bandwidth_runtime(cfs_b);
-			__start_cfs_bandwidth(cfs_b);
-		}
-
-		if (cfs_b->runtime > 0) {
-			amount = min(cfs_b->runtime, min_amount);
-			cfs_b->runtime -= amount;
-			cfs_b->idle = 0;
-		}
+	if (cfs_b->pools) {
+		amount = assign_pool_runtime(cfs_b, cfs_rq, min_amount,
+					     &expires);
+	} else {
+		raw_spin_lock(&cfs_b->lock);
+		amount = __take_cfs_bandwidth_runtime(cfs_b, min_amount,
+						      min_amount);
+		expires = cfs_b->runtime_expires;
+		raw_spin_unlock(&cfs_b->lock);
 	}
-	expires = cfs_b->runtime_expires;
-	raw_spin_unlock(&cfs_b->lock);
 
 	cfs_rq->runtime_remaining += amount;
 	/*
@@ -3994,10 +4132,40 @@ void __start_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 	start_bandwidth_timer(&cfs_b->period_timer, cfs_b->period);
 }
 
+static int alloc_cfs_bandwidth_pools(struct cfs_bandwidth *cfs_b)
+{
+	struct cfs_bandwidth_pool *pool;
+	int node;
+
+	if (nr_node_ids == 1)
+		return 0;
+
+	cfs_b->pools = kzalloc(sizeof(pool) * nr_node_ids, GFP_KERNEL);
+	if (!cfs_b->pools)
+		return -ENOMEM;
+
+	for_each_node(node) {
+		pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, node);
+		if (!pool)
+			return -ENOMEM;
+		raw_spin_lock_init(&pool->lock);
+		cfs_b->pools[node] = pool;
+	}
+	return 0;
+}
+
 static void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 {
+	int node;
+
 	hrtimer_cancel(&cfs_b->period_timer);
 	hrtimer_cancel(&cfs_b->slack_timer);
+
+	if (cfs_b->pools) {
+		for_each_node(node)
+			kfree(cfs_b->pools[node]);
+		kfree(cfs_b->pools);
+	}
 }
 
 static void __maybe_unused unthrottle_offline_cfs_rqs(struct rq *rq)
@@ -4052,6 +4220,10 @@ static inline struct cfs_bandwidth *tg_cfs_bandwidth(struct task_group *tg)
 {
 	return NULL;
 }
+static inline int alloc_cfs_bandwidth_pools(struct cfs_bandwidth *cfs_b)
+{
+	return 0;
+}
 static inline void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b) {}
 static inline void unthrottle_offline_cfs_rqs(struct rq *rq) {}
 
@@ -4698,6 +4870,124 @@ done:
 	return target;
 }
 
+#if defined(CONFIG_SMP) && defined(CONFIG_CFS_CPULIMIT)
+/*
+ * Would making @cpu active spread the group over two LLCs while it fits
+ * into one?  @src_cpu is the cpu the group leaves, or -1.
+ * Called under rcu_read_lock().
+ */
+static bool cpulimit_spread_llc(struct task_group *tg, int cpu, int src_cpu)
+{
+	int nr_cpus_active = atomic_read(&tg->nr_cpus_active);
+	int nr_cpus_limit = cpulimit_nr_cpus(tg);
+	struct sched_domain *sd;
+	int i;
+
+	if (src_cpu >= 0 && cfs_rq_active(tg->cfs_rq[src_cpu]))
+		nr_cpus_active--;
+	if (!nr_cpus_limit || nr_cpus_active <= 0)
+		return false;
+
+	sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	if (!sd || sd->span_weight < nr_cpus_limit)
+		return false;
+
+	for_each_cpu(i, sched_domain_span(sd)) {
+		if (i != src_cpu && cfs_rq_active(tg->cfs_rq[i]))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * The group is not active anywhere: go back to the cpu it was last
+ * active on while its caches may still be warm, unless it is busy.
+ */
+static bool cpulimit_warm_cpu(struct task_struct *p, struct task_group *tg,
+			      int *new_cpu)
+{
+	struct sched_domain *sd;
+	int cpu = ACCESS_ONCE(tg->last_active_cpu);
+
+	if (!sysctl_sched_vcpu_affinity || tg == &root_task_group ||
+	    cpu < 0 || !cpumask_test_cpu(cpu, tsk_cpus_allowed(p)) ||
+	    !cpu_online(cpu))
+		return false;
+
+	if (idle_cpu(cpu)) {
+		*new_cpu = cpu;
+		return true;
+	}
+
+	/* The cpu is taken by others, its siblings share at least the LLC */
+	sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	if (!sd)
+		return false;
+	for_each_cpu_and(cpu, sched_domain_span(sd), tsk_cpus_allowed(p)) {
+		if (idle_cpu(cpu)) {
+			*new_cpu = cpu;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The group may become active on one more cpu.  Prefer an idle one
+ * sharing a cache with the cpus it already runs on, siblings first.
+ */
+static bool cpulimit_pack_cpu(struct task_struct *p, struct task_group *tg,
+			      int *new_cpu)
+{
+	struct sched_domain *sd, *llc;
+	int cpu, anchor = -1;
+
+	if (!atomic_read(&tg->nr_cpus_active))
+		return cpulimit_warm_cpu(p, tg, new_cpu);
+
+	if (cfs_rq_active(tg->cfs_rq[*new_cpu]) ||
+	    !cpulimit_spread_llc(tg, *new_cpu, -1))
+		return false;
+
+	for_each_domain(*new_cpu, sd) {
+		for_each_cpu(cpu, sched_domain_span(sd)) {
+			if (cfs_rq_active(tg->cfs_rq[cpu])) {
+				anchor = cpu;
+				goto found;
+			}
+		}
+	}
+	return false;
+
+found:
+	llc = rcu_dereference(per_cpu(sd_llc, anchor));
+	for_each_domain(anchor, sd) {
+		for_each_cpu_and(cpu, sched_domain_span(sd),
+				 tsk_cpus_allowed(p)) {
+			if (idle_cpu(cpu)) {
+				*new_cpu = cpu;
+				return true;
+			}
+		}
+		if (sd == llc)
+			break;
+	}
+	return false;
+}
+#else
+static inline bool cpulimit_spread_llc(struct task_group *tg, int cpu,
+				       int src_cpu)
+{
+	return false;
+}
+
+static inline bool cpulimit_pack_cpu(struct task_struct *p,
+				     struct task_group *tg, int *new_cpu)
+{
+	return false;
+}
+#endif
+
 static inline bool select_runnable_cpu(struct task_struct *p, int *new_cpu)
 {
 	struct cfs_rq *cfs_rq;
@@ -4708,7 +4998,7 @@ static inline bool select_runnable_cpu(struct task_struct *p, int *new_cpu)
 
 	cfs_rq = top_cfs_rq_of(&p->se);
 	if (check_cpulimit_spread(cfs_rq, *new_cpu) > 0)
-		return false;
+		return cpulimit_pack_cpu(p, cfs_rq->tg, new_cpu);
 
 	tg = cfs_rq->tg;
 
@@ -4947,6 +5237,16 @@ static void set_skip_buddy(struct sched_entity *se)
 /*
  * Preempt the current task with a newly woken task if needed:
  */
+/* an idle task, or the entity of an idle group */
+static inline int se_is_idle(struct sched_entity *se)
+{
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	if (!entity_is_task(se))
+		return group_cfs_rq(se)->tg->idle;
+#endif
+	return task_of(se)->policy == SCHED_IDLE;
+}
+
 static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_flags)
 {
 	struct task_struct *curr = rq->curr;
@@ -4998,8 +5298,19 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 		return;
 
 	find_matching_se(&se, &pse);
-	update_curr(cfs_rq_of(se));
 	BUG_ON(!pse);
+
+	/*
+	 * Same as for idle tasks above, but at the level where the
+	 * hierarchies of curr and p meet: idle groups are preempted by
+	 * anyone else at once and preempt only each other.
+	 */
+	if (se_is_idle(se) && !se_is_idle(pse))
+		goto preempt;
+	if (se_is_idle(se) != se_is_idle(pse))
+		return;
+
+	update_curr(cfs_rq_of(se));
 	if (wakeup_preempt_entity(se, pse) == 1) {
 		/*
 		 * Bias pick_next to pick the sched entity that is
@@ -5478,6 +5789,12 @@ int can_migrate_task(struct task_struct *p, struct lb_env *env)
 		return 0;
 	}
 
+	if (!cfs_rq_active(cfs_rq->tg->cfs_rq[env->dst_cpu]) &&
+	    cpulimit_spread_llc(cfs_rq->tg, env->dst_cpu, -1)) {
+		schedstat_inc(p, se.statistics.nr_failed_migrations_cpulimit);
+		return 0;
+	}
+
 	/*
 	 * We do not migrate tasks that are:
 	 * 1) throttled_lb_pair, or
@@ -5729,6 +6046,11 @@ static int move_task_groups(struct lb_env *env)
 		    cfs_rq_active(top_cfs_rq->tg->cfs_rq[env->dst_cpu]))
 			continue;
 
+		/* Move the group to another LLC only if it moves there whole */
+		if (cpulimit_spread_llc(top_cfs_rq->tg, env->dst_cpu,
+					env->src_cpu))
+			continue;
+
 		load = entity_h_load(top_cfs_rq->tg->se[env->src_cpu]);
 		if ((load / 2) > env->imbalance)
 			continue;
@@ -7946,8 +8268,13 @@ int alloc_fair_sched_group(struct task_group *tg, struct task_group *parent)
 		goto err;
 
 	tg->shares = NICE_0_LOAD;
+#ifdef CONFIG_CFS_CPULIMIT
+	tg->last_active_cpu = -1;
+#endif
 
 	init_cfs_bandwidth(tg_cfs_bandwidth(tg));
+	if (alloc_cfs_bandwidth_pools(tg_cfs_bandwidth(tg)))
+		goto err;
 
 	for_each_possible_cpu(i) {
 		cfs_rq = kzalloc_node(sizeof(struct cfs_rq),
@@ -8023,22 +8350,15 @@ void init_tg_cfs_entry(struct task_group *tg, struct cfs_rq *cfs_rq,
 
 static DEFINE_MUTEX(shares_mutex);
 
-int sched_group_set_shares(struct task_group *tg, unsigned long shares)
+/* requires shares_mutex */
+static void __sched_group_set_shares(struct task_group *tg,
+				     unsigned long shares)
 {
 	int i;
 	unsigned long flags;
 
-	/*
-	 * We can't change the weight of the root cgroup.
-	 */
-	if (!tg->se[0])
-		return -EINVAL;
-
-	shares = clamp(shares, scale_load(MIN_SHARES), scale_load(MAX_SHARES));
-
-	mutex_lock(&shares_mutex);
 	if (tg->shares == shares)
-		goto done;
+		return;
 
 	tg->shares = shares;
 	for_each_possible_cpu(i) {
@@ -8052,8 +8372,52 @@ int sched_group_set_shares(struct task_group *tg, unsigned long shares)
 			update_cfs_shares(group_cfs_rq(se));
 		raw_spin_unlock_irqrestore(&rq->lock, flags);
 	}
+}
 
-done:
+int sched_group_set_shares(struct task_group *tg, unsigned long shares)
+{
+	/*
+	 * We can't change the weight of the root cgroup.
+	 */
+	if (!tg->se[0])
+		return -EINVAL;
+
+	shares = clamp(shares, scale_load(MIN_SHARES), scale_load(MAX_SHARES));
+
+	mutex_lock(&shares_mutex);
+	if (tg->idle)
+		tg->shares_saved = shares;
+	else
+		__sched_group_set_shares(tg, shares);
+	mutex_unlock(&shares_mutex);
+	return 0;
+}
+
+/*
+ * An idle group gets the weight of a SCHED_IDLE task and yields to
+ * wakeups of everyone else (see check_preempt_wakeup), so that it only
+ * uses the cpu time other groups leave.  Its shares are kept aside and
+ * come back once it's not idle anymore.
+ */
+int sched_group_set_idle(struct task_group *tg, int idle)
+{
+	if (!tg->se[0])
+		return -EINVAL;
+
+	idle = !!idle;
+
+	mutex_lock(&shares_mutex);
+	if (tg->idle != idle) {
+		if (idle) {
+			tg->shares_saved = tg->shares;
+			tg->idle = 1;
+			__sched_group_set_shares(tg,
+					scale_load(WEIGHT_IDLEPRIO));
+		} else {
+			tg->idle = 0;
+			__sched_group_set_shares(tg, tg->shares_saved);
+		}
+	}
 	mutex_unlock(&shares_mutex);
 	return 0;
 }
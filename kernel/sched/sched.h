@@ -114,11 +114,18 @@ struct rt_rq;
 
 extern struct list_head task_groups;
 
+/* Runtime taken from cfs_bandwidth by cpus of one node, see fair.c */
+struct cfs_bandwidth_pool {
+	raw_spinlock_t lock;
+	u64 runtime, runtime_expires;
+};
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t lock;
 	ktime_t period;
 	u64 quota, runtime;
+	u64 burst;	/* how much unused runtime may be carried over */
 	s64 hierarchal_quota;
 	u64 runtime_expires;
 
@@ -126,6 +133,9 @@ struct cfs_bandwidth {
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
+	/* per node, NULL on single node systems and for the root group */
+	struct cfs_bandwidth_pool **pools;
+
 	/* statistics */
 	int nr_periods, nr_throttled;
 	u64 throttled_time;
@@ -142,6 +152,9 @@ struct task_group {
 	/* runqueue "owned" by this group on each cpu */
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
+	/* runs only when nobody else wants the cpu, see sched_group_set_idle */
+	int idle;
+	unsigned long shares_saved;	/* shares to restore when not idle */
 
 	atomic_t load_weight;
 	atomic64_t load_avg;
@@ -174,6 +187,12 @@ struct task_group {
 	struct kernel_cpustat *vcpustat;
 	ktime_t vcpustat_last_update;
 	spinlock_t vcpustat_lock;
+	/*
+	 * Cpus tasks of the group ever were on.  Per cpu stats of other
+	 * cpus are zero, so /proc/stat of a container need not look at
+	 * them.  Not maintained for root_task_group, see tg_used_cpus().
+	 */
+	cpumask_var_t used_cpus;
 
 	struct cfs_bandwidth cfs_bandwidth;
 
@@ -182,6 +201,7 @@ struct task_group {
 	unsigned long cpu_rate;
 	unsigned int nr_cpus;
 	atomic_t nr_cpus_active;
+	int last_active_cpu;	/* -1 if never active */
 #endif
 };
 
@@ -247,6 +267,7 @@ extern void sched_move_task(struct task_struct *tsk);
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 extern int sched_group_set_shares(struct task_group *tg, unsigned long shares);
+extern int sched_group_set_idle(struct task_group *tg, int idle);
 #endif
 
 #else /* CONFIG_CGROUP_SCHED */
@@ -749,11 +770,25 @@ static inline struct task_group *task_group(struct task_struct *p)
 }
 
 /* Change a task's cfs_rq and parent entity if it moves across CPUs/groups */
+static inline void tg_mark_cpu_used(struct task_group *tg, unsigned int cpu)
+{
+	for (; tg && tg != &root_task_group; tg = tg->parent)
+		if (!cpumask_test_cpu(cpu, tg->used_cpus))
+			cpumask_set_cpu(cpu, tg->used_cpus);
+}
+
+static inline const struct cpumask *tg_used_cpus(struct task_group *tg)
+{
+	if (tg == &root_task_group)
+		return cpu_possible_mask;
+	return tg->used_cpus;
+}
+
 static inline void set_task_rq(struct task_struct *p, unsigned int cpu)
 {
-#if defined(CONFIG_FAIR_GROUP_SCHED) || defined(CONFIG_RT_GROUP_SCHED)
 	struct task_group *tg = task_group(p);
-#endif
+
+	tg_mark_cpu_used(tg, cpu);
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	p->se.cfs_rq = tg->cfs_rq[cpu];
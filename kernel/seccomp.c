@@ -38,8 +38,8 @@
  *         outside of a lifetime-guarded section.  In general, this
  *         is only needed for handling filters shared across tasks.
  * @prev: points to a previously installed, or inherited, filter
- * @len: the number of instructions in the program
- * @insns: the BPF program instructions to evaluate
+ * @cache: results of @prog for syscalls it decides on the number alone
+ * @prog: the BPF program to evaluate, JIT-compiled if possible
  *
  * seccomp_filter objects are organized in a tree linked via the @prev
  * pointer.  For any task, it appears to be a singly-linked list starting
@@ -54,13 +54,33 @@
 struct seccomp_filter {
 	atomic_t usage;
 	struct seccomp_filter *prev;
-	unsigned short len;  /* Instruction count */
-	struct sock_filter insns[];
+	struct seccomp_cache *cache;
+	struct sk_filter *prog;
 };
 
 /* Limit any path through the tree to 256KB worth of instructions. */
 #define MAX_INSNS_PER_PATH ((1 << 18) / sizeof(struct sock_filter))
 
+/* Enough for the native and the compat syscall tables */
+#define SECCOMP_CACHE_NR	512
+
+/**
+ * struct seccomp_cache - per syscall results of a seccomp filter
+ *
+ * @arch: the AUDIT_ARCH_* the results were computed for
+ * @known: set for syscalls whose result does not depend on the arguments
+ * @ret: the filter result for each syscall set in @known
+ *
+ * Most filters are a list of "syscall X -> verdict" rules, and for those
+ * running the program is a waste of time.  The cache is built once at
+ * attach time and is never modified afterwards.
+ */
+struct seccomp_cache {
+	u32 arch;
+	DECLARE_BITMAP(known, SECCOMP_CACHE_NR);
+	u32 ret[SECCOMP_CACHE_NR];
+};
+
 /**
  * get_u32 - returns a u32 offset into data
  * @data: a unsigned 64 bit value
@@ -193,6 +213,189 @@ static int seccomp_check_filter(struct sock_filter *filter, unsigned int flen)
 	return 0;
 }
 
+/**
+ * seccomp_eval_const - runs a checked filter knowing only arch and nr
+ * @filter: filter rewritten by seccomp_check_filter
+ * @flen: length of filter
+ * @arch: the AUDIT_ARCH_* value seen by the filter
+ * @nr: the syscall number seen by the filter
+ * @ret: where to store the result
+ *
+ * This mirrors sk_run_filter(), but tracks which of A, X and mem[] are
+ * known.  Loads of the arguments or the instruction pointer make A
+ * unknown, and so does any ALU operation, for simplicity.
+ *
+ * Returns true if the filter reaches a RET without a branch on or a
+ * return of an unknown value.  The result is then valid for every call
+ * of @nr.
+ */
+static bool seccomp_eval_const(const struct sock_filter *filter,
+			       unsigned int flen, u32 arch, int nr, u32 *ret)
+{
+	u32 A = 0, X = 0, mem[BPF_MEMWORDS] = { 0 };
+	bool a_known = true, x_known = true;
+	unsigned int mem_known = ~0U;
+	unsigned int pc;
+	bool cond;
+
+	for (pc = 0; pc < flen; pc++) {
+		const struct sock_filter *f = &filter[pc];
+		u32 K = f->k;
+
+		switch (f->code) {
+		case BPF_S_ANC_SECCOMP_LD_W:
+			a_known = true;
+			if (K == BPF_DATA(nr))
+				A = nr;
+			else if (K == BPF_DATA(arch))
+				A = arch;
+			else
+				a_known = false;
+			continue;
+		case BPF_S_LD_IMM:
+			A = K;
+			a_known = true;
+			continue;
+		case BPF_S_LDX_IMM:
+			X = K;
+			x_known = true;
+			continue;
+		case BPF_S_LD_MEM:
+			A = mem[K];
+			a_known = mem_known & (1U << K);
+			continue;
+		case BPF_S_LDX_MEM:
+			X = mem[K];
+			x_known = mem_known & (1U << K);
+			continue;
+		case BPF_S_ST:
+			mem[K] = A;
+			mem_known = a_known ? mem_known | (1U << K) :
+					      mem_known & ~(1U << K);
+			continue;
+		case BPF_S_STX:
+			mem[K] = X;
+			mem_known = x_known ? mem_known | (1U << K) :
+					      mem_known & ~(1U << K);
+			continue;
+		case BPF_S_MISC_TAX:
+			X = A;
+			x_known = a_known;
+			continue;
+		case BPF_S_MISC_TXA:
+			A = X;
+			a_known = x_known;
+			continue;
+		case BPF_S_RET_K:
+			*ret = K;
+			return true;
+		case BPF_S_RET_A:
+			if (!a_known)
+				return false;
+			*ret = A;
+			return true;
+		case BPF_S_JMP_JA:
+			pc += K;
+			continue;
+		case BPF_S_JMP_JEQ_X:
+		case BPF_S_JMP_JGE_X:
+		case BPF_S_JMP_JGT_X:
+		case BPF_S_JMP_JSET_X:
+			if (!x_known)
+				return false;
+			K = X;
+			/* fall through */
+		case BPF_S_JMP_JEQ_K:
+		case BPF_S_JMP_JGE_K:
+		case BPF_S_JMP_JGT_K:
+		case BPF_S_JMP_JSET_K:
+			if (!a_known)
+				return false;
+			switch (f->code) {
+			case BPF_S_JMP_JEQ_X:
+			case BPF_S_JMP_JEQ_K:
+				cond = A == K;
+				break;
+			case BPF_S_JMP_JGE_X:
+			case BPF_S_JMP_JGE_K:
+				cond = A >= K;
+				break;
+			case BPF_S_JMP_JGT_X:
+			case BPF_S_JMP_JGT_K:
+				cond = A > K;
+				break;
+			default:
+				cond = A & K;
+				break;
+			}
+			pc += cond ? f->jt : f->jf;
+			continue;
+		default:
+			/* ALU operations, the only ones left */
+			a_known = false;
+			continue;
+		}
+	}
+	return false;
+}
+
+/**
+ * seccomp_build_cache - fills in @filter->cache for the current arch
+ * @filter: a checked filter
+ *
+ * The cache is only an optimization: nothing is cached on failure or
+ * if no syscall is decided on its number alone.
+ */
+static void seccomp_build_cache(struct seccomp_filter *filter)
+{
+	struct seccomp_cache *cache;
+	bool any = false;
+	int nr;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL|__GFP_NOWARN);
+	if (!cache)
+		return;
+
+	cache->arch = syscall_get_arch();
+	for (nr = 0; nr < SECCOMP_CACHE_NR; nr++) {
+		if (seccomp_eval_const(filter->prog->insns, filter->prog->len,
+				       cache->arch, nr, &cache->ret[nr])) {
+			__set_bit(nr, cache->known);
+			any = true;
+		}
+	}
+
+	if (!any) {
+		kfree(cache);
+		return;
+	}
+	filter->cache = cache;
+}
+
+static inline bool seccomp_cache_lookup(struct seccomp_filter *f,
+					u32 arch, int syscall, u32 *ret)
+{
+	struct seccomp_cache *cache = f->cache;
+
+	if (!cache || cache->arch != arch ||
+	    syscall < 0 || syscall >= SECCOMP_CACHE_NR ||
+	    !test_bit(syscall, cache->known))
+		return false;
+
+	*ret = cache->ret[syscall];
+	return true;
+}
+
+static void seccomp_filter_free(struct seccomp_filter *filter)
+{
+	if (filter->prog) {
+		bpf_jit_free(filter->prog);
+		kfree(filter->prog);
+	}
+	kfree(filter->cache);
+	kfree(filter);
+}
+
 /**
  * seccomp_run_filters - evaluates all seccomp filters against @syscall
  * @syscall: number of the current system call
@@ -203,17 +406,23 @@ static u32 seccomp_run_filters(int syscall)
 {
 	struct seccomp_filter *f;
 	u32 ret = SECCOMP_RET_ALLOW;
+	u32 arch;
 
 	/* Ensure unexpected behavior doesn't result in failing open. */
 	if (WARN_ON(current->seccomp.filter == NULL))
 		return SECCOMP_RET_KILL;
 
+	arch = syscall_get_arch();
+
 	/*
 	 * All filters in the list are evaluated and the lowest BPF return
 	 * value always takes priority (ignoring the DATA).
 	 */
 	for (f = current->seccomp.filter; f; f = f->prev) {
-		u32 cur_ret = sk_run_filter(NULL, f->insns);
+		u32 cur_ret;
+
+		if (!seccomp_cache_lookup(f, arch, syscall, &cur_ret))
+			cur_ret = SK_RUN_FILTER(f->prog, NULL);
 		if ((cur_ret & SECCOMP_RET_ACTION) < (ret & SECCOMP_RET_ACTION))
 			ret = cur_ret;
 	}
@@ -236,8 +445,9 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 	if (fprog->len == 0 || fprog->len > BPF_MAXINSNS)
 		return -EINVAL;
 
+	/* include a 4 instr penalty */
 	for (filter = current->seccomp.filter; filter; filter = filter->prev)
-		total_insns += filter->len + 4;  /* include a 4 instr penalty */
+		total_insns += filter->prog->len + 4;
 	if (total_insns > MAX_INSNS_PER_PATH)
 		return -ENOMEM;
 
@@ -253,28 +463,38 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 		return -EACCES;
 
 	/* Allocate a new seccomp_filter */
-	filter = kzalloc(sizeof(struct seccomp_filter) + fp_size,
-			 GFP_KERNEL|__GFP_NOWARN);
+	filter = kzalloc(sizeof(struct seccomp_filter), GFP_KERNEL|__GFP_NOWARN);
 	if (!filter)
 		return -ENOMEM;
 	atomic_set(&filter->usage, 1);
-	filter->len = fprog->len;
+
+	ret = -ENOMEM;
+	filter->prog = kzalloc(sizeof(struct sk_filter) + fp_size,
+			       GFP_KERNEL|__GFP_NOWARN);
+	if (!filter->prog)
+		goto fail;
+	atomic_set(&filter->prog->refcnt, 1);
+	filter->prog->len = fprog->len;
+	filter->prog->bpf_func = sk_run_filter;
 
 	/* Copy the instructions from fprog. */
 	ret = -EFAULT;
-	if (copy_from_user(filter->insns, fprog->filter, fp_size))
+	if (copy_from_user(filter->prog->insns, fprog->filter, fp_size))
 		goto fail;
 
 	/* Check and rewrite the fprog via the skb checker */
-	ret = sk_chk_filter(filter->insns, filter->len);
+	ret = sk_chk_filter(filter->prog->insns, filter->prog->len);
 	if (ret)
 		goto fail;
 
 	/* Check and rewrite the fprog for seccomp use */
-	ret = seccomp_check_filter(filter->insns, filter->len);
+	ret = seccomp_check_filter(filter->prog->insns, filter->prog->len);
 	if (ret)
 		goto fail;
 
+	bpf_jit_compile(filter->prog);
+	seccomp_build_cache(filter);
+
 	/*
 	 * If there is an existing filter, make it the prev and don't drop its
 	 * task reference.
@@ -283,7 +503,7 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 	current->seccomp.filter = filter;
 	return 0;
 fail:
-	kfree(filter);
+	seccomp_filter_free(filter);
 	return ret;
 }
 
@@ -332,7 +552,7 @@ void put_seccomp_filter(struct task_struct *tsk)
 	while (orig && atomic_dec_and_test(&orig->usage)) {
 		struct seccomp_filter *freeme = orig;
 		orig = orig->prev;
-		kfree(freeme);
+		seccomp_filter_free(freeme);
 	}
 }
 
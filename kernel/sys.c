@@ -128,6 +128,11 @@ DEFINE_SEMAPHORE(virtinfo_sem);
 EXPORT_SYMBOL(virtinfo_sem);
 static struct vnotifier_block *virtinfo_chain[VIRT_TYPES];
 
+struct static_key virtinfo_keys[VIRT_TYPES] = {
+	[0 ... VIRT_TYPES - 1] = STATIC_KEY_INIT_FALSE,
+};
+EXPORT_SYMBOL(virtinfo_keys);
+
 void __virtinfo_notifier_register(int type, struct vnotifier_block *nb)
 {
 	struct vnotifier_block **p;
@@ -138,6 +143,7 @@ void __virtinfo_notifier_register(int type, struct vnotifier_block *nb)
 	nb->next = *p;
 	smp_wmb();
 	*p = nb;
+	static_key_slow_inc(&virtinfo_keys[type]);
 }
 
 EXPORT_SYMBOL(__virtinfo_notifier_register);
@@ -166,6 +172,7 @@ void virtinfo_notifier_unregister(int type, struct vnotifier_block *nb)
 	down(&virtinfo_sem);
 	for (p = &virtinfo_chain[type]; *p != nb; p = &(*p)->next);
 	*p = nb->next;
+	static_key_slow_dec(&virtinfo_keys[type]);
 	smp_mb();
 
 	for_each_possible_cpu(entry_cpu) {
@@ -211,7 +218,7 @@ static int do_virtinfo_notifier_call(int type, unsigned long n, void *data)
 	return ret;
 }
 
-int virtinfo_notifier_call(int type, unsigned long n, void *data)
+int __virtinfo_notifier_call(int type, unsigned long n, void *data)
 {
 	int ret;
 	int entry_cpu, exit_cpu;
@@ -230,15 +237,15 @@ int virtinfo_notifier_call(int type, unsigned long n, void *data)
 
 	return ret;
 }
-EXPORT_SYMBOL(virtinfo_notifier_call);
+EXPORT_SYMBOL(__virtinfo_notifier_call);
 
-int virtinfo_notifier_call_irq(int type, unsigned long n, void *data)
+int __virtinfo_notifier_call_irq(int type, unsigned long n, void *data)
 {
 	if (!in_interrupt())
-		return virtinfo_notifier_call(type, n, data);
+		return __virtinfo_notifier_call(type, n, data);
 	return do_virtinfo_notifier_call(type, n, data);
 }
-EXPORT_SYMBOL(virtinfo_notifier_call_irq);
+EXPORT_SYMBOL(__virtinfo_notifier_call_irq);
 
 /*
  * If set, this is used for preparing the system to power off.
@@ -64,6 +64,7 @@
 #include <linux/sched/sysctl.h>
 #include <linux/kexec.h>
 #include <linux/ve.h>
+#include <linux/pagecache_handover.h>
 
 #include <asm/uaccess.h>
 #include <asm/processor.h>
@@ -475,6 +476,15 @@ static struct ctl_table kern_table[] = {
 		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= &zero,
 	},
+	{
+		.procname	= "sched_vcpu_affinity",
+		.data		= &sysctl_sched_vcpu_affinity,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 	{
 		.procname	= "sched_cpulimit_scale_cpufreq",
 		.data		= &sysctl_sched_cpulimit_scale_cpufreq,
@@ -1353,6 +1363,17 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &one,
 		.extra2		= &four,
 	},
+#ifdef CONFIG_PAGECACHE_HANDOVER
+	{
+		.procname	= "pagecache_handover",
+		.data		= &sysctl_pagecache_handover,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= pagecache_handover_sysctl_handler,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #ifdef CONFIG_COMPACTION
 	{
 		.procname	= "compact_memory",
@@ -1370,6 +1391,14 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "compaction_proactive_ms",
+		.data		= &sysctl_compaction_proactive_ms,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= sysctl_compaction_proactive_handler,
+		.extra1		= &zero,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1626,6 +1655,13 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+	{
+		.procname	= "negative-dentry-limit",
+		.data		= &sysctl_negative_dentry_limit,
+		.maxlen		= sizeof(sysctl_negative_dentry_limit),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
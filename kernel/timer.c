@@ -791,6 +791,20 @@ int mod_timer_pending(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pending);
 
+/*
+ * Timers armed by tasks of a VE with timer_coalesce set may fire up to
+ * 1/32 of their timeout late instead of 1/256, so that more of them
+ * end up expiring in the same jiffy.
+ */
+static inline int timer_slack_shift(void)
+{
+#ifdef CONFIG_VE
+	if (!in_interrupt() && get_exec_env()->timer_coalesce)
+		return 5;
+#endif
+	return 8;
+}
+
 /*
  * Decide where to put the timer while taking the slack into account
  *
@@ -811,11 +825,12 @@ unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
 		expires_limit = expires + timer->slack;
 	} else {
 		long delta = expires - jiffies;
+		int shift = timer_slack_shift();
 
-		if (delta < 256)
+		if (delta < (1L << shift))
 			return expires;
 
-		expires_limit = expires + delta / 256;
+		expires_limit = expires + (delta >> shift);
 	}
 	mask = expires ^ expires_limit;
 	if (mask == 0)
@@ -13,6 +13,8 @@
 #include <linux/spinlock.h>
 #include <linux/ve_proto.h>
 #include <linux/module.h>
+#include <linux/async.h>
+#include <linux/slab.h>
 
 static struct list_head ve_hooks[VE_MAX_CHAINS];
 static DECLARE_RWSEM(ve_hook_sem);
@@ -66,14 +68,86 @@ static inline void ve_hook_fini(struct ve_hook *vh, struct ve_struct *ve)
 	}
 }
 
-int ve_hook_iterate_init(int chain, void *ve)
+/*
+ * Hooks of one priority form a stage.  Within a stage VE_HOOK_ASYNC
+ * hooks are run in parallel with async, the others in the calling
+ * task, and the next stage starts once the whole stage is done.
+ * Starting hundreds of containers at once is dominated by these
+ * calls, so let the independent ones overlap.
+ */
+struct ve_hook_call {
+	struct ve_hook	*vh;
+	void		*data;
+	int		err;
+};
+
+static void ve_hook_init_async(void *arg, async_cookie_t cookie)
+{
+	struct ve_hook_call *call = arg;
+
+	call->err = ve_hook_init(call->vh, call->data);
+}
+
+static void ve_hook_fini_async(void *arg, async_cookie_t cookie)
+{
+	struct ve_hook_call *call = arg;
+
+	ve_hook_fini(call->vh, call->data);
+}
+
+static void ve_hook_run_stage(struct ve_hook_call *calls, int nr, bool init)
 {
+	ASYNC_DOMAIN_EXCLUSIVE(domain);
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		/* fini goes in reverse, as the serial iteration did */
+		struct ve_hook_call *call = calls + (init ? i : nr - 1 - i);
+
+		if (nr > 1 && (call->vh->flags & VE_HOOK_ASYNC))
+			async_schedule_domain(init ? ve_hook_init_async :
+						     ve_hook_fini_async,
+					      call, &domain);
+		else if (init)
+			call->err = ve_hook_init(call->vh, call->data);
+		else
+			ve_hook_fini(call->vh, call->data);
+	}
+	async_synchronize_full_domain(&domain);
+}
+
+/* Called under ve_hook_sem, returns NULL for an empty chain too */
+static struct ve_hook_call *ve_hook_snapshot(int chain, void *ve, int *nr)
+{
+	struct ve_hook_call *calls;
 	struct ve_hook *vh;
-	int err;
+	int n = 0;
 
-	err = 0;
+	list_for_each_entry(vh, &ve_hooks[chain], list)
+		n++;
+	*nr = n;
+	if (!n)
+		return NULL;
+
+	calls = kmalloc(n * sizeof(*calls), GFP_KERNEL);
+	if (!calls)
+		return NULL;
+
+	n = 0;
+	list_for_each_entry(vh, &ve_hooks[chain], list) {
+		calls[n].vh = vh;
+		calls[n].data = ve;
+		calls[n].err = 0;
+		n++;
+	}
+	return calls;
+}
+
+static int ve_hook_serial_init(int chain, void *ve)
+{
+	struct ve_hook *vh;
+	int err = 0;
 
-	down_read(&ve_hook_sem);
 	list_for_each_entry(vh, &ve_hooks[chain], list)
 		if ((err = ve_hook_init(vh, ve)) < 0)
 			break;
@@ -82,6 +156,45 @@ int ve_hook_iterate_init(int chain, void *ve)
 		list_for_each_entry_continue_reverse(vh, &ve_hooks[chain], list)
 			ve_hook_fini(vh, ve);
 
+	return err;
+}
+
+int ve_hook_iterate_init(int chain, void *ve)
+{
+	struct ve_hook_call *calls;
+	int i, j, k, nr, err = 0;
+
+	down_read(&ve_hook_sem);
+	calls = ve_hook_snapshot(chain, ve, &nr);
+	if (!calls) {
+		if (nr)
+			err = ve_hook_serial_init(chain, ve);
+		goto out;
+	}
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr; j++)
+			if (calls[j].vh->priority != calls[i].vh->priority)
+				break;
+
+		ve_hook_run_stage(calls + i, j - i, true);
+
+		for (k = i; k < j; k++)
+			if (calls[k].err < 0) {
+				err = calls[k].err;
+				break;
+			}
+		if (!err)
+			continue;
+
+		/* undo what succeeded in this stage and all the previous */
+		for (k = j - 1; k >= 0; k--)
+			if (k < i || calls[k].err >= 0)
+				ve_hook_fini(calls[k].vh, ve);
+		break;
+	}
+	kfree(calls);
+out:
 	up_read(&ve_hook_sem);
 	return err;
 }
@@ -90,11 +203,29 @@ EXPORT_SYMBOL(ve_hook_iterate_init);
 
 void ve_hook_iterate_fini(int chain, void *ve)
 {
+	struct ve_hook_call *calls;
 	struct ve_hook *vh;
+	int i, j, nr;
 
 	down_read(&ve_hook_sem);
-	list_for_each_entry_reverse(vh, &ve_hooks[chain], list)
-		ve_hook_fini(vh, ve);
+	calls = ve_hook_snapshot(chain, ve, &nr);
+	if (!calls) {
+		list_for_each_entry_reverse(vh, &ve_hooks[chain], list)
+			ve_hook_fini(vh, ve);
+		goto out;
+	}
+
+	for (j = nr; j > 0; j = i) {
+		int prio = calls[j - 1].vh->priority;
+
+		for (i = j - 1; i > 0; i--)
+			if (calls[i - 1].vh->priority != prio)
+				break;
+
+		ve_hook_run_stage(calls + i, j - i, false);
+	}
+	kfree(calls);
+out:
 	up_read(&ve_hook_sem);
 }
 
@@ -32,6 +32,7 @@
 #include <linux/module.h>
 #include <linux/rcupdate.h>
 #include <linux/ve_proto.h>
+#include <linux/ve_stats.h>
 #include <linux/devpts_fs.h>
 #include <linux/user_namespace.h>
 #include <linux/init_task.h>
@@ -60,6 +61,9 @@ EXPORT_SYMBOL(no_module);
 struct kmapset_set ve_sysfs_perms;
 
 static DEFINE_PER_CPU(struct kstat_lat_pcpu_snap_struct, ve0_lat_stats);
+static DEFINE_PER_CPU(struct kstat_lat_hist_struct, ve0_lat_hist);
+static DEFINE_PER_CPU(struct kstat_stall_pcpu_struct, ve0_stall);
+static DEFINE_PER_CPU(struct ve_stats_pcpu, ve0_stats);
 
 struct ve_struct ve0 = {
 	.ve_name		= "0",
@@ -81,6 +85,10 @@ struct ve_struct ve0 = {
 					2,
 #endif
 	.sched_lat_ve.cur	= &ve0_lat_stats,
+	.sched_lat_hist		= &ve0_lat_hist,
+	.stall.cur		= &ve0_stall,
+	.stall.lock		= __SPIN_LOCK_UNLOCKED(ve0.stall.lock),
+	.stats			= &ve0_stats,
 	.init_cred		= &init_cred,
 };
 EXPORT_SYMBOL(ve0);
@@ -285,9 +293,24 @@ out:
 	complete(&work->done);
 }
 
+void ve_work_account(struct ve_work_stat *stat, u64 queued)
+{
+	u64 lat = ktime_to_ns(ktime_get()) - queued;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stat->lock, flags);
+	stat->count++;
+	stat->total_lat += lat;
+	if (stat->max_lat < lat)
+		stat->max_lat = lat;
+	spin_unlock_irqrestore(&stat->lock, flags);
+}
+
 struct kthread_create_work {
 	struct kthread_work work;
 	struct kthread_create_info *info;
+	struct ve_struct *ve;
+	u64 queued;
 };
 
 extern void create_kthread(struct kthread_create_info *create);
@@ -297,6 +320,7 @@ static void kthread_create_fn(struct kthread_work *w)
 	struct kthread_create_work *work = container_of(w,
 			struct kthread_create_work, work);
 
+	ve_work_account(&work->ve->ve_kthread_stat, work->queued);
 	create_kthread(work->info);
 }
 
@@ -306,6 +330,8 @@ static void kthread_create_queue(void *data, struct kthread_create_info *info)
 	struct kthread_create_work create = {
 		KTHREAD_WORK_INIT(create.work, kthread_create_fn),
 		.info = info,
+		.ve = ve,
+		.queued = ktime_to_ns(ktime_get()),
 	};
 	queue_kthread_work(&ve->ve_kthread_worker, &create.work);
 	wait_for_completion(&info->done);
@@ -331,25 +357,54 @@ struct task_struct *kthread_create_on_node_ve(struct ve_struct *ve,
 }
 EXPORT_SYMBOL(kthread_create_on_node_ve);
 
-static int ve_start_umh(struct ve_struct *ve)
+/*
+ * Helpers are spawned with CLONE_VFORK, so a khelper thread waits for
+ * each one to exec.  Let independent helpers go in parallel through a
+ * few threads, preferring the idle ones.
+ */
+struct kthread_worker *ve_umh_worker(struct ve_struct *ve)
 {
-	struct task_struct *t;
+	struct kthread_worker *worker;
+	int i, n = atomic_inc_return(&ve->ve_umh_next);
 
-	init_kthread_worker(&ve->ve_umh_worker);
-	t = kthread_run_ve(ve, kthread_worker_fn, &ve->ve_umh_worker,
-			"khelper");
-	if (IS_ERR(t))
-		return PTR_ERR(t);
+	for (i = 0; i < VE_UMH_WORKERS; i++) {
+		worker = &ve->ve_umh_worker[(n + i) % VE_UMH_WORKERS];
+		if (!worker->current_work && list_empty(&worker->work_list))
+			return worker;
+	}
+	return &ve->ve_umh_worker[n % VE_UMH_WORKERS];
+}
 
-	ve->ve_umh_task = t;
+static void ve_stop_umh_workers(struct ve_struct *ve, int nr)
+{
+	while (nr--) {
+		flush_kthread_worker(&ve->ve_umh_worker[nr]);
+		kthread_stop(ve->ve_umh_task[nr]);
+		ve->ve_umh_task[nr] = NULL;
+	}
+}
+
+static int ve_start_umh(struct ve_struct *ve)
+{
+	struct task_struct *t;
+	int i;
+
+	for (i = 0; i < VE_UMH_WORKERS; i++) {
+		init_kthread_worker(&ve->ve_umh_worker[i]);
+		t = kthread_run_ve(ve, kthread_worker_fn,
+				   &ve->ve_umh_worker[i], "khelper");
+		if (IS_ERR(t)) {
+			ve_stop_umh_workers(ve, i);
+			return PTR_ERR(t);
+		}
+		ve->ve_umh_task[i] = t;
+	}
 	return 0;
 }
 
 static void ve_stop_umh(struct ve_struct *ve)
 {
-	flush_kthread_worker(&ve->ve_umh_worker);
-	kthread_stop(ve->ve_umh_task);
-	ve->ve_umh_task = NULL;
+	ve_stop_umh_workers(ve, VE_UMH_WORKERS);
 }
 
 static int ve_start_kthread(struct ve_struct *ve)
@@ -374,6 +429,8 @@ static int ve_start_kthread(struct ve_struct *ve)
 		return attach.result;
 	}
 
+	/* dropped in ve_drop_context(), see there */
+	get_task_struct(t);
 	ve->ve_kthread_task = t;
 	return 0;
 }
@@ -382,9 +439,55 @@ static void ve_stop_kthread(struct ve_struct *ve)
 {
 	flush_kthread_worker(&ve->ve_kthread_worker);
 	kthread_stop(ve->ve_kthread_task);
-	ve->ve_kthread_task = NULL;
 }
 
+/*
+ * Unbound work done on behalf of a container goes to a workqueue of its
+ * own, kept on the cpus the container may run on and bounded by its own
+ * max_active.  Both can be tuned in /sys/devices/virtual/workqueue/ve_*.
+ * The workqueue lives as long as the VE, so that work queued when the
+ * container is stopping still finds it.
+ */
+#define VE_WQ_MAX_ACTIVE	16
+
+int ve_wq_set_cpumask(struct ve_struct *ve, const struct cpumask *mask)
+{
+	struct workqueue_attrs *attrs;
+	int err;
+
+	if (!ve->wq)
+		return 0;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return -ENOMEM;
+
+	cpumask_copy(attrs->cpumask, mask);
+	err = apply_workqueue_attrs(ve->wq, attrs);
+	free_workqueue_attrs(attrs);
+	return err;
+}
+EXPORT_SYMBOL(ve_wq_set_cpumask);
+
+static int ve_start_wq(struct ve_struct *ve)
+{
+	if (!ve->wq) {
+		ve->wq = alloc_workqueue("ve_%s", WQ_UNBOUND | WQ_SYSFS,
+					 VE_WQ_MAX_ACTIVE, ve_name(ve));
+		if (!ve->wq)
+			return -ENOMEM;
+	}
+
+	/* kthreadd is attached to the cpuset of the container */
+	return ve_wq_set_cpumask(ve, tsk_cpus_allowed(ve->ve_kthread_task));
+}
+
+bool ve_queue_work(struct ve_struct *ve, struct work_struct *work)
+{
+	return queue_work(ve->wq ? : system_unbound_wq, work);
+}
+EXPORT_SYMBOL(ve_queue_work);
+
 static void ve_grab_context(struct ve_struct *ve)
 {
 	struct task_struct *tsk = current;
@@ -396,9 +499,53 @@ static void ve_grab_context(struct ve_struct *ve)
 	synchronize_rcu();
 }
 
+/*
+ * Whatever RCU readers may still find through the VE being stopped is
+ * released after a grace period, without making the stop wait for one.
+ */
+struct ve_context_release {
+	struct rcu_head		rcu;
+	struct work_struct	work;
+	struct ve_struct	*ve;
+	struct nsproxy		*ve_ns;
+	struct task_struct	*kthread;
+};
+
+static void ve_context_release(struct ve_struct *ve, struct nsproxy *ve_ns,
+			       struct task_struct *kthread)
+{
+	put_nsproxy(ve_ns);
+	if (kthread)
+		put_task_struct(kthread);
+	put_ve(ve);
+}
+
+static void ve_context_release_work(struct work_struct *work)
+{
+	struct ve_context_release *r;
+
+	r = container_of(work, struct ve_context_release, work);
+	ve_context_release(r->ve, r->ve_ns, r->kthread);
+	kfree(r);
+}
+
+static void ve_context_release_rcu(struct rcu_head *rcu)
+{
+	struct ve_context_release *r;
+
+	/* put_nsproxy() may sleep */
+	r = container_of(rcu, struct ve_context_release, rcu);
+	INIT_WORK(&r->work, ve_context_release_work);
+	schedule_work(&r->work);
+}
+
 static void ve_drop_context(struct ve_struct *ve)
 {
 	struct nsproxy *ve_ns = ve->ve_ns;
+	/* looked up locklessly by the scheduler helpers */
+	struct task_struct *kthread = ve->ve_kthread_task;
+	struct ve_context_release *r;
+
 	path_put(&ve->root_path);
 	ve->root_path.mnt = NULL;
 	ve->root_path.dentry = NULL;
@@ -407,8 +554,19 @@ static void ve_drop_context(struct ve_struct *ve)
 	ve->ve_netns = NULL;
 
 	rcu_assign_pointer(ve->ve_ns, NULL);
-	synchronize_rcu();
-	put_nsproxy(ve_ns);
+	ve->ve_kthread_task = NULL;
+
+	get_ve(ve);
+	r = kmalloc(sizeof(*r), GFP_KERNEL);
+	if (r) {
+		r->ve = ve;
+		r->ve_ns = ve_ns;
+		r->kthread = kthread;
+		call_rcu(&r->rcu, ve_context_release_rcu);
+	} else {
+		synchronize_rcu();
+		ve_context_release(ve, ve_ns, kthread);
+	}
 
 	put_cred(ve->init_cred);
 	ve->init_cred = NULL;
@@ -442,6 +600,10 @@ int ve_start_container(struct ve_struct *ve)
 	if (err)
 		goto err_kthread;
 
+	err = ve_start_wq(ve);
+	if (err)
+		goto err_wq;
+
 	err = ve_start_umh(ve);
 	if (err)
 		goto err_umh;
@@ -473,6 +635,7 @@ err_tty_console:
 err_legacy_pty:
 	ve_stop_umh(ve);
 err_umh:
+err_wq:
 	ve_stop_kthread(ve);
 err_kthread:
 	ve_list_del(ve, false);
@@ -611,6 +774,21 @@ static struct cgroup_subsys_state *ve_create(struct cgroup *cg)
 	if (!ve->sched_lat_ve.cur)
 		goto err_lat;
 
+	ve->sched_lat_hist = alloc_percpu(struct kstat_lat_hist_struct);
+	if (!ve->sched_lat_hist)
+		goto err_hist;
+
+	if (kstat_stall_init(&ve->stall))
+		goto err_stall;
+
+	ve->rx_softirq = alloc_percpu(struct kstat_softirq_pcpu_struct);
+	if (!ve->rx_softirq)
+		goto err_softirq;
+
+	ve->stats = alloc_percpu(struct ve_stats_pcpu);
+	if (!ve->stats)
+		goto err_stats;
+
 	err = ve_log_init(ve);
 	if (err)
 		goto err_log;
@@ -619,6 +797,8 @@ static struct cgroup_subsys_state *ve_create(struct cgroup *cg)
 
 do_init:
 	init_rwsem(&ve->op_sem);
+	spin_lock_init(&ve->ve_kthread_stat.lock);
+	spin_lock_init(&ve->ve_umh_stat.lock);
 	mutex_init(&ve->sync_mutex);
 	INIT_LIST_HEAD(&ve->devices);
 	INIT_LIST_HEAD(&ve->ve_list);
@@ -635,6 +815,14 @@ do_init:
 	return &ve->css;
 
 err_log:
+	free_percpu(ve->stats);
+err_stats:
+	free_percpu(ve->rx_softirq);
+err_softirq:
+	kstat_stall_free(&ve->stall);
+err_stall:
+	free_percpu(ve->sched_lat_hist);
+err_hist:
 	free_percpu(ve->sched_lat_ve.cur);
 err_lat:
 	kfree(ve->ve_name);
@@ -681,6 +869,12 @@ static void ve_destroy(struct cgroup *cg)
 
 	ve_log_destroy(ve);
 	kfree(ve->binfmt_misc);
+	if (ve->wq)
+		destroy_workqueue(ve->wq);
+	free_percpu(ve->stats);
+	free_percpu(ve->rx_softirq);
+	kstat_stall_free(&ve->stall);
+	free_percpu(ve->sched_lat_hist);
 	free_percpu(ve->sched_lat_ve.cur);
 	kfree(ve->ve_name);
 	kmem_cache_free(ve_cachep, ve);
@@ -738,6 +932,11 @@ static void ve_attach(struct cgroup *cg, struct cgroup_taskset *tset)
 		/* Leave parent exec domain */
 		task->parent_exec_id--;
 
+		if (ve->timer_slack_ns) {
+			task->timer_slack_ns = ve->timer_slack_ns;
+			task->default_timer_slack_ns = ve->timer_slack_ns;
+		}
+
 		task->task_ve = ve;
 	}
 }
@@ -1121,6 +1320,9 @@ enum {
 	VE_CF_STATE,
 	VE_CF_FEATURES,
 	VE_CF_IPTABLES_MASK,
+	VE_CF_KSM,
+	VE_CF_TIMER_SLACK,
+	VE_CF_TIMER_COALESCE,
 };
 
 static u64 ve_read_u64(struct cgroup *cg, struct cftype *cft)
@@ -1131,6 +1333,12 @@ static u64 ve_read_u64(struct cgroup *cg, struct cftype *cft)
 	else if (cft->private == VE_CF_IPTABLES_MASK)
 		return cgroup_ve(cg)->ipt_mask;
 #endif
+	else if (cft->private == VE_CF_KSM)
+		return cgroup_ve(cg)->ksm;
+	else if (cft->private == VE_CF_TIMER_SLACK)
+		return cgroup_ve(cg)->timer_slack_ns;
+	else if (cft->private == VE_CF_TIMER_COALESCE)
+		return cgroup_ve(cg)->timer_coalesce;
 	return 0;
 }
 
@@ -1141,6 +1349,24 @@ static int ve_write_u64(struct cgroup *cg, struct cftype *cft, u64 value)
 	if (!ve_is_super(get_exec_env()))
 		return -EPERM;
 
+	/* Affects only mappings created afterwards, so fine at any time */
+	if (cft->private == VE_CF_KSM) {
+		ve->ksm = !!value;
+		return 0;
+	}
+
+	/* Both are picked up on the fly, by attach and by mod_timer() */
+	if (cft->private == VE_CF_TIMER_SLACK) {
+		if (value > ULONG_MAX)
+			return -EINVAL;
+		ve->timer_slack_ns = value;
+		return 0;
+	}
+	if (cft->private == VE_CF_TIMER_COALESCE) {
+		ve->timer_coalesce = !!value;
+		return 0;
+	}
+
 	down_write(&ve->op_sem);
 	if (ve->is_running || ve->ve_ns) {
 		up_write(&ve->op_sem);
@@ -1157,6 +1383,93 @@ static int ve_write_u64(struct cgroup *cg, struct cftype *cft, u64 value)
 	return 0;
 }
 
+static int ve_sched_lat_hist_read(struct cgroup *cg, struct cftype *cft,
+				  struct seq_file *m)
+{
+	kstat_lat_hist_seq_show(m, cgroup_ve(cg)->sched_lat_hist);
+	return 0;
+}
+
+static int ve_pressure_read(struct cgroup *cg, struct cftype *cft,
+			    struct seq_file *m)
+{
+	kstat_stall_seq_show(m, &cgroup_ve(cg)->stall);
+	return 0;
+}
+
+static int ve_softirq_stat_read(struct cgroup *cg, struct cftype *cft,
+				struct seq_file *m)
+{
+	struct ve_struct *ve = cgroup_ve(cg);
+	unsigned long throttled = 0;
+	u64 time = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct kstat_softirq_pcpu_struct *st;
+
+		st = per_cpu_ptr(ve->rx_softirq, cpu);
+		time += st->time;
+		throttled += st->throttled;
+	}
+
+	seq_printf(m, "net_rx %Lu %lu\n",
+		   div_u64(time, NSEC_PER_USEC), throttled);
+	return 0;
+}
+
+/* work not started yet */
+static int ve_worker_depth(struct kthread_worker *worker)
+{
+	struct kthread_work *work;
+	int depth = 0;
+
+	spin_lock_irq(&worker->lock);
+	list_for_each_entry(work, &worker->work_list, node)
+		depth++;
+	spin_unlock_irq(&worker->lock);
+	return depth;
+}
+
+static void ve_work_stat_show(struct seq_file *m, const char *name,
+			      int depth, struct ve_work_stat *stat)
+{
+	u64 count, total, max;
+
+	spin_lock_irq(&stat->lock);
+	count = stat->count;
+	total = stat->total_lat;
+	max = stat->max_lat;
+	spin_unlock_irq(&stat->lock);
+
+	seq_printf(m, "%-10s %10d %20Lu %20Lu %20Lu\n", name, depth, count,
+		   div_u64(total, NSEC_PER_USEC), div_u64(max, NSEC_PER_USEC));
+}
+
+static int ve_kthread_stat_read(struct cgroup *cg, struct cftype *cft,
+				struct seq_file *m)
+{
+	struct ve_struct *ve = cgroup_ve(cg);
+	int i, depth = 0;
+
+	seq_printf(m, "%-10s %10s %20s %20s %20s\n", "Thread", "Queued",
+		   "Started", "Total_lat_us", "Max_lat_us");
+
+	down_read(&ve->op_sem);
+	if (ve->is_running)
+		depth = ve_worker_depth(&ve->ve_kthread_worker);
+	ve_work_stat_show(m, "kthreadd", depth, &ve->ve_kthread_stat);
+
+	depth = 0;
+	if (ve->is_running)
+		for (i = 0; i < VE_UMH_WORKERS; i++)
+			depth += ve_worker_depth(&ve->ve_umh_worker[i]);
+	ve_work_stat_show(m, "khelper", depth, &ve->ve_umh_stat);
+	up_read(&ve->op_sem);
+
+	return 0;
+}
+
 static struct cftype ve_cftypes[] = {
 	{
 		.name			= "state",
@@ -1200,6 +1513,45 @@ static struct cftype ve_cftypes[] = {
 		.write_u64		= ve_write_u64,
 		.private		= VE_CF_IPTABLES_MASK,
 	},
+	{
+		.name			= "ksm",
+		.flags			= CFTYPE_NOT_ON_ROOT,
+		.read_u64		= ve_read_u64,
+		.write_u64		= ve_write_u64,
+		.private		= VE_CF_KSM,
+	},
+	{
+		.name			= "timer_slack_ns",
+		.flags			= CFTYPE_NOT_ON_ROOT,
+		.read_u64		= ve_read_u64,
+		.write_u64		= ve_write_u64,
+		.private		= VE_CF_TIMER_SLACK,
+	},
+	{
+		.name			= "timer_coalesce",
+		.flags			= CFTYPE_NOT_ON_ROOT,
+		.read_u64		= ve_read_u64,
+		.write_u64		= ve_write_u64,
+		.private		= VE_CF_TIMER_COALESCE,
+	},
+	{
+		.name			= "sched_lat_hist",
+		.read_seq_string	= ve_sched_lat_hist_read,
+	},
+	{
+		.name			= "pressure",
+		.read_seq_string	= ve_pressure_read,
+	},
+	{
+		.name			= "kthread_stat",
+		.flags			= CFTYPE_NOT_ON_ROOT,
+		.read_seq_string	= ve_kthread_stat_read,
+	},
+	{
+		.name			= "softirq_stat",
+		.flags			= CFTYPE_NOT_ON_ROOT,
+		.read_seq_string	= ve_softirq_stat_read,
+	},
 	{ }
 };
 
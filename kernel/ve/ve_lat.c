@@ -0,0 +1,180 @@
+/*
+ *  kernel/ve/ve_lat.c
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ * Always-on per-cpu rings of per-container latency samples.  Hot paths
+ * (fork, exec, page faults, memcg reclaim, ploop and NET_RX) report
+ * how long an operation took through ve_lat_record().  Samples over
+ * kernel.ve_lat_threshold_ns are stored into the ring of the local cpu
+ * without any locks, and userspace maps the rings read-only through
+ * /proc/vz/latency_ring for per-tenant latency profiling.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/sysctl.h>
+#include <linux/vmalloc.h>
+#include <linux/ve.h>
+#include <linux/ve_lat.h>
+#include <linux/ve_stats.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/ve_lat.h>
+
+struct ve_lat_ring {
+	struct ve_lat_ring_hdr	*hdr;
+	struct ve_lat_sample	*samples;
+	unsigned int		mask;
+};
+
+static DEFINE_PER_CPU(struct ve_lat_ring, ve_lat_rings);
+
+/* log2 of the pages of samples per cpu, negative disables sampling */
+static int ve_lat_order = 4;
+static unsigned long ve_lat_region_size;
+
+unsigned long sysctl_ve_lat_threshold = 10 * NSEC_PER_USEC;
+
+struct static_key ve_lat_key = STATIC_KEY_INIT_FALSE;
+EXPORT_SYMBOL(ve_lat_key);
+
+static int __init ve_lat_setup(char *str)
+{
+	get_option(&str, &ve_lat_order);
+	if (ve_lat_order > 10)
+		ve_lat_order = 10;
+	return 1;
+}
+__setup("ve_lat_order=", ve_lat_setup);
+
+void __ve_lat_record(struct ve_struct *ve, int type, u64 lat, u16 arg)
+{
+	envid_t veid = ve ? ve->veid : 0;
+	struct ve_lat_ring *ring;
+	struct ve_lat_sample *s;
+	unsigned long flags;
+	u64 head;
+
+	trace_ve_latency(veid, type, lat, arg);
+	ve_stat_lat(ve ? ve : &ve0, type, lat);
+
+	if (lat < ACCESS_ONCE(sysctl_ve_lat_threshold))
+		return;
+
+	local_irq_save(flags);
+	ring = this_cpu_ptr(&ve_lat_rings);
+	head = ring->hdr->head;
+	s = ring->samples + (head & ring->mask);
+
+	s->seq = 0;
+	smp_wmb();
+	s->time = local_clock();
+	s->lat = lat;
+	s->veid = veid;
+	s->type = type;
+	s->arg = arg;
+	smp_wmb();
+	s->seq = head + 1;
+	ring->hdr->head = head + 1;
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(__ve_lat_record);
+
+static ssize_t ve_lat_read(struct file *file, char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	struct ve_lat_info info = {
+		.version	= VE_LAT_VERSION,
+		.nr_cpus	= nr_cpu_ids,
+		.region_size	= ve_lat_region_size,
+		.nr_samples	= this_cpu_ptr(&ve_lat_rings)->mask + 1,
+	};
+
+	return simple_read_from_buffer(buf, count, ppos, &info, sizeof(info));
+}
+
+static int ve_lat_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long region_pages = ve_lat_region_size >> PAGE_SHIFT;
+	unsigned long cpu;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff % region_pages)
+		return -EINVAL;
+
+	cpu = vma->vm_pgoff / region_pages;
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -ENXIO;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, per_cpu(ve_lat_rings, cpu).hdr, 0);
+}
+
+static const struct file_operations proc_ve_lat_operations = {
+	.owner		= THIS_MODULE,
+	.read		= ve_lat_read,
+	.mmap		= ve_lat_mmap,
+	.llseek		= default_llseek,
+};
+
+static struct ctl_table ve_lat_table[] = {
+	{
+		.procname	= "ve_lat_threshold_ns",
+		.data		= &sysctl_ve_lat_threshold,
+		.maxlen		= sizeof(unsigned long),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
+	{ }
+};
+
+static struct ctl_path ve_lat_path[] = {
+	{ .procname = "kernel", },
+	{ }
+};
+
+static int __init ve_lat_init(void)
+{
+	unsigned long data_size;
+	int cpu;
+
+	if (ve_lat_order < 0)
+		return 0;
+
+	data_size = PAGE_SIZE << ve_lat_order;
+	ve_lat_region_size = PAGE_SIZE + data_size;
+
+	for_each_possible_cpu(cpu) {
+		struct ve_lat_ring *ring = &per_cpu(ve_lat_rings, cpu);
+
+		ring->hdr = vmalloc_user(ve_lat_region_size);
+		if (!ring->hdr)
+			goto fail;
+		ring->hdr->cpu = cpu;
+		ring->hdr->data_offset = PAGE_SIZE;
+		ring->samples = (void *)ring->hdr + PAGE_SIZE;
+		ring->mask = data_size / sizeof(struct ve_lat_sample) - 1;
+	}
+
+	if (!proc_create("latency_ring", S_IRUSR, proc_vz_dir,
+			 &proc_ve_lat_operations))
+		goto fail;
+	register_sysctl_paths(ve_lat_path, ve_lat_table);
+
+	static_key_slow_inc(&ve_lat_key);
+	return 0;
+
+fail:
+	printk(KERN_WARNING "VE: can't set up latency rings\n");
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu(ve_lat_rings, cpu).hdr);
+		per_cpu(ve_lat_rings, cpu).hdr = NULL;
+	}
+	return -ENOMEM;
+}
+late_initcall(ve_lat_init);
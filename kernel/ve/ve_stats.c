@@ -0,0 +1,222 @@
+/*
+ *  kernel/ve/ve_stats.c
+ *
+ *  Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ * Per-container resource usage in one place.  Hot paths add to per-cpu
+ * counters of the container through ve_stat_add(), latency samples are
+ * summed up by ve_lat_record().  Every kernel.ve_stats_interval_ms a
+ * work folds the counters of all running containers, together with
+ * their cpu cgroup times, into a snapshot and publishes it in a ring
+ * userspace maps read-only through /proc/vz/stats_ring.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/sysctl.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/kernel_stat.h>
+#include <linux/fairsched.h>
+#include <linux/ve_proto.h>
+#include <linux/ve_stats.h>
+
+/* log2 of the pages of entries, negative disables snapshots */
+static int ve_stats_order = 6;
+static unsigned long ve_stats_region_size;
+
+static struct ve_stats_ring_hdr *ve_stats_hdr;
+static struct ve_stats_entry *ve_stats_entries;
+static unsigned int ve_stats_mask;
+
+static int sysctl_ve_stats_interval = MSEC_PER_SEC;
+static int ve_stats_interval_min = 10;
+static int ve_stats_interval_max = 60 * MSEC_PER_SEC;
+
+static void ve_stats_snapshot(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ve_stats_work, ve_stats_snapshot);
+
+struct static_key ve_stats_key = STATIC_KEY_INIT_FALSE;
+EXPORT_SYMBOL(ve_stats_key);
+
+static int __init ve_stats_setup(char *str)
+{
+	get_option(&str, &ve_stats_order);
+	if (ve_stats_order > 10)
+		ve_stats_order = 10;
+	return 1;
+}
+__setup("ve_stats_order=", ve_stats_setup);
+
+static void ve_stats_fill(struct ve_struct *ve, struct ve_stats_entry *e)
+{
+	struct kernel_cpustat kstat;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct ve_stats_pcpu *st = per_cpu_ptr(ve->stats, cpu);
+
+		for (i = 0; i < VE_STAT_NR; i++)
+			e->stat[i] += st->stat[i];
+		for (i = 0; i < VE_LAT_NR; i++) {
+			e->lat_count[i] += st->lat_count[i];
+			e->lat_ns[i] += st->lat_ns[i];
+		}
+	}
+
+	if (ve_is_super(ve) || fairsched_get_cpu_stat(ve->ve_name, &kstat))
+		return;
+
+	e->stat[VE_STAT_CPU_USER] = (u64)NSEC_PER_USEC *
+		cputime_to_usecs(kstat.cpustat[CPUTIME_USER] +
+				 kstat.cpustat[CPUTIME_NICE]);
+	e->stat[VE_STAT_CPU_SYSTEM] = (u64)NSEC_PER_USEC *
+		cputime_to_usecs(kstat.cpustat[CPUTIME_SYSTEM]);
+}
+
+/* The only writer is ve_stats_work, so no locking against other ones */
+static void ve_stats_publish(struct ve_stats_entry *e)
+{
+	u64 head = ve_stats_hdr->head;
+	struct ve_stats_entry *s = ve_stats_entries + (head & ve_stats_mask);
+
+	s->seq = 0;
+	smp_wmb();
+	memcpy((void *)s + sizeof(s->seq), (void *)e + sizeof(e->seq),
+	       sizeof(*e) - sizeof(e->seq));
+	smp_wmb();
+	s->seq = head + 1;
+	ve_stats_hdr->head = head + 1;
+}
+
+static void ve_stats_snapshot(struct work_struct *work)
+{
+	struct ve_stats_entry e;
+	struct ve_struct **ves, *ve;
+	u64 period = ve_stats_hdr->period + 1;
+	u64 now = ktime_to_ns(ktime_get());
+	int i, n = 0;
+
+	/*
+	 * fairsched_get_cpu_stat() takes cgroup_mutex, which nests
+	 * outside of ve_list_lock, so pin the containers and drop it.
+	 */
+	mutex_lock(&ve_list_lock);
+	ves = kmalloc_array(nr_ve, sizeof(*ves), GFP_KERNEL);
+	if (ves) {
+		for_each_ve(ve) {
+			if (n == nr_ve)
+				break;
+			ves[n++] = get_ve(ve);
+		}
+	}
+	mutex_unlock(&ve_list_lock);
+
+	for (i = 0; i < n; i++) {
+		memset(&e, 0, sizeof(e));
+		e.time = now;
+		e.period = period;
+		e.veid = ves[i]->veid;
+		ve_stats_fill(ves[i], &e);
+		ve_stats_publish(&e);
+		put_ve(ves[i]);
+	}
+	kfree(ves);
+
+	smp_wmb();
+	ve_stats_hdr->period = period;
+
+	schedule_delayed_work(&ve_stats_work,
+		msecs_to_jiffies(ACCESS_ONCE(sysctl_ve_stats_interval)));
+}
+
+static ssize_t ve_stats_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct ve_stats_info info = {
+		.version	= VE_STATS_VERSION,
+		.interval_ms	= ACCESS_ONCE(sysctl_ve_stats_interval),
+		.region_size	= ve_stats_region_size,
+		.nr_entries	= ve_stats_mask + 1,
+	};
+
+	return simple_read_from_buffer(buf, count, ppos, &info, sizeof(info));
+}
+
+static int ve_stats_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, ve_stats_hdr, 0);
+}
+
+static const struct file_operations proc_ve_stats_operations = {
+	.owner		= THIS_MODULE,
+	.read		= ve_stats_read,
+	.mmap		= ve_stats_mmap,
+	.llseek		= default_llseek,
+};
+
+static struct ctl_table ve_stats_table[] = {
+	{
+		.procname	= "ve_stats_interval_ms",
+		.data		= &sysctl_ve_stats_interval,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ve_stats_interval_min,
+		.extra2		= &ve_stats_interval_max,
+	},
+	{ }
+};
+
+static struct ctl_path ve_stats_path[] = {
+	{ .procname = "kernel", },
+	{ }
+};
+
+static int __init ve_stats_init(void)
+{
+	unsigned long data_size;
+
+	if (ve_stats_order < 0)
+		return 0;
+
+	data_size = PAGE_SIZE << ve_stats_order;
+	ve_stats_region_size = PAGE_SIZE + data_size;
+
+	ve_stats_hdr = vmalloc_user(ve_stats_region_size);
+	if (!ve_stats_hdr)
+		goto fail;
+	ve_stats_hdr->data_offset = PAGE_SIZE;
+	ve_stats_hdr->entry_size = sizeof(struct ve_stats_entry);
+	ve_stats_entries = (void *)ve_stats_hdr + PAGE_SIZE;
+	ve_stats_mask = rounddown_pow_of_two(data_size /
+				sizeof(struct ve_stats_entry)) - 1;
+
+	if (!proc_create("stats_ring", S_IRUSR, proc_vz_dir,
+			 &proc_ve_stats_operations))
+		goto fail;
+	register_sysctl_paths(ve_stats_path, ve_stats_table);
+
+	static_key_slow_inc(&ve_stats_key);
+	schedule_delayed_work(&ve_stats_work,
+			      msecs_to_jiffies(sysctl_ve_stats_interval));
+	return 0;
+
+fail:
+	printk(KERN_WARNING "VE: can't set up stats ring\n");
+	vfree(ve_stats_hdr);
+	ve_stats_hdr = NULL;
+	return -ENOMEM;
+}
+late_initcall(ve_stats_init);
@@ -595,6 +595,7 @@ static void vzmon_stop_notifier(void *data)
 static struct ve_hook vzmon_stop_hook = {
 	.fini		= vzmon_stop_notifier,
 	.priority	= HOOK_PRIO_FINISHING,
+	.flags		= VE_HOOK_ASYNC,
 	.owner		= THIS_MODULE,
 };
 
@@ -8,9 +8,14 @@
 #include <linux/ve_proto.h>
 #include <linux/vzevent.h>
 #include <linux/pid_namespace.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
 
 #define NETLINK_UEVENT	31
-#define VZ_EVGRP_ALL	0x01
+
+/* Window and size cap for the events coalesced for VZ_EVGRP_BATCH */
+#define VZEV_BATCH_DELAY	(HZ / 50)
+#define VZEV_BATCH_SIZE		PAGE_SIZE
 
 static int reboot_event;
 module_param(reboot_event, int, 0644);
@@ -24,6 +29,12 @@ MODULE_PARM_DESC(reboot_event, "Enable reboot events");
 
 static struct sock *vzev_sock;
 
+static struct sk_buff *vzev_batch;
+static DEFINE_MUTEX(vzev_batch_mutex);
+
+static void vzevent_batch_flush(struct work_struct *work);
+static DECLARE_DELAYED_WORK(vzev_batch_work, vzevent_batch_flush);
+
 static char *action_to_string(int action)
 {
 	switch (action) {
@@ -42,30 +53,105 @@ static char *action_to_string(int action)
 	}
 }
 
-static int do_vzevent_send(int event, char *msg, int len)
+static void vzevent_put(struct sk_buff *skb, char *action, int alen,
+		char *msg, int len)
 {
-	struct sk_buff *skb;
-	char *buf, *action;
-	int alen;
+	char *buf;
 
-	action = action_to_string(event);
-	if (!action)
-		return -EINVAL;
+	buf = skb_put(skb, len + 1 + alen);
+	memcpy(buf, action, alen);
+	buf[alen] = '@';
+	memcpy(buf + alen + 1, msg, len);
+}
 
-	alen = strlen(action);
+static int vzevent_broadcast(int group, char *action, int alen,
+		char *msg, int len)
+{
+	struct sk_buff *skb;
 
 	skb = alloc_skb(len + 1 + alen, GFP_KERNEL);
 	if (!skb)
 		return -ENOMEM;
 
-	buf = skb_put(skb, len + 1 + alen);
-	memcpy(buf, action, alen);
-	buf[alen] = '@';
-	memcpy(buf + alen + 1, msg, len);
-	(void)netlink_broadcast(vzev_sock, skb, 0, VZ_EVGRP_ALL, GFP_KERNEL);
+	vzevent_put(skb, action, alen, msg, len);
+	(void)netlink_broadcast(vzev_sock, skb, 0, group, GFP_KERNEL);
 	return 0;
 }
 
+static void vzevent_batch_flush(struct work_struct *work)
+{
+	struct sk_buff *skb;
+
+	mutex_lock(&vzev_batch_mutex);
+	skb = vzev_batch;
+	vzev_batch = NULL;
+	mutex_unlock(&vzev_batch_mutex);
+
+	if (skb)
+		(void)netlink_broadcast(vzev_sock, skb, 0,
+				VZ_EVGRP_BATCH, GFP_KERNEL);
+}
+
+/*
+ * Append the event to the pending batch.  The batch goes out when the
+ * window expires, or earlier if the next record does not fit into it.
+ */
+static int vzevent_batch_add(char *action, int alen, char *msg, int len)
+{
+	struct sk_buff *full = NULL;
+	int size = alen + 1 + len + 1;
+
+	if (size > VZEV_BATCH_SIZE)
+		return vzevent_broadcast(VZ_EVGRP_BATCH, action, alen, msg, len);
+
+	mutex_lock(&vzev_batch_mutex);
+	if (vzev_batch && skb_tailroom(vzev_batch) < size) {
+		full = vzev_batch;
+		vzev_batch = NULL;
+	}
+	if (!vzev_batch) {
+		vzev_batch = alloc_skb(VZEV_BATCH_SIZE, GFP_KERNEL);
+		if (!vzev_batch) {
+			mutex_unlock(&vzev_batch_mutex);
+			if (full)
+				(void)netlink_broadcast(vzev_sock, full, 0,
+						VZ_EVGRP_BATCH, GFP_KERNEL);
+			return -ENOMEM;
+		}
+		schedule_delayed_work(&vzev_batch_work, VZEV_BATCH_DELAY);
+	}
+	vzevent_put(vzev_batch, action, alen, msg, len);
+	*(char *)skb_put(vzev_batch, 1) = '\0';
+	mutex_unlock(&vzev_batch_mutex);
+
+	if (full)
+		(void)netlink_broadcast(vzev_sock, full, 0,
+				VZ_EVGRP_BATCH, GFP_KERNEL);
+	return 0;
+}
+
+static int do_vzevent_send(int event, char *msg, int len)
+{
+	char *action;
+	int alen, err = 0;
+
+	action = action_to_string(event);
+	if (!action)
+		return -EINVAL;
+
+	alen = strlen(action);
+
+	/* Nothing is built for a group nobody has joined */
+	if (netlink_has_listeners(vzev_sock, VZ_EVGRP_ALL))
+		err = vzevent_broadcast(VZ_EVGRP_ALL, action, alen, msg, len);
+	if (!err && netlink_has_listeners(vzev_sock, VZ_EVGRP_TYPE(event)))
+		err = vzevent_broadcast(VZ_EVGRP_TYPE(event), action, alen,
+				msg, len);
+	if (!err && netlink_has_listeners(vzev_sock, VZ_EVGRP_BATCH))
+		err = vzevent_batch_add(action, alen, msg, len);
+	return err;
+}
+
 int vzevent_send(int event, const char *attrs_fmt, ...)
 {
 	va_list args;
@@ -127,6 +213,8 @@ static int __init init_vzevent(void)
 static void __exit exit_vzevent(void)
 {
 	ve_hook_unregister(&ve_start_stop_hook);
+	cancel_delayed_work_sync(&vzev_batch_work);
+	vzevent_batch_flush(NULL);
 	netlink_kernel_release(vzev_sock);
 }
 
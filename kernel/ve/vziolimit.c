@@ -31,7 +31,8 @@ enum {
 	UB_CGROUP_IOPSLIMIT_SPEED 	= 3,
 	UB_CGROUP_IOPSLIMIT_BURST 	= 4,
 	UB_CGROUP_IOPSLIMIT_LATENCY 	= 5,
-
+	UB_CGROUP_IOLIMIT_PEAK		= 6,
+	UB_CGROUP_IOPSLIMIT_PEAK	= 7,
 };
 
 /**
@@ -50,6 +51,31 @@ static void throttle_setup(struct throttle *th, unsigned speed,
 	th->speed = speed;
 }
 
+/**
+ * set peak speed of burst mode, externally serialized
+ * @peak	peak throttler
+ * @th		throttler of the sustained speed
+ * @speed	peak speed (1/sec), 0 disables burst mode
+ *
+ * In burst mode th->burst units of credit, accrued at the sustained speed,
+ * are spent no faster than the peak speed. Thus a burst much larger than
+ * the latency allowance can be given for container start or cron jobs
+ * without permitting an unlimited instant rate.
+ */
+static void throttle_setup_peak(struct throttle *peak, struct throttle *th,
+		unsigned speed)
+{
+	peak->time = jiffies;
+	peak->burst = max(speed / 8, 1u);	/* 125ms at peak speed */
+	peak->latency = th->latency;
+	peak->state = 0;
+	/* start with full credit */
+	if (speed && !peak->speed)
+		th->state = max_t(long long, th->state, th->burst);
+	wmb();
+	peak->speed = speed;
+}
+
 /* externally serialized */
 static void throttle_charge(struct throttle *th, long long charge)
 {
@@ -102,9 +128,31 @@ static unsigned long throttle_timeout(struct throttle *th, unsigned long now)
 struct iolimit {
 	struct throttle throttle;
 	struct throttle iops;
+	/* peak speeds of burst mode, see throttle_setup_peak() */
+	struct throttle throttle_peak;
+	struct throttle iops_peak;
 	wait_queue_head_t wq;
 };
 
+/* externally serialized */
+static void iolimit_charge_peak(struct throttle *peak, long long charge)
+{
+	if (!peak->speed)
+		return;
+	throttle_charge(peak, charge);
+	peak->state -= charge;
+}
+
+static unsigned long iolimit_timeout(struct iolimit *iolimit)
+{
+	unsigned long now = jiffies;
+
+	return max(max(throttle_timeout(&iolimit->throttle, now),
+		       throttle_timeout(&iolimit->iops, now)),
+		   max(throttle_timeout(&iolimit->throttle_peak, now),
+		       throttle_timeout(&iolimit->iops_peak, now)));
+}
+
 static void iolimit_wait(struct iolimit *iolimit, unsigned long timeout)
 {
 	DEFINE_WAIT(wait);
@@ -116,20 +164,11 @@ static void iolimit_wait(struct iolimit *iolimit, unsigned long timeout)
 		if (fatal_signal_pending(current))
 			break;
 		if (unlikely(timeout))
-			timeout = min(throttle_timeout(&iolimit->throttle,
-						jiffies), timeout);
+			timeout = min(iolimit_timeout(iolimit), timeout);
 	} while (timeout);
 	finish_wait(&iolimit->wq, &wait);
 }
 
-static unsigned long iolimit_timeout(struct iolimit *iolimit)
-{
-	unsigned long now = jiffies;
-
-	return max(throttle_timeout(&iolimit->throttle, now),
-			throttle_timeout(&iolimit->iops, now));
-}
-
 static void iolimit_balance_dirty(struct iolimit *iolimit,
 				  struct user_beancounter *ub,
 				  unsigned long write_chunk)
@@ -142,12 +181,9 @@ static void iolimit_balance_dirty(struct iolimit *iolimit,
 
 	/* can be non-atomic on i386, but ok. this just hint. */
 	state = th->state >> PAGE_SHIFT;
-	dirty = ub_stat_get(ub, dirty_pages) + write_chunk;
-	/* protect agains ub-stat percpu drift */
-	if (dirty + UB_STAT_BATCH * num_possible_cpus()	< state)
-		return;
-	/* get exact value of for smooth throttling */
-	dirty = ub_stat_get_exact(ub, dirty_pages) + write_chunk;
+	/* get exact value near the limit for smooth throttling */
+	dirty = ub_stat_get_bounded(ub, dirty_pages,
+				    (long)(state - write_chunk)) + write_chunk;
 	if (dirty < state)
 		return;
 
@@ -159,6 +195,19 @@ static void iolimit_balance_dirty(struct iolimit *iolimit,
 	spin_unlock_irqrestore(&ub->ub_lock, flags);
 }
 
+/*
+ * VITYPE_IO notifications are skipped for beancounters without this
+ * flag, see virtinfo_wanted().  Called under ub_lock.
+ */
+static void iolimit_update_flags(struct user_beancounter *ub,
+				 struct iolimit *iolimit)
+{
+	if (iolimit->throttle.speed || iolimit->iops.speed)
+		set_bit(UB_IO_LIMITED, &ub->ub_flags);
+	else
+		clear_bit(UB_IO_LIMITED, &ub->ub_flags);
+}
+
 static int iolimit_virtinfo(struct vnotifier_block *nb,
 		unsigned long cmd, void *arg, int old_ret)
 {
@@ -183,6 +232,8 @@ static int iolimit_virtinfo(struct vnotifier_block *nb,
 
 				throttle_charge(&iolimit->throttle, charge);
 				iolimit->throttle.state -= charge;
+				iolimit_charge_peak(&iolimit->throttle_peak,
+						    charge);
 			}
 			spin_unlock_irqrestore(&ub->ub_lock, flags);
 			break;
@@ -208,6 +259,7 @@ static int iolimit_virtinfo(struct vnotifier_block *nb,
 				if (iolimit->iops.state > 1 ||
 				    !(current->flags & PF_SWAPWRITE))
 					iolimit->iops.state--;
+				iolimit_charge_peak(&iolimit->iops_peak, 1);
 			}
 			spin_unlock_irqrestore(&ub->ub_lock, flags);
 			break;
@@ -307,6 +359,7 @@ static int iolimit_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			spin_lock_irq(&ub->ub_lock);
 			throttle_setup(&iolimit->throttle, state.speed,
 					state.burst, state.latency);
+			iolimit_update_flags(ub, iolimit);
 			spin_unlock_irq(&ub->ub_lock);
 			wake_up_all(&iolimit->wq);
 			err = 0;
@@ -319,6 +372,7 @@ static int iolimit_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			spin_lock_irq(&ub->ub_lock);
 			throttle_setup(&iolimit->iops, state.speed,
 					state.burst, state.latency);
+			iolimit_update_flags(ub, iolimit);
 			spin_unlock_irq(&ub->ub_lock);
 			wake_up_all(&iolimit->wq);
 			err = 0;
@@ -394,6 +448,12 @@ static ssize_t iolimit_cgroup_read(struct cgroup *cg, struct cftype *cft,
 	case UB_CGROUP_IOPSLIMIT_LATENCY:
 		val = iolimit->iops.latency;
 		break;
+	case UB_CGROUP_IOLIMIT_PEAK:
+		val = iolimit->throttle_peak.speed;
+		break;
+	case UB_CGROUP_IOPSLIMIT_PEAK:
+		val = iolimit->iops_peak.speed;
+		break;
 	default:
 		BUG();
 	}
@@ -429,16 +489,27 @@ static int iolimit_cgroup_write_u64(struct cgroup *cg, struct cftype *cft, u64 v
 		break;
 	case UB_CGROUP_IOLIMIT_LATENCY:
 		iolimit->throttle.latency = val;
+		iolimit->throttle_peak.latency = val;
 		break;
 	case UB_CGROUP_IOPSLIMIT_BURST:
 		iolimit->iops.burst = val;
 		break;
 	case UB_CGROUP_IOPSLIMIT_LATENCY:
 		iolimit->iops.latency = val;
+		iolimit->iops_peak.latency = val;
+		break;
+	case UB_CGROUP_IOLIMIT_PEAK:
+		throttle_setup_peak(&iolimit->throttle_peak,
+				    &iolimit->throttle, val);
+		break;
+	case UB_CGROUP_IOPSLIMIT_PEAK:
+		throttle_setup_peak(&iolimit->iops_peak,
+				    &iolimit->iops, val);
 		break;
 	default:
 		BUG();
 	}
+	iolimit_update_flags(ub, iolimit);
 	wake_up_all(&iolimit->wq);
 	spin_unlock_irq(&ub->ub_lock);
 	return 0;
@@ -467,6 +538,14 @@ static struct cftype vziolimit_cftypes[] = {
 		.write_u64 = iolimit_cgroup_write_u64,
 	},
 
+	{
+		.name = "iolimit.peak",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = UB_CGROUP_IOLIMIT_PEAK,
+		.read = iolimit_cgroup_read,
+		.write_u64 = iolimit_cgroup_write_u64,
+	},
+
 	{
 		.name = "iopslimit.speed",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -488,6 +567,13 @@ static struct cftype vziolimit_cftypes[] = {
 		.read = iolimit_cgroup_read,
 		.write_u64 = iolimit_cgroup_write_u64,
 	},
+	{
+		.name = "iopslimit.peak",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = UB_CGROUP_IOPSLIMIT_PEAK,
+		.read = iolimit_cgroup_read,
+		.write_u64 = iolimit_cgroup_write_u64,
+	},
 	{ }
 };
 
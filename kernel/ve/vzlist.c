@@ -19,6 +19,7 @@
 #include <linux/veip.h>
 #include <linux/uaccess.h>
 #include <linux/pid_namespace.h>
+#include <linux/mm.h>
 
 static DEFINE_SEMAPHORE(vzlist_sem);
 
@@ -132,6 +133,90 @@ out_no_ve:
 	return ret;
 }
 
+static void fill_vetask(struct vzlist_vetask *t, struct task_struct *tsk,
+		struct pid_namespace *ns)
+{
+	cputime_t utime, stime;
+
+	t->pid = tsk->pid;
+	t->vpid = task_pid_nr_ns(tsk, ns);
+	t->tgid = tsk->tgid;
+	t->state = tsk->state | tsk->exit_state;
+
+	task_cputime(tsk, &utime, &stime);
+	t->utime = cputime_to_nsecs(utime);
+	t->stime = cputime_to_nsecs(stime);
+
+	t->rss = 0;
+	task_lock(tsk);
+	if (tsk->mm)
+		t->rss = get_mm_rss(tsk->mm);
+	task_unlock(tsk);
+}
+
+/* Same as get_vepids(), but with a summary of every task */
+static int get_vetasks(struct vzlist_vetaskctl *s)
+{
+	int ret;
+	int tasks = 0;
+	unsigned long size;
+	struct vzlist_vetask *buf;
+	struct ve_struct *ve;
+	struct task_struct *tsk;
+	struct pid_namespace *ns;
+	int nr;
+
+	ret = -ESRCH;
+	ve = get_ve_by_id(s->veid);
+	if (!ve)
+		goto out_no_ve;
+	ns = ve->ve_ns->pid_ns;
+
+	down(&vzlist_sem);
+again:
+	size = (tasks + 512)*sizeof(*buf);
+	ret = -ENOMEM;
+	buf = vmalloc(size);
+	if (!buf)
+		goto out_oom;
+
+	tasks = 0;
+	read_lock(&tasklist_lock);
+	nr = next_pidmap(ns, 0);
+	while (nr > 0) {
+		rcu_read_lock();
+
+		tsk = pid_task(find_pid_ns(nr, ns), PIDTYPE_PID);
+		if (tsk) {
+			if (size >= (tasks + 1)*sizeof(*buf))
+				fill_vetask(&buf[tasks], tsk, ns);
+			tasks++;
+		}
+
+		rcu_read_unlock();
+		nr = next_pidmap(ns, nr);
+	}
+	read_unlock(&tasklist_lock);
+
+	ret = tasks;
+	if ((tasks > s->num) | (!tasks))
+		goto out;
+	if (size < tasks*sizeof(*buf)) {
+		vfree(buf);
+		goto again;
+	}
+	if (copy_to_user(s->task, buf, tasks*sizeof(*buf)))
+		ret = -EFAULT;
+	/* success */
+out:
+	vfree(buf);
+out_oom:
+	up(&vzlist_sem);
+	put_ve(ve);
+out_no_ve:
+	return ret;
+}
+
 static int get_veips(struct vzlist_veipctl *s, unsigned int cmd)
 {
 	int ret;
@@ -253,6 +338,15 @@ static int vzlist_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			err = get_vepids(&s);
 		}
 		break;
+	case VZCTL_GET_VETASKS: {
+			struct vzlist_vetaskctl s;
+
+			err = -EFAULT;
+			if (copy_from_user(&s, argp, sizeof(s)))
+				break;
+			err = get_vetasks(&s);
+		}
+		break;
 	case VZCTL_GET_VEIP6S:
 	case VZCTL_GET_VEIPS: {
 			struct vzlist_veipctl s;
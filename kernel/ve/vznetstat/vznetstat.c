@@ -16,7 +16,9 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/spinlock.h>
+#include <linux/rculist.h>
 #include <asm/uaccess.h>
 #include <net/ip.h>
 #include <linux/in6.h>
@@ -35,11 +37,30 @@
  * ---------------------------------------------------------------------------
  */
 
+/*
+ * tc_lock serializes updates of the stat hash and of the class tables.
+ * Readers of both walk them under rcu_read_lock() only.
+ */
 static int stat_num = 0;
-static DEFINE_RWLOCK(tc_lock);
+static DEFINE_SPINLOCK(tc_lock);
+
+/*
+ * Class tables are compiled into a binary trie over the address bits.
+ * Every node remembers the biggest index of the table entry whose prefix
+ * ends there, so walking the address down the trie and taking the biggest
+ * index met gives the same result as scanning the table from its end,
+ * but in at most prefix length steps.  Child 0 means no child, since the
+ * root is never anybody's child.
+ */
+struct tc_trie_node {
+	u32 child[2];
+	int idx;
+};
 
 struct class_info_set {
 	unsigned int len;
+	/* NULL if some mask is not a prefix, table is scanned then */
+	struct tc_trie_node *trie;
 	union {
 		struct vz_tc_class_info info_v4[0];
 		struct vz_tc_class_info_v6 info_v6[0];
@@ -52,6 +73,127 @@ static struct class_info_set *info_v4 = NULL;
 static struct class_info_set *info_v6 = NULL;
 #endif
 
+/* words: number of 32-bit words in address; returns -1 for non-prefix mask */
+static int tc_prefix_len(const __u32 *mask, int words)
+{
+	int i, len = 0;
+
+	for (i = 0; i < words; i++) {
+		u32 m = ntohl(mask[i]);
+
+		if (m & (~m >> 1))
+			/* there are ones after the first zero */
+			return -1;
+		if (len != i * 32 && m)
+			return -1;
+		len += hweight32(m);
+	}
+	return len;
+}
+
+static inline int tc_addr_bit(const __u32 *addr, int bit)
+{
+	return (ntohl(addr[bit / 32]) >> (31 - bit % 32)) & 1;
+}
+
+static struct tc_trie_node *tc_trie_grow(struct tc_trie_node *trie,
+		unsigned int *size)
+{
+	struct tc_trie_node *new;
+
+	new = krealloc(trie, 2 * *size * sizeof(*trie), GFP_KERNEL);
+	if (new == NULL) {
+		kfree(trie);
+		return NULL;
+	}
+	*size *= 2;
+	return new;
+}
+
+static struct tc_trie_node *tc_trie_compile(struct class_info_set *info,
+		int v6)
+{
+	struct tc_trie_node *trie;
+	unsigned int size = 64, nr = 1;
+	int words = v6 ? 4 : 1;
+	int i;
+
+	trie = kmalloc(size * sizeof(*trie), GFP_KERNEL);
+	if (trie == NULL)
+		return NULL;
+	memset(&trie[0], 0, sizeof(*trie));
+	trie[0].idx = -1;
+
+	for (i = 0; i < info->len; i++) {
+		const __u32 *addr, *mask;
+		unsigned int n = 0;
+		int bit, len, w;
+
+		if (v6) {
+			addr = info->info_v6[i].addr;
+			mask = info->info_v6[i].mask;
+		} else {
+			addr = &info->info_v4[i].addr;
+			mask = &info->info_v4[i].mask;
+		}
+
+		len = tc_prefix_len(mask, words);
+		if (len < 0) {
+			kfree(trie);
+			return NULL;
+		}
+		for (w = 0; w < words; w++)
+			if (addr[w] & ~mask[w])
+				break;
+		if (w != words)
+			/* such a class never matches */
+			continue;
+
+		for (bit = 0; bit < len; bit++) {
+			int b = tc_addr_bit(addr, bit);
+
+			if (trie[n].child[b] == 0) {
+				if (nr == size) {
+					trie = tc_trie_grow(trie, &size);
+					if (trie == NULL)
+						return NULL;
+				}
+				memset(&trie[nr], 0, sizeof(*trie));
+				trie[nr].idx = -1;
+				trie[n].child[b] = nr++;
+			}
+			n = trie[n].child[b];
+		}
+		trie[n].idx = i;
+	}
+	return trie;
+}
+
+/* returns the index of the matching class or -1 */
+static int tc_trie_lookup(const struct tc_trie_node *trie,
+		const __u32 *addr, int bits)
+{
+	unsigned int n = 0;
+	int bit, idx = trie[0].idx;
+
+	for (bit = 0; bit < bits; bit++) {
+		n = trie[n].child[tc_addr_bit(addr, bit)];
+		if (n == 0)
+			break;
+		if (trie[n].idx > idx)
+			idx = trie[n].idx;
+	}
+	return idx;
+}
+
+static void class_info_free(struct class_info_set *info)
+{
+	if (info == NULL)
+		return;
+	kfree(info->trie);
+	kfree(info);
+}
+
 /* v6: flag IPv6 classes or IPv4 */
 static int venet_acct_set_classes(const void __user *user_info, int length, int v6)
 {
@@ -70,6 +212,7 @@ static int venet_acct_set_classes(const void __user *user_info, int length, int
 
 	err = -EFAULT;
 	info->len = length;
+	info->trie = NULL;
 	if (copy_from_user(info->data, user_info, size * length))
 		goto out_free;
 
@@ -87,20 +230,25 @@ static int venet_acct_set_classes(const void __user *user_info, int length, int
 			goto out_free;
 	}
 
-	write_lock_irq(&tc_lock);
+	/* Failure is not fatal, linear scan gives the same result */
+	info->trie = tc_trie_compile(info, v6);
+
+	spin_lock_irq(&tc_lock);
 	if (v6) {
-		old = rcu_dereference(info_v6);
+		old = rcu_dereference_protected(info_v6,
+				lockdep_is_held(&tc_lock));
 		rcu_assign_pointer(info_v6, info);
 	} else {
-		old = rcu_dereference(info_v4);
+		old = rcu_dereference_protected(info_v4,
+				lockdep_is_held(&tc_lock));
 		rcu_assign_pointer(info_v4, info);
 	}
-	write_unlock_irq(&tc_lock);
+	spin_unlock_irq(&tc_lock);
 
 	synchronize_net();
 	/* IMPORTANT. I think reset of statistics collected should not be
 	 * done here. */
-	kfree(old);
+	class_info_free(old);
 	return 0;
 
 out_free:
@@ -176,14 +324,14 @@ static int stat_hash(envid_t veid)
 	return veid & (STAT_HASH_LEN - 1);
 }
 
-/* tc_lock is taken by the caller! */
+/* rcu_read_lock() or tc_lock is taken by the caller! */
 static inline struct venet_stat *__find(envid_t veid)
 {
 	int hash;
 	struct venet_stat *ptr;
 
 	hash = stat_hash(veid);
-	list_for_each_entry(ptr, stat_hash_list + hash, list) {
+	list_for_each_entry_rcu(ptr, stat_hash_list + hash, list) {
 		if (ptr->veid == veid)
 			return ptr;
 	}
@@ -192,32 +340,45 @@ static inline struct venet_stat *__find(envid_t veid)
 
 static struct venet_stat *next_stat(int *hash, struct venet_stat *item)
 {
-	struct list_head *ptr;
+	struct list_head *ptr, *next;
 
 	ptr = item != NULL ? &item->list : (stat_hash_list + *hash);
 	while (*hash < STAT_HASH_LEN) {
-		if (ptr->next != stat_hash_list + *hash)
-			return list_entry(ptr->next, struct venet_stat, list);
+		next = rcu_dereference_raw(list_next_rcu(ptr));
+		if (next != stat_hash_list + *hash)
+			return list_entry(next, struct venet_stat, list);
 		(*hash)++;
 		ptr = stat_hash_list + *hash;
 	}
 	return NULL;
 }
 
+/*
+ * Lookups do not take tc_lock, so a stat being destroyed may still be
+ * found.  Destroying sets users to -1, and no references are given out
+ * after that.
+ */
+static struct venet_stat *__find_get(envid_t veid)
+{
+	struct venet_stat *ptr;
+
+	rcu_read_lock();
+	ptr = __find(veid);
+	if (ptr != NULL && !atomic_inc_unless_negative(&ptr->users))
+		ptr = NULL;
+	rcu_read_unlock();
+	return ptr;
+}
+
 struct venet_stat *venet_acct_find_create_stat(envid_t veid)
 {
 	struct venet_stat *ptr;
 	unsigned long flags;
 	struct venet_stat *stat;
 
-	read_lock(&tc_lock);
-	ptr = __find(veid);
-	if (ptr != NULL) {
-		venet_acct_get_stat(ptr);
-		read_unlock(&tc_lock);
+	ptr = __find_get(veid);
+	if (ptr != NULL)
 		return ptr;
-	}
-	read_unlock(&tc_lock);
 
 	ptr = kzalloc(sizeof(struct venet_stat), GFP_KERNEL);
 	if (ptr == NULL)
@@ -232,21 +393,28 @@ struct venet_stat *venet_acct_find_create_stat(envid_t veid)
 	if (ptr->ipv6_stat == NULL)
 		goto out_free_v4;
 
-	write_lock_irqsave(&tc_lock, flags);
+	ptr->rate.cache = alloc_percpu(s64);
+	if (ptr->rate.cache == NULL)
+		goto out_free_v6;
+
+	spin_lock_irqsave(&tc_lock, flags);
 	stat = __find(veid);
 	if (stat != NULL) {
+		free_percpu(ptr->rate.cache);
 		free_percpu(ptr->ipv6_stat);
 		free_percpu(ptr->ipv4_stat);
 		kfree(ptr);
 		ptr = stat;
 	} else {
-		list_add(&ptr->list, stat_hash_list + stat_hash(veid));
+		list_add_rcu(&ptr->list, stat_hash_list + stat_hash(veid));
 		stat_num++;
 	}
 	venet_acct_get_stat(ptr);
-	write_unlock_irqrestore(&tc_lock, flags);
+	spin_unlock_irqrestore(&tc_lock, flags);
 	return ptr;
 
+out_free_v6:
+	free_percpu(ptr->ipv6_stat);
 out_free_v4:
 	free_percpu(ptr->ipv4_stat);
 out_free:
@@ -257,14 +425,7 @@ out:
 
 struct venet_stat *venet_acct_find_stat(envid_t veid)
 {
-	struct venet_stat *ptr;
-
-	read_lock(&tc_lock);
-	ptr = __find(veid);
-	if (ptr != NULL)
-		venet_acct_get_stat(ptr);
-	read_unlock(&tc_lock);
-	return ptr;
+	return __find_get(veid);
 }
 
 void venet_acct_put_stat(struct venet_stat *stat)
@@ -308,7 +469,7 @@ static int venet_acct_get_ve_stat(struct vzctl_tc_get_stat *data, int v6)
 	incoming_pkt = (u32 *)(outgoing + TC_CLASS_MAX);
 	outgoing_pkt = incoming_pkt + TC_CLASS_MAX;
 
-	read_lock(&tc_lock);
+	rcu_read_lock();
 	err = -ESRCH;
 	stat = __find(data->veid);
 	if (stat == NULL)
@@ -329,7 +490,7 @@ static int venet_acct_get_ve_stat(struct vzctl_tc_get_stat *data, int v6)
 		}
 	}
 
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 
 	err = -EFAULT;
 	size = data->length * sizeof(u64);
@@ -350,19 +511,86 @@ out_free:
 	return err;
 
 out_unlock:
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 	goto out_free;
 }
 
-static int __tc_destroy_stat(struct venet_stat *stat)
+static void venet_stat_free_rcu(struct rcu_head *head)
 {
-	if (atomic_read(&stat->users))
-		return -EBUSY;
-	stat_num--;
-	list_del(&stat->list);
+	struct venet_stat *stat = container_of(head, struct venet_stat, rcu);
+
+	free_percpu(stat->rate.cache);
 	free_percpu(stat->ipv6_stat);
 	free_percpu(stat->ipv4_stat);
 	kfree(stat);
+}
+
+/* tc_lock is taken by the caller! */
+static void fold_ve_stat(struct acct_stat *acct, struct vz_tc_ve_stat *rec)
+{
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct acct_stat *stat;
+
+		stat = per_cpu_ptr(acct, cpu);
+		for (i = 0; i < TC_CLASS_MAX; i++) {
+			rec->incoming[i] += stat->cnt[i][ACCT_IN].bytes;
+			rec->outgoing[i] += stat->cnt[i][ACCT_OUT].bytes;
+			rec->incoming_pkt[i] += stat->cnt[i][ACCT_IN].pkts;
+			rec->outgoing_pkt[i] += stat->cnt[i][ACCT_OUT].pkts;
+		}
+	}
+}
+
+/*
+ * Counters of all VEs in one go, saves a GET_STAT call per VE.
+ * Returns the number of records filled.
+ */
+static int venet_acct_get_all_stat(struct vz_tc_ve_stat __user *ret,
+		int length, int v6)
+{
+	struct vz_tc_ve_stat *buf;
+	struct venet_stat *stat;
+	int hash, err, i;
+
+	BUILD_BUG_ON(VZ_TC_CLASS_MAX != TC_CLASS_MAX);
+
+	if (length < 0)
+		return -EINVAL;
+	length = min(length, stat_num);
+	if (length == 0)
+		return 0;
+
+	buf = vzalloc(length * sizeof(*buf));
+	if (buf == NULL)
+		return -ENOMEM;
+
+	i = 0;
+	hash = 0;
+	stat = NULL;
+	rcu_read_lock();
+	while (i < length && (stat = next_stat(&hash, stat)) != NULL) {
+		buf[i].veid = stat->veid;
+		fold_ve_stat(__choose_acct(stat, v6), buf + i);
+		i++;
+	}
+	rcu_read_unlock();
+
+	err = -EFAULT;
+	if (!copy_to_user(ret, buf, i * sizeof(*buf)))
+		err = i;
+	vfree(buf);
+	return err;
+}
+
+static int __tc_destroy_stat(struct venet_stat *stat)
+{
+	if (atomic_cmpxchg(&stat->users, 0, -1) != 0)
+		return -EBUSY;
+	stat_num--;
+	list_del_rcu(&stat->list);
+	call_rcu(&stat->rcu, venet_stat_free_rcu);
 	return 0;
 }
 
@@ -373,11 +601,11 @@ static int venet_acct_destroy_stat(envid_t veid)
 	int err;
 
 	err = -ESRCH;
-	write_lock_irq(&tc_lock);
+	spin_lock_irq(&tc_lock);
 	stat = __find(veid);
 	if (stat != NULL)
 		err = __tc_destroy_stat(stat);
-	write_unlock_irq(&tc_lock);
+	spin_unlock_irq(&tc_lock);
 	return err;
 }
 
@@ -386,13 +614,13 @@ static void venet_acct_destroy_all_stat(void)
 	int hash;
 	struct list_head *ptr, *tmp;
 
-	write_lock_irq(&tc_lock);
+	spin_lock_irq(&tc_lock);
 	for (hash = 0; hash < STAT_HASH_LEN; hash++) {
 		list_for_each_safe(ptr, tmp, stat_hash_list + hash)
 			__tc_destroy_stat(list_entry(ptr,
 						struct venet_stat, list));
 	}
-	write_unlock_irq(&tc_lock);
+	spin_unlock_irq(&tc_lock);
 }
 
 static DEFINE_MUTEX(req_mutex);
@@ -463,7 +691,7 @@ static void clear_all_percpu_statistics(struct work_struct *dummy)
 	if (cpumask_first(cpu_online_mask) == this_cpu)
 		other = 1;
 
-	read_lock(&tc_lock);
+	rcu_read_lock();
 
 	while ((stat = next_stat(&hash, stat)) != NULL) {
 		zero_venet_stat(stat, this_cpu);
@@ -477,7 +705,7 @@ static void clear_all_percpu_statistics(struct work_struct *dummy)
 				zero_venet_stat(stat, cpu);
 	}
 
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 }
 
 /* Clear all present statistics */
@@ -510,15 +738,15 @@ static int venet_acct_get_stat_list(envid_t *__list, int length)
 		return -ENOMEM;
 
 	i = 0;
-	read_lock(&tc_lock);
+	rcu_read_lock();
 	for (hash = 0; hash < STAT_HASH_LEN; hash++) {
-		list_for_each_entry(ptr, stat_hash_list + hash, list) {
+		list_for_each_entry_rcu(ptr, stat_hash_list + hash, list) {
 			list[i++] = ptr->veid;
 			if (i == length)
 				break;
 		}
 	}
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 
 	err = -EFAULT;
 	if (!copy_to_user(__list, list, sizeof(envid_t) * i))
@@ -532,11 +760,11 @@ static int venet_acct_get_base(envid_t veid)
 	int err = -ESRCH;
 	struct venet_stat *ptr;
 
-	read_lock(&tc_lock);
+	rcu_read_lock();
 	ptr = __find(veid);
 	if (ptr != NULL)
 		err = ptr->base;
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 	return err;
 }
 
@@ -565,7 +793,7 @@ static int venet_acct_set_base(envid_t veid, __u16 base)
 	if (stat == NULL)
 		return -ENOMEM;
 
-	write_lock_irq(&tc_lock);
+	spin_lock_irq(&tc_lock);
 	if (base != 0)
 		goto done;
 
@@ -584,11 +812,60 @@ done:
 		break;
 	} while (pos != rover);
 
-	write_unlock_irq(&tc_lock);
+	spin_unlock_irq(&tc_lock);
 	venet_acct_put_stat(stat);
 	return err;
 }
 
+static DEFINE_MUTEX(rate_mutex);
+
+static int venet_acct_set_rate(struct vzctl_tc_rate *tr)
+{
+	struct venet_stat *stat;
+	struct venet_rate *r;
+
+	if (tr->rate && tr->burst < VENET_RATE_BURST_MIN)
+		return -EINVAL;
+
+	stat = venet_acct_find_create_stat(tr->veid);
+	if (stat == NULL)
+		return -ENOMEM;
+
+	r = &stat->rate;
+	mutex_lock(&rate_mutex);
+	/* Senders do not look at the rest while the rate is 0 */
+	ACCESS_ONCE(r->rate) = 0;
+	smp_wmb();
+	r->burst = tr->burst;
+	r->batch = min_t(u64, VENET_RATE_BATCH_MAX,
+			 tr->burst / num_possible_cpus());
+	atomic64_set(&r->tokens, tr->burst);
+	atomic64_set(&r->stamp, ktime_to_ns(ktime_get()));
+	smp_wmb();
+	ACCESS_ONCE(r->rate) = tr->rate;
+	mutex_unlock(&rate_mutex);
+
+	venet_acct_put_stat(stat);
+	return 0;
+}
+
+static int venet_acct_get_rate(struct vzctl_tc_rate *tr)
+{
+	struct venet_stat *stat;
+
+	stat = venet_acct_find_stat(tr->veid);
+	if (stat == NULL)
+		return -ESRCH;
+
+	mutex_lock(&rate_mutex);
+	tr->rate = stat->rate.rate;
+	tr->burst = stat->rate.burst;
+	mutex_unlock(&rate_mutex);
+
+	venet_acct_put_stat(stat);
+	return 0;
+}
+
 /*
  * ---------------------------------------------------------------------------
  * Accounting engine
@@ -621,6 +898,13 @@ static noinline int venet_acct_classify_v6(struct sk_buff *skb, int dir)
 	if (info == NULL)
 		goto out_unlock;
 
+	if (info->trie != NULL) {
+		i = tc_trie_lookup(info->trie, addr, 128);
+		if (i >= 0)
+			ret = info->info_v6[i].cid;
+		goto out_unlock;
+	}
+
 	for (i = info->len - 1; i >= 0; i--) {
 		if (match_v6_class(addr, &info->info_v6[i])) {
 			ret = info->info_v6[i].cid;
@@ -645,6 +929,12 @@ static int __venet_acct_classify(__u32 daddr)
 	info = rcu_dereference(info_v4);
 	if (info == NULL)
 		goto out_unlock;
+	if (info->trie != NULL) {
+		i = tc_trie_lookup(info->trie, &daddr, 32);
+		if (i >= 0)
+			ret = info->info_v4[i].cid;
+		goto out_unlock;
+	}
 	for (i = info->len - 1; i >= 0; i--) {
 		if ((daddr & info->info_v4[i].mask) == info->info_v4[i].addr) {
 			ret = info->info_v4[i].cid;
@@ -777,6 +1067,7 @@ static int venet_acct_ioctl(struct file *file, unsigned int cmd,
 	struct vzctl_tc_classes_v6	tcl_v6;
 	struct vzctl_tc_get_stat 	tcnt;
 	struct vzctl_tc_get_stat_list	tcsl;
+	struct vzctl_tc_get_all_stat	tcas;
 
 
 	if (!capable_setveid())
@@ -838,6 +1129,14 @@ static int venet_acct_ioctl(struct file *file, unsigned int cmd,
 				break;
 			err = venet_acct_get_ve_stat(&tcnt, cmd == VZCTL_TC_GET_STAT_V6);
 			break;
+		case VZCTL_TC_GET_ALL_STAT:
+		case VZCTL_TC_GET_ALL_STAT_V6:
+			err = -EFAULT;
+			if (copy_from_user(&tcas, (void *)arg, sizeof(tcas)))
+				break;
+			err = venet_acct_get_all_stat(tcas.stat, tcas.length,
+					cmd == VZCTL_TC_GET_ALL_STAT_V6);
+			break;
 		case VZCTL_TC_DESTROY_STAT:
 			err = venet_acct_destroy_stat(arg);
 			break;
@@ -864,6 +1163,22 @@ static int venet_acct_ioctl(struct file *file, unsigned int cmd,
 			err = venet_acct_set_base(tcb.veid, tcb.base);
 			break;
 		}
+		case VZCTL_TC_SET_RATE:
+		case VZCTL_TC_GET_RATE:
+		{
+			struct vzctl_tc_rate tr;
+			err = -EFAULT;
+			if (copy_from_user(&tr, (void *)arg, sizeof(tr)))
+				break;
+			if (cmd == VZCTL_TC_SET_RATE) {
+				err = venet_acct_set_rate(&tr);
+				break;
+			}
+			err = venet_acct_get_rate(&tr);
+			if (!err && copy_to_user((void *)arg, &tr, sizeof(tr)))
+				err = -EFAULT;
+			break;
+		}
 	}
 	return err;
 }
@@ -916,6 +1231,27 @@ static int compat_venet_acct_ioctl(struct file *file, unsigned int cmd,
 				(unsigned long)s);
 		break;
 	}
+	case COMPAT_VZCTL_TC_GET_ALL_STAT:
+	case COMPAT_VZCTL_TC_GET_ALL_STAT_V6: {
+		struct compat_vzctl_tc_get_all_stat cs;
+		struct vzctl_tc_get_all_stat __user *s;
+
+		s = compat_alloc_user_space(sizeof(*s));
+
+		err = -EFAULT;
+		if (copy_from_user(&cs, (void *)arg, sizeof(cs)))
+			break;
+		if (put_user(compat_ptr(cs.stat), &s->stat) ||
+		    put_user(cs.length, &s->length))
+			break;
+
+		err = venet_acct_ioctl(file,
+				cmd == COMPAT_VZCTL_TC_GET_ALL_STAT_V6 ?
+					VZCTL_TC_GET_ALL_STAT_V6 :
+					VZCTL_TC_GET_ALL_STAT,
+				(unsigned long)s);
+		break;
+	}
 	case COMPAT_VZCTL_TC_SET_CLASS_TABLE:
 	case COMPAT_VZCTL_TC_GET_CLASS_TABLE: {
 		struct compat_vzctl_tc_classes cs;
@@ -1014,7 +1350,7 @@ static void *stat_seq_start(struct seq_file *m, loff_t *pos)
 	if (!ve_is_super(get_exec_env()))
 		return NULL;
 
-	read_lock(&tc_lock);
+	rcu_read_lock();
 	hash = 0;
 	stat = NULL;
 	stat = next_stat(&hash, stat);
@@ -1037,7 +1373,7 @@ static void *stat_seq_next(struct seq_file *m, void *v, loff_t *pos)
 
 static void stat_seq_stop(struct seq_file *m, void *v)
 {
-	read_unlock(&tc_lock);
+	rcu_read_unlock();
 }
 
 static struct seq_operations stat_seq_op = {
@@ -1148,8 +1484,10 @@ void __exit venetstat_exit(void)
 	remove_proc_entry("venetstat_v6", proc_vz_dir);
 	remove_proc_entry("venetstat", proc_vz_dir);
 #endif
-	kfree(info_v4);
-	kfree(info_v6);
+	/* Wait for venet_stat_free_rcu() callbacks */
+	rcu_barrier();
+	class_info_free(info_v4);
+	class_info_free(info_v6);
 }
 
 module_init(venetstat_init);
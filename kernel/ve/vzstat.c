@@ -201,6 +201,10 @@ static int latency_seq_show(struct seq_file *m, void *v)
 	avglat_seq_show(m, "swap_in:", kstat_glob.swap_in.avg);
 	avglat_seq_show(m, "page_in:", kstat_glob.page_in.avg);
 
+	seq_puts(m, "\nScheduling histogram:\n");
+	seq_printf(m, "%-11s %20s\n", "Lat_below", "Calls");
+	kstat_lat_hist_seq_show(m, kstat_glob.sched_lat_hist);
+
 	return 0;
 }
 
@@ -701,6 +705,94 @@ static struct file_operations proc_mmperf_operations = {
 	.owner = THIS_MODULE,
 };
 
+/*
+ * ------------------------------------------------------------------------
+ * /proc/vz/kstat: the same counters as one binary record
+ * ------------------------------------------------------------------------
+ */
+static void kstat_fill_lat(struct vz_kstat_lat *r,
+		struct kstat_lat_snap_struct *snap, u64 *avg)
+{
+	r->maxlat = snap->maxlat;
+	r->totlat = snap->totlat;
+	r->count = snap->count;
+	memcpy(r->avg, avg, sizeof(r->avg));
+}
+
+static void kstat_fill_perf(struct vz_kstat_perf *r,
+		struct kstat_perf_pcpu_struct *p)
+{
+	r->count = p->last.count;
+	r->cpu_maxdur = p->last.cpu_maxdur;
+	r->wall_maxdur = p->last.wall_maxdur;
+	r->cpu_tottime = p->last.cpu_tottime;
+	r->wall_tottime = p->last.wall_tottime;
+}
+
+static int kstat_seq_show(struct seq_file *m, void *v)
+{
+	struct vz_kstat_record *rec = m->private;
+	struct kstat_lat_hist_struct hist;
+	int i;
+
+	BUILD_BUG_ON(VZ_KSTAT_ALLOC_NR != KSTAT_ALLOCSTAT_NR);
+	BUILD_BUG_ON(VZ_KSTAT_HIST_NR != KSTAT_LAT_HIST_NR);
+
+	if (!v)
+		return 0;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->size = sizeof(*rec);
+	rec->version = VZ_KSTAT_VERSION;
+
+	kstat_fill_lat(&rec->sched_lat, &kstat_glob.sched_lat.last,
+			kstat_glob.sched_lat.avg);
+	for (i = 0; i < KSTAT_ALLOCSTAT_NR; i++)
+		kstat_fill_lat(&rec->alloc_lat[i],
+				&kstat_glob.alloc_lat[i].last,
+				kstat_glob.alloc_lat[i].avg);
+	kstat_fill_lat(&rec->swap_in, &kstat_glob.swap_in.last,
+			kstat_glob.swap_in.avg);
+	kstat_fill_lat(&rec->page_in, &kstat_glob.page_in.last,
+			kstat_glob.page_in.avg);
+
+	kstat_lat_hist_sum(kstat_glob.sched_lat_hist, &hist);
+	for (i = 0; i < KSTAT_LAT_HIST_NR; i++)
+		rec->sched_lat_hist[i] = hist.bucket[i];
+
+	kstat_fill_perf(&rec->ttfp, &kstat_glob.ttfp);
+	kstat_fill_perf(&rec->cache_reap, &kstat_glob.cache_reap);
+	kstat_fill_perf(&rec->refill_inact, &kstat_glob.refill_inact);
+	kstat_fill_perf(&rec->shrink_icache, &kstat_glob.shrink_icache);
+	kstat_fill_perf(&rec->shrink_dcache, &kstat_glob.shrink_dcache);
+
+	seq_write(m, rec, sizeof(*rec));
+	return 0;
+}
+
+static struct seq_operations kstat_seq_op = {
+	start:	empty_seq_start,
+	next:	empty_seq_next,
+	stop:	empty_seq_stop,
+	show:	kstat_seq_show
+};
+
+static int kstat_open(struct inode *inode, struct file *file)
+{
+	if (!__seq_open_private(file, &kstat_seq_op,
+				sizeof(struct vz_kstat_record)))
+		return -ENOMEM;
+	return 0;
+}
+
+static struct file_operations proc_kstat_operations = {
+	.open = kstat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+	.owner = THIS_MODULE,
+};
+
 /*
  * ------------------------------------------------------------------------
  * module init/exit code
@@ -729,6 +821,12 @@ int __init vzstat_mon_init(void)
 		goto fail_perf;
 	}
 
+	entry = proc_create("kstat", S_IRUGO, proc_vz_dir, &proc_kstat_operations);
+	if (!entry) {
+		printk(KERN_WARNING "VZSTAT: can't make proc entry\n");
+		goto fail_kstat;
+	}
+
 	vzstat_thread_tsk = kthread_run(vzstat_mon_loop, NULL, "vzstat");
 	if (IS_ERR(vzstat_thread_tsk))
 		goto fail_thread;
@@ -738,6 +836,8 @@ int __init vzstat_mon_init(void)
 	return 0;
 
 fail_thread:
+	remove_proc_entry("kstat", proc_vz_dir);
+fail_kstat:
 	remove_proc_entry("mmperf", proc_vz_dir);
 fail_perf:
 	remove_proc_entry("stats", proc_vz_dir);
@@ -751,6 +851,7 @@ void __exit vzstat_mon_exit(void)
 {
 	kthread_stop(vzstat_thread_tsk);
 
+	remove_proc_entry("kstat", proc_vz_dir);
 	remove_proc_entry("mmperf", proc_vz_dir);
 	remove_proc_entry("stats", proc_vz_dir);
 	remove_proc_entry("latency", proc_vz_dir);
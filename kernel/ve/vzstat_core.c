@@ -6,6 +6,9 @@
  */
 
 #include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ve.h>
 #include <linux/vzstat.h>
 
 void KSTAT_PERF_ADD(struct kstat_perf_pcpu_struct *ptr, u64 real_time, u64 cpu_time)
@@ -120,3 +123,142 @@ void KSTAT_LAT_PCPU_UPDATE(struct kstat_lat_pcpu_struct *p)
 	p->max_snap = 0;
 }
 EXPORT_SYMBOL(KSTAT_LAT_PCPU_UPDATE);
+
+/*
+ * Counters are only ever incremented, so users compute percentiles
+ * over an interval from the difference of two readings.
+ */
+void kstat_lat_hist_sum(struct kstat_lat_hist_struct __percpu *p,
+		struct kstat_lat_hist_struct *sum)
+{
+	struct kstat_lat_hist_struct *cur;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		cur = per_cpu_ptr(p, cpu);
+		for (i = 0; i < KSTAT_LAT_HIST_NR; i++)
+			sum->bucket[i] += ACCESS_ONCE(cur->bucket[i]);
+	}
+}
+EXPORT_SYMBOL(kstat_lat_hist_sum);
+
+/* One "<upper bound in ns> <count>" line per bucket */
+void kstat_lat_hist_seq_show(struct seq_file *m,
+		struct kstat_lat_hist_struct __percpu *p)
+{
+	struct kstat_lat_hist_struct sum;
+	int i;
+
+	kstat_lat_hist_sum(p, &sum);
+	for (i = 0; i < KSTAT_LAT_HIST_NR - 1; i++)
+		seq_printf(m, "%-11Lu %20lu\n",
+				1ULL << (i + KSTAT_LAT_HIST_SHIFT),
+				sum.bucket[i]);
+	seq_printf(m, "%-11s %20lu\n", "inf", sum.bucket[i]);
+}
+EXPORT_SYMBOL(kstat_lat_hist_seq_show);
+
+/*
+ * Stall accounting: whoever waits for memory or io brackets the wait
+ * with kstat_stall_start() and kstat_stall_end(), the scheduler adds
+ * run queue waits itself.  Averages are only folded when read, so they
+ * cost nothing while nobody looks at them.
+ */
+#define KSTAT_STALL_FREQ	(2 * NSEC_PER_SEC)
+#define KSTAT_STALL_MAX_FOLD	600	/* all averages are ~0 by then */
+
+/* 1/exp(2sec/10sec), 1/exp(2sec/60sec), 1/exp(2sec/300sec) */
+static const unsigned long kstat_stall_exp[3] = { 1677, 1981, 2034 };
+
+u64 kstat_stall_start(void)
+{
+	return local_clock();
+}
+EXPORT_SYMBOL(kstat_stall_start);
+
+void kstat_stall_end(int type, u64 start)
+{
+	this_cpu_add(current->task_ve->stall.cur->time[type],
+			local_clock() - start);
+}
+EXPORT_SYMBOL(kstat_stall_end);
+
+int kstat_stall_init(struct kstat_stall_struct *p)
+{
+	p->cur = alloc_percpu(struct kstat_stall_pcpu_struct);
+	if (!p->cur)
+		return -ENOMEM;
+	spin_lock_init(&p->lock);
+	p->last_update = ktime_to_ns(ktime_get());
+	return 0;
+}
+
+void kstat_stall_free(struct kstat_stall_struct *p)
+{
+	free_percpu(p->cur);
+}
+
+static void kstat_stall_fold(struct kstat_stall_struct *p,
+		struct kstat_stall_pcpu_struct *sum)
+{
+	u64 now, elapsed, delta;
+	unsigned long n, active;
+	int i, j, k, cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < KSTAT_STALL_NR; i++)
+			sum->time[i] += per_cpu_ptr(p->cur, cpu)->time[i];
+
+	now = ktime_to_ns(ktime_get());
+	elapsed = now - p->last_update;
+	if (elapsed < KSTAT_STALL_FREQ)
+		return;
+
+	n = min_t(u64, div64_u64(elapsed, KSTAT_STALL_FREQ),
+			KSTAT_STALL_MAX_FOLD);
+	for (i = 0; i < KSTAT_STALL_NR; i++) {
+		delta = sum->time[i] - p->last[i];
+		p->last[i] = sum->time[i];
+		/* stalled tasks on average over the elapsed time */
+		active = div64_u64(delta, elapsed >> FSHIFT);
+		for (j = 0; j < 3; j++)
+			for (k = 0; k < n; k++)
+				CALC_LOAD(p->avg[i][j], kstat_stall_exp[j],
+						active);
+	}
+	p->last_update = now;
+}
+
+#define STALL_INT(x)	((x) >> FSHIFT)
+#define STALL_FRAC(x)	STALL_INT(((x) & (FIXED_1 - 1)) * 100)
+
+/*
+ * Averages are in percent of one cpu's time: 100 means that one task
+ * was stalled all the time, or two tasks half the time, etc.
+ */
+void kstat_stall_seq_show(struct seq_file *m, struct kstat_stall_struct *p)
+{
+	static const char *names[KSTAT_STALL_NR] = {
+		[KSTAT_STALL_CPU] = "cpu",
+		[KSTAT_STALL_MEM] = "memory",
+		[KSTAT_STALL_IO] = "io",
+	};
+	struct kstat_stall_pcpu_struct sum;
+	unsigned long avg[KSTAT_STALL_NR][3];
+	int i, j;
+
+	spin_lock(&p->lock);
+	kstat_stall_fold(p, &sum);
+	memcpy(avg, p->avg, sizeof(avg));
+	spin_unlock(&p->lock);
+
+	for (i = 0; i < KSTAT_STALL_NR; i++) {
+		seq_printf(m, "%s", names[i]);
+		for (j = 0; j < 3; j++)
+			seq_printf(m, " %lu.%02lu", STALL_INT(avg[i][j] * 100),
+					STALL_FRAC(avg[i][j] * 100));
+		seq_printf(m, " %Lu\n", div_u64(sum.time[i], NSEC_PER_USEC));
+	}
+}
@@ -116,7 +116,11 @@ void __cleancache_init_fs(struct super_block *sb)
 	int pool_id = CLEANCACHE_NO_BACKEND;
 
 	if (cleancache_ops) {
-		pool_id = cleancache_ops->init_fs(PAGE_SIZE);
+		if (cleancache_ops->init_fs_uuid)
+			pool_id = cleancache_ops->init_fs_uuid(sb->s_uuid,
+							       PAGE_SIZE);
+		else
+			pool_id = cleancache_ops->init_fs(PAGE_SIZE);
 		if (pool_id < 0)
 			pool_id = CLEANCACHE_NO_POOL;
 	}
@@ -17,6 +17,8 @@
 #include <linux/balloon_compaction.h>
 #include <linux/page-isolation.h>
 #include <linux/kasan.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #ifdef CONFIG_COMPACTION
@@ -831,6 +833,9 @@ static int compact_finished(struct zone *zone,
 	if (fatal_signal_pending(current))
 		return COMPACT_PARTIAL;
 
+	if (cc->proactive && kthread_should_stop())
+		return COMPACT_PARTIAL;
+
 	/* Compaction run completes if the migrate and free scanner meet */
 	if (cc->free_pfn <= cc->migrate_pfn) {
 		/*
@@ -852,13 +857,23 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
-	/* Compaction run is not finished if the watermark is not met */
-	watermark = low_wmark_pages(zone);
+	/*
+	 * Compaction run is not finished if the watermark is not met.
+	 * Background compaction works up to the high watermark, so that
+	 * allocations find free blocks well before reaching the low one.
+	 */
+	if (cc->proactive)
+		watermark = high_wmark_pages(zone);
+	else
+		watermark = low_wmark_pages(zone);
 	watermark += (1 << cc->order);
 
 	if (!zone_watermark_ok(zone, cc->order, watermark, 0, 0))
 		return COMPACT_CONTINUE;
 
+	if (cc->proactive)
+		return COMPACT_PARTIAL;
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		struct free_area *area = &zone->free_area[order];
@@ -932,6 +947,9 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	unsigned long end_pfn = zone_end_pfn(zone);
 
 	ret = compaction_suitable(zone, cc->order);
+	/* An allocation would succeed, but kcompactd aims higher */
+	if (ret == COMPACT_PARTIAL && cc->proactive)
+		ret = COMPACT_CONTINUE;
 	switch (ret) {
 	case COMPACT_PARTIAL:
 	case COMPACT_SKIPPED:
@@ -1162,6 +1180,117 @@ static void compact_nodes(void)
 		compact_node(nid);
 }
 
+/*
+ * Background compaction: every sysctl_compaction_proactive_ms a per-node
+ * kcompactd looks for zones that have enough free memory but not in
+ * pageblock sized chunks, and compacts them asynchronously until the
+ * high watermark is met at that order.  Whether free memory is short
+ * because of fragmentation or just short is decided by the usual
+ * fragmentation index check against extfrag_threshold in
+ * compaction_suitable().  0 disables it.
+ */
+unsigned int sysctl_compaction_proactive_ms;
+
+static DECLARE_WAIT_QUEUE_HEAD(kcompactd_wait);
+
+static bool kcompactd_zone_needs(struct zone *zone, int order)
+{
+	unsigned long watermark = high_wmark_pages(zone);
+
+	/* Short of memory rather than of contiguity: that's for kswapd */
+	if (!zone_watermark_ok(zone, 0, watermark + (2UL << order), 0, 0))
+		return false;
+
+	return !zone_watermark_ok(zone, order, watermark, 0, 0);
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct compact_control cc = {
+			.order = pageblock_order,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = false,
+			.proactive = true,
+		};
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+		if (!kcompactd_zone_needs(zone, cc.order))
+			continue;
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (kthread_should_stop())
+			return;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		unsigned int msecs = ACCESS_ONCE(sysctl_compaction_proactive_ms);
+
+		if (!msecs) {
+			wait_event_freezable(kcompactd_wait,
+					sysctl_compaction_proactive_ms ||
+					kthread_should_stop());
+			continue;
+		}
+
+		kcompactd_do_work(pgdat);
+
+		wait_event_freezable_timeout(kcompactd_wait,
+				kthread_should_stop(), msecs_to_jiffies(msecs));
+	}
+
+	return 0;
+}
+
+int sysctl_compaction_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write)
+		wake_up_all(&kcompactd_wait);
+
+	return ret;
+}
+
+static int __init kcompactd_init(void)
+{
+	struct task_struct *p;
+	int nid;
+
+	for_each_node_state(nid, N_MEMORY) {
+		p = kthread_run(kcompactd, NODE_DATA(nid), "kcompactd%d", nid);
+		if (IS_ERR(p))
+			pr_err("Failed to start kcompactd on node %d\n", nid);
+	}
+	return 0;
+}
+module_init(kcompactd_init)
+
 /* The written value is actually unused, all memory is compacted */
 int sysctl_compact_memory;
 
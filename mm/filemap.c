@@ -1445,6 +1445,7 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @nowait:	don't wait for pages, stop with -EAGAIN instead
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
@@ -1453,7 +1454,7 @@ static void shrink_readahead_size_eio(struct file *filp,
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor, bool nowait)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1487,6 +1488,8 @@ find_page:
 				goto page_ok;
 		}
 		if (!page) {
+			if (nowait)
+				goto would_block;
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
@@ -1500,6 +1503,10 @@ find_page:
 					index, last_index - index);
 		}
 		if (!PageUptodate(page)) {
+			if (nowait) {
+				page_cache_release(page);
+				goto would_block;
+			}
 			if (inode->i_blkbits == PAGE_CACHE_SHIFT ||
 					!mapping->a_ops->is_partially_uptodate)
 				goto page_not_up_to_date;
@@ -1670,6 +1677,8 @@ no_cached_page:
 		goto readpage;
 	}
 
+would_block:
+	desc->error = -EAGAIN;
 out:
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
@@ -1853,7 +1862,8 @@ generic_file_read_iter(struct kiocb *iocb, struct iov_iter *iter, loff_t pos)
 	desc.arg.data = iter;
 	desc.count = count;
 	desc.error = 0;
-	do_generic_file_read(filp, ppos, &desc, file_read_iter_actor);
+	do_generic_file_read(filp, ppos, &desc, file_read_iter_actor,
+			     iocb->ki_flags & KIOCB_NOWAIT);
 
 	retval += desc.written;
 	if (desc.error && !retval)
@@ -1929,28 +1939,55 @@ static int page_cache_read(struct file *file, pgoff_t offset)
 
 #define MMAP_LOTSAMISS  (100)
 
+/*
+ * If the fault may be retried, drop mmap_sem before going to disk, so that
+ * other threads of the process are not stuck behind us on the semaphore
+ * while the I/O is in flight (mmap/munmap in one thread otherwise stalls
+ * every fault in all others). The file is pinned, since the vma may go
+ * away as soon as mmap_sem is released.
+ */
+static struct file *maybe_unlock_mmap_for_io(struct vm_area_struct *vma,
+					     unsigned int flags)
+{
+	struct file *file;
+
+	if ((flags & (FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_RETRY_NOWAIT)) !=
+	    FAULT_FLAG_ALLOW_RETRY)
+		return NULL;
+
+	file = get_file(vma->vm_file);
+	up_read(&vma->vm_mm->mmap_sem);
+	return file;
+}
+
 /*
  * Synchronous readahead happens when we don't even find
  * a page in the page cache at all.
+ *
+ * Returns the pinned file if mmap_sem was dropped for the I/O, the caller
+ * must then release it and have the fault retried.
  */
-static void do_sync_mmap_readahead(struct vm_area_struct *vma,
-				   struct file_ra_state *ra,
-				   struct file *file,
-				   pgoff_t offset)
+static struct file *do_sync_mmap_readahead(struct vm_area_struct *vma,
+					   struct file_ra_state *ra,
+					   struct file *file,
+					   pgoff_t offset,
+					   unsigned int flags)
 {
 	unsigned long ra_pages;
 	struct address_space *mapping = file->f_mapping;
+	struct file *fpin;
 
 	/* If we don't want any read-ahead, don't bother */
 	if (VM_RandomReadHint(vma))
-		return;
+		return NULL;
 	if (!ra->ra_pages)
-		return;
+		return NULL;
 
 	if (VM_SequentialReadHint(vma)) {
+		fpin = maybe_unlock_mmap_for_io(vma, flags);
 		page_cache_sync_readahead(mapping, ra, file, offset,
 					  ra->ra_pages);
-		return;
+		return fpin;
 	}
 
 	/* Avoid banging the cache line if not needed */
@@ -1962,16 +1999,18 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 	 * stop bothering with read-ahead. It will only hurt.
 	 */
 	if (ra->mmap_miss > MMAP_LOTSAMISS)
-		return;
+		return NULL;
 
 	/*
 	 * mmap read-around
 	 */
+	fpin = maybe_unlock_mmap_for_io(vma, flags);
 	ra_pages = max_sane_readahead(ra->ra_pages);
 	ra->start = max_t(long, 0, offset - ra_pages / 2);
 	ra->size = ra_pages;
 	ra->async_size = ra_pages / 4;
 	ra_submit(ra, mapping, file);
+	return fpin;
 }
 
 /*
@@ -2017,6 +2056,7 @@ int filemap_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	struct inode *inode = mapping->host;
 	pgoff_t offset = vmf->pgoff;
 	struct page *page;
+	struct file *fpin;
 	pgoff_t size;
 	int ret = 0;
 
@@ -2048,10 +2088,16 @@ int filemap_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 
 	} else if (!page) {
 		/* No page in the page cache at all */
-		do_sync_mmap_readahead(vma, ra, file, offset);
 		count_vm_event(PGMAJFAULT);
 		mem_cgroup_count_vm_event(vma->vm_mm, PGMAJFAULT);
 		ret = VM_FAULT_MAJOR;
+		fpin = do_sync_mmap_readahead(vma, ra, file, offset,
+					      vmf->flags);
+		if (fpin) {
+			/* mmap_sem is gone, the retry finds the page */
+			fput(fpin);
+			return ret | VM_FAULT_RETRY;
+		}
 retry_find:
 		page = find_get_page(mapping, offset);
 		if (!page)
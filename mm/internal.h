@@ -134,6 +134,7 @@ struct compact_control {
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
 	bool contended;			/* True if a lock was contended */
+	bool proactive;			/* Background compaction by kcompactd */
 };
 
 unsigned long
@@ -23,7 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/crc32c.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -37,6 +37,7 @@
 #include <linux/freezer.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/ve.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -829,7 +830,7 @@ static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = crc32c(17, addr, PAGE_SIZE);
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -1736,6 +1737,49 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+static bool ksm_flags_mergeable(unsigned long vm_flags)
+{
+	/*
+	 * Be somewhat over-protective for now!
+	 */
+	if (vm_flags & (VM_MERGEABLE | VM_SHARED  | VM_MAYSHARE   |
+			VM_PFNMAP    | VM_IO      | VM_DONTEXPAND |
+			VM_HUGETLB | VM_NONLINEAR | VM_MIXEDMAP))
+		return false;
+
+#ifdef VM_SAO
+	if (vm_flags & VM_SAO)
+		return false;
+#endif
+	return true;
+}
+
+static inline bool ve_ksm_enabled(void)
+{
+#ifdef CONFIG_VE
+	return get_exec_env()->ksm;
+#else
+	return false;
+#endif
+}
+
+/*
+ * A container can opt in to KSM as a whole through its ve cgroup:
+ * then new private mappings of its tasks are made mergeable as if
+ * they were madvised MADV_MERGEABLE.  Called under mmap_sem for write
+ * with the flags of a mapping being created.
+ */
+unsigned long ksm_mmap_flags(struct mm_struct *mm, unsigned long vm_flags)
+{
+	if (!ve_ksm_enabled() || !ksm_flags_mergeable(vm_flags))
+		return vm_flags;
+
+	if (!test_bit(MMF_VM_MERGEABLE, &mm->flags) && __ksm_enter(mm))
+		return vm_flags;
+
+	return vm_flags | VM_MERGEABLE;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1744,19 +1788,9 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 
 	switch (advice) {
 	case MADV_MERGEABLE:
-		/*
-		 * Be somewhat over-protective for now!
-		 */
-		if (*vm_flags & (VM_MERGEABLE | VM_SHARED  | VM_MAYSHARE   |
-				 VM_PFNMAP    | VM_IO      | VM_DONTEXPAND |
-				 VM_HUGETLB | VM_NONLINEAR | VM_MIXEDMAP))
+		if (!ksm_flags_mergeable(*vm_flags))
 			return 0;		/* just ignore the advice */
 
-#ifdef VM_SAO
-		if (*vm_flags & VM_SAO)
-			return 0;
-#endif
-
 		if (!test_bit(MMF_VM_MERGEABLE, &mm->flags)) {
 			err = __ksm_enter(mm);
 			if (err)
@@ -42,6 +42,7 @@
 #include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/swap.h>
+#include <linux/migrate.h>
 #include <linux/swapops.h>
 #include <linux/spinlock.h>
 #include <linux/eventfd.h>
@@ -53,6 +54,9 @@
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/ve.h>
+#include <linux/ve_lat.h>
+#include <linux/ve_stats.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -269,6 +273,15 @@ struct mem_cgroup {
 	unsigned long long low;
 	unsigned long long high;
 
+	/* Background reclaim above this percentage of the limit, 0 - off */
+	unsigned int bg_reclaim_ratio;
+	struct work_struct bg_reclaim_work;
+
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+	/* Pages found idle by the last idle_page_stats scan: anon, file */
+	unsigned long idle_pages[2];
+#endif
+
 	/* vmpressure notifications */
 	struct vmpressure vmpressure;
 
@@ -405,6 +418,28 @@ static bool memcg_kmem_test_and_clear_dead(struct mem_cgroup *memcg)
 	return test_and_clear_bit(KMEM_ACCOUNTED_DEAD,
 				  &memcg->kmem_account_flags);
 }
+
+static void __memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
+{
+	/* Not down to 0 */
+	if (res_counter_uncharge(&memcg->kmem, size))
+		return;
+
+	/*
+	 * Releases a reference taken in memcg_deactivate_kmem in case
+	 * this last uncharge is racing with the offlining code or it is
+	 * outliving the memcg existence.
+	 *
+	 * The memory barrier imposed by test&clear is paired with the
+	 * explicit one in memcg_kmem_mark_dead().
+	 */
+	if (memcg_kmem_test_and_clear_dead(memcg))
+		css_put(&memcg->css);
+}
+#else
+static inline void __memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
+{
+}
 #endif
 
 /* Stuffs for move charges at task migration. */
@@ -564,6 +599,118 @@ void sock_release_memcg(struct sock *sk)
 	}
 }
 
+/*
+ * Socket memory is charged to the protocol counter and to the memcg page
+ * by page as sk_forward_alloc runs dry, and given back as it is
+ * reclaimed, so a busy container takes the res_counter locks of its whole
+ * hierarchy a few times per packet.  Each cg_proto keeps a small per-cpu
+ * stock of pages charged in advance to absorb that.  The stock is only
+ * used while kmem accounting of the memcg is active, and is given back at
+ * offline by memcg_drain_sock_stocks().
+ *
+ * The stock is touched with interrupts disabled: sockets are charged from
+ * softirq as well as from process context.
+ */
+#define SOCK_CHARGE_BATCH	32U
+
+void memcg_charge_sock(struct cg_proto *prot, unsigned long nr_pages,
+		       int *parent_status)
+{
+	struct mem_cgroup *memcg = prot->memcg;
+	struct res_counter *fail;
+	unsigned long flags;
+
+	if (prot->stock && nr_pages <= SOCK_CHARGE_BATCH) {
+		unsigned int *stock;
+		u64 batch;
+
+		local_irq_save(flags);
+		if (!memcg_kmem_is_active(memcg))
+			goto nostock;
+
+		stock = this_cpu_ptr(prot->stock);
+		if (*stock >= nr_pages) {
+			*stock -= nr_pages;
+			local_irq_restore(flags);
+			return;
+		}
+
+		batch = (u64)(nr_pages + SOCK_CHARGE_BATCH) << PAGE_SHIFT;
+		if (!res_counter_charge(prot->memory_allocated, batch, &fail)) {
+			memcg_charge_kmem_nofail(memcg, batch);
+			*stock += SOCK_CHARGE_BATCH;
+			local_irq_restore(flags);
+			return;
+		}
+nostock:
+		local_irq_restore(flags);
+	}
+
+	memcg_charge_kmem_nofail(memcg, nr_pages << PAGE_SHIFT);
+	if (res_counter_charge_nofail(prot->memory_allocated,
+				      nr_pages << PAGE_SHIFT, &fail) < 0)
+		*parent_status = OVER_LIMIT;
+}
+
+void memcg_uncharge_sock(struct cg_proto *prot, unsigned long nr_pages)
+{
+	unsigned long flags;
+
+	if (prot->stock) {
+		unsigned int *stock;
+
+		local_irq_save(flags);
+		if (memcg_kmem_is_active(prot->memcg)) {
+			stock = this_cpu_ptr(prot->stock);
+			*stock += nr_pages;
+			if (*stock <= 2 * SOCK_CHARGE_BATCH) {
+				local_irq_restore(flags);
+				return;
+			}
+			nr_pages = *stock - SOCK_CHARGE_BATCH;
+			*stock = SOCK_CHARGE_BATCH;
+		}
+		local_irq_restore(flags);
+	}
+
+	res_counter_uncharge(prot->memory_allocated, nr_pages << PAGE_SHIFT);
+	memcg_uncharge_kmem(prot->memcg, nr_pages << PAGE_SHIFT);
+}
+
+static void __memcg_drain_sock_stock(struct cg_proto *prot)
+{
+	unsigned long nr_pages = 0;
+	int cpu;
+
+	if (!prot->stock)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		unsigned int *stock = per_cpu_ptr(prot->stock, cpu);
+
+		nr_pages += *stock;
+		*stock = 0;
+	}
+
+	if (nr_pages) {
+		res_counter_uncharge(prot->memory_allocated,
+				     nr_pages << PAGE_SHIFT);
+		memcg_uncharge_kmem(prot->memcg, nr_pages << PAGE_SHIFT);
+	}
+}
+
+/*
+ * Called once kmem accounting of @memcg is switched off.  Stock updates
+ * run with interrupts disabled after checking that flag, so once a sched
+ * grace period has elapsed nobody can refill the stocks any more.
+ */
+static void memcg_drain_sock_stocks(struct mem_cgroup *memcg)
+{
+	synchronize_sched();
+	__memcg_drain_sock_stock(&memcg->tcp_mem.cg_proto);
+	__memcg_drain_sock_stock(&memcg->udp_mem.cg_proto);
+}
+
 struct cg_proto *tcp_proto_cgroup(struct mem_cgroup *memcg)
 {
 	if (!memcg || mem_cgroup_is_root(memcg))
@@ -593,6 +740,10 @@ static void disarm_sock_keys(struct mem_cgroup *memcg)
 static void disarm_sock_keys(struct mem_cgroup *memcg)
 {
 }
+
+static void memcg_drain_sock_stocks(struct mem_cgroup *memcg)
+{
+}
 #endif
 
 #ifdef CONFIG_MEMCG_KMEM
@@ -1946,6 +2097,27 @@ static u64 mem_cgroup_get_limit(struct mem_cgroup *memcg)
 	return limit;
 }
 
+/*
+ * All threads of a process share the mm and so the badness.  If the
+ * group leader is still alive in the same memcg, it is scored for the
+ * whole thread group and the other threads needn't be.  The scan checks
+ * (TIF_MEMDIE, exiting) are still done for each of them.
+ */
+static bool oom_thread_covered(struct task_struct *task,
+			       struct mem_cgroup *memcg)
+{
+	struct task_struct *leader = task->group_leader;
+	bool ret;
+
+	if (leader == task || !leader->mm || leader->exit_state)
+		return false;
+
+	rcu_read_lock();
+	ret = mem_cgroup_from_task(leader) == memcg;
+	rcu_read_unlock();
+	return ret;
+}
+
 static void mem_cgroup_out_of_memory(struct mem_cgroup *memcg, gfp_t gfp_mask,
 				     int order)
 {
@@ -2000,6 +2172,8 @@ retry:
 			case OOM_SCAN_OK:
 				break;
 			};
+			if (oom_thread_covered(task, iter))
+				continue;
 			points = oom_badness(task, memcg, NULL, totalpages);
 			if (points > chosen_points) {
 				if (chosen)
@@ -2508,12 +2682,14 @@ void mem_cgroup_update_page_stat(struct page *page,
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * Big containers charge in larger batches, see memcg_charge_batch().
  */
-#define CHARGE_BATCH	32U
+#define CHARGE_BATCH		32U
+#define CHARGE_BATCH_MAX	512U
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+	unsigned int nr_kmem_pages; /* precharged to ->kmem only */
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2521,6 +2697,89 @@ struct memcg_stock_pcp {
 static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
+/*
+ * Every charge that misses the per-cpu stock walks the res_counter
+ * hierarchy taking each level's lock, so with a fixed small batch big
+ * containers hit those locks every few pages from all cpus.  Scale the
+ * batch with the smallest limit up the hierarchy instead, such that the
+ * stocks of all cpus together can hold no more than 1/64 of it.
+ */
+static unsigned int memcg_charge_batch(struct mem_cgroup *memcg)
+{
+	unsigned long long limit = RESOURCE_MAX;
+	unsigned long long batch;
+
+	for (; memcg; memcg = parent_mem_cgroup(memcg)) {
+		limit = min(limit, res_counter_read_u64(&memcg->res, RES_LIMIT));
+		if (do_swap_account)
+			limit = min(limit, res_counter_read_u64(&memcg->memsw,
+								RES_LIMIT));
+	}
+
+	batch = (limit >> PAGE_SHIFT) / (64 * num_online_cpus());
+	return clamp_t(unsigned long long, batch, CHARGE_BATCH,
+		       CHARGE_BATCH_MAX);
+}
+
+/*
+ * Background reclaim: once usage gets over bg_reclaim_ratio percent of
+ * the limit, a worker reclaims the memcg back below that, so that the
+ * charging tasks rarely have to reclaim at the limit themselves.
+ */
+static struct workqueue_struct *memcg_bg_reclaim_wq;
+
+static unsigned long long mem_cgroup_bg_wmark(struct mem_cgroup *memcg)
+{
+	unsigned int ratio = ACCESS_ONCE(memcg->bg_reclaim_ratio);
+	unsigned long long limit;
+
+	if (!ratio)
+		return RESOURCE_MAX;
+
+	limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
+	if (limit == RESOURCE_MAX)
+		return RESOURCE_MAX;
+
+	return div_u64(limit, 100) * ratio;
+}
+
+static void mem_cgroup_bg_reclaim_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg = container_of(work, struct mem_cgroup,
+						bg_reclaim_work);
+	unsigned long long wmark = mem_cgroup_bg_wmark(memcg);
+	unsigned long long slack = (u64)CHARGE_BATCH_MAX << PAGE_SHIFT;
+	int retries = MEM_CGROUP_RECLAIM_RETRIES;
+
+	/* Get somewhat below the watermark not to bounce around it */
+	wmark -= min(wmark, slack);
+
+	while (res_counter_read_u64(&memcg->res, RES_USAGE) > wmark) {
+		if (!try_to_free_mem_cgroup_pages(memcg, SWAP_CLUSTER_MAX,
+						  GFP_KERNEL, false) &&
+		    !--retries)
+			break;
+		cond_resched();
+	}
+
+	css_put(&memcg->css);
+}
+
+static void mem_cgroup_bg_reclaim_check(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup *iter;
+
+	for (iter = memcg; iter; iter = parent_mem_cgroup(iter)) {
+		if (res_counter_read_u64(&iter->res, RES_USAGE) <=
+		    mem_cgroup_bg_wmark(iter))
+			continue;
+		/* The work holds a reference until it has run */
+		css_get(&iter->css);
+		if (!queue_work(memcg_bg_reclaim_wq, &iter->bg_reclaim_work))
+			css_put(&iter->css);
+	}
+}
+
 /**
  * consume_stock: Try to consume stocked charge on this cpu.
  * @memcg: memcg to consume from.
@@ -2537,7 +2796,7 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	struct memcg_stock_pcp *stock;
 	bool ret = true;
 
-	if (nr_pages > CHARGE_BATCH)
+	if (nr_pages > CHARGE_BATCH_MAX)
 		return false;
 
 	stock = &get_cpu_var(memcg_stock);
@@ -2564,6 +2823,10 @@ static void drain_stock(struct memcg_stock_pcp *stock)
 			res_counter_uncharge(&old->memsw, bytes);
 		stock->nr_pages = 0;
 	}
+	if (stock->nr_kmem_pages) {
+		__memcg_uncharge_kmem(old, stock->nr_kmem_pages * PAGE_SIZE);
+		stock->nr_kmem_pages = 0;
+	}
 	stock->cached = NULL;
 }
 
@@ -2605,6 +2868,39 @@ static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * The kmem counter is stocked the same way, on top of the same cached
+ * memcg: a slab page charge would otherwise take the kmem res_counter
+ * locks all the way up the hierarchy every time.
+ */
+static bool consume_kmem_stock(struct mem_cgroup *memcg,
+			       unsigned int nr_pages)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (memcg == stock->cached && stock->nr_kmem_pages >= nr_pages) {
+		stock->nr_kmem_pages -= nr_pages;
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
+static void refill_kmem_stock(struct mem_cgroup *memcg,
+			      unsigned int nr_pages)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+
+	if (stock->cached != memcg) { /* reset if necessary */
+		drain_stock(stock);
+		stock->cached = memcg;
+	}
+	stock->nr_kmem_pages += nr_pages;
+	put_cpu_var(memcg_stock);
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it. sync flag says whether we should block
@@ -2622,7 +2918,7 @@ static void drain_all_stock(struct mem_cgroup *root_memcg, bool sync)
 		struct mem_cgroup *memcg;
 
 		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages)
+		if (!memcg || (!stock->nr_pages && !stock->nr_kmem_pages))
 			continue;
 		if (!mem_cgroup_same_or_subtree(root_memcg, memcg))
 			continue;
@@ -2737,16 +3033,20 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	struct mem_cgroup *mem_over_limit;
 	struct res_counter *fail_res;
 	unsigned long flags = 0;
+	u64 lat_start;
 	int ret;
 
 	ret = res_counter_charge(&memcg->res, csize, &fail_res);
 
 	if (likely(!ret)) {
-		if (!do_swap_account)
-			return CHARGE_OK;
-		ret = res_counter_charge(&memcg->memsw, csize, &fail_res);
-		if (likely(!ret))
+		if (do_swap_account)
+			ret = res_counter_charge(&memcg->memsw, csize,
+						 &fail_res);
+		if (likely(!ret)) {
+			ve_stat_add(get_exec_env(), VE_STAT_MEM_CHARGED,
+				    nr_pages);
 			return CHARGE_OK;
+		}
 
 		res_counter_uncharge(&memcg->res, csize);
 		mem_over_limit = mem_cgroup_from_res_counter(fail_res, memsw);
@@ -2765,7 +3065,9 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		return CHARGE_WOULDBLOCK;
 	}
 
+	lat_start = ve_lat_start();
 	ret = mem_cgroup_reclaim(mem_over_limit, gfp_mask, flags);
+	ve_lat_end(get_exec_env(), VE_LAT_MEMCG_RECLAIM, lat_start);
 	if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
 		return CHARGE_RETRY;
 	/*
@@ -2830,7 +3132,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 				   struct mem_cgroup **ptr,
 				   bool oom)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch = 0;
 	int nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *memcg = NULL, *iter;
 	int ret;
@@ -2902,6 +3204,9 @@ again:
 		rcu_read_unlock();
 	}
 
+	if (!batch)
+		batch = max(memcg_charge_batch(memcg), nr_pages);
+
 	do {
 		bool oom_check;
 
@@ -2947,6 +3252,8 @@ again:
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
 
+	mem_cgroup_bg_reclaim_check(memcg);
+
 	/*
 	 * If the hierarchy is above the normal consumption range,
 	 * make the charging task trim their excess contribution.
@@ -3026,6 +3333,42 @@ static struct mem_cgroup *mem_cgroup_lookup(unsigned short id)
 	return mem_cgroup_from_css(css);
 }
 
+/*
+ * Workingset detection keeps its eviction clock per lruvec and refers
+ * to the memcg of an evicted page by its css id in the shadow entry.
+ * Both helpers must be called under rcu_read_lock().
+ */
+unsigned short mem_cgroup_page_id(struct page *page)
+{
+	struct mem_cgroup *memcg;
+	struct page_cgroup *pc;
+
+	if (mem_cgroup_disabled())
+		return 0;
+
+	pc = lookup_page_cgroup(page);
+	memcg = ACCESS_ONCE(pc->mem_cgroup);
+	if (!PageCgroupUsed(pc) || !memcg)
+		memcg = root_mem_cgroup;
+	return css_id(&memcg->css);
+}
+
+/*
+ * Returns NULL if the memcg @id referred to has been removed since.
+ */
+struct lruvec *mem_cgroup_id_lruvec(unsigned short id, struct zone *zone)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return &zone->lruvec;
+
+	memcg = mem_cgroup_lookup(id);
+	if (!memcg)
+		return NULL;
+	return mem_cgroup_zone_lruvec(zone, memcg);
+}
+
 struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
 {
 	struct mem_cgroup *memcg = NULL;
@@ -3172,13 +3515,43 @@ int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp, u64 size)
 {
 	struct res_counter *fail_res;
 	struct mem_cgroup *_memcg;
+	int retries = MEM_CGROUP_RECLAIM_RETRIES;
+	unsigned int nr_pages = size >> PAGE_SHIFT;
+	u64 batch = size;
 	int ret = 0;
 	bool may_oom;
 
-	ret = res_counter_charge(&memcg->kmem, size, &fail_res);
-	if (ret)
-		return ret;
+	/*
+	 * Only whole pages of an active cgroup are stocked: after offline
+	 * the stock must not hold new kmem charges back from reparenting.
+	 */
+	if (!(size & ~PAGE_MASK) && memcg_kmem_is_active(memcg)) {
+		if (consume_kmem_stock(memcg, nr_pages))
+			goto charge_res;
+		batch = max_t(u64, size, (u64)CHARGE_BATCH << PAGE_SHIFT);
+	}
 
+	/*
+	 * Over the kmem limit: shrink the slab caches of the cgroup that hit
+	 * it, not the global ones, so that other containers do not pay.
+	 */
+	while ((ret = res_counter_charge(&memcg->kmem, batch, &fail_res))) {
+		if (batch > size) {
+			batch = size;
+			continue;
+		}
+		if (!(gfp & __GFP_WAIT) || (gfp & __GFP_NORETRY) ||
+		    (current->flags & PF_MEMALLOC) || !retries--)
+			return ret;
+		if (!try_to_free_mem_cgroup_kmem(
+			mem_cgroup_from_res_counter(fail_res, kmem), gfp))
+			return ret;
+	}
+
+	if (batch > size)
+		refill_kmem_stock(memcg, (batch - size) >> PAGE_SHIFT);
+
+charge_res:
 	/*
 	 * Conditions under which we can wait for the oom_killer. Those are
 	 * the same conditions tested by the core page allocator
@@ -3232,20 +3605,7 @@ void memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
 	if (do_swap_account)
 		res_counter_uncharge(&memcg->memsw, size);
 
-	/* Not down to 0 */
-	if (res_counter_uncharge(&memcg->kmem, size))
-		return;
-
-	/*
-	 * Releases a reference taken in memcg_deactivate_kmem in case
-	 * this last uncharge is racing with the offlining code or it is
-	 * outliving the memcg existence.
-	 *
-	 * The memory barrier imposed by test&clear is paired with the
-	 * explicit one in memcg_kmem_mark_dead().
-	 */
-	if (memcg_kmem_test_and_clear_dead(memcg))
-		css_put(&memcg->css);
+	__memcg_uncharge_kmem(memcg, size);
 }
 
 int __memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, unsigned size)
@@ -3400,7 +3760,7 @@ static void __memcg_schedule_kmem_cache_create(struct mem_cgroup *memcg,
 	cw->cachep = cachep;
 	INIT_WORK(&cw->work, memcg_kmem_cache_create_func);
 
-	schedule_work(&cw->work);
+	ve_queue_work(get_exec_env(), &cw->work);
 }
 
 static void memcg_schedule_kmem_cache_create(struct mem_cgroup *memcg,
@@ -5565,8 +5925,223 @@ static int memcg_numa_stat_show(struct cgroup *cont, struct cftype *cft,
 	seq_putc(m, '\n');
 	return 0;
 }
+
+#define MEMCG_NUMA_MIGRATE_BATCH	SWAP_CLUSTER_MAX
+
+struct memcg_numa_migrate_struct {
+	nodemask_t *target_nodes;
+	int current_node;
+};
+
+/* spread the pages over the target nodes round-robin */
+static struct page *memcg_numa_migrate_new_page(struct page *page,
+				unsigned long private, int **result)
+{
+	struct memcg_numa_migrate_struct *ms = (void *)private;
+	int nid;
+
+	nid = next_node(ms->current_node, *ms->target_nodes);
+	if (nid == MAX_NUMNODES)
+		nid = first_node(*ms->target_nodes);
+	ms->current_node = nid;
+
+	return alloc_pages_exact_node(nid, GFP_HIGHUSER_MOVABLE |
+				      __GFP_THISNODE | __GFP_NOWARN, 0);
+}
+
+/*
+ * Migrate the pages of one lru list of @lruvec in batches, looking at
+ * each page once: pages which fail to migrate are put back at the head
+ * of the list, migrated ones go to the lruvecs of the target nodes.
+ */
+static int memcg_numa_migrate_lruvec(struct lruvec *lruvec, enum lru_list lru,
+				     struct memcg_numa_migrate_struct *ms)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct list_head *src = &lruvec->lists[lru];
+	unsigned long nr_to_scan = mem_cgroup_get_lru_size(lruvec, lru);
+	int file = is_file_lru(lru);
+
+	while (nr_to_scan) {
+		unsigned long nr_taken = 0, nr_batch = 0;
+		LIST_HEAD(pages);
+
+		if (fatal_signal_pending(current))
+			return -EINTR;
+
+		spin_lock_irq(&zone->lru_lock);
+		while (nr_to_scan && nr_batch < MEMCG_NUMA_MIGRATE_BATCH &&
+		       !list_empty(src)) {
+			struct page *page = list_entry(src->prev,
+						       struct page, lru);
+			int nr_pages = hpage_nr_pages(page);
+
+			nr_to_scan--;
+			if (__isolate_lru_page(page, 0)) {
+				list_move(&page->lru, src);
+				continue;
+			}
+			mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
+			list_move(&page->lru, &pages);
+			nr_taken += nr_pages;
+			nr_batch++;
+		}
+		__mod_zone_page_state(zone, NR_LRU_BASE + lru, -nr_taken);
+		__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
+		spin_unlock_irq(&zone->lru_lock);
+
+		if (!nr_batch)
+			break;
+
+		if (migrate_pages(&pages, memcg_numa_migrate_new_page,
+				  (unsigned long)ms, MIGRATE_SYNC_LIGHT,
+				  MR_SYSCALL))
+			putback_lru_pages(&pages);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int memcg_numa_migrate_node(struct mem_cgroup *memcg, int nid,
+				   struct memcg_numa_migrate_struct *ms)
+{
+	enum lru_list lru;
+	int zid, ret;
+
+	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
+		struct zone *zone = &NODE_DATA(nid)->node_zones[zid];
+		struct lruvec *lruvec;
+
+		if (!populated_zone(zone))
+			continue;
+		lruvec = mem_cgroup_zone_lruvec(zone, memcg);
+		for_each_evictable_lru(lru) {
+			ret = memcg_numa_migrate_lruvec(lruvec, lru, ms);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Writing a node list to memory.numa_migrate moves all pages of the cgroup
+ * and its subcgroups which reside on other nodes - anon, page cache and
+ * tmpfs ones - to the given nodes. Pages in use or without free memory on
+ * the target nodes are left where they are.
+ */
+static int memcg_numa_migrate_write(struct cgroup *cont, struct cftype *cft,
+				    const char *buf)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+	NODEMASK_ALLOC(nodemask_t, target_nodes, GFP_KERNEL);
+	struct memcg_numa_migrate_struct ms;
+	struct mem_cgroup *iter;
+	int nid, ret;
+
+	if (!target_nodes)
+		return -ENOMEM;
+
+	ret = nodelist_parse(buf, *target_nodes);
+	if (ret)
+		goto out;
+
+	nodes_and(*target_nodes, *target_nodes, node_states[N_MEMORY]);
+	ret = -EINVAL;
+	if (nodes_empty(*target_nodes))
+		goto out;
+
+	ms.target_nodes = target_nodes;
+	ms.current_node = -1;
+
+	ret = 0;
+	lru_add_drain_all();
+	for_each_mem_cgroup_tree(iter, memcg) {
+		for_each_node_state(nid, N_MEMORY) {
+			if (node_isset(nid, *target_nodes))
+				continue;
+			ret = memcg_numa_migrate_node(iter, nid, &ms);
+			if (ret) {
+				mem_cgroup_iter_break(memcg, iter);
+				goto out;
+			}
+		}
+	}
+out:
+	NODEMASK_FREE(target_nodes);
+	return ret;
+}
 #endif /* CONFIG_NUMA */
 
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+static bool page_in_mem_cgroup(struct page *page, struct mem_cgroup *memcg)
+{
+	struct page_cgroup *pc = lookup_page_cgroup(page);
+	bool ret = false;
+
+	lock_page_cgroup(pc);
+	if (PageCgroupUsed(pc))
+		ret = mem_cgroup_same_or_subtree(memcg, pc->mem_cgroup);
+	unlock_page_cgroup(pc);
+	return ret;
+}
+
+/*
+ * Count user pages of the cgroup subtree which stayed idle since the
+ * previous scan and mark all of them idle for the next one, the same way
+ * /proc/kpageidle does, but without reading and writing the bitmap of
+ * the whole memory from userspace. Pages of other cgroups are skipped
+ * before the rmap walk, so the cost is mostly in the cgroup's own pages.
+ */
+static int mem_cgroup_idle_page_scan(struct cgroup *cont, unsigned int event)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+	unsigned long idle[2] = { 0, 0 };
+	unsigned long pfn, end_pfn;
+	struct page *page;
+	int nid;
+
+	for_each_node_state(nid, N_MEMORY) {
+		end_pfn = node_end_pfn(nid);
+		for (pfn = node_start_pfn(nid); pfn < end_pfn; pfn++) {
+			if (!(pfn % 1024)) {
+				if (fatal_signal_pending(current))
+					return -EINTR;
+				cond_resched();
+			}
+
+			page = page_idle_get_page(pfn);
+			if (!page)
+				continue;
+			if (page_in_mem_cgroup(page, memcg)) {
+				page_idle_clear_pte_refs(page);
+				if (page_is_idle(page))
+					idle[page_is_file_cache(page)]++;
+				set_page_idle(page);
+			}
+			put_page(page);
+		}
+	}
+
+	memcg->idle_pages[0] = idle[0];
+	memcg->idle_pages[1] = idle[1];
+	return 0;
+}
+
+static int mem_cgroup_idle_page_stats_show(struct cgroup *cont,
+					   struct cftype *cft,
+					   struct seq_file *m)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+
+	seq_printf(m, "idle_anon %lu\n",
+		   memcg->idle_pages[0] << PAGE_SHIFT);
+	seq_printf(m, "idle_file %lu\n",
+		   memcg->idle_pages[1] << PAGE_SHIFT);
+	return 0;
+}
+#endif /* CONFIG_IDLE_PAGE_TRACKING */
+
 static inline void mem_cgroup_lru_names_not_uptodate(void)
 {
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
@@ -5682,6 +6257,22 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_bg_reclaim_read(struct cgroup *cgrp,
+				      struct cftype *cft)
+{
+	return mem_cgroup_from_cont(cgrp)->bg_reclaim_ratio;
+}
+
+static int mem_cgroup_bg_reclaim_write(struct cgroup *cgrp,
+				       struct cftype *cft, u64 val)
+{
+	if (val > 100)
+		return -EINVAL;
+
+	mem_cgroup_from_cont(cgrp)->bg_reclaim_ratio = val;
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -6050,6 +6641,7 @@ static void memcg_deactivate_kmem(struct mem_cgroup *memcg)
 	 */
 	clear_bit(KMEM_ACCOUNTED_ACTIVE, &memcg->kmem_account_flags);
 
+	memcg_drain_sock_stocks(memcg);
 	memcg_deactivate_kmem_caches(memcg);
 
 	kmemcg_id = memcg->kmemcg_id;
@@ -6160,6 +6752,12 @@ static struct cftype mem_cgroup_files[] = {
 		.write_string = mem_cgroup_high_write,
 		.read = mem_cgroup_high_read,
 	},
+	{
+		.name = "bg_reclaim_ratio",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_bg_reclaim_read,
+		.write_u64 = mem_cgroup_bg_reclaim_write,
+	},
 	{
 		.name = "failcnt",
 		.private = MEMFILE_PRIVATE(_MEM, RES_FAILCNT),
@@ -6214,6 +6812,18 @@ static struct cftype mem_cgroup_files[] = {
 		.name = "numa_stat",
 		.read_seq_string = memcg_numa_stat_show,
 	},
+	{
+		.name = "numa_migrate",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.write_string = memcg_numa_migrate_write,
+	},
+#endif
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+	{
+		.name = "idle_page_stats",
+		.trigger = mem_cgroup_idle_page_scan,
+		.read_seq_string = mem_cgroup_idle_page_stats_show,
+	},
 #endif
 #ifdef CONFIG_MEMCG_KMEM
 	{
@@ -6435,6 +7045,7 @@ mem_cgroup_css_alloc(struct cgroup *cont)
 	}
 
 	memcg->last_scanned_node = MAX_NUMNODES;
+	INIT_WORK(&memcg->bg_reclaim_work, mem_cgroup_bg_reclaim_func);
 	INIT_LIST_HEAD(&memcg->oom_notify);
 	memcg->move_charge_at_immigrate = 0;
 	mutex_init(&memcg->thresholds_lock);
@@ -7209,6 +7820,9 @@ static int __init mem_cgroup_init(void)
 	enable_swap_cgroup();
 	mem_cgroup_soft_limit_tree_init();
 	memcg_stock_init();
+	memcg_bg_reclaim_wq = alloc_workqueue("memcg_bg_reclaim",
+				WQ_UNBOUND | WQ_MEM_RECLAIM | WQ_FREEZABLE, 0);
+	BUG_ON(!memcg_bg_reclaim_wq);
 	return 0;
 }
 subsys_initcall(mem_cgroup_init);
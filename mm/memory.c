@@ -61,6 +61,7 @@
 #include <linux/migrate.h>
 #include <linux/string.h>
 #include <linux/ve.h>
+#include <linux/ve_lat.h>
 
 #include <bc/beancounter.h>
 #include <bc/io_acct.h>
@@ -184,6 +185,69 @@ static void check_sync_rss_stat(struct task_struct *task)
 
 #ifdef HAVE_GENERIC_MMU_GATHER
 
+/*
+ * When a whole address space is torn down, flushed batches of pages are
+ * freed by unbound workers of the local node, in parallel with zapping
+ * of the rest of it. tlb_finish_mmu() waits for them, so all the memory
+ * is still back by the time exit_mmap() returns.
+ */
+static struct workqueue_struct *tlb_free_wq;
+static DECLARE_WAIT_QUEUE_HEAD(tlb_free_waitq);
+
+/* don't let zapping run too far ahead of freeing */
+#define TLB_FREE_ASYNC_MAX	(4 * MAX_GATHER_BATCH_COUNT)
+
+static int __init tlb_free_wq_init(void)
+{
+	tlb_free_wq = alloc_workqueue("tlb_free",
+				      WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	return 0;
+}
+core_initcall(tlb_free_wq_init);
+
+static void tlb_free_batch_workfn(struct work_struct *work)
+{
+	struct mmu_gather_batch *batch = container_of(work,
+					struct mmu_gather_batch, free_work);
+	struct mmu_gather *tlb = batch->tlb;
+
+	free_pages_and_swap_cache(batch->pages, batch->nr);
+	free_pages((unsigned long)batch, 0);
+
+	if (atomic_dec_and_test(&tlb->nr_async))
+		wake_up(&tlb_free_waitq);
+}
+
+/*
+ * Hand the allocated batches over to workers, the on-stack one is
+ * freed synchronously. Returns false if they must be freed here.
+ */
+static bool tlb_free_batches_async(struct mmu_gather *tlb)
+{
+	struct mmu_gather_batch *batch, *next;
+
+	if (!tlb->fullmm || !tlb_free_wq ||
+	    atomic_read(&tlb->nr_async) >= TLB_FREE_ASYNC_MAX)
+		return false;
+
+	batch = tlb->local.next;
+	tlb->local.next = NULL;
+	tlb->batch_count = 0;
+
+	for (; batch; batch = next) {
+		next = batch->next;
+		if (!batch->nr) {
+			free_pages((unsigned long)batch, 0);
+			continue;
+		}
+		batch->tlb = tlb;
+		INIT_WORK(&batch->free_work, tlb_free_batch_workfn);
+		atomic_inc(&tlb->nr_async);
+		queue_work(tlb_free_wq, &batch->free_work);
+	}
+	return true;
+}
+
 static int tlb_next_batch(struct mmu_gather *tlb)
 {
 	struct mmu_gather_batch *batch;
@@ -232,6 +296,7 @@ void tlb_gather_mmu(struct mmu_gather *tlb, struct mm_struct *mm, unsigned long
 	tlb->local.max  = ARRAY_SIZE(tlb->__pages);
 	tlb->active     = &tlb->local;
 	tlb->batch_count = 0;
+	atomic_set(&tlb->nr_async, 0);
 
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
 	tlb->batch = NULL;
@@ -250,9 +315,14 @@ void tlb_flush_mmu(struct mmu_gather *tlb)
 	tlb_table_flush(tlb);
 #endif
 
-	for (batch = &tlb->local; batch; batch = batch->next) {
-		free_pages_and_swap_cache(batch->pages, batch->nr);
-		batch->nr = 0;
+	if (tlb_free_batches_async(tlb)) {
+		free_pages_and_swap_cache(tlb->local.pages, tlb->local.nr);
+		tlb->local.nr = 0;
+	} else {
+		for (batch = &tlb->local; batch; batch = batch->next) {
+			free_pages_and_swap_cache(batch->pages, batch->nr);
+			batch->nr = 0;
+		}
 	}
 	tlb->active = &tlb->local;
 }
@@ -267,6 +337,8 @@ void tlb_finish_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long e
 
 	tlb_flush_mmu(tlb);
 
+	wait_event(tlb_free_waitq, !atomic_read(&tlb->nr_async));
+
 	/* keep the page table cache within bounds */
 	check_pgt_cache();
 
@@ -3722,8 +3794,8 @@ unlock:
 /*
  * By the time we get here, we already hold the mm semaphore
  */
-int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, unsigned int flags)
+static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+			     unsigned long address, unsigned int flags)
 {
 	pgd_t *pgd;
 	pud_t *pud;
@@ -3810,6 +3882,17 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, unsigned int flags)
+{
+	u64 lat_start = ve_lat_start();
+	int ret;
+
+	ret = __handle_mm_fault(mm, vma, address, flags);
+	ve_lat_end(get_exec_env(), VE_LAT_FAULT, lat_start);
+	return ret;
+}
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -4466,6 +4549,9 @@ struct page *pick_peer_page(struct address_space *mapping, pgoff_t index,
 		page = NULL;
 	}
 out:
+	/* This page is not duplicated in the mapping's own page cache */
+	if (page)
+		ub_percpu_inc(get_exec_ub(), pfcache_peer_pages);
 	fput(file);
 	return page;
 }
@@ -2319,6 +2319,10 @@ int mpol_misplaced(struct page *page, struct vm_area_struct *vma, unsigned long
 	if (pol->flags & MPOL_F_MORON) {
 		polnid = thisnid;
 
+		/* but not out of the cpuset, e.g. fairsched node mask */
+		if (!node_isset(polnid, cpuset_current_mems_allowed))
+			goto out;
+
 		if (!should_numa_migrate_memory(current, page, curnid, thiscpu))
 			goto out;
 	}
@@ -32,6 +32,7 @@
 #include <linux/virtinfo.h>
 #include <linux/audit.h>
 #include <linux/khugepaged.h>
+#include <linux/ksm.h>
 #include <linux/uprobes.h>
 #include <linux/rbtree_augmented.h>
 #include <linux/sched/sysctl.h>
@@ -1541,6 +1542,8 @@ munmap_back:
 		goto charge_error;
 	ub_charged = 1;
 
+	vm_flags = ksm_mmap_flags(mm, vm_flags);
+
 	/*
 	 * Can we just expand an old mapping?
 	 */
@@ -2675,6 +2678,7 @@ static unsigned long do_brk(unsigned long addr, unsigned long len, int soft)
 		return addr;
 
 	flags = VM_DATA_DEFAULT_FLAGS | VM_ACCOUNT | mm->def_flags;
+	flags = ksm_mmap_flags(mm, flags);
 
 	error = get_unmapped_area(NULL, addr, len, 0, MAP_FIXED);
 	if (error & ~PAGE_MASK)
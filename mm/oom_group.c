@@ -5,22 +5,55 @@
 #include <linux/ctype.h>
 #include <linux/oom.h>
 #include <linux/ve.h>
+#include <linux/hashtable.h>
+#include <linux/dcache.h>
 
 #include <bc/beancounter.h>
 
+/*
+ * Patterns are kept on a list in the order they were written, which is
+ * the order they are matched in: the first matching one wins.  For the
+ * lookup, patterns with an exact comm are also hashed by it, and the
+ * ones whose comm has an asterisk are on a separate chain, so a task
+ * is checked only against these two chains.  The sequence number tells
+ * which of the matching patterns comes first.
+ */
+#define OOM_GROUP_HASH_BITS	8
+
 static LIST_HEAD(oom_group_list_head);
+static DEFINE_HASHTABLE(oom_group_hash, OOM_GROUP_HASH_BITS);
+static HLIST_HEAD(oom_group_wild);
+static unsigned long oom_group_seq;
 static DEFINE_RWLOCK(oom_group_lock);
 
 struct oom_group_pattern {
 	char comm[TASK_COMM_LEN], pcomm[TASK_COMM_LEN];
 	int oom_uid;
 	int oom_score_adj;
+	unsigned long seq;
 	struct list_head group_list;
+	struct hlist_node hash_node;
 };
 
+static unsigned int oom_comm_hash(const char *comm)
+{
+	return full_name_hash((const unsigned char *)comm,
+			      strnlen(comm, TASK_COMM_LEN));
+}
+
 static void oom_groups_append(struct list_head *list)
 {
+	struct oom_group_pattern *gp;
+
 	write_lock_irq(&oom_group_lock);
+	list_for_each_entry(gp, list, group_list) {
+		gp->seq = oom_group_seq++;
+		if (strchr(gp->comm, '*'))
+			hlist_add_head(&gp->hash_node, &oom_group_wild);
+		else
+			hash_add(oom_group_hash, &gp->hash_node,
+				 oom_comm_hash(gp->comm));
+	}
 	list_splice_tail(list, &oom_group_list_head);
 	write_unlock_irq(&oom_group_lock);
 }
@@ -32,6 +65,8 @@ static void oom_groups_reset(void)
 
 	write_lock_irq(&oom_group_lock);
 	list_replace_init(&oom_group_list_head, &list);
+	hash_init(oom_group_hash);
+	INIT_HLIST_HEAD(&oom_group_wild);
 	write_unlock_irq(&oom_group_lock);
 
 	list_for_each_entry_safe(gp, tmp, &list, group_list)
@@ -52,9 +87,39 @@ static bool oom_match_comm(const char *comm, const char *mask)
 	return (!*mask && !*comm) || (*mask == '*');
 }
 
+static bool oom_match_pattern(struct oom_group_pattern *gp,
+			      struct task_struct *t, uid_t task_uid)
+{
+	if (gp->oom_uid >= 0 && task_uid != gp->oom_uid)
+		return false;
+	if (gp->oom_uid < -1 && task_uid >= -gp->oom_uid)
+		return false;
+	if (!oom_match_comm(t->comm, gp->comm))
+		return false;
+	if (!oom_match_comm(t->parent->comm, gp->pcomm))
+		return false;
+	return true;
+}
+
+static struct oom_group_pattern *
+oom_match_chain(struct hlist_head *head, struct task_struct *t,
+		uid_t task_uid, struct oom_group_pattern *best)
+{
+	struct oom_group_pattern *gp;
+
+	hlist_for_each_entry(gp, head, hash_node) {
+		if (best && gp->seq > best->seq)
+			continue;
+		if (oom_match_pattern(gp, t, task_uid))
+			best = gp;
+	}
+	return best;
+}
+
 int get_task_oom_score_adj(struct task_struct *t)
 {
 	struct oom_group_pattern *gp;
+	struct hlist_head *head;
 	unsigned long flags;
 	const struct cred *cred;
 	uid_t task_uid;
@@ -70,18 +135,12 @@ int get_task_oom_score_adj(struct task_struct *t)
 	rcu_read_unlock();
 
 	read_lock_irqsave(&oom_group_lock, flags);
-	list_for_each_entry(gp, &oom_group_list_head, group_list) {
-		if (gp->oom_uid >= 0 && task_uid != gp->oom_uid)
-			continue;
-		if (gp->oom_uid < -1 && task_uid >= -gp->oom_uid)
-			continue;
-		if (!oom_match_comm(t->comm, gp->comm))
-			continue;
-		if (!oom_match_comm(t->parent->comm, gp->pcomm))
-			continue;
+	head = &oom_group_hash[hash_min(oom_comm_hash(t->comm),
+					OOM_GROUP_HASH_BITS)];
+	gp = oom_match_chain(head, t, task_uid, NULL);
+	gp = oom_match_chain(&oom_group_wild, t, task_uid, gp);
+	if (gp)
 		adj = gp->oom_score_adj;
-		break;
-	}
 	read_unlock_irqrestore(&oom_group_lock, flags);
 	return adj;
 }
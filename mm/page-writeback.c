@@ -1391,6 +1391,36 @@ static inline void bdi_dirty_limits(struct backing_dev_info *bdi,
 	}
 }
 
+/*
+ * Per beancounter dirty throttling. Dirty and writeback pages of a
+ * beancounter are kept around the setpoint of its own dirty limits with
+ * the same control line as the global ones, see pos_ratio_polynom(), and
+ * its tasks are paced by the beancounter write bandwidth. Thus containers
+ * writing to slow devices are throttled harder than those writing to fast
+ * ones. Returns ULONG_MAX while under the beancounter freerun ceiling.
+ */
+static unsigned long ub_task_ratelimit(struct user_beancounter *ub,
+				       unsigned long start_time)
+{
+	unsigned long bg_thresh, freerun, setpoint, dirty;
+	long long pos_ratio;
+	long thresh;
+
+	if (!ub_dirty_limits(&bg_thresh, &thresh, ub))
+		return ULONG_MAX;
+
+	freerun = dirty_freerun_ceiling(thresh, bg_thresh);
+	dirty = ub_dirty_pages(ub, freerun);
+	if (dirty <= freerun)
+		return ULONG_MAX;
+
+	setpoint = (freerun + thresh) / 2;
+	pos_ratio = pos_ratio_polynom(setpoint, dirty, thresh);
+
+	return (u64)ub_write_bandwidth(ub, start_time) * pos_ratio >>
+							RATELIMIT_CALC_SHIFT;
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -1413,8 +1443,10 @@ static void balance_dirty_pages(struct address_space *mapping,
 	bool dirty_exceeded = false;
 	unsigned long task_ratelimit;
 	unsigned long dirty_ratelimit;
+	unsigned long ub_ratelimit;
 	unsigned long pos_ratio;
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	struct user_beancounter *ub = get_io_ub();
 	bool strictlimit = bdi->capabilities & BDI_CAP_STRICTLIMIT;
 	unsigned long start_time = jiffies;
 
@@ -1459,8 +1491,13 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * In strictlimit case make decision based on the bdi counters
 		 * and limits. Small writeouts when the bdi limits are ramping
 		 * up are the price we consciously pay for strictlimit-ing.
+		 *
+		 * A beancounter over its own dirty limits is throttled even
+		 * if the global state is fine.
 		 */
-		if (dirty <= dirty_freerun_ceiling(thresh, bg_thresh)) {
+		ub_ratelimit = ub_task_ratelimit(ub, start_time);
+		if (dirty <= dirty_freerun_ceiling(thresh, bg_thresh) &&
+		    ub_ratelimit == ULONG_MAX) {
 			current->dirty_paused_when = now;
 			current->nr_dirtied = 0;
 			current->nr_dirtied_pause =
@@ -1490,6 +1527,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 					       bdi_thresh, bdi_dirty);
 		task_ratelimit = ((u64)dirty_ratelimit * pos_ratio) >>
 							RATELIMIT_CALC_SHIFT;
+		task_ratelimit = min(task_ratelimit, ub_ratelimit);
 		max_pause = bdi_max_pause(bdi, bdi_dirty);
 		min_pause = bdi_min_pause(bdi, max_pause,
 					  task_ratelimit, dirty_ratelimit,
@@ -658,16 +658,17 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
 	int to_free = count;
 
 	spin_lock(&zone->lock);
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	while (to_free > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -678,15 +679,16 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == NR_PCP_LISTS)
 			batch_free = to_free;
 
+		order = pindex / MIGRATE_PCPTYPES;
 		do {
 			int mt;	/* migratetype of the to-be-freed page */
 
@@ -695,15 +697,19 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			list_del(&page->lru);
 			mt = get_freepage_migratetype(page);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, mt);
-			trace_mm_page_pcpu_drain(page, 0, mt);
+			__free_one_page(page, zone, order, mt);
+			trace_mm_page_pcpu_drain(page, order, mt);
 			if (likely(!is_migrate_isolate_page(page))) {
-				__mod_zone_page_state(zone, NR_FREE_PAGES, 1);
+				__mod_zone_page_state(zone, NR_FREE_PAGES,
+						      1 << order);
 				if (is_migrate_cma(mt))
-					__mod_zone_page_state(zone, NR_FREE_CMA_PAGES, 1);
+					__mod_zone_page_state(zone,
+						NR_FREE_CMA_PAGES, 1 << order);
 			}
-		} while (--to_free && --batch_free && !list_empty(list));
+			to_free -= 1 << order;
+		} while (to_free > 0 && --batch_free && !list_empty(list));
 	}
+	pcp->count -= count - to_free;
 	spin_unlock(&zone->lock);
 }
 
@@ -1219,10 +1225,8 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->batch;
 	else
 		to_drain = pcp->count;
-	if (to_drain > 0) {
+	if (to_drain > 0)
 		free_pcppages_bulk(zone, to_drain, pcp);
-		pcp->count -= to_drain;
-	}
 	local_irq_restore(flags);
 }
 #endif
@@ -1247,10 +1251,8 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		if (pcp->count) {
+		if (pcp->count)
 			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
-		}
 		local_irq_restore(flags);
 	}
 }
@@ -1344,23 +1346,27 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of order up to PCP_MAX_ORDER to the pcp lists
  * cold == true ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, bool cold)
+static void free_pcp_page(struct page *page, unsigned int order, bool cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
 	int migratetype;
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
+		return;
+
+	/* the pcp lists keep plain blocks, prep_new_page() makes them anew */
+	if (order && PageCompound(page) && destroy_compound_page(page, order))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
 	set_freepage_migratetype(page, migratetype);
 	local_irq_save(flags);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1371,7 +1377,7 @@ void free_hot_cold_page(struct page *page, bool cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(is_migrate_isolate(migratetype))) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
@@ -1379,19 +1385,28 @@ void free_hot_cold_page(struct page *page, bool cold)
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
 	if (!cold)
-		list_add(&page->lru, &pcp->lists[migratetype]);
+		list_add(&page->lru,
+			 &pcp->lists[pcp_list_index(order, migratetype)]);
 	else
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
+		list_add_tail(&page->lru,
+			      &pcp->lists[pcp_list_index(order, migratetype)]);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
 		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == true ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, bool cold)
+{
+	free_pcp_page(page, 0, cold);
+}
+
 /*
  * Free a list of 0-order pages
  */
@@ -1514,18 +1529,33 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	bool cold = ((gfp_flags & __GFP_COLD) != 0);
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[pcp_list_index(order, migratetype)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			/* refill with about a batch worth of pages */
+			pcp->count += rmqueue_bulk(zone, order,
+					max(pcp->batch >> order, 1), list,
+					migratetype, cold) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1536,21 +1566,8 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -2789,6 +2806,119 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * alloc_pages_bulk - allocate a number of order-0 pages at once
+ * @gfp_mask: GFP flags for the allocation
+ * @nr_pages: number of pages wanted
+ * @pages: array of at least @nr_pages entries to store the pages in
+ *
+ * Takes as many pages as it can from the per-cpu list of the local
+ * preferred zone in one irq-disabled pass, refilling the list from the
+ * buddy under a single zone->lock hold when it runs dry. Whatever is
+ * left, or everything if the zone is short of free pages, is allocated
+ * one by one with alloc_page(), which knows how to fall back to other
+ * zones and nodes and how to reclaim.
+ *
+ * Returns the number of pages stored at the beginning of @pages, this is
+ * less than @nr_pages only if the allocation failed.
+ */
+unsigned long alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr_pages,
+			       struct page **pages)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	bool cold = ((gfp_mask & __GFP_COLD) != 0);
+	int alloc_flags = ALLOC_WMARK_LOW;
+	unsigned int cpuset_mems_cookie;
+	unsigned long flags, nr = 0, taken, i;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct zone *zone;
+
+	gfp_mask &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(gfp_mask);
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (nr_pages < 2 || should_fail_alloc_page(gfp_mask, 0))
+		goto fallback;
+#ifdef CONFIG_NUMA
+	/* Leave memory policies to alloc_pages_current() */
+	if (current->mempolicy && !in_interrupt())
+		goto fallback;
+#endif
+
+	cpuset_mems_cookie = get_mems_allowed();
+	first_zones_zonelist(node_zonelist(numa_node_id(), gfp_mask),
+			     high_zoneidx, &cpuset_current_mems_allowed, &zone);
+	if (!zone)
+		goto out_mems;
+
+	/* Respect the fair zone batches and the dirty limit */
+	if (zone_page_state(zone, NR_ALLOC_BATCH) < (long)nr_pages)
+		goto out_mems;
+	if ((gfp_mask & __GFP_WRITE) && !zone_dirty_ok(zone))
+		goto out_mems;
+#ifdef CONFIG_CMA
+	if (migratetype == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+#endif
+	if (!zone_watermark_ok(zone, 0, low_wmark_pages(zone) + nr_pages,
+			       zone_idx(zone), alloc_flags))
+		goto out_mems;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[migratetype];
+	while (nr < nr_pages) {
+		struct page *page;
+
+		if (list_empty(list)) {
+			pcp->count += rmqueue_bulk(zone, 0,
+					pcp->batch, list,
+					migratetype, cold);
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_del(&page->lru);
+		pcp->count--;
+		zone_statistics(zone, zone, gfp_mask);
+		pages[nr++] = page;
+	}
+	__mod_zone_page_state(zone, NR_ALLOC_BATCH, -(long)nr);
+	__count_zone_vm_events(PGALLOC, zone, nr);
+	local_irq_restore(flags);
+
+	/* Bad pages are dropped, as buffered_rmqueue() does */
+	for (i = 0, taken = nr, nr = 0; i < taken; i++) {
+		struct page *page = pages[i];
+
+		VM_BUG_ON_PAGE(bad_range(zone, page), page);
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		page->pfmemalloc = false;
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+		pages[nr++] = page;
+	}
+out_mems:
+	put_mems_allowed(cpuset_mems_cookie);
+fallback:
+	for (; nr < nr_pages; nr++) {
+		pages[nr] = alloc_page(gfp_mask);
+		if (!pages[nr])
+			break;
+	}
+	return nr;
+}
+EXPORT_SYMBOL(alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -2832,6 +2962,8 @@ void __free_pages(struct page *page, unsigned int order)
 	if (put_page_testzero(page)) {
 		if (order == 0)
 			free_hot_cold_page(page, false);
+		else if (order <= PCP_MAX_ORDER)
+			free_pcp_page(page, order, false);
 		else
 			__free_pages_ok(page, order);
 	}
@@ -4194,7 +4326,7 @@ static int __meminit zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -4202,8 +4334,8 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -35,11 +35,7 @@
 
 static int pcpu_populate_chunk(struct pcpu_chunk *chunk, int off, int size)
 {
-	unsigned int cpu;
-
-	for_each_possible_cpu(cpu)
-		memset((void *)pcpu_chunk_addr(chunk, cpu, 0) + off, 0, size);
-
+	/* nada, the whole chunk is allocated on creation */
 	return 0;
 }
 
@@ -70,6 +66,7 @@ static struct pcpu_chunk *pcpu_create_chunk(void)
 
 	chunk->data = pages;
 	chunk->base_addr = page_address(pages) - pcpu_group_offsets[0];
+	bitmap_fill(chunk->populated, pcpu_unit_pages);
 	return chunk;
 }
 
@@ -293,7 +293,7 @@ static void pcpu_post_map_flush(struct pcpu_chunk *chunk,
  * @size: size of the area to populate in bytes
  *
  * For each cpu, populate and map pages [@page_start,@page_end) into
- * @chunk.  The area is cleared on return.
+ * @chunk.  The area is not cleared, pcpu_alloc() does it.
  *
  * CONTEXT:
  * pcpu_alloc_mutex, does GFP_KERNEL allocation.
@@ -305,14 +305,11 @@ static int pcpu_populate_chunk(struct pcpu_chunk *chunk, int off, int size)
 	int free_end = page_start, unmap_end = page_start;
 	struct page **pages;
 	unsigned long *populated;
-	unsigned int cpu;
 	int rs, re, rc;
 
 	/* quick path, check whether all pages are already there */
-	rs = page_start;
-	pcpu_next_pop(chunk, &rs, &re, page_end);
-	if (rs == page_start && re == page_end)
-		goto clear;
+	if (pcpu_area_populated(chunk, off, size))
+		return 0;
 
 	/* need to allocate and map pages, this chunk can't be immutable */
 	WARN_ON(chunk->immutable);
@@ -337,11 +334,12 @@ static int pcpu_populate_chunk(struct pcpu_chunk *chunk, int off, int size)
 	}
 	pcpu_post_map_flush(chunk, page_start, page_end);
 
-	/* commit new bitmap */
+	/*
+	 * Commit new bitmap.  Allocations which don't take pcpu_alloc_mutex
+	 * look at it, make sure they see the mappings first.
+	 */
+	smp_wmb();
 	bitmap_copy(chunk->populated, populated, pcpu_unit_pages);
-clear:
-	for_each_possible_cpu(cpu)
-		memset((void *)pcpu_chunk_addr(chunk, cpu, 0) + off, 0, size);
 	return 0;
 
 err_unmap:
@@ -159,16 +159,23 @@ static int pcpu_reserved_chunk_limit;
  * vmalloc mapping.  The latter is a spinlock and protects the index
  * data structures - chunk slots, chunks and area maps in chunks.
  *
- * During allocation, pcpu_alloc_mutex is kept locked all the time and
- * pcpu_lock is grabbed and released as necessary.  All actual memory
- * allocations are done using GFP_KERNEL with pcpu_lock released.  In
- * general, percpu memory can't be allocated with irq off but
- * irqsave/restore are still used in alloc path so that it can be used
- * from early init path - sched_init() specifically.
+ * Allocation first looks for free space under pcpu_lock alone.  If the
+ * area found is populated and the area map needs no extension, nothing
+ * else is necessary.  Otherwise pcpu_alloc_mutex is grabbed and the
+ * search restarted, then the mutex is kept locked for the rest of the
+ * allocation and pcpu_lock is grabbed and released as necessary.  All
+ * actual memory allocations are done using GFP_KERNEL with pcpu_lock
+ * released.  In general, percpu memory can't be allocated with irq off
+ * but irqsave/restore are still used in alloc path so that it can be
+ * used from early init path - sched_init() specifically.
+ *
+ * The populated bitmap only gains bits while a chunk is reachable
+ * through the slots, and the area found is allocated before pcpu_lock
+ * is dropped, so the chunk can't be reclaimed under the lockless path.
  *
  * Free path accesses and alters only the index data structures, so it
  * can be safely called from atomic context.  When memory needs to be
- * returned to the system, free path schedules reclaim_work which
+ * returned to the system, free path schedules balance_work which
  * grabs both pcpu_alloc_mutex and pcpu_lock, unlinks chunks to be
  * reclaimed, release both locks and frees the chunks.  Note that it's
  * necessary to grab both locks to remove a chunk from circulation as
@@ -180,9 +187,22 @@ static DEFINE_SPINLOCK(pcpu_lock);	/* protects index data structures */
 
 static struct list_head *pcpu_slot __read_mostly; /* chunk list slots */
 
-/* reclaim work to release fully free chunks, scheduled from free path */
-static void pcpu_reclaim(struct work_struct *work);
-static DECLARE_WORK(pcpu_reclaim_work, pcpu_reclaim);
+/*
+ * Balance work releases fully free chunks, scheduled from free path, and
+ * keeps one populated free chunk around, scheduled from alloc path.
+ */
+static void pcpu_balance_workfn(struct work_struct *work);
+static DECLARE_WORK(pcpu_balance_work, pcpu_balance_workfn);
+static bool pcpu_async_enabled __read_mostly;
+
+/* pages populated in advance at the start of the spare free chunk */
+#define PCPU_SPARE_POP_PAGES	4
+
+static void pcpu_schedule_balance_work(void)
+{
+	if (pcpu_async_enabled)
+		schedule_work(&pcpu_balance_work);
+}
 
 static bool pcpu_addr_in_first_chunk(void *addr)
 {
@@ -274,6 +294,17 @@ static void __maybe_unused pcpu_next_pop(struct pcpu_chunk *chunk,
 	     (rs) < (re);						    \
 	     (rs) = (re) + 1, pcpu_next_pop((chunk), &(rs), &(re), (end)))
 
+/* are all pages backing [@off, @off + @size) of @chunk populated? */
+static bool pcpu_area_populated(struct pcpu_chunk *chunk, int off, int size)
+{
+	int page_start = PFN_DOWN(off);
+	int page_end = PFN_UP(off + size);
+	int rs = page_start, re;
+
+	pcpu_next_pop(chunk, &rs, &re, page_end);
+	return rs == page_start && re == page_end;
+}
+
 /**
  * pcpu_mem_zalloc - allocate memory
  * @size: bytes to allocate
@@ -740,7 +771,9 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 	static int warn_limit = 10;
 	struct pcpu_chunk *chunk;
 	const char *err;
+	bool locked = false, need_balance = false;
 	int slot, off, new_alloc;
+	unsigned int cpu;
 	unsigned long flags;
 	void __percpu *ptr;
 
@@ -756,7 +789,6 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 		return NULL;
 	}
 
-	mutex_lock(&pcpu_alloc_mutex);
 	spin_lock_irqsave(&pcpu_lock, flags);
 
 	/* serve reserved allocations from the reserved chunk if available */
@@ -770,7 +802,10 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 
 		while ((new_alloc = pcpu_need_to_extend(chunk))) {
 			spin_unlock_irqrestore(&pcpu_lock, flags);
-			if (pcpu_extend_area_map(chunk, new_alloc) < 0) {
+			if (!locked) {
+				mutex_lock(&pcpu_alloc_mutex);
+				locked = true;
+			} else if (pcpu_extend_area_map(chunk, new_alloc) < 0) {
 				err = "failed to extend area map of reserved chunk";
 				goto fail_unlock_mutex;
 			}
@@ -795,8 +830,11 @@ restart:
 			new_alloc = pcpu_need_to_extend(chunk);
 			if (new_alloc) {
 				spin_unlock_irqrestore(&pcpu_lock, flags);
-				if (pcpu_extend_area_map(chunk,
-							 new_alloc) < 0) {
+				if (!locked) {
+					mutex_lock(&pcpu_alloc_mutex);
+					locked = true;
+				} else if (pcpu_extend_area_map(chunk,
+								new_alloc) < 0) {
 					err = "failed to extend area map";
 					goto fail_unlock_mutex;
 				}
@@ -809,14 +847,26 @@ restart:
 			}
 
 			off = pcpu_alloc_area(chunk, size, align);
-			if (off >= 0)
+			if (off >= 0) {
+				/* the spare free chunk is taken, get another */
+				if (slot == pcpu_nr_slots - 1)
+					need_balance = true;
 				goto area_found;
+			}
 		}
 	}
 
 	/* hmmm... no space left, create a new chunk */
 	spin_unlock_irqrestore(&pcpu_lock, flags);
 
+	if (!locked) {
+		/* someone might have created one meanwhile, look again */
+		mutex_lock(&pcpu_alloc_mutex);
+		locked = true;
+		spin_lock_irqsave(&pcpu_lock, flags);
+		goto restart;
+	}
+
 	chunk = pcpu_create_chunk();
 	if (!chunk) {
 		err = "failed to allocate new chunk";
@@ -828,9 +878,20 @@ restart:
 	goto restart;
 
 area_found:
+	/* lockless fast path, the area is ready to be used */
+	if (!locked && pcpu_area_populated(chunk, off, size)) {
+		spin_unlock_irqrestore(&pcpu_lock, flags);
+		smp_rmb();	/* pairs with pcpu_populate_chunk() */
+		goto clear;
+	}
 	spin_unlock_irqrestore(&pcpu_lock, flags);
 
-	/* populate, map and clear the area */
+	if (!locked) {
+		mutex_lock(&pcpu_alloc_mutex);
+		locked = true;
+	}
+
+	/* populate and map the area */
 	if (pcpu_populate_chunk(chunk, off, size)) {
 		spin_lock_irqsave(&pcpu_lock, flags);
 		pcpu_free_area(chunk, off);
@@ -839,6 +900,13 @@ area_found:
 	}
 
 	mutex_unlock(&pcpu_alloc_mutex);
+	need_balance = true;
+clear:
+	if (need_balance)
+		pcpu_schedule_balance_work();
+
+	for_each_possible_cpu(cpu)
+		memset((void *)pcpu_chunk_addr(chunk, cpu, 0) + off, 0, size);
 
 	/* return address relative to base address */
 	ptr = __addr_to_pcpu_ptr(chunk->base_addr + off);
@@ -848,7 +916,8 @@ area_found:
 fail_unlock:
 	spin_unlock_irqrestore(&pcpu_lock, flags);
 fail_unlock_mutex:
-	mutex_unlock(&pcpu_alloc_mutex);
+	if (locked)
+		mutex_unlock(&pcpu_alloc_mutex);
 	if (warn_limit) {
 		pr_warning("PERCPU: allocation failed, size=%zu align=%zu, "
 			   "%s\n", size, align, err);
@@ -901,15 +970,18 @@ void __percpu *__alloc_reserved_percpu(size_t size, size_t align)
 }
 
 /**
- * pcpu_reclaim - reclaim fully free chunks, workqueue function
+ * pcpu_balance_workfn - manage the pool of free chunks, workqueue function
  * @work: unused
  *
- * Reclaim all fully free chunks except for the first one.
+ * Reclaim all fully free chunks except for the first one.  If there is
+ * none, create it, and populate the first pages of it, so that the next
+ * allocations neither create chunks nor populate them under
+ * pcpu_alloc_mutex.
  *
  * CONTEXT:
  * workqueue context.
  */
-static void pcpu_reclaim(struct work_struct *work)
+static void pcpu_balance_workfn(struct work_struct *work)
 {
 	LIST_HEAD(todo);
 	struct list_head *head = &pcpu_slot[pcpu_nr_slots - 1];
@@ -935,6 +1007,24 @@ static void pcpu_reclaim(struct work_struct *work)
 		pcpu_destroy_chunk(chunk);
 	}
 
+	spin_lock_irq(&pcpu_lock);
+	chunk = list_first_entry_or_null(head, struct pcpu_chunk, list);
+	spin_unlock_irq(&pcpu_lock);
+
+	if (!chunk) {
+		chunk = pcpu_create_chunk();
+		if (chunk) {
+			spin_lock_irq(&pcpu_lock);
+			pcpu_chunk_relocate(chunk, -1);
+			spin_unlock_irq(&pcpu_lock);
+		}
+	}
+
+	/* failure is fine, allocations will populate on their own */
+	if (chunk && !chunk->immutable)
+		pcpu_populate_chunk(chunk, 0, min(PCPU_SPARE_POP_PAGES,
+					pcpu_unit_pages) << PAGE_SHIFT);
+
 	mutex_unlock(&pcpu_alloc_mutex);
 }
 
@@ -974,7 +1064,7 @@ void free_percpu(void __percpu *ptr)
 
 		list_for_each_entry(pos, &pcpu_slot[pcpu_nr_slots - 1], list)
 			if (pos != chunk) {
-				schedule_work(&pcpu_reclaim_work);
+				pcpu_schedule_balance_work();
 				break;
 			}
 	}
@@ -1986,3 +2076,14 @@ void __init percpu_init_late(void)
 		spin_unlock_irqrestore(&pcpu_lock, flags);
 	}
 }
+
+/*
+ * Percpu allocator is initialized early during boot when neither slab or
+ * workqueue is available.  Don't schedule balance work until both are up.
+ */
+static int __init percpu_enable_async(void)
+{
+	pcpu_async_enabled = true;
+	return 0;
+}
+subsys_initcall(percpu_enable_async);
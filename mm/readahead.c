@@ -332,6 +332,10 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * for sequential patterns. Hence interleaved reads might be served as
  * sequential ones.
  *
+ * Reads at a constant distance of each other are recognized as a strided
+ * stream with the help of the stride of the last random read, and the
+ * next records along the stride are read ahead.
+ *
  * There is a special-case: if the first page which the application tries to
  * read happens to be the first page of the file, it is assumed that a linear
  * read is about to happen and the window is immediately set to the initial size
@@ -394,6 +398,30 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Strided reads: records of @req_size pages at a fixed distance of each
+ * other, like a scan over a column or over every Nth block of an image.
+ * Read the records which fit into the readahead window along the stride
+ * at once, so that the application does not wait for each of them.
+ */
+static unsigned long strided_readahead(struct address_space *mapping,
+				       struct file *filp,
+				       struct file_ra_state *ra,
+				       pgoff_t offset,
+				       unsigned long req_size,
+				       unsigned long max)
+{
+	/* prev_pos is in the last page of the previous record */
+	unsigned long step = ra->stride + req_size - 1;
+	unsigned long nr = max / step;
+	unsigned long i, ret = 0;
+
+	for (i = 0; i <= nr; i++)
+		ret += __do_page_cache_readahead(mapping, filp,
+				offset + i * step, req_size, 0);
+	return ret;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -470,6 +498,19 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	/*
+	 * The same step forward as between the previous two reads:
+	 * a strided stream, don't confuse it with a random one.
+	 */
+	if (offset > prev_offset) {
+		unsigned long stride = offset - prev_offset;
+
+		if (stride == ra->stride && stride + req_size <= max)
+			return strided_readahead(mapping, filp, ra, offset,
+						 req_size, max);
+		ra->stride = stride;
+	}
+
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
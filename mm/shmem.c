@@ -159,7 +159,7 @@ static inline int shmem_acct_size(unsigned long flags, loff_t size,
 	if (flags & VM_NORESERVE)
 		return 0;
 
-	ret = charge_beancounter(ub, UB_SHMPAGES, pages, UB_HARD);
+	ret = charge_beancounter_fast(ub, UB_SHMPAGES, pages, UB_HARD);
 	if (ret)
 		goto no_shm;
 
@@ -196,7 +196,7 @@ static inline int shmem_acct_size(unsigned long flags, loff_t size,
 no_vm:
 	uncharge_beancounter_fast(ub, UB_PRIVVMPAGES, pages);
 no_privvm:
-	uncharge_beancounter(ub, UB_SHMPAGES, pages);
+	uncharge_beancounter_fast(ub, UB_SHMPAGES, pages);
 no_shm:
 	return ret;
 }
@@ -209,7 +209,7 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size,
 	if (!(flags & VM_NORESERVE)) {
 		vm_unacct_memory(pages);
 		uncharge_beancounter_fast(ub, UB_PRIVVMPAGES, pages);
-		uncharge_beancounter(ub, UB_SHMPAGES, pages);
+		uncharge_beancounter_fast(ub, UB_SHMPAGES, pages);
 	}
 }
 
@@ -14,10 +14,25 @@
 #include <linux/atomic.h>
 #include <linux/kref.h>
 #include <linux/jhash.h>
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
 #include <linux/completion.h>
+#include <linux/workqueue.h>
 #include <linux/shrinker.h>
 #include <linux/vmstat.h>
+#include <linux/pagevec.h>
+#include <linux/cpu.h>
+#include <linux/crypto.h>
+#include <linux/zbud.h>
 #include <linux/cleancache.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include <bc/beancounter.h>
+#include <bc/proc.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/tcache.h>
 
 /* cleancache_put_page is called from atomic context */
 #define TCACHE_GFP_MASK			(__GFP_NORETRY | __GFP_NOWARN)
@@ -27,6 +42,14 @@ struct tcache_node_tree {
 	spinlock_t			lock;
 };
 
+/* Per pool event counters, reported in debugfs */
+struct tcache_pool_stat {
+	unsigned long			puts;
+	unsigned long			gets;
+	unsigned long			hits;
+	unsigned long			evicts;
+};
+
 /*
  * Tcache pools correspond to super blocks. A pool is created on FS mount
  * (cleancache_init_fs) and destroyed on unmount (cleancache_invalidate_fs).
@@ -50,6 +73,24 @@ struct tcache_pool {
 	/* track total number of nodes in each pool for debugging */
 	atomic_long_t			nr_nodes;
 
+	/* id in tcache_pool_idr, recorded in compressed pages */
+	int				id;
+
+	/* beancounter of who mounted the FS, charged for UB_TCACHEPAGES */
+	struct user_beancounter		*ub;
+
+	struct tcache_pool_stat __percpu *stat;
+
+	/*
+	 * UUID of the file system, if any, and whether the pool is to be kept
+	 * after unmount (see tcache_keep_pool). Protected by tcache_pool_lock.
+	 */
+	u8				uuid[16];
+	bool				has_uuid;
+	bool				keep;
+	unsigned long			keep_expire;
+	struct list_head		kept_list;
+
 	/* used to synchronize destruction */
 	struct completion		completion;
 	struct rcu_head			rcu;
@@ -84,6 +125,8 @@ struct tcache_node {
 
 	/*
 	 * Radix tree of pages attached to this node. Protected by tree_lock.
+	 * Besides pages, it may contain exceptional entries standing for
+	 * compressed pages - see tcache_compress_page.
 	 */
 	struct radix_tree_root		page_tree;
 	spinlock_t			tree_lock;
@@ -105,6 +148,23 @@ static int num_node_trees __read_mostly = 1;
 static DEFINE_IDR(tcache_pool_idr);
 static DEFINE_SPINLOCK(tcache_pool_lock);
 
+/*
+ * A pool can be kept for tcache.keep_timeout seconds after its file system is
+ * unmounted, so that a quick umount/mount cycle, e.g. a container restart,
+ * finds the cache warm: if a file system with the same UUID is mounted in
+ * time, it gets the old pool back. Nothing guarantees the file system is not
+ * modified meanwhile, so it is done only on request, by writing the UUID to
+ * tcache.keep while the file system is mounted. Kept pools are on
+ * tcache_kept_pools, protected by tcache_pool_lock, and are destroyed by
+ * tcache_keep_work when expired.
+ */
+static unsigned int tcache_keep_timeout __read_mostly = 60;
+module_param_named(keep_timeout, tcache_keep_timeout, uint, 0644);
+
+static LIST_HEAD(tcache_kept_pools);
+static void tcache_keep_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(tcache_keep_work, tcache_keep_work_fn);
+
 struct tcache_lru {
 	spinlock_t lock;
 	struct list_head list;
@@ -117,11 +177,25 @@ struct tcache_lru {
  */
 static struct tcache_lru *tcache_lru_node;
 
+/*
+ * Pages are added to the LRU lists in batches collected per cpu, so that
+ * concurrent tcache_cleancache_put_page() callers do not bounce the LRU lock
+ * on every page. A page in a batch is pinned by the batch and is not visible
+ * to the shrinker yet.
+ *
+ * Whether a page should be on the LRU is told by PG_owner_priv_1 (tcache
+ * pages are not in page cache, so we own it). It is set when the page is
+ * batched and cleared when the page is removed from the LRU or isolated. A
+ * batched page whose flag was cleared meanwhile is simply dropped on drain.
+ */
+static DEFINE_PER_CPU(struct pagevec, tcache_lru_pvec);
+
 /*
  * Locking rules:
  *
  * - tcache_node_tree->lock nests inside tcache_node->tree_lock
  * - tcache_lru->lock is independent
+ * - per cpu LRU batches are accessed with irqs disabled
  */
 
 /* Enable/disable tcache backend (set at boot time) */
@@ -135,6 +209,111 @@ module_param_named(active, tcache_active, bool, 0644);
 /* Total number of pages cached */
 static DEFINE_PER_CPU(long, nr_tcache_pages);
 
+/*
+ * Compressed tier. When a page gets to the head of the LRU, instead of
+ * dropping it we try to compress it and store in a zbud pool, so only cold
+ * pages are compressed. Compressed pages are not on tcache LRU lists, they
+ * are evicted from the zbud pool by the shrinker after raw pages are gone.
+ */
+#define TCACHE_COMPRESSOR_DEFAULT "lzo"
+static char *tcache_compressor = TCACHE_COMPRESSOR_DEFAULT;
+module_param_named(compressor, tcache_compressor, charp, 0444);
+
+/* Max percentage of RAM taken by compressed pages, 0 disables compression */
+static unsigned int tcache_compress_percent __read_mostly;
+module_param_named(compress_percent, tcache_compress_percent, uint, 0644);
+
+static struct zbud_pool *tcache_zbud_pool __read_mostly;
+static DEFINE_PER_CPU(struct crypto_comp *, tcache_comp_tfm);
+static DEFINE_PER_CPU(u8 *, tcache_comp_buf);
+
+/* Compressed pages, their decompressions and time spent on them (ns) */
+static DEFINE_PER_CPU(long, nr_tcache_zpages);
+static DEFINE_PER_CPU(long, nr_tcache_decompress);
+static DEFINE_PER_CPU(long, tcache_decompress_ns);
+
+/* Stored in front of compressed data, for the zbud evict callback */
+struct tcache_zhdr {
+	int				pool_id;
+	unsigned int			length;
+	pgoff_t				index;
+	struct cleancache_filekey	key;
+};
+
+/*
+ * Deduplication (tcache.dedup, set at boot time). Page contents are hashed on
+ * put, and a page identical to one already cached, in whatever pool, is not
+ * copied again: the page tree gets a reference to the shared copy, a
+ * tcache_sref, stored as an exceptional entry with TCACHE_SREF_ENTRY set. The
+ * shared copy is freed with its last reference. References are not on tcache
+ * LRU lists, but on their own one, and are evicted by the shrinker after raw
+ * pages. Each reference is still charged to its pool as a whole page.
+ */
+static bool tcache_dedup __read_mostly;
+module_param_named(dedup, tcache_dedup, bool, 0444);
+
+#define TCACHE_SREF_ENTRY		4
+
+struct tcache_shared {
+	struct hlist_node		hash;
+	u32				csum;
+	unsigned int			nr_refs;	/* under bucket lock */
+	struct page			*page;
+};
+
+struct tcache_sref {
+	struct tcache_shared		*shared;
+	struct list_head		lru;
+	/* where the reference is, for eviction */
+	int				pool_id;
+	pgoff_t				index;
+	struct cleancache_filekey	key;
+};
+
+struct tcache_dedup_bucket {
+	struct hlist_head		head;
+	spinlock_t			lock;
+};
+
+static struct tcache_dedup_bucket *tcache_dedup_hash;
+static unsigned int tcache_dedup_hash_bits;
+
+static LIST_HEAD(tcache_sref_lru);
+static DEFINE_SPINLOCK(tcache_sref_lru_lock);
+static unsigned long tcache_nr_srefs;
+module_param_named(nr_srefs, tcache_nr_srefs, ulong, 0444);
+
+/* Shared copies */
+static DEFINE_PER_CPU(long, nr_tcache_shared);
+
+static inline void *tcache_sref_to_entry(struct tcache_sref *sref)
+{
+	return (void *)((unsigned long)sref | TCACHE_SREF_ENTRY |
+			RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static inline struct tcache_sref *tcache_entry_to_sref(void *entry)
+{
+	return (void *)((unsigned long)entry &
+			~(TCACHE_SREF_ENTRY | RADIX_TREE_EXCEPTIONAL_ENTRY));
+}
+
+static inline bool tcache_entry_is_sref(void *entry)
+{
+	return radix_tree_exceptional_entry(entry) &&
+		((unsigned long)entry & TCACHE_SREF_ENTRY);
+}
+
+static inline void *tcache_handle_to_entry(unsigned long handle)
+{
+	return (void *)(handle | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static inline unsigned long tcache_entry_to_handle(void *entry)
+{
+	return (unsigned long)entry & ~RADIX_TREE_EXCEPTIONAL_ENTRY;
+}
+
 static inline u32 key_hash(const struct cleancache_filekey *key)
 {
 	return jhash2(key->u.key, CLEANCACHE_KEY_MAX, 0);
@@ -147,29 +326,68 @@ node_tree_from_key(struct tcache_pool *pool,
 	return &pool->node_tree[key_hash(key) & (num_node_trees - 1)];
 }
 
+/*
+ * Move batched pages to the LRU lists and drop the batch references. Must be
+ * called with irqs disabled.
+ */
+static void tcache_lru_drain(struct pagevec *pvec)
+{
+	struct tcache_lru *lru = NULL, *page_lru;
+	struct page *page;
+	int i;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		page = pvec->pages[i];
+		page_lru = &tcache_lru_node[page_to_nid(page)];
+		if (page_lru != lru) {
+			if (lru)
+				spin_unlock(&lru->lock);
+			lru = page_lru;
+			spin_lock(&lru->lock);
+		}
+		/* Checked under the lock, see tcache_lru_del */
+		if (PageOwnerPriv1(page)) {
+			list_add_tail(&page->lru, &lru->list);
+			lru->nr_items++;
+		}
+	}
+	if (lru)
+		spin_unlock(&lru->lock);
+
+	for (i = 0; i < pagevec_count(pvec); i++)
+		put_page(pvec->pages[i]);
+	pagevec_reinit(pvec);
+}
+
 /*
  * Add a page to the LRU list. This effectively makes the page visible to the
  * shrinker, so it must only be called after the page was properly initialized
- * and added to the corresponding page tree.
+ * and added to the corresponding page tree. Must be called with irqs
+ * disabled.
  */
 static void tcache_lru_add(struct page *page)
 {
-	struct tcache_lru *lru = &tcache_lru_node[page_to_nid(page)];
+	struct pagevec *pvec = &__get_cpu_var(tcache_lru_pvec);
 
-	spin_lock(&lru->lock);
-	list_add_tail(&page->lru, &lru->list);
-	lru->nr_items++;
-	spin_unlock(&lru->lock);
+	get_page(page);
+	SetPageOwnerPriv1(page);
+	if (!pagevec_add(pvec, page))
+		tcache_lru_drain(pvec);
 }
 
 /*
  * Remove a page from the LRU list. This function is safe to call on the same
- * page from concurrent threads - the page will be removed only once.
+ * page from concurrent threads - the page will be removed only once. If the
+ * page is still in a per cpu batch, it will be dropped when the batch is
+ * drained.
  */
 static void tcache_lru_del(struct page *page)
 {
 	struct tcache_lru *lru = &tcache_lru_node[page_to_nid(page)];
 
+	if (!TestClearPageOwnerPriv1(page))
+		return;
+
 	spin_lock(&lru->lock);
 	if (!list_empty(&page->lru)) {
 		list_del_init(&page->lru);
@@ -178,7 +396,7 @@ static void tcache_lru_del(struct page *page)
 	spin_unlock(&lru->lock);
 }
 
-static int tcache_create_pool(void)
+static int tcache_create_pool(const u8 *uuid)
 {
 	struct tcache_pool *pool;
 	int id;
@@ -193,8 +411,18 @@ static int tcache_create_pool(void)
 	if (!pool->node_tree)
 		goto free_pool;
 
+	pool->stat = alloc_percpu(struct tcache_pool_stat);
+	if (!pool->stat)
+		goto free_trees;
+
 	kref_init(&pool->kref);
 	init_completion(&pool->completion);
+	pool->ub = get_beancounter(get_exec_ub());
+	INIT_LIST_HEAD(&pool->kept_list);
+	if (uuid && memchr_inv(uuid, 0, sizeof(pool->uuid))) {
+		memcpy(pool->uuid, uuid, sizeof(pool->uuid));
+		pool->has_uuid = true;
+	}
 
 	for (i = 0; i < num_node_trees; i++) {
 		pool->node_tree[i].root = RB_ROOT;
@@ -205,14 +433,18 @@ static int tcache_create_pool(void)
 	spin_lock(&tcache_pool_lock);
 
 	id = idr_alloc(&tcache_pool_idr, pool, 0, 0, GFP_NOWAIT);
+	pool->id = id;
 
 	spin_unlock(&tcache_pool_lock);
 	idr_preload_end();
 
 	if (id < 0)
-		goto free_trees;
+		goto free_stat;
 	return id;
 
+free_stat:
+	put_beancounter(pool->ub);
+	free_percpu(pool->stat);
 free_trees:
 	kfree(pool->node_tree);
 free_pool:
@@ -303,10 +535,83 @@ static void tcache_destroy_pool(int id)
 
 	BUG_ON(atomic_long_read(&pool->nr_nodes) != 0);
 
+	put_beancounter(pool->ub);
+	free_percpu(pool->stat);
 	kfree(pool->node_tree);
 	kfree_rcu(pool, rcu);
 }
 
+/*
+ * Called on unmount. If the pool was asked to be kept, put it on the kept
+ * list instead of destroying. Returns true if the pool was kept.
+ */
+static bool tcache_keep_pool(int id)
+{
+	struct tcache_pool *pool;
+	unsigned long timeout = tcache_keep_timeout * HZ;
+	bool ret = false;
+
+	spin_lock(&tcache_pool_lock);
+	pool = idr_find(&tcache_pool_idr, id);
+	if (pool && pool->keep && timeout) {
+		pool->keep = false;
+		pool->keep_expire = jiffies + timeout;
+		list_add_tail(&pool->kept_list, &tcache_kept_pools);
+		ret = true;
+	}
+	spin_unlock(&tcache_pool_lock);
+
+	if (ret)
+		schedule_delayed_work(&tcache_keep_work, timeout);
+	return ret;
+}
+
+/*
+ * Return the id of a kept pool for the given UUID, taking it off the kept
+ * list, or -1 if there is no such pool.
+ */
+static int tcache_restore_pool(const u8 *uuid)
+{
+	struct tcache_pool *pool;
+	int id = -1;
+
+	spin_lock(&tcache_pool_lock);
+	list_for_each_entry(pool, &tcache_kept_pools, kept_list) {
+		if (!memcmp(pool->uuid, uuid, sizeof(pool->uuid))) {
+			list_del_init(&pool->kept_list);
+			id = pool->id;
+			break;
+		}
+	}
+	spin_unlock(&tcache_pool_lock);
+	return id;
+}
+
+static void tcache_keep_work_fn(struct work_struct *work)
+{
+	struct tcache_pool *pool, *tmp;
+	unsigned long next = 0;
+	LIST_HEAD(expired);
+
+	spin_lock(&tcache_pool_lock);
+	list_for_each_entry_safe(pool, tmp, &tcache_kept_pools, kept_list) {
+		if (time_after_eq(jiffies, pool->keep_expire))
+			list_move(&pool->kept_list, &expired);
+		else if (!next || time_before(pool->keep_expire, next))
+			next = pool->keep_expire;
+	}
+	spin_unlock(&tcache_pool_lock);
+
+	list_for_each_entry_safe(pool, tmp, &expired, kept_list) {
+		list_del_init(&pool->kept_list);
+		tcache_destroy_pool(pool->id);
+	}
+
+	if (next)
+		schedule_delayed_work(&tcache_keep_work,
+				      max_t(long, next - jiffies, 1));
+}
+
 static struct tcache_node *tcache_alloc_node(void)
 {
 	struct tcache_node *node;
@@ -545,13 +850,33 @@ static inline void tcache_init_page(struct page *page,
 	page->index = index;
 }
 
+/*
+ * Account an entry added to (nr = 1) or deleted from (nr = -1) a page tree.
+ * Must be called with irqs disabled.
+ */
+static void tcache_account_entry(void *entry, int nr)
+{
+	if (tcache_entry_is_sref(entry))
+		return;		/* see tcache_sref_lru_add */
+	if (radix_tree_exceptional_entry(entry))
+		__this_cpu_add(nr_tcache_zpages, nr);
+	else {
+		__this_cpu_add(nr_tcache_pages, nr);
+		__mod_zone_page_state(page_zone(entry), NR_FILE_PAGES, nr);
+	}
+}
+
+/*
+ * Insert an entry at a given offset, replacing the old one, which is returned
+ * in *old_entry and must be released by the caller.
+ */
 static int tcache_page_tree_replace(struct tcache_node *node, pgoff_t index,
-				    struct page *page, struct page **old_page)
+				    void *entry, void **old_entry)
 {
 	void **pslot;
 	int err = 0;
 
-	*old_page = NULL;
+	*old_entry = NULL;
 
 	spin_lock(&node->tree_lock);
 	/*
@@ -565,19 +890,25 @@ static int tcache_page_tree_replace(struct tcache_node *node, pgoff_t index,
 
 	pslot = radix_tree_lookup_slot(&node->page_tree, index);
 	if (pslot) {
-		*old_page = radix_tree_deref_slot_protected(pslot,
-							    &node->tree_lock);
-		radix_tree_replace_slot(pslot, page);
-		__dec_zone_page_state(*old_page, NR_FILE_PAGES);
-		__inc_zone_page_state(page, NR_FILE_PAGES);
+		*old_entry = radix_tree_deref_slot_protected(pslot,
+							     &node->tree_lock);
+		radix_tree_replace_slot(pslot, entry);
+		tcache_account_entry(*old_entry, -1);
+		tcache_account_entry(entry, 1);
 	} else {
-		err = radix_tree_insert(&node->page_tree, index, page);
+		err = charge_beancounter_fast(node->pool->ub, UB_TCACHEPAGES,
+					      1, UB_HARD);
+		if (err)
+			goto out;
+		err = radix_tree_insert(&node->page_tree, index, entry);
 		BUG_ON(err == -EEXIST);
-		if (!err) {
+		if (err)
+			uncharge_beancounter_fast(node->pool->ub,
+						  UB_TCACHEPAGES, 1);
+		else {
 			if (!node->nr_pages++)
 				tcache_hold_node(node);
-			__this_cpu_inc(nr_tcache_pages);
-			__inc_zone_page_state(page, NR_FILE_PAGES);
+			tcache_account_entry(entry, 1);
 		}
 	}
 out:
@@ -585,26 +916,125 @@ out:
 	return err;
 }
 
-static struct page *__tcache_page_tree_delete(struct tcache_node *node,
-					      pgoff_t index, struct page *page)
+/*
+ * Delete an entry, a page, a compressed page or a shared page reference, at a
+ * given offset. If entry is not NULL, delete only if it is still there.
+ * Returns the deleted entry.
+ */
+static void *__tcache_page_tree_delete(struct tcache_node *node,
+				       pgoff_t index, void *entry)
 {
-	page = radix_tree_delete_item(&node->page_tree, index, page);
-	if (page) {
+	entry = radix_tree_delete_item(&node->page_tree, index, entry);
+	if (entry) {
+		uncharge_beancounter_fast(node->pool->ub, UB_TCACHEPAGES, 1);
 		if (!--node->nr_pages)
 			tcache_put_node(node);
-		__this_cpu_dec(nr_tcache_pages);
-		__dec_zone_page_state(page, NR_FILE_PAGES);
+		tcache_account_entry(entry, -1);
 	}
-	return page;
+	return entry;
 }
 
-static struct page *tcache_page_tree_delete(struct tcache_node *node,
-					    pgoff_t index, struct page *page)
+static void *tcache_page_tree_delete(struct tcache_node *node,
+				     pgoff_t index, void *entry)
 {
 	spin_lock(&node->tree_lock);
-	page = __tcache_page_tree_delete(node, index, page);
+	entry = __tcache_page_tree_delete(node, index, entry);
 	spin_unlock(&node->tree_lock);
-	return page;
+	return entry;
+}
+
+/*
+ * Replace an isolated page with its compressed copy, or delete it if handle
+ * is 0. Returns false if the page was deleted by a concurrent thread, in
+ * which case the handle is freed.
+ */
+static bool tcache_page_tree_evict(struct tcache_node *node,
+				   struct page *page, unsigned long handle)
+{
+	void **pslot;
+	bool ret = false;
+
+	spin_lock(&node->tree_lock);
+	if (!handle) {
+		ret = __tcache_page_tree_delete(node, page->index, page);
+		goto out;
+	}
+
+	pslot = radix_tree_lookup_slot(&node->page_tree, page->index);
+	if (pslot && radix_tree_deref_slot_protected(pslot,
+					&node->tree_lock) == page) {
+		radix_tree_replace_slot(pslot, tcache_handle_to_entry(handle));
+		tcache_account_entry(page, -1);
+		tcache_account_entry(tcache_handle_to_entry(handle), 1);
+		ret = true;
+	}
+out:
+	spin_unlock(&node->tree_lock);
+
+	if (!ret && handle)
+		zbud_free(tcache_zbud_pool, handle);
+	return ret;
+}
+
+static inline struct tcache_dedup_bucket *tcache_dedup_bucket(u32 csum)
+{
+	return &tcache_dedup_hash[hash_32(csum, tcache_dedup_hash_bits)];
+}
+
+static void tcache_sref_lru_add(struct tcache_sref *sref)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tcache_sref_lru_lock, flags);
+	list_add_tail(&sref->lru, &tcache_sref_lru);
+	tcache_nr_srefs++;
+	spin_unlock_irqrestore(&tcache_sref_lru_lock, flags);
+}
+
+/*
+ * Drop a reference to a shared page, freeing the page with the last one.
+ */
+static void tcache_put_sref(struct tcache_sref *sref)
+{
+	struct tcache_shared *shared = sref->shared;
+	struct tcache_dedup_bucket *b = tcache_dedup_bucket(shared->csum);
+	unsigned long flags;
+	bool last;
+
+	spin_lock_irqsave(&tcache_sref_lru_lock, flags);
+	list_del(&sref->lru);
+	tcache_nr_srefs--;
+	spin_unlock(&tcache_sref_lru_lock);
+
+	spin_lock(&b->lock);
+	last = !--shared->nr_refs;
+	if (last) {
+		hlist_del(&shared->hash);
+		__this_cpu_dec(nr_tcache_shared);
+		__dec_zone_page_state(shared->page, NR_FILE_PAGES);
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+
+	if (last) {
+		put_page(shared->page);
+		kfree(shared);
+	}
+	kfree(sref);
+}
+
+/*
+ * Release an entry detached from a page tree.
+ */
+static void tcache_put_entry(void *entry)
+{
+	if (!entry)
+		return;
+	if (tcache_entry_is_sref(entry))
+		tcache_put_sref(tcache_entry_to_sref(entry));
+	else if (radix_tree_exceptional_entry(entry))
+		zbud_free(tcache_zbud_pool, tcache_entry_to_handle(entry));
+	else
+		put_page(entry);
 }
 
 /*
@@ -615,51 +1045,83 @@ static struct page *tcache_page_tree_delete(struct tcache_node *node,
 static noinline_for_stack int
 tcache_attach_page(struct tcache_node *node, pgoff_t index, struct page *page)
 {
-	struct page *old_page;
+	void *old;
 	unsigned long flags;
 	int err = 0;
 
 	tcache_init_page(page, node, index);
 
 	local_irq_save(flags);
-	err = tcache_page_tree_replace(node, index, page, &old_page);
+	err = tcache_page_tree_replace(node, index, page, &old);
 	if (err)
 		goto out;
 
-	if (old_page) {
-		tcache_lru_del(old_page);
-		put_page(old_page);
-	}
+	if (old && !radix_tree_exceptional_entry(old))
+		tcache_lru_del(old);
 	get_page(page);
 	tcache_lru_add(page);
 out:
 	local_irq_restore(flags);
+	tcache_put_entry(old);
 	return err;
 }
 
 /*
- * Detach and return the page at a given offset of a node. The caller must put
- * the page when it is done with it.
+ * Same as tcache_attach_page, but for a reference to a shared page, which is
+ * released on failure.
  */
-static struct page *tcache_detach_page(struct tcache_node *node, pgoff_t index)
+static noinline_for_stack int
+tcache_attach_sref(struct tcache_node *node, pgoff_t index,
+		   struct tcache_sref *sref)
 {
+	void *old;
 	unsigned long flags;
-	struct page *page;
+	int err;
+
+	sref->pool_id = node->pool->id;
+	sref->index = index;
+	sref->key = node->key;
+
+	/* Eviction tolerates references which are not in the tree yet */
+	tcache_sref_lru_add(sref);
 
 	local_irq_save(flags);
-	page = tcache_page_tree_delete(node, index, NULL);
-	if (page)
-		tcache_lru_del(page);
+	err = tcache_page_tree_replace(node, index, tcache_sref_to_entry(sref),
+				       &old);
+	if (!err && old && !radix_tree_exceptional_entry(old))
+		tcache_lru_del(old);
 	local_irq_restore(flags);
 
-	return page;
+	tcache_put_entry(old);
+	if (err)
+		tcache_put_sref(sref);
+	return err;
+}
+
+/*
+ * Detach and return the entry, a page or a compressed page, at a given offset
+ * of a node. The caller must release it with tcache_put_entry when it is done
+ * with it.
+ */
+static void *tcache_detach_page(struct tcache_node *node, pgoff_t index)
+{
+	unsigned long flags;
+	void *entry;
+
+	local_irq_save(flags);
+	entry = tcache_page_tree_delete(node, index, NULL);
+	if (entry && !radix_tree_exceptional_entry(entry))
+		tcache_lru_del(entry);
+	local_irq_restore(flags);
+
+	return entry;
 }
 
 static noinline_for_stack void
 tcache_invalidate_node_pages(struct tcache_node *node)
 {
 	struct radix_tree_iter iter;
-	struct page *page;
+	void *entry;
 	void **slot;
 
 	spin_lock_irq(&node->tree_lock);
@@ -674,12 +1136,13 @@ tcache_invalidate_node_pages(struct tcache_node *node)
 	 * deleted from this node by the shrinker or by concurrent lookups.
 	 */
 	radix_tree_for_each_slot(slot, &node->page_tree, &iter, 0) {
-		page = radix_tree_deref_slot_protected(slot, &node->tree_lock);
-		BUG_ON(!__tcache_page_tree_delete(node, page->index, page));
+		entry = radix_tree_deref_slot_protected(slot, &node->tree_lock);
+		BUG_ON(!__tcache_page_tree_delete(node, iter.index, entry));
 		spin_unlock(&node->tree_lock);
 
-		tcache_lru_del(page);
-		put_page(page);
+		if (!radix_tree_exceptional_entry(entry))
+			tcache_lru_del(entry);
+		tcache_put_entry(entry);
 
 		local_irq_enable();
 		cond_resched();
@@ -708,6 +1171,7 @@ static struct page *tcache_lru_isolate(struct tcache_lru *lru,
 	page = list_first_entry(&lru->list, struct page, lru);
 
 	list_del_init(&page->lru);
+	ClearPageOwnerPriv1(page);
 	lru->nr_items--;
 
 	node = tcache_page_node(page);
@@ -738,17 +1202,149 @@ out:
 	return page;
 }
 
+static bool tcache_compress_full(void)
+{
+	return zbud_get_pool_size(tcache_zbud_pool) >
+		totalram_pages * tcache_compress_percent / 100;
+}
+
+/*
+ * Compress an isolated page into the zbud pool. Returns the zbud handle or 0
+ * if the page is not worth keeping compressed. Must be called with irqs
+ * disabled.
+ */
+static unsigned long tcache_compress_page(struct tcache_node *node,
+					  struct page *page)
+{
+	struct tcache_zhdr *zhdr;
+	unsigned long handle;
+	unsigned int dlen = PAGE_SIZE * 2;
+	u8 *src, *dst = __this_cpu_read(tcache_comp_buf);
+	int ret;
+
+	if (!tcache_zbud_pool || !tcache_compress_percent ||
+	    tcache_compress_full())
+		return 0;
+
+	src = kmap_atomic(page);
+	ret = crypto_comp_compress(__this_cpu_read(tcache_comp_tfm),
+				   src, PAGE_SIZE, dst, &dlen);
+	kunmap_atomic(src);
+	if (ret)
+		return 0;
+
+	/* Unless two fit into a zbud page, we save nothing */
+	if (sizeof(*zhdr) + dlen > PAGE_SIZE / 2)
+		return 0;
+
+	if (zbud_alloc(tcache_zbud_pool, sizeof(*zhdr) + dlen,
+		       TCACHE_GFP_MASK, &handle))
+		return 0;
+
+	/* Handles are chunk aligned, so they fit an exceptional entry */
+	if (WARN_ON_ONCE(handle & (RADIX_TREE_EXCEPTIONAL_ENTRY |
+				   TCACHE_SREF_ENTRY))) {
+		zbud_free(tcache_zbud_pool, handle);
+		return 0;
+	}
+
+	zhdr = zbud_map(tcache_zbud_pool, handle);
+	zhdr->pool_id = node->pool->id;
+	zhdr->length = dlen;
+	zhdr->index = page->index;
+	zhdr->key = node->key;
+	memcpy(zhdr + 1, dst, dlen);
+	zbud_unmap(tcache_zbud_pool, handle);
+
+	return handle;
+}
+
+static int tcache_decompress_page(unsigned long handle, struct page *page)
+{
+	struct tcache_zhdr *zhdr;
+	unsigned int dlen = PAGE_SIZE;
+	u64 start;
+	u8 *dst;
+	int ret;
+
+	zhdr = zbud_map(tcache_zbud_pool, handle);
+	dst = kmap_atomic(page);
+	start = local_clock();
+	ret = crypto_comp_decompress(__this_cpu_read(tcache_comp_tfm),
+				     (u8 *)(zhdr + 1), zhdr->length,
+				     dst, &dlen);
+	__this_cpu_add(tcache_decompress_ns, local_clock() - start);
+	__this_cpu_inc(nr_tcache_decompress);
+	kunmap_atomic(dst);
+	zbud_unmap(tcache_zbud_pool, handle);
+
+	return ret || dlen != PAGE_SIZE ? -EIO : 0;
+}
+
+/*
+ * Called by zbud_reclaim_page for compressed pages of a zbud page being
+ * freed. If the compressed page is still in its tree, drop it from there.
+ */
+static int tcache_zbud_evict(struct zbud_pool *zpool, unsigned long handle)
+{
+	struct tcache_zhdr *zhdr;
+	struct tcache_node *node;
+	struct cleancache_filekey key;
+	unsigned long flags;
+	pgoff_t index;
+	int pool_id;
+	void *entry = NULL;
+
+	zhdr = zbud_map(zpool, handle);
+	pool_id = zhdr->pool_id;
+	index = zhdr->index;
+	key = zhdr->key;
+	zbud_unmap(zpool, handle);
+
+	node = tcache_get_node_and_pool(pool_id, &key, false);
+	if (node) {
+		local_irq_save(flags);
+		entry = tcache_page_tree_delete(node, index,
+					tcache_handle_to_entry(handle));
+		local_irq_restore(flags);
+		if (entry) {
+			trace_tcache_evict(pool_id, &key, index,
+					   TCACHE_EVICT_ZBUD);
+			this_cpu_inc(node->pool->stat->evicts);
+			ub_percpu_inc(node->pool->ub, tcache_evict);
+		}
+		tcache_put_node_and_pool(node);
+	}
+
+	/* Otherwise the one who deleted it frees it */
+	if (entry)
+		zbud_free(zpool, handle);
+	return 0;
+}
+
+static struct zbud_ops tcache_zbud_ops = {
+	.evict = tcache_zbud_evict,
+};
+
 static noinline_for_stack struct page *
-__tcache_try_to_reclaim_page(struct tcache_lru *lru)
+__tcache_try_to_reclaim_page(struct tcache_lru *lru, int reason)
 {
 	struct page *page = NULL;
 	struct tcache_node *node;
-	unsigned long flags;
+	unsigned long flags, handle;
 
 	local_irq_save(flags);
 	page = tcache_lru_isolate(lru, &node);
 	if (page) {
-		if (tcache_page_tree_delete(node, page->index, page)) {
+		handle = tcache_compress_page(node, page);
+		if (tcache_page_tree_evict(node, page, handle)) {
+			trace_tcache_evict(node->pool->id, &node->key,
+					   page->index, handle ?
+					   TCACHE_EVICT_COMPRESS : reason);
+			if (!handle) {
+				__this_cpu_inc(node->pool->stat->evicts);
+				ub_percpu_inc(node->pool->ub, tcache_evict);
+			}
 			/*
 			 * We deleted the page from the tree - drop the
 			 * corresponding reference. Note, we still hold the
@@ -773,7 +1369,7 @@ static struct page *tcache_try_to_reclaim_page(void)
 {
 	struct tcache_lru *lru = &tcache_lru_node[numa_node_id()];
 
-	return __tcache_try_to_reclaim_page(lru);
+	return __tcache_try_to_reclaim_page(lru, TCACHE_EVICT_REUSE);
 }
 
 static struct page *tcache_alloc_page(void)
@@ -787,10 +1383,175 @@ static struct page *tcache_alloc_page(void)
 	return page;
 }
 
+static u32 tcache_page_csum(struct page *page)
+{
+	void *addr = kmap_atomic(page);
+	u32 csum = jhash2(addr, PAGE_SIZE / 4, 17);
+
+	kunmap_atomic(addr);
+	return csum;
+}
+
+static bool tcache_pages_identical(struct page *page1, struct page *page2)
+{
+	char *addr1, *addr2;
+	int ret;
+
+	addr1 = kmap_atomic(page1);
+	addr2 = kmap_atomic(page2);
+	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	kunmap_atomic(addr2);
+	kunmap_atomic(addr1);
+	return ret == 0;
+}
+
+/* Find a shared copy of a page and take a reference to it */
+static struct tcache_shared *
+__tcache_dedup_lookup(struct tcache_dedup_bucket *b, u32 csum,
+		      struct page *page)
+{
+	struct tcache_shared *shared;
+
+	hlist_for_each_entry(shared, &b->head, hash) {
+		if (shared->csum == csum &&
+		    tcache_pages_identical(shared->page, page)) {
+			shared->nr_refs++;
+			return shared;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return a new reference to a shared copy of a page, making the copy if
+ * there is none yet, or NULL on allocation failure.
+ */
+static noinline_for_stack struct tcache_sref *
+tcache_dedup_page(struct page *page)
+{
+	struct tcache_dedup_bucket *b;
+	struct tcache_shared *shared, *new = NULL;
+	struct tcache_sref *sref;
+	unsigned long flags;
+	u32 csum;
+
+	sref = kmalloc(sizeof(*sref), TCACHE_GFP_MASK);
+	if (!sref)
+		return NULL;
+
+	csum = tcache_page_csum(page);
+	b = tcache_dedup_bucket(csum);
+
+	spin_lock_irqsave(&b->lock, flags);
+	shared = __tcache_dedup_lookup(b, csum, page);
+	spin_unlock_irqrestore(&b->lock, flags);
+	if (shared)
+		goto out;
+
+	new = kmalloc(sizeof(*new), TCACHE_GFP_MASK);
+	if (!new)
+		goto out_free_sref;
+	new->page = tcache_alloc_page();
+	if (!new->page)
+		goto out_free_new;
+	copy_highpage(new->page, page);
+	new->csum = csum;
+	new->nr_refs = 1;
+
+	/* Recheck, somebody could have added the same page meanwhile */
+	spin_lock_irqsave(&b->lock, flags);
+	shared = __tcache_dedup_lookup(b, csum, page);
+	if (!shared) {
+		shared = new;
+		new = NULL;
+		hlist_add_head(&shared->hash, &b->head);
+		__this_cpu_inc(nr_tcache_shared);
+		__inc_zone_page_state(shared->page, NR_FILE_PAGES);
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+
+	if (new) {
+		put_page(new->page);
+		kfree(new);
+	}
+out:
+	sref->shared = shared;
+	return sref;
+
+out_free_new:
+	kfree(new);
+out_free_sref:
+	kfree(sref);
+	return NULL;
+}
+
+/*
+ * Evict the coldest shared page reference. Returns true if one was evicted.
+ */
+static bool tcache_evict_sref(void)
+{
+	struct tcache_sref *sref;
+	struct tcache_node *node;
+	struct cleancache_filekey key;
+	unsigned long flags;
+	pgoff_t index;
+	int pool_id;
+	void *entry = NULL;
+
+	spin_lock_irqsave(&tcache_sref_lru_lock, flags);
+	if (list_empty(&tcache_sref_lru)) {
+		spin_unlock_irqrestore(&tcache_sref_lru_lock, flags);
+		return false;
+	}
+	sref = list_first_entry(&tcache_sref_lru, struct tcache_sref, lru);
+	list_move_tail(&sref->lru, &tcache_sref_lru);
+	pool_id = sref->pool_id;
+	index = sref->index;
+	key = sref->key;
+	spin_unlock_irqrestore(&tcache_sref_lru_lock, flags);
+
+	/*
+	 * The reference can be freed as soon as we drop the lock, so look it
+	 * up by its location, as tcache_zbud_evict does.
+	 */
+	node = tcache_get_node_and_pool(pool_id, &key, false);
+	if (node) {
+		local_irq_save(flags);
+		entry = tcache_page_tree_delete(node, index,
+						tcache_sref_to_entry(sref));
+		if (entry) {
+			trace_tcache_evict(pool_id, &key, index,
+					   TCACHE_EVICT_SHARED);
+			__this_cpu_inc(node->pool->stat->evicts);
+			ub_percpu_inc(node->pool->ub, tcache_evict);
+		}
+		local_irq_restore(flags);
+		tcache_put_node_and_pool(node);
+	}
+
+	tcache_put_entry(entry);
+	return entry != NULL;
+}
+
+/* Shared page references are not per node, spread them evenly */
+static unsigned long tcache_sref_count(void)
+{
+	return tcache_nr_srefs / num_online_nodes();
+}
+
+/* Compressed pages are not per node, spread them evenly */
+static unsigned long tcache_zbud_count(void)
+{
+	if (!tcache_zbud_pool)
+		return 0;
+	return zbud_get_pool_size(tcache_zbud_pool) / num_online_nodes();
+}
+
 static unsigned long tcache_shrink_count(struct shrinker *shrink,
 					 struct shrink_control *sc)
 {
-	return tcache_lru_node[sc->nid].nr_items;
+	return tcache_lru_node[sc->nid].nr_items + tcache_sref_count() +
+		tcache_zbud_count();
 }
 
 static unsigned long tcache_shrink_scan(struct shrinker *shrink,
@@ -801,13 +1562,27 @@ static unsigned long tcache_shrink_scan(struct shrinker *shrink,
 	unsigned long nr_reclaimed = 0;
 
 	while (lru->nr_items > 0 && sc->nr_to_scan > 0) {
-		page = __tcache_try_to_reclaim_page(lru);
+		page = __tcache_try_to_reclaim_page(lru, TCACHE_EVICT_SHRINK);
 		if (page) {
 			put_page(page);
 			nr_reclaimed++;
 		}
 		sc->nr_to_scan--;
 	}
+
+	/* Raw pages are gone, now shared page references */
+	while (sc->nr_to_scan > 0 && tcache_sref_count() > 0) {
+		if (tcache_evict_sref())
+			nr_reclaimed++;
+		sc->nr_to_scan--;
+	}
+
+	/* And the compressed ones */
+	while (sc->nr_to_scan > 0 && tcache_zbud_count() > 0) {
+		if (!zbud_reclaim_page(tcache_zbud_pool, 8))
+			nr_reclaimed++;
+		sc->nr_to_scan--;
+	}
 	return nr_reclaimed;
 }
 
@@ -821,7 +1596,18 @@ struct shrinker tcache_shrinker = {
 static int tcache_cleancache_init_fs(size_t pagesize)
 {
 	BUG_ON(pagesize != PAGE_SIZE);
-	return tcache_create_pool();
+	return tcache_create_pool(NULL);
+}
+
+static int tcache_cleancache_init_fs_uuid(char *uuid, size_t pagesize)
+{
+	int id;
+
+	BUG_ON(pagesize != PAGE_SIZE);
+	id = tcache_restore_pool(uuid);
+	if (id >= 0)
+		return id;
+	return tcache_create_pool(uuid);
 }
 
 static int tcache_cleancache_init_shared_fs(char *uuid, size_t pagesize)
@@ -835,62 +1621,100 @@ static void tcache_cleancache_put_page(int pool_id,
 {
 	struct tcache_node *node;
 	struct page *cache_page = NULL;
+	struct tcache_sref *sref = NULL;
+	void *entry = NULL;
+	int err = -ENOMEM;
 
 	node = tcache_get_node_and_pool(pool_id, &key, true);
 	if (node) {
-		if (tcache_active && !(current->flags & PF_MEMALLOC))
-			cache_page = tcache_alloc_page();
-		if (cache_page) {
+		if (tcache_active && !(current->flags & PF_MEMALLOC)) {
+			if (tcache_dedup_hash)
+				sref = tcache_dedup_page(page);
+			else
+				cache_page = tcache_alloc_page();
+		}
+		if (sref)
+			err = tcache_attach_sref(node, index, sref);
+		else if (cache_page) {
 			copy_highpage(cache_page, page);
 			/* cleancache does not care about failures */
-			(void)tcache_attach_page(node, index, cache_page);
+			err = tcache_attach_page(node, index, cache_page);
 		} else
-			cache_page = tcache_detach_page(node, index);
+			entry = tcache_detach_page(node, index);
+		if (!err)
+			this_cpu_inc(node->pool->stat->puts);
 		tcache_put_node_and_pool(node);
 	}
+	trace_tcache_put_page(pool_id, &key, index, err);
 
 	if (cache_page)
 		put_page(cache_page);
+	tcache_put_entry(entry);
 }
 
 static int tcache_cleancache_get_page(int pool_id,
 				      struct cleancache_filekey key,
 				      pgoff_t index, struct page *page)
 {
+	struct tcache_pool *pool;
 	struct tcache_node *node;
-	struct page *cache_page = NULL;
+	void *entry = NULL;
+	int ret = -1;
 
-	node = tcache_get_node_and_pool(pool_id, &key, false);
+	pool = tcache_get_pool(pool_id);
+	if (!pool)
+		return -1;
+
+	node = tcache_get_node(pool, &key, false);
 	if (node) {
-		cache_page = tcache_detach_page(node, index);
-		if (unlikely(cache_page && node->invalidated)) {
-			put_page(cache_page);
-			cache_page = NULL;
+		entry = tcache_detach_page(node, index);
+		if (unlikely(entry && node->invalidated)) {
+			tcache_put_entry(entry);
+			entry = NULL;
 		}
-		tcache_put_node_and_pool(node);
+		tcache_put_node(node);
 	}
 
-	if (cache_page) {
-		copy_highpage(page, cache_page);
-		put_page(cache_page);
-		return 0;
+	if (entry && tcache_entry_is_sref(entry)) {
+		copy_highpage(page, tcache_entry_to_sref(entry)->shared->page);
+		ret = 0;
+	} else if (entry && radix_tree_exceptional_entry(entry)) {
+		preempt_disable();
+		if (!tcache_decompress_page(tcache_entry_to_handle(entry), page))
+			ret = 0;
+		preempt_enable();
+	} else if (entry) {
+		copy_highpage(page, entry);
+		ret = 0;
 	}
-	return -1;
+	tcache_put_entry(entry);
+
+	trace_tcache_get_page(pool_id, &key, index, ret);
+	this_cpu_inc(pool->stat->gets);
+	if (ret)
+		ub_percpu_inc(pool->ub, tcache_miss);
+	else {
+		this_cpu_inc(pool->stat->hits);
+		ub_percpu_inc(pool->ub, tcache_hit);
+	}
+	tcache_put_pool(pool);
+	return ret;
 }
 
 static void tcache_cleancache_invalidate_page(int pool_id,
 		struct cleancache_filekey key, pgoff_t index)
 {
 	struct tcache_node *node;
-	struct page *page;
+	void *entry = NULL;
 
 	node = tcache_get_node_and_pool(pool_id, &key, false);
 	if (node) {
-		page = tcache_detach_page(node, index);
-		if (page)
-			put_page(page);
+		entry = tcache_detach_page(node, index);
 		tcache_put_node_and_pool(node);
 	}
+	trace_tcache_invalidate_page(pool_id, &key, index,
+				     entry ? 0 : -ENOENT);
+	tcache_put_entry(entry);
 }
 
 static void tcache_cleancache_invalidate_inode(int pool_id,
@@ -898,6 +1722,7 @@ static void tcache_cleancache_invalidate_inode(int pool_id,
 {
 	struct tcache_pool *pool;
 
+	trace_tcache_invalidate_inode(pool_id, &key);
 	pool = tcache_get_pool(pool_id);
 	if (pool) {
 		tcache_invalidate_node(pool, &key);
@@ -907,11 +1732,13 @@ static void tcache_cleancache_invalidate_inode(int pool_id,
 
 static void tcache_cleancache_invalidate_fs(int pool_id)
 {
-	tcache_destroy_pool(pool_id);
+	if (!tcache_keep_pool(pool_id))
+		tcache_destroy_pool(pool_id);
 }
 
 static struct cleancache_ops tcache_cleancache_ops = {
 	.init_fs		= tcache_cleancache_init_fs,
+	.init_fs_uuid		= tcache_cleancache_init_fs_uuid,
 	.init_shared_fs		= tcache_cleancache_init_shared_fs,
 	.put_page		= tcache_cleancache_put_page,
 	.get_page		= tcache_cleancache_get_page,
@@ -920,22 +1747,208 @@ static struct cleancache_ops tcache_cleancache_ops = {
 	.invalidate_fs		= tcache_cleancache_invalidate_fs,
 };
 
-static int param_get_nr_pages(char *buffer, const struct kernel_param *kp)
+/* Sum of a per cpu counter given by kp->arg */
+static int param_get_pcpu_sum(char *buffer, const struct kernel_param *kp)
 {
+	long __percpu *pcp = kp->arg;
 	int cpu;
 	long val = 0;
 
 	for_each_possible_cpu(cpu)
-		val += per_cpu(nr_tcache_pages, cpu);
+		val += *per_cpu_ptr(pcp, cpu);
 	if (val < 0)
 		val = 0;
 	return sprintf(buffer, "%lu", val);
 }
 
-static struct kernel_param_ops param_ops_nr_pages = {
-	.get = param_get_nr_pages,
+static struct kernel_param_ops param_ops_pcpu_sum = {
+	.get = param_get_pcpu_sum,
+};
+module_param_cb(nr_pages, &param_ops_pcpu_sum, &nr_tcache_pages, 0444);
+module_param_cb(nr_zpages, &param_ops_pcpu_sum, &nr_tcache_zpages, 0444);
+module_param_cb(nr_decompress, &param_ops_pcpu_sum,
+		&nr_tcache_decompress, 0444);
+module_param_cb(decompress_ns, &param_ops_pcpu_sum,
+		&tcache_decompress_ns, 0444);
+module_param_cb(nr_shared, &param_ops_pcpu_sum, &nr_tcache_shared, 0444);
+
+/*
+ * Writing a file system UUID to tcache.keep asks to keep the pool of the
+ * mounted file system after its next unmount. Reading lists the pools to be
+ * kept and those which are kept.
+ */
+static int tcache_parse_uuid(const char *str, u8 *uuid)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < 16; i++) {
+		if (*str == '-')
+			str++;
+		hi = hex_to_bin(str[0]);
+		lo = hi < 0 ? -1 : hex_to_bin(str[1]);
+		if (lo < 0)
+			return -EINVAL;
+		uuid[i] = (hi << 4) | lo;
+		str += 2;
+	}
+	return *str && *str != '\n' ? -EINVAL : 0;
+}
+
+static int param_set_keep(const char *val, const struct kernel_param *kp)
+{
+	struct tcache_pool *pool;
+	u8 uuid[16];
+	int id, err;
+
+	err = tcache_parse_uuid(val, uuid);
+	if (err)
+		return err;
+
+	err = -ENOENT;
+	spin_lock(&tcache_pool_lock);
+	idr_for_each_entry(&tcache_pool_idr, pool, id) {
+		if (pool->has_uuid && list_empty(&pool->kept_list) &&
+		    !memcmp(pool->uuid, uuid, sizeof(uuid))) {
+			pool->keep = true;
+			err = 0;
+		}
+	}
+	spin_unlock(&tcache_pool_lock);
+	return err;
+}
+
+static int param_get_keep(char *buffer, const struct kernel_param *kp)
+{
+	struct tcache_pool *pool;
+	int id, len = 0;
+
+	spin_lock(&tcache_pool_lock);
+	idr_for_each_entry(&tcache_pool_idr, pool, id) {
+		if (len > PAGE_SIZE - 64)
+			break;
+		if (pool->keep)
+			len += sprintf(buffer + len, "%pUb\n", pool->uuid);
+		else if (!list_empty(&pool->kept_list))
+			len += sprintf(buffer + len, "%pUb kept\n",
+				       pool->uuid);
+	}
+	spin_unlock(&tcache_pool_lock);
+	return len;
+}
+
+static struct kernel_param_ops param_ops_keep = {
+	.set = param_set_keep,
+	.get = param_get_keep,
 };
-module_param_cb(nr_pages, &param_ops_nr_pages, NULL, 0444);
+module_param_cb(keep, &param_ops_keep, NULL, 0644);
+
+static int param_get_zpool_pages(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%llu", tcache_zbud_pool ?
+		       zbud_get_pool_size(tcache_zbud_pool) : 0);
+}
+
+static struct kernel_param_ops param_ops_zpool_pages = {
+	.get = param_get_zpool_pages,
+};
+module_param_cb(zpool_pages, &param_ops_zpool_pages, NULL, 0444);
+
+#ifdef CONFIG_BEANCOUNTERS
+static int tcache_bc_show(struct seq_file *f, void *v)
+{
+	struct user_beancounter *ub = seq_beancounter(f);
+
+	seq_printf(f, bc_proc_lu_lfmt, "pages",
+		   ub->ub_parms[UB_TCACHEPAGES].held);
+	seq_printf(f, bc_proc_lu_lfmt, "hit", ub_percpu_sum(ub, tcache_hit));
+	seq_printf(f, bc_proc_lu_lfmt, "miss", ub_percpu_sum(ub, tcache_miss));
+	seq_printf(f, bc_proc_lu_lfmt, "evict",
+		   ub_percpu_sum(ub, tcache_evict));
+	return 0;
+}
+
+static struct bc_proc_entry tcache_bc_entry = {
+	.name = "tcache",
+	.u.show = tcache_bc_show,
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *tcache_debugfs_root;
+
+static int tcache_pools_show(struct seq_file *m, void *v)
+{
+	struct tcache_pool_stat sum, *st;
+	struct tcache_pool *pool;
+	int id, cpu;
+
+	seq_printf(m, "%-6s %12s %12s %12s %12s %5s\n", "pool",
+		   "puts", "gets", "hits", "evicts", "hit%");
+
+	rcu_read_lock();
+	idr_for_each_entry(&tcache_pool_idr, pool, id) {
+		if (!tcache_grab_pool(pool))
+			continue;
+
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			st = per_cpu_ptr(pool->stat, cpu);
+			sum.puts += st->puts;
+			sum.gets += st->gets;
+			sum.hits += st->hits;
+			sum.evicts += st->evicts;
+		}
+		tcache_put_pool(pool);
+
+		seq_printf(m, "%-6d %12lu %12lu %12lu %12lu %5lu\n", id,
+			   sum.puts, sum.gets, sum.hits, sum.evicts,
+			   sum.gets ? sum.hits * 100 / sum.gets : 0);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static int tcache_pools_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tcache_pools_show, NULL);
+}
+
+static const struct file_operations tcache_pools_fops = {
+	.open		= tcache_pools_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init tcache_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return;
+
+	tcache_debugfs_root = debugfs_create_dir("tcache", NULL);
+	if (!tcache_debugfs_root)
+		return;
+
+	debugfs_create_file("pools", S_IRUSR, tcache_debugfs_root, NULL,
+			    &tcache_pools_fops);
+}
+#else
+static inline void tcache_debugfs_init(void) { }
+#endif
+
+static int tcache_cpu_notify(struct notifier_block *self,
+			     unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+	unsigned long flags;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		local_irq_save(flags);
+		tcache_lru_drain(&per_cpu(tcache_lru_pvec, cpu));
+		local_irq_restore(flags);
+	}
+	return NOTIFY_OK;
+}
 
 static int __init tcache_lru_init(void)
 {
@@ -950,9 +1963,33 @@ static int __init tcache_lru_init(void)
 		spin_lock_init(&tcache_lru_node[i].lock);
 		INIT_LIST_HEAD(&tcache_lru_node[i].list);
 	}
+	hotcpu_notifier(tcache_cpu_notify, 0);
 	return 0;
 }
 
+static void __init tcache_dedup_init(void)
+{
+	unsigned long size, i;
+
+	if (!tcache_dedup)
+		return;
+
+	/* About a bucket per 64 pages of RAM */
+	tcache_dedup_hash_bits = clamp(ilog2(totalram_pages / 64 + 1), 10, 18);
+	size = 1UL << tcache_dedup_hash_bits;
+
+	tcache_dedup_hash = vmalloc(size * sizeof(*tcache_dedup_hash));
+	if (!tcache_dedup_hash) {
+		pr_warn("tcache: deduplication disabled\n");
+		return;
+	}
+
+	for (i = 0; i < size; i++) {
+		INIT_HLIST_HEAD(&tcache_dedup_hash[i].head);
+		spin_lock_init(&tcache_dedup_hash[i].lock);
+	}
+}
+
 static int __init tcache_init(void)
 {
 	int err;
@@ -972,10 +2009,17 @@ static int __init tcache_init(void)
 	num_node_trees = roundup_pow_of_two(2 * num_possible_cpus());
 #endif
 
+	tcache_dedup_init();
+
 	err = cleancache_register_ops(&tcache_cleancache_ops);
 	if (err)
 		goto out_unregister_shrinker;
 
+#ifdef CONFIG_BEANCOUNTERS
+	bc_register_proc_entry(&tcache_bc_entry);
+#endif
+	tcache_debugfs_init();
+
 	pr_info("tcache loaded\n");
 	return 0;
 
@@ -988,5 +2032,59 @@ out_fail:
 }
 module_init(tcache_init);
 
+/*
+ * Compressors are registered by the crypto layer, which is initialized after
+ * us, hence late_initcall. Without a compressor tcache keeps raw pages only.
+ */
+static int __init tcache_comp_init(void)
+{
+	struct crypto_comp *tfm;
+	u8 *buf;
+	int cpu;
+
+	if (!tcache_enabled)
+		return 0;
+
+	if (!crypto_has_comp(tcache_compressor, 0, 0)) {
+		pr_info("tcache: %s compressor not available\n",
+			tcache_compressor);
+		tcache_compressor = TCACHE_COMPRESSOR_DEFAULT;
+		if (!crypto_has_comp(tcache_compressor, 0, 0))
+			return 0;
+	}
+
+	for_each_possible_cpu(cpu) {
+		tfm = crypto_alloc_comp(tcache_compressor, 0, 0);
+		if (IS_ERR(tfm))
+			goto out_free;
+		per_cpu(tcache_comp_tfm, cpu) = tfm;
+
+		buf = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+		if (!buf)
+			goto out_free;
+		per_cpu(tcache_comp_buf, cpu) = buf;
+	}
+
+	tcache_zbud_pool = zbud_create_pool(GFP_KERNEL, &tcache_zbud_ops);
+	if (!tcache_zbud_pool)
+		goto out_free;
+
+	pr_info("tcache: using %s compressor\n", tcache_compressor);
+	return 0;
+
+out_free:
+	for_each_possible_cpu(cpu) {
+		tfm = per_cpu(tcache_comp_tfm, cpu);
+		if (tfm && !IS_ERR(tfm))
+			crypto_free_comp(tfm);
+		per_cpu(tcache_comp_tfm, cpu) = NULL;
+		kfree(per_cpu(tcache_comp_buf, cpu));
+		per_cpu(tcache_comp_buf, cpu) = NULL;
+	}
+	pr_warn("tcache: compression disabled\n");
+	return 0;
+}
+late_initcall(tcache_comp_init);
+
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Transcendent file cache");
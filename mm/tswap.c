@@ -13,13 +13,29 @@
 #include <linux/pagemap.h>
 #include <linux/shrinker.h>
 #include <linux/frontswap.h>
+#include <linux/writeback.h>
+#include <linux/blkdev.h>
+#include <linux/kthread.h>
+#include <linux/nodemask.h>
+#include <linux/sort.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/tswap.h>
 
 #define TSWAP_GFP_MASK		(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN)
 
-static RADIX_TREE(tswap_page_tree, GFP_ATOMIC | __GFP_NOWARN);
-static DEFINE_SPINLOCK(tswap_lock);
-
+/*
+ * Pages are kept on the NUMA node they were stored on: each node has its own
+ * page tree, LRU and lock, so that the shrinker reclaims the node which is
+ * under pressure without contending with the others. A swap entry is looked
+ * up on the local node first.
+ */
 struct tswap_lru {
+	spinlock_t lock;
+	struct radix_tree_root page_tree;
 	struct list_head list;
 	unsigned long nr_items;
 } ____cacheline_aligned_in_smp;
@@ -34,39 +50,130 @@ module_param_named(enabled, tswap_enabled, bool, 0444);
 static bool tswap_active __read_mostly;
 module_param_named(active, tswap_active, bool, 0644);
 
-/* Total number of pages cached */
-static unsigned long tswap_nr_pages;
-module_param_named(nr_pages, tswap_nr_pages, ulong, 0444);
+/* Max number of pages written back to swap in one go */
+#define TSWAP_WB_BATCH_MAX	256
+static unsigned int tswap_wb_batch __read_mostly = 64;
+module_param_named(writeback_batch, tswap_wb_batch, uint, 0644);
+
+/*
+ * Pages are written back to the swap device by tswapd, not by the shrinker:
+ * the shrinker only marks the node which is under pressure and wakes tswapd
+ * up. Written pages are in swap cache and get freed by the regular reclaim.
+ */
+static struct task_struct *tswap_wb_task;
+static DECLARE_WAIT_QUEUE_HEAD(tswap_wb_wait);
+static nodemask_t tswap_wb_nodes;
+
+/*
+ * Statistics, reported in debugfs. The age of a page is the time it spent in
+ * tswap, counted in log2 seconds buckets; the store time is kept in
+ * page->index, which is not used otherwise while the page is ours.
+ */
+#define TSWAP_AGE_BUCKETS	16
+
+enum {
+	TSWAP_STAT_STORE,
+	TSWAP_STAT_LOAD,
+	TSWAP_STAT_HIT,
+	TSWAP_STAT_INVALIDATE,
+	TSWAP_STAT_EVICT,
+	TSWAP_STAT_NR,
+};
+
+struct tswap_stat {
+	unsigned long events[TSWAP_STAT_NR];
+	unsigned long hit_age[TSWAP_AGE_BUCKETS];
+	unsigned long evict_age[TSWAP_AGE_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct tswap_stat, tswap_stat);
+
+static inline void tswap_stat_inc(int item)
+{
+	this_cpu_inc(tswap_stat.events[item]);
+}
+
+static inline unsigned long tswap_page_age(struct page *page)
+{
+	return jiffies - page->index;
+}
+
+static inline int tswap_age_bucket(unsigned long age)
+{
+	return min_t(int, ilog2(age / HZ + 1), TSWAP_AGE_BUCKETS - 1);
+}
 
-static void tswap_lru_add(struct page *page)
+static void tswap_account_hit(struct page *page)
 {
-	struct tswap_lru *lru = &tswap_lru_node[page_to_nid(page)];
+	unsigned long age = tswap_page_age(page);
+
+	tswap_stat_inc(TSWAP_STAT_HIT);
+	this_cpu_inc(tswap_stat.hit_age[tswap_age_bucket(age)]);
+}
+
+static void tswap_account_evict(swp_entry_t entry, struct page *page,
+				int reason)
+{
+	unsigned long age = tswap_page_age(page);
+
+	trace_tswap_evict(swp_type(entry), swp_offset(entry), age, reason);
+	tswap_stat_inc(TSWAP_STAT_EVICT);
+	this_cpu_inc(tswap_stat.evict_age[tswap_age_bucket(age)]);
+}
+
+/* Total number of pages cached */
+static int param_get_nr_pages(char *buffer, const struct kernel_param *kp)
+{
+	unsigned long val = 0;
+	int i;
+
+	for (i = 0; tswap_lru_node && i < nr_node_ids; i++)
+		val += tswap_lru_node[i].nr_items;
+	return sprintf(buffer, "%lu", val);
+}
+
+static struct kernel_param_ops param_ops_nr_pages = {
+	.get = param_get_nr_pages,
+};
+module_param_cb(nr_pages, &param_ops_nr_pages, NULL, 0444);
 
+/* Walk nodes starting from the local one */
+#define for_each_tswap_lru(lru, i, start)				\
+	for (i = 0, start = numa_node_id(); i < nr_node_ids &&		\
+	     (lru = &tswap_lru_node[(start + i) % nr_node_ids]); i++)
+
+static void tswap_lru_add(struct tswap_lru *lru, struct page *page)
+{
 	list_add_tail(&page->lru, &lru->list);
 	lru->nr_items++;
 }
 
-static void tswap_lru_del(struct page *page)
+static void tswap_lru_del(struct tswap_lru *lru, struct page *page)
 {
-	struct tswap_lru *lru = &tswap_lru_node[page_to_nid(page)];
-
 	list_del(&page->lru);
 	lru->nr_items--;
 }
 
 static struct page *tswap_lookup_page(swp_entry_t entry)
 {
-	struct page *page;
-
-	spin_lock(&tswap_lock);
-	page = radix_tree_lookup(&tswap_page_tree, entry.val);
-	spin_unlock(&tswap_lock);
+	struct tswap_lru *lru;
+	struct page *page = NULL;
+	int i, start;
+
+	for_each_tswap_lru(lru, i, start) {
+		spin_lock(&lru->lock);
+		page = radix_tree_lookup(&lru->page_tree, entry.val);
+		spin_unlock(&lru->lock);
+		if (page)
+			break;
+	}
 	BUG_ON(page && page_private(page) != entry.val);
 	return page;
 }
 
 static int tswap_insert_page(swp_entry_t entry, struct page *page)
 {
+	struct tswap_lru *lru;
 	int err;
 
 	err = radix_tree_preload(TSWAP_GFP_MASK);
@@ -74,29 +181,45 @@ static int tswap_insert_page(swp_entry_t entry, struct page *page)
 		return err;
 
 	set_page_private(page, entry.val);
-	spin_lock(&tswap_lock);
-	err = radix_tree_insert(&tswap_page_tree, entry.val, page);
-	if (!err) {
-		tswap_lru_add(page);
-		tswap_nr_pages++;
-	}
-	spin_unlock(&tswap_lock);
+	lru = &tswap_lru_node[page_to_nid(page)];
+	spin_lock(&lru->lock);
+	err = radix_tree_insert(&lru->page_tree, entry.val, page);
+	if (!err)
+		tswap_lru_add(lru, page);
+	spin_unlock(&lru->lock);
 
 	radix_tree_preload_end();
 	return err;
 }
 
-static struct page *tswap_delete_page(swp_entry_t entry, struct page *expected)
+static struct page *__tswap_delete_page(struct tswap_lru *lru,
+				       swp_entry_t entry, struct page *expected)
 {
 	struct page *page;
 
-	spin_lock(&tswap_lock);
-	page = radix_tree_delete_item(&tswap_page_tree, entry.val, expected);
-	if (page) {
-		tswap_lru_del(page);
-		tswap_nr_pages--;
-	}
-	spin_unlock(&tswap_lock);
+	spin_lock(&lru->lock);
+	page = radix_tree_delete_item(&lru->page_tree, entry.val, expected);
+	if (page)
+		tswap_lru_del(lru, page);
+	spin_unlock(&lru->lock);
+	return page;
+}
+
+static struct page *tswap_delete_page(swp_entry_t entry, struct page *expected)
+{
+	struct tswap_lru *lru;
+	struct page *page = NULL;
+	int i, start;
+
+	if (expected)
+		page = __tswap_delete_page(&tswap_lru_node[page_to_nid(expected)],
+					   entry, expected);
+	else
+		for_each_tswap_lru(lru, i, start) {
+			page = __tswap_delete_page(lru, entry, NULL);
+			if (page)
+				break;
+		}
 	if (page) {
 		BUG_ON(expected && page != expected);
 		BUG_ON(page_private(page) != entry.val);
@@ -152,6 +275,8 @@ retry:
 			 */
 			err = -ENOENT;
 			if (tswap_delete_page(entry, page)) {
+				tswap_account_evict(entry, page,
+						    TSWAP_EVICT_SWAPCACHE);
 				SetPageDirty(found_page);
 				put_page(page);
 				err = 0;
@@ -196,6 +321,7 @@ retry:
 
 	/* the page is now in the swap cache, remove it from tswap */
 	BUG_ON(!tswap_delete_page(entry, page));
+	tswap_account_evict(entry, page, TSWAP_EVICT_WRITEBACK);
 	put_page(page);
 
 	lru_cache_add_anon(page);
@@ -209,42 +335,113 @@ out:
 	return err;
 }
 
-static unsigned long tswap_shrink_scan(struct shrinker *shrink,
-				       struct shrink_control *sc)
+static int tswap_wb_cmp(const void *a, const void *b)
 {
-	struct tswap_lru *lru = &tswap_lru_node[sc->nid];
-	unsigned long nr_reclaimed = 0;
+	unsigned long x = page_private(*(struct page **)a);
+	unsigned long y = page_private(*(struct page **)b);
 
-	spin_lock(&tswap_lock);
-	while (sc->nr_to_scan-- > 0) {
-		struct page *page;
+	return x < y ? -1 : x > y;
+}
 
-		if (!lru->nr_items)
-			break;
-		
+/*
+ * Take up to nr cold pages from the node LRU, locked and referenced. Pages
+ * are left on the LRU, tswap_evict_page removes them.
+ */
+static int tswap_wb_isolate(struct tswap_lru *lru, struct page **pages,
+			    int nr)
+{
+	unsigned long nr_scan;
+	struct page *page;
+	int n = 0;
+
+	spin_lock(&lru->lock);
+	for (nr_scan = lru->nr_items; nr_scan > 0 && n < nr; nr_scan--) {
 		page = list_first_entry(&lru->list, struct page, lru);
+		list_move_tail(&page->lru, &lru->list);
 		/* lock the page to avoid interference with
 		 * other reclaiming threads */
-		if (!trylock_page(page)) {
-			list_move_tail(&page->lru, &lru->list);
-			cond_resched_lock(&tswap_lock);
+		if (!trylock_page(page))
 			continue;
-		}
 		get_page(page);
-		spin_unlock(&tswap_lock);
-
-		if (tswap_evict_page(page) == 0)
-			nr_reclaimed++;
+		pages[n++] = page;
+	}
+	spin_unlock(&lru->lock);
+	return n;
+}
 
-		unlock_page(page);
+/*
+ * Move a batch of cold pages of a node to swap cache and write them out,
+ * sorted by swap offset so that the block layer can merge them.
+ */
+static void tswap_writeback_node(int nid)
+{
+	static struct page *pages[TSWAP_WB_BATCH_MAX];
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct blk_plug plug;
+	struct page *page;
+	int i, nr;
+
+	nr = tswap_wb_isolate(&tswap_lru_node[nid], pages,
+			clamp_t(unsigned int, tswap_wb_batch,
+				1, TSWAP_WB_BATCH_MAX));
+	if (!nr)
+		return;
+
+	sort(pages, nr, sizeof(pages[0]), tswap_wb_cmp, NULL);
+	wbc.nr_to_write = nr;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		page = pages[i];
+		if (tswap_evict_page(page) == 0 &&
+		    clear_page_dirty_for_io(page)) {
+			/* let the page be freed as soon as it is written */
+			SetPageReclaim(page);
+			/* bypass frontswap, it would store it back to us */
+			__swap_writepage(page, &wbc, end_swap_bio_write);
+		} else
+			unlock_page(page);
 		put_page(page);
+	}
+	blk_finish_plug(&plug);
+}
 
-		cond_resched();
-		spin_lock(&tswap_lock);
+static int tswap_writeback_fn(void *data)
+{
+	int nid;
+
+	/* we are a reclaimer, see also tswap_frontswap_store */
+	current->flags |= PF_MEMALLOC | PF_SWAPWRITE;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(tswap_wb_wait,
+					 !nodes_empty(tswap_wb_nodes) ||
+					 kthread_should_stop());
+
+		for_each_node_mask(nid, tswap_wb_nodes) {
+			node_clear(nid, tswap_wb_nodes);
+			tswap_writeback_node(nid);
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static unsigned long tswap_shrink_scan(struct shrinker *shrink,
+				       struct shrink_control *sc)
+{
+	if (!tswap_lru_node[sc->nid].nr_items)
+		return SHRINK_STOP;
+
+	if (!node_isset(sc->nid, tswap_wb_nodes)) {
+		node_set(sc->nid, tswap_wb_nodes);
+		wake_up_interruptible(&tswap_wb_wait);
 	}
-	spin_unlock(&tswap_lock);
 
-	return nr_reclaimed;
+	/* pages are freed by the regular reclaim once written */
+	return SHRINK_STOP;
 }
 
 static struct shrinker tswap_shrinker = {
@@ -257,7 +454,7 @@ static struct shrinker tswap_shrinker = {
 static void tswap_frontswap_init(unsigned type)
 {
 	/*
-	 * We maintain the single page tree for all swap types, so nothing to
+	 * We maintain the same page trees for all swap types, so nothing to
 	 * do here.
 	 */
 }
@@ -276,12 +473,15 @@ static int tswap_frontswap_store(unsigned type, pgoff_t offset,
 	if (cache_page)
 		goto copy;
 
+	err = -1;
 	if (current->flags & PF_MEMALLOC)
-		return -1;
+		goto out;
 
-	cache_page = alloc_page(TSWAP_GFP_MASK | __GFP_HIGHMEM);
+	/* Keep the page close to whoever is going to fault it back */
+	cache_page = alloc_pages_node(numa_node_id(),
+				      TSWAP_GFP_MASK | __GFP_HIGHMEM, 0);
 	if (!cache_page)
-		return -1;
+		goto out;
 
 	err = tswap_insert_page(entry, cache_page);
 	if (err) {
@@ -291,11 +491,16 @@ static int tswap_frontswap_store(unsigned type, pgoff_t offset,
 		 */
 		BUG_ON(err == -EEXIST);
 		put_page(cache_page);
-		return -1;
+		err = -1;
+		goto out;
 	}
 copy:
 	copy_highpage(cache_page, page);
-	return 0;
+	cache_page->index = jiffies;
+	tswap_stat_inc(TSWAP_STAT_STORE);
+out:
+	trace_tswap_store(type, offset, err);
+	return err;
 }
 
 static int tswap_frontswap_load(unsigned type, pgoff_t offset,
@@ -303,10 +508,13 @@ static int tswap_frontswap_load(unsigned type, pgoff_t offset,
 {
 	struct page *cache_page;
 
+	tswap_stat_inc(TSWAP_STAT_LOAD);
 	cache_page = tswap_delete_page(swp_entry(type, offset), NULL);
+	trace_tswap_load(type, offset, cache_page ? 0 : -1);
 	if (!cache_page)
 		return -1;
 
+	tswap_account_hit(cache_page);
 	copy_highpage(page, cache_page);
 	put_page(cache_page);
 	return 0;
@@ -317,8 +525,11 @@ static void tswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	struct page *cache_page;
 
 	cache_page = tswap_delete_page(swp_entry(type, offset), NULL);
-	if (cache_page)
+	trace_tswap_invalidate_page(type, offset, cache_page ? 0 : -ENOENT);
+	if (cache_page) {
+		tswap_stat_inc(TSWAP_STAT_INVALIDATE);
 		put_page(cache_page);
+	}
 }
 
 static void tswap_frontswap_invalidate_area(unsigned type)
@@ -338,6 +549,80 @@ static struct frontswap_ops tswap_frontswap_ops = {
 	.invalidate_area = tswap_frontswap_invalidate_area,
 };
 
+#ifdef CONFIG_DEBUG_FS
+static const char * const tswap_stat_names[TSWAP_STAT_NR] = {
+	[TSWAP_STAT_STORE]	= "stores",
+	[TSWAP_STAT_LOAD]	= "loads",
+	[TSWAP_STAT_HIT]	= "hits",
+	[TSWAP_STAT_INVALIDATE]	= "invalidates",
+	[TSWAP_STAT_EVICT]	= "evicts",
+};
+
+static struct dentry *tswap_debugfs_root;
+
+static int tswap_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long events[TSWAP_STAT_NR] = { 0 };
+	unsigned long hit_age[TSWAP_AGE_BUCKETS] = { 0 };
+	unsigned long evict_age[TSWAP_AGE_BUCKETS] = { 0 };
+	unsigned long nr_pages = 0;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct tswap_stat *st = per_cpu_ptr(&tswap_stat, cpu);
+
+		for (i = 0; i < TSWAP_STAT_NR; i++)
+			events[i] += st->events[i];
+		for (i = 0; i < TSWAP_AGE_BUCKETS; i++) {
+			hit_age[i] += st->hit_age[i];
+			evict_age[i] += st->evict_age[i];
+		}
+	}
+	for (i = 0; i < nr_node_ids; i++)
+		nr_pages += tswap_lru_node[i].nr_items;
+
+	seq_printf(m, "pages %lu\n", nr_pages);
+	for (i = 0; i < TSWAP_STAT_NR; i++)
+		seq_printf(m, "%s %lu\n", tswap_stat_names[i], events[i]);
+	seq_printf(m, "hit_rate %lu%%\n", events[TSWAP_STAT_LOAD] ?
+		   events[TSWAP_STAT_HIT] * 100 / events[TSWAP_STAT_LOAD] : 0);
+
+	/* bucket i holds pages aged [2^i - 1, 2^(i+1) - 1) seconds */
+	seq_puts(m, "age_sec hits evicts\n");
+	for (i = 0; i < TSWAP_AGE_BUCKETS; i++)
+		seq_printf(m, "%lu %lu %lu\n", (1UL << i) - 1,
+			   hit_age[i], evict_age[i]);
+	return 0;
+}
+
+static int tswap_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tswap_stats_show, NULL);
+}
+
+static const struct file_operations tswap_stats_fops = {
+	.open		= tswap_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init tswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return;
+
+	tswap_debugfs_root = debugfs_create_dir("tswap", NULL);
+	if (!tswap_debugfs_root)
+		return;
+
+	debugfs_create_file("stats", S_IRUSR, tswap_debugfs_root, NULL,
+			    &tswap_stats_fops);
+}
+#else
+static inline void tswap_debugfs_init(void) { }
+#endif
+
 static int __init tswap_lru_init(void)
 {
 	int i;
@@ -347,8 +632,12 @@ static int __init tswap_lru_init(void)
 	if (!tswap_lru_node)
 		return -ENOMEM;
 
-	for (i = 0; i < nr_node_ids; i++)
+	for (i = 0; i < nr_node_ids; i++) {
+		spin_lock_init(&tswap_lru_node[i].lock);
+		INIT_RADIX_TREE(&tswap_lru_node[i].page_tree,
+				GFP_ATOMIC | __GFP_NOWARN);
 		INIT_LIST_HEAD(&tswap_lru_node[i].list);
+	}
 	return 0;
 }
 
@@ -364,9 +653,17 @@ static int __init tswap_init(void)
 	if (err)
 		goto out_fail;
 
+	tswap_wb_task = kthread_run(tswap_writeback_fn, NULL, "tswapd");
+	if (IS_ERR(tswap_wb_task)) {
+		err = PTR_ERR(tswap_wb_task);
+		goto out_free_lru;
+	}
+
 	err = register_shrinker(&tswap_shrinker);
 	if (err)
-		goto out_free_lru;
+		goto out_stop_wb;
+
+	tswap_debugfs_init();
 
 	frontswap_tmem_exclusive_gets(true);
 
@@ -377,6 +674,8 @@ static int __init tswap_init(void)
 
 	return 0;
 
+out_stop_wb:
+	kthread_stop(tswap_wb_task);
 out_free_lru:
 	kfree(tswap_lru_node);
 out_fail:
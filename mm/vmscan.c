@@ -2812,6 +2812,7 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
 	unsigned long nr_reclaimed;
+	u64 stall = kstat_stall_start();
 	struct scan_control sc = {
 		.gfp_mask = (gfp_mask = memalloc_noio_flags(gfp_mask)),
 		.may_writepage = !laptop_mode,
@@ -2829,8 +2830,10 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 	 * 1 is returned so that the page allocator does not OOM kill at this
 	 * point.
 	 */
-	if (throttle_direct_reclaim(gfp_mask, zonelist, nodemask))
+	if (throttle_direct_reclaim(gfp_mask, zonelist, nodemask)) {
+		kstat_stall_end(KSTAT_STALL_MEM, stall);
 		return 1;
+	}
 
 	trace_mm_vmscan_direct_reclaim_begin(order,
 				sc.may_writepage,
@@ -2839,6 +2842,7 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 
 	trace_mm_vmscan_direct_reclaim_end(nr_reclaimed);
+	kstat_stall_end(KSTAT_STALL_MEM, stall);
 
 	return nr_reclaimed;
 }
@@ -2892,6 +2896,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 {
 	struct zonelist *zonelist;
 	unsigned long nr_reclaimed;
+	u64 stall = kstat_stall_start();
 	int nid;
 	struct scan_control sc = {
 		.may_writepage = !laptop_mode,
@@ -2922,9 +2927,33 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
+	kstat_stall_end(KSTAT_STALL_MEM, stall);
 
 	return nr_reclaimed;
 }
+
+/*
+ * Called when @memcg hits its kmem limit.  Only slab objects of @memcg
+ * and its children are charged there, so shrink their per-memcg lists
+ * (dentries, inodes, ext4 extent status, ...) and leave the caches of
+ * everybody else and the page LRUs alone.
+ */
+unsigned long try_to_free_mem_cgroup_kmem(struct mem_cgroup *memcg,
+					  gfp_t gfp_mask)
+{
+	struct mem_cgroup *iter;
+	unsigned long freed = 0;
+	int nid;
+
+	for_each_online_node(nid) {
+		iter = mem_cgroup_iter(memcg, NULL, NULL);
+		do {
+			freed += shrink_slab(gfp_mask, nid, iter, 1000, 1000);
+		} while ((iter = mem_cgroup_iter(memcg, iter, NULL)));
+	}
+
+	return freed;
+}
 #endif
 
 static void age_active_anon(struct zone *zone, struct scan_control *sc)
@@ -141,19 +141,27 @@
  *
  *		Implementation
  *
- * For each zone's file LRU lists, a counter for inactive evictions
- * and activations is maintained (zone->inactive_age).
+ * For each lruvec's file LRU lists, a counter for inactive evictions
+ * and activations is maintained (lruvec->inactive_age).  With memory
+ * cgroups every cgroup has its own lruvec in each zone, so a cgroup
+ * thrashing within its limit is detected against its own lists rather
+ * than against the whole zone.
  *
  * On eviction, a snapshot of this counter (along with some bits to
- * identify the zone) is stored in the now empty page cache radix tree
- * slot of the evicted page.  This is called a shadow entry.
+ * identify the zone and the cgroup) is stored in the now empty page
+ * cache radix tree slot of the evicted page.  This is called a shadow
+ * entry.
  *
  * On cache misses for which there are shadow entries, an eligible
  * refault distance will immediately activate the refaulting page.
  */
 
-static void *pack_shadow(unsigned long eviction, struct zone *zone)
+#define MEMCG_ID_SHIFT	16
+
+static void *pack_shadow(unsigned short memcgid, struct zone *zone,
+			 unsigned long eviction)
 {
+	eviction = (eviction << MEMCG_ID_SHIFT) | memcgid;
 	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
 	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
 	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
@@ -161,14 +169,10 @@ static void *pack_shadow(unsigned long eviction, struct zone *zone)
 	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
 }
 
-static void unpack_shadow(void *shadow,
-			  struct zone **zone,
-			  unsigned long *distance)
+static void unpack_shadow(void *shadow, unsigned short *memcgid,
+			  struct zone **zone, unsigned long *eviction)
 {
 	unsigned long entry = (unsigned long)shadow;
-	unsigned long eviction;
-	unsigned long refault;
-	unsigned long mask;
 	int zid, nid;
 
 	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
@@ -176,12 +180,21 @@ static void unpack_shadow(void *shadow,
 	entry >>= ZONES_SHIFT;
 	nid = entry & ((1UL << NODES_SHIFT) - 1);
 	entry >>= NODES_SHIFT;
-	eviction = entry;
+	*memcgid = entry & ((1UL << MEMCG_ID_SHIFT) - 1);
+	entry >>= MEMCG_ID_SHIFT;
 
 	*zone = NODE_DATA(nid)->node_zones + zid;
+	*eviction = entry;
+}
 
-	refault = atomic_long_read(&(*zone)->inactive_age);
-	mask = ~0UL >> (NODES_SHIFT + ZONES_SHIFT +
+static unsigned long shadow_distance(struct lruvec *lruvec,
+				     unsigned long eviction)
+{
+	unsigned long refault;
+	unsigned long mask;
+
+	refault = atomic_long_read(&lruvec->inactive_age);
+	mask = ~0UL >> (MEMCG_ID_SHIFT + NODES_SHIFT + ZONES_SHIFT +
 			RADIX_TREE_EXCEPTIONAL_SHIFT);
 	/*
 	 * The unsigned subtraction here gives an accurate distance
@@ -199,7 +212,15 @@ static void unpack_shadow(void *shadow,
 	 * inappropriate activation leading to pressure on the active
 	 * list is not a problem.
 	 */
-	*distance = (refault - eviction) & mask;
+	return (refault - eviction) & mask;
+}
+
+static unsigned long lruvec_active_file(struct lruvec *lruvec,
+					struct zone *zone)
+{
+	if (mem_cgroup_disabled())
+		return zone_page_state(zone, NR_ACTIVE_FILE);
+	return mem_cgroup_get_lru_size(lruvec, LRU_ACTIVE_FILE);
 }
 
 /**
@@ -213,10 +234,18 @@ static void unpack_shadow(void *shadow,
 void *workingset_eviction(struct address_space *mapping, struct page *page)
 {
 	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+	unsigned short memcgid;
 	unsigned long eviction;
 
-	eviction = atomic_long_inc_return(&zone->inactive_age);
-	return pack_shadow(eviction, zone);
+	/* The page is still charged, so its cgroup can't go away */
+	rcu_read_lock();
+	memcgid = mem_cgroup_page_id(page);
+	lruvec = mem_cgroup_id_lruvec(memcgid, zone);
+	eviction = atomic_long_inc_return(&lruvec->inactive_age);
+	rcu_read_unlock();
+
+	return pack_shadow(memcgid, zone, eviction);
 }
 
 /**
@@ -224,19 +253,39 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
  * @shadow: shadow entry of the evicted page
  *
  * Calculates and evaluates the refault distance of the previously
- * evicted page in the context of the zone it was allocated in.
+ * evicted page in the context of the zone it was allocated in and of
+ * the memory cgroup it was charged to.
  *
  * Returns %true if the page should be activated, %false otherwise.
  */
 bool workingset_refault(void *shadow)
 {
 	unsigned long refault_distance;
+	unsigned long eviction;
+	unsigned long active_file;
+	unsigned short memcgid;
+	struct lruvec *lruvec;
 	struct zone *zone;
 
-	unpack_shadow(shadow, &zone, &refault_distance);
+	unpack_shadow(shadow, &memcgid, &zone, &eviction);
+
+	rcu_read_lock();
+	lruvec = mem_cgroup_id_lruvec(memcgid, zone);
+	/*
+	 * The cgroup the page was evicted from is gone, the distance
+	 * can't be measured against anything meaningful anymore.
+	 */
+	if (!lruvec) {
+		rcu_read_unlock();
+		return false;
+	}
+	refault_distance = shadow_distance(lruvec, eviction);
+	active_file = lruvec_active_file(lruvec, zone);
+	rcu_read_unlock();
+
 	inc_zone_state(zone, WORKINGSET_REFAULT);
 
-	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+	if (refault_distance <= active_file) {
 		inc_zone_state(zone, WORKINGSET_ACTIVATE);
 		return true;
 	}
@@ -249,7 +298,14 @@ bool workingset_refault(void *shadow)
  */
 void workingset_activation(struct page *page)
 {
-	atomic_long_inc(&page_zone(page)->inactive_age);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+	lruvec = mem_cgroup_id_lruvec(mem_cgroup_page_id(page),
+				      page_zone(page));
+	if (lruvec)
+		atomic_long_inc(&lruvec->inactive_age);
+	rcu_read_unlock();
 }
 
 /*
@@ -81,8 +81,8 @@ static int receiver_wake_function(wait_queue_t *wait, unsigned int mode, int syn
 /*
  * Wait for the last received packet to be different from skb
  */
-static int wait_for_more_packets(struct sock *sk, int *err, long *timeo_p,
-				 const struct sk_buff *skb)
+int __skb_wait_for_more_packets(struct sock *sk, int *err, long *timeo_p,
+				const struct sk_buff *skb)
 {
 	int error;
 	DEFINE_WAIT_FUNC(wait, receiver_wake_function);
@@ -128,6 +128,43 @@ out_noerr:
 	error = 1;
 	goto out;
 }
+EXPORT_SYMBOL(__skb_wait_for_more_packets);
+
+/*
+ * Take the first datagram off @queue, or reference it for MSG_PEEK,
+ * skipping *off bytes of already peeked data.  @queue->lock must be
+ * held.  *last is set to the last skb looked at, or to the queue head.
+ */
+struct sk_buff *__skb_try_recv_from_queue(struct sock *sk,
+					  struct sk_buff_head *queue,
+					  unsigned int flags,
+					  int *peeked, int *off,
+					  struct sk_buff **last)
+{
+	struct sk_buff *skb;
+	int _off = *off;
+
+	*last = (struct sk_buff *)queue;
+	skb_queue_walk(queue, skb) {
+		*last = skb;
+		*peeked = skb->peeked;
+		if (flags & MSG_PEEK) {
+			if (_off >= skb->len && (skb->len || _off ||
+						 skb->peeked)) {
+				_off -= skb->len;
+				continue;
+			}
+			skb->peeked = 1;
+			atomic_inc(&skb->users);
+		} else
+			__skb_unlink(skb, queue);
+
+		*off = _off;
+		return skb;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(__skb_try_recv_from_queue);
 
 /**
  *	__skb_recv_datagram - Receive a datagram skbuff
@@ -184,29 +221,13 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned int flags,
 		 */
 		unsigned long cpu_flags;
 		struct sk_buff_head *queue = &sk->sk_receive_queue;
-		int _off = *off;
 
-		last = (struct sk_buff *)queue;
 		spin_lock_irqsave(&queue->lock, cpu_flags);
-		skb_queue_walk(queue, skb) {
-			last = skb;
-			*peeked = skb->peeked;
-			if (flags & MSG_PEEK) {
-				if (_off >= skb->len && (skb->len || _off ||
-							 skb->peeked)) {
-					_off -= skb->len;
-					continue;
-				}
-				skb->peeked = 1;
-				atomic_inc(&skb->users);
-			} else
-				__skb_unlink(skb, queue);
-
-			spin_unlock_irqrestore(&queue->lock, cpu_flags);
-			*off = _off;
-			return skb;
-		}
+		skb = __skb_try_recv_from_queue(sk, queue, flags, peeked, off,
+						&last);
 		spin_unlock_irqrestore(&queue->lock, cpu_flags);
+		if (skb)
+			return skb;
 
 		if (sk_can_busy_loop(sk) &&
 		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
@@ -217,7 +238,7 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned int flags,
 		if (!timeo)
 			goto no_packet;
 
-	} while (!wait_for_more_packets(sk, err, &timeo, last));
+	} while (!__skb_wait_for_more_packets(sk, err, &timeo, last));
 
 	return NULL;
 
@@ -284,19 +305,20 @@ EXPORT_SYMBOL(skb_free_datagram_locked);
  *	It returns 0 if the packet was removed by us.
  */
 
-int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+int __skb_kill_datagram(struct sock *sk, struct sk_buff_head *queue,
+			struct sk_buff *skb, unsigned int flags)
 {
 	int err = 0;
 
 	if (flags & MSG_PEEK) {
 		err = -ENOENT;
-		spin_lock_bh(&sk->sk_receive_queue.lock);
-		if (skb == skb_peek(&sk->sk_receive_queue)) {
-			__skb_unlink(skb, &sk->sk_receive_queue);
+		spin_lock_bh(&queue->lock);
+		if (skb == skb_peek(queue)) {
+			__skb_unlink(skb, queue);
 			atomic_dec(&skb->users);
 			err = 0;
 		}
-		spin_unlock_bh(&sk->sk_receive_queue.lock);
+		spin_unlock_bh(&queue->lock);
 	}
 
 	kfree_skb(skb);
@@ -305,6 +327,12 @@ int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
 
 	return err;
 }
+EXPORT_SYMBOL(__skb_kill_datagram);
+
+int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+{
+	return __skb_kill_datagram(sk, &sk->sk_receive_queue, skb, flags);
+}
 EXPORT_SYMBOL(skb_kill_datagram);
 
 /**
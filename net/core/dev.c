@@ -130,6 +130,8 @@
 #include <linux/cpu_rmap.h>
 #include <linux/static_key.h>
 #include <linux/hashtable.h>
+#include <linux/ve_lat.h>
+#include <linux/ve_stats.h>
 
 #include "net-sysfs.h"
 
@@ -1626,24 +1628,16 @@ static inline bool is_skb_forwardable(struct net_device *dev,
 }
 
 /**
- * dev_forward_skb - loopback an skb to another netif
+ * __dev_forward_skb - prepare an skb to be looped back to another netif
  *
  * @dev: destination network device
  * @skb: buffer to forward
  *
- * return values:
- *	NET_RX_SUCCESS	(no congestion)
- *	NET_RX_DROP     (packet was dropped, but freed)
- *
- * dev_forward_skb can be used for injecting an skb from the
- * start_xmit function of one device into the receive queue
- * of another device.
- *
- * The receiving device may be in another namespace, so
- * we have to clear all information in the skb that could
- * impact namespace isolation.
+ * Does everything dev_forward_skb() does except queueing the skb, for
+ * drivers which deliver it on their own. Returns 0 or NET_RX_DROP, in
+ * the latter case the skb is freed.
  */
-int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
+int __dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 {
 	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
 		if (skb_copy_ubufs(skb, GFP_ATOMIC)) {
@@ -1660,7 +1654,31 @@ int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 	}
 	skb_scrub_packet(skb, true);
 	skb->protocol = eth_type_trans(skb, dev);
-	return netif_rx(skb);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__dev_forward_skb);
+
+/**
+ * dev_forward_skb - loopback an skb to another netif
+ *
+ * @dev: destination network device
+ * @skb: buffer to forward
+ *
+ * return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_DROP     (packet was dropped, but freed)
+ *
+ * dev_forward_skb can be used for injecting an skb from the
+ * start_xmit function of one device into the receive queue
+ * of another device.
+ *
+ * The receiving device may be in another namespace, so
+ * we have to clear all information in the skb that could
+ * impact namespace isolation.
+ */
+int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
+{
+	return __dev_forward_skb(dev, skb) ?: netif_rx(skb);
 }
 EXPORT_SYMBOL_GPL(dev_forward_skb);
 
@@ -1668,7 +1686,7 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -2774,6 +2792,11 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 	skb_update_prio(skb);
 
+#ifdef CONFIG_VE
+	ve_stat_add(dev_net(dev)->owner_ve, VE_STAT_NET_TX_PKTS, 1);
+	ve_stat_add(dev_net(dev)->owner_ve, VE_STAT_NET_TX_BYTES, skb->len);
+#endif
+
 	txq = netdev_pick_tx(dev, skb);
 	q = rcu_dereference_bh(txq->qdisc);
 
@@ -2869,6 +2892,34 @@ EXPORT_SYMBOL(rps_sock_flow_table);
 
 struct static_key rps_needed __read_mostly;
 
+/* Keep RPS of a container's devices on the cpus its cpulimit allows */
+int sysctl_rps_ve_steering __read_mostly;
+
+static u16 rps_map_cpu(struct net_device *dev, struct rps_map *map, u32 hash)
+{
+	unsigned int idx = ((u64) hash * map->len) >> 32;
+#ifdef CONFIG_VE
+	struct ve_struct *ve = dev_net(dev)->owner_ve;
+	unsigned int i;
+
+	if (!sysctl_rps_ve_steering || ve_is_super(ve))
+		return map->cpus[idx];
+
+	/*
+	 * Prefer the cpu the hash picks, otherwise the next one in the
+	 * map the container is running on, so softirq work for its flows
+	 * stays cache local with and is accounted next to the container.
+	 */
+	for (i = 0; i < map->len; i++) {
+		u16 tcpu = map->cpus[(idx + i) % map->len];
+
+		if (cpu_online(tcpu) && ve_sched_cpu_allowed(ve, tcpu))
+			return tcpu;
+	}
+#endif
+	return map->cpus[idx];
+}
+
 static struct rps_dev_flow *
 set_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	    struct rps_dev_flow *rflow, u16 next_cpu)
@@ -2998,7 +3049,7 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	}
 
 	if (map) {
-		tcpu = map->cpus[((u64) skb->rxhash * map->len) >> 32];
+		tcpu = rps_map_cpu(dev, map, skb->rxhash);
 
 		if (cpu_online(tcpu)) {
 			cpu = tcpu;
@@ -3522,7 +3573,7 @@ ncls:
 	}
 
 	if (pt_prev) {
-		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 			goto drop;
 		else
 			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -3542,7 +3593,7 @@ out:
 	return ret;
 }
 
-static int __netif_receive_skb(struct sk_buff *skb)
+static int ___netif_receive_skb(struct sk_buff *skb)
 {
 	int ret;
 
@@ -3567,6 +3618,78 @@ static int __netif_receive_skb(struct sk_buff *skb)
 	return ret;
 }
 
+#ifdef CONFIG_VE
+/* Share of each cpu's softirq a container may use, percents, 0 - no limit */
+int sysctl_ve_rx_softirq_max __read_mostly;
+
+#define VE_RX_WINDOW	(10 * NSEC_PER_MSEC)
+
+static bool ve_rx_throttled(struct kstat_softirq_pcpu_struct *st, u64 now)
+{
+	int max = ACCESS_ONCE(sysctl_ve_rx_softirq_max);
+
+	if (!max)
+		return false;
+
+	if (now - st->window_start >= VE_RX_WINDOW) {
+		st->window_start = now;
+		st->window_time = 0;
+		return false;
+	}
+
+	return st->window_time >= VE_RX_WINDOW / 100 * max;
+}
+
+/*
+ * NET_RX softirq is accounted to the task it happens to interrupt, so a
+ * flooded container would get its packet processing for free at the
+ * expense of its neighbours.  Measure the delivery to the container's
+ * devices, charge it to the container's cpu accounting group and, when
+ * asked to, drop what exceeds its share of the cpu.
+ */
+static int ve_netif_receive_skb(struct ve_struct *ve, struct sk_buff *skb)
+{
+	struct kstat_softirq_pcpu_struct *st = this_cpu_ptr(ve->rx_softirq);
+	int ifindex = skb->dev->ifindex;
+	unsigned int len = skb->len;
+	u64 start = local_clock();
+	u64 delta;
+	int ret;
+
+	if (ve_rx_throttled(st, start)) {
+		st->throttled++;
+		atomic_long_inc(&skb->dev->rx_dropped);
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
+	ret = ___netif_receive_skb(skb);
+
+	delta = local_clock() - start;
+	ve_lat_record(ve, VE_LAT_NET_RX, delta, ifindex);
+	ve_stat_add(ve, VE_STAT_NET_RX_PKTS, 1);
+	ve_stat_add(ve, VE_STAT_NET_RX_BYTES, len);
+	st->time += delta;
+	st->window_time += delta;
+	st->uncharged += delta;
+	if (st->uncharged >= TICK_NSEC)
+		st->uncharged = ve_account_softirq_time(ve, st->uncharged);
+
+	return ret;
+}
+#endif
+
+static int __netif_receive_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_VE
+	struct ve_struct *ve = dev_net(skb->dev)->owner_ve;
+
+	if (!ve_is_super(ve) && in_serving_softirq())
+		return ve_netif_receive_skb(ve, skb);
+#endif
+	return ___netif_receive_skb(skb);
+}
+
 /**
  *	netif_receive_skb - process receive buffer from network
  *	@skb: buffer to process
@@ -3909,7 +4032,7 @@ static gro_result_t napi_skb_finish(gro_result_t ret, struct sk_buff *skb)
 
 	case GRO_MERGED_FREE:
 		if (NAPI_GRO_CB(skb)->free == NAPI_GRO_FREE_STOLEN_HEAD)
-			kmem_cache_free(skbuff_head_cache, skb);
+			napi_skb_free_stolen_head(skb);
 		else
 			__kfree_skb(skb);
 		break;
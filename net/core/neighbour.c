@@ -124,36 +124,81 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
 
-static int neigh_forced_gc(struct neigh_table *tbl)
+static inline atomic_t *neigh_net_entries(struct neigh_table *tbl,
+					  struct net *net)
+{
+	return &net->neigh.entries[tbl->index];
+}
+
+/* Neighbour record may be discarded if:
+ * - nobody refers to it.
+ * - it is not permanent
+ */
+static inline bool neigh_gc_candidate(struct neighbour *n, struct net *net)
+{
+	return atomic_read(&n->refcnt) == 1 &&
+	       !(n->nud_state & NUD_PERMANENT) &&
+	       net_eq(dev_net(n->dev), net);
+}
+
+static bool neigh_bucket_has_candidates(struct neigh_hash_table *nht,
+					unsigned int i, struct net *net)
+{
+	struct neighbour *n;
+
+	for (n = rcu_dereference_bh(nht->hash_buckets[i]); n;
+	     n = rcu_dereference_bh(n->next))
+		if (neigh_gc_candidate(n, net))
+			return true;
+	return false;
+}
+
+/*
+ * Shrink the entries of @net by up to @goal.  Buckets are scanned under
+ * RCU, starting where the previous run stopped, and the table lock is
+ * taken only for the buckets which have something to evict, so that
+ * lookups and other namespaces are not stalled behind a full table walk.
+ */
+static int neigh_forced_gc(struct neigh_table *tbl, struct net *net,
+			   int goal)
 {
-	int shrunk = 0;
-	int i;
 	struct neigh_hash_table *nht;
+	unsigned int i, size, scanned;
+	int shrunk = 0;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
-	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-	for (i = 0; i < (1 << nht->hash_shift); i++) {
+	rcu_read_lock_bh();
+	nht = rcu_dereference_bh(tbl->nht);
+	size = 1 << nht->hash_shift;
+	i = tbl->gc_pos & (size - 1);
+
+	for (scanned = 0; scanned < size && shrunk < goal;
+	     scanned++, i = (i + 1) & (size - 1)) {
 		struct neighbour *n;
 		struct neighbour __rcu **np;
 
+		if (!neigh_bucket_has_candidates(nht, i, net))
+			continue;
+
+		write_lock(&tbl->lock);
+		if (nht != rcu_dereference_protected(tbl->nht,
+					lockdep_is_held(&tbl->lock))) {
+			/* The table was resized, retry on the next run */
+			write_unlock(&tbl->lock);
+			break;
+		}
+
 		np = &nht->hash_buckets[i];
 		while ((n = rcu_dereference_protected(*np,
 					lockdep_is_held(&tbl->lock))) != NULL) {
-			/* Neighbour record may be discarded if:
-			 * - nobody refers to it.
-			 * - it is not permanent
-			 */
 			write_lock(&n->lock);
-			if (atomic_read(&n->refcnt) == 1 &&
-			    !(n->nud_state & NUD_PERMANENT)) {
+			if (shrunk < goal && neigh_gc_candidate(n, net)) {
 				rcu_assign_pointer(*np,
 					rcu_dereference_protected(n->next,
 						  lockdep_is_held(&tbl->lock)));
 				n->dead = 1;
-				shrunk	= 1;
+				shrunk++;
 				write_unlock(&n->lock);
 				neigh_cleanup_and_release(n);
 				continue;
@@ -161,12 +206,13 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 			write_unlock(&n->lock);
 			np = &n->next;
 		}
+		write_unlock(&tbl->lock);
 	}
+	tbl->gc_pos = i;
+	rcu_read_unlock_bh();
 
 	tbl->last_flush = jiffies;
 
-	write_unlock_bh(&tbl->lock);
-
 	return shrunk;
 }
 
@@ -274,15 +320,24 @@ EXPORT_SYMBOL(neigh_ifdown);
 static struct neighbour *neigh_alloc(struct neigh_table *tbl, struct net_device *dev)
 {
 	struct neighbour *n = NULL;
+	struct net *net = dev_net(dev);
 	unsigned long now = jiffies;
 	int entries;
 
-	entries = atomic_inc_return(&tbl->entries) - 1;
+	/*
+	 * The gc thresholds are applied per namespace, so that one
+	 * container filling its neighbour cache can neither evict the
+	 * entries of the others nor make them fail allocations.
+	 */
+	atomic_inc(&tbl->entries);
+	entries = atomic_inc_return(neigh_net_entries(tbl, net)) - 1;
 	n = ERR_PTR(-ENOBUFS);
 	if (entries >= tbl->gc_thresh3 ||
 	    (entries >= tbl->gc_thresh2 &&
 	     time_after(now, tbl->last_flush + 5 * HZ))) {
-		if (!neigh_forced_gc(tbl) &&
+		int goal = max(entries - tbl->gc_thresh2, 1);
+
+		if (!neigh_forced_gc(tbl, net, goal) &&
 		    entries >= tbl->gc_thresh3)
 			goto out_entries;
 	}
@@ -311,6 +366,7 @@ out:
 out_nomem:
 	n = ERR_PTR(-ENOMEM);
 out_entries:
+	atomic_dec(neigh_net_entries(tbl, net));
 	atomic_dec(&tbl->entries);
 	goto out;
 }
@@ -702,6 +758,7 @@ static inline void neigh_parms_put(struct neigh_parms *parms)
 void neigh_destroy(struct neighbour *neigh)
 {
 	struct net_device *dev = neigh->dev;
+	struct net *net = dev_net(dev);
 
 	NEIGH_CACHE_STAT_INC(neigh->tbl, destroys);
 
@@ -729,6 +786,8 @@ void neigh_destroy(struct neighbour *neigh)
 	if (dev->netdev_ops->ndo_neigh_destroy)
 		dev->netdev_ops->ndo_neigh_destroy(neigh);
 
+	/* The device pins its namespace, account before releasing it */
+	atomic_dec(neigh_net_entries(neigh->tbl, net));
 	dev_put(dev);
 	neigh_parms_put(neigh->parms);
 
@@ -1549,6 +1608,20 @@ static void neigh_table_init_no_netlink(struct neigh_table *tbl)
 	unsigned long now = jiffies;
 	unsigned long phsize;
 
+	switch (tbl->family) {
+	case AF_INET:
+		tbl->index = NEIGH_ARP_TABLE;
+		break;
+	case AF_INET6:
+		tbl->index = NEIGH_ND_TABLE;
+		break;
+	case AF_DECnet:
+		tbl->index = NEIGH_DN_TABLE;
+		break;
+	default:
+		panic("neighbour table for unknown family %d\n", tbl->family);
+	}
+
 	write_pnet(&tbl->parms.net, &init_net);
 	atomic_set(&tbl->parms.refcnt, 1);
 	tbl->parms.reachable_time =
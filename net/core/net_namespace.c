@@ -8,6 +8,7 @@
 #include <linux/list.h>
 #include <linux/delay.h>
 #include <linux/idr.h>
+#include <linux/rwsem.h>
 #include <linux/rculist.h>
 #include <linux/nsproxy.h>
 #include <linux/fs.h>
@@ -28,6 +29,30 @@ static LIST_HEAD(pernet_list);
 static struct list_head *first_device = &pernet_list;
 DEFINE_MUTEX(net_mutex);
 
+/*
+ * Namespaces are set up and cleaned up under net_sem held for read,
+ * registering pernet operations takes it for write. Operations which
+ * are not marked async additionally need net_mutex, so while there are
+ * any, namespaces are still created one at a time.
+ */
+DECLARE_RWSEM(net_sem);
+static unsigned int nr_sync_pernet_ops;
+
+/* nr_sync_pernet_ops does not change while net_sem is held */
+static void lock_pernet_ops(void)
+{
+	down_read(&net_sem);
+	if (nr_sync_pernet_ops)
+		mutex_lock(&net_mutex);
+}
+
+static void unlock_pernet_ops(void)
+{
+	if (nr_sync_pernet_ops)
+		mutex_unlock(&net_mutex);
+	up_read(&net_sem);
+}
+
 LIST_HEAD(net_namespace_list);
 EXPORT_SYMBOL_GPL(net_namespace_list);
 
@@ -62,11 +87,11 @@ int net_assign_generic(struct net *net, int id, void *data)
 {
 	struct net_generic *ng, *old_ng;
 
-	BUG_ON(!mutex_is_locked(&net_mutex));
+	BUG_ON(!rwsem_is_locked(&net_sem));
 	BUG_ON(id == 0);
 
 	old_ng = rcu_dereference_protected(net->gen,
-					   lockdep_is_held(&net_mutex));
+					   lockdep_is_held(&net_sem));
 	ng = old_ng;
 	if (old_ng->len >= id)
 		goto assign;
@@ -158,7 +183,7 @@ static void ops_free_list(const struct pernet_operations *ops,
  */
 static __net_init int setup_net(struct net *net, struct user_namespace *user_ns)
 {
-	/* Must be called with net_mutex held */
+	/* Must be called under lock_pernet_ops() */
 	const struct pernet_operations *ops, *saved_ops;
 	int error = 0;
 	LIST_HEAD(net_exit_list);
@@ -266,14 +291,14 @@ struct net *copy_net_ns(unsigned long flags,
 
 	get_user_ns(user_ns);
 
-	mutex_lock(&net_mutex);
+	lock_pernet_ops();
 	rv = setup_net(net, user_ns);
 	if (rv == 0) {
 		rtnl_lock();
 		list_add_tail_rcu(&net->list, &net_namespace_list);
 		rtnl_unlock();
 	}
-	mutex_unlock(&net_mutex);
+	unlock_pernet_ops();
 	if (rv < 0) {
 		put_user_ns(user_ns);
 		net_drop_ns(net);
@@ -297,7 +322,7 @@ static void cleanup_net(struct work_struct *work)
 	list_replace_init(&cleanup_list, &net_kill_list);
 	spin_unlock_irq(&cleanup_list_lock);
 
-	mutex_lock(&net_mutex);
+	lock_pernet_ops();
 
 	/* Don't let anyone else find us. */
 	rtnl_lock();
@@ -329,7 +354,7 @@ static void cleanup_net(struct work_struct *work)
 		put_ve(ve);
 	}
 
-	mutex_unlock(&net_mutex);
+	unlock_pernet_ops();
 
 	/* Ensure there are no outstanding rcu callbacks using this
 	 * network namespace.
@@ -418,6 +443,7 @@ static __net_exit void net_ns_net_exit(struct net *net)
 static struct pernet_operations __net_initdata net_ns_ops = {
 	.init = net_ns_net_init,
 	.exit = net_ns_net_exit,
+	.async = true,
 };
 
 static int __init net_ns_init(void)
@@ -441,7 +467,7 @@ static int __init net_ns_init(void)
 
 	rcu_assign_pointer(init_net.gen, ng);
 
-	mutex_lock(&net_mutex);
+	lock_pernet_ops();
 	if (setup_net(&init_net, &init_user_ns))
 		panic("Could not setup the initial network namespace");
 
@@ -449,7 +475,7 @@ static int __init net_ns_init(void)
 	list_add_tail_rcu(&init_net.list, &net_namespace_list);
 	rtnl_unlock();
 
-	mutex_unlock(&net_mutex);
+	unlock_pernet_ops();
 
 	register_pernet_subsys(&net_ns_ops);
 
@@ -539,14 +565,16 @@ again:
 		rcu_barrier();
 		if (ops->id)
 			ida_remove(&net_generic_ids, *ops->id);
-	}
+	} else if (!ops->async)
+		nr_sync_pernet_ops++;
 
 	return error;
 }
 
 static void unregister_pernet_operations(struct pernet_operations *ops)
 {
-	
+	if (!ops->async)
+		nr_sync_pernet_ops--;
 	__unregister_pernet_operations(ops);
 	rcu_barrier();
 	if (ops->id)
@@ -575,9 +603,11 @@ static void unregister_pernet_operations(struct pernet_operations *ops)
 int register_pernet_subsys(struct pernet_operations *ops)
 {
 	int error;
+	down_write(&net_sem);
 	mutex_lock(&net_mutex);
 	error =  register_pernet_operations(first_device, ops);
 	mutex_unlock(&net_mutex);
+	up_write(&net_sem);
 	return error;
 }
 EXPORT_SYMBOL_GPL(register_pernet_subsys);
@@ -593,9 +623,11 @@ EXPORT_SYMBOL_GPL(register_pernet_subsys);
  */
 void unregister_pernet_subsys(struct pernet_operations *ops)
 {
+	down_write(&net_sem);
 	mutex_lock(&net_mutex);
 	unregister_pernet_operations(ops);
 	mutex_unlock(&net_mutex);
+	up_write(&net_sem);
 }
 EXPORT_SYMBOL_GPL(unregister_pernet_subsys);
 
@@ -621,11 +653,13 @@ EXPORT_SYMBOL_GPL(unregister_pernet_subsys);
 int register_pernet_device(struct pernet_operations *ops)
 {
 	int error;
+	down_write(&net_sem);
 	mutex_lock(&net_mutex);
 	error = register_pernet_operations(&pernet_list, ops);
 	if (!error && (first_device == &pernet_list))
 		first_device = &ops->list;
 	mutex_unlock(&net_mutex);
+	up_write(&net_sem);
 	return error;
 }
 EXPORT_SYMBOL_GPL(register_pernet_device);
@@ -641,11 +675,13 @@ EXPORT_SYMBOL_GPL(register_pernet_device);
  */
 void unregister_pernet_device(struct pernet_operations *ops)
 {
+	down_write(&net_sem);
 	mutex_lock(&net_mutex);
 	if (&ops->list == first_device)
 		first_device = first_device->next;
 	unregister_pernet_operations(ops);
 	mutex_unlock(&net_mutex);
+	up_write(&net_sem);
 }
 EXPORT_SYMBOL_GPL(unregister_pernet_device);
 
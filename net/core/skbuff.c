@@ -175,6 +175,53 @@ out:
 	return obj;
 }
 
+/*
+ * Heads of the skbs consumed in NAPI context are kept per CPU and given
+ * to the next allocations in softirq, so forwarding does not go to the
+ * slab for every packet. The cache is only touched with BHs disabled
+ * and never from hardirq, that is all the protection it needs.
+ */
+#define SKB_RECYCLE_CACHE_SIZE	64
+
+struct skb_recycle_cache {
+	unsigned int	count;
+	struct sk_buff	*skbs[SKB_RECYCLE_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct skb_recycle_cache, skb_recycle_cache);
+
+static inline bool skb_recycle_allowed(void)
+{
+	return in_softirq() && !in_irq();
+}
+
+static struct sk_buff *skb_recycle_get(int node)
+{
+	struct skb_recycle_cache *nc;
+
+	if (!skb_recycle_allowed() ||
+	    (node != NUMA_NO_NODE && node != numa_mem_id()))
+		return NULL;
+
+	nc = &__get_cpu_var(skb_recycle_cache);
+	if (!nc->count)
+		return NULL;
+	return nc->skbs[--nc->count];
+}
+
+static void skb_recycle_put(struct sk_buff *skb)
+{
+	struct skb_recycle_cache *nc = &__get_cpu_var(skb_recycle_cache);
+
+	/* Full: give half back at once and keep the rest warm */
+	if (unlikely(nc->count == SKB_RECYCLE_CACHE_SIZE)) {
+		while (nc->count > SKB_RECYCLE_CACHE_SIZE / 2)
+			kmem_cache_free(skbuff_head_cache,
+					nc->skbs[--nc->count]);
+	}
+	nc->skbs[nc->count++] = skb;
+}
+
 /* 	Allocate a new skbuff. We do this ourselves so we can fill in a few
  *	'private' fields and also do memory statistics to find all the
  *	[BEEP] leaks.
@@ -239,7 +286,11 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 		gfp_mask |= __GFP_MEMALLOC;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	skb = NULL;
+	if (cache == skbuff_head_cache)
+		skb = skb_recycle_get(node);
+	if (!skb)
+		skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
 	if (!skb)
 		goto out;
 	prefetchw(skb);
@@ -328,7 +379,9 @@ struct sk_buff *build_skb(void *data, unsigned int frag_size)
 	struct sk_buff *skb;
 	unsigned int size = frag_size ? : ksize(data);
 
-	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	skb = skb_recycle_get(NUMA_NO_NODE);
+	if (!skb)
+		skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
 	if (!skb)
 		return NULL;
 
@@ -689,6 +742,51 @@ void consume_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(consume_skb);
 
+/**
+ *	napi_consume_skb - free an skbuff from NAPI poll
+ *	@skb: buffer to free
+ *	@budget: NAPI budget, 0 if not called from NAPI poll
+ *
+ *	Like consume_skb, but the sk_buff itself is kept in a per-CPU cache
+ *	for the next allocations in softirq instead of going to the slab.
+ */
+void napi_consume_skb(struct sk_buff *skb, int budget)
+{
+	if (unlikely(!skb))
+		return;
+
+	/* Zero budget is netpoll, which may run with IRQs disabled */
+	if (unlikely(!budget || !skb_recycle_allowed())) {
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	if (likely(atomic_read(&skb->users) == 1))
+		smp_rmb();
+	else if (likely(!atomic_dec_and_test(&skb->users)))
+		return;
+	trace_consume_skb(skb);
+
+	if (skb->fclone != SKB_FCLONE_UNAVAILABLE) {
+		__kfree_skb(skb);
+		return;
+	}
+	skb_release_all(skb);
+	skb_recycle_put(skb);
+}
+EXPORT_SYMBOL(napi_consume_skb);
+
+/* Head of an skb merged by GRO, its data went to another skb */
+void napi_skb_free_stolen_head(struct sk_buff *skb)
+{
+	skb_dst_drop(skb);
+	if (skb_recycle_allowed())
+		skb_recycle_put(skb);
+	else
+		kmem_cache_free(skbuff_head_cache, skb);
+}
+EXPORT_SYMBOL(napi_skb_free_stolen_head);
+
 static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 {
 	new->tstamp		= old->tstamp;
@@ -814,9 +912,16 @@ EXPORT_SYMBOL_GPL(skb_morph);
 int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	int i;
-	int num_frags = skb_shinfo(skb)->nr_frags;
+	int num_frags;
 	struct page *page, *head = NULL;
-	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+	struct ubuf_info *uarg;
+
+	/* Clones of a MSG_ZEROCOPY skb keep sharing the pages */
+	if (skb_zcopy_sock(skb) && skb_unclone(skb, gfp_mask))
+		return -ENOMEM;
+
+	num_frags = skb_shinfo(skb)->nr_frags;
+	uarg = skb_shinfo(skb)->destructor_arg;
 
 	for (i = 0; i < num_frags; i++) {
 		u8 *vaddr;
@@ -857,6 +962,204 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL_GPL(skb_copy_ubufs);
 
+/*
+ * MSG_ZEROCOPY.  User pages are pinned into frags and the sender learns
+ * from its error queue when the stack is done with them.  The ubuf_info
+ * lives in the cb of the very skb which carries the notification, so
+ * completion never allocates.  Those skbs are tail-merged in the queue
+ * when their ids are consecutive.
+ */
+static void sock_rmem_free(struct sk_buff *skb);
+
+static inline struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+/* Called under the socket lock, which serializes sk_zckey */
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, bool zerocopy)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	skb = alloc_skb(0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	uarg = (void *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->ctx = NULL;
+	uarg->desc = 0;
+	atomic_set(&uarg->refcnt, 1);
+	uarg->id = sk->sk_zckey++;
+	uarg->zerocopy = zerocopy;
+	uarg->aborted = false;
+
+	sock_hold(sk);
+	skb->sk = sk;
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+static void sock_zerocopy_notify(struct ubuf_info *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sock_exterr_skb *serr, *tserr;
+	unsigned long flags;
+	u32 id = uarg->id;
+	u8 code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	if (uarg->aborted)
+		goto out;
+
+	/* uarg is gone from here on, the cb is reused */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = id;
+	serr->ee.ee_data = id;
+
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	tserr = tail ? SKB_EXT_ERR(tail) : NULL;
+	if (tserr && tserr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY &&
+	    tserr->ee.ee_code == code && tserr->ee.ee_data + 1 == id) {
+		tserr->ee.ee_data = id;
+	} else {
+		skb->destructor = sock_rmem_free;
+		atomic_add(skb->truesize, &sk->sk_rmem_alloc);
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_error_report(sk);
+out:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_notify(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Nothing was queued with @uarg, give its id back without notifying */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		skb_from_uarg(uarg)->sk->sk_zckey--;
+		uarg->aborted = true;
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+void sock_zerocopy_callback(struct ubuf_info *uarg, bool success)
+{
+	if (!success)
+		uarg->zerocopy = false;
+	sock_zerocopy_put(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+/**
+ *	skb_zerocopy_iter_stream - pin user pages into frags of a stream skb
+ *	@sk: socket owning the skb, charged for the pages
+ *	@skb: buffer to append to
+ *	@from: user buffer
+ *	@length: bytes wanted
+ *	@uarg: completion the skb is tied to
+ *
+ *	Returns the number of bytes appended, -EMSGSIZE if there is no frag
+ *	left, -EEXIST if the skb already carries pages of another send, or
+ *	-EFAULT.
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     const char __user *from, int length,
+			     struct ubuf_info *uarg)
+{
+	int frag = skb_shinfo(skb)->nr_frags;
+	int copied = 0;
+
+	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY &&
+	    skb_shinfo(skb)->destructor_arg != uarg)
+		return -EEXIST;
+
+	while (length && frag < MAX_SKB_FRAGS) {
+		struct page *pages[MAX_SKB_FRAGS];
+		unsigned long addr = (unsigned long)from;
+		int off = offset_in_page(addr);
+		int n, i;
+
+		n = min_t(int, DIV_ROUND_UP(off + length, PAGE_SIZE),
+			  MAX_SKB_FRAGS - frag);
+		n = get_user_pages_fast(addr & PAGE_MASK, n, 0, pages);
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			int size = min_t(int, PAGE_SIZE - off, length);
+
+			skb_fill_page_desc(skb, frag++, pages[i], off, size);
+			off = 0;
+			from += size;
+			length -= size;
+			copied += size;
+		}
+	}
+
+	if (!copied)
+		return frag == MAX_SKB_FRAGS ? -EMSGSIZE : -EFAULT;
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	sk->sk_wmem_queued += copied;
+	sk_mem_charge(sk, copied);
+
+	if (!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)) {
+		sock_zerocopy_get(uarg);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY |
+					     SKBTX_SHARED_FRAG;
+	}
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
+/**
+ *	skb_zerocopy_clone - tie a buffer to the completion of another
+ *	@nskb: buffer which got frags of @orig
+ *	@orig: original buffer
+ *
+ *	Needed whenever MSG_ZEROCOPY pages move to a buffer with a shinfo
+ *	of its own.  Fails if @nskb already carries pages of another send.
+ */
+int skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig)
+{
+	struct ubuf_info *uarg = skb_zcopy_sock(orig);
+
+	if (!uarg)
+		return 0;
+	if (skb_shinfo(nskb)->tx_flags & SKBTX_DEV_ZEROCOPY)
+		return skb_shinfo(nskb)->destructor_arg == uarg ? 0 : -EIO;
+
+	sock_zerocopy_get(uarg);
+	skb_shinfo(nskb)->destructor_arg = uarg;
+	skb_shinfo(nskb)->tx_flags |= SKBTX_DEV_ZEROCOPY | SKBTX_SHARED_FRAG;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_clone);
+
 /**
  *	skb_clone	-	duplicate an sk_buff
  *	@skb: buffer to clone
@@ -1019,6 +1322,7 @@ struct sk_buff *__pskb_copy(struct sk_buff *skb, int headroom, gfp_t gfp_mask)
 			skb_frag_ref(skb, i);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zerocopy_clone(n, skb);
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -1089,6 +1393,9 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		/* copy this zero copy skb frags */
 		if (skb_orphan_frags(skb, gfp_mask))
 			goto nofrags;
+		/* The new shinfo points to the pinned pages as well */
+		if (skb_zcopy_sock(skb))
+			sock_zerocopy_get(skb_zcopy_sock(skb));
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			skb_frag_ref(skb, i);
 
@@ -2168,7 +2475,7 @@ skb_zerocopy(struct sk_buff *to, struct sk_buff *from, int len, int hlen)
 	to->len += len + plen;
 	to->data_len += len + plen;
 
-	if (unlikely(skb_orphan_frags(from, GFP_ATOMIC))) {
+	if (unlikely(skb_orphan_frags_rx(from, GFP_ATOMIC))) {
 		skb_tx_error(from);
 		return -ENOMEM;
 	}
@@ -2449,6 +2756,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 	int pos = skb_headlen(skb);
 
 	skb_shinfo(skb1)->tx_flags = skb_shinfo(skb)->tx_flags & SKBTX_SHARED_FRAG;
+	skb_zerocopy_clone(skb1, skb);
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2491,6 +2799,9 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	if (skb_zerocopy_clone(tgt, skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -3013,7 +3324,8 @@ struct sk_buff *skb_segment(struct sk_buff *head_skb,
 				goto err;
 			}
 
-			if (unlikely(skb_orphan_frags(frag_skb, GFP_ATOMIC)))
+			if (unlikely(skb_orphan_frags(frag_skb, GFP_ATOMIC) ||
+				     skb_zerocopy_clone(nskb, frag_skb)))
 				goto err;
 
 			*nskb_frag = *frag;
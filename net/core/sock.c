@@ -915,6 +915,21 @@ set_rcvbuf:
 		}
 		break;
 #endif
+
+	case SO_INCOMING_CPU:
+		sk->sk_incoming_cpu = val;
+		break;
+
+	case SO_ZEROCOPY:
+		if ((sk->sk_family != PF_INET && sk->sk_family != PF_INET6) ||
+		    sk->sk_protocol != IPPROTO_TCP)
+			ret = -ENOTSUPP;
+		else if (val < 0 || val > 1)
+			ret = -EINVAL;
+		else
+			sock_valbool_flag(sk, SOCK_ZEROCOPY, valbool);
+		break;
+
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -1182,6 +1197,14 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		break;
 #endif
 
+	case SO_INCOMING_CPU:
+		v.val = sk->sk_incoming_cpu;
+		break;
+
+	case SO_ZEROCOPY:
+		v.val = sock_flag(sk, SOCK_ZEROCOPY);
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1448,6 +1471,9 @@ struct sock *sk_clone_lock(const struct sock *sk, const gfp_t priority)
 		/* SANITY */
 		get_net(sock_net(newsk));
 		sk_node_init(&newsk->sk_node);
+#ifdef CONFIG_NET_NS
+		INIT_HLIST_NODE(&newsk->sk_netns_node);
+#endif
 		sock_lock_init(newsk);
 		bh_lock_sock(newsk);
 		newsk->sk_backlog.head	= newsk->sk_backlog.tail = NULL;
@@ -2297,10 +2323,11 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 	sk->sk_sndtimeo		=	MAX_SCHEDULE_TIMEOUT;
 
 	sk->sk_stamp = ktime_set(-1L, 0);
+	sk->sk_incoming_cpu = -1;
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	sk->sk_napi_id		=	0;
-	sk->sk_ll_usec		=	sysctl_net_busy_read;
+	sk->sk_ll_usec		=	sock_net(sk)->core.sysctl_busy_read;
 #endif
 
 	/*
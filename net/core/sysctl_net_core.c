@@ -24,6 +24,9 @@
 
 static int zero = 0;
 static int one = 1;
+#ifdef CONFIG_VE
+static int one_hundred = 100;
+#endif
 static int ushort_max = USHRT_MAX;
 
 #ifdef CONFIG_RPS
@@ -92,6 +95,18 @@ static int rps_sock_flow_sysctl(struct ctl_table *table, int write,
 #endif /* CONFIG_RPS */
 
 #ifdef CONFIG_NET_SCHED
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* Spinning burns host CPU, so only host admin may raise it in containers */
+static int busy_read_sysctl(struct ctl_table *table, int write,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	if (write && !capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	return proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+}
+#endif
+
 static int set_default_qdisc(struct ctl_table *table, int write,
 			     void __user *buffer, size_t *lenp, loff_t *ppos)
 {
@@ -203,18 +218,31 @@ static struct ctl_table net_core_table[] = {
 		.mode		= 0644,
 		.proc_handler	= rps_sock_flow_sysctl
 	},
+	{
+		.procname	= "rps_ve_steering",
+		.data		= &sysctl_rps_ve_steering,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 #endif
-#ifdef CONFIG_NET_RX_BUSY_POLL
+#ifdef CONFIG_VE
 	{
-		.procname	= "busy_poll",
-		.data		= &sysctl_net_busy_poll,
-		.maxlen		= sizeof(unsigned int),
+		.procname	= "ve_rx_softirq_max",
+		.data		= &sysctl_ve_rx_softirq_max,
+		.maxlen		= sizeof(int),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
 	},
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
 	{
-		.procname	= "busy_read",
-		.data		= &sysctl_net_busy_read,
+		.procname	= "busy_poll",
+		.data		= &sysctl_net_busy_poll,
 		.maxlen		= sizeof(unsigned int),
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec
@@ -256,6 +284,16 @@ static struct ctl_table netns_core_table[] = {
 		.extra2		= &ushort_max,
 		.proc_handler	= proc_dointvec_minmax
 	},
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	{
+		.procname	= "busy_read",
+		.data		= &init_net.core.sysctl_busy_read,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.extra1		= &zero,
+		.proc_handler	= busy_read_sysctl
+	},
+#endif
 	{ }
 };
 
@@ -264,6 +302,10 @@ static __net_init int sysctl_core_net_init(struct net *net)
 	struct ctl_table *tbl;
 
 	net->core.sysctl_somaxconn = SOMAXCONN;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* Containers start with what the host uses */
+	net->core.sysctl_busy_read = init_net.core.sysctl_busy_read;
+#endif
 
 	tbl = netns_core_table;
 	if (!net_eq(net, &init_net)) {
@@ -272,6 +314,9 @@ static __net_init int sysctl_core_net_init(struct net *net)
 			goto err_dup;
 
 		tbl[0].data = &net->core.sysctl_somaxconn;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+		tbl[1].data = &net->core.sysctl_busy_read;
+#endif
 
 		/* Don't export any sysctls to unprivileged users */
 		if (net->user_ns != &init_user_ns) {
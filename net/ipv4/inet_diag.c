@@ -818,6 +818,60 @@ out:
 	return err;
 }
 
+static int inet_diag_dump_ehash_sk(struct sock *sk, struct sk_buff *skb,
+		struct netlink_callback *cb, struct inet_diag_req_v2 *r,
+		struct nlattr *bc)
+{
+	int state;
+
+	state = (sk->sk_state == TCP_TIME_WAIT) ?
+		inet_twsk(sk)->tw_substate : sk->sk_state;
+	if (!(r->idiag_states & (1 << state)))
+		return 0;
+	if (r->sdiag_family != AF_UNSPEC &&
+	    sk->sk_family != r->sdiag_family)
+		return 0;
+	if (r->id.idiag_sport != htons(sk->sk_num) &&
+	    r->id.idiag_sport)
+		return 0;
+	if (r->id.idiag_dport != sk->sk_dport &&
+	    r->id.idiag_dport)
+		return 0;
+	if (sk->sk_state == TCP_TIME_WAIT)
+		return inet_twsk_diag_dump(sk, skb, cb, r, bc);
+	return inet_csk_diag_dump(sk, skb, cb, r, bc);
+}
+
+#ifdef CONFIG_NET_NS
+/*
+ * A container's sockets are all on its namespace list, see
+ * inet_ehash_netns_add(), so there is no need to scan the host-wide
+ * ehash table for them.  cb->args[2] counts the sockets of @hashinfo
+ * already visited on the list.
+ */
+static void inet_diag_dump_netns(struct inet_hashinfo *hashinfo,
+		struct net *net, struct sk_buff *skb,
+		struct netlink_callback *cb, struct inet_diag_req_v2 *r,
+		struct nlattr *bc, int s_num)
+{
+	struct sock *sk;
+	int num = 0;
+
+	spin_lock_bh(&net->ipv4.ehash_sk_lock);
+	hlist_for_each_entry(sk, &net->ipv4.ehash_sk_list, sk_netns_node) {
+		if (sk->sk_prot->h.hashinfo != hashinfo)
+			continue;
+		if (num >= s_num &&
+		    inet_diag_dump_ehash_sk(sk, skb, cb, r, bc) < 0)
+			break;
+		++num;
+	}
+	spin_unlock_bh(&net->ipv4.ehash_sk_lock);
+
+	cb->args[2] = num;
+}
+#endif
+
 void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
 		struct netlink_callback *cb, struct inet_diag_req_v2 *r, struct nlattr *bc)
 {
@@ -896,6 +950,13 @@ skip_listen_ht:
 	if (!(r->idiag_states & ~(TCPF_LISTEN | TCPF_SYN_RECV)))
 		goto out;
 
+#ifdef CONFIG_NET_NS
+	if (!net_eq(net, &init_net)) {
+		inet_diag_dump_netns(hashinfo, net, skb, cb, r, bc, s_num);
+		goto out;
+	}
+#endif
+
 	for (i = s_i; i <= hashinfo->ehash_mask; i++) {
 		struct inet_ehash_bucket *head = &hashinfo->ehash[i];
 		spinlock_t *lock = inet_ehash_lockp(hashinfo, i);
@@ -912,31 +973,11 @@ skip_listen_ht:
 
 		spin_lock_bh(lock);
 		sk_nulls_for_each(sk, node, &head->chain) {
-			int res;
-			int state;
-
 			if (!net_eq(sock_net(sk), net))
 				continue;
 			if (num < s_num)
 				goto next_normal;
-			state = (sk->sk_state == TCP_TIME_WAIT) ?
-				inet_twsk(sk)->tw_substate : sk->sk_state;
-			if (!(r->idiag_states & (1 << state)))
-				goto next_normal;
-			if (r->sdiag_family != AF_UNSPEC &&
-			    sk->sk_family != r->sdiag_family)
-				goto next_normal;
-			if (r->id.idiag_sport != htons(sk->sk_num) &&
-			    r->id.idiag_sport)
-				goto next_normal;
-			if (r->id.idiag_dport != sk->sk_dport &&
-			    r->id.idiag_dport)
-				goto next_normal;
-			if (sk->sk_state == TCP_TIME_WAIT)
-				res = inet_twsk_diag_dump(sk, skb, cb, r, bc);
-			else
-				res = inet_csk_diag_dump(sk, skb, cb, r, bc);
-			if (res < 0) {
+			if (inet_diag_dump_ehash_sk(sk, skb, cb, r, bc) < 0) {
 				spin_unlock_bh(lock);
 				goto done;
 			}
@@ -32,6 +32,7 @@ int inet_twsk_unhash(struct inet_timewait_sock *tw)
 
 	hlist_nulls_del_rcu(&tw->tw_node);
 	sk_nulls_node_init(&tw->tw_node);
+	inet_ehash_netns_del((struct sock *)tw);
 	/*
 	 * We cannot call inet_twsk_put() ourself under lock,
 	 * caller must call it for us.
@@ -160,10 +161,13 @@ void __inet_twsk_hashdance(struct inet_timewait_sock *tw, struct sock *sk,
 	 */
 	atomic_set(&tw->tw_refcnt, 1 + 1 + 1);
 	inet_twsk_add_node_rcu(tw, &ehead->chain);
+	inet_ehash_netns_add((struct sock *)tw);
 
 	/* Step 3: Remove SK from hash chain */
-	if (__sk_nulls_del_node_init_rcu(sk))
+	if (__sk_nulls_del_node_init_rcu(sk)) {
+		inet_ehash_netns_del(sk);
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
+	}
 
 	spin_unlock(lock);
 }
@@ -203,6 +207,9 @@ struct inet_timewait_sock *inet_twsk_alloc(const struct sock *sk, const int stat
 		 */
 		atomic_set(&tw->tw_refcnt, 0);
 		inet_twsk_dead_node_init(tw);
+#ifdef CONFIG_NET_NS
+		INIT_HLIST_NODE(&tw->tw_netns_node);
+#endif
 		__module_get(tw->tw_prot->owner);
 	}
 
@@ -1446,7 +1446,12 @@ static int tcp_v4_conn_req_fastopen(struct sock *sk,
 	return 0;
 }
 
-int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+/*
+ * @lockless: the listener is not locked, only syn_wait_lock is held for
+ * read. Only a cookie may be sent then, the SYN queue must not be touched.
+ */
+static int __tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb,
+				 bool lockless)
 {
 	struct tcp_options_received tmp_opt;
 	struct request_sock *req;
@@ -1471,7 +1476,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	 * limitations, they conserve resources and peer is
 	 * evidently real one.
 	 */
-	if ((sysctl_tcp_syncookies == 2 ||
+	if ((lockless || sysctl_tcp_syncookies == 2 ||
 	     inet_csk_reqsk_queue_is_full(sk)) && !isn) {
 		want_cookie = tcp_syn_flood_action(sk, skb, "TCP");
 		if (!want_cookie)
@@ -1567,7 +1572,8 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 		if (dst == NULL)
 			goto drop_and_free;
 	}
-	do_fastopen = tcp_fastopen_check(sk, skb, req, &foc, &valid_foc);
+	do_fastopen = !lockless &&
+		      tcp_fastopen_check(sk, skb, req, &foc, &valid_foc);
 
 	/* We don't call tcp_v4_send_synack() directly because we need
 	 * to make sure a child socket can be created successfully before
@@ -1617,8 +1623,51 @@ drop:
 	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_LISTENDROPS);
 	return 0;
 }
+
+int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+{
+	return __tcp_v4_conn_request(sk, skb, false);
+}
 EXPORT_SYMBOL(tcp_v4_conn_request);
 
+#ifdef CONFIG_SYN_COOKIES
+/*
+ * When every SYN is answered with a cookie, as under SYN flood, nothing
+ * of the listener changes, so don't serialize all SYNs on the listener
+ * lock. syn_wait_lock keeps listen_opt and the SYN queue stable: a SYN
+ * retransmitted for a queued request still goes the locked way, not to
+ * answer it with other ISN than the request has. Returns true if skb
+ * was handled.
+ */
+static bool tcp_v4_syn_cookie_lockless(struct sock *sk, struct sk_buff *skb)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	struct request_sock **prev;
+	bool done = false;
+
+	if (!sysctl_tcp_syncookies || sk->sk_family != AF_INET ||
+	    !th->syn || th->ack || th->rst || th->fin)
+		return false;
+
+	if (tcp_checksum_complete(skb))
+		return false;
+
+	read_lock(&queue->syn_wait_lock);
+	if (queue->listen_opt && sk->sk_state == TCP_LISTEN &&
+	    (sysctl_tcp_syncookies == 2 || inet_csk_reqsk_queue_is_full(sk)) &&
+	    !inet_csk_search_req(sk, &prev, th->source,
+				 iph->saddr, iph->daddr)) {
+		__tcp_v4_conn_request(sk, skb, true);
+		done = true;
+	}
+	read_unlock(&queue->syn_wait_lock);
+
+	return done;
+}
+#endif
+
 
 /*
  * The three way handshake has completed - we got a valid synack -
@@ -1989,6 +2038,19 @@ process:
 	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
+	/* Listeners keep the cpu user asked for with SO_INCOMING_CPU */
+	if (sk->sk_state != TCP_LISTEN)
+		sk_incoming_cpu_update(sk);
+
+#ifdef CONFIG_SYN_COOKIES
+	if (sk->sk_state == TCP_LISTEN &&
+	    tcp_v4_syn_cookie_lockless(sk, skb)) {
+		sock_put(sk);
+		consume_skb(skb);
+		return 0;
+	}
+#endif
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -2096,6 +2158,7 @@ const struct inet_connection_sock_af_ops ipv4_specific = {
 	.addr2sockaddr	   = inet_csk_addr2sockaddr,
 	.sockaddr_len	   = sizeof(struct sockaddr_in),
 	.bind_conflict	   = inet_csk_bind_conflict,
+	.recv_error	   = ip_recv_error,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_ip_setsockopt,
 	.compat_getsockopt = compat_ip_getsockopt,
@@ -2751,6 +2814,8 @@ EXPORT_SYMBOL(tcp_prot);
 static int __net_init tcp_sk_init(struct net *net)
 {
 	net->ipv4.sysctl_tcp_ecn = 2;
+	INIT_HLIST_HEAD(&net->ipv4.ehash_sk_list);
+	spin_lock_init(&net->ipv4.ehash_sk_lock);
 	return 0;
 }
 
@@ -120,6 +120,8 @@ int tcp_init_cgroup(struct mem_cgroup *memcg, struct cgroup_subsys *ss)
 	cg_proto->memory_allocated = &tcp->tcp_memory_allocated;
 	cg_proto->sockets_allocated = &tcp->tcp_sockets_allocated;
 	cg_proto->memcg = memcg;
+	/* the charge stock is an optimization, do without it on failure */
+	cg_proto->stock = alloc_percpu(unsigned int);
 
 	return 0;
 }
@@ -137,6 +139,7 @@ void tcp_destroy_cgroup(struct mem_cgroup *memcg)
 	tcp = tcp_from_cgproto(cg_proto);
 	percpu_counter_destroy(&tcp->tcp_sockets_allocated);
 	percpu_counter_destroy(&tcp->tcp_orphan_count);
+	free_percpu(cg_proto->stock);
 }
 EXPORT_SYMBOL(tcp_destroy_cgroup);
 
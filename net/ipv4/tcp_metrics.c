@@ -94,8 +94,6 @@ struct tcpm_hash_bucket {
 	struct tcp_metrics_block __rcu	*chain;
 };
 
-static DEFINE_SPINLOCK(tcp_metrics_lock);
-
 static void tcpm_suck_dst(struct tcp_metrics_block *tm, struct dst_entry *dst,
 			  bool fastopen_clear)
 {
@@ -135,11 +133,18 @@ static struct tcp_metrics_block *tcpm_new(struct dst_entry *dst,
 					  unsigned int hash,
 					  bool reclaim)
 {
+	struct net *net = dev_net(dst->dev);
 	struct tcp_metrics_block *tm;
-	struct net *net;
 
-	spin_lock_bh(&tcp_metrics_lock);
-	net = dev_net(dst->dev);
+	spin_lock_bh(&net->ipv4.tcp_metrics_lock);
+	if (unlikely(!reclaim &&
+		     net->ipv4.tcp_metrics_count >= net->ipv4.tcp_metrics_max)) {
+		/* Full, recycle the oldest entry of the chain if any */
+		tm = NULL;
+		if (!net->ipv4.tcp_metrics_hash[hash].chain)
+			goto out_unlock;
+		reclaim = true;
+	}
 	if (unlikely(reclaim)) {
 		struct tcp_metrics_block *oldest;
 
@@ -162,10 +167,11 @@ static struct tcp_metrics_block *tcpm_new(struct dst_entry *dst,
 	if (likely(!reclaim)) {
 		tm->tcpm_next = net->ipv4.tcp_metrics_hash[hash].chain;
 		rcu_assign_pointer(net->ipv4.tcp_metrics_hash[hash].chain, tm);
+		net->ipv4.tcp_metrics_count++;
 	}
 
 out_unlock:
-	spin_unlock_bh(&tcp_metrics_lock);
+	spin_unlock_bh(&net->ipv4.tcp_metrics_lock);
 	return tm;
 }
 
@@ -932,9 +938,9 @@ out_free:
 	return ret;
 }
 
-#define deref_locked_genl(p)	\
+#define deref_locked_genl(net, p)	\
 	rcu_dereference_protected(p, lockdep_genl_is_held() && \
-				     lockdep_is_held(&tcp_metrics_lock))
+			lockdep_is_held(&(net)->ipv4.tcp_metrics_lock))
 
 #define deref_genl(p)	rcu_dereference_protected(p, lockdep_genl_is_held())
 
@@ -946,17 +952,25 @@ static int tcp_metrics_flush_all(struct net *net)
 	unsigned int row;
 
 	for (row = 0; row < max_rows; row++, hb++) {
-		spin_lock_bh(&tcp_metrics_lock);
-		tm = deref_locked_genl(hb->chain);
+		unsigned int freed = 0;
+
+		spin_lock_bh(&net->ipv4.tcp_metrics_lock);
+		tm = deref_locked_genl(net, hb->chain);
 		if (tm)
 			hb->chain = NULL;
-		spin_unlock_bh(&tcp_metrics_lock);
+		spin_unlock_bh(&net->ipv4.tcp_metrics_lock);
 		while (tm) {
 			struct tcp_metrics_block *next;
 
 			next = deref_genl(tm->tcpm_next);
 			kfree_rcu(tm, rcu_head);
 			tm = next;
+			freed++;
+		}
+		if (freed) {
+			spin_lock_bh(&net->ipv4.tcp_metrics_lock);
+			net->ipv4.tcp_metrics_count -= freed;
+			spin_unlock_bh(&net->ipv4.tcp_metrics_lock);
 		}
 	}
 	return 0;
@@ -981,15 +995,16 @@ static int tcp_metrics_nl_cmd_del(struct sk_buff *skb, struct genl_info *info)
 	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
 	hb = net->ipv4.tcp_metrics_hash + hash;
 	pp = &hb->chain;
-	spin_lock_bh(&tcp_metrics_lock);
-	for (tm = deref_locked_genl(*pp); tm;
-	     pp = &tm->tcpm_next, tm = deref_locked_genl(*pp)) {
+	spin_lock_bh(&net->ipv4.tcp_metrics_lock);
+	for (tm = deref_locked_genl(net, *pp); tm;
+	     pp = &tm->tcpm_next, tm = deref_locked_genl(net, *pp)) {
 		if (addr_same(&tm->tcpm_addr, &addr)) {
 			*pp = tm->tcpm_next;
+			net->ipv4.tcp_metrics_count--;
 			break;
 		}
 	}
-	spin_unlock_bh(&tcp_metrics_lock);
+	spin_unlock_bh(&net->ipv4.tcp_metrics_lock);
 	if (!tm)
 		return -ESRCH;
 	kfree_rcu(tm, rcu_head);
@@ -1040,8 +1055,18 @@ static int __net_init tcp_net_metrics_init(struct net *net)
 		else
 			slots = 8 * 1024;
 	}
+	/*
+	 * Containers talk to far fewer peers than the host does, and
+	 * there may be thousands of them: size their caches accordingly.
+	 */
+	if (!net_eq(net, &init_net))
+		slots = max(slots >> 4, 64U);
 
+	spin_lock_init(&net->ipv4.tcp_metrics_lock);
 	net->ipv4.tcp_metrics_hash_log = order_base_2(slots);
+	/* what the reclaim of deep chains bounds the hash to anyway */
+	net->ipv4.tcp_metrics_max = (TCP_METRICS_RECLAIM_DEPTH + 1) <<
+				    net->ipv4.tcp_metrics_hash_log;
 	size = sizeof(struct tcpm_hash_bucket) << net->ipv4.tcp_metrics_hash_log;
 
 	net->ipv4.tcp_metrics_hash = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
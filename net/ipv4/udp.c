@@ -1161,6 +1161,42 @@ out:
 }
 
 
+/*
+ * Move everything softirq queued so far to the reader queue, under a
+ * single acquisition of sk_receive_queue.lock.  The reader queue lock
+ * must be held with BH disabled.
+ */
+static void udp_splice_receive_queue(struct sock *sk)
+{
+	struct sk_buff_head *sk_queue = &sk->sk_receive_queue;
+
+	if (skb_queue_empty(sk_queue))
+		return;
+
+	spin_lock(&sk_queue->lock);
+	skb_queue_splice_tail_init(sk_queue, &udp_sk(sk)->reader_queue);
+	spin_unlock(&sk_queue->lock);
+}
+
+static struct sk_buff *__first_packet_length(struct sock *sk,
+					     struct sk_buff_head *rcvq,
+					     struct sk_buff_head *list_kill)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_peek(rcvq)) != NULL &&
+		udp_lib_checksum_complete(skb)) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_CSUMERRORS,
+				 IS_UDPLITE(sk));
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+				 IS_UDPLITE(sk));
+		atomic_inc(&sk->sk_drops);
+		__skb_unlink(skb, rcvq);
+		__skb_queue_tail(list_kill, skb);
+	}
+	return skb;
+}
+
 /**
  *	first_packet_length	- return length of first packet in receive queue
  *	@sk: socket
@@ -1170,22 +1206,17 @@ out:
  */
 static unsigned int first_packet_length(struct sock *sk)
 {
-	struct sk_buff_head list_kill, *rcvq = &sk->sk_receive_queue;
+	struct sk_buff_head list_kill, *rcvq = &udp_sk(sk)->reader_queue;
 	struct sk_buff *skb;
 	unsigned int res;
 
 	__skb_queue_head_init(&list_kill);
 
 	spin_lock_bh(&rcvq->lock);
-	while ((skb = skb_peek(rcvq)) != NULL &&
-		udp_lib_checksum_complete(skb)) {
-		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_CSUMERRORS,
-				 IS_UDPLITE(sk));
-		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
-				 IS_UDPLITE(sk));
-		atomic_inc(&sk->sk_drops);
-		__skb_unlink(skb, rcvq);
-		__skb_queue_tail(&list_kill, skb);
+	skb = __first_packet_length(sk, rcvq, &list_kill);
+	if (!skb && !skb_queue_empty(&sk->sk_receive_queue)) {
+		udp_splice_receive_queue(sk);
+		skb = __first_packet_length(sk, rcvq, &list_kill);
 	}
 	res = skb ? skb->len : 0;
 	spin_unlock_bh(&rcvq->lock);
@@ -1237,6 +1268,69 @@ int udp_ioctl(struct sock *sk, int cmd, unsigned long arg)
 }
 EXPORT_SYMBOL(udp_ioctl);
 
+/**
+ *	__skb_recv_udp - receive a datagram from a UDP socket
+ *
+ *	Same as __skb_recv_datagram(), except that datagrams are taken from
+ *	the socket's reader queue.  When that runs dry, the whole
+ *	sk_receive_queue is spliced onto it, so that a reader draining a
+ *	busy socket takes the lock shared with softirq once per batch
+ *	rather than once per datagram.
+ */
+struct sk_buff *__skb_recv_udp(struct sock *sk, unsigned int flags,
+			       int *peeked, int *off, int *err)
+{
+	struct sk_buff_head *queue = &udp_sk(sk)->reader_queue;
+	struct sk_buff *skb, *last;
+	long timeo;
+	int error = sock_error(sk);
+
+	if (error)
+		goto no_packet;
+
+	timeo = sock_rcvtimeo(sk, flags & MSG_DONTWAIT);
+
+	do {
+		spin_lock_bh(&queue->lock);
+		skb = __skb_try_recv_from_queue(sk, queue, flags, peeked,
+						off, &last);
+		if (!skb && !skb_queue_empty(&sk->sk_receive_queue)) {
+			udp_splice_receive_queue(sk);
+			skb = __skb_try_recv_from_queue(sk, queue, flags,
+							peeked, off, &last);
+		}
+		spin_unlock_bh(&queue->lock);
+		if (skb)
+			return skb;
+
+		if (sk_can_busy_loop(sk) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
+
+		/* User doesn't want to wait */
+		error = -EAGAIN;
+		if (!timeo)
+			goto no_packet;
+
+		/* everything was spliced, wait for the next enqueue */
+		last = (struct sk_buff *)&sk->sk_receive_queue;
+	} while (!__skb_wait_for_more_packets(sk, err, &timeo, last));
+
+	return NULL;
+
+no_packet:
+	*err = error;
+	return NULL;
+}
+EXPORT_SYMBOL(__skb_recv_udp);
+
+int udp_skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
+			  unsigned int flags)
+{
+	return __skb_kill_datagram(sk, &udp_sk(sk)->reader_queue, skb, flags);
+}
+EXPORT_SYMBOL(udp_skb_kill_datagram);
+
 /*
  * 	This should be easy, if there is something there we
  * 	return it, otherwise we block.
@@ -1258,8 +1352,8 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		return ip_recv_error(sk, msg, len, addr_len);
 
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &off, &err);
+	skb = __skb_recv_udp(sk, flags | (noblock ? MSG_DONTWAIT : 0),
+			     &peeked, &off, &err);
 	if (!skb)
 		goto out;
 
@@ -1331,7 +1425,7 @@ out:
 
 csum_copy_err:
 	slow = lock_sock_fast(sk);
-	if (!skb_kill_datagram(sk, skb, flags)) {
+	if (!udp_skb_kill_datagram(sk, skb, flags)) {
 		UDP_INC_STATS_USER(sock_net(sk), UDP_MIB_CSUMERRORS, is_udplite);
 		UDP_INC_STATS_USER(sock_net(sk), UDP_MIB_INERRORS, is_udplite);
 	}
@@ -1812,6 +1906,8 @@ void udp_destroy_sock(struct sock *sk)
 	struct udp_sock *up = udp_sk(sk);
 	bool slow = lock_sock_fast(sk);
 	udp_flush_pending_frames(sk);
+	__skb_queue_purge(&up->reader_queue);
+	sk_mem_reclaim_partial(sk);
 	unlock_sock_fast(sk, slow);
 	if (static_key_false(&udp_encap_needed) && up->encap_type) {
 		void (*encap_destroy)(struct sock *sk);
@@ -2026,6 +2122,9 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	unsigned int mask = datagram_poll(file, sock, wait);
 	struct sock *sk = sock->sk;
 
+	if (!skb_queue_empty(&udp_sk(sk)->reader_queue))
+		mask |= POLLIN | POLLRDNORM;
+
 	/* Check for false positives due to checksum errors */
 	if ((mask & POLLRDNORM) && !(file->f_flags & O_NONBLOCK) &&
 	    !(sk->sk_shutdown & RCV_SHUTDOWN) && !first_packet_length(sk))
@@ -2038,6 +2137,8 @@ EXPORT_SYMBOL(udp_poll);
 
 int udp_init_sock(struct sock *sk)
 {
+	skb_queue_head_init(&udp_sk(sk)->reader_queue);
+
 	local_bh_disable();
 	sock_update_memcg(sk);
 	local_bh_enable();
@@ -48,12 +48,20 @@ int udp_init_cgroup(struct mem_cgroup *memcg, struct cgroup_subsys *ss)
 	cg_proto->sysctl_mem = udp->udp_prot_mem;
 	cg_proto->memory_allocated = &udp->udp_memory_allocated;
 	cg_proto->memcg = memcg;
+	cg_proto->stock = alloc_percpu(unsigned int);
 
 	return 0;
 }
 
 void udp_destroy_cgroup(struct mem_cgroup *memcg)
 {
+	struct cg_proto *cg_proto;
+
+	cg_proto = udp_prot.proto_cgroup(memcg);
+	if (!cg_proto)
+		return;
+
+	free_percpu(cg_proto->stock);
 }
 
 static int udp_update_limit(struct mem_cgroup *memcg, u64 val)
@@ -47,6 +47,7 @@ int __inet6_hash(struct sock *sk, struct inet_timewait_sock *tw)
 		lock = inet_ehash_lockp(hashinfo, hash);
 		spin_lock(lock);
 		__sk_nulls_add_node_rcu(sk, list);
+		inet_ehash_netns_add(sk);
 		if (tw) {
 			WARN_ON(sk->sk_hash != tw->tw_hash);
 			twrefcnt = inet_twsk_unhash(tw);
@@ -131,6 +132,8 @@ static inline int compute_score(struct sock *sk, struct net *net,
 				return -1;
 			score++;
 		}
+		if (sk->sk_incoming_cpu == raw_smp_processor_id())
+			score++;
 	}
 	return score;
 }
@@ -252,6 +255,7 @@ static int __inet6_check_established(struct inet_timewait_death_row *death_row,
 	sk->sk_hash = hash;
 	WARN_ON(!sk_unhashed(sk));
 	__sk_nulls_add_node_rcu(sk, &head->chain);
+	inet_ehash_netns_add(sk);
 	if (tw) {
 		twrefcnt = inet_twsk_unhash(tw);
 		NET_INC_STATS_BH(net, LINUX_MIB_TIMEWAITRECYCLED);
@@ -1488,6 +1488,10 @@ process:
 	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
+	/* Listeners keep the cpu user asked for with SO_INCOMING_CPU */
+	if (sk->sk_state != TCP_LISTEN)
+		sk_incoming_cpu_update(sk);
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1625,6 +1629,7 @@ static const struct inet_connection_sock_af_ops ipv6_specific = {
 	.addr2sockaddr	   = inet6_csk_addr2sockaddr,
 	.sockaddr_len	   = sizeof(struct sockaddr_in6),
 	.bind_conflict	   = inet6_csk_bind_conflict,
+	.recv_error	   = ipv6_recv_error,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_ipv6_setsockopt,
 	.compat_getsockopt = compat_ipv6_getsockopt,
@@ -1656,6 +1661,7 @@ static const struct inet_connection_sock_af_ops ipv6_mapped = {
 	.addr2sockaddr	   = inet6_csk_addr2sockaddr,
 	.sockaddr_len	   = sizeof(struct sockaddr_in6),
 	.bind_conflict	   = inet6_csk_bind_conflict,
+	.recv_error	   = ipv6_recv_error,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_ipv6_setsockopt,
 	.compat_getsockopt = compat_ipv6_getsockopt,
@@ -377,8 +377,8 @@ int udpv6_recvmsg(struct kiocb *iocb, struct sock *sk,
 		return ipv6_recv_rxpmtu(sk, msg, len, addr_len);
 
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &off, &err);
+	skb = __skb_recv_udp(sk, flags | (noblock ? MSG_DONTWAIT : 0),
+			     &peeked, &off, &err);
 	if (!skb)
 		goto out;
 
@@ -476,7 +476,7 @@ out:
 
 csum_copy_err:
 	slow = lock_sock_fast(sk);
-	if (!skb_kill_datagram(sk, skb, flags)) {
+	if (!udp_skb_kill_datagram(sk, skb, flags)) {
 		if (is_udp4) {
 			UDP_INC_STATS_USER(sock_net(sk),
 					UDP_MIB_CSUMERRORS, is_udplite);
@@ -1342,6 +1342,8 @@ void udpv6_destroy_sock(struct sock *sk)
 	struct udp_sock *up = udp_sk(sk);
 	lock_sock(sk);
 	udp_v6_flush_pending_frames(sk);
+	__skb_queue_purge(&up->reader_queue);
+	sk_mem_reclaim_partial(sk);
 	release_sock(sk);
 
 	if (static_key_false(&udpv6_encap_needed) && up->encap_type) {
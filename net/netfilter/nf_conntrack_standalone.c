@@ -414,6 +414,24 @@ static int log_invalid_proto_max = 255;
 
 static struct ctl_table_header *nf_ct_netfilter_header;
 
+static int nf_conntrack_hash_sysctl(struct ctl_table *table, int write,
+				    void __user *buffer, size_t *lenp,
+				    loff_t *ppos)
+{
+	struct net *net = container_of(table->data, struct net,
+				       ct.htable_size);
+	struct ctl_table tmp = *table;
+	unsigned int hashsize = net->ct.htable_size;
+	int ret;
+
+	tmp.data = &hashsize;
+	ret = proc_dointvec(&tmp, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	return nf_conntrack_hash_resize(net, hashsize);
+}
+
 static struct ctl_table nf_ct_sysctl_table[] = {
 	{
 		.procname	= "nf_conntrack_max",
@@ -433,8 +451,8 @@ static struct ctl_table nf_ct_sysctl_table[] = {
 		.procname       = "nf_conntrack_buckets",
 		.data           = &init_net.ct.htable_size,
 		.maxlen         = sizeof(unsigned int),
-		.mode           = 0444,
-		.proc_handler   = proc_dointvec,
+		.mode           = 0644,
+		.proc_handler   = nf_conntrack_hash_sysctl,
 	},
 	{
 		.procname	= "nf_conntrack_checksum",
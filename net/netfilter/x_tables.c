@@ -71,7 +71,7 @@ static const char *const xt_prefix[NFPROTO_NUMPROTO] = {
 #ifdef CONFIG_BEANCOUNTERS
 static void uncharge_xtables(struct xt_table_info *info, unsigned long size)
 {
-	uncharge_beancounter(info->ub, UB_NUMXTENT, size);
+	uncharge_beancounter_fast(info->ub, UB_NUMXTENT, size);
 }
 
 static int recharge_xtables(struct xt_table_info *new, struct xt_table_info *old)
@@ -90,13 +90,13 @@ static int recharge_xtables(struct xt_table_info *new, struct xt_table_info *old
 	}
 
 	if (change > 0) {
-		if (charge_beancounter(ub, UB_NUMXTENT, change, UB_SOFT))
+		if (charge_beancounter_fast(ub, UB_NUMXTENT, change, UB_SOFT))
 			return -ENOMEM;
 	} else if (change < 0)
-		uncharge_beancounter(ub, UB_NUMXTENT, -change);
+		uncharge_beancounter_fast(ub, UB_NUMXTENT, -change);
 
 	if (old_ub != ub)
-		uncharge_beancounter(old_ub, UB_NUMXTENT, old->number);
+		uncharge_beancounter_fast(old_ub, UB_NUMXTENT, old->number);
 
 	return 0;
 }
@@ -743,31 +743,25 @@ EXPORT_SYMBOL_GPL(xt_compat_target_to_user);
 struct xt_table_info *xt_alloc_table_info(unsigned int size)
 {
 	struct xt_table_info *newinfo;
-	int cpu;
 
 	/* Pedantry: prevent them from hitting BUG() in vmalloc.c --RR */
 	if ((SMP_ALIGN(size) >> PAGE_SHIFT) + 2 > totalram_pages)
 		return NULL;
 
-	newinfo = kzalloc(XT_TABLE_INFO_SZ, GFP_KERNEL);
+	newinfo = kzalloc(sizeof(*newinfo), GFP_KERNEL);
 	if (!newinfo)
 		return NULL;
 
 	newinfo->size = size;
 
-	for_each_possible_cpu(cpu) {
-		if (size <= PAGE_SIZE)
-			newinfo->entries[cpu] = kmalloc_node(size,
-							GFP_KERNEL,
-							cpu_to_node(cpu));
-		else
-			newinfo->entries[cpu] = vmalloc_node(size,
-							cpu_to_node(cpu));
+	if (size <= PAGE_SIZE)
+		newinfo->entries = kmalloc(size, GFP_KERNEL);
+	else
+		newinfo->entries = vmalloc(size);
 
-		if (newinfo->entries[cpu] == NULL) {
-			xt_free_table_info(newinfo);
-			return NULL;
-		}
+	if (newinfo->entries == NULL) {
+		xt_free_table_info(newinfo);
+		return NULL;
 	}
 
 	newinfo->ub = get_beancounter(get_exec_ub());
@@ -780,12 +774,10 @@ void xt_free_table_info(struct xt_table_info *info)
 {
 	int cpu;
 
-	for_each_possible_cpu(cpu) {
-		if (info->size <= PAGE_SIZE)
-			kfree(info->entries[cpu]);
-		else
-			vfree(info->entries[cpu]);
-	}
+	if (info->size <= PAGE_SIZE)
+		kfree(info->entries);
+	else
+		vfree(info->entries);
 
 	if (info->jumpstack != NULL) {
 		if (sizeof(void *) * info->stacksize > PAGE_SIZE) {
@@ -284,6 +284,77 @@ static struct rpc_xprt *rpc_clnt_set_transport(struct rpc_clnt *clnt,
 	return old;
 }
 
+static void rpc_put_xprt_set(struct rpc_xprt_set *set)
+{
+	unsigned int i;
+
+	if (set == NULL || !atomic_dec_and_test(&set->count))
+		return;
+	for (i = 0; i < set->nr; i++)
+		xprt_put(set->xprts[i]);
+	kfree(set);
+}
+
+/* Called under rcu_read_lock(), the owner keeps the set alive */
+static struct rpc_xprt_set *rpc_get_xprt_set(struct rpc_xprt_set *set)
+{
+	if (set != NULL)
+		atomic_inc(&set->count);
+	return set;
+}
+
+/*
+ * Create @nr more transports to the peer of @args for a client that was
+ * asked for several connections.
+ */
+static struct rpc_xprt_set *rpc_alloc_xprt_set(struct xprt_create *args,
+		unsigned int resvport, unsigned int nr)
+{
+	struct rpc_xprt_set *set;
+	struct rpc_xprt *xprt;
+
+	set = kzalloc(sizeof(*set) + nr * sizeof(set->xprts[0]), GFP_KERNEL);
+	if (set == NULL)
+		return ERR_PTR(-ENOMEM);
+	atomic_set(&set->count, 1);
+
+	while (set->nr < nr) {
+		xprt = xprt_create_transport(args);
+		if (IS_ERR(xprt)) {
+			rpc_put_xprt_set(set);
+			return ERR_CAST(xprt);
+		}
+		xprt->resvport = resvport;
+		set->xprts[set->nr++] = xprt;
+	}
+	return set;
+}
+
+/*
+ * Pick the transport for a new task. Swap-out traffic stays on cl_xprt,
+ * which is the one xs_swapper() marks.
+ */
+static struct rpc_xprt *rpc_task_get_xprt(struct rpc_clnt *clnt,
+		struct rpc_task *task)
+{
+	struct rpc_xprt_set *set;
+	struct rpc_xprt *xprt = NULL;
+	unsigned int idx;
+
+	rcu_read_lock();
+	set = rcu_dereference(clnt->cl_xprt_set);
+	if (set != NULL && !(task->tk_flags & RPC_TASK_SWAPPER)) {
+		idx = (unsigned int)atomic_inc_return(&set->next) %
+			(set->nr + 1);
+		if (idx < set->nr)
+			xprt = xprt_get(set->xprts[idx]);
+	}
+	if (xprt == NULL)
+		xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+	rcu_read_unlock();
+	return xprt;
+}
+
 static void rpc_clnt_set_nodename(struct rpc_clnt *clnt, const char *nodename)
 {
 	clnt->cl_nodelen = strlen(nodename);
@@ -482,7 +553,10 @@ EXPORT_SYMBOL_GPL(rpc_create_xprt);
  */
 struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 {
+	struct rpc_xprt_set *set;
 	struct rpc_xprt *xprt;
+	struct rpc_clnt *clnt;
+	unsigned int nconnect;
 	struct xprt_create xprtargs = {
 		.net = args->net,
 		.ident = args->protocol,
@@ -546,7 +620,18 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
 		xprt->resvport = 0;
 
-	return rpc_create_xprt(args, xprt);
+	clnt = rpc_create_xprt(args, xprt);
+	if (IS_ERR(clnt) || args->nconnect <= 1)
+		return clnt;
+
+	nconnect = min_t(unsigned int, args->nconnect, RPC_MAX_CONNECT);
+	set = rpc_alloc_xprt_set(&xprtargs, xprt->resvport, nconnect - 1);
+	if (IS_ERR(set)) {
+		rpc_shutdown_client(clnt);
+		return ERR_CAST(set);
+	}
+	rcu_assign_pointer(clnt->cl_xprt_set, set);
+	return clnt;
 }
 EXPORT_SYMBOL_GPL(rpc_create);
 
@@ -576,6 +661,11 @@ static struct rpc_clnt *__rpc_clone_client(struct rpc_create_args *args,
 		goto out_err;
 	}
 
+	rcu_read_lock();
+	rcu_assign_pointer(new->cl_xprt_set,
+			   rpc_get_xprt_set(rcu_dereference(clnt->cl_xprt_set)));
+	rcu_read_unlock();
+
 	/* Turn off autobind on clones */
 	new->cl_autobind = 0;
 	new->cl_softrtry = clnt->cl_softrtry;
@@ -649,6 +739,7 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 {
 	const struct rpc_timeout *old_timeo;
 	rpc_authflavor_t pseudoflavor;
+	struct rpc_xprt_set *old_set;
 	struct rpc_xprt *xprt, *old;
 	struct rpc_clnt *parent;
 	int err;
@@ -665,6 +756,10 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	old_timeo = clnt->cl_timeout;
 	old = rpc_clnt_set_transport(clnt, xprt, timeout);
 
+	/* The extra connections lead to the old server */
+	old_set = rcu_dereference_protected(clnt->cl_xprt_set, 1);
+	rcu_assign_pointer(clnt->cl_xprt_set, NULL);
+
 	rpc_unregister_client(clnt);
 	__rpc_clnt_remove_pipedir(clnt);
 
@@ -688,12 +783,14 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	synchronize_rcu();
 	if (parent != clnt)
 		rpc_release_client(parent);
+	rpc_put_xprt_set(old_set);
 	xprt_put(old);
 	dprintk("RPC:       replaced xprt for clnt %p\n", clnt);
 	return 0;
 
 out_revert:
 	rpc_clnt_set_transport(clnt, old, old_timeo);
+	rcu_assign_pointer(clnt->cl_xprt_set, old_set);
 	clnt->cl_parent = parent;
 	rpc_client_register(clnt, pseudoflavor, NULL);
 	xprt_put(xprt);
@@ -772,6 +869,7 @@ rpc_free_client(struct rpc_clnt *clnt)
 	rpc_unregister_client(clnt);
 	rpc_free_iostats(clnt->cl_metrics);
 	clnt->cl_metrics = NULL;
+	rpc_put_xprt_set(rcu_dereference_raw(clnt->cl_xprt_set));
 	xprt_put(rcu_dereference_raw(clnt->cl_xprt));
 	rpciod_down();
 	rpc_free_clid(clnt);
@@ -866,6 +964,8 @@ void rpc_task_release_client(struct rpc_task *task)
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
 
+		xprt_put(task->tk_xprt);
+		task->tk_xprt = NULL;
 		rpc_release_client(clnt);
 	}
 }
@@ -890,6 +990,7 @@ void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 				task->tk_flags |= RPC_TASK_SWAPPER;
 			rcu_read_unlock();
 		}
+		task->tk_xprt = rpc_task_get_xprt(clnt, task);
 		/* Add to the client's list of all tasks */
 		spin_lock(&clnt->cl_lock);
 		list_add_tail(&task->tk_task, &clnt->cl_tasks);
@@ -1269,12 +1370,20 @@ EXPORT_SYMBOL_GPL(rpc_localaddr);
 void
 rpc_setbufsize(struct rpc_clnt *clnt, unsigned int sndsize, unsigned int rcvsize)
 {
+	struct rpc_xprt_set *set;
 	struct rpc_xprt *xprt;
+	unsigned int i;
 
 	rcu_read_lock();
 	xprt = rcu_dereference(clnt->cl_xprt);
 	if (xprt->ops->set_buffer_size)
 		xprt->ops->set_buffer_size(xprt, sndsize, rcvsize);
+	set = rcu_dereference(clnt->cl_xprt_set);
+	for (i = 0; set != NULL && i < set->nr; i++) {
+		xprt = set->xprts[i];
+		if (xprt->ops->set_buffer_size)
+			xprt->ops->set_buffer_size(xprt, sndsize, rcvsize);
+	}
 	rcu_read_unlock();
 }
 EXPORT_SYMBOL_GPL(rpc_setbufsize);
@@ -1353,9 +1462,15 @@ EXPORT_SYMBOL_GPL(rpc_get_timeout);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
+	struct rpc_xprt_set *set;
+	unsigned int i;
+
 	if (clnt->cl_autobind) {
 		rcu_read_lock();
 		xprt_clear_bound(rcu_dereference(clnt->cl_xprt));
+		set = rcu_dereference(clnt->cl_xprt_set);
+		for (i = 0; set != NULL && i < set->nr; i++)
+			xprt_clear_bound(set->xprts[i]);
 		rcu_read_unlock();
 	}
 }
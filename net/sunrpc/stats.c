@@ -180,8 +180,10 @@ static void _print_name(struct seq_file *seq, unsigned int op,
 void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 {
 	struct rpc_iostats *stats = clnt->cl_metrics;
+	struct rpc_xprt_set *set;
 	struct rpc_xprt *xprt;
 	unsigned int op, maxproc = clnt->cl_maxproc;
+	unsigned int i;
 
 	if (!stats)
 		return;
@@ -194,6 +196,9 @@ void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 	xprt = rcu_dereference(clnt->cl_xprt);
 	if (xprt)
 		xprt->ops->print_stats(xprt, seq);
+	set = rcu_dereference(clnt->cl_xprt_set);
+	for (i = 0; set != NULL && i < set->nr; i++)
+		set->xprts[i]->ops->print_stats(set->xprts[i], seq);
 	rcu_read_unlock();
 
 	seq_printf(seq, "\tper-op statistics\n");
@@ -0,0 +1,618 @@
+/*
+ * ploop_bench - performance regression harness for ploop
+ *
+ * Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Creates an image of the requested format, attaches it to a ploop device
+ * through the ploop ioctl interface and runs a fixed set of workloads on
+ * the device with O_DIRECT. Every workload prints one line of key=value
+ * pairs: IOPS, bandwidth, latency percentiles, CPU time per I/O and the
+ * change of every /sys/block/ploopN/pstat counter, so that runs on
+ * different kernels can be compared with a plain diff or a spreadsheet.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <linux/types.h>
+
+#define cpu_to_le32(x)	htole32(x)
+
+/* generate_pvd_header() needs it, but the image header has it kernel-only */
+struct ploop_pvd_header;
+static void put_SizeInSectors(__u64 size, struct ploop_pvd_header *vh,
+			      int version);
+
+#include "../../../../include/linux/ploop/ploop_if.h"
+#include "../../../../drivers/block/ploop/ploop1_image.h"
+
+static void put_SizeInSectors(__u64 size, struct ploop_pvd_header *vh,
+			      int version)
+{
+	if (version == PLOOP_FMT_V1)
+		vh->m_SizeInSectors_v1 = size;
+	else
+		vh->m_SizeInSectors_v2 = size;
+}
+
+#define MAX_THREADS	64
+#define MAX_SNAPSHOTS	8
+
+static const char *stat_names[] = {
+#define __DO(name)	#name,
+#include "../../../../include/linux/ploop/ploop_stat.h"
+#undef __DO
+};
+#define NR_STATS	(sizeof(stat_names) / sizeof(stat_names[0]))
+
+enum workload_type {
+	WL_SEQWRITE,
+	WL_SEQREAD,
+	WL_RANDWRITE,
+	WL_RANDREAD,
+	WL_FSYNC,
+	WL_SNAPSHOT,
+	WL_MERGE,
+	WL_MAX,
+};
+
+struct workload {
+	const char	*name;
+	unsigned int	bs;
+	bool		write;
+	bool		random;
+	bool		fsync;
+};
+
+static const struct workload workloads[WL_MAX] = {
+	[WL_SEQWRITE]	= { "seqwrite",	 1 << 20, true,	 false, false },
+	[WL_SEQREAD]	= { "seqread",	 1 << 20, false, false, false },
+	[WL_RANDWRITE]	= { "randwrite", 4096,	  true,	 true,	false },
+	[WL_RANDREAD]	= { "randread",	 4096,	  false, true,	false },
+	[WL_FSYNC]	= { "fsync",	 4096,	  true,	 true,	true  },
+	[WL_SNAPSHOT]	= { "snapshot",	 4096,	  true,	 true,	false },
+	[WL_MERGE]	= { "merge",	 4096,	  true,	 true,	false },
+};
+
+static const char *usage =
+"Usage: %s -d /dev/ploopN [options]\n"
+"\n"
+"	-d dev	ploop device to use, must not be in use\n"
+"	-D dir	directory for the images (default: current directory)\n"
+"	-f fmt	image format: raw or ploop1 (default: ploop1)\n"
+"	-e io	I/O engine: direct or kaio (default: direct)\n"
+"	-s MB	device size (default: 1024)\n"
+"	-c log	cluster size in sectors, log2 (default: 11, 1M)\n"
+"	-t sec	runtime of every workload (default: 10)\n"
+"	-j nr	number of I/O threads (default: 4)\n"
+"	-w list	comma separated workloads (default: all)\n"
+"		seqwrite,seqread,randwrite,randread,fsync,snapshot,merge\n"
+"	-k	keep the images\n";
+
+static const char *dev_path;
+static const char *image_dir = ".";
+static int fmt = PLOOP_FMT_PLOOP1;
+static int io_type = PLOOP_IO_DIRECT;
+static unsigned long long dev_size = 1024ULL << 20;
+static unsigned int cluster_log = 11;
+static unsigned int runtime = 10;
+static unsigned int nr_threads = 4;
+static unsigned int wl_mask = (1 << WL_MAX) - 1;
+static bool keep_images;
+
+static char *images[MAX_SNAPSHOTS + 1];
+static int nr_images;
+static int ctl_fd = -1;
+static char stat_dir[256];
+
+static void die(const char *what)
+{
+	fprintf(stderr, "ploop_bench: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Busy time of all cpus, kernel threads doing the I/O included */
+static uint64_t cpu_busy_us(void)
+{
+	unsigned long long v[8] = { 0 };
+	uint64_t busy = 0;
+	FILE *f;
+	int i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		die("/proc/stat");
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &v[0], &v[1], &v[2], &v[3], &v[4],
+		   &v[5], &v[6], &v[7]) < 4)
+		v[0] = 0;
+	fclose(f);
+
+	/* everything except idle and iowait */
+	for (i = 0; i < 8; i++)
+		if (i != 3 && i != 4)
+			busy += v[i];
+	return busy * 1000000ULL / sysconf(_SC_CLK_TCK);
+}
+
+static void read_stats(unsigned int *st)
+{
+	char path[512];
+	unsigned int i;
+	FILE *f;
+
+	for (i = 0; i < NR_STATS; i++) {
+		st[i] = 0;
+		snprintf(path, sizeof(path), "%s/%s",
+			 stat_dir, stat_names[i]);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%u", &st[i]) != 1)
+			st[i] = 0;
+		fclose(f);
+	}
+}
+
+static char *image_name(int level)
+{
+	char *name;
+
+	if (asprintf(&name, "%s/ploop_bench.%d.%s", image_dir, level,
+		     level || fmt == PLOOP_FMT_PLOOP1 ? "hdd" : "raw") < 0)
+		die("asprintf");
+	return name;
+}
+
+/* Empty ploop1 image: PVD header followed by a zeroed L2 table */
+static int create_ploop1(const char *name)
+{
+	struct ploop_pvd_header *vh;
+	unsigned int hdr_size;
+	void *buf;
+	int fd;
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die(name);
+
+	vh = calloc(1, sizeof(*vh));
+	if (!vh)
+		die("calloc");
+	hdr_size = generate_pvd_header(vh, dev_size >> 9, 1 << cluster_log,
+				       PLOOP_FMT_V2);
+	vh->m_Type = htole32(vh->m_Type);
+	vh->m_Heads = htole32(vh->m_Heads);
+	vh->m_Cylinders = htole32(vh->m_Cylinders);
+	vh->m_Sectors = htole32(vh->m_Sectors);
+	vh->m_Size = htole32(vh->m_Size);
+	vh->m_SizeInSectors_v2 = htole64(vh->m_SizeInSectors_v2);
+	vh->m_FirstBlockOffset = htole32(vh->m_FirstBlockOffset);
+
+	buf = calloc(1, hdr_size);
+	if (!buf)
+		die("calloc");
+	memcpy(buf, vh, sizeof(*vh));
+	if (pwrite(fd, buf, hdr_size, 0) != hdr_size || fsync(fd))
+		die(name);
+
+	free(buf);
+	free(vh);
+	return fd;
+}
+
+/* Raw image is preallocated, we measure ploop and not the allocator */
+static int create_raw(const char *name)
+{
+	int fd, err;
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die(name);
+	err = posix_fallocate(fd, 0, dev_size);
+	if (err) {
+		errno = err;
+		die(name);
+	}
+	return fd;
+}
+
+static void fill_ctl(struct ploop_ctl_delta *req, int fd, int format)
+{
+	memset(req, 0, sizeof(*req));
+	req->c.pctl_format = format;
+	req->c.pctl_cluster_log = cluster_log;
+	req->c.pctl_chunks = 1;
+	req->f.pctl_fd = fd;
+	req->f.pctl_type = io_type;
+}
+
+static void attach(void)
+{
+	struct ploop_ctl_delta req;
+	const char *p;
+	int fd;
+
+	images[0] = image_name(0);
+	if (fmt == PLOOP_FMT_RAW)
+		fd = create_raw(images[0]);
+	else
+		fd = create_ploop1(images[0]);
+	nr_images = 1;
+
+	ctl_fd = open(dev_path, O_RDONLY);
+	if (ctl_fd < 0)
+		die(dev_path);
+
+	fill_ctl(&req, fd, fmt);
+	if (ioctl(ctl_fd, PLOOP_IOC_ADD_DELTA, &req) < 0)
+		die("PLOOP_IOC_ADD_DELTA");
+	close(fd);
+	if (ioctl(ctl_fd, PLOOP_IOC_START, 0) < 0)
+		die("PLOOP_IOC_START");
+
+	p = strrchr(dev_path, '/');
+	snprintf(stat_dir, sizeof(stat_dir), "/sys/block/%s/pstat",
+		 p ? p + 1 : dev_path);
+}
+
+static void detach(void)
+{
+	int i;
+
+	if (ctl_fd >= 0) {
+		ioctl(ctl_fd, PLOOP_IOC_STOP, 0);
+		if (ioctl(ctl_fd, PLOOP_IOC_CLEAR, 0) < 0)
+			perror("ploop_bench: PLOOP_IOC_CLEAR");
+		close(ctl_fd);
+		ctl_fd = -1;
+	}
+
+	for (i = 0; i < nr_images; i++) {
+		if (!keep_images)
+			unlink(images[i]);
+		free(images[i]);
+	}
+	nr_images = 0;
+}
+
+/* Take a snapshot: a new empty ploop1 delta on top. Returns duration */
+static uint64_t snapshot(void)
+{
+	struct ploop_ctl_delta req;
+	uint64_t start;
+	int fd;
+
+	if (nr_images > MAX_SNAPSHOTS) {
+		fprintf(stderr, "ploop_bench: too many snapshots\n");
+		exit(1);
+	}
+	images[nr_images] = image_name(nr_images);
+	fd = create_ploop1(images[nr_images]);
+
+	fill_ctl(&req, fd, PLOOP_FMT_PLOOP1);
+	start = now_ns();
+	if (ioctl(ctl_fd, PLOOP_IOC_SNAPSHOT, &req) < 0)
+		die("PLOOP_IOC_SNAPSHOT");
+	start = now_ns() - start;
+	close(fd);
+	nr_images++;
+	return start;
+}
+
+/* Merge the top delta down and drop its image. Returns duration */
+static uint64_t merge(void)
+{
+	uint64_t start;
+
+	start = now_ns();
+	if (ioctl(ctl_fd, PLOOP_IOC_MERGE, 0) < 0)
+		die("PLOOP_IOC_MERGE");
+	start = now_ns() - start;
+
+	nr_images--;
+	unlink(images[nr_images]);
+	free(images[nr_images]);
+	return start;
+}
+
+struct worker {
+	pthread_t	thread;
+	int		id;
+	int		fd;
+	const struct workload *wl;
+	uint64_t	deadline;
+	unsigned int	seed;
+	uint64_t	*lat;		/* per I/O latency, ns */
+	size_t		nr, max;
+	int		err;
+};
+
+static volatile int stop_workers;
+
+static void record(struct worker *w, uint64_t lat)
+{
+	if (w->nr == w->max) {
+		w->max = w->max ? w->max * 2 : 65536;
+		w->lat = realloc(w->lat, w->max * sizeof(*w->lat));
+		if (!w->lat)
+			die("realloc");
+	}
+	w->lat[w->nr++] = lat;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	const struct workload *wl = w->wl;
+	unsigned long long nr_blocks = dev_size / wl->bs;
+	unsigned long long span = nr_blocks / nr_threads;
+	unsigned long long blk = 0;
+	void *buf;
+	ssize_t ret;
+
+	if (posix_memalign(&buf, 4096, wl->bs))
+		die("posix_memalign");
+	memset(buf, 0x5a + w->id, wl->bs);
+
+	if (!span)
+		span = 1;
+
+	while (!stop_workers && now_ns() < w->deadline) {
+		off_t off;
+		uint64_t start;
+
+		if (wl->random)
+			off = (off_t)(((unsigned long long)rand_r(&w->seed) <<
+				       31 | rand_r(&w->seed)) % nr_blocks);
+		else
+			off = (off_t)(w->id * span + blk++ % span);
+		off *= wl->bs;
+
+		start = now_ns();
+		if (wl->write)
+			ret = pwrite(w->fd, buf, wl->bs, off);
+		else
+			ret = pread(w->fd, buf, wl->bs, off);
+		if (ret == wl->bs && wl->fsync && fdatasync(w->fd))
+			ret = -1;
+		if (ret != wl->bs) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+		record(w, now_ns() - start);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct_us(uint64_t *lat, size_t nr, double pct)
+{
+	size_t i;
+
+	if (!nr)
+		return 0;
+	i = (size_t)(nr * pct / 100.0);
+	if (i >= nr)
+		i = nr - 1;
+	return lat[i] / 1000.0;
+}
+
+static void run_workload(enum workload_type type)
+{
+	const struct workload *wl = &workloads[type];
+	static unsigned int st_before[NR_STATS], st_after[NR_STATS];
+	struct worker w[MAX_THREADS];
+	uint64_t start, elapsed, cpu, maint_ns = 0;
+	uint64_t *lat;
+	size_t nr = 0;
+	unsigned int i;
+	int err = 0;
+
+	/* merge needs something to merge, let writes pile up in a delta */
+	if (type == WL_MERGE && nr_images < 2)
+		snapshot();
+
+	memset(w, 0, sizeof(w));
+	stop_workers = 0;
+	read_stats(st_before);
+	cpu = cpu_busy_us();
+	start = now_ns();
+
+	for (i = 0; i < nr_threads; i++) {
+		w[i].id = i;
+		w[i].wl = wl;
+		w[i].seed = 0x1234567 * (i + 1);
+		w[i].deadline = start + runtime * 1000000000ULL;
+		w[i].fd = open(dev_path, (wl->write ? O_RDWR : O_RDONLY) |
+			       O_DIRECT);
+		if (w[i].fd < 0)
+			die(dev_path);
+		if (pthread_create(&w[i].thread, NULL, worker_fn, &w[i]))
+			die("pthread_create");
+	}
+
+	if (type == WL_SNAPSHOT) {
+		usleep(runtime * 500000);
+		maint_ns = snapshot();
+	} else if (type == WL_MERGE) {
+		usleep(runtime * 500000);
+		maint_ns = merge();
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		close(w[i].fd);
+		nr += w[i].nr;
+		if (w[i].err)
+			err = w[i].err;
+	}
+	elapsed = now_ns() - start;
+	cpu = cpu_busy_us() - cpu;
+	read_stats(st_after);
+
+	lat = malloc((nr ? nr : 1) * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+	for (nr = 0, i = 0; i < nr_threads; i++) {
+		memcpy(lat + nr, w[i].lat, w[i].nr * sizeof(*lat));
+		nr += w[i].nr;
+		free(w[i].lat);
+	}
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+
+	printf("ploop_bench: fmt=%s io=%s wl=%s bs=%u threads=%u",
+	       fmt == PLOOP_FMT_RAW ? "raw" : "ploop1",
+	       io_type == PLOOP_IO_KAIO ? "kaio" : "direct",
+	       wl->name, wl->bs, nr_threads);
+	printf(" ops=%zu iops=%.0f mbps=%.1f", nr,
+	       nr * 1e9 / elapsed, (double)nr * wl->bs * 1e3 / elapsed);
+	printf(" lat_p50_us=%.1f lat_p90_us=%.1f lat_p99_us=%.1f"
+	       " lat_p999_us=%.1f lat_max_us=%.1f",
+	       pct_us(lat, nr, 50), pct_us(lat, nr, 90),
+	       pct_us(lat, nr, 99), pct_us(lat, nr, 99.9),
+	       pct_us(lat, nr, 100));
+	printf(" cpu_us_per_io=%.2f", nr ? (double)cpu / nr : 0.0);
+	if (maint_ns)
+		printf(" %s_ms=%.1f", wl->name, maint_ns / 1e6);
+	for (i = 0; i < NR_STATS; i++)
+		if (st_after[i] != st_before[i])
+			printf(" %s=%u", stat_names[i],
+			       st_after[i] - st_before[i]);
+	if (err)
+		printf(" error=%s", strerror(err));
+	printf("\n");
+	fflush(stdout);
+
+	free(lat);
+	if (err)
+		exit(1);
+}
+
+static void parse_workloads(char *list)
+{
+	char *tok;
+	int i;
+
+	wl_mask = 0;
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		for (i = 0; i < WL_MAX; i++)
+			if (!strcmp(tok, workloads[i].name))
+				break;
+		if (i == WL_MAX) {
+			fprintf(stderr, "ploop_bench: unknown workload %s\n",
+				tok);
+			exit(1);
+		}
+		wl_mask |= 1 << i;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct utsname uts;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "d:D:f:e:s:c:t:j:w:kh")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'D':
+			image_dir = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "raw"))
+				fmt = PLOOP_FMT_RAW;
+			else if (!strcmp(optarg, "ploop1"))
+				fmt = PLOOP_FMT_PLOOP1;
+			else
+				goto usage;
+			break;
+		case 'e':
+			if (!strcmp(optarg, "direct"))
+				io_type = PLOOP_IO_DIRECT;
+			else if (!strcmp(optarg, "kaio"))
+				io_type = PLOOP_IO_KAIO;
+			else
+				goto usage;
+			break;
+		case 's':
+			dev_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'c':
+			cluster_log = atoi(optarg);
+			break;
+		case 't':
+			runtime = atoi(optarg);
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'w':
+			parse_workloads(optarg);
+			break;
+		case 'k':
+			keep_images = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (!dev_path || !dev_size || !runtime ||
+	    !nr_threads || nr_threads > MAX_THREADS)
+		goto usage;
+	if (dev_size & ((1ULL << (cluster_log + 9)) - 1)) {
+		fprintf(stderr, "ploop_bench: size must be cluster aligned\n");
+		return 1;
+	}
+
+	uname(&uts);
+	printf("ploop_bench: kernel=%s machine=%s size_mb=%llu "
+	       "cluster_log=%u runtime=%u\n", uts.release, uts.machine,
+	       dev_size >> 20, cluster_log, runtime);
+
+	atexit(detach);
+	attach();
+	for (i = 0; i < WL_MAX; i++)
+		if (wl_mask & (1 << i))
+			run_workload(i);
+	return 0;
+
+usage:
+	fprintf(stderr, usage, argv[0]);
+	return 1;
+}
@@ -0,0 +1,499 @@
+/*
+ * ve_density - container lifecycle latency versus container density
+ *
+ * Copyright (c) 2015 Parallels IP Holdings GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Starts minimal containers through the ve cgroup interface (ve.veid,
+ * ve.state) in steps, up to the requested number. The containers of a
+ * step are left running, so every step raises the density. At each
+ * density level a few probe containers are run through the whole
+ * lifecycle and the latency of every phase is reported:
+ *
+ *	create	mkdir of the ve cgroup and setting ve.veid
+ *	start	clone of the init with new namespaces, attach, "START"
+ *	suspend	freezing the container's freezer cgroup
+ *	resume	thawing it
+ *	stop	killing the init until ve.state reads STOPPED
+ *	destroy	rmdir of the cgroups
+ *
+ * When the kernel has CONFIG_LOCK_STAT, contention of the locks the
+ * lifecycle is known to serialize on is reported for every level too.
+ * Output is one key=value line per phase and per lock, so that runs
+ * can be compared between kernels.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+#define STACK_SIZE	(64 * 1024)
+#define MAX_PROBES	64
+#define MAX_LOCKS	32
+
+enum phase {
+	PH_CREATE,
+	PH_START,
+	PH_SUSPEND,
+	PH_RESUME,
+	PH_STOP,
+	PH_DESTROY,
+	PH_MAX,
+};
+
+static const char *phase_names[PH_MAX] = {
+	"create", "start", "suspend", "resume", "stop", "destroy",
+};
+
+struct ve {
+	int		veid;
+	pid_t		init;
+	char		ve_cg[256];
+	char		fr_cg[256];
+	bool		frozen_cg;
+};
+
+static const char *usage =
+"Usage: %s [options]\n"
+"\n"
+"	-n nr	number of running containers to reach (default: 200)\n"
+"	-s nr	containers started per density step (default: 50)\n"
+"	-p nr	probe lifecycles at every step (default: 10)\n"
+"	-b id	first veid to use (default: 100000)\n"
+"	-V dir	ve cgroup mount (default: /sys/fs/cgroup/ve)\n"
+"	-F dir	freezer cgroup mount (default: /sys/fs/cgroup/freezer)\n"
+"	-l list	comma separated lock classes to report (default:\n"
+"		cgroup_mutex,net_mutex,namespace_sem,ve_hook_sem,\n"
+"		ve_list_lock,rtnl_mutex)\n";
+
+static int max_ves = 200;
+static int step = 50;
+static int nr_probes = 10;
+static int next_veid = 100000;
+static const char *ve_root = "/sys/fs/cgroup/ve";
+static const char *freezer_root = "/sys/fs/cgroup/freezer";
+static bool have_freezer;
+static bool have_lock_stat;
+
+static char lock_list[512] =
+	"cgroup_mutex,net_mutex,namespace_sem,ve_hook_sem,"
+	"ve_list_lock,rtnl_mutex";
+static char *locks[MAX_LOCKS];
+static int nr_locks;
+
+static struct ve *ves;
+static int nr_ves;
+
+static void die(const char *what)
+{
+	fprintf(stderr, "ve_density: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_file(const char *dir, const char *file, const char *val)
+{
+	char path[512];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static int read_file(const char *dir, const char *file, char *buf, int len)
+{
+	char path[512];
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+	if (n && buf[n - 1] == '\n')
+		buf[n - 1] = '\0';
+	return 0;
+}
+
+/* Poll a state file until it reads @want */
+static int wait_state(const char *dir, const char *file, const char *want)
+{
+	char buf[64];
+	int i;
+
+	for (i = 0; i < 100000; i++) {
+		if (read_file(dir, file, buf, sizeof(buf)))
+			return -1;
+		if (!strcmp(buf, want))
+			return 0;
+		usleep(100);
+	}
+	fprintf(stderr, "ve_density: %s/%s stuck at %s\n", dir, file, buf);
+	return -1;
+}
+
+struct init_arg {
+	struct ve	*ve;
+	int		pipe;
+};
+
+/* Init of the container: enter the cgroups, start the VE, then idle */
+static int ve_init(void *data)
+{
+	struct init_arg *arg = data;
+	struct ve *ve = arg->ve;
+	int err;
+
+	err = write_file(ve->ve_cg, "tasks", "0");
+	if (!err && ve->frozen_cg)
+		err = write_file(ve->fr_cg, "tasks", "0");
+	if (!err)
+		err = write_file(ve->ve_cg, "ve.state", "START");
+	/* _exit(), the atexit() cleanup belongs to the parent */
+	if (write(arg->pipe, &err, sizeof(err)) != sizeof(err) || err)
+		_exit(1);
+	close(arg->pipe);
+
+	for (;;)
+		pause();
+	return 0;
+}
+
+static void ve_create(struct ve *ve, uint64_t *lat)
+{
+	char buf[32];
+	uint64_t start;
+	int err;
+
+	memset(ve, 0, sizeof(*ve));
+	ve->veid = next_veid++;
+	snprintf(ve->ve_cg, sizeof(ve->ve_cg), "%s/%d", ve_root, ve->veid);
+	snprintf(ve->fr_cg, sizeof(ve->fr_cg), "%s/%d",
+		 freezer_root, ve->veid);
+	snprintf(buf, sizeof(buf), "%d", ve->veid);
+
+	start = now_ns();
+	if (mkdir(ve->ve_cg, 0755))
+		die(ve->ve_cg);
+	err = write_file(ve->ve_cg, "ve.veid", buf);
+	if (err) {
+		errno = -err;
+		die("ve.veid");
+	}
+	if (have_freezer) {
+		if (mkdir(ve->fr_cg, 0755))
+			die(ve->fr_cg);
+		ve->frozen_cg = true;
+	}
+	lat[PH_CREATE] = now_ns() - start;
+}
+
+static void ve_start(struct ve *ve, uint64_t *lat)
+{
+	static char *stack;
+	struct init_arg arg;
+	uint64_t start;
+	int fds[2], err;
+
+	if (!stack) {
+		stack = malloc(STACK_SIZE);
+		if (!stack)
+			die("malloc");
+	}
+	if (pipe(fds))
+		die("pipe");
+	arg.ve = ve;
+	arg.pipe = fds[1];
+
+	start = now_ns();
+	/* the stack is only used until the init blocks in pause() */
+	ve->init = clone(ve_init, stack + STACK_SIZE,
+			 CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWUTS |
+			 CLONE_NEWIPC | CLONE_NEWNET | SIGCHLD, &arg);
+	if (ve->init < 0)
+		die("clone");
+	close(fds[1]);
+	if (read(fds[0], &err, sizeof(err)) != sizeof(err))
+		err = -EIO;
+	close(fds[0]);
+	if (err) {
+		errno = -err;
+		die("ve start");
+	}
+	if (wait_state(ve->ve_cg, "ve.state", "RUNNING"))
+		exit(1);
+	lat[PH_START] = now_ns() - start;
+}
+
+static void ve_suspend_resume(struct ve *ve, uint64_t *lat)
+{
+	uint64_t start;
+
+	if (!ve->frozen_cg)
+		return;
+
+	start = now_ns();
+	if (write_file(ve->fr_cg, "freezer.state", "FROZEN") ||
+	    wait_state(ve->fr_cg, "freezer.state", "FROZEN"))
+		exit(1);
+	lat[PH_SUSPEND] = now_ns() - start;
+
+	start = now_ns();
+	if (write_file(ve->fr_cg, "freezer.state", "THAWED") ||
+	    wait_state(ve->fr_cg, "freezer.state", "THAWED"))
+		exit(1);
+	lat[PH_RESUME] = now_ns() - start;
+}
+
+static void ve_stop(struct ve *ve, uint64_t *lat)
+{
+	uint64_t start;
+	int i;
+
+	start = now_ns();
+	kill(ve->init, SIGKILL);
+	if (waitpid(ve->init, NULL, 0) < 0)
+		die("waitpid");
+	if (wait_state(ve->ve_cg, "ve.state", "STOPPED"))
+		exit(1);
+	lat[PH_STOP] = now_ns() - start;
+
+	start = now_ns();
+	/* the last references go away asynchronously, retry a while */
+	for (i = 0; rmdir(ve->ve_cg); i++) {
+		if (errno != EBUSY || i == 10000)
+			die(ve->ve_cg);
+		usleep(100);
+	}
+	if (ve->frozen_cg && rmdir(ve->fr_cg))
+		die(ve->fr_cg);
+	lat[PH_DESTROY] = now_ns() - start;
+}
+
+static void lock_stat_reset(void)
+{
+	if (have_lock_stat && write_file("/proc", "lock_stat", "0"))
+		have_lock_stat = false;
+}
+
+/*
+ * Lines of /proc/lock_stat look like
+ *   name: con-bounces contentions wait-min wait-max wait-total
+ *         acq-bounces acquisitions hold-min hold-max hold-total
+ * with -W/-R suffixes on the name for rwsems.
+ */
+static void lock_stat_report(int density)
+{
+	char line[512], name[128];
+	unsigned long cb, con, ab, acq;
+	double wmin, wmax, wtot, hmin, hmax, htot;
+	FILE *f;
+	int i;
+
+	if (!have_lock_stat)
+		return;
+	f = fopen("/proc/lock_stat", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *colon = strchr(line, ':');
+		char *p = line;
+
+		if (!colon || colon - line >= (int)sizeof(name) ||
+		    colon[1] != ' ')
+			continue;
+		while (*p == ' ')
+			p++;
+		memcpy(name, p, colon - p);
+		name[colon - p] = '\0';
+
+		for (i = 0; i < nr_locks; i++)
+			if (!strncmp(name, locks[i], strlen(locks[i])) &&
+			    (!name[strlen(locks[i])] ||
+			     name[strlen(locks[i])] == '-'))
+				break;
+		if (i == nr_locks)
+			continue;
+
+		if (sscanf(colon + 1, "%lu %lu %lf %lf %lf %lu %lu %lf %lf %lf",
+			   &cb, &con, &wmin, &wmax, &wtot, &ab, &acq,
+			   &hmin, &hmax, &htot) != 10)
+			continue;
+		printf("ve_density: n=%d lock=%s contentions=%lu "
+		       "wait_max_us=%.2f wait_total_us=%.2f acquisitions=%lu "
+		       "hold_max_us=%.2f hold_total_us=%.2f\n",
+		       density, name, con, wmax, wtot, acq, hmax, htot);
+	}
+	fclose(f);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(int density, uint64_t lat[][PH_MAX], int nr)
+{
+	uint64_t v[MAX_PROBES];
+	int ph, i;
+
+	for (ph = 0; ph < PH_MAX; ph++) {
+		if ((ph == PH_SUSPEND || ph == PH_RESUME) && !have_freezer)
+			continue;
+		for (i = 0; i < nr; i++)
+			v[i] = lat[i][ph];
+		qsort(v, nr, sizeof(v[0]), cmp_u64);
+		printf("ve_density: n=%d phase=%s samples=%d p50_ms=%.3f "
+		       "p90_ms=%.3f max_ms=%.3f\n", density, phase_names[ph],
+		       nr, v[nr / 2] / 1e6, v[nr * 9 / 10] / 1e6,
+		       v[nr - 1] / 1e6);
+	}
+	fflush(stdout);
+}
+
+/* Run the probe lifecycles with @density containers in the background */
+static void probe(int density)
+{
+	static uint64_t lat[MAX_PROBES][PH_MAX];
+	struct ve ve;
+	int i;
+
+	lock_stat_reset();
+	for (i = 0; i < nr_probes; i++) {
+		ve_create(&ve, lat[i]);
+		ve_start(&ve, lat[i]);
+		ve_suspend_resume(&ve, lat[i]);
+		ve_stop(&ve, lat[i]);
+	}
+	report(density, lat, nr_probes);
+	lock_stat_report(density);
+}
+
+static void cleanup(void)
+{
+	uint64_t lat[PH_MAX];
+
+	while (nr_ves)
+		ve_stop(&ves[--nr_ves], lat);
+}
+
+static void parse_locks(void)
+{
+	char *tok;
+
+	for (tok = strtok(lock_list, ","); tok && nr_locks < MAX_LOCKS;
+	     tok = strtok(NULL, ","))
+		locks[nr_locks++] = tok;
+}
+
+int main(int argc, char *argv[])
+{
+	struct utsname uts;
+	struct stat st;
+	uint64_t lat[PH_MAX];
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:p:b:V:F:l:h")) != -1) {
+		switch (c) {
+		case 'n':
+			max_ves = atoi(optarg);
+			break;
+		case 's':
+			step = atoi(optarg);
+			break;
+		case 'p':
+			nr_probes = atoi(optarg);
+			break;
+		case 'b':
+			next_veid = atoi(optarg);
+			break;
+		case 'V':
+			ve_root = optarg;
+			break;
+		case 'F':
+			freezer_root = optarg;
+			break;
+		case 'l':
+			snprintf(lock_list, sizeof(lock_list), "%s", optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (max_ves < 0 || step <= 0 || nr_probes <= 0 ||
+	    nr_probes > MAX_PROBES || next_veid <= 0)
+		goto usage;
+	parse_locks();
+
+	if (stat(ve_root, &st) || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "ve_density: no ve cgroup at %s\n", ve_root);
+		return 1;
+	}
+	have_freezer = !stat(freezer_root, &st) && S_ISDIR(st.st_mode);
+	have_lock_stat = !access("/proc/lock_stat", W_OK);
+	if (have_lock_stat)
+		write_file("/proc/sys/kernel", "lock_stat", "1");
+
+	ves = calloc(max_ves + 1, sizeof(*ves));
+	if (!ves)
+		die("calloc");
+
+	uname(&uts);
+	printf("ve_density: kernel=%s machine=%s max=%d step=%d probes=%d "
+	       "freezer=%d lock_stat=%d\n", uts.release, uts.machine,
+	       max_ves, step, nr_probes, have_freezer, have_lock_stat);
+
+	atexit(cleanup);
+	probe(0);
+	while (nr_ves < max_ves) {
+		int i;
+
+		for (i = 0; i < step && nr_ves < max_ves; i++) {
+			ve_create(&ves[nr_ves], lat);
+			ve_start(&ves[nr_ves], lat);
+			nr_ves++;
+		}
+		probe(nr_ves);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, usage, argv[0]);
+	return 1;
+}